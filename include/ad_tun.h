@@ -9,6 +9,7 @@
 #define AD_TUN_SRC_AD_TUN_H_
 
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 /**
@@ -31,9 +32,21 @@ typedef enum {
     AD_TUN_STATE_INITIALIZED,
     AD_TUN_STATE_RUNNING,
     AD_TUN_STATE_STOPPED,
-    AD_TUN_STATE_ERROR
+    AD_TUN_STATE_ERROR,
+    AD_TUN_STATE_DRAINING      /**< ad_tun_stop_drain() in progress, or ad_tun_stop() waiting for I/O in flight */
 } ad_tun_state_t;
 
+/** Most queues ad_tun_start() opens on one device. */
+#define AD_TUN_MAX_QUEUES 16
+
+/**
+ * @brief Device type created by ad_tun_start().
+ */
+typedef enum {
+    AD_TUN_MODE_TUN = 0,       /**< Layer 3: raw IP packets */
+    AD_TUN_MODE_TAP            /**< Layer 2: Ethernet frames */
+} ad_tun_mode_t;
+
 /**
  * @brief Configuration parameters for initializing a TUN interface.
  *
@@ -46,8 +59,30 @@ typedef struct {
     const char *ipv6;    /**< IPv6 address (e.g., "fd00::1/64") */
     int mtu;             /**< MTU value */
     int persist;         /**< Whether the TUN device should persist after close */
+    int fragment;        /**< Fragment oversized datagrams in ad_tun_write() */
+    int reassemble;      /**< Reassemble IP fragments in ad_tun_read() */
+    int offload;         /**< Prefix packets with a virtio-net header (IFF_VNET_HDR) */
+    int mode;            /**< ad_tun_mode_t */
+    const char *mac;     /**< TAP MAC address "xx:xx:xx:xx:xx:xx", NULL = kernel-chosen */
+    int queues;          /**< Queues to open (IFF_MULTI_QUEUE when > 1), 0 = 1 */
 } ad_tun_config_t;
 
+/**
+ * @brief Packet buffer shared by the buffer pool and packet processing stages.
+ *
+ * Packet bytes live in [data, data + len) inside the storage block
+ * [head, head + size). The gap between head and data is headroom that a
+ * stage may use to prepend headers without moving the payload.
+ */
+typedef struct ad_tun_buf {
+    struct ad_tun_buf *next;  /**< Link for free lists and queues, owned by the holder */
+    unsigned char *head;      /**< Start of the storage block */
+    unsigned char *data;      /**< Start of packet data */
+    size_t len;               /**< Packet length in bytes */
+    size_t size;              /**< Size of the storage block */
+    uint64_t ts;              /**< Arrival timestamp for latency instrumentation, 0 = none */
+} ad_tun_buf_t;
+
 /**
  * @brief Load AD-TUN configuration from an INI file.
  *
@@ -66,6 +101,42 @@ ad_tun_error_t ad_tun_load_config(const char *path, ad_tun_config_t *out_cfg);
  */
 void ad_tun_free_config(ad_tun_config_t *cfg);
 
+/**
+ * @brief Tunnel configurations loaded from one multi-section INI file.
+ *
+ * The array and every string it points to live in a single allocation.
+ */
+typedef struct {
+    ad_tun_config_t *tuns;    /**< count entries, in file order */
+    unsigned count;
+    void *arena;              /**< Block holding tuns and their strings */
+} ad_tun_config_set_t;
+
+/**
+ * @brief Load every tunnel section of an INI file in one pass.
+ *
+ * Each `[tun:NAME]` section declares one tunnel; ifname defaults to NAME.
+ * A plain `[ad_tun]` section is accepted as one more tunnel. Keys missing
+ * from a tunnel section are taken from the `[defaults]` section wherever
+ * it appears in the file. Repeated sections continue the same tunnel;
+ * other sections are ignored. Values are validated as by
+ * ad_tun_load_config().
+ *
+ * @param path Path to the INI configuration file.
+ * @param out_set Caller-allocated set to fill.
+ *
+ * @return AD_TUN_OK, or AD_TUN_ERR_CONFIG if the file cannot be parsed,
+ *         declares no tunnel or a tunnel lacks ifname or ipv4.
+ *
+ * @note Free with ad_tun_free_config_set(), never ad_tun_free_config().
+ */
+ad_tun_error_t ad_tun_load_config_set(const char *path, ad_tun_config_set_t *out_set);
+
+/**
+ * @brief Free a set filled by ad_tun_load_config_set().
+ */
+void ad_tun_free_config_set(ad_tun_config_set_t *set);
+
 /**
  * @brief Initialize the TUN interface with the given configuration.
  *
@@ -86,6 +157,9 @@ ad_tun_error_t ad_tun_start(void);
 /**
  * @brief Stop the TUN interface and bring it down.
  *
+ * New reads and writes are refused at once; reads and writes already in
+ * progress finish before the queues are closed.
+ *
  * @return AD_TUN_OK on success, error code on failure.
  */
 ad_tun_error_t ad_tun_stop(void);
@@ -97,6 +171,66 @@ ad_tun_error_t ad_tun_stop(void);
  */
 ad_tun_error_t ad_tun_restart(void);
 
+/**
+ * @brief Called by ad_tun_stop_drain() to flush the caller's write queues.
+ *
+ * Writes made from inside the callback are still accepted.
+ *
+ * @return Packets still queued (0 when flushed), or -errno to give up.
+ */
+typedef int (*ad_tun_drain_flush_fn)(void *arg);
+
+/**
+ * @brief Receives each packet left in the kernel queues during a drain.
+ */
+typedef void (*ad_tun_drain_rx_fn)(void *arg, const char *buf, size_t len);
+
+/**
+ * @brief Options for ad_tun_stop_drain().
+ */
+typedef struct {
+    int timeout_ms;                 /**< Budget for in-flight I/O and flushing, -1 = forever */
+    ad_tun_drain_flush_fn flush;    /**< Optional, called until it returns <= 0 */
+    void *flush_arg;
+    ad_tun_drain_rx_fn on_rx;       /**< Optional, NULL discards the packets read out */
+    void *rx_arg;
+} ad_tun_drain_opts_t;
+
+/**
+ * @brief What ad_tun_stop_drain() managed to do.
+ */
+typedef struct {
+    uint64_t rx_drained;            /**< Packets read out of the kernel queues */
+    unsigned inflight_at_timeout;   /**< I/O calls still running when the timeout ran out (0 if it did not) */
+    int flush_left;                 /**< Last flush return value (0 = flushed), -ETIMEDOUT if never called */
+    int timed_out;                  /**< The timeout cut the drain short */
+} ad_tun_drain_result_t;
+
+/**
+ * @brief Stop the TUN interface without losing packets.
+ *
+ * New reads and writes fail with -ESHUTDOWN (state AD_TUN_STATE_DRAINING),
+ * calls already inside ad_tun_read()/ad_tun_write() and friends are waited
+ * for, opts->flush is called until the caller's queues are empty, the link
+ * is brought down and every packet still queued by the kernel is passed to
+ * opts->on_rx. Only then are the queues closed. When timeout_ms runs out
+ * the remaining steps are cut short, but the close still waits for calls
+ * already in progress; they do not block, as the descriptors are
+ * non-blocking, so this wait is short.
+ *
+ * @param opts   Drain options, NULL = wait forever, no callbacks.
+ * @param result Optional, filled in when the device was stopped.
+ * @return AD_TUN_OK on success, error code on failure.
+ */
+ad_tun_error_t ad_tun_stop_drain(const ad_tun_drain_opts_t *opts, ad_tun_drain_result_t *result);
+
+/**
+ * @brief ad_tun_stop_drain() + ad_tun_start().
+ *
+ * @return AD_TUN_OK on success, error code on failure.
+ */
+ad_tun_error_t ad_tun_restart_drain(const ad_tun_drain_opts_t *opts, ad_tun_drain_result_t *result);
+
 /**
  * @brief Cleanup resources and close the TUN device.
  *
@@ -109,6 +243,12 @@ ad_tun_error_t ad_tun_cleanup(void);
 /**
  * @brief Read raw IP packets from the TUN interface.
  *
+ * In TAP mode each read returns one Ethernet frame.
+ *
+ * When reassembly is enabled, fragments are absorbed into the reassembly
+ * cache and -EAGAIN is returned until a datagram is complete, at which point
+ * the whole datagram is returned in buf.
+ *
  * @param buf Buffer to write into.
  * @param buf_len Size of the buffer.
  * @return Number of bytes read, or negative on error.
@@ -118,12 +258,110 @@ ssize_t ad_tun_read(char *buf, size_t buf_len);
 /**
  * @brief Write raw IP packets to the TUN interface.
  *
+ * In TAP mode buf holds one Ethernet frame.
+ *
+ * When fragmentation is enabled, datagrams larger than the configured MTU
+ * are split into fragments that are written one by one. If a fragment
+ * after the first cannot be written the datagram is dropped with -EIO.
+ *
  * @param buf Packet buffer.
  * @param buf_len Packet length.
  * @return Number of bytes written, or negative on error.
  */
 ssize_t ad_tun_write(const char *buf, size_t buf_len);
 
+/**
+ * @brief virtio-net header as exchanged with an IFF_VNET_HDR device.
+ *
+ * Same layout as struct virtio_net_hdr from <linux/virtio_net.h>, in native
+ * byte order.
+ */
+typedef struct {
+    uint8_t flags;         /**< AD_TUN_VNET_F_* */
+    uint8_t gso_type;      /**< AD_TUN_GSO_* */
+    uint16_t hdr_len;      /**< Length of IP + L4 headers */
+    uint16_t gso_size;     /**< Payload bytes per segment */
+    uint16_t csum_start;   /**< Offset where checksumming starts */
+    uint16_t csum_offset;  /**< Offset of the checksum field from csum_start */
+} ad_tun_vnet_hdr_t;
+
+#define AD_TUN_VNET_F_NEEDS_CSUM 1  /**< Checksum must be completed from csum_start */
+#define AD_TUN_VNET_F_DATA_VALID 2  /**< Checksum was verified by the sender */
+
+#define AD_TUN_GSO_NONE  0          /**< Not a GSO packet */
+#define AD_TUN_GSO_TCPV4 1          /**< IPv4 TCP segmentation */
+#define AD_TUN_GSO_UDP   3          /**< UDP fragmentation offload */
+#define AD_TUN_GSO_TCPV6 4          /**< IPv6 TCP segmentation */
+
+/**
+ * @brief Write a packet described by a virtio-net header.
+ *
+ * With 'offload' enabled the header is passed to the kernel as-is, so a
+ * TCP super-packet with gso_type/gso_size set is segmented by the kernel.
+ * Without 'offload' only headers with gso_type NONE are accepted.
+ *
+ * @param hdr virtio-net header describing the packet.
+ * @param buf Packet buffer.
+ * @param buf_len Packet length.
+ * @return Number of bytes written, or negative on error.
+ */
+ssize_t ad_tun_write_gso(const ad_tun_vnet_hdr_t *hdr, const char *buf, size_t buf_len);
+
+/**
+ * @brief Read up to count packets into caller-supplied buffers.
+ *
+ * Each packet is read into bufs[i]->data using all space up to the end of
+ * the buffer, and bufs[i]->len is set to its length. Reading stops early
+ * when the device has no more packets queued.
+ *
+ * @param bufs Array of buffers, typically taken from an ad_tun_pool_t.
+ * @param count Number of buffers in bufs.
+ * @return Number of packets read (>0), or negative on error
+ *         (-EAGAIN if no packet was available).
+ */
+int ad_tun_read_batch(ad_tun_buf_t **bufs, unsigned count);
+
+/**
+ * @brief Write count packets from caller-supplied buffers.
+ *
+ * @param bufs Array of buffers holding packets in [data, data + len).
+ * @param count Number of buffers in bufs.
+ * @return Number of packets written (>0), or negative on error if the
+ *         first write failed. A short count means the device stopped
+ *         accepting packets (e.g. -EAGAIN on the next one).
+ */
+int ad_tun_write_batch(ad_tun_buf_t *const *bufs, unsigned count);
+
+/**
+ * @brief ad_tun_read_batch() on queue q of a multi-queue device.
+ *
+ * Queue 0 is the descriptor returned by ad_tun_get_fd(). Each queue is
+ * meant to be served by one worker thread.
+ *
+ * @return As ad_tun_read_batch(); -EINVAL if q is not an open queue.
+ */
+int ad_tun_read_batch_queue(unsigned q, ad_tun_buf_t **bufs, unsigned count);
+
+/**
+ * @brief ad_tun_write_batch() on queue q of a multi-queue device.
+ *
+ * @return As ad_tun_write_batch(); -EINVAL if q is not an open queue.
+ */
+int ad_tun_write_batch_queue(unsigned q, ad_tun_buf_t *const *bufs, unsigned count);
+
+/**
+ * @brief Attach or detach queue q (TUNSETQUEUE).
+ *
+ * A detached queue keeps its descriptor but the kernel stops steering
+ * packets to it, so its worker can sleep. Needs queues > 1.
+ *
+ * @param q Queue index, below ad_tun_get_num_queues().
+ * @param on 1 = IFF_ATTACH_QUEUE, 0 = IFF_DETACH_QUEUE.
+ * @return AD_TUN_OK, AD_TUN_ERR_INVALID_STATE if not running,
+ *         AD_TUN_ERR_CONFIG for a bad q, AD_TUN_ERR_SYS if the ioctl fails.
+ */
+ad_tun_error_t ad_tun_set_queue_enabled(unsigned q, int on);
+
 /**
  * @brief Get the TUN file descriptor for event loops or polling.
  *
@@ -131,6 +369,20 @@ ssize_t ad_tun_write(const char *buf, size_t buf_len);
  */
 int ad_tun_get_fd(void);
 
+/**
+ * @brief Get the number of open queues.
+ *
+ * @return Queue count, or 0 if not running.
+ */
+int ad_tun_get_num_queues(void);
+
+/**
+ * @brief Get the file descriptor of queue q.
+ *
+ * @return File descriptor, or -1 if not running or q is out of range.
+ */
+int ad_tun_get_queue_fd(unsigned q);
+
 /**
  * @brief Get a copy of the configuration used to initialize the interface.
  *
@@ -173,4 +425,20 @@ const char* ad_tun_get_ipv6(void);
  */
 ad_tun_state_t ad_tun_get_state(void);
 
+/**
+ * @brief Write-path fragmentation counters, cumulative over the process.
+ */
+typedef struct {
+    uint64_t fragmented;    /**< Datagrams written as fragments */
+    uint64_t partial;       /**< Datagrams dropped after some of their fragments were written */
+} ad_tun_frag_stats_t;
+
+/**
+ * @brief Copy the write-path fragmentation counters.
+ *
+ * A fragmented write that fails after its first fragment went out returns
+ * -EIO and counts as partial; only a failure before it returns -EAGAIN.
+ */
+void ad_tun_get_frag_stats(ad_tun_frag_stats_t *stats);
+
 #endif
@@ -0,0 +1,623 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun C++ Coroutines     **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_HPP_
+#define AD_TUN_SRC_AD_TUN_HPP_
+
+#if __cplusplus < 202002L
+#error "ad_tun.hpp requires C++20"
+#endif
+
+extern "C" {
+#include "ad_tun.h"
+#include "ad_tun_pool.h"
+#include "ad_tun_mgr.h"
+}
+
+#include <cerrno>
+#include <coroutine>
+#include <cstring>
+#include <exception>
+#include <list>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+/**
+ * Header-only C++20 layer over the C API.
+ *
+ * A scheduler owns an epoll set and runs coroutines on the calling thread.
+ * Tunnel handles expose awaitable read_batch()/write_batch() that work on
+ * spans of pool buffers, so packets are never copied and no allocation
+ * happens per call: the non-blocking attempt is made first and the
+ * coroutine is parked only on EAGAIN, with the retry made by the scheduler
+ * before it is resumed. Lifecycle errors throw ad_tun::error; I/O returns
+ * counts or negative errnos like the C functions.
+ */
+namespace ad_tun {
+
+/**
+ * @brief Lifecycle failure of the C API.
+ */
+class error : public std::runtime_error {
+public:
+    error(ad_tun_error_t code, const std::string &what)
+        : std::runtime_error(what), code_(code) {}
+
+    ad_tun_error_t code() const noexcept { return code_; }
+
+private:
+    ad_tun_error_t code_;
+};
+
+template <class T = void> class task;
+class scheduler;
+
+namespace detail {
+
+struct promise_base {
+    std::coroutine_handle<> cont = std::noop_coroutine();
+    std::exception_ptr exc;
+
+    struct final_awaiter {
+        bool await_ready() noexcept { return false; }
+        template <class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+        {
+            return h.promise().cont;
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() noexcept { exc = std::current_exception(); }
+};
+
+/* Operation parked on an fd; retried by the scheduler on readiness */
+struct io_waiter {
+    std::coroutine_handle<> handle;
+    virtual bool attempt() = 0;     /* true once the operation is complete */
+protected:
+    ~io_waiter() = default;
+};
+
+} // namespace detail
+
+/**
+ * @brief Lazily started coroutine returning T.
+ *
+ * Runs when awaited (or when handed to a scheduler) and resumes its awaiter
+ * directly on completion. Exceptions propagate to the awaiter.
+ */
+template <class T>
+class task {
+public:
+    struct promise_type : detail::promise_base {
+        std::optional<T> value;
+
+        task get_return_object() { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        template <class U> void return_value(U &&v) { value.emplace(std::forward<U>(v)); }
+    };
+
+    task(task &&o) noexcept : h_(std::exchange(o.h_, {})) {}
+    task &operator=(task &&o) noexcept
+    {
+        if (this != &o) {
+            if (h_) h_.destroy();
+            h_ = std::exchange(o.h_, {});
+        }
+        return *this;
+    }
+    ~task() { if (h_) h_.destroy(); }
+
+    bool done() const noexcept { return !h_ || h_.done(); }
+
+    auto operator co_await() && noexcept
+    {
+        struct awaiter {
+            std::coroutine_handle<promise_type> h;
+            bool await_ready() noexcept { return h.done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept
+            {
+                h.promise().cont = c;
+                return h;
+            }
+            T await_resume()
+            {
+                if (h.promise().exc) std::rethrow_exception(h.promise().exc);
+                return std::move(*h.promise().value);
+            }
+        };
+        return awaiter{h_};
+    }
+
+private:
+    friend class scheduler;
+    explicit task(std::coroutine_handle<promise_type> h) : h_(h) {}
+
+    T result()
+    {
+        if (h_.promise().exc) std::rethrow_exception(h_.promise().exc);
+        return std::move(*h_.promise().value);
+    }
+
+    std::coroutine_handle<promise_type> h_;
+};
+
+template <>
+class task<void> {
+public:
+    struct promise_type : detail::promise_base {
+        task get_return_object() { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        void return_void() noexcept {}
+    };
+
+    task(task &&o) noexcept : h_(std::exchange(o.h_, {})) {}
+    task &operator=(task &&o) noexcept
+    {
+        if (this != &o) {
+            if (h_) h_.destroy();
+            h_ = std::exchange(o.h_, {});
+        }
+        return *this;
+    }
+    ~task() { if (h_) h_.destroy(); }
+
+    bool done() const noexcept { return !h_ || h_.done(); }
+
+    auto operator co_await() && noexcept
+    {
+        struct awaiter {
+            std::coroutine_handle<promise_type> h;
+            bool await_ready() noexcept { return h.done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept
+            {
+                h.promise().cont = c;
+                return h;
+            }
+            void await_resume()
+            {
+                if (h.promise().exc) std::rethrow_exception(h.promise().exc);
+            }
+        };
+        return awaiter{h_};
+    }
+
+private:
+    friend class scheduler;
+    explicit task(std::coroutine_handle<promise_type> h) : h_(h) {}
+
+    void result()
+    {
+        if (h_.promise().exc) std::rethrow_exception(h_.promise().exc);
+    }
+
+    std::coroutine_handle<promise_type> h_;
+};
+
+/**
+ * @brief Single-threaded epoll scheduler.
+ *
+ * Not thread-safe: run one scheduler per thread and keep each tunnel on
+ * one scheduler. File descriptors are registered edge-triggered on their
+ * first wait and must be forgotten before they are closed.
+ */
+class scheduler {
+public:
+    scheduler() : epfd_(epoll_create1(EPOLL_CLOEXEC))
+    {
+        if (epfd_ < 0) throw std::system_error(errno, std::generic_category(), "epoll_create1");
+    }
+
+    ~scheduler()
+    {
+        spawned_.clear();
+        close(epfd_);
+    }
+
+    scheduler(const scheduler &) = delete;
+    scheduler &operator=(const scheduler &) = delete;
+
+    /**
+     * @brief Start a task that runs until it finishes or the scheduler is destroyed.
+     *
+     * An exception escaping the task is rethrown by run() / run_once().
+     */
+    void spawn(task<void> t)
+    {
+        ready_.push_back(t.h_);
+        spawned_.push_back(std::move(t));
+    }
+
+    /**
+     * @brief Run the loop until t completes and return its result.
+     */
+    template <class T>
+    T run(task<T> t)
+    {
+        ready_.push_back(t.h_);
+        while (!t.done()) {
+            if (!run_once(-1) && !t.done()) {
+                throw std::logic_error("ad_tun::scheduler::run: task can never complete");
+            }
+        }
+        return t.result();
+    }
+
+    /**
+     * @brief Run until every spawned task has finished or waits on something other than I/O.
+     */
+    void run()
+    {
+        while (run_once(-1)) {}
+    }
+
+    /**
+     * @brief Resume every runnable coroutine, then wait up to timeout_ms for I/O once.
+     *
+     * @return false once no coroutine waits for I/O, so nothing can make progress.
+     */
+    bool run_once(int timeout_ms)
+    {
+        drain();
+        if (parked_ == 0) return false;
+
+        epoll_event evs[64];
+        int n = epoll_wait(epfd_, evs, 64, timeout_ms);
+        if (n < 0 && errno != EINTR) throw std::system_error(errno, std::generic_category(), "epoll_wait");
+
+        for (int i = 0; i < n; i++) {
+            fd_state &st = fds_[(size_t)evs[i].data.fd];
+            uint32_t ev = evs[i].events;
+            if ((ev & (EPOLLIN | EPOLLERR | EPOLLHUP)) && st.in) wake(st.in);
+            if ((ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && st.out) wake(st.out);
+        }
+        drain();
+        return true;
+    }
+
+    /**
+     * @brief Drop fd from the epoll set; call before closing it.
+     */
+    void forget(int fd)
+    {
+        if (fd < 0 || (size_t)fd >= fds_.size() || !fds_[(size_t)fd].registered) return;
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+        fds_[(size_t)fd] = fd_state{};
+    }
+
+    /**
+     * @brief Awaitable completing once fd is readable (or writable with out set).
+     */
+    auto wait(int fd, bool out)
+    {
+        struct op : detail::io_waiter {
+            scheduler *s;
+            int fd;
+            bool out;
+            bool attempt() override { return true; }
+            bool await_ready() noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) { handle = h; s->park(fd, out, this); }
+            void await_resume() noexcept {}
+        };
+        op o;
+        o.s = this;
+        o.fd = fd;
+        o.out = out;
+        return o;
+    }
+
+    /** @cond internal */
+    void park(int fd, bool out, detail::io_waiter *w)
+    {
+        if (fd < 0) throw std::invalid_argument("ad_tun::scheduler: bad fd");
+        if ((size_t)fd >= fds_.size()) fds_.resize((size_t)fd + 1);
+        fd_state &st = fds_[(size_t)fd];
+        if (!st.registered) {
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+            ev.data.fd = fd;
+            if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) != 0 && errno != EEXIST) {
+                throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+            }
+            st.registered = true;
+        }
+        detail::io_waiter *&slot = out ? st.out : st.in;
+        if (slot) throw std::logic_error("ad_tun::scheduler: fd already awaited in this direction");
+        slot = w;
+        parked_++;
+    }
+    /** @endcond */
+
+private:
+    struct fd_state {
+        detail::io_waiter *in = nullptr;
+        detail::io_waiter *out = nullptr;
+        bool registered = false;
+    };
+
+    void wake(detail::io_waiter *&slot)
+    {
+        detail::io_waiter *w = slot;
+        if (!w->attempt()) return;      /* spurious edge, stay parked */
+        slot = nullptr;
+        parked_--;
+        ready_.push_back(w->handle);
+    }
+
+    void drain()
+    {
+        while (!ready_.empty()) {
+            std::vector<std::coroutine_handle<>> batch;
+            batch.swap(ready_);
+            for (auto h : batch) h.resume();
+        }
+        for (auto it = spawned_.begin(); it != spawned_.end();) {
+            if (it->done()) {
+                task<void> t = std::move(*it);
+                it = spawned_.erase(it);
+                t.result();
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    int epfd_;
+    std::vector<fd_state> fds_;
+    std::vector<std::coroutine_handle<>> ready_;
+    std::list<task<void>> spawned_;
+    unsigned parked_ = 0;
+};
+
+namespace detail {
+
+/* Awaitable around a non-blocking call returning a count or -errno */
+template <class Fn>
+struct io_op : io_waiter {
+    scheduler *s;
+    int fd;
+    bool out;
+    Fn fn;
+    int res = 0;
+
+    io_op(scheduler *s_, int fd_, bool out_, Fn f) : s(s_), fd(fd_), out(out_), fn(std::move(f)) {}
+
+    bool attempt() override
+    {
+        res = fn();
+        return res != -EAGAIN;
+    }
+    bool await_ready() { return attempt(); }
+    void await_suspend(std::coroutine_handle<> h) { handle = h; s->park(fd, out, this); }
+    int await_resume() const noexcept { return res; }
+};
+
+template <class Fn>
+io_op<Fn> make_io(scheduler *s, int fd, bool out, Fn fn) { return io_op<Fn>(s, fd, out, std::move(fn)); }
+
+/* Write every buffer of bufs, continuing after partial batches; -EAGAIN until done */
+template <class WriteFn>
+int write_all(std::span<ad_tun_buf_t *const> bufs, size_t &done, WriteFn write)
+{
+    while (done < bufs.size()) {
+        int n = write(bufs.data() + done, (unsigned)(bufs.size() - done));
+        if (n == -EAGAIN) return -EAGAIN;
+        if (n < 0) return done ? (int)done : n;
+        done += (size_t)n;
+    }
+    return (int)done;
+}
+
+} // namespace detail
+
+/**
+ * @brief Packet bytes of a pool buffer.
+ */
+inline std::span<unsigned char> packet(ad_tun_buf_t *b) noexcept { return {b->data, b->len}; }
+
+/**
+ * @brief RAII buffer pool.
+ */
+class pool {
+public:
+    pool(unsigned count, size_t buf_size, size_t headroom = 0, const ad_tun_mem_config_t *mem = nullptr)
+    {
+        ad_tun_error_t err = ad_tun_pool_init_numa(&p_, count, buf_size, headroom, mem);
+        if (err != AD_TUN_OK) throw error(err, "ad_tun_pool_init failed");
+    }
+    ~pool() { ad_tun_pool_free(&p_); }
+
+    pool(const pool &) = delete;
+    pool &operator=(const pool &) = delete;
+
+    /** @brief Fill bufs from the pool; returns the filled prefix. */
+    std::span<ad_tun_buf_t *> get(std::span<ad_tun_buf_t *> bufs)
+    {
+        return bufs.first(ad_tun_pool_get_bulk(&p_, bufs.data(), (unsigned)bufs.size()));
+    }
+    void put(std::span<ad_tun_buf_t *const> bufs)
+    {
+        ad_tun_pool_put_bulk(&p_, const_cast<ad_tun_buf_t **>(bufs.data()), (unsigned)bufs.size());
+    }
+    unsigned available() { return ad_tun_pool_available(&p_); }
+    ad_tun_pool_t *get() noexcept { return &p_; }
+
+private:
+    ad_tun_pool_t p_;
+};
+
+/**
+ * @brief The ad_tun_init()/ad_tun_start() interface, started for the handle's lifetime.
+ *
+ * Wraps the process-wide single interface, so only one may exist at a time.
+ */
+class device {
+public:
+    device(scheduler &s, const ad_tun_config_t &cfg) : s_(&s)
+    {
+        ad_tun_error_t err = ad_tun_init(&cfg);
+        if (err != AD_TUN_OK) throw error(err, "ad_tun_init failed");
+        err = ad_tun_start();
+        if (err != AD_TUN_OK) {
+            ad_tun_cleanup();
+            throw error(err, "ad_tun_start failed");
+        }
+        fd_ = ad_tun_get_fd();
+    }
+
+    ~device()
+    {
+        s_->forget(fd_);
+        ad_tun_stop();
+        ad_tun_cleanup();
+    }
+
+    device(const device &) = delete;
+    device &operator=(const device &) = delete;
+
+    int fd() const noexcept { return fd_; }
+
+    /**
+     * @brief Read at least one packet into bufs.
+     *
+     * co_await yields the number of packets read, or a negative errno.
+     */
+    auto read_batch(std::span<ad_tun_buf_t *> bufs)
+    {
+        return detail::make_io(s_, fd_, false, [bufs] {
+            return ad_tun_read_batch(bufs.data(), (unsigned)bufs.size());
+        });
+    }
+
+    /**
+     * @brief Write every packet of bufs.
+     *
+     * co_await yields bufs.size(), the number written before a hard error,
+     * or a negative errno if the first packet failed.
+     */
+    auto write_batch(std::span<ad_tun_buf_t *const> bufs)
+    {
+        return detail::make_io(s_, fd_, true, [bufs, done = size_t(0)]() mutable {
+            return detail::write_all(bufs, done, ad_tun_write_batch);
+        });
+    }
+
+private:
+    scheduler *s_;
+    int fd_ = -1;
+};
+
+/**
+ * @brief One tunnel of a manager.
+ */
+class tunnel {
+public:
+    tunnel(scheduler &s, ad_tun_mgr_t *mgr, unsigned idx) : s_(&s), mgr_(mgr), idx_(idx) {}
+
+    int fd() const noexcept
+    {
+        const ad_tun_mgr_tun_t *t = ad_tun_mgr_get(mgr_, idx_);
+        return t ? t->fd : -1;
+    }
+    unsigned index() const noexcept { return idx_; }
+
+    /** @brief Same contract as device::read_batch(). */
+    auto read_batch(std::span<ad_tun_buf_t *> bufs)
+    {
+        return detail::make_io(s_, fd(), false, [bufs, mgr = mgr_, idx = idx_] {
+            int n = 0;
+            for (ad_tun_buf_t *b : bufs) {
+                ssize_t r = ad_tun_mgr_read(mgr, idx, b->data, (size_t)(b->head + b->size - b->data));
+                if (r < 0) return n ? n : (int)r;
+                b->len = (size_t)r;
+                n++;
+            }
+            return n;
+        });
+    }
+
+    /** @brief Same contract as device::write_batch(). */
+    auto write_batch(std::span<ad_tun_buf_t *const> bufs)
+    {
+        auto write = [mgr = mgr_, idx = idx_](ad_tun_buf_t *const *b, unsigned n) {
+            int done = 0;
+            for (unsigned i = 0; i < n; i++) {
+                ssize_t r = ad_tun_mgr_write(mgr, idx, b[i]->data, b[i]->len);
+                if (r < 0) return done ? done : (int)r;
+                done++;
+            }
+            return done;
+        };
+        return detail::make_io(s_, fd(), true, [bufs, done = size_t(0), write]() mutable {
+            return detail::write_all(bufs, done, write);
+        });
+    }
+
+private:
+    scheduler *s_;
+    ad_tun_mgr_t *mgr_;
+    unsigned idx_;
+};
+
+/**
+ * @brief RAII tunnel manager; every tunnel is stopped and the manager freed on destruction.
+ */
+class manager {
+public:
+    explicit manager(scheduler &s, const ad_tun_mgr_config_t *cfg = nullptr) : s_(&s)
+    {
+        ad_tun_error_t err = ad_tun_mgr_init(&m_, cfg);
+        if (err != AD_TUN_OK) throw error(err, "ad_tun_mgr_init failed");
+    }
+
+    ~manager()
+    {
+        forget_all();
+        ad_tun_mgr_free(&m_);
+    }
+
+    manager(const manager &) = delete;
+    manager &operator=(const manager &) = delete;
+
+    /** @brief Declare a tunnel; returns its index or a negative errno. */
+    int add(const ad_tun_config_t &cfg) { return ad_tun_mgr_add(&m_, &cfg); }
+
+    /** @brief Bring every declared tunnel up; returns how many are up. */
+    int start_all() { return ad_tun_mgr_start_all(&m_); }
+
+    void stop_all()
+    {
+        forget_all();
+        ad_tun_mgr_stop_all(&m_);
+    }
+
+    unsigned size() const noexcept { return m_.count; }
+    tunnel operator[](unsigned idx) { return tunnel(*s_, &m_, idx); }
+    ad_tun_mgr_t *get() noexcept { return &m_; }
+
+private:
+    void forget_all()
+    {
+        for (unsigned i = 0; i < m_.count; i++) s_->forget(m_.tuns[i].fd);
+    }
+
+    scheduler *s_;
+    ad_tun_mgr_t m_;
+};
+
+} // namespace ad_tun
+
+#endif
@@ -0,0 +1,191 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun ACL                **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_ACL_H_
+#define AD_TUN_SRC_AD_TUN_ACL_H_
+
+#include "ad_tun.h"
+#include "ad_tun_pkt.h"
+#include "ad_tun_pool.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+/** Packets read from the device (ad_tun_read()). */
+#define AD_TUN_ACL_RX 0
+/** Packets written to the device (ad_tun_write()). */
+#define AD_TUN_ACL_TX 1
+
+/** Rule index reported for packets that matched no rule. */
+#define AD_TUN_ACL_DEFAULT (-1)
+
+typedef enum {
+    AD_TUN_ACL_ALLOW = 0,
+    AD_TUN_ACL_DROP = 1
+} ad_tun_acl_action_t;
+
+/**
+ * @brief One 5-tuple rule.
+ *
+ * Rules are matched in order and the first match decides. Unset fields
+ * match anything.
+ */
+typedef struct {
+    uint8_t action;             /**< ad_tun_acl_action_t */
+    uint8_t dirs;               /**< Bit (1 << AD_TUN_ACL_RX) and/or (1 << AD_TUN_ACL_TX) */
+    uint8_t family;             /**< AF_INET, AF_INET6 or 0 = both (no address given) */
+    uint8_t proto;              /**< IP protocol, 0 = any */
+    uint8_t src_plen;           /**< Source prefix length, 0 = any */
+    uint8_t dst_plen;           /**< Destination prefix length, 0 = any */
+    uint8_t src[16];            /**< Source prefix, host bits cleared */
+    uint8_t dst[16];            /**< Destination prefix, host bits cleared */
+    uint16_t sport_lo, sport_hi;    /**< Source port range, 0-65535 = any */
+    uint16_t dport_lo, dport_hi;    /**< Destination port range, 0-65535 = any */
+} ad_tun_acl_rule_t;
+
+/**
+ * @brief Ordered rule list, built by hand or with ad_tun_acl_load_config().
+ */
+typedef struct {
+    ad_tun_acl_rule_t *rules;
+    unsigned count;
+    unsigned cap;
+    uint8_t default_action[2];  /**< Per direction, for packets matching no rule */
+} ad_tun_acl_rules_t;
+
+/** Compiled rule set (internal). */
+typedef struct ad_tun_acl_set ad_tun_acl_set_t;
+
+/**
+ * @brief Filter handle shared by the I/O threads.
+ *
+ * Lookups run under the read side of lock and ad_tun_acl_compile() only
+ * takes the write side to swap the set pointer, so a reload never stalls
+ * traffic for longer than one batch.
+ */
+typedef struct {
+    pthread_rwlock_t lock;
+    ad_tun_acl_set_t *set;
+} ad_tun_acl_t;
+
+/**
+ * @brief Per-direction counters of the current rule set.
+ */
+typedef struct {
+    uint64_t packets[2];        /**< Packets evaluated */
+    uint64_t dropped[2];        /**< Packets whose verdict was drop */
+    uint64_t defaults[2];       /**< Packets that matched no rule */
+    unsigned rules;             /**< Rules in the set */
+    unsigned tuples;            /**< Distinct mask combinations searched per lookup at most */
+} ad_tun_acl_stats_t;
+
+/**
+ * @brief Initialize an empty rule list; both defaults are allow.
+ */
+void ad_tun_acl_rules_init(ad_tun_acl_rules_t *rules);
+
+/**
+ * @brief Free a rule list.
+ */
+void ad_tun_acl_rules_free(ad_tun_acl_rules_t *rules);
+
+/**
+ * @brief Append a rule.
+ *
+ * @return 0 or -ENOMEM.
+ */
+int ad_tun_acl_rules_add(ad_tun_acl_rules_t *rules, const ad_tun_acl_rule_t *rule);
+
+/**
+ * @brief Parse "ACTION [rx|tx] [PROTO] [from ADDR] [to ADDR] [sport PORTS] [dport PORTS]".
+ *
+ * ACTION is allow or drop; PROTO is tcp, udp, icmp, icmp6 or a number;
+ * ADDR is a prefix or "any"; PORTS is a port or a LO-HI range. Without
+ * rx or tx the rule applies to both directions.
+ *
+ * @return 0 or -EINVAL.
+ */
+int ad_tun_acl_parse_rule(const char *spec, ad_tun_acl_rule_t *out);
+
+/**
+ * @brief Load rules from the `[acl]` section of an INI file.
+ *
+ * Each `rule = SPEC` line appends one rule; `default = allow|drop`,
+ * `default_rx` and `default_tx` set the defaults.
+ *
+ * @param rules Initialized list the rules are appended to.
+ * @return AD_TUN_OK or AD_TUN_ERR_CONFIG.
+ */
+ad_tun_error_t ad_tun_acl_load_config(const char *path, ad_tun_acl_rules_t *rules);
+
+/**
+ * @brief Initialize a filter with no rule set; everything is allowed.
+ *
+ * @return AD_TUN_OK or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_acl_init(ad_tun_acl_t *acl);
+
+/**
+ * @brief Free a filter and its rule set. No lookup may be running.
+ */
+void ad_tun_acl_free(ad_tun_acl_t *acl);
+
+/**
+ * @brief Compile rules into a tuple-space classifier and swap it in.
+ *
+ * Rules are grouped by their combination of prefix lengths, protocol and
+ * port masks (port ranges are split into prefixes); each group is a hash
+ * table keyed on the masked 5-tuple, so a lookup costs one probe per group
+ * regardless of the number of rules. Lookups in flight finish on the old
+ * set. Hit counters start from zero with the new set.
+ *
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS; the old set stays on failure.
+ */
+ad_tun_error_t ad_tun_acl_compile(ad_tun_acl_t *acl, const ad_tun_acl_rules_t *rules);
+
+/**
+ * @brief Load the `[acl]` section of a file and swap it in.
+ *
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS; the old set stays on failure.
+ */
+ad_tun_error_t ad_tun_acl_reload(ad_tun_acl_t *acl, const char *path);
+
+/**
+ * @brief Classify a batch of parsed packets.
+ *
+ * @param dir AD_TUN_ACL_RX or AD_TUN_ACL_TX.
+ * @param verdicts Receives an ad_tun_acl_action_t per packet.
+ * @param rules Optional; receives the matching rule index or AD_TUN_ACL_DEFAULT.
+ * @return Number of packets allowed.
+ */
+unsigned ad_tun_acl_classify(ad_tun_acl_t *acl, int dir, const ad_tun_pkt_info_t *info, unsigned n,
+                             uint8_t *verdicts, int32_t *rules);
+
+/**
+ * @brief Parse and classify a batch, keeping the allowed packets.
+ *
+ * Dropped packets are prepended to *drops as a chain linked through next;
+ * packets that do not parse take the default action.
+ *
+ * @return Number of allowed packets, compacted at the front of bufs.
+ */
+unsigned ad_tun_acl_filter(ad_tun_acl_t *acl, int dir, ad_tun_buf_t **bufs, unsigned n,
+                           ad_tun_buf_t **drops);
+
+/**
+ * @brief Copy the per-rule hit counters of the current set.
+ *
+ * @return Number of rules in the set (may exceed max).
+ */
+unsigned ad_tun_acl_hits(ad_tun_acl_t *acl, uint64_t *hits, unsigned max);
+
+/**
+ * @brief Counters of the current set.
+ */
+void ad_tun_acl_get_stats(ad_tun_acl_t *acl, ad_tun_acl_stats_t *stats);
+
+#endif
@@ -0,0 +1,154 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Packet Capture     **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_CAPTURE_H_
+#define AD_TUN_SRC_AD_TUN_CAPTURE_H_
+
+#include "ad_tun.h"
+#include "ad_tun_numa.h"
+#include "ad_tun_pkt.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Packet read from the TUN device (sent by the kernel). */
+#define AD_TUN_CAPTURE_RX 0x1
+/** Packet written to the TUN device (received by the kernel). */
+#define AD_TUN_CAPTURE_TX 0x2
+
+/** pcapng link type of TUN packets (raw IPv4/IPv6). */
+#define AD_TUN_CAPTURE_LINK_RAW 101
+/** pcapng link type of TAP frames. */
+#define AD_TUN_CAPTURE_LINK_ETHERNET 1
+
+/**
+ * @brief Packet filter; zero fields match anything.
+ *
+ * Usually built with ad_tun_capture_parse_filter().
+ */
+typedef struct {
+    int family;                 /**< AF_INET / AF_INET6, 0 = any */
+    uint8_t has_proto;          /**< proto is set */
+    uint8_t proto;              /**< IP protocol */
+    uint8_t src[16];            /**< Source network */
+    uint8_t src_plen;           /**< Prefix length, 0 = any */
+    uint8_t dst[16];            /**< Destination network */
+    uint8_t dst_plen;
+    uint8_t host[16];           /**< Network matching either address */
+    uint8_t host_plen;
+    uint8_t src_family;         /**< Address family of src/dst/host */
+    uint8_t dst_family;
+    uint8_t host_family;
+    uint16_t sport;             /**< Source port, 0 = any */
+    uint16_t dport;             /**< Destination port, 0 = any */
+    uint16_t port;              /**< Either port, 0 = any */
+} ad_tun_capture_filter_t;
+
+/**
+ * @brief Capture configuration.
+ */
+typedef struct {
+    const char *path;           /**< pcapng file written by the background thread */
+    const char *ifname;         /**< Interface name recorded in the file, may be NULL */
+    unsigned slots;             /**< Ring slots, rounded up to a power of two */
+    unsigned snaplen;           /**< Bytes kept per packet */
+    unsigned sample;            /**< Keep 1 in sample matching packets, 0 or 1 = all */
+    unsigned directions;        /**< AD_TUN_CAPTURE_RX | AD_TUN_CAPTURE_TX */
+    unsigned linktype;          /**< AD_TUN_CAPTURE_LINK_*, 0 = raw IP */
+    const ad_tun_mem_config_t *mem; /**< Placement of the ring, e.g. the I/O threads' node; NULL = any */
+    ad_tun_capture_filter_t filter;
+} ad_tun_capture_config_t;
+
+/**
+ * @brief Capture counters.
+ */
+typedef struct {
+    uint64_t seen;              /**< Packets offered while enabled */
+    uint64_t filtered;          /**< Rejected by the filter or direction mask */
+    uint64_t sampled_out;       /**< Skipped by sampling */
+    uint64_t dropped;           /**< Ring full */
+    uint64_t written;           /**< Packets written to the file */
+} ad_tun_capture_stats_t;
+
+/**
+ * @brief Nonzero while capturing; read by ad_tun_capture_hook() on the I/O path.
+ */
+extern int ad_tun_capture_active;
+
+/**
+ * @brief Fill cfg with defaults: 4096 slots, 256 byte snaplen, both directions,
+ *        raw IP, no filter.
+ */
+void ad_tun_capture_default_config(ad_tun_capture_config_t *cfg);
+
+/**
+ * @brief Parse a tcpdump-style filter expression.
+ *
+ * Terms joined by "and": ip, ip6, tcp, udp, icmp, icmp6, proto N,
+ * [src|dst] host ADDR, [src|dst] net ADDR/LEN, [src|dst] port N.
+ * An empty or NULL expression matches everything. On Ethernet captures
+ * the terms apply to the IP packet inside the frame and non-IP frames
+ * only match the empty filter.
+ *
+ * @return AD_TUN_OK or AD_TUN_ERR_CONFIG.
+ */
+ad_tun_error_t ad_tun_capture_parse_filter(const char *expr, ad_tun_capture_filter_t *filter);
+
+/**
+ * @brief Match an already parsed packet against a filter.
+ *
+ * @return 1 on a match, 0 otherwise.
+ */
+int ad_tun_capture_filter_match(const ad_tun_capture_filter_t *f, const ad_tun_pkt_info_t *info);
+
+/**
+ * @brief Open the output file, map the ring, start the writer thread and
+ *        enable capturing.
+ *
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG, AD_TUN_ERR_INVALID_STATE (already started)
+ *         or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_capture_start(const ad_tun_capture_config_t *cfg);
+
+/**
+ * @brief Disable capturing, flush the ring to the file and release everything.
+ */
+void ad_tun_capture_stop(void);
+
+/**
+ * @brief Pause (0) or resume (1) a started capture without losing the file.
+ *
+ * @return AD_TUN_OK or AD_TUN_ERR_INVALID_STATE if no capture is started.
+ */
+ad_tun_error_t ad_tun_capture_enable(int on);
+
+/**
+ * @brief Copy the counters of the current (or last) capture.
+ */
+void ad_tun_capture_get_stats(ad_tun_capture_stats_t *stats);
+
+/**
+ * @brief Offer a packet to the capture ring. Never blocks.
+ *
+ * @param dir AD_TUN_CAPTURE_RX or AD_TUN_CAPTURE_TX.
+ * @param pkt Packet starting at the IP header, or at the Ethernet header
+ *            for AD_TUN_CAPTURE_LINK_ETHERNET.
+ * @param len Packet length.
+ */
+void ad_tun_capture_packet(unsigned dir, const void *pkt, size_t len);
+
+/**
+ * @brief I/O path hook: a single predicted-not-taken branch while capture is off.
+ */
+static inline void ad_tun_capture_hook(unsigned dir, const void *pkt, size_t len)
+{
+    if (__builtin_expect(__atomic_load_n(&ad_tun_capture_active, __ATOMIC_RELAXED), 0)) {
+        ad_tun_capture_packet(dir, pkt, len);
+    }
+}
+
+#endif
@@ -0,0 +1,174 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun AEAD Crypto        **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_CRYPTO_H_
+#define AD_TUN_SRC_AD_TUN_CRYPTO_H_
+
+#include "ad_tun.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+/** Tunnel header prepended to every encrypted packet: receiver id (4) + counter (8), big endian. */
+#define AD_TUN_CRYPTO_HDR_LEN 12
+
+/** Authentication tag appended to every encrypted packet. */
+#define AD_TUN_CRYPTO_TAG_LEN 16
+
+/** Total growth of a packet by encryption. */
+#define AD_TUN_CRYPTO_OVERHEAD (AD_TUN_CRYPTO_HDR_LEN + AD_TUN_CRYPTO_TAG_LEN)
+
+/** Words in the replay bitmap; the window covers (words - 1) * 64 counters. */
+#define AD_TUN_REPLAY_WORDS 32
+
+/**
+ * @brief AEAD algorithms.
+ */
+typedef enum {
+    AD_TUN_AEAD_CHACHA20_POLY1305 = 0,  /**< 32-byte key */
+    AD_TUN_AEAD_AES_128_GCM,            /**< 16-byte key */
+    AD_TUN_AEAD_AES_256_GCM             /**< 32-byte key */
+} ad_tun_aead_t;
+
+/**
+ * @brief Sliding anti-replay window (RFC 6479 style bitmap).
+ */
+typedef struct {
+    uint64_t top;                       /**< Highest counter accepted */
+    uint64_t bitmap[AD_TUN_REPLAY_WORDS];
+} ad_tun_replay_t;
+
+/**
+ * @brief Crypto counters.
+ */
+typedef struct {
+    uint64_t encrypted;
+    uint64_t decrypted;
+    uint64_t auth_failed;       /**< Tag mismatch or malformed packet */
+    uint64_t replayed;          /**< Duplicate or too old counter */
+    uint64_t unknown_peer;      /**< Receiver id without a key */
+} ad_tun_crypto_stats_t;
+
+/**
+ * @brief Keys and state of one peer (internal).
+ *
+ * Each direction has its own key and cipher context; the contexts keep the
+ * expanded key so a batch only changes the nonce per packet.
+ */
+typedef struct {
+    int in_use;
+    ad_tun_aead_t alg;
+    uint32_t remote_id;         /**< Receiver id written into outgoing headers */
+    void *tx_ctx;               /**< EVP_CIPHER_CTX */
+    void *rx_ctx;
+    uint64_t tx_counter;        /**< Next counter to send */
+    ad_tun_replay_t replay;
+    pthread_mutex_t tx_lock;
+    pthread_mutex_t rx_lock;    /**< Protects rx_ctx and replay */
+} ad_tun_crypto_peer_t;
+
+/**
+ * @brief Encryption stage for the tunnel data path.
+ *
+ * Packets are encrypted and decrypted in place in pool buffers: the
+ * tunnel header goes into the headroom and the tag into the tailroom, so
+ * pools feeding the encrypt path need AD_TUN_CRYPTO_HDR_LEN bytes of
+ * headroom and AD_TUN_CRYPTO_TAG_LEN spare bytes after the largest packet.
+ * Peers are indexed by the receiver id carried in the header. A batch takes
+ * each peer lock once, so any number of threads may process batches.
+ */
+typedef struct {
+    ad_tun_crypto_peer_t *peers;
+    unsigned max_peers;
+    ad_tun_crypto_stats_t stats;    /**< Updated atomically */
+} ad_tun_crypto_t;
+
+/**
+ * @brief Key length of an algorithm in bytes, 0 if unknown.
+ */
+size_t ad_tun_aead_key_len(ad_tun_aead_t alg);
+
+/**
+ * @brief Initialize a crypto stage with room for peers 0 .. max_peers - 1.
+ *
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_crypto_init(ad_tun_crypto_t *c, unsigned max_peers);
+
+/**
+ * @brief Wipe keys and free the crypto stage.
+ */
+void ad_tun_crypto_free(ad_tun_crypto_t *c);
+
+/**
+ * @brief Install (or rekey) a peer.
+ *
+ * Rekeying resets the send counter and the replay window.
+ *
+ * @param c Crypto stage.
+ * @param local_id Id the peer puts in packets it sends us; selects the slot.
+ * @param remote_id Id we put in packets sent to the peer.
+ * @param alg AEAD algorithm.
+ * @param tx_key Key for packets we send.
+ * @param rx_key Key for packets we receive.
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_crypto_set_peer(ad_tun_crypto_t *c, uint32_t local_id, uint32_t remote_id,
+                                      ad_tun_aead_t alg, const uint8_t *tx_key, const uint8_t *rx_key);
+
+/**
+ * @brief Remove a peer and wipe its keys.
+ */
+void ad_tun_crypto_del_peer(ad_tun_crypto_t *c, uint32_t local_id);
+
+/**
+ * @brief Encrypt a batch of packets for one peer in place.
+ *
+ * On success each buffer holds header + ciphertext + tag, data having moved
+ * back by AD_TUN_CRYPTO_HDR_LEN and len grown by AD_TUN_CRYPTO_OVERHEAD.
+ *
+ * If the cipher fails mid-batch the packets before the failing one stay
+ * encrypted and their count is returned. The failing packet is left
+ * partly overwritten and must be dropped; the ones after it are untouched.
+ *
+ * @param c Crypto stage.
+ * @param local_id Peer slot.
+ * @param bufs Packets, e.g. from ad_tun_read_batch().
+ * @param n Number of packets.
+ * @return Number of packets encrypted from the front of bufs (n unless the
+ *         cipher failed), or -ENOENT (no such peer), -ENOSPC (a buffer
+ *         lacks head- or tailroom; nothing was encrypted), -EOVERFLOW
+ *         (counter exhausted, rekey), -EIO (cipher failure on the first packet).
+ */
+int ad_tun_crypto_encrypt_batch(ad_tun_crypto_t *c, uint32_t local_id,
+                                ad_tun_buf_t **bufs, unsigned n);
+
+/**
+ * @brief Authenticate and decrypt a batch of tunnel packets in place.
+ *
+ * Packets may belong to different peers. Valid packets are stripped to the
+ * inner IP packet and moved, in their original order, to the front of
+ * bufs; rejected ones (unknown peer, bad tag, replay) end up after them, in
+ * no particular order, and can be returned to their pool. No allocation.
+ *
+ * @return Number of valid packets at the front of bufs, or -EINVAL.
+ */
+int ad_tun_crypto_decrypt_batch(ad_tun_crypto_t *c, ad_tun_buf_t **bufs, unsigned n);
+
+/**
+ * @brief Check a counter against a replay window without recording it.
+ *
+ * @return 1 if the counter is acceptable, 0 if it is a replay or too old.
+ */
+int ad_tun_replay_check(const ad_tun_replay_t *r, uint64_t counter);
+
+/**
+ * @brief Record an authenticated counter in a replay window.
+ */
+void ad_tun_replay_update(ad_tun_replay_t *r, uint64_t counter);
+
+#endif
@@ -0,0 +1,150 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Ethernet           **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_ETH_H_
+#define AD_TUN_SRC_AD_TUN_ETH_H_
+
+#include "ad_tun.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AD_TUN_ETH_ALEN 6           /**< Bytes in a MAC address */
+#define AD_TUN_ETH_HLEN 14          /**< Untagged Ethernet header */
+
+#define AD_TUN_ETH_P_IP     0x0800
+#define AD_TUN_ETH_P_ARP    0x0806
+#define AD_TUN_ETH_P_8021Q  0x8100
+#define AD_TUN_ETH_P_8021AD 0x88A8
+#define AD_TUN_ETH_P_IPV6   0x86DD
+
+/** ad_tun_mac_forward(): send to every port but the input one. */
+#define AD_TUN_MAC_FLOOD (-1)
+/** ad_tun_mac_forward(): do not forward. */
+#define AD_TUN_MAC_DROP  (-2)
+
+/**
+ * @brief Parse "xx:xx:xx:xx:xx:xx" (':' or '-' separated).
+ *
+ * @return 0, or -EINVAL if malformed, multicast or all zero.
+ */
+int ad_tun_eth_parse_mac(const char *s, uint8_t mac[AD_TUN_ETH_ALEN]);
+
+/**
+ * @brief Locate the network header of a frame, skipping up to two VLAN tags.
+ *
+ * @param frame Frame starting at the destination MAC.
+ * @param len Frame length.
+ * @param proto Set to the EtherType after the tags, may be NULL.
+ * @param vlan Set to the outer VLAN id, 0 if untagged, may be NULL.
+ * @return Offset of the network header, or -EINVAL if truncated.
+ */
+int ad_tun_eth_l3_offset(const unsigned char *frame, size_t len, uint16_t *proto, uint16_t *vlan);
+
+/**
+ * @brief Offset of the IPv4/IPv6 header of a frame.
+ *
+ * @return Offset, or -EINVAL if the frame does not carry IP.
+ */
+int ad_tun_eth_ip_offset(const unsigned char *frame, size_t len);
+
+/**
+ * @brief MAC learning table tuning.
+ */
+typedef struct {
+    unsigned max_entries;       /**< Addresses learned at most */
+    unsigned age_ms;            /**< Forget an address not seen for this long */
+} ad_tun_mac_config_t;
+
+/**
+ * @brief MAC learning counters.
+ */
+typedef struct {
+    uint64_t learned;           /**< New addresses */
+    uint64_t moved;             /**< Addresses seen on another port */
+    uint64_t aged;              /**< Addresses expired */
+    uint64_t full;              /**< Addresses not learned, table full */
+    uint64_t hits;              /**< Frames forwarded to one port */
+    uint64_t floods;            /**< Broadcast, multicast or unknown destination */
+    uint64_t drops;             /**< Malformed or destined to the input port */
+} ad_tun_mac_stats_t;
+
+/**
+ * @brief Learned address (internal).
+ */
+typedef struct {
+    uint64_t key;               /**< MAC << 16 | VLAN, 0 = empty slot */
+    uint64_t seen_ms;
+    int port;
+} ad_tun_mac_entry_t;
+
+/**
+ * @brief MAC learning table for bridging several TAP devices.
+ *
+ * Addresses are learned per VLAN from source MACs and forgotten after
+ * age_ms. Ports are application-chosen integers >= 0, e.g. manager
+ * tunnel indexes. Not thread-safe: use one table per bridging thread.
+ */
+typedef struct {
+    ad_tun_mac_config_t cfg;
+    ad_tun_mac_entry_t *slots;  /**< Open addressing, linear probing */
+    unsigned mask;
+    unsigned count;
+    ad_tun_mac_stats_t stats;
+} ad_tun_mac_table_t;
+
+/**
+ * @brief Initialize a table. A NULL cfg selects 4096 entries aged after 300 s.
+ *
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_mac_init(ad_tun_mac_table_t *tbl, const ad_tun_mac_config_t *cfg);
+
+/**
+ * @brief Free a table.
+ */
+void ad_tun_mac_free(ad_tun_mac_table_t *tbl);
+
+/**
+ * @brief Record that mac was seen on port.
+ *
+ * @return 0 if new or refreshed, 1 if it moved from another port,
+ *         -ENOSPC if the table is full, -EINVAL for a multicast or zero MAC.
+ */
+int ad_tun_mac_learn(ad_tun_mac_table_t *tbl, const uint8_t *mac, uint16_t vlan, int port, uint64_t now_ms);
+
+/**
+ * @brief Port a unicast MAC was learned on.
+ *
+ * @return Port, or -1 if unknown or expired.
+ */
+int ad_tun_mac_lookup(ad_tun_mac_table_t *tbl, const uint8_t *mac, uint16_t vlan, uint64_t now_ms);
+
+/**
+ * @brief Learn the source of a frame and pick its output port.
+ *
+ * @param in_port Port the frame arrived on.
+ * @return Output port, AD_TUN_MAC_FLOOD or AD_TUN_MAC_DROP.
+ */
+int ad_tun_mac_forward(ad_tun_mac_table_t *tbl, const unsigned char *frame, size_t len,
+                       int in_port, uint64_t now_ms);
+
+/**
+ * @brief Forget every address learned on port, e.g. when its device goes away.
+ *
+ * @return Number of addresses removed.
+ */
+unsigned ad_tun_mac_flush_port(ad_tun_mac_table_t *tbl, int port);
+
+/**
+ * @brief Remove every expired address.
+ *
+ * @return Number of addresses removed.
+ */
+unsigned ad_tun_mac_expire(ad_tun_mac_table_t *tbl, uint64_t now_ms);
+
+#endif
@@ -0,0 +1,56 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Eventfd Waits      **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_EVWAIT_H_
+#define AD_TUN_SRC_AD_TUN_EVWAIT_H_
+
+#include <stdint.h>
+
+/*
+ * Internal sleep/wake protocol shared by the shared-memory rings and the
+ * ordered dispatcher: a consumer registers in a waiting counter, looks at
+ * its queue again and sleeps on an eventfd; a producer publishes, then
+ * writes the eventfd only if someone is registered. The seq_cst fences on
+ * both sides make sure either the consumer sees the new data or the
+ * producer sees the consumer.
+ */
+
+/**
+ * @brief Readiness check of the object waited on, e.g. "queue not empty".
+ */
+typedef int (*ad_tun_evwait_ready_fn)(const void *obj);
+
+/**
+ * @brief Register as a sleeper in waiting, then check ready(obj) again so a
+ *        concurrent wake is not lost.
+ *
+ * The registration stays in place; the caller drops it with
+ * __atomic_fetch_sub(waiting, 1, __ATOMIC_RELAXED) once done.
+ *
+ * @return The result of ready(obj).
+ */
+int ad_tun_evwait_arm(uint32_t *waiting, ad_tun_evwait_ready_fn ready, const void *obj);
+
+/**
+ * @brief Sleep on fd until ready(obj) holds or timeout_ms passes.
+ *
+ * @param timeout_ms -1 waits forever, 0 only checks.
+ * @return 1 if ready, 0 on timeout, or a negative errno.
+ */
+int ad_tun_evwait(uint32_t *waiting, int fd, ad_tun_evwait_ready_fn ready, const void *obj,
+                  int timeout_ms);
+
+/**
+ * @brief Producer side: signal fd if a sleeper is registered in waiting.
+ *
+ * Call after publishing; pairs with the fence in ad_tun_evwait_arm().
+ *
+ * @return 1 if a wakeup was written, 0 otherwise.
+ */
+int ad_tun_evwait_wake(uint32_t *waiting, int fd);
+
+#endif
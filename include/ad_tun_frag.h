@@ -0,0 +1,163 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Fragmentation      **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_FRAG_H_
+#define AD_TUN_SRC_AD_TUN_FRAG_H_
+
+#include "ad_tun.h"
+#include "ad_tun_pool.h"
+
+#include <stdint.h>
+
+/** Maximum number of fragments accepted for a single datagram. */
+#define AD_TUN_REASM_MAX_FRAGS 64
+
+/**
+ * @brief Split an IPv4 or IPv6 datagram into fragments of at most mtu bytes.
+ *
+ * Each fragment is built directly in a buffer taken from pool: the header is
+ * written once and the payload slice is copied once, with no intermediate
+ * staging. IPv6 datagrams get a fragment extension header inserted after the
+ * unfragmentable part. On success the caller owns the returned buffers and
+ * must return them to pool.
+ *
+ * @param pool Pool to take fragment buffers from.
+ * @param pkt Datagram starting at the IP header.
+ * @param len Datagram length.
+ * @param mtu Maximum fragment size including the IP header.
+ * @param out Array receiving the fragment buffers.
+ * @param max_out Capacity of out.
+ * @return Number of fragments, or -EINVAL (malformed or already an IPv6
+ *         fragment), -EMSGSIZE (IPv4 DF set, mtu too small, or more than
+ *         max_out fragments), -ENOBUFS (pool exhausted).
+ */
+int ad_tun_frag_fragment(ad_tun_pool_t *pool, const unsigned char *pkt, size_t len,
+                         size_t mtu, ad_tun_buf_t **out, unsigned max_out);
+
+/**
+ * @brief Reassembly counters.
+ */
+typedef struct {
+    uint64_t reassembled;   /**< Datagrams completed */
+    uint64_t timeouts;      /**< Datagrams expired before completion */
+    uint64_t evictions;     /**< Datagrams evicted to make room */
+    uint64_t invalid;       /**< Fragments or datagrams dropped as malformed/overlapping */
+    uint64_t duplicates;    /**< Exact duplicate fragments ignored */
+} ad_tun_reasm_stats_t;
+
+/**
+ * @brief One stored fragment (internal).
+ */
+typedef struct {
+    ad_tun_buf_t *buf;      /**< Fragment payload, data points past the IP header */
+    uint16_t off;           /**< Payload offset in the datagram */
+    uint16_t len;           /**< Payload length */
+} ad_tun_reasm_frag_t;
+
+/**
+ * @brief Partially reassembled datagram (internal).
+ */
+typedef struct {
+    ad_tun_reasm_frag_t frags[AD_TUN_REASM_MAX_FRAGS]; /**< Sorted by offset */
+    uint8_t src[16];
+    uint8_t dst[16];
+    uint64_t expires_ms;    /**< Absolute expiry time */
+    uint32_t id;            /**< Fragment identification */
+    uint32_t received;      /**< Payload bytes received */
+    uint32_t total;         /**< Payload length, 0 until the last fragment is seen */
+    int32_t hnext;          /**< Hash chain link */
+    int32_t prev;           /**< Age list links (oldest at head) */
+    int32_t next;
+    uint16_t nfrags;
+    uint16_t hdr_len;       /**< Bytes of the first fragment kept as the datagram header */
+    uint16_t pay_off;       /**< Offset of the payload in the first fragment */
+    uint16_t nh_off;        /**< IPv6: next-header byte to restore */
+    uint8_t nh_val;         /**< IPv6: next-header value from the fragment header */
+    uint8_t family;
+    uint8_t proto;
+    uint8_t in_use;
+    uint8_t have_first;
+} ad_tun_reasm_entry_t;
+
+/**
+ * @brief Bounded fragment reassembly cache.
+ *
+ * The number of partial datagrams is capped at init time and fragments are
+ * stored in buffers from a caller-supplied pool, so memory use never grows
+ * beyond those limits: when either runs out, the oldest partial datagram is
+ * evicted. Partial datagrams expire timeout_ms after their first fragment.
+ * Not thread-safe; callers serialize access.
+ */
+typedef struct {
+    ad_tun_reasm_entry_t *entries;
+    int32_t *buckets;
+    unsigned nbuckets;
+    unsigned max_datagrams;
+    unsigned active;
+    unsigned timeout_ms;
+    int32_t free_head;
+    int32_t age_head;
+    int32_t age_tail;
+    uint32_t seed;
+    ad_tun_pool_t *pool;
+    ad_tun_reasm_stats_t stats;
+} ad_tun_reasm_t;
+
+/**
+ * @brief Initialize a reassembly cache.
+ *
+ * @param r Caller-allocated cache.
+ * @param pool Pool used to hold fragments; its buffer size bounds the
+ *             largest fragment accepted.
+ * @param max_datagrams Maximum number of concurrent partial datagrams.
+ * @param timeout_ms Lifetime of a partial datagram.
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_reasm_init(ad_tun_reasm_t *r, ad_tun_pool_t *pool,
+                                 unsigned max_datagrams, unsigned timeout_ms);
+
+/**
+ * @brief Drop all partial datagrams and free the cache.
+ */
+void ad_tun_reasm_free(ad_tun_reasm_t *r);
+
+/**
+ * @brief Feed a fragment into the cache.
+ *
+ * The fragment is copied into the pool before the output is written, so out
+ * may alias pkt.
+ *
+ * @param r Cache.
+ * @param pkt Fragment starting at the IP header.
+ * @param len Fragment length.
+ * @param now_ms Current monotonic time in milliseconds.
+ * @param out Buffer for a completed datagram.
+ * @param out_cap Capacity of out.
+ * @return Length of the reassembled datagram written to out, 0 if the
+ *         fragment was stored and the datagram is still incomplete, or
+ *         -EINVAL (not a fragment / dropped), -EMSGSIZE (out too small; the
+ *         datagram is discarded), -ENOBUFS (no room even after eviction).
+ */
+ssize_t ad_tun_reasm_input(ad_tun_reasm_t *r, const unsigned char *pkt, size_t len,
+                           uint64_t now_ms, unsigned char *out, size_t out_cap);
+
+/**
+ * @brief Expire partial datagrams older than their timeout.
+ *
+ * Called implicitly by ad_tun_reasm_input(); callers with their own timers
+ * can call it periodically to release buffers during idle periods.
+ *
+ * @return Number of datagrams expired.
+ */
+unsigned ad_tun_reasm_expire(ad_tun_reasm_t *r, uint64_t now_ms);
+
+/**
+ * @brief Absolute time of the next expiry, or 0 if the cache is empty.
+ */
+uint64_t ad_tun_reasm_next_expiry(const ad_tun_reasm_t *r);
+
+#endif
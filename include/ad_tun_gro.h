@@ -0,0 +1,143 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Software GRO       **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_GRO_H_
+#define AD_TUN_SRC_AD_TUN_GRO_H_
+
+#include "ad_tun.h"
+#include "ad_tun_pool.h"
+
+#include <stdint.h>
+
+/**
+ * @brief GRO tuning parameters.
+ */
+typedef struct {
+    unsigned max_flows;         /**< TCP flows held for coalescing at once */
+    unsigned max_segs;          /**< Segments merged into one super-packet */
+    unsigned flush_timeout_us;  /**< Hold time across batches, 0 = flush at the end of each batch */
+    size_t headroom;            /**< Headroom reserved in super-packet buffers */
+    int ethernet;               /**< Packets are Ethernet frames from a TAP device */
+    const ad_tun_mem_config_t *mem; /**< Placement of buffers and flows, NULL = heap; read at init */
+    int csum_valid;             /**< Input TCP checksums are known good (AD_TUN_VNET_F_DATA_VALID), skip verifying them */
+} ad_tun_gro_config_t;
+
+/**
+ * @brief Packet emitted by the GRO stage.
+ *
+ * vnet describes the packet for ad_tun_write_gso() or for a UDP GSO socket
+ * (gso_size is the segment size). In Ethernet mode hdr_len and csum_start
+ * count from the start of the frame. Packets that were not merged carry
+ * gso_type AD_TUN_GSO_NONE and an unmodified checksum.
+ */
+typedef struct {
+    ad_tun_vnet_hdr_t vnet;     /**< GSO descriptor */
+    ad_tun_buf_t *buf;          /**< Packet data */
+    unsigned segs;              /**< Number of segments merged into buf */
+    int owned;                  /**< buf belongs to the GRO stage, see ad_tun_gro_release() */
+} ad_tun_gro_pkt_t;
+
+/**
+ * @brief Flow currently being coalesced (internal).
+ */
+typedef struct {
+    ad_tun_buf_t *buf;          /**< Super-packet under construction */
+    uint64_t first_us;          /**< Arrival time of the first segment */
+    uint32_t hash;
+    uint32_t next_seq;          /**< Sequence number expected next */
+    uint16_t mss;               /**< Payload size of the first segment */
+    uint16_t l2_len;            /**< Ethernet header incl. VLAN tags, 0 for IP packets */
+    uint16_t l3_len;
+    uint16_t l4_len;
+    uint16_t segs;
+    uint8_t family;
+} ad_tun_gro_flow_t;
+
+/**
+ * @brief GRO statistics.
+ */
+typedef struct {
+    uint64_t segs_in;           /**< TCP segments considered for coalescing */
+    uint64_t coalesced;         /**< Segments appended to an existing super-packet */
+    uint64_t super_pkts;        /**< Super-packets emitted (more than one segment) */
+    uint64_t passthrough;       /**< Packets forwarded unchanged */
+    uint64_t csum_bad;          /**< TCP segments not merged because their checksum failed */
+} ad_tun_gro_stats_t;
+
+/**
+ * @brief Software GRO context.
+ *
+ * Consecutive in-order TCP segments of the same flow are copied into a
+ * super-packet buffer owned by the context. The super-packet only carries
+ * a pseudo-header checksum, so a segment is merged only once its own TCP
+ * checksum verified (or cfg.csum_valid vouches for it); a corrupt segment
+ * is passed through for the receiver to drop. With cfg.ethernet, segments
+ * merge only if their Ethernet headers (MACs and VLAN tags) are identical. Not thread-safe: use one
+ * context per reader thread.
+ */
+typedef struct {
+    ad_tun_gro_config_t cfg;
+    ad_tun_pool_t pool;         /**< Super-packet buffers */
+    ad_tun_gro_flow_t *flows;   /**< Active flows, oldest first */
+    unsigned nflows;
+    ad_tun_mem_t flows_map;     /**< Backing of flows when cfg.mem is set */
+    ad_tun_gro_stats_t stats;
+} ad_tun_gro_t;
+
+/**
+ * @brief Initialize a GRO context. A NULL cfg selects the defaults.
+ *
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_gro_init(ad_tun_gro_t *gro, const ad_tun_gro_config_t *cfg);
+
+/**
+ * @brief Free a GRO context. Held flows are discarded.
+ */
+void ad_tun_gro_free(ad_tun_gro_t *gro);
+
+/**
+ * @brief Run a batch of packets through GRO.
+ *
+ * Per-flow order is preserved. Input buffers never change owner: those
+ * referenced by an output with owned == 0 are passed through untouched, the
+ * others have been copied and may be reused as soon as this call returns.
+ *
+ * @param gro Context.
+ * @param in Packets, e.g. from ad_tun_read_batch().
+ * @param n Number of packets in in.
+ * @param now_us Current monotonic time in microseconds.
+ * @param out Output array; must hold at least n + cfg.max_flows entries.
+ * @param max_out Capacity of out.
+ * @return Number of packets stored in out, or -EINVAL.
+ */
+int ad_tun_gro_batch(ad_tun_gro_t *gro, ad_tun_buf_t **in, unsigned n, uint64_t now_us,
+                     ad_tun_gro_pkt_t *out, unsigned max_out);
+
+/**
+ * @brief Flush flows held for at least flush_timeout_us.
+ *
+ * @return Number of packets stored in out (at most cfg.max_flows).
+ */
+int ad_tun_gro_flush_expired(ad_tun_gro_t *gro, uint64_t now_us,
+                             ad_tun_gro_pkt_t *out, unsigned max_out);
+
+/**
+ * @brief Flush every held flow.
+ *
+ * @return Number of packets stored in out (at most cfg.max_flows).
+ */
+int ad_tun_gro_flush_all(ad_tun_gro_t *gro, ad_tun_gro_pkt_t *out, unsigned max_out);
+
+/**
+ * @brief Release an output packet once it has been consumed.
+ *
+ * Returns owned buffers to the GRO pool; a no-op for passthrough packets.
+ */
+void ad_tun_gro_release(ad_tun_gro_t *gro, ad_tun_gro_pkt_t *pkt);
+
+#endif
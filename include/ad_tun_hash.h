@@ -0,0 +1,72 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Hash Helpers       **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_HASH_H_
+#define AD_TUN_SRC_AD_TUN_HASH_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Internal helpers shared by the flow tables (heavy hitters, IPFIX).
+ */
+
+/**
+ * @brief Hash of a 40-byte flow key.
+ *
+ * The five words are multiplied independently (no dependency chain between
+ * them), then the murmur3 finaliser spreads the high bits down.
+ */
+static inline uint64_t ad_tun_hash_key40(const void *key)
+{
+    uint64_t w[5];
+    memcpy(w, key, sizeof(w));
+
+    uint64_t h = (w[0] * 0x9e3779b97f4a7c15ull) ^ (w[1] * 0xc2b2ae3d27d4eb4full) ^
+                 (w[2] * 0x165667b19e3779f9ull) ^ (w[3] * 0xd6e8feb86659fd93ull) ^
+                 ((w[4] + 0x243f6a8885a308d3ull) * 0xff51afd7ed558ccdull);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * @brief Slot accessors of a linear-probing table for ad_tun_hash_lp_del().
+ *
+ * home() is only called for occupied slots; move() copies slot src into
+ * dst and marks src empty.
+ */
+typedef struct {
+    int (*used)(void *tab, uint32_t slot);
+    uint32_t (*home)(void *tab, uint32_t slot);
+    void (*move)(void *tab, uint32_t dst, uint32_t src);
+} ad_tun_hash_lp_ops_t;
+
+/**
+ * @brief Backward-shift deletion from a linear-probing table.
+ *
+ * Slot i must already be marked empty. Later entries of its probe run
+ * move back into the hole unless their home slot lies cyclically in
+ * (hole, entry], so lookups never need tombstones. Inline, so constant
+ * ops are resolved at compile time.
+ */
+static inline void ad_tun_hash_lp_del(void *tab, uint32_t mask, uint32_t i,
+                                      const ad_tun_hash_lp_ops_t *ops)
+{
+    for (uint32_t j = (i + 1) & mask; ops->used(tab, j); j = (j + 1) & mask) {
+        uint32_t home = ops->home(tab, j) & mask;
+        int stays = (i <= j) ? (home > i && home <= j) : (home > i || home <= j);
+        if (stays) continue;
+        ops->move(tab, i, j);
+        i = j;
+    }
+}
+
+#endif
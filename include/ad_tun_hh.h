@@ -0,0 +1,182 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Heavy Hitters      **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_HH_H_
+#define AD_TUN_SRC_AD_TUN_HH_H_
+
+#include "ad_tun.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+/** Sketch rows at most. */
+#define AD_TUN_HH_MAX_DEPTH 8
+/** Tracked entries at most. */
+#define AD_TUN_HH_MAX_TOPK 65536
+
+/** Key on the 5-tuple (addresses only for fragments). */
+#define AD_TUN_HH_KEY_FLOW 0
+/** Key on the source address: top talkers. */
+#define AD_TUN_HH_KEY_SRC 1
+/** Key on the destination address. */
+#define AD_TUN_HH_KEY_DST 2
+
+/** Rank by packets. */
+#define AD_TUN_HH_PACKETS 0
+/** Rank by bytes (IP length). */
+#define AD_TUN_HH_BYTES 1
+
+/**
+ * @brief Sketch configuration, usually loaded with ad_tun_hh_load_config().
+ *
+ * Memory is width * depth * 8 bytes for the sketch plus about 100 bytes
+ * per tracked entry, all allocated by ad_tun_hh_init().
+ */
+typedef struct {
+    unsigned width;             /**< Counters per row, rounded up to a power of two */
+    unsigned depth;             /**< Rows, 1..AD_TUN_HH_MAX_DEPTH */
+    unsigned topk;              /**< Entries tracked, 1..AD_TUN_HH_MAX_TOPK */
+    unsigned decay_ms;          /**< Halve all counts this often (ad_tun_hh_tick()), 0 = never */
+    int key;                    /**< AD_TUN_HH_KEY_* */
+    int metric;                 /**< AD_TUN_HH_PACKETS or AD_TUN_HH_BYTES */
+    int l2;                     /**< Packets are Ethernet frames (TAP mode) */
+} ad_tun_hh_config_t;
+
+/**
+ * @brief What an entry is counted on; fields outside the key mode are zero.
+ *
+ * Addresses are in network byte order, IPv4 in the first 4 bytes.
+ */
+typedef struct {
+    uint8_t src[16];
+    uint8_t dst[16];
+    uint16_t sport;
+    uint16_t dport;
+    uint8_t proto;
+    uint8_t family;             /**< AF_INET or AF_INET6 */
+    uint8_t pad[2];
+} ad_tun_hh_key_t;
+
+/**
+ * @brief One tracked entry, as returned by ad_tun_hh_snapshot().
+ *
+ * The true (decayed) count lies between count - error and count.
+ */
+typedef struct {
+    ad_tun_hh_key_t key;
+    uint64_t count;             /**< Estimated metric, an upper bound */
+    uint64_t error;             /**< Most by which count may be too high */
+    uint64_t packets;           /**< Exact packets since the entry was admitted, not decayed */
+    uint64_t bytes;             /**< Exact bytes since the entry was admitted, not decayed */
+} ad_tun_hh_entry_t;
+
+/**
+ * @brief Sketch counters.
+ */
+typedef struct {
+    uint64_t packets;           /**< Packets counted */
+    uint64_t bytes;             /**< Bytes counted */
+    uint64_t unparsed;          /**< Packets skipped, no IP header found */
+    uint64_t admissions;        /**< Keys that entered the top-K */
+    uint64_t evictions;         /**< Keys pushed out of the top-K by a heavier one */
+    uint64_t decays;            /**< Times all counts were halved */
+} ad_tun_hh_stats_t;
+
+/** Tracked entry (internal). */
+typedef struct ad_tun_hh_slot ad_tun_hh_slot_t;
+
+/**
+ * @brief Count-min sketch with a top-K of the heaviest keys.
+ *
+ * Every packet adds to one counter in each row of the sketch (only to the
+ * lowest ones: conservative update), which gives an estimate that is never
+ * too low for any key, in fixed memory. The top-K is a min-heap of the
+ * heaviest keys seen, in the manner of space-saving: a key not yet tracked
+ * replaces the lightest entry once its sketch estimate exceeds that entry's
+ * count, so the flood of one-packet flows never touches the heap.
+ *
+ * One thread updates; snapshots and stats may be taken from any thread.
+ */
+typedef struct {
+    ad_tun_hh_config_t cfg;
+    uint64_t *rows;             /**< depth rows of width saturating counters */
+    uint32_t wmask;
+    ad_tun_hh_slot_t *heap;     /**< Min-heap on count */
+    uint64_t *index;            /**< Key hash -> heap position + 1 and hash tag, linear probing */
+    uint32_t imask;
+    unsigned used;
+    uint64_t last_decay;        /**< ad_tun_hh_tick() time of the last decay */
+    pthread_mutex_t lock;       /**< Taken once per batch */
+    ad_tun_hh_stats_t stats;
+} ad_tun_hh_t;
+
+/**
+ * @brief Fill cfg with defaults: 4 rows of 65536 counters (2 MB), top 256
+ *        flows by bytes, halved every 10 s.
+ */
+void ad_tun_hh_default_config(ad_tun_hh_config_t *cfg);
+
+/**
+ * @brief Load the [heavy_hitters] section of an INI file over the defaults.
+ *
+ * Keys: width, depth, topk, decay_ms, key (flow, src, dst), metric
+ * (packets, bytes). Out-of-range values fall back to their defaults.
+ *
+ * @return AD_TUN_OK or AD_TUN_ERR_CONFIG.
+ */
+ad_tun_error_t ad_tun_hh_load_config(const char *path, ad_tun_hh_config_t *cfg);
+
+/**
+ * @brief Initialize a sketch.
+ *
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_hh_init(ad_tun_hh_t *hh, const ad_tun_hh_config_t *cfg);
+
+/**
+ * @brief Free a sketch.
+ */
+void ad_tun_hh_free(ad_tun_hh_t *hh);
+
+/**
+ * @brief Count a batch of packets (updating thread only).
+ */
+void ad_tun_hh_update(ad_tun_hh_t *hh, ad_tun_buf_t *const *bufs, unsigned n);
+
+/**
+ * @brief Halve all counts if decay_ms has passed since the last decay.
+ *
+ * The first call only sets the starting time.
+ *
+ * @param now_ms Any monotonic clock in milliseconds.
+ * @return 1 if the counts were halved, 0 otherwise.
+ */
+int ad_tun_hh_tick(ad_tun_hh_t *hh, uint64_t now_ms);
+
+/**
+ * @brief Halve all counts now.
+ */
+void ad_tun_hh_decay(ad_tun_hh_t *hh);
+
+/**
+ * @brief Sketch estimate for one key, never lower than its true count.
+ */
+uint64_t ad_tun_hh_estimate(ad_tun_hh_t *hh, const ad_tun_hh_key_t *key);
+
+/**
+ * @brief Copy the tracked entries, heaviest first.
+ *
+ * @return Number of entries stored in out, at most max.
+ */
+unsigned ad_tun_hh_snapshot(ad_tun_hh_t *hh, ad_tun_hh_entry_t *out, unsigned max);
+
+/**
+ * @brief Copy the counters.
+ */
+void ad_tun_hh_get_stats(ad_tun_hh_t *hh, ad_tun_hh_stats_t *stats);
+
+#endif
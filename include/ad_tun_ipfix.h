@@ -0,0 +1,220 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun IPFIX Export       **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_IPFIX_H_
+#define AD_TUN_SRC_AD_TUN_IPFIX_H_
+
+#include "ad_tun.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+/** Recording threads at most. */
+#define AD_TUN_IPFIX_MAX_WORKERS 64
+/** Longest collector host name including the terminator. */
+#define AD_TUN_IPFIX_HOST_LEN 256
+
+/** Packets written to the device, entering the host: flowDirection ingress. */
+#define AD_TUN_IPFIX_DIR_WRITE 0
+/** Packets read from the device, leaving the host: flowDirection egress. */
+#define AD_TUN_IPFIX_DIR_READ 1
+
+/** flowEndReason values (RFC 7011, IE 136). */
+#define AD_TUN_IPFIX_END_IDLE 1
+#define AD_TUN_IPFIX_END_ACTIVE 2
+#define AD_TUN_IPFIX_END_FORCED 4
+#define AD_TUN_IPFIX_END_RESOURCES 5
+
+/**
+ * @brief Exporter configuration, usually loaded with ad_tun_ipfix_load_config().
+ */
+typedef struct {
+    char collector[AD_TUN_IPFIX_HOST_LEN];  /**< Collector host or address */
+    uint16_t port;              /**< Collector UDP port */
+    uint32_t domain_id;         /**< Observation domain ID in every message */
+    unsigned workers;           /**< Recording threads, 1..AD_TUN_IPFIX_MAX_WORKERS */
+    unsigned worker_flows;      /**< Flows one worker table holds per interval, rounded up to a power of two */
+    unsigned max_flows;         /**< Flows the exporter's cache holds */
+    unsigned active_timeout_ms; /**< Report a flow still in progress this often */
+    unsigned idle_timeout_ms;   /**< End a flow silent this long */
+    unsigned interval_ms;       /**< Merge and export period of the exporter thread */
+    unsigned template_ms;       /**< Resend the templates this often */
+    unsigned sampling;          /**< Record 1 packet in sampling, 1 = all */
+    unsigned mtu;               /**< Largest message sent, in bytes */
+    int l2;                     /**< Packets are Ethernet frames (TAP mode) */
+} ad_tun_ipfix_config_t;
+
+/**
+ * @brief Exporter counters.
+ */
+typedef struct {
+    uint64_t packets;           /**< Packets seen by ad_tun_ipfix_record() */
+    uint64_t sampled;           /**< Packets recorded after sampling */
+    uint64_t unparsed;          /**< Sampled packets without an IP header */
+    uint64_t worker_full;       /**< Sampled packets lost to a full worker table */
+    uint64_t merges;            /**< Worker tables merged into the cache */
+    uint64_t merge_waits;       /**< Rounds a worker table stayed in use and was merged later */
+    uint64_t records;           /**< Flow records exported */
+    uint64_t cache_full;        /**< Records exported early because the cache was full */
+    uint64_t messages;          /**< IPFIX messages sent */
+    uint64_t send_errors;       /**< Messages the socket refused */
+    unsigned flows;             /**< Flows in the cache now */
+} ad_tun_ipfix_stats_t;
+
+/** Per-worker flow tables (internal). */
+typedef struct ad_tun_ipfix_worker ad_tun_ipfix_worker_t;
+
+/** Exporter flow cache entry (internal). */
+typedef struct ad_tun_ipfix_flow ad_tun_ipfix_flow_t;
+
+/**
+ * @brief IPFIX (RFC 7011) flow exporter.
+ *
+ * Each recording thread owns two preallocated flow tables and aggregates
+ * into one of them without locks or allocation. Every round the exporter
+ * moves a worker to its other table by bumping an epoch the worker reads
+ * on each call, and merges the table left behind into its own flow cache
+ * as soon as the worker is seen outside ad_tun_ipfix_record(); the worker
+ * never waits. The cache applies the active and idle timeouts and sends
+ * the records over UDP.
+ *
+ * Threads calling ad_tun_read()/ad_tun_write() record their packets
+ * without code changes once bound with ad_tun_ipfix_bind().
+ */
+typedef struct {
+    ad_tun_ipfix_config_t cfg;
+    ad_tun_ipfix_worker_t *workers;
+    ad_tun_ipfix_flow_t *flows;     /**< Cache, linear probing */
+    uint32_t fmask;
+    unsigned nflows;
+    int fd;                     /**< UDP socket connected to the collector */
+    unsigned char *msg;         /**< Message being built, cfg.mtu bytes */
+    size_t msg_len;
+    size_t set_off;             /**< Offset of the open set header, 0 = none */
+    uint16_t set_id;
+    unsigned msg_records;       /**< Data records in the message being built */
+    uint32_t seq;               /**< Data records sent (IPFIX sequence number) */
+    uint64_t last_template;     /**< Time the templates were last sent, 0 = never */
+    pthread_mutex_t lock;       /**< Serializes export rounds; never taken by workers */
+    pthread_t thread;
+    int running;
+    int wake_fd;                /**< eventfd stopping the thread */
+    ad_tun_ipfix_stats_t stats; /**< Exporter side; packet counters are summed on read */
+} ad_tun_ipfix_t;
+
+/**
+ * @brief Fill cfg with defaults: collector 127.0.0.1:4739, 1 worker of
+ *        4096 flows, 65536 cached flows, 60 s active / 15 s idle timeout,
+ *        1 s interval, templates every 60 s, no sampling, 1400-byte messages.
+ */
+void ad_tun_ipfix_default_config(ad_tun_ipfix_config_t *cfg);
+
+/**
+ * @brief Load the [ipfix] section of an INI file over the defaults.
+ *
+ * Keys: collector, port, domain_id, workers, worker_flows, max_flows,
+ * active_timeout_ms, idle_timeout_ms, interval_ms, template_ms,
+ * sampling, mtu. Out-of-range values fall back to their defaults.
+ *
+ * @return AD_TUN_OK or AD_TUN_ERR_CONFIG.
+ */
+ad_tun_error_t ad_tun_ipfix_load_config(const char *path, ad_tun_ipfix_config_t *cfg);
+
+/**
+ * @brief Allocate the tables and open the socket to the collector.
+ *
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_ipfix_init(ad_tun_ipfix_t *ex, const ad_tun_ipfix_config_t *cfg);
+
+/**
+ * @brief Stop the thread, close the socket and free all state. Flows not
+ *        yet exported are lost; see ad_tun_ipfix_flush().
+ */
+void ad_tun_ipfix_free(ad_tun_ipfix_t *ex);
+
+/**
+ * @brief Record a batch of packets as worker w (one thread per worker).
+ *
+ * Lock- and allocation-free.
+ *
+ * @param dir AD_TUN_IPFIX_DIR_READ or AD_TUN_IPFIX_DIR_WRITE.
+ */
+void ad_tun_ipfix_record(ad_tun_ipfix_t *ex, unsigned w, ad_tun_buf_t *const *bufs,
+                         unsigned n, int dir);
+
+/**
+ * @brief Record the calling thread's ad_tun_read()/ad_tun_write() packets
+ *        as worker w of ex; ex = NULL unbinds.
+ *
+ * The thread must unbind before ex is freed.
+ *
+ * @return AD_TUN_OK or AD_TUN_ERR_CONFIG.
+ */
+ad_tun_error_t ad_tun_ipfix_bind(ad_tun_ipfix_t *ex, unsigned w);
+
+/**
+ * @brief One export round: merge the worker tables switched since the last
+ *        round, export flows whose timeouts passed and request new switches.
+ *
+ * Called by the exporter thread every interval_ms; call directly when it
+ * is not started.
+ *
+ * @param now_ms Time in ad_tun_ipfix_now_ms() terms, 0 = now.
+ */
+void ad_tun_ipfix_poll(ad_tun_ipfix_t *ex, uint64_t now_ms);
+
+/**
+ * @brief Merge every worker table and export all cached flows (forced end).
+ *
+ * Only once the workers have stopped recording, e.g. before ad_tun_ipfix_free().
+ */
+void ad_tun_ipfix_flush(ad_tun_ipfix_t *ex);
+
+/**
+ * @brief Start the exporter thread.
+ *
+ * @return AD_TUN_OK, AD_TUN_ERR_INVALID_STATE if running, or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_ipfix_start(ad_tun_ipfix_t *ex);
+
+/**
+ * @brief Stop the exporter thread; cached flows are kept.
+ */
+void ad_tun_ipfix_stop(ad_tun_ipfix_t *ex);
+
+/**
+ * @brief Wall clock in milliseconds since the epoch, as used for flow times.
+ */
+uint64_t ad_tun_ipfix_now_ms(void);
+
+/**
+ * @brief Copy the counters.
+ */
+void ad_tun_ipfix_get_stats(ad_tun_ipfix_t *ex, ad_tun_ipfix_stats_t *stats);
+
+/**
+ * @brief Number of threads bound; read by ad_tun_ipfix_hook() on the I/O path.
+ */
+extern int ad_tun_ipfix_bound;
+
+/**
+ * @brief Record one packet for the calling thread's binding, if any.
+ */
+void ad_tun_ipfix_packet(int dir, const void *pkt, size_t len);
+
+/**
+ * @brief I/O path hook: a single predicted-not-taken branch while no thread is bound.
+ */
+static inline void ad_tun_ipfix_hook(int dir, const void *pkt, size_t len)
+{
+    if (__builtin_expect(__atomic_load_n(&ad_tun_ipfix_bound, __ATOMIC_RELAXED) != 0, 0)) {
+        ad_tun_ipfix_packet(dir, pkt, len);
+    }
+}
+
+#endif
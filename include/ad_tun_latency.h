@@ -0,0 +1,152 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Latency            **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_LATENCY_H_
+#define AD_TUN_SRC_AD_TUN_LATENCY_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/** Sub-buckets per power of two (2^4 = 16, about 6% resolution). */
+#define AD_TUN_LAT_SUB_BITS 4
+
+/** Buckets of a histogram covering 0 .. 2^64 - 1 ns. */
+#define AD_TUN_LAT_BUCKETS ((65 - AD_TUN_LAT_SUB_BITS) * (1 << AD_TUN_LAT_SUB_BITS))
+
+/**
+ * @brief Instrumented stages of the packet path.
+ */
+typedef enum {
+    AD_TUN_LAT_READ = 0,        /**< read() of one packet from the device */
+    AD_TUN_LAT_REASM,           /**< Reassembly of one fragment */
+    AD_TUN_LAT_GRO,             /**< ad_tun_gro_batch() call */
+    AD_TUN_LAT_SHAPER,          /**< ad_tun_shaper_submit() call */
+    AD_TUN_LAT_ENCRYPT,         /**< ad_tun_crypto_encrypt_batch() call */
+    AD_TUN_LAT_DECRYPT,         /**< ad_tun_crypto_decrypt_batch() call */
+    AD_TUN_LAT_WQ,              /**< Time a packet spent in a write queue */
+    AD_TUN_LAT_FRAG,            /**< Fragmentation and write of one datagram */
+    AD_TUN_LAT_WRITE,           /**< write() of one packet to the device */
+    AD_TUN_LAT_TOTAL,           /**< ad_tun_read_batch() to ad_tun_write_batch() of the same buffer */
+    AD_TUN_LAT_APP,             /**< Free for the application */
+    AD_TUN_LAT_STAGES
+} ad_tun_lat_stage_t;
+
+/**
+ * @brief Log-linear (HDR style) latency histogram in nanoseconds.
+ *
+ * Values below 2^(SUB_BITS + 1) ns have their own bucket; above that each
+ * power of two is split into 2^SUB_BITS buckets.
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t buckets[AD_TUN_LAT_BUCKETS];
+} ad_tun_lat_hist_t;
+
+/**
+ * @brief Raw timestamp counter: TSC on x86, the virtual counter on arm64,
+ *        CLOCK_MONOTONIC_RAW elsewhere.
+ */
+static inline uint64_t ad_tun_lat_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/*
+ * Instrumentation macros used on the packet path. Built with
+ * AD_TUN_LATENCY (CMake option AD_TUN_ENABLE_LATENCY) they take
+ * timestamps; otherwise they compile to nothing.
+ */
+#ifdef AD_TUN_LATENCY
+#define AD_TUN_LAT_START(var) uint64_t var = ad_tun_lat_ticks()
+#define AD_TUN_LAT_END(stage, var) ad_tun_lat_record_ticks((stage), ad_tun_lat_ticks() - (var))
+#define AD_TUN_LAT_STAMP(buf) ((buf)->ts = ad_tun_lat_ticks())
+#define AD_TUN_LAT_SINCE(stage, buf) \
+    do { \
+        if ((buf)->ts) ad_tun_lat_record_ticks((stage), ad_tun_lat_ticks() - (buf)->ts); \
+    } while (0)
+#else
+#define AD_TUN_LAT_START(var) ((void)0)
+#define AD_TUN_LAT_END(stage, var) ((void)0)
+#define AD_TUN_LAT_STAMP(buf) ((void)0)
+#define AD_TUN_LAT_SINCE(stage, buf) ((void)0)
+#endif
+
+/**
+ * @brief Nonzero if the library was built with the instrumentation macros enabled.
+ */
+int ad_tun_lat_enabled(void);
+
+/**
+ * @brief Measure the tick rate against CLOCK_MONOTONIC (about 10 ms).
+ *
+ * Runs automatically before the first recording; call it again after the
+ * CPU frequency setup changed on machines without an invariant TSC.
+ */
+void ad_tun_lat_calibrate(void);
+
+/**
+ * @brief Convert a tick delta to nanoseconds.
+ */
+uint64_t ad_tun_lat_ticks_to_ns(uint64_t ticks);
+
+/**
+ * @brief Record a duration in ticks into the calling thread's histogram.
+ */
+void ad_tun_lat_record_ticks(ad_tun_lat_stage_t stage, uint64_t ticks);
+
+/**
+ * @brief Record a duration in nanoseconds into the calling thread's histogram.
+ */
+void ad_tun_lat_record(ad_tun_lat_stage_t stage, uint64_t ns);
+
+/**
+ * @brief Merge the histograms of all threads, including exited ones.
+ *
+ * @param out Array of AD_TUN_LAT_STAGES histograms, overwritten.
+ */
+void ad_tun_lat_snapshot(ad_tun_lat_hist_t *out);
+
+/**
+ * @brief Add src into dst.
+ */
+void ad_tun_lat_merge(ad_tun_lat_hist_t *dst, const ad_tun_lat_hist_t *src);
+
+/**
+ * @brief Value at percentile pct (0-100), accurate to one bucket.
+ *
+ * @return Upper bound of the bucket holding the percentile, 0 if empty.
+ */
+uint64_t ad_tun_lat_percentile(const ad_tun_lat_hist_t *h, double pct);
+
+/**
+ * @brief Clear all histograms. Threads drop their data at their next recording.
+ */
+void ad_tun_lat_reset(void);
+
+/**
+ * @brief Short name of a stage ("read", "gro", ...).
+ */
+const char *ad_tun_lat_stage_name(ad_tun_lat_stage_t stage);
+
+#endif
@@ -0,0 +1,196 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Manager            **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_MGR_H_
+#define AD_TUN_SRC_AD_TUN_MGR_H_
+
+#include "ad_tun.h"
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/** Upper bound for creation threads. */
+#define AD_TUN_MGR_MAX_THREADS 64
+
+/**
+ * @brief State of a managed tunnel.
+ */
+typedef enum {
+    AD_TUN_MGR_DOWN = 0,        /**< Declared, no device */
+    AD_TUN_MGR_UP,              /**< Device open and configured */
+    AD_TUN_MGR_FAILED           /**< Device creation failed, see err */
+} ad_tun_mgr_state_t;
+
+/**
+ * @brief Manager configuration.
+ */
+typedef struct {
+    unsigned threads;           /**< Threads creating and closing devices, 0 = online CPUs */
+    uint32_t group;             /**< Device group of all tunnels, private to the manager; 0 = leave in the default group */
+} ad_tun_mgr_config_t;
+
+/**
+ * @brief One managed tunnel.
+ */
+typedef struct {
+    ad_tun_config_t cfg;        /**< Private copy */
+    int fd;                     /**< Non-blocking TUN fd, -1 while down */
+    int ifindex;
+    ad_tun_mgr_state_t state;
+    int err;                    /**< errno of the last failure, 0 if none */
+    void *user;                 /**< Free for the application */
+} ad_tun_mgr_tun_t;
+
+/**
+ * @brief Readiness reported by ad_tun_mgr_wait().
+ */
+typedef struct {
+    unsigned tun;               /**< Tunnel index */
+    uint32_t events;            /**< EPOLLIN, EPOLLOUT, ... */
+} ad_tun_mgr_event_t;
+
+/**
+ * @brief Bulk tunnel manager.
+ *
+ * Independent of the single-interface ad_tun_init()/ad_tun_start() API:
+ * devices are created by a pool of threads, all links and addresses are
+ * configured through one batched rtnetlink transaction, and every fd is
+ * registered in a shared epoll set. Tunnels are addressed by index.
+ * Management calls must not run concurrently with each other; I/O on
+ * different tunnels may run from any thread.
+ */
+typedef struct {
+    ad_tun_mgr_config_t cfg;
+    ad_tun_mgr_tun_t *tuns;
+    unsigned count;
+    unsigned cap;
+    unsigned *names;            /**< Open-addressing index by name, slot = tunnel + 1 */
+    unsigned names_cap;
+    int epfd;
+    uint64_t create_ns;         /**< Device creation time of the last start */
+    uint64_t config_ns;         /**< Netlink configuration time of the last start */
+} ad_tun_mgr_t;
+
+/**
+ * @brief Fill cfg with defaults (one thread per online CPU).
+ */
+void ad_tun_mgr_default_config(ad_tun_mgr_config_t *cfg);
+
+/**
+ * @brief Initialize an empty manager.
+ *
+ * @param mgr Caller-allocated manager.
+ * @param cfg Configuration, NULL for the defaults.
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_mgr_init(ad_tun_mgr_t *mgr, const ad_tun_mgr_config_t *cfg);
+
+/**
+ * @brief Stop all tunnels and free the manager.
+ */
+void ad_tun_mgr_free(ad_tun_mgr_t *mgr);
+
+/**
+ * @brief Declare a tunnel; the configuration is copied.
+ *
+ * @return Tunnel index, -EEXIST (name taken), -EINVAL or -ENOMEM.
+ */
+int ad_tun_mgr_add(ad_tun_mgr_t *mgr, const ad_tun_config_t *cfg);
+
+/**
+ * @brief Declare every tunnel section of an INI file.
+ *
+ * The file is read with ad_tun_load_config_set(); tunnels whose name is
+ * taken or whose addresses do not parse are logged and skipped.
+ *
+ * @return Number of tunnels added, -EINVAL if the file does not load, or -ENOMEM.
+ */
+int ad_tun_mgr_load_file(ad_tun_mgr_t *mgr, const char *path);
+
+/**
+ * @brief Declare the tunnels of every "*.ini" file of a directory, in name order.
+ *
+ * Each file goes through ad_tun_mgr_load_file(); a file that fails to
+ * load is logged and skipped.
+ *
+ * @return Number of tunnels added, or a negative errno if the directory cannot be read.
+ */
+int ad_tun_mgr_load_dir(ad_tun_mgr_t *mgr, const char *path);
+
+/**
+ * @brief Look a tunnel up by interface name.
+ *
+ * @return Tunnel index or -1.
+ */
+int ad_tun_mgr_find(const ad_tun_mgr_t *mgr, const char *ifname);
+
+/**
+ * @brief Tunnel at index, NULL if out of range.
+ */
+const ad_tun_mgr_tun_t *ad_tun_mgr_get(const ad_tun_mgr_t *mgr, unsigned idx);
+
+/**
+ * @brief Create and configure every tunnel that is not up.
+ *
+ * A tunnel whose link or address setup the kernel rejected is closed and
+ * left FAILED like one whose device could not be created.
+ *
+ * @return Number of tunnels brought up; the others are left FAILED with err set.
+ */
+int ad_tun_mgr_start_all(ad_tun_mgr_t *mgr);
+
+/**
+ * @brief Create and configure tunnels [first, first + n).
+ *
+ * @return Number of tunnels brought up, or -EINVAL.
+ */
+int ad_tun_mgr_start(ad_tun_mgr_t *mgr, unsigned first, unsigned n);
+
+/**
+ * @brief Close every open tunnel; non-persistent devices disappear.
+ *
+ * Unregistering a device waits for an RCU grace period, so closing fds one
+ * by one costs milliseconds per tunnel. With a device group configured and
+ * no persistent tunnels, all devices are deleted by a single RTM_DELLINK
+ * for the group, which the kernel unregisters as one batch. The group must
+ * be private to the manager: if any other link is in it, the devices are
+ * closed one by one instead.
+ */
+void ad_tun_mgr_stop_all(ad_tun_mgr_t *mgr);
+
+/**
+ * @brief Close tunnels [first, first + n).
+ */
+void ad_tun_mgr_stop(ad_tun_mgr_t *mgr, unsigned first, unsigned n);
+
+/**
+ * @brief Shared epoll instance holding the fd of every open tunnel (EPOLLIN).
+ */
+int ad_tun_mgr_epoll_fd(const ad_tun_mgr_t *mgr);
+
+/**
+ * @brief Wait for readiness on any tunnel.
+ *
+ * @return Number of events, 0 on timeout, or a negative errno.
+ */
+int ad_tun_mgr_wait(ad_tun_mgr_t *mgr, ad_tun_mgr_event_t *events, unsigned max, int timeout_ms);
+
+/**
+ * @brief Read one packet from a tunnel.
+ *
+ * @return Bytes read, -EAGAIN if none is queued, -EBADF if the tunnel is down.
+ */
+ssize_t ad_tun_mgr_read(ad_tun_mgr_t *mgr, unsigned idx, void *buf, size_t len);
+
+/**
+ * @brief Write one packet to a tunnel.
+ *
+ * @return Bytes written or a negative errno.
+ */
+ssize_t ad_tun_mgr_write(ad_tun_mgr_t *mgr, unsigned idx, const void *buf, size_t len);
+
+#endif
@@ -0,0 +1,159 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Link Monitor       **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_MONITOR_H_
+#define AD_TUN_SRC_AD_TUN_MONITOR_H_
+
+#include "ad_tun.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+/** Longest interface name including the terminator (IFNAMSIZ). */
+#define AD_TUN_MON_NAME_LEN 16
+
+/**
+ * @brief Change observed on a watched interface.
+ */
+typedef enum {
+    AD_TUN_MON_LINK_NEW = 0,    /**< Interface appeared */
+    AD_TUN_MON_LINK_DEL,        /**< Interface was removed */
+    AD_TUN_MON_LINK_UP,         /**< Administratively up */
+    AD_TUN_MON_LINK_DOWN,       /**< Administratively down */
+    AD_TUN_MON_CARRIER_UP,      /**< Carrier gained (TUN: a queue is attached) */
+    AD_TUN_MON_CARRIER_DOWN,    /**< Carrier lost */
+    AD_TUN_MON_MTU,             /**< MTU changed, see mtu */
+    AD_TUN_MON_ADDR_ADD,        /**< Address added, see family/addr/plen */
+    AD_TUN_MON_ADDR_DEL,        /**< Address removed */
+    AD_TUN_MON_REPAIRED,        /**< Configuration restored by the monitor */
+    AD_TUN_MON_RESYNC           /**< Events were lost; state was re-read from the kernel */
+} ad_tun_mon_event_type_t;
+
+/**
+ * @brief Event passed to the callback.
+ */
+typedef struct {
+    ad_tun_mon_event_type_t type;
+    char ifname[AD_TUN_MON_NAME_LEN];   /**< Empty for AD_TUN_MON_RESYNC */
+    int ifindex;
+    unsigned mtu;                       /**< Current MTU */
+    int family;                         /**< AF_INET / AF_INET6 for address events */
+    unsigned char addr[16];
+    unsigned plen;
+} ad_tun_mon_event_t;
+
+/**
+ * @brief Called from the monitor thread; may call the monitor API.
+ */
+typedef void (*ad_tun_mon_cb)(const ad_tun_mon_event_t *ev, void *arg);
+
+/**
+ * @brief Monitor configuration.
+ */
+typedef struct {
+    ad_tun_mon_cb cb;           /**< Event callback, may be NULL */
+    void *arg;                  /**< Passed to cb */
+    int repair;                 /**< Bring watched links back up and restore their MTU and addresses */
+} ad_tun_mon_config_t;
+
+/**
+ * @brief Observed state of a watched interface.
+ */
+typedef struct {
+    int ifindex;                /**< 0 while the interface does not exist */
+    int up;                     /**< IFF_UP */
+    int carrier;                /**< IFF_LOWER_UP */
+    unsigned mtu;
+    int has_ipv4;               /**< Configured IPv4 address present */
+    int has_ipv6;               /**< Configured IPv6 address present */
+    uint64_t events;            /**< Events reported for this interface */
+    uint64_t repairs;           /**< Repair requests sent */
+} ad_tun_mon_status_t;
+
+struct ad_tun_mon_link;
+struct ad_tun_mon_watch;
+
+/**
+ * @brief rtnetlink link and address monitor.
+ *
+ * A background thread subscribes to RTNLGRP_LINK, RTNLGRP_IPV4_IFADDR and
+ * RTNLGRP_IPV6_IFADDR and keeps a table of every link and its addresses,
+ * seeded by a dump when started. Interfaces are watched by name with the
+ * configuration they should have; changes to them are reported through
+ * the callback and, with repair set, undone through rtnetlink.
+ */
+typedef struct {
+    ad_tun_mon_config_t cfg;
+    pthread_mutex_t lock;
+    pthread_t thread;
+    int running;
+    int fd;                     /**< Subscribed rtnetlink socket */
+    int wake_fd;                /**< eventfd stopping the thread */
+    struct ad_tun_mon_link **links;     /**< Hash by ifindex */
+    unsigned links_cap;
+    unsigned nlinks;
+    struct ad_tun_mon_watch **watches;  /**< Hash by name */
+    unsigned watches_cap;
+    unsigned nwatches;
+    unsigned gen;               /**< Generation of the last dump, marks links it saw */
+    uint64_t resyncs;           /**< Socket overruns recovered by a dump */
+} ad_tun_mon_t;
+
+/**
+ * @brief Initialize a monitor; nothing runs until ad_tun_mon_start().
+ *
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_mon_init(ad_tun_mon_t *mon, const ad_tun_mon_config_t *cfg);
+
+/**
+ * @brief Stop the thread and free all state.
+ */
+void ad_tun_mon_free(ad_tun_mon_t *mon);
+
+/**
+ * @brief Subscribe, read the current links and addresses and start the thread.
+ *
+ * @return AD_TUN_OK, AD_TUN_ERR_INVALID_STATE if running, or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_mon_start(ad_tun_mon_t *mon);
+
+/**
+ * @brief Stop the thread; the tables are kept.
+ */
+void ad_tun_mon_stop(ad_tun_mon_t *mon);
+
+/**
+ * @brief Watch an interface; the desired MTU and addresses are copied from cfg.
+ *
+ * Watching a name again replaces its configuration. The interface need
+ * not exist yet. With repair enabled the configuration is checked at once.
+ *
+ * @return 0, -EINVAL or -ENOMEM.
+ */
+int ad_tun_mon_watch(ad_tun_mon_t *mon, const ad_tun_config_t *cfg);
+
+/**
+ * @brief Stop watching an interface.
+ *
+ * @return 0 or -ENOENT.
+ */
+int ad_tun_mon_unwatch(ad_tun_mon_t *mon, const char *ifname);
+
+/**
+ * @brief Current state of a watched interface.
+ *
+ * @return 0 or -ENOENT if ifname is not watched.
+ */
+int ad_tun_mon_status(ad_tun_mon_t *mon, const char *ifname, ad_tun_mon_status_t *out);
+
+/**
+ * @brief Human-readable event name.
+ */
+const char *ad_tun_mon_event_name(ad_tun_mon_event_type_t type);
+
+#endif
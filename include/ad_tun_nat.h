@@ -0,0 +1,151 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun NAT                **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_NAT_H_
+#define AD_TUN_SRC_AD_TUN_NAT_H_
+
+#include "ad_tun.h"
+#include "ad_tun_pool.h"
+
+#include <stdint.h>
+
+/** External IPv4 addresses at most. */
+#define AD_TUN_NAT_MAX_ADDRS 16
+
+/** Shards at most. */
+#define AD_TUN_NAT_MAX_SHARDS 64
+
+/**
+ * @brief NAT configuration, usually loaded with ad_tun_nat_load_config().
+ */
+typedef struct {
+    int enabled;                /**< [nat] enabled = 0/1 */
+    unsigned naddrs;            /**< Number of entries in addrs, 0 = no IPv4 NAT */
+    uint8_t addrs[AD_TUN_NAT_MAX_ADDRS][4];     /**< External addresses */
+    uint8_t internal[4];        /**< Only sources in internal/internal_plen are translated */
+    uint8_t internal_plen;      /**< 0 = every source */
+    uint16_t port_lo;           /**< External ports and ICMP ids handed out */
+    uint16_t port_hi;
+    unsigned tcp_timeout;       /**< Seconds, established TCP */
+    unsigned tcp_transitory_timeout;    /**< Seconds, TCP before a reply or after FIN/RST */
+    unsigned udp_timeout;       /**< Seconds */
+    unsigned icmp_timeout;      /**< Seconds */
+    unsigned max_mappings;      /**< Mappings at most, over all shards */
+    unsigned shards;            /**< Independently locked parts of the table */
+    int nptv6;                  /**< Translate npt_internal/npt_plen to npt_external */
+    uint8_t npt_internal[16];
+    uint8_t npt_external[16];
+    uint8_t npt_plen;           /**< Prefix length, at most 64 */
+} ad_tun_nat_config_t;
+
+/**
+ * @brief NAT counters.
+ */
+typedef struct {
+    uint64_t out;               /**< Packets translated on the way out */
+    uint64_t in;                /**< Packets translated on the way in */
+    uint64_t icmp_errors;       /**< ICMP errors whose quoted packet was translated back */
+    uint64_t passed;            /**< Packets NAT does not apply to, left alone */
+    uint64_t no_mapping;        /**< Inbound packets to an external address without a mapping, left alone */
+    uint64_t dropped;           /**< Fragments, unsupported protocols and truncated headers */
+    uint64_t exhausted;         /**< Outbound packets dropped for lack of a port or table slot */
+    uint64_t created;           /**< Mappings created */
+    uint64_t expired;           /**< Mappings timed out */
+    uint64_t mappings;          /**< Mappings alive */
+} ad_tun_nat_stats_t;
+
+/** Table shard (internal). */
+typedef struct ad_tun_nat_shard ad_tun_nat_shard_t;
+
+/**
+ * @brief Source NAT for IPv4 and NPTv6 prefix translation for IPv6.
+ *
+ * IPv4 mappings are endpoint-independent: one internal address and port
+ * maps to one external address and port whatever the destination, and
+ * the same internal address always gets the same external address. The
+ * external port range is split between the shards, so the shard owning a
+ * mapping is known from either side without a shared lock. NPTv6
+ * (RFC 6296) is stateless and checksum-neutral.
+ */
+typedef struct {
+    ad_tun_nat_config_t cfg;
+    ad_tun_nat_shard_t *shards;
+    unsigned nshards;
+    unsigned ports_per_shard;
+    uint16_t npt_adjust;        /**< Ones' complement difference of the two prefixes */
+    unsigned npt_word;          /**< 16-bit word of the address carrying the adjustment */
+    ad_tun_nat_stats_t stats;   /**< Counters of packets no shard handled, updated atomically */
+} ad_tun_nat_t;
+
+/**
+ * @brief Fill cfg with defaults: disabled, ports 1024-65535, RFC 4787/5382 timeouts.
+ */
+void ad_tun_nat_default_config(ad_tun_nat_config_t *cfg);
+
+/**
+ * @brief Load the [nat] section of an INI file.
+ *
+ * Keys: enabled, external (repeatable, or comma-separated), internal,
+ * ports = LO-HI, tcp_timeout, tcp_transitory_timeout, udp_timeout,
+ * icmp_timeout, max_mappings, shards and nptv6 = INTERNAL/LEN EXTERNAL/LEN.
+ *
+ * @param cfg Output configuration, filled with defaults first.
+ * @return AD_TUN_OK or AD_TUN_ERR_CONFIG.
+ */
+ad_tun_error_t ad_tun_nat_load_config(const char *path, ad_tun_nat_config_t *cfg);
+
+/**
+ * @brief Allocate the translation table.
+ *
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_nat_init(ad_tun_nat_t *nat, const ad_tun_nat_config_t *cfg);
+
+/**
+ * @brief Free the translation table.
+ */
+void ad_tun_nat_free(ad_tun_nat_t *nat);
+
+/**
+ * @brief Translate packets leaving through NAT (source rewrite), in place.
+ *
+ * Packets NAT does not apply to are left alone. Dropped packets are
+ * prepended to *drops as a chain linked through next. Fragments are
+ * dropped: reassemble first.
+ *
+ * @return Number of packets kept, compacted at the front of bufs.
+ */
+unsigned ad_tun_nat_out(ad_tun_nat_t *nat, ad_tun_buf_t **bufs, unsigned n, uint64_t now_ns,
+                        ad_tun_buf_t **drops);
+
+/**
+ * @brief Translate returning packets (destination rewrite), in place.
+ *
+ * ICMP errors quoting a translated packet have the quoted headers
+ * translated back as well.
+ *
+ * @return Number of packets kept, compacted at the front of bufs.
+ */
+unsigned ad_tun_nat_in(ad_tun_nat_t *nat, ad_tun_buf_t **bufs, unsigned n, uint64_t now_ns,
+                       ad_tun_buf_t **drops);
+
+/**
+ * @brief Remove mappings idle longer than their timeout.
+ *
+ * Expired mappings are also reclaimed when a shard runs out of room; call
+ * this periodically to free ports sooner.
+ *
+ * @return Number of mappings removed.
+ */
+unsigned ad_tun_nat_expire(ad_tun_nat_t *nat, uint64_t now_ns);
+
+/**
+ * @brief Sum of the shard counters.
+ */
+void ad_tun_nat_get_stats(ad_tun_nat_t *nat, ad_tun_nat_stats_t *stats);
+
+#endif
@@ -0,0 +1,141 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Netlink Helper     **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_NL_H_
+#define AD_TUN_SRC_AD_TUN_NL_H_
+
+#include "ad_tun.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Called by ad_tun_nl_commit() for every request the kernel rejected.
+ *
+ * @param arg User argument.
+ * @param seq Sequence number returned when the request was queued.
+ * @param err Positive errno.
+ */
+typedef void (*ad_tun_nl_err_fn)(void *arg, uint32_t seq, int err);
+
+struct nlmsghdr;
+
+/**
+ * @brief Called by ad_tun_nl_dump() for every object of the dump.
+ *
+ * @return 0 to continue, non-zero to stop early.
+ */
+typedef int (*ad_tun_nl_msg_fn)(void *arg, const struct nlmsghdr *h);
+
+/**
+ * @brief rtnetlink request batch (internal).
+ *
+ * Requests are appended to a buffer and sent by ad_tun_nl_commit() in as
+ * few sendmsg() calls as the socket allows, so configuring thousands of
+ * interfaces costs a handful of system calls instead of a process per
+ * address. Not thread safe; use one batch per thread.
+ */
+typedef struct {
+    int fd;
+    uint32_t seq;               /**< Sequence number of the request queued last */
+    unsigned char *buf;
+    size_t len;
+    size_t cap;
+    size_t last;                /**< Offset of the request queued last */
+    unsigned pending;           /**< Requests queued since the last commit */
+} ad_tun_nl_t;
+
+/**
+ * @brief Open an rtnetlink socket.
+ *
+ * @return AD_TUN_OK or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_nl_open(ad_tun_nl_t *nl);
+
+/**
+ * @brief Close the socket and free the batch.
+ */
+void ad_tun_nl_close(ad_tun_nl_t *nl);
+
+/**
+ * @brief Queue a link change.
+ *
+ * @param ifindex Interface index.
+ * @param mtu New MTU, 0 to keep.
+ * @param up 1 = up, 0 = down, -1 = keep.
+ * @return Sequence number of the request, 0 on allocation failure.
+ */
+uint32_t ad_tun_nl_link_set(ad_tun_nl_t *nl, int ifindex, unsigned mtu, int up);
+
+/**
+ * @brief Queue the deletion of a link (e.g. a persistent TUN device).
+ */
+uint32_t ad_tun_nl_link_del(ad_tun_nl_t *nl, int ifindex);
+
+/**
+ * @brief Queue adding (replacing) or removing an interface address.
+ *
+ * @param add 1 to add, 0 to delete.
+ * @param family AF_INET or AF_INET6.
+ * @param addr 4 or 16 address bytes in network order.
+ * @param plen Prefix length.
+ * @return Sequence number of the request, 0 on allocation failure.
+ */
+uint32_t ad_tun_nl_addr(ad_tun_nl_t *nl, int add, int ifindex, int family,
+                        const void *addr, unsigned plen);
+
+/**
+ * @brief Queue a raw request built by the caller (type, flags and payload).
+ *
+ * NLM_F_REQUEST and NLM_F_ACK are added. The payload starts with the
+ * family header (ifinfomsg, rtmsg, ...) followed by attributes.
+ *
+ * @return Sequence number of the request, 0 on allocation failure.
+ */
+uint32_t ad_tun_nl_request(ad_tun_nl_t *nl, uint16_t type, uint16_t flags,
+                           const void *payload, size_t len);
+
+/**
+ * @brief Append an attribute to the request queued last.
+ *
+ * @return 0 or -ENOMEM.
+ */
+int ad_tun_nl_attr(ad_tun_nl_t *nl, uint16_t type, const void *data, size_t len);
+
+/**
+ * @brief Send all queued requests and wait for their acknowledgements.
+ *
+ * @param fn Called for each rejected request, may be NULL.
+ * @param arg Passed to fn.
+ * @return Number of rejected requests, or a negative errno if the socket failed.
+ */
+int ad_tun_nl_commit(ad_tun_nl_t *nl, ad_tun_nl_err_fn fn, void *arg);
+
+/**
+ * @brief Dump all objects of a kind (links, addresses, routes) synchronously.
+ *
+ * Must not be called with requests queued.
+ *
+ * @param type RTM_GETLINK, RTM_GETADDR, RTM_GETROUTE, ...
+ * @param family Address family filter, AF_UNSPEC for all.
+ * @param fn Called for each object message.
+ * @return 0, or a negative errno (-EINTR if the kernel interrupted the dump).
+ */
+int ad_tun_nl_dump(ad_tun_nl_t *nl, uint16_t type, unsigned char family,
+                   ad_tun_nl_msg_fn fn, void *arg);
+
+/**
+ * @brief Parse "ADDR[/LEN]"; a missing length means a host prefix.
+ *
+ * @param family Set to AF_INET or AF_INET6.
+ * @param addr 16-byte output buffer.
+ * @param plen Set to the prefix length.
+ * @return 0 or -EINVAL.
+ */
+int ad_tun_nl_parse_prefix(const char *s, int *family, unsigned char *addr, unsigned *plen);
+
+#endif
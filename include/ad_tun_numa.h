@@ -0,0 +1,96 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun NUMA Memory        **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_NUMA_H_
+#define AD_TUN_SRC_AD_TUN_NUMA_H_
+
+#include "ad_tun.h"
+
+#include <stddef.h>
+
+/** ad_tun_mem_config_t node: no binding, pages land where first touched. */
+#define AD_TUN_NUMA_ANY   (-1)
+/** ad_tun_mem_config_t node: node of the CPU the allocating thread runs on. */
+#define AD_TUN_NUMA_LOCAL (-2)
+
+/** Back with 2 MiB pages: reserved hugetlb pages, else transparent hugepages. */
+#define AD_TUN_MEM_HUGE   0x1u
+/** Fail instead of taking pages from another node when the node is full. */
+#define AD_TUN_MEM_STRICT 0x2u
+
+/**
+ * @brief Placement of a memory block.
+ *
+ * Components take a pointer to one in their config; NULL keeps them on
+ * the ordinary heap.
+ */
+typedef struct {
+    int node;                   /**< NUMA node, AD_TUN_NUMA_ANY or AD_TUN_NUMA_LOCAL */
+    unsigned flags;             /**< AD_TUN_MEM_* */
+} ad_tun_mem_config_t;
+
+/**
+ * @brief Block returned by ad_tun_mem_alloc().
+ */
+typedef struct {
+    void *ptr;
+    size_t len;                 /**< Mapped bytes, rounded up to the page size */
+    int node;                   /**< Node the block is bound to, -1 if none */
+    int huge;                   /**< 0 = base pages, 1 = hugetlb, 2 = transparent hugepages */
+} ad_tun_mem_t;
+
+/**
+ * @brief Number of NUMA nodes the system may have (highest node + 1), at least 1.
+ */
+int ad_tun_numa_nodes(void);
+
+/**
+ * @brief Node of a CPU.
+ *
+ * @param cpu CPU number, or -1 for the CPU the calling thread runs on.
+ * @return Node, or -ENOENT if unknown.
+ */
+int ad_tun_numa_node_of_cpu(int cpu);
+
+/**
+ * @brief Node a network device is attached to, e.g. the NIC tunnel traffic leaves by.
+ *
+ * @return Node, -ENOENT for virtual devices and single-node systems,
+ *         -ENODEV if there is no such device, -EINVAL for a bad name.
+ */
+int ad_tun_numa_node_of_dev(const char *ifname);
+
+/**
+ * @brief Node holding the page at addr. The page must have been touched.
+ *
+ * @return Node, or a negative errno.
+ */
+int ad_tun_numa_node_of_addr(const void *addr);
+
+/**
+ * @brief Map zeroed, prefaulted memory placed as cfg asks.
+ *
+ * The pages are faulted in by the caller after the NUMA policy is set, so
+ * they are resident on the node before the packet path touches them.
+ * Without AD_TUN_MEM_STRICT a full node, a missing hugetlb reservation or
+ * a kernel without NUMA support falls back to whatever memory is
+ * available; m->node and m->huge report what was obtained.
+ *
+ * @param m Block to fill.
+ * @param len Bytes wanted.
+ * @param cfg Placement, NULL = AD_TUN_NUMA_ANY with base pages.
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG for a bad node or length,
+ *         AD_TUN_ERR_SYS if no memory could be mapped.
+ */
+ad_tun_error_t ad_tun_mem_alloc(ad_tun_mem_t *m, size_t len, const ad_tun_mem_config_t *cfg);
+
+/**
+ * @brief Unmap a block. A zeroed block is ignored.
+ */
+void ad_tun_mem_free(ad_tun_mem_t *m);
+
+#endif
@@ -0,0 +1,135 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Ordered Dispatch   **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_ORDER_H_
+#define AD_TUN_SRC_AD_TUN_ORDER_H_
+
+#include "ad_tun.h"
+
+#include <stdint.h>
+
+/** Worker threads at most. */
+#define AD_TUN_ORDER_MAX_WORKERS 64
+
+/**
+ * @brief Dispatcher configuration.
+ */
+typedef struct {
+    unsigned workers;           /**< Worker threads, 1..AD_TUN_ORDER_MAX_WORKERS */
+    unsigned buckets;           /**< Flow buckets, rounded up to a power of two */
+    unsigned depth;             /**< Packets each worker queue holds, rounded up to a power of two */
+    unsigned rebalance;         /**< Queue length gap that moves an idle bucket to a shorter queue, 0 = never */
+    int l2;                     /**< Packets are Ethernet frames (TAP mode) */
+} ad_tun_order_config_t;
+
+/**
+ * @brief Dispatcher counters.
+ */
+typedef struct {
+    uint64_t dispatched;        /**< Packets handed to workers */
+    uint64_t completed;         /**< Packets workers reported done */
+    uint64_t migrations;        /**< Idle buckets moved to a shorter queue */
+    uint64_t full;              /**< Dispatch calls that stopped on a full worker queue */
+    uint64_t wakeups;           /**< eventfd signals sent to sleeping workers */
+} ad_tun_order_stats_t;
+
+/** Worker queue (internal). */
+typedef struct ad_tun_order_worker ad_tun_order_worker_t;
+
+/** Flow bucket (internal). */
+typedef struct {
+    uint64_t last;              /**< Queue position after the bucket's newest packet */
+    uint32_t worker;            /**< Worker the bucket is pinned to */
+} ad_tun_order_bucket_t;
+
+/**
+ * @brief Flow-ordered fan-out from one reader to several workers.
+ *
+ * Packets are hashed on their 5-tuple (addresses only for fragments)
+ * into buckets, and every bucket is pinned to one worker, so packets of
+ * a flow are processed and written in the order they were read. A bucket
+ * moves to a less loaded worker only when none of its packets is still
+ * queued or being processed, which is known without locks from how far
+ * the old worker has got (ad_tun_order_done()). Idle workers thus take
+ * over new and paused flows from busy ones while flows in progress stay
+ * where they are.
+ *
+ * One thread dispatches; each worker queue has one consumer.
+ */
+typedef struct {
+    ad_tun_order_config_t cfg;
+    ad_tun_order_worker_t *workers;
+    ad_tun_order_bucket_t *buckets;
+    uint32_t bmask;
+    uint32_t qmask;
+    ad_tun_order_stats_t stats; /**< Dispatcher side; completed is summed on read */
+} ad_tun_order_t;
+
+/**
+ * @brief Fill cfg with defaults: 4 workers, 4096 buckets, 1024 packets
+ *        per queue, rebalancing at a gap of 64 packets, IP packets.
+ */
+void ad_tun_order_default_config(ad_tun_order_config_t *cfg);
+
+/**
+ * @brief Initialize a dispatcher.
+ *
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_order_init(ad_tun_order_t *ord, const ad_tun_order_config_t *cfg);
+
+/**
+ * @brief Free a dispatcher. Packets still queued are not returned to their pool.
+ */
+void ad_tun_order_free(ad_tun_order_t *ord);
+
+/**
+ * @brief Hand packets to the workers (dispatcher thread only).
+ *
+ * Sleeping workers are woken once per call.
+ *
+ * @return Number of packets taken from the front of bufs; fewer than n
+ *         when a worker queue is full, the rest stay with the caller.
+ */
+unsigned ad_tun_order_dispatch(ad_tun_order_t *ord, ad_tun_buf_t *const *bufs, unsigned n);
+
+/**
+ * @brief Take up to n packets from worker w's queue.
+ *
+ * Packets come out in dispatch order and stay counted against their
+ * flows until ad_tun_order_done().
+ *
+ * @return Number of buffers stored in bufs.
+ */
+unsigned ad_tun_order_dequeue(ad_tun_order_t *ord, unsigned w, ad_tun_buf_t **bufs, unsigned n);
+
+/**
+ * @brief Report the oldest n dequeued packets of worker w as finished.
+ *
+ * Call once they have been written or dropped; until then their flows
+ * cannot move to another worker.
+ */
+void ad_tun_order_done(ad_tun_order_t *ord, unsigned w, unsigned n);
+
+/**
+ * @brief Sleep until worker w has packets, or timeout_ms passes (-1 = forever).
+ *
+ * @return 1 if packets are available, 0 on timeout, -errno on error.
+ */
+int ad_tun_order_wait(ad_tun_order_t *ord, unsigned w, int timeout_ms);
+
+/**
+ * @brief Packets dispatched to worker w and not yet done (a snapshot).
+ */
+unsigned ad_tun_order_pending(const ad_tun_order_t *ord, unsigned w);
+
+/**
+ * @brief Copy the counters.
+ */
+void ad_tun_order_get_stats(const ad_tun_order_t *ord, ad_tun_order_stats_t *stats);
+
+#endif
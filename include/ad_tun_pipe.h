@@ -0,0 +1,200 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Pipeline           **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_PIPE_H_
+#define AD_TUN_SRC_AD_TUN_PIPE_H_
+
+#include "ad_tun.h"
+#include "ad_tun_pkt.h"
+#include "ad_tun_capture.h"
+#include "ad_tun_shaper.h"
+#include "ad_tun_crypto.h"
+
+#include <stdint.h>
+
+/** Stages of one runtime pipeline at most. */
+#define AD_TUN_PIPE_MAX_STAGES 16
+
+/**
+ * @brief Batch flowing through a pipeline.
+ *
+ * Survivors stay compacted at the front of bufs, with info and cls
+ * parallel to them. Packets a stage rejects are prepended to drops as a
+ * chain linked through next, ready for ad_tun_pool_put_chain().
+ */
+typedef struct {
+    ad_tun_buf_t **bufs;
+    unsigned n;
+    ad_tun_pkt_info_t *info;    /**< Set by the parse stage */
+    uint8_t *cls;               /**< Set by the classify stage */
+    ad_tun_buf_t **scratch;     /**< Room for n packets, used by the shape stage */
+    ad_tun_buf_t *drops;
+    unsigned ndrops;
+    uint64_t now_ns;
+} ad_tun_pipe_batch_t;
+
+/**
+ * @brief Writer of the send stage, e.g. a UDP socket sender.
+ *
+ * @return Packets written from the front of bufs, or a negative errno.
+ */
+typedef int (*ad_tun_pipe_write_fn)(void *arg, ad_tun_buf_t *const *bufs, unsigned n);
+
+/**
+ * @brief Application stage of a runtime pipeline.
+ *
+ * Called once per batch; drop packets with ad_tun_pipe_drop() or keep
+ * them compacted at the front of the batch.
+ */
+typedef void (*ad_tun_pipe_stage_fn)(void *arg, ad_tun_pipe_batch_t *b);
+
+/**
+ * @brief Stage types of a runtime pipeline.
+ */
+typedef enum {
+    AD_TUN_STAGE_PARSE = 0,     /**< Parse the IP header, drop malformed packets */
+    AD_TUN_STAGE_CLASSIFY,      /**< DSCP to class through dscp_map */
+    AD_TUN_STAGE_FILTER,        /**< Keep packets matching filter (drop them with invert) */
+    AD_TUN_STAGE_SHAPE,         /**< ad_tun_shaper_submit(); held packets resume on poll */
+    AD_TUN_STAGE_ENCRYPT,       /**< ad_tun_crypto_encrypt_batch() for peer */
+    AD_TUN_STAGE_CUSTOM,        /**< fn(arg, batch) */
+    AD_TUN_STAGE_SEND           /**< write_fn(write_arg, ...) or ad_tun_write_batch(); must be last */
+} ad_tun_stage_type_t;
+
+/**
+ * @brief One stage of a runtime pipeline; only the fields of its type are read.
+ */
+typedef struct {
+    ad_tun_stage_type_t type;
+    const uint8_t *dscp_map;                /**< CLASSIFY: 64 entries, NULL = class selector (DSCP >> 3) */
+    const ad_tun_capture_filter_t *filter;  /**< FILTER */
+    int invert;                             /**< FILTER: drop matching packets instead */
+    ad_tun_shaper_t *shaper;                /**< SHAPE */
+    ad_tun_crypto_t *crypto;                /**< ENCRYPT */
+    uint32_t peer;                          /**< ENCRYPT: local id of the peer */
+    ad_tun_pipe_stage_fn fn;                /**< CUSTOM */
+    void *arg;                              /**< CUSTOM */
+    ad_tun_pipe_write_fn write_fn;          /**< SEND, NULL = ad_tun_write_batch() */
+    void *write_arg;                        /**< SEND */
+} ad_tun_stage_t;
+
+/**
+ * @brief Pipeline counters.
+ */
+typedef struct {
+    uint64_t batches;
+    uint64_t in;                /**< Packets entering the first stage */
+    uint64_t out;               /**< Packets leaving the last stage (sent) */
+    uint64_t dropped;           /**< Packets handed back through drops */
+    uint64_t drops[AD_TUN_PIPE_MAX_STAGES];     /**< Drops per stage */
+} ad_tun_pipe_stats_t;
+
+/**
+ * @brief Pipeline configured at run time.
+ *
+ * The C counterpart of the compile-time pipeline in ad_tun_pipeline.hpp,
+ * running the same stage code. Consecutive per-packet stages (parse,
+ * classify, filter) run fused in one pass over the batch and dispatch on
+ * the stage type without indirect calls; the other stages run once per
+ * batch. Not thread-safe: use one pipeline per worker thread.
+ */
+typedef struct {
+    ad_tun_stage_t stages[AD_TUN_PIPE_MAX_STAGES];
+    unsigned nstages;
+    unsigned max_batch;
+    ad_tun_pkt_info_t *info;    /**< Scratch for max_batch packets */
+    uint8_t *cls;
+    ad_tun_buf_t **scratch;
+    ad_tun_pipe_stats_t stats;
+} ad_tun_pipe_t;
+
+/* ---- Per-packet stage code shared with ad_tun_pipeline.hpp ---- */
+
+static inline int ad_tun_stage_parse(const ad_tun_buf_t *b, ad_tun_pkt_info_t *info)
+{
+    return ad_tun_pkt_parse(b->data, b->len, info) == 0;
+}
+
+static inline uint8_t ad_tun_stage_classify(const ad_tun_pkt_info_t *info, const uint8_t *dscp_map)
+{
+    unsigned dscp = info->tos >> 2;
+    return dscp_map ? dscp_map[dscp] : (uint8_t)(dscp >> 3);
+}
+
+static inline int ad_tun_stage_filter(const ad_tun_pkt_info_t *info, const ad_tun_capture_filter_t *f,
+                                      int invert)
+{
+    return ad_tun_capture_filter_match(f, info) != (invert != 0);
+}
+
+/* ---- Batch stage code shared with ad_tun_pipeline.hpp ---- */
+
+/**
+ * @brief Move packet i of a batch to its drop chain, keeping the others in order.
+ */
+void ad_tun_pipe_drop(ad_tun_pipe_batch_t *b, unsigned i);
+
+/**
+ * @brief Shape stage: conforming packets stay, held ones are owned by the shaper.
+ *
+ * @return Packets held back.
+ */
+unsigned ad_tun_pipe_shape(ad_tun_pipe_batch_t *b, ad_tun_shaper_t *sh);
+
+/**
+ * @brief Encrypt stage; on failure the whole batch is dropped.
+ */
+void ad_tun_pipe_encrypt(ad_tun_pipe_batch_t *b, ad_tun_crypto_t *c, uint32_t peer);
+
+/**
+ * @brief Send stage; packets the writer does not take are dropped.
+ */
+void ad_tun_pipe_send(ad_tun_pipe_batch_t *b, ad_tun_pipe_write_fn fn, void *arg);
+
+/**
+ * @brief Build a pipeline from stages (copied).
+ *
+ * A parse stage must come before classify and filter stages, none of the
+ * three can follow a shape stage, and a send stage can only be the last one.
+ *
+ * @param max_batch Largest batch passed to ad_tun_pipe_run().
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_pipe_init(ad_tun_pipe_t *p, const ad_tun_stage_t *stages, unsigned nstages,
+                                unsigned max_batch);
+
+/**
+ * @brief Free a pipeline. Packets held by its shapers stay with the shapers.
+ */
+void ad_tun_pipe_free(ad_tun_pipe_t *p);
+
+/**
+ * @brief Run a batch through every stage.
+ *
+ * @param bufs Packets, e.g. from ad_tun_read_batch(); survivors end up at the front.
+ * @param n Number of packets, at most max_batch.
+ * @param now_ns Monotonic time for the shape stage.
+ * @param drops Chain that rejected packets are prepended to.
+ * @return Packets that left the last stage, at the front of bufs, or -EINVAL.
+ */
+int ad_tun_pipe_run(ad_tun_pipe_t *p, ad_tun_buf_t **bufs, unsigned n, uint64_t now_ns,
+                    ad_tun_buf_t **drops);
+
+/**
+ * @brief Release packets held by the shape stages and run them through the stages after them.
+ *
+ * @param out Receives the packets that left the last stage; max_batch entries.
+ * @return Number of packets in out.
+ */
+int ad_tun_pipe_poll(ad_tun_pipe_t *p, uint64_t now_ns, ad_tun_buf_t **out, ad_tun_buf_t **drops);
+
+/**
+ * @brief Name of a stage type for logs.
+ */
+const char *ad_tun_pipe_stage_name(ad_tun_stage_type_t type);
+
+#endif
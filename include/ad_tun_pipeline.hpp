@@ -0,0 +1,294 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun C++ Pipeline       **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_PIPELINE_HPP_
+#define AD_TUN_SRC_AD_TUN_PIPELINE_HPP_
+
+#if __cplusplus < 202002L
+#error "ad_tun_pipeline.hpp requires C++20"
+#endif
+
+extern "C" {
+#include "ad_tun_pipe.h"
+}
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+/**
+ * Pipeline composed at compile time.
+ *
+ * The stages are template arguments, so the whole chain is known to the
+ * compiler: consecutive per-packet stages are fused into one loop over the
+ * batch with every stage inlined, and batch stages call the shared C stage
+ * code directly. Ordering rules of ad_tun_pipe_init() are checked with
+ * static_assert instead of at run time. The runtime-configured
+ * ad_tun_pipe_t runs the same stage code for deployments that build their
+ * chain from configuration.
+ *
+ *     ad_tun::pipeline p(64, ad_tun::stage::parse{},
+ *                        ad_tun::stage::filter{f},
+ *                        ad_tun::stage::send{});
+ *     int n = p.run(bufs, now_ns, drops);
+ */
+namespace ad_tun {
+
+namespace stage {
+
+/* Per-packet stages return false to drop the packet */
+
+struct parse {
+    static constexpr ad_tun_stage_type_t type = AD_TUN_STAGE_PARSE;
+    static constexpr bool per_packet = true;
+
+    bool operator()(ad_tun_buf_t *b, ad_tun_pkt_info_t &info, uint8_t &) const {
+        return ad_tun_stage_parse(b, &info);
+    }
+};
+
+struct classify {
+    static constexpr ad_tun_stage_type_t type = AD_TUN_STAGE_CLASSIFY;
+    static constexpr bool per_packet = true;
+
+    const uint8_t *dscp_map = nullptr;      /**< 64 entries, nullptr = DSCP >> 3 */
+
+    bool operator()(ad_tun_buf_t *, ad_tun_pkt_info_t &info, uint8_t &cls) const {
+        cls = ad_tun_stage_classify(&info, dscp_map);
+        return true;
+    }
+};
+
+struct filter {
+    static constexpr ad_tun_stage_type_t type = AD_TUN_STAGE_FILTER;
+    static constexpr bool per_packet = true;
+
+    ad_tun_capture_filter_t f;
+    bool invert = false;
+
+    bool operator()(ad_tun_buf_t *, ad_tun_pkt_info_t &info, uint8_t &) const {
+        return ad_tun_stage_filter(&info, &f, invert);
+    }
+};
+
+/**
+ * @brief Application per-packet stage, fused and inlined like the built-in ones.
+ *
+ * f(ad_tun_buf_t *, const ad_tun_pkt_info_t &, uint8_t cls) returns false to drop.
+ */
+template <class F>
+struct each {
+    static constexpr ad_tun_stage_type_t type = AD_TUN_STAGE_CUSTOM;
+    static constexpr bool per_packet = true;
+
+    F f;
+
+    bool operator()(ad_tun_buf_t *b, ad_tun_pkt_info_t &info, uint8_t &cls) {
+        return f(b, static_cast<const ad_tun_pkt_info_t &>(info), cls);
+    }
+};
+
+template <class F> each(F) -> each<F>;
+
+/**
+ * @brief Application batch stage: f(ad_tun_pipe_batch_t &).
+ */
+template <class F>
+struct batch {
+    static constexpr ad_tun_stage_type_t type = AD_TUN_STAGE_CUSTOM;
+    static constexpr bool per_packet = false;
+
+    F f;
+
+    void operator()(ad_tun_pipe_batch_t &b) { f(b); }
+};
+
+template <class F> batch(F) -> batch<F>;
+
+struct shape {
+    static constexpr ad_tun_stage_type_t type = AD_TUN_STAGE_SHAPE;
+    static constexpr bool per_packet = false;
+
+    ad_tun_shaper_t *shaper;
+
+    void operator()(ad_tun_pipe_batch_t &b) const { ad_tun_pipe_shape(&b, shaper); }
+};
+
+struct encrypt {
+    static constexpr ad_tun_stage_type_t type = AD_TUN_STAGE_ENCRYPT;
+    static constexpr bool per_packet = false;
+
+    ad_tun_crypto_t *crypto;
+    uint32_t peer;
+
+    void operator()(ad_tun_pipe_batch_t &b) const { ad_tun_pipe_encrypt(&b, crypto, peer); }
+};
+
+struct send {
+    static constexpr ad_tun_stage_type_t type = AD_TUN_STAGE_SEND;
+    static constexpr bool per_packet = false;
+
+    ad_tun_pipe_write_fn fn = nullptr;      /**< nullptr = ad_tun_write_batch() */
+    void *arg = nullptr;
+
+    void operator()(ad_tun_pipe_batch_t &b) const { ad_tun_pipe_send(&b, fn, arg); }
+};
+
+} // namespace stage
+
+/**
+ * @brief Pipeline of stages fixed at compile time.
+ *
+ * Not thread-safe: use one pipeline per worker thread.
+ */
+template <class... S>
+class pipeline {
+    static constexpr std::size_t N = sizeof...(S);
+    static constexpr ad_tun_stage_type_t types[N] = { S::type... };
+    static constexpr bool per_packet[N] = { S::per_packet... };
+
+    static_assert(N > 0 && N <= AD_TUN_PIPE_MAX_STAGES, "a pipeline has 1 to AD_TUN_PIPE_MAX_STAGES stages");
+
+    /* Same rules as ad_tun_pipe_init(); per-packet stages read the parsed info */
+    static constexpr bool valid() {
+        bool parsed = false, shaped = false;
+        for (std::size_t i = 0; i < N; i++) {
+            if (types[i] == AD_TUN_STAGE_PARSE) {
+                if (shaped) return false;
+                parsed = true;
+            } else if (per_packet[i] && (!parsed || shaped)) return false;
+            if (types[i] == AD_TUN_STAGE_SHAPE && std::exchange(shaped, true)) return false;
+            if (types[i] == AD_TUN_STAGE_SEND && i != N - 1) return false;
+        }
+        return true;
+    }
+    static_assert(valid(), "per-packet stages need a parse stage before them, neither can follow "
+                           "a shape stage, one shape stage at most, and send only as the last stage");
+
+    /* End of the run of per-packet stages starting at I */
+    static constexpr std::size_t fused_end(std::size_t i) {
+        while (i < N && per_packet[i]) i++;
+        return i;
+    }
+
+    static constexpr std::size_t shape_at() {
+        for (std::size_t i = 0; i < N; i++)
+            if (types[i] == AD_TUN_STAGE_SHAPE) return i;
+        return N;
+    }
+
+public:
+    explicit pipeline(unsigned max_batch, S... stages)
+        : stages_(std::move(stages)...), info_(max_batch), cls_(max_batch), scratch_(max_batch) {}
+
+    /**
+     * @brief Run a batch through every stage.
+     *
+     * @param bufs Packets, at most max_batch; survivors end up at the front.
+     * @param drops Chain that rejected packets are prepended to.
+     * @return Packets that left the last stage, or -EINVAL if the batch is too large.
+     */
+    int run(std::span<ad_tun_buf_t *> bufs, uint64_t now_ns, ad_tun_buf_t *&drops) {
+        if (bufs.size() > info_.size()) return -EINVAL;
+
+        ad_tun_pipe_batch_t b = { bufs.data(), (unsigned)bufs.size(), info_.data(), cls_.data(),
+                                  scratch_.data(), drops, 0, now_ns };
+        run_from<0>(b);
+
+        drops = b.drops;
+        stats_.batches++;
+        stats_.in += bufs.size();
+        stats_.out += b.n;
+        stats_.dropped += b.ndrops;
+        return (int)b.n;
+    }
+
+    /**
+     * @brief Release packets held by the shape stage and run the stages after it.
+     *
+     * @param out Receives the packets that left the last stage.
+     * @return Number of packets in out.
+     */
+    int poll(uint64_t now_ns, std::span<ad_tun_buf_t *> out, ad_tun_buf_t *&drops) {
+        constexpr std::size_t s = shape_at();
+        if constexpr (s == N) {
+            return 0;
+        } else {
+            int n = ad_tun_shaper_poll(std::get<s>(stages_).shaper, now_ns, out.data(), (unsigned)out.size());
+            if (n <= 0) return 0;
+
+            ad_tun_pipe_batch_t b = { out.data(), (unsigned)n, nullptr, nullptr,
+                                      scratch_.data(), drops, 0, now_ns };
+            run_from<s + 1>(b);
+
+            drops = b.drops;
+            stats_.out += b.n;
+            stats_.dropped += b.ndrops;
+            return (int)b.n;
+        }
+    }
+
+    const ad_tun_pipe_stats_t &stats() const noexcept { return stats_; }
+
+    template <std::size_t I>
+    auto &get() noexcept { return std::get<I>(stages_); }
+
+private:
+    template <std::size_t I>
+    void run_from(ad_tun_pipe_batch_t &b) {
+        if constexpr (I < N) {
+            if (b.n == 0) return;
+
+            if constexpr (per_packet[I]) {
+                constexpr std::size_t E = fused_end(I);
+                fused<I>(b, std::make_index_sequence<E - I>{});
+                run_from<E>(b);
+            } else {
+                unsigned before = b.ndrops;
+                std::get<I>(stages_)(b);
+                stats_.drops[I] += b.ndrops - before;
+                run_from<I + 1>(b);
+            }
+        }
+    }
+
+    /* Stages I..I+K in one pass; && stops at the first stage that drops */
+    template <std::size_t I, std::size_t... K>
+    void fused(ad_tun_pipe_batch_t &b, std::index_sequence<K...>) {
+        unsigned k = 0;
+
+        for (unsigned i = 0; i < b.n; i++) {
+            ad_tun_buf_t *buf = b.bufs[i];
+            std::size_t at = sizeof...(K);
+
+            bool keep = ((std::get<I + K>(stages_)(buf, b.info[k], b.cls[k]) || (at = K, false)) && ...);
+            if (keep) {
+                b.bufs[k++] = buf;
+            } else {
+                buf->next = b.drops;
+                b.drops = buf;
+                b.ndrops++;
+                stats_.drops[I + at]++;
+            }
+        }
+        b.n = k;
+    }
+
+    std::tuple<S...> stages_;
+    std::vector<ad_tun_pkt_info_t> info_;
+    std::vector<uint8_t> cls_;
+    std::vector<ad_tun_buf_t *> scratch_;
+    ad_tun_pipe_stats_t stats_{};
+};
+
+} // namespace ad_tun
+
+#endif
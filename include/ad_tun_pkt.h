@@ -0,0 +1,98 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Packet Helpers     **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_PKT_H_
+#define AD_TUN_SRC_AD_TUN_PKT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Header fields extracted from a raw IPv4/IPv6 packet.
+ *
+ * Addresses are stored in network byte order; IPv4 addresses occupy the
+ * first 4 bytes of src/dst. Ports are in host byte order and are only set
+ * for TCP/UDP packets that are not non-first fragments.
+ */
+typedef struct {
+    int family;             /**< AF_INET, AF_INET6 */
+    uint8_t proto;          /**< Upper-layer protocol (after IPv6 extension headers) */
+    uint8_t tos;            /**< IPv4 TOS / IPv6 traffic class */
+    uint8_t src[16];        /**< Source address */
+    uint8_t dst[16];        /**< Destination address */
+    uint16_t sport;         /**< Source port */
+    uint16_t dport;         /**< Destination port */
+    uint16_t l3_len;        /**< Bytes from the start of the packet to the L4 header */
+    uint32_t tot_len;       /**< Datagram length according to the IP header */
+
+    int is_frag;            /**< Packet is an IP fragment */
+    int more_frags;         /**< MF flag of a fragment */
+    uint16_t frag_off;      /**< Fragment offset in bytes */
+    uint32_t frag_id;       /**< IPv4 identification or IPv6 fragment identification */
+    uint16_t frag_hdr_off;  /**< IPv6: offset of the fragment extension header */
+    uint16_t nh_off;        /**< IPv6: offset of the next-header byte naming the fragment header */
+    int dont_frag;          /**< IPv4 DF flag */
+} ad_tun_pkt_info_t;
+
+/**
+ * @brief Parse the IP (and TCP/UDP port) headers of a raw packet.
+ *
+ * @param data Packet starting at the IP header.
+ * @param len Number of bytes available.
+ * @param info Output structure.
+ * @return 0 on success, -EINVAL if the packet is truncated or not IP.
+ */
+int ad_tun_pkt_parse(const unsigned char *data, size_t len, ad_tun_pkt_info_t *info);
+
+/**
+ * @brief Accumulate data into a 32-bit ones' complement sum.
+ */
+uint32_t ad_tun_csum_partial(const void *data, size_t len, uint32_t sum);
+
+/**
+ * @brief Fold a 32-bit sum and return the ones' complement checksum.
+ */
+uint16_t ad_tun_csum_fold(uint32_t sum);
+
+/**
+ * @brief Recompute the header checksum of an IPv4 header in place.
+ */
+void ad_tun_ipv4_set_csum(unsigned char *iph);
+
+/**
+ * @brief Update a checksum for covered bytes changing from old to new (RFC 1624).
+ *
+ * @param csum Big-endian checksum field.
+ * @param len Even number of bytes, aligned to 16-bit words of the checksummed data.
+ */
+void ad_tun_csum_adjust(unsigned char *csum, const void *old, const void *new_, size_t len);
+
+static inline uint16_t ad_tun_get_be16(const unsigned char *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline void ad_tun_put_be16(unsigned char *p, uint16_t v)
+{
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)v;
+}
+
+static inline uint32_t ad_tun_get_be32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void ad_tun_put_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+#endif
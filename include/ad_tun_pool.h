@@ -0,0 +1,121 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Buffer Pool        **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_POOL_H_
+#define AD_TUN_SRC_AD_TUN_POOL_H_
+
+#include "ad_tun.h"
+#include "ad_tun_numa.h"
+
+#include <pthread.h>
+
+/**
+ * @brief Fixed-size packet buffer pool.
+ *
+ * All buffers are carved out of a single storage block allocated at init
+ * time, so the memory used by a pool is bounded and no allocation happens
+ * on the packet path. Get/put are thread-safe. A pool made with
+ * ad_tun_pool_init_numa() keeps descriptors and storage in one mapping on
+ * the node of the threads that use it.
+ */
+typedef struct {
+    ad_tun_buf_t *bufs;        /**< Descriptor array (internal) */
+    unsigned char *mem;        /**< Storage block (internal) */
+    size_t mem_len;            /**< Size of the storage block */
+    ad_tun_buf_t *free_list;   /**< Free descriptors (internal) */
+    unsigned count;            /**< Total number of buffers */
+    unsigned avail;            /**< Buffers currently free */
+    size_t buf_size;           /**< Storage bytes per buffer */
+    size_t headroom;           /**< Headroom reserved in front of data */
+    pthread_mutex_t lock;      /**< Protects free_list and avail */
+    ad_tun_mem_t map;          /**< Backing of bufs and mem, ptr NULL if on the heap */
+} ad_tun_pool_t;
+
+/**
+ * @brief Initialize a pool of count buffers.
+ *
+ * @param pool Caller-allocated pool to initialize.
+ * @param count Number of buffers.
+ * @param buf_size Usable packet bytes per buffer (headroom not included).
+ * @param headroom Bytes reserved in front of the packet data.
+ * @return AD_TUN_OK on success, AD_TUN_ERR_CONFIG on bad arguments,
+ *         AD_TUN_ERR_SYS if memory cannot be allocated.
+ */
+ad_tun_error_t ad_tun_pool_init(ad_tun_pool_t *pool, unsigned count,
+                                size_t buf_size, size_t headroom);
+
+/**
+ * @brief Initialize a pool placed as mem asks.
+ *
+ * Same as ad_tun_pool_init() with descriptors and buffers on the given
+ * NUMA node, optionally on hugepages. A NULL mem uses the heap.
+ *
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_pool_init_numa(ad_tun_pool_t *pool, unsigned count, size_t buf_size,
+                                     size_t headroom, const ad_tun_mem_config_t *mem);
+
+/**
+ * @brief Release the pool storage.
+ *
+ * All buffers must have been returned; outstanding buffers become invalid.
+ */
+void ad_tun_pool_free(ad_tun_pool_t *pool);
+
+/**
+ * @brief Take a buffer from the pool.
+ *
+ * The returned buffer has data positioned after the headroom and len = 0.
+ *
+ * @return Buffer, or NULL if the pool is exhausted.
+ */
+ad_tun_buf_t *ad_tun_pool_get(ad_tun_pool_t *pool);
+
+/**
+ * @brief Take up to n buffers from the pool under a single lock.
+ *
+ * @return Number of buffers stored in bufs.
+ */
+unsigned ad_tun_pool_get_bulk(ad_tun_pool_t *pool, ad_tun_buf_t **bufs, unsigned n);
+
+/**
+ * @brief Return a buffer to the pool. NULL is ignored.
+ */
+void ad_tun_pool_put(ad_tun_pool_t *pool, ad_tun_buf_t *buf);
+
+/**
+ * @brief Return n buffers to the pool under a single lock.
+ */
+void ad_tun_pool_put_bulk(ad_tun_pool_t *pool, ad_tun_buf_t **bufs, unsigned n);
+
+/**
+ * @brief Return a chain of buffers linked through next.
+ */
+void ad_tun_pool_put_chain(ad_tun_pool_t *pool, ad_tun_buf_t *chain);
+
+/**
+ * @brief Number of buffers currently available.
+ */
+unsigned ad_tun_pool_available(ad_tun_pool_t *pool);
+
+/**
+ * @brief Bytes available after data + len in a buffer.
+ */
+static inline size_t ad_tun_buf_tailroom(const ad_tun_buf_t *buf)
+{
+    return (size_t)(buf->head + buf->size - (buf->data + buf->len));
+}
+
+/**
+ * @brief Bytes available in front of data in a buffer.
+ */
+static inline size_t ad_tun_buf_headroom(const ad_tun_buf_t *buf)
+{
+    return (size_t)(buf->data - buf->head);
+}
+
+#endif
@@ -0,0 +1,181 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Queue Scaling      **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_QSCALE_H_
+#define AD_TUN_SRC_AD_TUN_QSCALE_H_
+
+#include "ad_tun.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+/** Queue attached, its worker serving it. */
+#define AD_TUN_QSCALE_ACTIVE 0
+/** Queue detached, its worker not yet parked. */
+#define AD_TUN_QSCALE_DRAINING 1
+/** Queue detached, its worker asleep in ad_tun_qscale_worker_wait(). */
+#define AD_TUN_QSCALE_PARKED 2
+
+/**
+ * @brief Queue switch: attach (on = 1) or detach (on = 0) queue q.
+ */
+typedef ad_tun_error_t (*ad_tun_qscale_set_fn)(void *arg, unsigned q, int on);
+
+/**
+ * @brief Controller configuration, usually loaded with ad_tun_qscale_load_config().
+ *
+ * Load is judged over the active queues each interval: it is high when
+ * the average rate per queue exceeds up_pps or up_full_pct of reads fill
+ * the whole batch (the queue holds a backlog), and low when both are
+ * under the down thresholds. A threshold of 0 is not used.
+ */
+typedef struct {
+    unsigned min_queues;        /**< Queues always attached, at least 1 */
+    unsigned max_queues;        /**< Queues attached at most, up to the queues open */
+    unsigned interval_ms;       /**< Shortest time between two decisions */
+    uint64_t up_pps;            /**< Packets/s per active queue that count as high load */
+    uint64_t down_pps;          /**< Packets/s per active queue that count as low load */
+    unsigned up_full_pct;       /**< Percent of full batches that count as high load */
+    unsigned down_full_pct;     /**< Percent of full batches that count as low load */
+    unsigned up_intervals;      /**< High intervals in a row before attaching a queue */
+    unsigned down_intervals;    /**< Low intervals in a row before detaching one */
+    ad_tun_qscale_set_fn set_fn;        /**< Queue switch, NULL = ad_tun_set_queue_enabled() */
+    void *set_arg;
+} ad_tun_qscale_config_t;
+
+/**
+ * @brief Controller statistics.
+ */
+typedef struct {
+    uint64_t ups;               /**< Queues attached */
+    uint64_t downs;             /**< Queues detached */
+    uint64_t errors;            /**< Queue switches that failed */
+    uint64_t parks;             /**< Times a worker went to sleep */
+    uint64_t wakes;             /**< Times a parked worker resumed */
+    unsigned active;            /**< Queues attached now */
+} ad_tun_qscale_stats_t;
+
+/**
+ * @brief Per-queue counters, one cache line each (internal).
+ *
+ * pkts, reads and full are written only by the queue's worker; the rest
+ * belongs to the controller.
+ */
+typedef struct {
+    uint64_t pkts;
+    uint64_t reads;
+    uint64_t full;
+    int state;                  /**< AD_TUN_QSCALE_* */
+    uint64_t last_pkts;         /**< Counters at the previous decision */
+    uint64_t last_reads;
+    uint64_t last_full;
+    uint64_t pps;               /**< Rate over the last interval */
+    unsigned full_pct;          /**< Full batches over the last interval, percent */
+} __attribute__((aligned(64))) ad_tun_qscale_queue_t;
+
+/**
+ * @brief Load-driven queue scaling for a multi-queue device.
+ *
+ * Queues 0 .. active - 1 are attached and the rest detached, so the
+ * kernel spreads flows only over queues with a running worker. One
+ * worker thread serves each queue up to max_queues; it reports every
+ * read with ad_tun_qscale_record() and calls ad_tun_qscale_worker_wait()
+ * before the next one, which puts it to sleep while its queue is
+ * detached. A single thread calls ad_tun_qscale_tick() periodically; it
+ * attaches or detaches at most one queue per call, with the hysteresis
+ * of up_intervals / down_intervals.
+ */
+typedef struct {
+    ad_tun_qscale_config_t cfg;
+    ad_tun_qscale_queue_t *queues;      /**< max_queues entries */
+    unsigned active;
+    unsigned up_streak;
+    unsigned down_streak;
+    uint64_t last_ns;           /**< Time of the previous decision, 0 = none yet */
+    int stopping;
+    ad_tun_qscale_stats_t stats;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} ad_tun_qscale_t;
+
+/**
+ * @brief Fill cfg with defaults: 1 to 4 queues, decisions every second,
+ *        up at 200k pps or 50% full batches for 2 intervals, down under
+ *        50k pps and 5% for 5 intervals, switching with ad_tun_set_queue_enabled().
+ */
+void ad_tun_qscale_default_config(ad_tun_qscale_config_t *cfg);
+
+/**
+ * @brief Load the [queue_scaling] section of an INI file.
+ *
+ * Without the section cfg holds the defaults.
+ *
+ * @return AD_TUN_OK or AD_TUN_ERR_CONFIG.
+ */
+ad_tun_error_t ad_tun_qscale_load_config(const char *path, ad_tun_qscale_config_t *cfg);
+
+/**
+ * @brief Initialize a controller and detach queues min_queues .. max_queues - 1.
+ *
+ * With the default switch the device must be running with at least
+ * max_queues queues. Queues above max_queues are left alone.
+ *
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_qscale_init(ad_tun_qscale_t *ctl, const ad_tun_qscale_config_t *cfg);
+
+/**
+ * @brief Free a controller. Workers must have returned from ad_tun_qscale_worker_wait().
+ */
+void ad_tun_qscale_free(ad_tun_qscale_t *ctl);
+
+/**
+ * @brief Account one read on queue q. Called by the queue's worker only.
+ *
+ * @param pkts Packets the read returned, 0 if none.
+ * @param full Nonzero if the read filled the whole batch.
+ */
+void ad_tun_qscale_record(ad_tun_qscale_t *ctl, unsigned q, unsigned pkts, int full);
+
+/**
+ * @brief Decide whether to attach or detach a queue.
+ *
+ * Calls sooner than interval_ms after the previous decision do nothing.
+ *
+ * @param now_ns CLOCK_MONOTONIC time.
+ * @return 1 if a queue was attached, -1 if one was detached, 0 otherwise.
+ */
+int ad_tun_qscale_tick(ad_tun_qscale_t *ctl, uint64_t now_ns);
+
+/**
+ * @brief Called by the worker of queue q before each read.
+ *
+ * Returns at once while the queue is attached. Once it is detached the
+ * worker sleeps here until the controller attaches the queue again.
+ * Workers that poll their queue should use a timeout so they notice a
+ * detach.
+ *
+ * @return 1 to keep serving, 0 once ad_tun_qscale_stop() was called.
+ */
+int ad_tun_qscale_worker_wait(ad_tun_qscale_t *ctl, unsigned q);
+
+/**
+ * @brief Wake every parked worker and make ad_tun_qscale_worker_wait() return 0.
+ */
+void ad_tun_qscale_stop(ad_tun_qscale_t *ctl);
+
+/**
+ * @brief State of queue q (AD_TUN_QSCALE_*), -1 if q is out of range.
+ */
+int ad_tun_qscale_queue_state(ad_tun_qscale_t *ctl, unsigned q);
+
+/**
+ * @brief Copy the controller statistics.
+ */
+void ad_tun_qscale_get_stats(ad_tun_qscale_t *ctl, ad_tun_qscale_stats_t *stats);
+
+#endif
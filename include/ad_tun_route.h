@@ -0,0 +1,130 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Routes             **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_ROUTE_H_
+#define AD_TUN_SRC_AD_TUN_ROUTE_H_
+
+#include "ad_tun.h"
+
+#include <stdint.h>
+
+/** rtm_protocol marking routes owned by ad_tun; sync never touches others. */
+#define AD_TUN_RTPROT 0xad
+
+/** Routing table used when none is given (RT_TABLE_MAIN). */
+#define AD_TUN_ROUTE_TABLE_MAIN 254
+
+/**
+ * @brief One route through a TUN device.
+ */
+typedef struct {
+    uint8_t family;             /**< AF_INET or AF_INET6 */
+    uint8_t plen;               /**< Prefix length */
+    uint8_t dst[16];            /**< Destination prefix, host bits cleared */
+    uint32_t metric;            /**< Priority; IPv6 0 is stored as the kernel's 1024 */
+    uint32_t table;             /**< Routing table id */
+    int ifindex;                /**< Output interface, 0 = given at install time */
+} ad_tun_route_t;
+
+/**
+ * @brief Growable array of routes.
+ */
+typedef struct {
+    ad_tun_route_t *routes;
+    unsigned count;
+    unsigned cap;
+} ad_tun_route_set_t;
+
+/**
+ * @brief Result of ad_tun_route_sync().
+ */
+typedef struct {
+    unsigned added;
+    unsigned removed;
+    unsigned unchanged;
+    unsigned failed;            /**< Requests the kernel rejected */
+} ad_tun_route_stats_t;
+
+/**
+ * @brief Initialize an empty set.
+ */
+void ad_tun_route_set_init(ad_tun_route_set_t *set);
+
+/**
+ * @brief Free the routes of a set.
+ */
+void ad_tun_route_set_free(ad_tun_route_set_t *set);
+
+/**
+ * @brief Append a route.
+ *
+ * @return 0 or -ENOMEM.
+ */
+int ad_tun_route_set_add(ad_tun_route_set_t *set, const ad_tun_route_t *route);
+
+/**
+ * @brief Parse "PREFIX [metric N] [table ID]".
+ *
+ * A prefix without a length is a host route; table accepts a number,
+ * "main", "local" or "default".
+ *
+ * @param metric Metric used when the spec names none.
+ * @param table Table used when the spec names none.
+ * @return 0 or -EINVAL.
+ */
+int ad_tun_route_parse(const char *spec, uint32_t metric, uint32_t table, ad_tun_route_t *out);
+
+/**
+ * @brief Load routes from an INI file.
+ *
+ * Each `route = SPEC` line adds one route; `metric = N` and `table = ID`
+ * set the defaults for the route lines that follow them in the section.
+ *
+ * @param path Path to the INI file.
+ * @param ifname NULL to read `[routes]`; a name to read `[routes:NAME]`;
+ *               "*" to read every `[routes:NAME]` section, with ifindex
+ *               resolved from NAME (routes of missing interfaces are skipped).
+ * @param set Initialized set the routes are appended to.
+ * @return AD_TUN_OK or AD_TUN_ERR_CONFIG.
+ */
+ad_tun_error_t ad_tun_route_load_config(const char *path, const char *ifname, ad_tun_route_set_t *set);
+
+/**
+ * @brief Install routes in batched rtnetlink requests (create or replace).
+ *
+ * @param ifindex Output interface for every route, 0 to use each route's own.
+ * @return Number of rejected routes, or a negative errno.
+ */
+int ad_tun_route_install(const ad_tun_route_t *routes, unsigned n, int ifindex);
+
+/**
+ * @brief Remove routes in batched rtnetlink requests.
+ *
+ * @return Number of rejected requests (e.g. routes already gone), or a negative errno.
+ */
+int ad_tun_route_remove(const ad_tun_route_t *routes, unsigned n, int ifindex);
+
+/**
+ * @brief Make the kernel's ad_tun routes match a set.
+ *
+ * Dumps the routes marked AD_TUN_RTPROT, adds what the set has and the
+ * kernel lacks, then removes what the kernel has and the set lacks.
+ * Matching routes are not touched, so reloading an unchanged
+ * configuration costs one dump. A route moved to another interface is
+ * replaced in place by its add, and removing a route that is already gone
+ * does not count as a failure.
+ *
+ * @param ifindex Scope: with ifindex > 0 every route of the set goes out of
+ *                that interface and only kernel routes on it are considered;
+ *                with 0 routes carry their own ifindex and every ad_tun route
+ *                in the network namespace is considered.
+ * @param stats Optional counters.
+ * @return 0 if every request succeeded, the number rejected, or a negative errno.
+ */
+int ad_tun_route_sync(const ad_tun_route_set_t *set, int ifindex, ad_tun_route_stats_t *stats);
+
+#endif
@@ -0,0 +1,202 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Traffic Shaper     **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_SHAPER_H_
+#define AD_TUN_SRC_AD_TUN_SHAPER_H_
+
+#include "ad_tun.h"
+
+#include <stdint.h>
+
+/** Maximum number of traffic classes. */
+#define AD_TUN_SHAPER_MAX_CLASSES 8
+
+/** Slots in the timer wheel; deferrals longer than this many ticks are re-checked on expiry. */
+#define AD_TUN_SHAPER_WHEEL_SLOTS 1024
+
+/**
+ * @brief Rate and burst of one traffic class.
+ */
+typedef struct {
+    char name[32];              /**< Class name from the [shaper:<name>] section */
+    uint64_t rate;              /**< Bits per second, 0 = limited by the interface only */
+    uint32_t burst;             /**< Bucket size in bytes */
+} ad_tun_shaper_class_cfg_t;
+
+/**
+ * @brief Shaper configuration, usually loaded with ad_tun_shaper_load_config().
+ */
+typedef struct {
+    int enabled;                /**< [shaper] enabled = 0/1 */
+    uint64_t rate;              /**< Interface rate in bits per second, 0 = unlimited */
+    uint32_t burst;             /**< Interface bucket size in bytes */
+    uint64_t flow_rate;         /**< Per-flow rate in bits per second, 0 = no per-flow limit */
+    uint32_t flow_burst;        /**< Per-flow bucket size in bytes */
+    unsigned flow_buckets;      /**< Hashed per-flow buckets (rounded up to a power of two) */
+    unsigned queue_limit;       /**< Packets held back at most; beyond this new packets are dropped */
+    unsigned tick_us;           /**< Timer wheel granularity */
+    unsigned nclasses;          /**< Number of entries in classes */
+    unsigned default_class;     /**< Class of packets whose DSCP is not mapped */
+    ad_tun_shaper_class_cfg_t classes[AD_TUN_SHAPER_MAX_CLASSES];
+    uint8_t dscp_map[64];       /**< DSCP to class index */
+} ad_tun_shaper_config_t;
+
+/**
+ * @brief Token bucket (internal).
+ *
+ * Credit is kept in nanoseconds of transmission time, as the kernel's tbf
+ * does, so refilling is a subtraction and never overflows.
+ */
+typedef struct {
+    int64_t tokens;             /**< Available credit in ns, may go negative by one packet */
+    int64_t depth;              /**< Bucket size in ns */
+    uint64_t ns_per_byte;       /**< Cost of one byte in ns, 20-bit fixed point; 0 = unlimited */
+    uint64_t last_ns;           /**< Time of the last refill */
+} ad_tun_tb_t;
+
+/**
+ * @brief Held-back packet (internal).
+ */
+typedef struct {
+    ad_tun_buf_t *buf;
+    int32_t next;               /**< Next packet in the same queue / free list */
+    uint32_t flow;              /**< Per-flow bucket index */
+    uint8_t cls;                /**< Class index */
+} ad_tun_shaper_desc_t;
+
+/**
+ * @brief FIFO of held-back packets sharing a bucket (internal).
+ */
+typedef struct {
+    int32_t head;
+    int32_t tail;
+    int32_t wnext;              /**< Next queue in the same wheel slot */
+    uint8_t scheduled;          /**< Queue is on the timer wheel */
+} ad_tun_shaper_queue_t;
+
+/**
+ * @brief Shaper statistics.
+ */
+typedef struct {
+    uint64_t passed;            /**< Packets released immediately */
+    uint64_t delayed;           /**< Packets held back and released later */
+    uint64_t dropped;           /**< Packets dropped because queue_limit was reached */
+    uint64_t bytes;             /**< Bytes released */
+} ad_tun_shaper_stats_t;
+
+/**
+ * @brief Hierarchical token-bucket shaper.
+ *
+ * Each packet is classified by DSCP and must conform to the interface
+ * bucket, its class bucket and, when flow_rate is set, its hashed per-flow
+ * bucket. Classes are ceilings under the interface rate; they do not borrow
+ * unused bandwidth from each other. Packets that do not conform are held in
+ * a FIFO per flow bucket (per class without per-flow limits) whose head is
+ * parked on a timer wheel until enough credit has accrued, so per-flow order
+ * is preserved and every operation is O(1) per packet.
+ *
+ * Not thread-safe: use one shaper per writer thread.
+ */
+typedef struct {
+    ad_tun_shaper_config_t cfg;
+    ad_tun_tb_t iface;
+    ad_tun_tb_t classes[AD_TUN_SHAPER_MAX_CLASSES];
+    ad_tun_tb_t *flows;         /**< flow_buckets entries, NULL without per-flow limits */
+    unsigned flow_mask;
+    uint32_t seed;
+    ad_tun_shaper_queue_t *queues;
+    unsigned nqueues;
+    ad_tun_shaper_desc_t *descs;
+    int32_t free_desc;
+    unsigned held;              /**< Packets currently held back */
+    int32_t wheel_head[AD_TUN_SHAPER_WHEEL_SLOTS];
+    int32_t wheel_tail[AD_TUN_SHAPER_WHEEL_SLOTS];
+    uint64_t wheel_tick;        /**< Last tick processed */
+    uint64_t tick_ns;
+    unsigned scheduled;         /**< Queues on the wheel */
+    ad_tun_shaper_stats_t stats;
+} ad_tun_shaper_t;
+
+/**
+ * @brief Load the [shaper] and [shaper:<class>] sections of an INI file.
+ *
+ * The [ad_tun] section is ignored, so the shaper can live in the same file
+ * as the tunnel configuration. Without a [shaper] section cfg->enabled is 0.
+ *
+ * @param path INI file.
+ * @param cfg Output configuration, filled with defaults first.
+ * @return AD_TUN_OK or AD_TUN_ERR_CONFIG.
+ */
+ad_tun_error_t ad_tun_shaper_load_config(const char *path, ad_tun_shaper_config_t *cfg);
+
+/**
+ * @brief Fill cfg with defaults: unlimited, one class, no per-flow limits.
+ */
+void ad_tun_shaper_default_config(ad_tun_shaper_config_t *cfg);
+
+/**
+ * @brief Initialize a shaper.
+ *
+ * @param sh Caller-allocated shaper.
+ * @param cfg Configuration, NULL for the defaults.
+ * @param now_ns Current monotonic time; buckets start full.
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_shaper_init(ad_tun_shaper_t *sh, const ad_tun_shaper_config_t *cfg,
+                                  uint64_t now_ns);
+
+/**
+ * @brief Free a shaper. Held-back buffers must have been taken with ad_tun_shaper_drain().
+ */
+void ad_tun_shaper_free(ad_tun_shaper_t *sh);
+
+/**
+ * @brief Submit a batch of packets.
+ *
+ * Conforming packets are stored in out, in submission order, and may be
+ * written right away. The others are kept by the shaper and come out of
+ * ad_tun_shaper_poll() later. Packets dropped because queue_limit was
+ * reached are prepended to *drops as a chain linked through next, ready
+ * for ad_tun_pool_put_chain().
+ *
+ * @param sh Shaper.
+ * @param in Packets starting at the IP header.
+ * @param n Number of packets in in.
+ * @param now_ns Current monotonic time in nanoseconds.
+ * @param out Output array; must hold n entries.
+ * @param max_out Capacity of out.
+ * @param drops Chain of dropped buffers; *drops is only ever prepended to.
+ * @return Number of packets stored in out, or -EINVAL.
+ */
+int ad_tun_shaper_submit(ad_tun_shaper_t *sh, ad_tun_buf_t **in, unsigned n, uint64_t now_ns,
+                         ad_tun_buf_t **out, unsigned max_out, ad_tun_buf_t **drops);
+
+/**
+ * @brief Release held-back packets that conform by now_ns.
+ *
+ * When out fills up the remaining due packets stay queued and are returned
+ * by the next call.
+ *
+ * @return Number of packets stored in out.
+ */
+int ad_tun_shaper_poll(ad_tun_shaper_t *sh, uint64_t now_ns, ad_tun_buf_t **out, unsigned max_out);
+
+/**
+ * @brief Time at which ad_tun_shaper_poll() should be called next.
+ *
+ * @return Absolute time in nanoseconds, or 0 if nothing is held back.
+ */
+uint64_t ad_tun_shaper_next_timeout(const ad_tun_shaper_t *sh);
+
+/**
+ * @brief Remove every held-back packet regardless of credit.
+ *
+ * @return Chain of buffers linked through next, oldest first per queue.
+ */
+ad_tun_buf_t *ad_tun_shaper_drain(ad_tun_shaper_t *sh);
+
+#endif
@@ -0,0 +1,186 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Shared Memory Ring **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_SHM_H_
+#define AD_TUN_SRC_AD_TUN_SHM_H_
+
+#include "ad_tun.h"
+#include "ad_tun_pool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** One producer and one consumer. */
+#define AD_TUN_SHM_SPSC 0
+/** Any number of producers and consumers, in any of the attached processes. */
+#define AD_TUN_SHM_MPMC 1
+
+/**
+ * @brief Ring configuration.
+ */
+typedef struct {
+    unsigned slots;             /**< Packets the ring holds, rounded up to a power of two */
+    unsigned slot_size;         /**< Largest packet carried, in bytes */
+    int mode;                   /**< AD_TUN_SHM_SPSC or AD_TUN_SHM_MPMC */
+    const char *name;           /**< memfd name shown in /proc/PID/fd, may be NULL */
+} ad_tun_shm_config_t;
+
+/**
+ * @brief Counters kept in the shared region, so every side sees the same values.
+ */
+typedef struct {
+    uint64_t enqueued;          /**< Packets put in the ring */
+    uint64_t dequeued;          /**< Packets taken out of the ring */
+    uint64_t full;              /**< Enqueue calls that stopped on a full ring */
+    uint64_t oversize;          /**< Packets skipped, larger than a slot or the receiving buffer */
+    uint64_t wakeups;           /**< eventfd signals sent to a sleeping side */
+} ad_tun_shm_stats_t;
+
+/** Shared region header (internal). */
+typedef struct ad_tun_shm_hdr ad_tun_shm_hdr_t;
+
+/**
+ * @brief One process's view of a ring.
+ *
+ * The ring lives in a memfd mapped by every process using it. data_fd is
+ * an eventfd the producer signals when a consumer sleeps on an empty ring,
+ * space_fd the reverse; both can be added to an epoll set.
+ */
+typedef struct {
+    ad_tun_shm_hdr_t *hdr;
+    unsigned char *slots;
+    size_t map_len;
+    uint32_t mask;
+    uint32_t stride;            /**< Bytes per slot */
+    uint32_t slot_size;
+    int mode;
+    int mem_fd;
+    int data_fd;
+    int space_fd;
+    uint64_t cached_head;       /**< SPSC consumer: last producer index seen */
+    uint64_t cached_tail;       /**< SPSC producer: last consumer index seen */
+} ad_tun_shm_ring_t;
+
+/**
+ * @brief Fill cfg with defaults: 1024 slots of 2048 bytes, SPSC.
+ */
+void ad_tun_shm_default_config(ad_tun_shm_config_t *cfg);
+
+/**
+ * @brief Create a ring in a new memfd, with its two eventfds.
+ *
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_shm_create(ad_tun_shm_ring_t *ring, const ad_tun_shm_config_t *cfg);
+
+/**
+ * @brief Map a ring from descriptors received from its creator.
+ *
+ * The ring takes ownership of the three descriptors, also on failure.
+ * mem_fd must be sealed with F_SEAL_SHRINK and F_SEAL_GROW, as
+ * ad_tun_shm_create() does, so the peer cannot resize it under the mapping.
+ *
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG (not a sealed ring) or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_shm_attach(ad_tun_shm_ring_t *ring, int mem_fd, int data_fd, int space_fd);
+
+/**
+ * @brief Unmap the ring and close its descriptors.
+ *
+ * The memory goes away once every process has closed it.
+ */
+void ad_tun_shm_close(ad_tun_shm_ring_t *ring);
+
+/**
+ * @brief Pass the ring's descriptors over a Unix socket (SCM_RIGHTS).
+ *
+ * @return AD_TUN_OK or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_shm_send_fds(const ad_tun_shm_ring_t *ring, int sock);
+
+/**
+ * @brief Receive descriptors sent with ad_tun_shm_send_fds() and attach.
+ *
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_shm_recv_fds(ad_tun_shm_ring_t *ring, int sock);
+
+/**
+ * @brief Copy packets into the ring.
+ *
+ * The buffers stay with the caller. Packets larger than a slot are
+ * skipped and counted in oversize. A sleeping consumer is woken once per
+ * call.
+ *
+ * @return Number of packets taken from the front of bufs, stored or
+ *         skipped; fewer than n when the ring is full.
+ */
+unsigned ad_tun_shm_enqueue(ad_tun_shm_ring_t *ring, ad_tun_buf_t *const *bufs, unsigned n);
+
+/**
+ * @brief Copy packets out of the ring into buffers taken from pool.
+ *
+ * @return Number of buffers stored in bufs.
+ */
+unsigned ad_tun_shm_dequeue(ad_tun_shm_ring_t *ring, ad_tun_pool_t *pool, ad_tun_buf_t **bufs, unsigned n);
+
+/**
+ * @brief Point at packets in the ring without copying them (SPSC only).
+ *
+ * The packets stay valid until ad_tun_shm_release().
+ *
+ * @return Number of packets, 0 for an MPMC ring.
+ */
+unsigned ad_tun_shm_peek(ad_tun_shm_ring_t *ring, const unsigned char **pkts, uint32_t *lens, unsigned n);
+
+/**
+ * @brief Hand back the first n packets returned by ad_tun_shm_peek().
+ */
+void ad_tun_shm_release(ad_tun_shm_ring_t *ring, unsigned n);
+
+/**
+ * @brief Packets currently in the ring (a snapshot).
+ */
+unsigned ad_tun_shm_count(const ad_tun_shm_ring_t *ring);
+
+/**
+ * @brief Sleep until the ring has packets, or timeout_ms passes (-1 = forever).
+ *
+ * @return 1 if packets are available, 0 on timeout, -errno on error.
+ */
+int ad_tun_shm_wait_readable(ad_tun_shm_ring_t *ring, int timeout_ms);
+
+/**
+ * @brief Sleep until the ring has a free slot, or timeout_ms passes (-1 = forever).
+ *
+ * @return 1 if a slot is free, 0 on timeout, -errno on error.
+ */
+int ad_tun_shm_wait_writable(ad_tun_shm_ring_t *ring, int timeout_ms);
+
+/**
+ * @brief Announce that the consumer is about to sleep on data_fd in epoll.
+ *
+ * Call before epoll_wait(). Producers only signal data_fd while a
+ * consumer is armed, so a busy ring costs no system calls.
+ *
+ * @return 1 if packets are already available (not armed, do not sleep),
+ *         0 if armed; then call ad_tun_shm_disarm_readable() once
+ *         epoll_wait() returns, whatever woke it.
+ */
+int ad_tun_shm_arm_readable(ad_tun_shm_ring_t *ring);
+
+/**
+ * @brief Undo ad_tun_shm_arm_readable() and clear data_fd.
+ */
+void ad_tun_shm_disarm_readable(ad_tun_shm_ring_t *ring);
+
+/**
+ * @brief Copy the shared counters.
+ */
+void ad_tun_shm_get_stats(const ad_tun_shm_ring_t *ring, ad_tun_shm_stats_t *stats);
+
+#endif
@@ -0,0 +1,72 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Tracepoints        **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_TRACE_H_
+#define AD_TUN_SRC_AD_TUN_TRACE_H_
+
+/*
+ * USDT (statically defined tracing) probes under the provider "ad_tun".
+ *
+ * With <sys/sdt.h> (systemtap-sdt-dev) available each probe is a single
+ * nop plus an ELF note describing where its arguments live; tools such as
+ * bpftrace and perf patch the nop only while attached, so an idle probe
+ * costs nothing and the library gains no runtime dependency. Without the
+ * header, or with AD_TUN_NO_USDT, the probes compile to nothing.
+ *
+ * Probes (arguments in order):
+ *
+ *   config__load      path, err
+ *   start__entry
+ *   start__return     err, ifname, fd
+ *   stop__entry       (also ad_tun_stop_drain())
+ *   stop__return      err
+ *   restart__entry    (also ad_tun_restart_drain())
+ *   restart__return   err
+ *   read              ret (bytes or negative errno), buf
+ *   write             ret (bytes or negative errno), buf, len
+ *   read__batch       ret (packets or negative errno), count
+ *   write__batch      ret (packets or negative errno), count
+ *   queue__set        queue, on (1 = attached, 0 = detached)
+ *
+ * Probes with arguments costly to compute are wrapped in
+ * AD_TUN_TRACE_ENABLED(name), which reads the probe's semaphore: a counter
+ * the tracer raises while attached, so the arguments are only evaluated
+ * then. Every probe needs AD_TUN_TRACE_SEMAPHORE(name) once in the file
+ * that fires it.
+ *
+ * Example:
+ *
+ *   bpftrace -e 'usdt:./libad_tun.so:ad_tun:write /arg0 < 0/ { @err[arg0] = count(); }'
+ */
+
+#if !defined(AD_TUN_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define AD_TUN_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef AD_TUN_HAVE_USDT
+#define AD_TUN_TRACE_SEMAPHORE(name) \
+    unsigned short ad_tun_##name##_semaphore __attribute__((section(".probes")))
+#define AD_TUN_TRACE_ENABLED(name) \
+    __builtin_expect(__atomic_load_n(&ad_tun_##name##_semaphore, __ATOMIC_RELAXED) != 0, 0)
+#define AD_TUN_TRACE0(name) DTRACE_PROBE(ad_tun, name)
+#define AD_TUN_TRACE1(name, a) DTRACE_PROBE1(ad_tun, name, a)
+#define AD_TUN_TRACE2(name, a, b) DTRACE_PROBE2(ad_tun, name, a, b)
+#define AD_TUN_TRACE3(name, a, b, c) DTRACE_PROBE3(ad_tun, name, a, b, c)
+#else
+#define AD_TUN_TRACE_SEMAPHORE(name) extern unsigned short ad_tun_##name##_semaphore
+#define AD_TUN_TRACE_ENABLED(name) 0
+#define AD_TUN_TRACE0(name) ((void)0)
+#define AD_TUN_TRACE1(name, a) ((void)0)
+#define AD_TUN_TRACE2(name, a, b) ((void)0)
+#define AD_TUN_TRACE3(name, a, b, c) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,182 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Write Queue        **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#ifndef AD_TUN_SRC_AD_TUN_WQ_H_
+#define AD_TUN_SRC_AD_TUN_WQ_H_
+
+#include "ad_tun.h"
+#include "ad_tun_pool.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+
+/** Maximum number of classes in a write queue. */
+#define AD_TUN_WQ_MAX_CLASSES 8
+
+/**
+ * @brief Scheduling between classes.
+ */
+typedef enum {
+    AD_TUN_WQ_STRICT = 0,       /**< Lowest class index first */
+    AD_TUN_WQ_DRR               /**< Deficit round robin, quantum bytes per class and round */
+} ad_tun_wq_sched_t;
+
+/**
+ * @brief Packet writer: returns bytes written, -EAGAIN when the device is full, or another negative errno.
+ */
+typedef ssize_t (*ad_tun_wq_write_fn)(void *arg, const char *buf, size_t len);
+
+/**
+ * @brief Backpressure notification: on = 1 at the high watermark, 0 back at the low watermark.
+ *
+ * Called with the queue lock held; it must not call back into the queue.
+ */
+typedef void (*ad_tun_wq_pressure_fn)(void *arg, int on);
+
+/**
+ * @brief Write queue configuration.
+ */
+typedef struct {
+    unsigned nclasses;                          /**< Number of classes, class 0 is the most important */
+    ad_tun_wq_sched_t sched;                    /**< Scheduling between classes */
+    unsigned limit[AD_TUN_WQ_MAX_CLASSES];      /**< Packets each class may hold */
+    unsigned quantum[AD_TUN_WQ_MAX_CLASSES];    /**< DRR bytes per round */
+    unsigned high_wm;                           /**< Queued packets that raise backpressure, 0 = never */
+    unsigned low_wm;                            /**< Queued packets that clear it */
+    size_t buf_size;                            /**< Largest packet accepted */
+    ad_tun_wq_write_fn write_fn;                /**< Writer, NULL = ad_tun_write() */
+    void *write_arg;
+    ad_tun_wq_pressure_fn on_pressure;          /**< Optional backpressure callback */
+    void *pressure_arg;
+    const ad_tun_mem_config_t *mem;             /**< Placement of queue buffers, NULL = heap; read at init */
+} ad_tun_wq_config_t;
+
+/**
+ * @brief Write queue statistics.
+ */
+typedef struct {
+    uint64_t enqueued;          /**< Packets accepted */
+    uint64_t sent;              /**< Packets written */
+    uint64_t rejected;          /**< Packets refused because their class was full */
+    uint64_t errors;            /**< Packets dropped on a write error other than EAGAIN */
+    uint64_t blocked;           /**< Times the writer returned EAGAIN */
+    uint64_t pressure_on;       /**< High watermark crossings */
+} ad_tun_wq_stats_t;
+
+/**
+ * @brief FIFO of one class (internal).
+ */
+typedef struct {
+    ad_tun_buf_t *head;         /**< Linked through next */
+    ad_tun_buf_t *tail;
+    unsigned count;
+    int32_t deficit;            /**< DRR credit in bytes */
+} ad_tun_wq_class_t;
+
+/**
+ * @brief Bounded multi-producer write queue.
+ *
+ * Packets are copied into buffers from a pool owned by the queue, so a
+ * producer may reuse its buffer as soon as ad_tun_wq_enqueue() returns and
+ * a full device never causes a drop: a packet refused with EAGAIN goes back
+ * to the head of its class and the queue waits for EPOLLOUT. Any number of
+ * threads may enqueue; one thread at a time drains, and producers calling
+ * ad_tun_wq_send() take that role when nobody else has it.
+ */
+typedef struct {
+    ad_tun_wq_config_t cfg;
+    ad_tun_pool_t pool;
+    ad_tun_wq_class_t classes[AD_TUN_WQ_MAX_CLASSES];
+    unsigned nonempty;          /**< Bit per class with queued packets */
+    unsigned drr_cur;           /**< DRR class being served */
+    unsigned total;             /**< Packets queued, including one being written */
+    int draining;               /**< A thread is draining */
+    int blocked;                /**< Last write returned EAGAIN */
+    int pressure;               /**< Above the high watermark, not yet back at the low one */
+    int epfd;                   /**< epoll instance toggled for EPOLLOUT, -1 if none */
+    int ep_fd;
+    struct epoll_event ep_ev;   /**< Registration without EPOLLOUT */
+    int ep_armed;               /**< EPOLLOUT currently requested */
+    ad_tun_wq_stats_t stats;
+    pthread_mutex_t lock;
+} ad_tun_wq_t;
+
+/**
+ * @brief Fill cfg with defaults: 3 strict-priority classes of 128 packets,
+ *        watermarks at 256/64, 9000 byte packets, writing with ad_tun_write().
+ */
+void ad_tun_wq_default_config(ad_tun_wq_config_t *cfg);
+
+/**
+ * @brief Initialize a write queue.
+ *
+ * @param wq Caller-allocated queue.
+ * @param cfg Configuration, NULL for the defaults.
+ * @return AD_TUN_OK, AD_TUN_ERR_CONFIG or AD_TUN_ERR_SYS.
+ */
+ad_tun_error_t ad_tun_wq_init(ad_tun_wq_t *wq, const ad_tun_wq_config_t *cfg);
+
+/**
+ * @brief Free a write queue, dropping queued packets. No other thread may use it.
+ */
+void ad_tun_wq_free(ad_tun_wq_t *wq);
+
+/**
+ * @brief Let the queue request EPOLLOUT on fd while it is blocked.
+ *
+ * fd must already be registered in epfd with ev; the queue switches the
+ * registration between ev->events and ev->events | EPOLLOUT with
+ * EPOLL_CTL_MOD. The caller calls ad_tun_wq_drain() on EPOLLOUT.
+ *
+ * @return AD_TUN_OK or AD_TUN_ERR_CONFIG.
+ */
+ad_tun_error_t ad_tun_wq_attach_epoll(ad_tun_wq_t *wq, int epfd, int fd,
+                                      const struct epoll_event *ev);
+
+/**
+ * @brief Queue a packet without writing anything.
+ *
+ * @return len on success, -ENOBUFS if the class is full (backpressure),
+ *         -EMSGSIZE if len exceeds buf_size, -EINVAL on bad arguments.
+ */
+ssize_t ad_tun_wq_enqueue(ad_tun_wq_t *wq, unsigned cls, const char *buf, size_t len);
+
+/**
+ * @brief Queue a packet and drain the queue unless it is blocked or
+ *        another thread is draining.
+ *
+ * The calling thread may write packets queued by other producers.
+ *
+ * @return As ad_tun_wq_enqueue().
+ */
+ssize_t ad_tun_wq_send(ad_tun_wq_t *wq, unsigned cls, const char *buf, size_t len);
+
+/**
+ * @brief Write queued packets until the queue is empty or the writer
+ *        returns EAGAIN. Call on EPOLLOUT.
+ *
+ * @return Number of packets written, 0 if another thread is draining.
+ */
+int ad_tun_wq_drain(ad_tun_wq_t *wq);
+
+/**
+ * @brief Number of packets queued, in total (cls < 0) or in one class.
+ */
+unsigned ad_tun_wq_count(ad_tun_wq_t *wq, int cls);
+
+/**
+ * @brief Nonzero while the writer is blocked and the queue waits for EPOLLOUT.
+ */
+int ad_tun_wq_blocked(ad_tun_wq_t *wq);
+
+/**
+ * @brief Nonzero between a high watermark crossing and the return to the low watermark.
+ */
+int ad_tun_wq_pressure(ad_tun_wq_t *wq);
+
+#endif
@@ -7,6 +7,14 @@
 
 #include "../include/ad_tun.h"
 #include "../include/ad_tun_helper.h"
+#include "../include/ad_tun_frag.h"
+#include "../include/ad_tun_pkt.h"
+#include "../include/ad_tun_capture.h"
+#include "../include/ad_tun_ipfix.h"
+#include "../include/ad_tun_latency.h"
+#include "../include/ad_tun_trace.h"
+#include "../include/ad_tun_nl.h"
+#include "../include/ad_tun_eth.h"
 #include "../../prebuilt/inih/include/ini.h"
 #include "../../prebuilt/zlog/include/zlog.h"
 
@@ -16,15 +24,54 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <net/if.h>
 #include <linux/if.h>
 #include <linux/if_tun.h>
+#include <linux/virtio_net.h>
+#include <linux/rtnetlink.h>
 #include <errno.h>
 #include <stdio.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <limits.h>
 
 /* Default values for ad_tun_config_t */
 #define DEFAULT_MTU 1500
 #define DEFAULT_PERSIST 0
+#define DEFAULT_FRAGMENT 0
+#define DEFAULT_REASSEMBLE 0
+#define DEFAULT_OFFLOAD 0
+#define DEFAULT_MODE AD_TUN_MODE_TUN
+#define DEFAULT_QUEUES 1
+
+/* Fragmentation / reassembly sizing */
+#define FRAG_POOL_SIZE 128           /* fragment buffers for the write path */
+#define FRAG_MAX_OUT 64              /* fragments per datagram on the write path */
+#define REASM_POOL_SIZE 1024         /* buffers holding queued fragments */
+#define REASM_MAX_DATAGRAMS 256      /* concurrent partial datagrams */
+#define REASM_TIMEOUT_MS 30000       /* lifetime of a partial datagram */
+
+/* Graceful stop */
+#define DRAIN_BUF_SIZE 65536         /* read-out buffer, the largest IP packet */
+#define DRAIN_FLUSH_PAUSE_NS 1000000 /* between flush callbacks that left packets queued */
+
+/* USDT probe semaphores, see ad_tun_trace.h */
+AD_TUN_TRACE_SEMAPHORE(config__load);
+AD_TUN_TRACE_SEMAPHORE(start__entry);
+AD_TUN_TRACE_SEMAPHORE(start__return);
+AD_TUN_TRACE_SEMAPHORE(stop__entry);
+AD_TUN_TRACE_SEMAPHORE(stop__return);
+AD_TUN_TRACE_SEMAPHORE(restart__entry);
+AD_TUN_TRACE_SEMAPHORE(restart__return);
+AD_TUN_TRACE_SEMAPHORE(read);
+AD_TUN_TRACE_SEMAPHORE(write);
+AD_TUN_TRACE_SEMAPHORE(read__batch);
+AD_TUN_TRACE_SEMAPHORE(write__batch);
+AD_TUN_TRACE_SEMAPHORE(queue__set);
+
+_Static_assert(sizeof(ad_tun_vnet_hdr_t) == sizeof(struct virtio_net_hdr),
+               "ad_tun_vnet_hdr_t must match struct virtio_net_hdr");
 
 /* Internal module state */
 static ad_tun_state_t g_state = AD_TUN_STATE_UNINITIALIZED;
@@ -33,6 +80,34 @@ static pthread_mutex_t g_state_lock = PTHREAD_MUTEX_INITIALIZER;
 static int g_tun_fd = -1;
 static int g_config_initialized = 0;
 
+/* Queue descriptors while running; g_queue_fds[0] == g_tun_fd */
+static int g_queue_fds[AD_TUN_MAX_QUEUES];
+static unsigned g_num_queues = 0;
+
+/* Drain support: I/O calls in progress, and the thread allowed to write while draining */
+static unsigned g_io_inflight = 0;
+static int g_draining = 0;
+static pthread_cond_t g_drain_cond = PTHREAD_COND_INITIALIZER;
+static _Thread_local int t_drain_writer = 0;
+
+/* Fragmentation / reassembly state, set up by ad_tun_start() */
+static ad_tun_pool_t g_frag_pool;
+static ad_tun_pool_t g_reasm_pool;
+static ad_tun_reasm_t g_reasm;
+static pthread_mutex_t g_reasm_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_frag_ready = 0;
+static int g_reasm_ready = 0;
+static uint64_t g_reasm_next_ms = 0;       /* oldest partial datagram's expiry, 0 = none */
+static ad_tun_frag_stats_t g_frag_stats;   /* write path, updated atomically */
+
+/* "tun" / "tap" to ad_tun_mode_t, -1 if neither */
+static int ad_tun_parse_mode(const char *value)
+{
+    if (strcmp(value, "tun") == 0) return AD_TUN_MODE_TUN;
+    if (strcmp(value, "tap") == 0) return AD_TUN_MODE_TAP;
+    return -1;
+}
+
 /* ---- INI handler callback with logging ---- */
 static int ad_tun_ini_handler(void* user, const char* section,
                               const char* name, const char* value)
@@ -70,6 +145,32 @@ static int ad_tun_ini_handler(void* user, const char* section,
         cfg->mtu = atoi(value);
     } else if (strcmp(name, "persist") == 0) {
         cfg->persist = atoi(value);
+    } else if (strcmp(name, "fragment") == 0) {
+        cfg->fragment = atoi(value);
+    } else if (strcmp(name, "reassemble") == 0) {
+        cfg->reassemble = atoi(value);
+    } else if (strcmp(name, "offload") == 0) {
+        cfg->offload = atoi(value);
+    } else if (strcmp(name, "queues") == 0) {
+        cfg->queues = atoi(value);
+    } else if (strcmp(name, "mode") == 0) {
+        cfg->mode = ad_tun_parse_mode(value);
+        if (cfg->mode < 0) {
+            zlog_error(zc, "Config error: 'mode' must be tun or tap, got '%s'", value);
+            return 0;
+        }
+    } else if (strcmp(name, "mac") == 0) {
+        uint8_t mac[AD_TUN_ETH_ALEN];
+        if (ad_tun_eth_parse_mac(value, mac) != 0) {
+            zlog_error(zc, "Config error: 'mac' is not a unicast MAC address: '%s'", value);
+            return 0;
+        }
+        free((char*)cfg->mac);
+        cfg->mac = strdup(value);
+        if (!cfg->mac) {
+            zlog_error(zc, "Memory allocation failed for 'mac'");
+            return 0;
+        }
     } else {
         zlog_warn(zc, "Unknown config key ignored: %s", name);
     }
@@ -85,12 +186,57 @@ void ad_tun_free_config(ad_tun_config_t *cfg)
     free((char*)cfg->ifname);
     free((char*)cfg->ipv4);
     free((char*)cfg->ipv6);
+    free((char*)cfg->mac);
 
     memset(cfg, 0, sizeof(*cfg));
 }
 
+/* Replace out-of-range numeric values with their defaults */
+static void ad_tun_check_config(ad_tun_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (cfg->mtu <= 0 || cfg->mtu > 9000) {
+        zlog_warn(zc, "Config warning: 'mtu' is invalid (%d), using default %d", cfg->mtu, DEFAULT_MTU);
+        cfg->mtu = DEFAULT_MTU;
+    }
+
+    if (cfg->persist != 0 && cfg->persist != 1) {
+        zlog_warn(zc, "Config warning: 'persist' should be 0 or 1, using default %d", DEFAULT_PERSIST);
+        cfg->persist = DEFAULT_PERSIST;
+    }
+
+    if (cfg->fragment != 0 && cfg->fragment != 1) {
+        zlog_warn(zc, "Config warning: 'fragment' should be 0 or 1, using default %d", DEFAULT_FRAGMENT);
+        cfg->fragment = DEFAULT_FRAGMENT;
+    }
+
+    if (cfg->reassemble != 0 && cfg->reassemble != 1) {
+        zlog_warn(zc, "Config warning: 'reassemble' should be 0 or 1, using default %d", DEFAULT_REASSEMBLE);
+        cfg->reassemble = DEFAULT_REASSEMBLE;
+    }
+
+    if (cfg->offload != 0 && cfg->offload != 1) {
+        zlog_warn(zc, "Config warning: 'offload' should be 0 or 1, using default %d", DEFAULT_OFFLOAD);
+        cfg->offload = DEFAULT_OFFLOAD;
+    }
+
+    if (cfg->queues < 1 || cfg->queues > AD_TUN_MAX_QUEUES) {
+        zlog_warn(zc, "Config warning: 'queues' should be 1..%d, using default %d",
+                  AD_TUN_MAX_QUEUES, DEFAULT_QUEUES);
+        cfg->queues = DEFAULT_QUEUES;
+    }
+
+    /* Fragmentation works on IP packets; TAP devices carry frames */
+    if (cfg->mode == AD_TUN_MODE_TAP && (cfg->fragment || cfg->reassemble)) {
+        zlog_warn(zc, "Config warning: 'fragment'/'reassemble' are not supported in tap mode, disabled");
+        cfg->fragment = 0;
+        cfg->reassemble = 0;
+    }
+}
+
 /* Load configuration from INI file */
-ad_tun_error_t ad_tun_load_config(const char *path, ad_tun_config_t *out_cfg)
+static ad_tun_error_t ad_tun_do_load_config(const char *path, ad_tun_config_t *out_cfg)
 {
     /* Ensure zlog is initialized before any logging calls. Ignore errors and fall back to stderr. */
     ad_tun_zlog_init();
@@ -104,6 +250,11 @@ ad_tun_error_t ad_tun_load_config(const char *path, ad_tun_config_t *out_cfg)
     memset(out_cfg, 0, sizeof(*out_cfg));
     out_cfg->mtu = DEFAULT_MTU;
     out_cfg->persist = DEFAULT_PERSIST;
+    out_cfg->fragment = DEFAULT_FRAGMENT;
+    out_cfg->reassemble = DEFAULT_REASSEMBLE;
+    out_cfg->offload = DEFAULT_OFFLOAD;
+    out_cfg->mode = DEFAULT_MODE;
+    out_cfg->queues = DEFAULT_QUEUES;
 
     zlog_category_t *zc = zlog_get_category("ad_tun");
     zlog_info(zc, "Loading config file: %s", path);
@@ -135,24 +286,392 @@ ad_tun_error_t ad_tun_load_config(const char *path, ad_tun_config_t *out_cfg)
         out_cfg->ipv6 = NULL;
     }
 
-    if (out_cfg->mtu <= 0 || out_cfg->mtu > 9000) {
-        zlog_warn(zc, "Config warning: 'mtu' is invalid (%d), using default %d", out_cfg->mtu, DEFAULT_MTU);
-        out_cfg->mtu = DEFAULT_MTU;
+    ad_tun_check_config(out_cfg);
+
+    zlog_info(zc, "Config loaded successfully from %s", path);
+    zlog_debug(zc, "ifname=%s, ipv4=%s, ipv6=%s, mtu=%d, persist=%d, fragment=%d, reassemble=%d, offload=%d, mode=%s, mac=%s",
+               out_cfg->ifname, out_cfg->ipv4, out_cfg->ipv6 ? out_cfg->ipv6 : "none",
+               out_cfg->mtu, out_cfg->persist, out_cfg->fragment, out_cfg->reassemble,
+               out_cfg->offload, out_cfg->mode == AD_TUN_MODE_TAP ? "tap" : "tun",
+               out_cfg->mac ? out_cfg->mac : "auto");
+
+    return AD_TUN_OK;
+}
+
+ad_tun_error_t ad_tun_load_config(const char *path, ad_tun_config_t *out_cfg)
+{
+    ad_tun_error_t err = ad_tun_do_load_config(path, out_cfg);
+    AD_TUN_TRACE2(config__load, path, (int)err);
+    return err;
+}
+
+/* ---- Multi-section configuration ---- */
+
+#define CFGSET_INITIAL_STRS 4096
+#define CFGSET_INITIAL_TUNS 64
+
+/* Keys given explicitly in a section */
+#define CFG_SET_IFNAME     (1u << 0)
+#define CFG_SET_IPV4       (1u << 1)
+#define CFG_SET_IPV6       (1u << 2)
+#define CFG_SET_MTU        (1u << 3)
+#define CFG_SET_PERSIST    (1u << 4)
+#define CFG_SET_FRAGMENT   (1u << 5)
+#define CFG_SET_REASSEMBLE (1u << 6)
+#define CFG_SET_OFFLOAD    (1u << 7)
+#define CFG_SET_MODE       (1u << 8)
+#define CFG_SET_MAC        (1u << 9)
+#define CFG_SET_QUEUES     (1u << 10)
+
+/* One section while parsing; strings are arena offsets + 1, 0 = unset */
+typedef struct {
+    size_t name;
+    size_t ifname;
+    size_t ipv4;
+    size_t ipv6;
+    int mtu;
+    int persist;
+    int fragment;
+    int reassemble;
+    int offload;
+    int mode;
+    size_t mac;
+    int queues;
+    unsigned set;
+} cfgset_entry_t;
+
+/* State carried through ini_parse() */
+typedef struct {
+    char *strs;                 /* string arena, grows by doubling */
+    size_t len;
+    size_t cap;
+    cfgset_entry_t *ents;
+    unsigned count;
+    unsigned ents_cap;
+    unsigned *index;            /* open addressing by section name, slot = entry + 1 */
+    unsigned index_cap;
+    cfgset_entry_t defaults;
+    cfgset_entry_t *cur;        /* section being parsed, NULL if ignored */
+    size_t cur_name;            /* arena offset + 1 of its section name, 0 = none */
+    int nomem;
+} cfgset_ctx_t;
+
+/* FNV-1a of a section name */
+static uint32_t cfgset_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
     }
+    return h;
+}
 
-    if (out_cfg->persist != 0 && out_cfg->persist != 1) {
-        zlog_warn(zc, "Config warning: 'persist' should be 0 or 1, using default %d", DEFAULT_PERSIST);
-        out_cfg->persist = DEFAULT_PERSIST;
+/* Copy a string into the arena; returns its offset + 1, 0 on allocation failure */
+static size_t cfgset_str(cfgset_ctx_t *ctx, const char *s)
+{
+    size_t n = strlen(s) + 1;
+    if (ctx->len + n > ctx->cap) {
+        size_t cap = ctx->cap ? ctx->cap : CFGSET_INITIAL_STRS;
+        while (cap < ctx->len + n) cap *= 2;
+        char *strs = realloc(ctx->strs, cap);
+        if (!strs) return 0;
+        ctx->strs = strs;
+        ctx->cap = cap;
     }
+    memcpy(ctx->strs + ctx->len, s, n);
+    ctx->len += n;
+    return ctx->len - n + 1;
+}
 
-    zlog_info(zc, "Config loaded successfully from %s", path);
-    zlog_debug(zc, "ifname=%s, ipv4=%s, ipv6=%s, mtu=%d, persist=%d",
-               out_cfg->ifname, out_cfg->ipv4, out_cfg->ipv6 ? out_cfg->ipv6 : "none",
-               out_cfg->mtu, out_cfg->persist);
+static const char *cfgset_at(const cfgset_ctx_t *ctx, size_t off)
+{
+    return off ? ctx->strs + off - 1 : NULL;
+}
+
+/* Keep the section index at most half full */
+static int cfgset_index_grow(cfgset_ctx_t *ctx)
+{
+    if ((ctx->count + 1) * 2 <= ctx->index_cap) return 0;
+
+    unsigned cap = ctx->index_cap ? ctx->index_cap * 2 : CFGSET_INITIAL_TUNS * 2;
+    unsigned *index = calloc(cap, sizeof(*index));
+    if (!index) return -1;
+
+    for (unsigned i = 0; i < ctx->count; i++) {
+        unsigned slot = cfgset_hash(cfgset_at(ctx, ctx->ents[i].name)) & (cap - 1);
+        while (index[slot]) slot = (slot + 1) & (cap - 1);
+        index[slot] = i + 1;
+    }
+    free(ctx->index);
+    ctx->index = index;
+    ctx->index_cap = cap;
+    return 0;
+}
+
+/* Find the entry of a tunnel section, creating it on first use */
+static cfgset_entry_t *cfgset_entry_for(cfgset_ctx_t *ctx, const char *section)
+{
+    if (ctx->index_cap) {
+        unsigned slot = cfgset_hash(section) & (ctx->index_cap - 1);
+        while (ctx->index[slot]) {
+            cfgset_entry_t *e = &ctx->ents[ctx->index[slot] - 1];
+            if (strcmp(cfgset_at(ctx, e->name), section) == 0) return e;
+            slot = (slot + 1) & (ctx->index_cap - 1);
+        }
+    }
+
+    if (ctx->count == ctx->ents_cap) {
+        unsigned cap = ctx->ents_cap ? ctx->ents_cap * 2 : CFGSET_INITIAL_TUNS;
+        cfgset_entry_t *ents = realloc(ctx->ents, cap * sizeof(*ents));
+        if (!ents) return NULL;
+        ctx->ents = ents;
+        ctx->ents_cap = cap;
+    }
+    if (cfgset_index_grow(ctx) != 0) return NULL;
+
+    size_t name = cfgset_str(ctx, section);
+    if (!name) return NULL;
 
+    cfgset_entry_t *e = &ctx->ents[ctx->count];
+    memset(e, 0, sizeof(*e));
+    e->name = name;
+
+    unsigned slot = cfgset_hash(section) & (ctx->index_cap - 1);
+    while (ctx->index[slot]) slot = (slot + 1) & (ctx->index_cap - 1);
+    ctx->index[slot] = ++ctx->count;
+    return e;
+}
+
+static int cfgset_ini_handler(void *user, const char *section,
+                              const char *name, const char *value)
+{
+    cfgset_ctx_t *ctx = (cfgset_ctx_t*)user;
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    /* inih reports the section with every key; resolve it only when it changes */
+    if (!ctx->cur_name || strcmp(cfgset_at(ctx, ctx->cur_name), section) != 0) {
+        if (strcmp(section, "defaults") == 0) {
+            ctx->cur = &ctx->defaults;
+        } else if (strcmp(section, "ad_tun") == 0 ||
+                   (strncmp(section, "tun:", 4) == 0 && section[4] != '\0')) {
+            ctx->cur = cfgset_entry_for(ctx, section);
+            if (!ctx->cur) {
+                ctx->nomem = 1;
+                return 0;
+            }
+        } else {
+            zlog_debug(zc, "Ignoring section: %s", section);
+            ctx->cur = NULL;
+        }
+        ctx->cur_name = (ctx->cur && ctx->cur != &ctx->defaults) ? ctx->cur->name : cfgset_str(ctx, section);
+        if (!ctx->cur_name) {
+            ctx->nomem = 1;
+            return 0;
+        }
+    }
+
+    cfgset_entry_t *e = ctx->cur;
+    if (!e) return 1;
+
+    if (strcmp(name, "ifname") == 0) {
+        if (e == &ctx->defaults) {
+            zlog_warn(zc, "Config warning: 'ifname' in [defaults] ignored");
+            return 1;
+        }
+        e->ifname = cfgset_str(ctx, value);
+        e->set |= CFG_SET_IFNAME;
+    } else if (strcmp(name, "ipv4") == 0) {
+        e->ipv4 = cfgset_str(ctx, value);
+        e->set |= CFG_SET_IPV4;
+    } else if (strcmp(name, "ipv6") == 0) {
+        e->ipv6 = cfgset_str(ctx, value);
+        e->set |= CFG_SET_IPV6;
+    } else if (strcmp(name, "mtu") == 0) {
+        e->mtu = atoi(value);
+        e->set |= CFG_SET_MTU;
+    } else if (strcmp(name, "persist") == 0) {
+        e->persist = atoi(value);
+        e->set |= CFG_SET_PERSIST;
+    } else if (strcmp(name, "fragment") == 0) {
+        e->fragment = atoi(value);
+        e->set |= CFG_SET_FRAGMENT;
+    } else if (strcmp(name, "reassemble") == 0) {
+        e->reassemble = atoi(value);
+        e->set |= CFG_SET_REASSEMBLE;
+    } else if (strcmp(name, "offload") == 0) {
+        e->offload = atoi(value);
+        e->set |= CFG_SET_OFFLOAD;
+    } else if (strcmp(name, "queues") == 0) {
+        e->queues = atoi(value);
+        e->set |= CFG_SET_QUEUES;
+    } else if (strcmp(name, "mode") == 0) {
+        e->mode = ad_tun_parse_mode(value);
+        if (e->mode < 0) {
+            zlog_error(zc, "Config error: [%s] 'mode' must be tun or tap, got '%s'", section, value);
+            return 0;
+        }
+        e->set |= CFG_SET_MODE;
+    } else if (strcmp(name, "mac") == 0) {
+        uint8_t mac[AD_TUN_ETH_ALEN];
+        /* One address on many devices would make them collide */
+        if (e == &ctx->defaults) {
+            zlog_warn(zc, "Config warning: 'mac' in [defaults] ignored");
+            return 1;
+        }
+        if (ad_tun_eth_parse_mac(value, mac) != 0) {
+            zlog_error(zc, "Config error: [%s] 'mac' is not a unicast MAC address: '%s'", section, value);
+            return 0;
+        }
+        e->mac = cfgset_str(ctx, value);
+        e->set |= CFG_SET_MAC;
+    } else {
+        zlog_warn(zc, "Unknown config key ignored: [%s] %s", section, name);
+        return 1;
+    }
+
+    /* The string keys above may have failed to allocate */
+    if (((e->set & CFG_SET_IFNAME) && !e->ifname) ||
+        ((e->set & CFG_SET_IPV4) && !e->ipv4) || ((e->set & CFG_SET_IPV6) && !e->ipv6) ||
+        ((e->set & CFG_SET_MAC) && !e->mac)) {
+        ctx->nomem = 1;
+        return 0;
+    }
+    return 1;
+}
+
+/* Fill keys a section left out from [defaults], then the built-in defaults */
+static void cfgset_inherit(cfgset_entry_t *e, const cfgset_entry_t *d)
+{
+    unsigned from = d->set & ~e->set;
+
+    if (from & CFG_SET_IPV4) e->ipv4 = d->ipv4;
+    if (from & CFG_SET_IPV6) e->ipv6 = d->ipv6;
+    if (from & CFG_SET_MTU) e->mtu = d->mtu;
+    if (from & CFG_SET_PERSIST) e->persist = d->persist;
+    if (from & CFG_SET_FRAGMENT) e->fragment = d->fragment;
+    if (from & CFG_SET_REASSEMBLE) e->reassemble = d->reassemble;
+    if (from & CFG_SET_OFFLOAD) e->offload = d->offload;
+    if (from & CFG_SET_MODE) e->mode = d->mode;
+    if (from & CFG_SET_QUEUES) e->queues = d->queues;
+
+    unsigned set = e->set | d->set;
+    if (!(set & CFG_SET_MTU)) e->mtu = DEFAULT_MTU;
+    if (!(set & CFG_SET_PERSIST)) e->persist = DEFAULT_PERSIST;
+    if (!(set & CFG_SET_FRAGMENT)) e->fragment = DEFAULT_FRAGMENT;
+    if (!(set & CFG_SET_REASSEMBLE)) e->reassemble = DEFAULT_REASSEMBLE;
+    if (!(set & CFG_SET_OFFLOAD)) e->offload = DEFAULT_OFFLOAD;
+    if (!(set & CFG_SET_MODE)) e->mode = DEFAULT_MODE;
+    if (!(set & CFG_SET_QUEUES)) e->queues = DEFAULT_QUEUES;
+}
+
+/* Build the final array and string block; returns AD_TUN_ERR_CONFIG on a bad tunnel */
+static ad_tun_error_t cfgset_finish(cfgset_ctx_t *ctx, ad_tun_config_set_t *out_set)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+    size_t tuns_size = (size_t)ctx->count * sizeof(ad_tun_config_t);
+
+    char *block = malloc(tuns_size + ctx->len);
+    if (!block) {
+        zlog_error(zc, "Memory allocation failed for %u tunnel configs", ctx->count);
+        return AD_TUN_ERR_CONFIG;
+    }
+    memcpy(block + tuns_size, ctx->strs, ctx->len);
+
+    ad_tun_config_t *tuns = (ad_tun_config_t*)block;
+    char *strs = block + tuns_size;
+#define CFGSET_PTR(off) ((off) ? strs + (off) - 1 : NULL)
+
+    for (unsigned i = 0; i < ctx->count; i++) {
+        cfgset_entry_t *e = &ctx->ents[i];
+        const char *section = CFGSET_PTR(e->name);
+        ad_tun_config_t *cfg = &tuns[i];
+
+        cfgset_inherit(e, &ctx->defaults);
+
+        memset(cfg, 0, sizeof(*cfg));
+        /* [tun:NAME] names the interface unless ifname says otherwise */
+        cfg->ifname = e->ifname ? CFGSET_PTR(e->ifname) : (strncmp(section, "tun:", 4) == 0 ? section + 4 : NULL);
+        cfg->ipv4 = CFGSET_PTR(e->ipv4);
+        cfg->ipv6 = CFGSET_PTR(e->ipv6);
+        cfg->mtu = e->mtu;
+        cfg->persist = e->persist;
+        cfg->fragment = e->fragment;
+        cfg->reassemble = e->reassemble;
+        cfg->offload = e->offload;
+        cfg->mode = e->mode;
+        cfg->mac = CFGSET_PTR(e->mac);
+        cfg->queues = e->queues;
+
+        if (!cfg->ifname || cfg->ifname[0] == '\0') {
+            zlog_error(zc, "Config error: [%s] 'ifname' is missing or empty", section);
+            free(block);
+            return AD_TUN_ERR_CONFIG;
+        }
+        if (!cfg->ipv4 || cfg->ipv4[0] == '\0') {
+            zlog_error(zc, "Config error: [%s] 'ipv4' is missing or empty", section);
+            free(block);
+            return AD_TUN_ERR_CONFIG;
+        }
+        if (cfg->ipv6 && cfg->ipv6[0] == '\0') cfg->ipv6 = NULL;
+
+        ad_tun_check_config(cfg);
+    }
+#undef CFGSET_PTR
+
+    out_set->tuns = tuns;
+    out_set->count = ctx->count;
+    out_set->arena = block;
     return AD_TUN_OK;
 }
 
+ad_tun_error_t ad_tun_load_config_set(const char *path, ad_tun_config_set_t *out_set)
+{
+    ad_tun_zlog_init();
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!path || !out_set) {
+        zlog_error(zc, "Invalid arguments to ad_tun_load_config_set()");
+        return AD_TUN_ERR_CONFIG;
+    }
+    memset(out_set, 0, sizeof(*out_set));
+
+    cfgset_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+
+    ad_tun_error_t err = AD_TUN_ERR_CONFIG;
+    int rc = ini_parse(path, cfgset_ini_handler, &ctx);
+    if (rc < 0) {
+        zlog_error(zc, "Failed to open config file: %s", path);
+    } else if (ctx.nomem) {
+        zlog_error(zc, "Memory allocation failed while loading %s", path);
+    } else if (rc > 0) {
+        zlog_error(zc, "Parsing error at line %d in config file %s", rc, path);
+    } else if (ctx.count == 0) {
+        zlog_error(zc, "Config error: no tunnel sections in %s", path);
+    } else {
+        err = cfgset_finish(&ctx, out_set);
+    }
+
+    free(ctx.strs);
+    free(ctx.ents);
+    free(ctx.index);
+
+    if (err == AD_TUN_OK) {
+        zlog_info(zc, "Loaded %u tunnel configs from %s", out_set->count, path);
+    }
+    AD_TUN_TRACE2(config__load, path, (int)err);
+    return err;
+}
+
+void ad_tun_free_config_set(ad_tun_config_set_t *set)
+{
+    if (!set) return;
+
+    free(set->arena);
+    memset(set, 0, sizeof(*set));
+}
+
 /* Initialize the TUN module with a config */
 ad_tun_error_t ad_tun_init(const ad_tun_config_t *cfg)
 {
@@ -172,6 +691,13 @@ ad_tun_error_t ad_tun_init(const ad_tun_config_t *cfg)
         return AD_TUN_ERR_INVALID_STATE;
     }
 
+    uint8_t mac[AD_TUN_ETH_ALEN];
+    if (cfg->mac && ad_tun_eth_parse_mac(cfg->mac, mac) != 0) {
+        zlog_error(zlog_get_category("ad_tun"), "ad_tun_init: invalid MAC address %s", cfg->mac);
+        pthread_mutex_unlock(&g_state_lock);
+        return AD_TUN_ERR_CONFIG;
+    }
+
     /* Clear previous config if any */
     if (g_config_initialized) {
         ad_tun_free_config(&g_cfg);
@@ -184,24 +710,173 @@ ad_tun_error_t ad_tun_init(const ad_tun_config_t *cfg)
     if (cfg->ifname) g_cfg.ifname = strdup(cfg->ifname);
     if (cfg->ipv4)   g_cfg.ipv4   = strdup(cfg->ipv4);
     if (cfg->ipv6)   g_cfg.ipv6   = strdup(cfg->ipv6);
+    if (cfg->mac)    g_cfg.mac    = strdup(cfg->mac);
 
     g_cfg.mtu     = (cfg->mtu > 0) ? cfg->mtu : DEFAULT_MTU;
     g_cfg.persist = (cfg->persist == 1) ? 1 : 0;
+    g_cfg.fragment = (cfg->fragment == 1) ? 1 : 0;
+    g_cfg.reassemble = (cfg->reassemble == 1) ? 1 : 0;
+    g_cfg.offload = (cfg->offload == 1) ? 1 : 0;
+    g_cfg.mode = (cfg->mode == AD_TUN_MODE_TAP) ? AD_TUN_MODE_TAP : AD_TUN_MODE_TUN;
+    g_cfg.queues = (cfg->queues >= 1 && cfg->queues <= AD_TUN_MAX_QUEUES) ? cfg->queues : DEFAULT_QUEUES;
+
+    if (g_cfg.mode == AD_TUN_MODE_TAP && (g_cfg.fragment || g_cfg.reassemble)) {
+        zlog_warn(zlog_get_category("ad_tun"), "fragment/reassemble are not supported in tap mode, disabled");
+        g_cfg.fragment = 0;
+        g_cfg.reassemble = 0;
+    }
+    if (g_cfg.mode == AD_TUN_MODE_TUN && g_cfg.mac) {
+        zlog_warn(zlog_get_category("ad_tun"), "'mac' only applies to tap mode, ignored");
+    }
 
     g_config_initialized = 1;
     g_state = AD_TUN_STATE_INITIALIZED;
 
     zlog_info(zlog_get_category("ad_tun"),
-              "ad_tun module initialized: ifname=%s, ipv4=%s, ipv6=%s, mtu=%d, persist=%d",
+              "ad_tun module initialized: ifname=%s, ipv4=%s, ipv6=%s, mtu=%d, persist=%d, mode=%s, queues=%d",
               g_cfg.ifname, g_cfg.ipv4, g_cfg.ipv6 ? g_cfg.ipv6 : "none",
-              g_cfg.mtu, g_cfg.persist);
+              g_cfg.mtu, g_cfg.persist, g_cfg.mode == AD_TUN_MODE_TAP ? "tap" : "tun", g_cfg.queues);
 
     pthread_mutex_unlock(&g_state_lock);
     return AD_TUN_OK;
 }
 
+/* Monotonic clock in milliseconds */
+static uint64_t ad_tun_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+/* Release fragmentation / reassembly resources */
+static void ad_tun_frag_teardown(void)
+{
+    pthread_mutex_lock(&g_reasm_lock);
+    if (g_reasm_ready) {
+        ad_tun_reasm_free(&g_reasm);
+        ad_tun_pool_free(&g_reasm_pool);
+        g_reasm_ready = 0;
+        __atomic_store_n(&g_reasm_next_ms, 0, __ATOMIC_RELAXED);
+    }
+    if (g_frag_ready) {
+        ad_tun_pool_free(&g_frag_pool);
+        g_frag_ready = 0;
+    }
+    pthread_mutex_unlock(&g_reasm_lock);
+}
+
+/* Allocate fragmentation / reassembly resources for the given config */
+static ad_tun_error_t ad_tun_frag_setup(const ad_tun_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+    ad_tun_error_t err = AD_TUN_OK;
+
+    pthread_mutex_lock(&g_reasm_lock);
+
+    if (cfg->fragment && !g_frag_ready) {
+        err = ad_tun_pool_init(&g_frag_pool, FRAG_POOL_SIZE, (size_t)cfg->mtu, 0);
+        if (err == AD_TUN_OK) {
+            g_frag_ready = 1;
+            zlog_info(zc, "Fragmentation enabled (mtu=%d)", cfg->mtu);
+        }
+    }
+
+    if (err == AD_TUN_OK && cfg->reassemble && !g_reasm_ready) {
+        err = ad_tun_pool_init(&g_reasm_pool, REASM_POOL_SIZE, (size_t)cfg->mtu, 0);
+        if (err == AD_TUN_OK) {
+            err = ad_tun_reasm_init(&g_reasm, &g_reasm_pool, REASM_MAX_DATAGRAMS, REASM_TIMEOUT_MS);
+            if (err != AD_TUN_OK) ad_tun_pool_free(&g_reasm_pool);
+        }
+        if (err == AD_TUN_OK) {
+            g_reasm_ready = 1;
+            zlog_info(zc, "Reassembly enabled (max_datagrams=%d, timeout_ms=%d)",
+                      REASM_MAX_DATAGRAMS, REASM_TIMEOUT_MS);
+        }
+    }
+
+    pthread_mutex_unlock(&g_reasm_lock);
+
+    if (err != AD_TUN_OK) {
+        zlog_error(zc, "Failed to set up fragmentation/reassembly: %s", ad_tun_strerror(err));
+        ad_tun_frag_teardown();
+    }
+    return err;
+}
+
+/* Report a rejected link or address request of ad_tun_configure_link() */
+static void ad_tun_nl_warn(void *arg, uint32_t seq, int err)
+{
+    const uint32_t *seqs = arg;
+    static const char *what[] = { "set MTU", "assign IPv4", "assign IPv6", "bring interface up",
+                                  "set MAC address" };
+
+    for (int i = 0; i < 5; i++) {
+        if (seqs[i] == seq) {
+            zlog_warn(zlog_get_category("ad_tun"), "Failed to %s: %s", what[i], strerror(err));
+        }
+    }
+}
+
+/* Set MTU, assign addresses and bring the link up */
+static void ad_tun_configure_link(const ad_tun_config_t *cfg, int ifindex)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+    ad_tun_nl_t nl;
+
+    if (ifindex <= 0 || ad_tun_nl_open(&nl) != AD_TUN_OK) {
+        zlog_warn(zc, "Cannot configure %s: no interface index or netlink socket", cfg->ifname);
+        return;
+    }
+
+    /* Separate requests, so a rejected MTU does not keep the link down */
+    uint32_t seqs[5] = { 0, 0, 0, 0, 0 };
+    const char *addrs[2] = { cfg->ipv4, cfg->ipv6 };
+    uint8_t mac[AD_TUN_ETH_ALEN];
+    if (cfg->mode == AD_TUN_MODE_TAP && cfg->mac && ad_tun_eth_parse_mac(cfg->mac, mac) == 0) {
+        seqs[4] = ad_tun_nl_link_set(&nl, ifindex, 0, -1);
+        if (seqs[4]) ad_tun_nl_attr(&nl, IFLA_ADDRESS, mac, sizeof(mac));
+    }
+    if (cfg->mtu > 0) seqs[0] = ad_tun_nl_link_set(&nl, ifindex, (unsigned)cfg->mtu, -1);
+    for (int i = 0; i < 2; i++) {
+        int family;
+        unsigned char addr[16];
+        unsigned plen;
+        if (!addrs[i]) continue;
+        if (ad_tun_nl_parse_prefix(addrs[i], &family, addr, &plen) != 0) {
+            zlog_warn(zc, "Invalid address: %s", addrs[i]);
+            continue;
+        }
+        seqs[i + 1] = ad_tun_nl_addr(&nl, 1, ifindex, family, addr, plen);
+    }
+    seqs[3] = ad_tun_nl_link_set(&nl, ifindex, 0, 1);
+
+    int rc = ad_tun_nl_commit(&nl, ad_tun_nl_warn, seqs);
+    if (rc < 0) {
+        zlog_warn(zc, "Netlink configuration of %s failed: %s", cfg->ifname, strerror(-rc));
+    } else if (rc == 0) {
+        zlog_info(zc, "Interface %s is now UP (MTU=%d)", cfg->ifname, cfg->mtu);
+    }
+    ad_tun_nl_close(&nl);
+}
+
+/* Open one more queue of the device named in ifr; returns the fd or -errno */
+static int ad_tun_open_queue(const struct ifreq *ifr)
+{
+    struct ifreq req = *ifr;
+
+    int fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+    if (fd < 0) return -errno;
+    if (ioctl(fd, TUNSETIFF, (void *)&req) < 0) {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+    return fd;
+}
+
 /* Start the TUN interface */
-ad_tun_error_t ad_tun_start(void)
+static ad_tun_error_t ad_tun_do_start(void)
 {
     zlog_category_t *zc = zlog_get_category("ad_tun");
 
@@ -236,8 +911,12 @@ ad_tun_error_t ad_tun_start(void)
     /* Prepare interface request */
     struct ifreq ifr;
     memset(&ifr, 0, sizeof(ifr));
-    /* Use IFF_TUN and avoid packet information. */
-    ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+    /* IFF_TUN for IP packets, IFF_TAP for Ethernet frames; no packet information */
+    ifr.ifr_flags = (cfg.mode == AD_TUN_MODE_TAP ? IFF_TAP : IFF_TUN) | IFF_NO_PI;
+    /* Offload mode prefixes every packet with a virtio-net header */
+    if (cfg.offload) ifr.ifr_flags |= IFF_VNET_HDR;
+    /* Every TUNSETIFF on the same name adds one queue */
+    if (cfg.queues > 1) ifr.ifr_flags |= IFF_MULTI_QUEUE;
     /* copy name */
     strncpy(ifr.ifr_name, cfg.ifname, IFNAMSIZ - 1);
 
@@ -248,66 +927,53 @@ ad_tun_error_t ad_tun_start(void)
         return AD_TUN_ERR_SYS;
     }
 
-    zlog_info(zc, "TUN interface %s created successfully", ifr.ifr_name);
+    zlog_info(zc, "%s interface %s created successfully",
+              cfg.mode == AD_TUN_MODE_TAP ? "TAP" : "TUN", ifr.ifr_name);
 
-    /* Configure MTU via netlink/ioctl (we use ioctl SIOCSIFMTU here) */
-    int sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock >= 0) {
-        struct ifreq if_mtu;
-        memset(&if_mtu, 0, sizeof(if_mtu));
-        strncpy(if_mtu.ifr_name, cfg.ifname, IFNAMSIZ - 1);
-        if_mtu.ifr_mtu = cfg.mtu;
+    if (cfg.offload) {
+        int hdr_sz = (int)sizeof(ad_tun_vnet_hdr_t);
+        if (ioctl(tun_fd, TUNSETVNETHDRSZ, &hdr_sz) < 0) {
+            zlog_error(zc, "ioctl(TUNSETVNETHDRSZ) failed: %s", strerror(errno));
+            close(tun_fd);
+            return AD_TUN_ERR_SYS;
+        }
+        /*
+         * Accept GSO packets from user space but ask the kernel to hand us
+         * fully segmented, checksummed packets, so reads need no fix-ups.
+         */
+        if (ioctl(tun_fd, TUNSETOFFLOAD, 0) < 0) {
+            zlog_warn(zc, "ioctl(TUNSETOFFLOAD) failed: %s", strerror(errno));
+        }
+        zlog_info(zc, "virtio-net header enabled on %s", ifr.ifr_name);
+    }
 
-        if (ioctl(sock, SIOCSIFMTU, &if_mtu) < 0) {
-            zlog_warn(zc, "Failed to set MTU=%d on %s: %s", cfg.mtu, cfg.ifname, strerror(errno));
-        } else {
-            zlog_info(zc, "Set MTU=%d on %s", cfg.mtu, cfg.ifname);
+    int qfds[AD_TUN_MAX_QUEUES];
+    unsigned nq = (cfg.queues > 1) ? (unsigned)cfg.queues : 1;
+    qfds[0] = tun_fd;
+    for (unsigned q = 1; q < nq; q++) {
+        qfds[q] = ad_tun_open_queue(&ifr);
+        if (qfds[q] < 0) {
+            zlog_error(zc, "Failed to open queue %u of %s: %s", q, ifr.ifr_name, strerror(-qfds[q]));
+            while (q > 0) close(qfds[--q]);
+            return AD_TUN_ERR_SYS;
         }
+    }
+    if (nq > 1) zlog_info(zc, "%u queues open on %s", nq, ifr.ifr_name);
 
-        close(sock);
-    } else {
-        zlog_warn(zc, "Failed to open socket for MTU configuration: %s", strerror(errno));
-    }
-
-    /* Configure IPv4 */
-    if (cfg.ipv4) {
-        char cmd[256];
-        snprintf(cmd, sizeof(cmd),
-                 "ip addr add %s dev %s >/dev/null 2>&1",
-                 cfg.ipv4, cfg.ifname);
-        if (system(cmd) != 0)
-            zlog_warn(zc, "Failed to assign IPv4: %s", cfg.ipv4);
-        else
-            zlog_info(zc, "Assigned IPv4: %s", cfg.ipv4);
-    }
-
-    /* Configure IPv6 */
-    if (cfg.ipv6) {
-        char cmd[256];
-        snprintf(cmd, sizeof(cmd),
-                 "ip -6 addr add %s dev %s >/dev/null 2>&1",
-                 cfg.ipv6, cfg.ifname);
-        if (system(cmd) != 0)
-            zlog_warn(zc, "Failed to assign IPv6: %s", cfg.ipv6);
-        else
-            zlog_info(zc, "Assigned IPv6: %s", cfg.ipv6);
-    }
-
-    /* Bring interface up */
-    {
-        char cmd[128];
-        snprintf(cmd, sizeof(cmd),
-                 "ip link set dev %s up >/dev/null 2>&1", cfg.ifname);
-        if (system(cmd) != 0)
-            zlog_warn(zc, "Failed to bring interface up");
-        else
-            zlog_info(zc, "Interface %s is now UP", cfg.ifname);
+    if (ad_tun_frag_setup(&cfg) != AD_TUN_OK) {
+        for (unsigned q = 0; q < nq; q++) close(qfds[q]);
+        return AD_TUN_ERR_SYS;
     }
 
+    /* MTU, addresses and link state in one rtnetlink transaction */
+    ad_tun_configure_link(&cfg, (int)if_nametoindex(cfg.ifname));
+
     /* Update state */
     pthread_mutex_lock(&g_state_lock);
     g_state = AD_TUN_STATE_RUNNING;
     g_tun_fd = tun_fd; /* fixed assignment */
+    memcpy(g_queue_fds, qfds, nq * sizeof(qfds[0]));
+    g_num_queues = nq;
     pthread_mutex_unlock(&g_state_lock);
 
     zlog_info(zc, "ad_tun_start() completed successfully");
@@ -315,8 +981,82 @@ ad_tun_error_t ad_tun_start(void)
     return AD_TUN_OK;
 }
 
+ad_tun_error_t ad_tun_start(void)
+{
+    AD_TUN_TRACE0(start__entry);
+    ad_tun_error_t err = ad_tun_do_start();
+    if (AD_TUN_TRACE_ENABLED(start__return)) {
+        AD_TUN_TRACE3(start__return, (int)err, ad_tun_get_name(), ad_tun_get_fd());
+    }
+    return err;
+}
+
+/* Wait on g_drain_cond (g_state_lock held) until woken or left ms pass, -1 = forever */
+static void ad_tun_drain_wait(int left)
+{
+    if (left < 0) {
+        pthread_cond_wait(&g_drain_cond, &g_state_lock);
+        return;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += left / 1000;
+    ts.tv_nsec += (long)(left % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&g_drain_cond, &g_state_lock, &ts);
+}
+
+/* Bring the interface down; failures are logged and otherwise ignored */
+static void ad_tun_link_down(const char *ifname)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    ad_tun_nl_t nl;
+    int ifindex = (int)if_nametoindex(ifname);
+    if (ifindex > 0 && ad_tun_nl_open(&nl) == AD_TUN_OK) {
+        int rc = ad_tun_nl_link_set(&nl, ifindex, 0, 0) ? ad_tun_nl_commit(&nl, NULL, NULL) : -ENOMEM;
+        if (rc != 0) {
+            zlog_warn(zc, "Failed to bring interface %s down (rc=%d)", ifname, rc);
+            /* non-fatal — continue stopping */
+        }
+        ad_tun_nl_close(&nl);
+    }
+}
+
+/*
+ * Close the queue fds snapshotted by a stop and mark the module stopped.
+ * The caller has set g_draining, so no new I/O starts; calls already in
+ * flight may still use the queues and the fragment pools, so wait for them
+ * (the descriptors are non-blocking, the wait is short).
+ */
+static void ad_tun_close_queues(const int *qfds, unsigned nq)
+{
+    pthread_mutex_lock(&g_state_lock);
+    while (__atomic_load_n(&g_io_inflight, __ATOMIC_SEQ_CST) > 0) ad_tun_drain_wait(-1);
+    pthread_mutex_unlock(&g_state_lock);
+
+    /* Close TUN file descriptors, one per queue */
+    for (unsigned q = 0; q < nq; q++) {
+        if (qfds[q] >= 0) close(qfds[q]);
+    }
+
+    ad_tun_frag_teardown();
+
+    /* Clear global state */
+    pthread_mutex_lock(&g_state_lock);
+    g_tun_fd = -1;
+    g_num_queues = 0;
+    g_state = AD_TUN_STATE_STOPPED;
+    __atomic_store_n(&g_draining, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&g_state_lock);
+}
+
 /* Stop the TUN interface */
-ad_tun_error_t ad_tun_stop(void)
+static ad_tun_error_t ad_tun_do_stop(void)
 {
     zlog_category_t *zc = zlog_get_category("ad_tun");
 
@@ -334,32 +1074,21 @@ ad_tun_error_t ad_tun_stop(void)
         return AD_TUN_ERR_INVALID_STATE;
     }
 
-    /* Snapshot fd & ifname */
-    int fd = g_tun_fd;
+    /* Snapshot fds & ifname */
+    int qfds[AD_TUN_MAX_QUEUES];
+    unsigned nq = g_num_queues;
+    memcpy(qfds, g_queue_fds, nq * sizeof(qfds[0]));
     const char *ifname = g_cfg.ifname;
 
-    pthread_mutex_unlock(&g_state_lock);
-
-    /* Bring interface down */
-    char cmd[256];
-    snprintf(cmd, sizeof(cmd), "ip link set %s down >/dev/null 2>&1", ifname);
-    int rc = system(cmd);
-    if (rc != 0) {
-        zlog_warn(zc, "Failed to bring interface %s down (rc=%d)", ifname, rc);
-        /* non-fatal — continue stopping */
-    }
-
-    /* Close TUN file descriptor */
-    if (fd >= 0) {
-        close(fd);
-    }
+    /* Refuse new reads and writes until the queues are closed */
+    g_state = AD_TUN_STATE_DRAINING;
+    __atomic_store_n(&g_draining, 1, __ATOMIC_SEQ_CST);
 
-    /* Clear global state */
-    pthread_mutex_lock(&g_state_lock);
-    g_tun_fd = -1;
-    g_state = AD_TUN_STATE_STOPPED;
     pthread_mutex_unlock(&g_state_lock);
 
+    ad_tun_link_down(ifname);
+    ad_tun_close_queues(qfds, nq);
+
     zlog_info(zc, "TUN interface %s stopped successfully", ifname);
 
     return AD_TUN_OK;
@@ -379,6 +1108,13 @@ ad_tun_error_t ad_tun_cleanup(void)
         return AD_TUN_OK;
     }
 
+    /* A drain still needs the configuration */
+    if (g_state == AD_TUN_STATE_DRAINING) {
+        pthread_mutex_unlock(&g_state_lock);
+        zlog_error(zc, "Cleanup requested while the interface is draining");
+        return AD_TUN_ERR_INVALID_STATE;
+    }
+
     /* If still running, stop it first */
     if (g_state == AD_TUN_STATE_RUNNING) {
         pthread_mutex_unlock(&g_state_lock);  // release before calling stop()
@@ -409,24 +1145,218 @@ ad_tun_error_t ad_tun_cleanup(void)
     return AD_TUN_OK;
 }
 
+ad_tun_error_t ad_tun_stop(void)
+{
+    AD_TUN_TRACE0(stop__entry);
+    ad_tun_error_t err = ad_tun_do_stop();
+    AD_TUN_TRACE1(stop__return, (int)err);
+    return err;
+}
+
 /* Restart the TUN interface */
 ad_tun_error_t ad_tun_restart(void)
 {
     ad_tun_error_t err;
 
-    /* First stop the interface */
+    AD_TUN_TRACE0(restart__entry);
+
+    /* First stop the interface, then start it again */
     err = ad_tun_stop();
-    if (err != AD_TUN_OK) {
-        return err;
+    if (err == AD_TUN_OK) {
+        err = ad_tun_start();
     }
 
-    /* Then start it again */
-    err = ad_tun_start();
-    if (err != AD_TUN_OK) {
-        return err;
+    AD_TUN_TRACE1(restart__return, (int)err);
+    return err;
+}
+
+/* Snapshot of the state needed by the I/O paths */
+typedef struct {
+    int fd;
+    int vnet_hdr;
+    int fragment;
+    int reassemble;
+    size_t mtu;
+} ad_tun_io_ctx_t;
+
+/* Fill io from the current settings for queue q (g_state_lock held) */
+static void ad_tun_io_fill(ad_tun_io_ctx_t *io, unsigned q)
+{
+    io->fd = (q < g_num_queues) ? g_queue_fds[q] : -1;
+    io->vnet_hdr = g_cfg.offload;
+    io->fragment = g_cfg.fragment;
+    io->reassemble = g_cfg.reassemble;
+    io->mtu = (size_t)g_cfg.mtu;
+}
+
+/*
+ * Snapshot I/O state of queue q under the lock and count the call as in flight,
+ * so a drain can wait for it. Returns 0 (pair with ad_tun_io_end()), -EIO when
+ * the module is not running, -ESHUTDOWN while draining (writes from the drain's
+ * flush callback excepted) or -EINVAL when the queue is not open.
+ */
+static int ad_tun_io_begin(ad_tun_io_ctx_t *io, unsigned q, int write, const char *fn)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    pthread_mutex_lock(&g_state_lock);
+    ad_tun_state_t st = g_state;
+    int open = (q < g_num_queues && g_queue_fds[q] > 0);
+    int rc = 0;
+    if (st == AD_TUN_STATE_DRAINING) {
+        rc = (write && t_drain_writer) ? 0 : -ESHUTDOWN;
+    } else if (st != AD_TUN_STATE_RUNNING) {
+        rc = -EIO;
+    }
+    if (rc == 0 && !open) rc = -EINVAL;
+    if (rc == 0) {
+        ad_tun_io_fill(io, q);
+        __atomic_add_fetch(&g_io_inflight, 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&g_state_lock);
+
+    if (rc == -EIO) {
+        zlog_error(zc, "%s: called while module not running", fn);
+    } else if (rc == -ESHUTDOWN) {
+        zlog_debug(zc, "%s: refused while draining", fn);
+    } else if (rc == -EINVAL) {
+        zlog_error(zc, "%s: queue %u is not open", fn, q);
     }
+    return rc;
+}
 
-    return AD_TUN_OK;
+/* Finish an I/O call started by ad_tun_io_begin(); the last one wakes a waiting drain */
+static void ad_tun_io_end(void)
+{
+    if (__atomic_sub_fetch(&g_io_inflight, 1, __ATOMIC_SEQ_CST) == 0 &&
+        __atomic_load_n(&g_draining, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&g_state_lock);
+        pthread_cond_broadcast(&g_drain_cond);
+        pthread_mutex_unlock(&g_state_lock);
+    }
+}
+
+/* read() one packet, stripping the virtio-net header when the device has one */
+static ssize_t ad_tun_sys_read(const ad_tun_io_ctx_t *io, void *buf, size_t len)
+{
+    if (!io->vnet_hdr) return read(io->fd, buf, len);
+
+    ad_tun_vnet_hdr_t hdr;
+    struct iovec iov[2] = {
+        { .iov_base = &hdr, .iov_len = sizeof(hdr) },
+        { .iov_base = buf,  .iov_len = len }
+    };
+
+    ssize_t n = readv(io->fd, iov, 2);
+    if (n < 0) return n;
+    if ((size_t)n < sizeof(hdr)) {
+        errno = EIO;
+        return -1;
+    }
+    return n - (ssize_t)sizeof(hdr);
+}
+
+/* write() one packet, prefixing a virtio-net header when the device expects one */
+static ssize_t ad_tun_sys_write(const ad_tun_io_ctx_t *io, const ad_tun_vnet_hdr_t *hdr,
+                                const void *buf, size_t len)
+{
+    if (!io->vnet_hdr) return write(io->fd, buf, len);
+
+    ad_tun_vnet_hdr_t none;
+    if (!hdr) {
+        memset(&none, 0, sizeof(none));
+        hdr = &none;
+    }
+
+    struct iovec iov[2] = {
+        { .iov_base = (void *)hdr, .iov_len = sizeof(*hdr) },
+        { .iov_base = (void *)buf, .iov_len = len }
+    };
+
+    ssize_t n = writev(io->fd, iov, 2);
+    if (n < 0) return n;
+    return (n >= (ssize_t)sizeof(*hdr)) ? n - (ssize_t)sizeof(*hdr) : 0;
+}
+
+/*
+ * Expire partial datagrams from reads that carry no fragment, so their
+ * buffers are released on time even when no further fragment arrives.
+ * Only an atomic load while nothing is pending or due.
+ */
+static void ad_tun_reasm_tick(void)
+{
+    uint64_t next = __atomic_load_n(&g_reasm_next_ms, __ATOMIC_RELAXED);
+    if (__builtin_expect(next == 0, 1)) return;
+
+    uint64_t now = ad_tun_now_ms();
+    if (now < next) return;
+
+    pthread_mutex_lock(&g_reasm_lock);
+    if (g_reasm_ready) {
+        ad_tun_reasm_expire(&g_reasm, now);
+        __atomic_store_n(&g_reasm_next_ms, ad_tun_reasm_next_expiry(&g_reasm), __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&g_reasm_lock);
+}
+
+/*
+ * Read one packet and run it through reassembly.
+ * Returns the packet length, 0 if a fragment was absorbed, or a negative errno.
+ */
+static ssize_t ad_tun_read_one(const ad_tun_io_ctx_t *io, char *buf, size_t buf_len)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    AD_TUN_LAT_START(t_read);
+    ssize_t n = ad_tun_sys_read(io, buf, buf_len);
+    if (AD_TUN_TRACE_ENABLED(read)) AD_TUN_TRACE2(read, (n < 0) ? (ssize_t)-errno : n, buf);
+
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            /* No data available */
+            if (io->reassemble) ad_tun_reasm_tick();
+            return -EAGAIN;
+        }
+        zlog_error(zc, "ad_tun_read: read() failed: %s", strerror(errno));
+        return -EIO;
+    }
+
+    AD_TUN_LAT_END(AD_TUN_LAT_READ, t_read);
+    zlog_debug(zc, "ad_tun_read: read %zd bytes from TUN", n);
+
+    if (io->reassemble) {
+        ad_tun_pkt_info_t info;
+        if (ad_tun_pkt_parse((const unsigned char *)buf, (size_t)n, &info) == 0 && info.is_frag) {
+            AD_TUN_LAT_START(t_reasm);
+            pthread_mutex_lock(&g_reasm_lock);
+            ssize_t r = n;
+            if (g_reasm_ready) {
+                r = ad_tun_reasm_input(&g_reasm, (const unsigned char *)buf, (size_t)n,
+                                       ad_tun_now_ms(), (unsigned char *)buf, buf_len);
+                __atomic_store_n(&g_reasm_next_ms, ad_tun_reasm_next_expiry(&g_reasm), __ATOMIC_RELAXED);
+            }
+            pthread_mutex_unlock(&g_reasm_lock);
+            AD_TUN_LAT_END(AD_TUN_LAT_REASM, t_reasm);
+
+            if (r == 0) {
+                /* Fragment absorbed, datagram not complete yet */
+                return 0;
+            }
+            if (r < 0) {
+                zlog_debug(zc, "ad_tun_read: fragment dropped: %s", strerror((int)-r));
+                return (r == -EMSGSIZE) ? -EMSGSIZE : 0;
+            }
+            zlog_debug(zc, "ad_tun_read: reassembled %zd byte datagram", r);
+            ad_tun_capture_hook(AD_TUN_CAPTURE_RX, buf, (size_t)r);
+            ad_tun_ipfix_hook(AD_TUN_IPFIX_DIR_READ, buf, (size_t)r);
+            return r;
+        }
+        ad_tun_reasm_tick();
+    }
+
+    ad_tun_capture_hook(AD_TUN_CAPTURE_RX, buf, (size_t)n);
+    ad_tun_ipfix_hook(AD_TUN_IPFIX_DIR_READ, buf, (size_t)n);
+    return n;
 }
 
 /* Read data from the TUN interface */
@@ -440,28 +1370,161 @@ ssize_t ad_tun_read(char *buf, size_t buf_len)
     }
 
     /* Ensure module is running */
-    pthread_mutex_lock(&g_state_lock);
-    int running = (g_state == AD_TUN_STATE_RUNNING && g_tun_fd > 0);
-    int fd = g_tun_fd;
-    pthread_mutex_unlock(&g_state_lock);
+    ad_tun_io_ctx_t io;
+    int rc = ad_tun_io_begin(&io, 0, 0, "ad_tun_read");
+    if (rc < 0) return rc;
 
-    if (!running) {
-        zlog_error(zc, "ad_tun_read: called while module not running");
-        return -EIO;
+    ssize_t n = ad_tun_read_one(&io, buf, buf_len);
+    ad_tun_io_end();
+    return (n == 0) ? -EAGAIN : n;
+}
+
+/* Read up to count packets from the queue in io */
+static int ad_tun_read_batch_io(const ad_tun_io_ctx_t *io, ad_tun_buf_t **bufs, unsigned count)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    unsigned got = 0;
+    while (got < count) {
+        ad_tun_buf_t *b = bufs[got];
+        ssize_t n = ad_tun_read_one(io, (char *)b->data, (size_t)(b->head + b->size - b->data));
+
+        if (n == 0) continue;  /* fragment absorbed, keep draining */
+        if (n < 0) {
+            if (got > 0) break;
+            AD_TUN_TRACE2(read__batch, (int)n, count);
+            return (int)n;
+        }
+        b->len = (size_t)n;
+        AD_TUN_LAT_STAMP(b);
+        got++;
+    }
+
+    zlog_debug(zc, "ad_tun_read_batch: read %u packets", got);
+    AD_TUN_TRACE2(read__batch, (int)got, count);
+    return (int)got;
+}
+
+/* Read up to count packets into caller-supplied buffers */
+int ad_tun_read_batch(ad_tun_buf_t **bufs, unsigned count)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!bufs || count == 0) {
+        zlog_error(zc, "ad_tun_read_batch: invalid buffer array");
+        return -EINVAL;
+    }
+
+    ad_tun_io_ctx_t io;
+    int rc = ad_tun_io_begin(&io, 0, 0, "ad_tun_read_batch");
+    if (rc < 0) return rc;
+
+    int n = ad_tun_read_batch_io(&io, bufs, count);
+    ad_tun_io_end();
+    return n;
+}
+
+/* ad_tun_read_batch() on one queue of a multi-queue device */
+int ad_tun_read_batch_queue(unsigned q, ad_tun_buf_t **bufs, unsigned count)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!bufs || count == 0 || q >= AD_TUN_MAX_QUEUES) {
+        zlog_error(zc, "ad_tun_read_batch_queue: invalid arguments");
+        return -EINVAL;
+    }
+
+    ad_tun_io_ctx_t io;
+    int rc = ad_tun_io_begin(&io, q, 0, "ad_tun_read_batch_queue");
+    if (rc < 0) return rc;
+
+    int n = ad_tun_read_batch_io(&io, bufs, count);
+    ad_tun_io_end();
+    return n;
+}
+
+/* Fragment an oversized datagram and write the fragments */
+static ssize_t ad_tun_write_fragmented(const ad_tun_io_ctx_t *io, const char *buf, size_t buf_len)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+    ad_tun_buf_t *frags[FRAG_MAX_OUT];
+
+    int nfrags = ad_tun_frag_fragment(&g_frag_pool, (const unsigned char *)buf, buf_len,
+                                      io->mtu, frags, FRAG_MAX_OUT);
+    if (nfrags < 0) {
+        zlog_warn(zc, "ad_tun_write: cannot fragment %zu byte datagram: %s",
+                  buf_len, strerror(-nfrags));
+        return (nfrags == -ENOBUFS) ? -EAGAIN : nfrags;
+    }
+
+    ssize_t ret = (ssize_t)buf_len;
+    for (int i = 0; i < nfrags; i++) {
+        if (ad_tun_sys_write(io, NULL, frags[i]->data, frags[i]->len) < 0) {
+            zlog_error(zc, "ad_tun_write: fragment %d/%d write failed: %s",
+                       i + 1, nfrags, strerror(errno));
+            if (i == 0) {
+                /* Nothing went out, the caller may retry the whole datagram */
+                ret = (errno == EAGAIN || errno == EWOULDBLOCK) ? -EAGAIN : -EIO;
+            } else {
+                /* A retry would send the first fragments twice: drop it */
+                __atomic_add_fetch(&g_frag_stats.partial, 1, __ATOMIC_RELAXED);
+                ret = -EIO;
+            }
+            break;
+        }
+    }
+    if (ret > 0) __atomic_add_fetch(&g_frag_stats.fragmented, 1, __ATOMIC_RELAXED);
+
+    ad_tun_pool_put_bulk(&g_frag_pool, frags, (unsigned)nfrags);
+
+    zlog_debug(zc, "ad_tun_write: wrote %zu byte datagram as %d fragments", buf_len, nfrags);
+    return ret;
+}
+
+/* Write-path fragmentation counters */
+void ad_tun_get_frag_stats(ad_tun_frag_stats_t *stats)
+{
+    if (!stats) return;
+    stats->fragmented = __atomic_load_n(&g_frag_stats.fragmented, __ATOMIC_RELAXED);
+    stats->partial = __atomic_load_n(&g_frag_stats.partial, __ATOMIC_RELAXED);
+}
+
+/* Write one packet, fragmenting it if needed. Returns bytes written or a negative errno. */
+static ssize_t ad_tun_write_one(const ad_tun_io_ctx_t *io, const ad_tun_vnet_hdr_t *hdr,
+                                const char *buf, size_t buf_len)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    ad_tun_capture_hook(AD_TUN_CAPTURE_TX, buf, buf_len);
+
+    /* GSO super-packets are segmented by the kernel, never fragmented here */
+    int gso = hdr && hdr->gso_type != AD_TUN_GSO_NONE;
+    if (!gso && io->fragment && g_frag_ready && buf_len > io->mtu) {
+        AD_TUN_LAT_START(t_frag);
+        ssize_t r = ad_tun_write_fragmented(io, buf, buf_len);
+        AD_TUN_LAT_END(AD_TUN_LAT_FRAG, t_frag);
+        AD_TUN_TRACE3(write, r, buf, buf_len);
+        /* Flows count what reached the device, unlike the capture above */
+        if (r > 0) ad_tun_ipfix_hook(AD_TUN_IPFIX_DIR_WRITE, buf, buf_len);
+        return r;
     }
 
-    ssize_t n = read(fd, buf, buf_len);
+    AD_TUN_LAT_START(t_write);
+    ssize_t n = ad_tun_sys_write(io, hdr, buf, buf_len);
+    if (AD_TUN_TRACE_ENABLED(write)) AD_TUN_TRACE3(write, (n < 0) ? (ssize_t)-errno : n, buf, buf_len);
 
     if (n < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            /* No data available */
+            /* Write would block */
             return -EAGAIN;
         }
-        zlog_error(zc, "ad_tun_read: read() failed: %s", strerror(errno));
+        zlog_error(zc, "ad_tun_write: write() failed: %s", strerror(errno));
         return -EIO;
     }
 
-    zlog_debug(zc, "ad_tun_read: read %zd bytes from TUN", n);
+    AD_TUN_LAT_END(AD_TUN_LAT_WRITE, t_write);
+    ad_tun_ipfix_hook(AD_TUN_IPFIX_DIR_WRITE, buf, buf_len);
+    zlog_debug(zc, "ad_tun_write: wrote %zd bytes to TUN", n);
     return n;
 }
 
@@ -476,29 +1539,287 @@ ssize_t ad_tun_write(const char *buf, size_t buf_len)
     }
 
     /* Ensure module is running */
+    ad_tun_io_ctx_t io;
+    int rc = ad_tun_io_begin(&io, 0, 1, "ad_tun_write");
+    if (rc < 0) return rc;
+
+    ssize_t n = ad_tun_write_one(&io, NULL, buf, buf_len);
+    ad_tun_io_end();
+    return n;
+}
+
+/* Write a packet described by a virtio-net (GSO) header */
+ssize_t ad_tun_write_gso(const ad_tun_vnet_hdr_t *hdr, const char *buf, size_t buf_len)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!hdr || !buf || buf_len == 0) {
+        zlog_error(zc, "ad_tun_write_gso: invalid arguments");
+        return -EINVAL;
+    }
+
+    ad_tun_io_ctx_t io;
+    int rc = ad_tun_io_begin(&io, 0, 1, "ad_tun_write_gso");
+    if (rc < 0) return rc;
+
+    if (!io.vnet_hdr && hdr->gso_type != AD_TUN_GSO_NONE) {
+        zlog_error(zc, "ad_tun_write_gso: GSO packet written without 'offload' enabled");
+        ad_tun_io_end();
+        return -EOPNOTSUPP;
+    }
+
+    ssize_t n = ad_tun_write_one(&io, hdr, buf, buf_len);
+    ad_tun_io_end();
+    return n;
+}
+
+/* Write count packets to the queue in io */
+static int ad_tun_write_batch_io(const ad_tun_io_ctx_t *io, ad_tun_buf_t *const *bufs, unsigned count)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    unsigned done = 0;
+    while (done < count) {
+        ssize_t n = ad_tun_write_one(io, NULL, (const char *)bufs[done]->data, bufs[done]->len);
+        if (n < 0) {
+            if (done > 0) break;
+            AD_TUN_TRACE2(write__batch, (int)n, count);
+            return (int)n;
+        }
+        AD_TUN_LAT_SINCE(AD_TUN_LAT_TOTAL, bufs[done]);
+        done++;
+    }
+
+    zlog_debug(zc, "ad_tun_write_batch: wrote %u packets", done);
+    AD_TUN_TRACE2(write__batch, (int)done, count);
+    return (int)done;
+}
+
+/* Write count packets from caller-supplied buffers */
+int ad_tun_write_batch(ad_tun_buf_t *const *bufs, unsigned count)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!bufs || count == 0) {
+        zlog_error(zc, "ad_tun_write_batch: invalid buffer array");
+        return -EINVAL;
+    }
+
+    ad_tun_io_ctx_t io;
+    int rc = ad_tun_io_begin(&io, 0, 1, "ad_tun_write_batch");
+    if (rc < 0) return rc;
+
+    int n = ad_tun_write_batch_io(&io, bufs, count);
+    ad_tun_io_end();
+    return n;
+}
+
+/* ad_tun_write_batch() on one queue of a multi-queue device */
+int ad_tun_write_batch_queue(unsigned q, ad_tun_buf_t *const *bufs, unsigned count)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!bufs || count == 0 || q >= AD_TUN_MAX_QUEUES) {
+        zlog_error(zc, "ad_tun_write_batch_queue: invalid arguments");
+        return -EINVAL;
+    }
+
+    ad_tun_io_ctx_t io;
+    int rc = ad_tun_io_begin(&io, q, 1, "ad_tun_write_batch_queue");
+    if (rc < 0) return rc;
+
+    int n = ad_tun_write_batch_io(&io, bufs, count);
+    ad_tun_io_end();
+    return n;
+}
+
+/* Attach or detach one queue of a multi-queue device */
+ad_tun_error_t ad_tun_set_queue_enabled(unsigned q, int on)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
     pthread_mutex_lock(&g_state_lock);
-    int running = (g_state == AD_TUN_STATE_RUNNING && g_tun_fd > 0);
-    int fd = g_tun_fd;
+    if (g_state != AD_TUN_STATE_RUNNING) {
+        pthread_mutex_unlock(&g_state_lock);
+        zlog_error(zc, "ad_tun_set_queue_enabled: called while module not running");
+        return AD_TUN_ERR_INVALID_STATE;
+    }
+    if (q >= g_num_queues) {
+        pthread_mutex_unlock(&g_state_lock);
+        zlog_error(zc, "ad_tun_set_queue_enabled: queue %u is not open", q);
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = on ? IFF_ATTACH_QUEUE : IFF_DETACH_QUEUE;
+    /* Held across the ioctl so stop() cannot close the fd underneath it */
+    int rc = ioctl(g_queue_fds[q], TUNSETQUEUE, (void *)&ifr);
+    int err = errno;
     pthread_mutex_unlock(&g_state_lock);
 
-    if (!running) {
-        zlog_error(zc, "ad_tun_write: called while module not running");
-        return -EIO;
+    if (rc < 0) {
+        zlog_error(zc, "ioctl(TUNSETQUEUE) on queue %u failed: %s", q, strerror(err));
+        return AD_TUN_ERR_SYS;
     }
+    zlog_info(zc, "Queue %u %s", q, on ? "attached" : "detached");
+    AD_TUN_TRACE2(queue__set, q, on);
+    return AD_TUN_OK;
+}
 
-    ssize_t n = write(fd, buf, buf_len);
+/* Milliseconds left until deadline (ad_tun_now_ms() time), -1 when there is none */
+static int ad_tun_drain_left(uint64_t deadline)
+{
+    if (deadline == UINT64_MAX) return -1;
+    uint64_t now = ad_tun_now_ms();
+    if (now >= deadline) return 0;
+    return (deadline - now > INT_MAX) ? INT_MAX : (int)(deadline - now);
+}
 
-    if (n < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            /* Write would block */
-            return -EAGAIN;
+/* Read every packet still queued on the snapshotted queues out to the callback */
+static void ad_tun_drain_rx(ad_tun_io_ctx_t *io, const int *qfds, unsigned nq,
+                            const ad_tun_drain_opts_t *opts, uint64_t deadline,
+                            ad_tun_drain_result_t *r)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    char *buf = malloc(DRAIN_BUF_SIZE);
+    if (!buf) {
+        zlog_error(zc, "ad_tun_stop_drain(): no memory for the read-out buffer");
+        return;
+    }
+
+    for (unsigned q = 0; q < nq; q++) {
+        io->fd = qfds[q];
+        for (;;) {
+            ssize_t n = ad_tun_read_one(io, buf, DRAIN_BUF_SIZE);
+            if (n > 0) {
+                r->rx_drained++;
+                if (opts->on_rx) opts->on_rx(opts->rx_arg, buf, (size_t)n);
+            } else if (n < 0 && n != -EMSGSIZE) {
+                break;      /* -EAGAIN: queue empty */
+            }
+            /* The link is down, but do not spin if the kernel keeps delivering */
+            if (ad_tun_drain_left(deadline) == 0) {
+                r->timed_out = 1;
+                free(buf);
+                return;
+            }
         }
-        zlog_error(zc, "ad_tun_write: write() failed: %s", strerror(errno));
-        return -EIO;
     }
+    free(buf);
+}
 
-    zlog_debug(zc, "ad_tun_write: wrote %zd bytes to TUN", n);
-    return n;
+/* Stop the TUN interface after draining it */
+static ad_tun_error_t ad_tun_do_stop_drain(const ad_tun_drain_opts_t *opts, ad_tun_drain_result_t *result)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+    ad_tun_drain_opts_t none = { .timeout_ms = -1 };
+    if (!opts) opts = &none;
+
+    pthread_mutex_lock(&g_state_lock);
+
+    if (!g_config_initialized) {
+        zlog_error(zc, "ad_tun_stop_drain(): Config not initialized");
+        pthread_mutex_unlock(&g_state_lock);
+        return AD_TUN_ERR_INVALID_STATE;
+    }
+
+    if (g_state != AD_TUN_STATE_RUNNING) {
+        zlog_warn(zc, "ad_tun_stop_drain(): Interface is not running (state=%d)", g_state);
+        pthread_mutex_unlock(&g_state_lock);
+        return AD_TUN_ERR_INVALID_STATE;
+    }
+
+    /* From here on new reads and writes are refused */
+    g_state = AD_TUN_STATE_DRAINING;
+    __atomic_store_n(&g_draining, 1, __ATOMIC_SEQ_CST);
+
+    ad_tun_drain_result_t r;
+    memset(&r, 0, sizeof(r));
+    uint64_t deadline = (opts->timeout_ms < 0) ? UINT64_MAX
+                                               : ad_tun_now_ms() + (uint64_t)opts->timeout_ms;
+
+    /* Wait for calls that got past the state check before it changed */
+    while (__atomic_load_n(&g_io_inflight, __ATOMIC_SEQ_CST) > 0) {
+        int left = ad_tun_drain_left(deadline);
+        if (left == 0) {
+            r.timed_out = 1;
+            break;
+        }
+        ad_tun_drain_wait(left);
+    }
+
+    /* Snapshot fds, ifname & I/O settings */
+    int qfds[AD_TUN_MAX_QUEUES];
+    unsigned nq = g_num_queues;
+    memcpy(qfds, g_queue_fds, nq * sizeof(qfds[0]));
+    const char *ifname = g_cfg.ifname;
+    ad_tun_io_ctx_t io;
+    ad_tun_io_fill(&io, 0);
+
+    pthread_mutex_unlock(&g_state_lock);
+
+    zlog_info(zc, "Draining TUN interface %s", ifname);
+
+    /* Let the caller flush its write queues; its writes still go through */
+    if (opts->flush && r.timed_out) {
+        r.flush_left = -ETIMEDOUT;
+    } else if (opts->flush) {
+        t_drain_writer = 1;
+        while ((r.flush_left = opts->flush(opts->flush_arg)) > 0) {
+            if (ad_tun_drain_left(deadline) == 0) {
+                r.timed_out = 1;
+                break;
+            }
+            struct timespec pause = { 0, DRAIN_FLUSH_PAUSE_NS };
+            nanosleep(&pause, NULL);
+        }
+        t_drain_writer = 0;
+        if (r.flush_left < 0) {
+            zlog_warn(zc, "ad_tun_stop_drain(): flush gave up (%d)", r.flush_left);
+        }
+    }
+
+    /* No new packets from the stack once the link is down; then read out the rest */
+    ad_tun_link_down(ifname);
+    ad_tun_drain_rx(&io, qfds, nq, opts, deadline, &r);
+
+    if (r.timed_out) {
+        r.inflight_at_timeout = __atomic_load_n(&g_io_inflight, __ATOMIC_SEQ_CST);
+        zlog_warn(zc, "TUN interface %s stopped before the drain finished (%u calls in flight, flush=%d)",
+                  ifname, r.inflight_at_timeout, r.flush_left);
+    }
+    ad_tun_close_queues(qfds, nq);
+    zlog_info(zc, "TUN interface %s drained and stopped (%llu packets read out)",
+              ifname, (unsigned long long)r.rx_drained);
+
+    if (result) *result = r;
+    return AD_TUN_OK;
+}
+
+ad_tun_error_t ad_tun_stop_drain(const ad_tun_drain_opts_t *opts, ad_tun_drain_result_t *result)
+{
+    AD_TUN_TRACE0(stop__entry);
+    ad_tun_error_t err = ad_tun_do_stop_drain(opts, result);
+    AD_TUN_TRACE1(stop__return, (int)err);
+    return err;
+}
+
+/* Restart the TUN interface, draining it first */
+ad_tun_error_t ad_tun_restart_drain(const ad_tun_drain_opts_t *opts, ad_tun_drain_result_t *result)
+{
+    ad_tun_error_t err;
+
+    AD_TUN_TRACE0(restart__entry);
+
+    err = ad_tun_stop_drain(opts, result);
+    if (err == AD_TUN_OK) {
+        err = ad_tun_start();
+    }
+
+    AD_TUN_TRACE1(restart__return, (int)err);
+    return err;
 }
 
 /* Return the TUN file descriptor */
@@ -511,6 +1832,26 @@ int ad_tun_get_fd(void)
     return fd;
 }
 
+/* Return the number of open queues */
+int ad_tun_get_num_queues(void)
+{
+    pthread_mutex_lock(&g_state_lock);
+    int n = (int)g_num_queues;
+    pthread_mutex_unlock(&g_state_lock);
+
+    return n;
+}
+
+/* Return the file descriptor of one queue */
+int ad_tun_get_queue_fd(unsigned q)
+{
+    pthread_mutex_lock(&g_state_lock);
+    int fd = (q < g_num_queues) ? g_queue_fds[q] : -1;
+    pthread_mutex_unlock(&g_state_lock);
+
+    return fd;
+}
+
 /* Helper to get internal config pointer */
 ad_tun_config_t ad_tun_get_config_copy(void)
 {
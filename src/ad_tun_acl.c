@@ -0,0 +1,753 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun ACL                **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#define _GNU_SOURCE
+
+#include "../include/ad_tun_acl.h"
+#include "../include/ad_tun_nl.h"
+#include "../../prebuilt/inih/include/ini.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/* Packets classified per chunk; their keys live on the stack */
+#define ACL_CHUNK 64
+
+/* A port range splits into at most 30 prefixes */
+#define ACL_MAX_PORT_PREFIXES 32
+
+#define ACL_NO_MATCH INT32_MAX
+
+/* Masked 5-tuple, hashed and compared as five words */
+typedef union {
+    struct {
+        uint8_t src[16];
+        uint8_t dst[16];
+        uint16_t sport;
+        uint16_t dport;
+        uint8_t proto;
+        uint8_t pad[3];
+    } f;
+    uint64_t w[5];
+} acl_key_t;
+
+typedef struct {
+    acl_key_t key;
+    int32_t prio;               /* Index of the first rule with this key, -1 = empty slot */
+} acl_entry_t;
+
+/* All rules sharing one combination of masks */
+typedef struct {
+    acl_key_t mask;
+    uint8_t src_plen, dst_plen, proto, sport_plen, dport_plen;
+    int32_t min_prio;           /* Best rule in the table; tuples are searched in this order */
+    uint32_t size_mask;
+    acl_entry_t *slots;
+    acl_entry_t *pending;       /* Entries collected before the table is sized */
+    unsigned count, cap;
+} acl_tuple_t;
+
+typedef struct {
+    acl_tuple_t *tuples;
+    unsigned count, cap;
+} acl_space_t;
+
+struct ad_tun_acl_set {
+    acl_space_t space[2][2];    /* [direction][0 = IPv4, 1 = IPv6] */
+    uint8_t *actions;
+    uint64_t *hits;
+    unsigned nrules;
+    uint8_t default_action[2];
+    uint64_t packets[2];
+    uint64_t dropped[2];
+    uint64_t defaults[2];
+};
+
+/* ---- Rule lists ---- */
+
+void ad_tun_acl_rules_init(ad_tun_acl_rules_t *rules)
+{
+    memset(rules, 0, sizeof(*rules));
+}
+
+void ad_tun_acl_rules_free(ad_tun_acl_rules_t *rules)
+{
+    if (!rules) return;
+    free(rules->rules);
+    memset(rules, 0, sizeof(*rules));
+}
+
+int ad_tun_acl_rules_add(ad_tun_acl_rules_t *rules, const ad_tun_acl_rule_t *rule)
+{
+    if (rules->count == rules->cap) {
+        unsigned cap = rules->cap ? rules->cap * 2 : 64;
+        ad_tun_acl_rule_t *r = realloc(rules->rules, cap * sizeof(*r));
+        if (!r) return -ENOMEM;
+        rules->rules = r;
+        rules->cap = cap;
+    }
+    rules->rules[rules->count++] = *rule;
+    return 0;
+}
+
+static int acl_parse_action(const char *s, uint8_t *out)
+{
+    if (strcmp(s, "allow") == 0) *out = AD_TUN_ACL_ALLOW;
+    else if (strcmp(s, "drop") == 0) *out = AD_TUN_ACL_DROP;
+    else return -EINVAL;
+    return 0;
+}
+
+static int acl_parse_proto(const char *s, uint8_t *out)
+{
+    if (strcmp(s, "tcp") == 0) *out = IPPROTO_TCP;
+    else if (strcmp(s, "udp") == 0) *out = IPPROTO_UDP;
+    else if (strcmp(s, "icmp") == 0) *out = IPPROTO_ICMP;
+    else if (strcmp(s, "icmp6") == 0) *out = IPPROTO_ICMPV6;
+    else if (strcmp(s, "ip") == 0) *out = 0;
+    else {
+        char *end;
+        unsigned long v = strtoul(s, &end, 10);
+        if (end == s || *end != '\0' || v > 255) return -EINVAL;
+        *out = (uint8_t)v;
+    }
+    return 0;
+}
+
+/* "N" or "LO-HI" */
+static int acl_parse_ports(const char *s, uint16_t *lo, uint16_t *hi)
+{
+    char *end;
+    unsigned long a = strtoul(s, &end, 10), b = a;
+    if (end == s) return -EINVAL;
+    if (*end == '-') {
+        const char *s2 = end + 1;
+        b = strtoul(s2, &end, 10);
+        if (end == s2) return -EINVAL;
+    }
+    if (*end != '\0' || a > 65535 || b > 65535 || a > b) return -EINVAL;
+    *lo = (uint16_t)a;
+    *hi = (uint16_t)b;
+    return 0;
+}
+
+/* "any" or a prefix with its host bits cleared */
+static int acl_parse_addr(const char *s, ad_tun_acl_rule_t *r, uint8_t *addr, uint8_t *plen)
+{
+    if (strcmp(s, "any") == 0) return 0;
+
+    int family;
+    unsigned len;
+    if (ad_tun_nl_parse_prefix(s, &family, addr, &len) != 0) return -EINVAL;
+    if (r->family && r->family != family) return -EINVAL;
+    r->family = (uint8_t)family;
+    *plen = (uint8_t)len;
+
+    for (unsigned i = 0; i < 16; i++) {
+        unsigned keep = (len >= (i + 1) * 8) ? 8 : (len > i * 8 ? len - i * 8 : 0);
+        addr[i] &= (uint8_t)(0xff00 >> keep);
+    }
+    return 0;
+}
+
+int ad_tun_acl_parse_rule(const char *spec, ad_tun_acl_rule_t *out)
+{
+    char buf[256];
+    if (!spec || !out || strlen(spec) >= sizeof(buf)) return -EINVAL;
+    strcpy(buf, spec);
+
+    memset(out, 0, sizeof(*out));
+    out->sport_hi = 65535;
+    out->dport_hi = 65535;
+
+    char *save = NULL;
+    char *tok = strtok_r(buf, " \t", &save);
+    if (!tok || acl_parse_action(tok, &out->action) != 0) return -EINVAL;
+
+    while ((tok = strtok_r(NULL, " \t", &save)) != NULL) {
+        if (strcmp(tok, "rx") == 0) {
+            out->dirs |= 1u << AD_TUN_ACL_RX;
+            continue;
+        } else if (strcmp(tok, "tx") == 0) {
+            out->dirs |= 1u << AD_TUN_ACL_TX;
+            continue;
+        } else if (acl_parse_proto(tok, &out->proto) == 0) {
+            continue;
+        }
+
+        char *val = strtok_r(NULL, " \t", &save);
+        if (!val) return -EINVAL;
+        int rc;
+        if (strcmp(tok, "proto") == 0) rc = acl_parse_proto(val, &out->proto);
+        else if (strcmp(tok, "from") == 0) rc = acl_parse_addr(val, out, out->src, &out->src_plen);
+        else if (strcmp(tok, "to") == 0) rc = acl_parse_addr(val, out, out->dst, &out->dst_plen);
+        else if (strcmp(tok, "sport") == 0) rc = acl_parse_ports(val, &out->sport_lo, &out->sport_hi);
+        else if (strcmp(tok, "dport") == 0) rc = acl_parse_ports(val, &out->dport_lo, &out->dport_hi);
+        else rc = -EINVAL;
+        if (rc != 0) return -EINVAL;
+    }
+
+    if (!out->dirs) out->dirs = (1u << AD_TUN_ACL_RX) | (1u << AD_TUN_ACL_TX);
+    return 0;
+}
+
+/* State carried through ini_parse() */
+typedef struct {
+    ad_tun_acl_rules_t *rules;
+    int nomem;
+} acl_parse_ctx_t;
+
+static int acl_ini_handler(void *user, const char *section,
+                           const char *name, const char *value)
+{
+    acl_parse_ctx_t *ctx = (acl_parse_ctx_t*)user;
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (strcmp(section, "acl") != 0) return 1;
+
+    if (strcmp(name, "rule") == 0) {
+        ad_tun_acl_rule_t r;
+        if (ad_tun_acl_parse_rule(value, &r) != 0) {
+            zlog_error(zc, "Invalid ACL rule: %s", value);
+            return 0;
+        }
+        if (ad_tun_acl_rules_add(ctx->rules, &r) != 0) {
+            ctx->nomem = 1;
+            return 0;
+        }
+    } else if (strcmp(name, "default") == 0 || strcmp(name, "default_rx") == 0 ||
+               strcmp(name, "default_tx") == 0) {
+        uint8_t a;
+        if (acl_parse_action(value, &a) != 0) {
+            zlog_error(zc, "Invalid ACL %s: %s", name, value);
+            return 0;
+        }
+        if (strcmp(name, "default_tx") != 0) ctx->rules->default_action[AD_TUN_ACL_RX] = a;
+        if (strcmp(name, "default_rx") != 0) ctx->rules->default_action[AD_TUN_ACL_TX] = a;
+    } else {
+        zlog_warn(zc, "Unknown ACL key '%s' ignored", name);
+    }
+    return 1;
+}
+
+ad_tun_error_t ad_tun_acl_load_config(const char *path, ad_tun_acl_rules_t *rules)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!path || !rules) {
+        zlog_error(zc, "Invalid arguments to ad_tun_acl_load_config()");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    acl_parse_ctx_t ctx = { rules, 0 };
+    unsigned before = rules->count;
+
+    int rc = ini_parse(path, acl_ini_handler, &ctx);
+    if (rc < 0) {
+        zlog_error(zc, "Failed to open config file: %s", path);
+        return AD_TUN_ERR_CONFIG;
+    } else if (ctx.nomem) {
+        zlog_error(zc, "Memory allocation failed while loading ACL rules from %s", path);
+        return AD_TUN_ERR_CONFIG;
+    } else if (rc > 0) {
+        zlog_error(zc, "Parsing error at line %d in config file %s", rc, path);
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    zlog_info(zc, "Loaded %u ACL rules from %s", rules->count - before, path);
+    return AD_TUN_OK;
+}
+
+/* ---- Compilation ---- */
+
+static uint16_t acl_port_mask(unsigned plen)
+{
+    return (uint16_t)(0xffff0000u >> plen);
+}
+
+/* Split [lo, hi] into aligned power-of-two blocks */
+static unsigned acl_port_prefixes(uint16_t lo, uint16_t hi, uint16_t *val, uint8_t *plen)
+{
+    unsigned n = 0;
+    uint32_t cur = lo;
+
+    while (cur <= hi) {
+        unsigned bits = 0;
+        while (bits < 16 && (cur & ((2u << bits) - 1)) == 0 && cur + (2u << bits) - 1 <= hi) bits++;
+        val[n] = (uint16_t)cur;
+        plen[n] = (uint8_t)(16 - bits);
+        n++;
+        cur += 1u << bits;
+    }
+    return n;
+}
+
+static void acl_prefix_mask(uint8_t *mask, unsigned plen)
+{
+    for (unsigned i = 0; i < 16; i++) {
+        unsigned keep = (plen >= (i + 1) * 8) ? 8 : (plen > i * 8 ? plen - i * 8 : 0);
+        mask[i] = (uint8_t)(0xff00 >> keep);
+    }
+}
+
+static inline uint32_t acl_hash(const acl_key_t *k)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    for (int i = 0; i < 5; i++) {
+        h = (h ^ k->w[i]) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+    }
+    return (uint32_t)h;
+}
+
+static inline int acl_key_eq(const acl_key_t *a, const acl_key_t *b)
+{
+    return ((a->w[0] ^ b->w[0]) | (a->w[1] ^ b->w[1]) | (a->w[2] ^ b->w[2]) |
+            (a->w[3] ^ b->w[3]) | (a->w[4] ^ b->w[4])) == 0;
+}
+
+static acl_tuple_t *acl_tuple_get(acl_space_t *sp, uint8_t src_plen, uint8_t dst_plen, uint8_t proto,
+                                  uint8_t sport_plen, uint8_t dport_plen)
+{
+    for (unsigned i = 0; i < sp->count; i++) {
+        acl_tuple_t *t = &sp->tuples[i];
+        if (t->src_plen == src_plen && t->dst_plen == dst_plen && t->proto == proto &&
+            t->sport_plen == sport_plen && t->dport_plen == dport_plen) return t;
+    }
+
+    if (sp->count == sp->cap) {
+        unsigned cap = sp->cap ? sp->cap * 2 : 8;
+        acl_tuple_t *t = realloc(sp->tuples, cap * sizeof(*t));
+        if (!t) return NULL;
+        sp->tuples = t;
+        sp->cap = cap;
+    }
+
+    acl_tuple_t *t = &sp->tuples[sp->count++];
+    memset(t, 0, sizeof(*t));
+    t->src_plen = src_plen;
+    t->dst_plen = dst_plen;
+    t->proto = proto;
+    t->sport_plen = sport_plen;
+    t->dport_plen = dport_plen;
+    t->min_prio = ACL_NO_MATCH;
+    acl_prefix_mask(t->mask.f.src, src_plen);
+    acl_prefix_mask(t->mask.f.dst, dst_plen);
+    t->mask.f.sport = acl_port_mask(sport_plen);
+    t->mask.f.dport = acl_port_mask(dport_plen);
+    t->mask.f.proto = proto ? 0xff : 0;
+    return t;
+}
+
+static int acl_tuple_push(acl_tuple_t *t, const acl_key_t *key, int32_t prio)
+{
+    if (t->count == t->cap) {
+        unsigned cap = t->cap ? t->cap * 2 : 16;
+        acl_entry_t *e = realloc(t->pending, cap * sizeof(*e));
+        if (!e) return -ENOMEM;
+        t->pending = e;
+        t->cap = cap;
+    }
+    t->pending[t->count].key = *key;
+    t->pending[t->count].prio = prio;
+    t->count++;
+    if (prio < t->min_prio) t->min_prio = prio;
+    return 0;
+}
+
+/* Hash the collected entries at a load factor of at most 1/2; the first rule wins a key */
+static int acl_tuple_build(acl_tuple_t *t)
+{
+    uint32_t size = 16;
+    while (size < t->count * 2) size <<= 1;
+
+    t->slots = malloc(size * sizeof(*t->slots));
+    if (!t->slots) return -ENOMEM;
+    for (uint32_t i = 0; i < size; i++) t->slots[i].prio = -1;
+    t->size_mask = size - 1;
+
+    unsigned unique = 0;
+    for (unsigned i = 0; i < t->count; i++) {
+        const acl_entry_t *e = &t->pending[i];
+        uint32_t h = acl_hash(&e->key) & t->size_mask;
+        while (t->slots[h].prio >= 0 && !acl_key_eq(&t->slots[h].key, &e->key)) h = (h + 1) & t->size_mask;
+        if (t->slots[h].prio < 0) {
+            t->slots[h] = *e;
+            unique++;
+        } else if (e->prio < t->slots[h].prio) {
+            t->slots[h].prio = e->prio;
+        }
+    }
+
+    free(t->pending);
+    t->pending = NULL;
+    t->count = unique;
+    return 0;
+}
+
+static int acl_tuple_cmp(const void *a, const void *b)
+{
+    int32_t x = ((const acl_tuple_t*)a)->min_prio, y = ((const acl_tuple_t*)b)->min_prio;
+    return (x > y) - (x < y);
+}
+
+static void acl_set_free(ad_tun_acl_set_t *set)
+{
+    if (!set) return;
+
+    for (int d = 0; d < 2; d++) {
+        for (int f = 0; f < 2; f++) {
+            acl_space_t *sp = &set->space[d][f];
+            for (unsigned i = 0; i < sp->count; i++) {
+                free(sp->tuples[i].slots);
+                free(sp->tuples[i].pending);
+            }
+            free(sp->tuples);
+        }
+    }
+    free(set->actions);
+    free(set->hits);
+    free(set);
+}
+
+/* Add the entries of one rule to one direction and family */
+static int acl_add_rule(acl_space_t *sp, const ad_tun_acl_rule_t *r, int32_t prio,
+                        const uint16_t *sv, const uint8_t *sl, unsigned ns,
+                        const uint16_t *dv, const uint8_t *dl, unsigned nd)
+{
+    for (unsigned i = 0; i < ns; i++) {
+        for (unsigned j = 0; j < nd; j++) {
+            acl_tuple_t *t = acl_tuple_get(sp, r->src_plen, r->dst_plen, r->proto, sl[i], dl[j]);
+            if (!t) return -ENOMEM;
+
+            acl_key_t key;
+            memset(&key, 0, sizeof(key));
+            memcpy(key.f.src, r->src, 16);
+            memcpy(key.f.dst, r->dst, 16);
+            key.f.sport = sv[i];
+            key.f.dport = dv[j];
+            key.f.proto = r->proto;
+            if (acl_tuple_push(t, &key, prio) != 0) return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+static ad_tun_acl_set_t *acl_set_build(const ad_tun_acl_rules_t *rules)
+{
+    ad_tun_acl_set_t *set = calloc(1, sizeof(*set));
+    if (!set) return NULL;
+
+    set->nrules = rules->count;
+    set->default_action[0] = rules->default_action[0];
+    set->default_action[1] = rules->default_action[1];
+    set->actions = malloc(rules->count + 1);
+    set->hits = calloc(rules->count + 1, sizeof(*set->hits));
+    if (!set->actions || !set->hits) goto fail;
+
+    for (unsigned i = 0; i < rules->count; i++) {
+        const ad_tun_acl_rule_t *r = &rules->rules[i];
+        uint16_t sv[ACL_MAX_PORT_PREFIXES], dv[ACL_MAX_PORT_PREFIXES];
+        uint8_t sl[ACL_MAX_PORT_PREFIXES], dl[ACL_MAX_PORT_PREFIXES];
+        unsigned ns = acl_port_prefixes(r->sport_lo, r->sport_hi, sv, sl);
+        unsigned nd = acl_port_prefixes(r->dport_lo, r->dport_hi, dv, dl);
+
+        set->actions[i] = r->action;
+        for (int d = 0; d < 2; d++) {
+            if (!(r->dirs & (1u << d))) continue;
+            if (r->family != AF_INET6 &&
+                acl_add_rule(&set->space[d][0], r, (int32_t)i, sv, sl, ns, dv, dl, nd) != 0) goto fail;
+            if (r->family != AF_INET &&
+                acl_add_rule(&set->space[d][1], r, (int32_t)i, sv, sl, ns, dv, dl, nd) != 0) goto fail;
+        }
+    }
+
+    for (int d = 0; d < 2; d++) {
+        for (int f = 0; f < 2; f++) {
+            acl_space_t *sp = &set->space[d][f];
+            for (unsigned i = 0; i < sp->count; i++) {
+                if (acl_tuple_build(&sp->tuples[i]) != 0) goto fail;
+            }
+            qsort(sp->tuples, sp->count, sizeof(*sp->tuples), acl_tuple_cmp);
+        }
+    }
+    return set;
+
+fail:
+    acl_set_free(set);
+    return NULL;
+}
+
+/* ---- Filter handle ---- */
+
+ad_tun_error_t ad_tun_acl_init(ad_tun_acl_t *acl)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!acl) {
+        zlog_error(zc, "ad_tun_acl_init: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    /* Reloads must not wait behind a steady stream of lookups */
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    int rc = pthread_rwlock_init(&acl->lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    if (rc != 0) {
+        zlog_error(zc, "ad_tun_acl_init: pthread_rwlock_init failed: %s", strerror(rc));
+        return AD_TUN_ERR_SYS;
+    }
+    acl->set = NULL;
+    return AD_TUN_OK;
+}
+
+void ad_tun_acl_free(ad_tun_acl_t *acl)
+{
+    if (!acl) return;
+    acl_set_free(acl->set);
+    acl->set = NULL;
+    pthread_rwlock_destroy(&acl->lock);
+}
+
+ad_tun_error_t ad_tun_acl_compile(ad_tun_acl_t *acl, const ad_tun_acl_rules_t *rules)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!acl || !rules || rules->count > INT32_MAX ||
+        rules->default_action[0] > AD_TUN_ACL_DROP || rules->default_action[1] > AD_TUN_ACL_DROP) {
+        zlog_error(zc, "ad_tun_acl_compile: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    ad_tun_acl_set_t *set = acl_set_build(rules);
+    if (!set) {
+        zlog_error(zc, "ad_tun_acl_compile: allocation failed");
+        return AD_TUN_ERR_SYS;
+    }
+
+    pthread_rwlock_wrlock(&acl->lock);
+    ad_tun_acl_set_t *old = acl->set;
+    acl->set = set;
+    pthread_rwlock_unlock(&acl->lock);
+    acl_set_free(old);
+
+    zlog_info(zc, "ACL compiled: rules=%u, tuples rx=%u/%u tx=%u/%u", rules->count,
+              set->space[0][0].count, set->space[0][1].count,
+              set->space[1][0].count, set->space[1][1].count);
+    return AD_TUN_OK;
+}
+
+ad_tun_error_t ad_tun_acl_reload(ad_tun_acl_t *acl, const char *path)
+{
+    ad_tun_acl_rules_t rules;
+    ad_tun_acl_rules_init(&rules);
+
+    ad_tun_error_t rc = ad_tun_acl_load_config(path, &rules);
+    if (rc == AD_TUN_OK) rc = ad_tun_acl_compile(acl, &rules);
+    ad_tun_acl_rules_free(&rules);
+    return rc;
+}
+
+/* ---- Lookup ---- */
+
+static inline void acl_key_of(const ad_tun_pkt_info_t *info, acl_key_t *k)
+{
+    memcpy(k->f.src, info->src, 16);
+    memcpy(k->f.dst, info->dst, 16);
+    k->f.sport = info->sport;
+    k->f.dport = info->dport;
+    k->f.proto = info->proto;
+    memset(k->f.pad, 0, sizeof(k->f.pad));
+}
+
+/*
+ * Search one family's tuples for the packets idx[0..n) of a chunk.
+ * Tuples are ordered by their best rule, so a tuple is skipped for packets
+ * that already matched an earlier rule, and the search stops once no
+ * packet can improve.
+ */
+static void acl_search(const acl_space_t *sp, const acl_key_t *keys, const uint8_t *idx, unsigned n,
+                       int32_t *best)
+{
+    int32_t worst = ACL_NO_MATCH;
+
+    for (unsigned t = 0; t < sp->count; t++) {
+        const acl_tuple_t *tp = &sp->tuples[t];
+        if (tp->min_prio >= worst) break;
+
+        int32_t next_worst = 0;
+        for (unsigned j = 0; j < n; j++) {
+            unsigned i = idx[j];
+            if (best[i] > tp->min_prio) {
+                acl_key_t k;
+                for (int w = 0; w < 5; w++) k.w[w] = keys[i].w[w] & tp->mask.w[w];
+
+                uint32_t h = acl_hash(&k) & tp->size_mask;
+                while (tp->slots[h].prio >= 0) {
+                    if (acl_key_eq(&tp->slots[h].key, &k)) {
+                        if (tp->slots[h].prio < best[i]) best[i] = tp->slots[h].prio;
+                        break;
+                    }
+                    h = (h + 1) & tp->size_mask;
+                }
+            }
+            if (best[i] > next_worst) next_worst = best[i];
+        }
+        worst = next_worst;
+    }
+}
+
+/* Classify up to ACL_CHUNK packets; info[i] may be NULL for packets that did not parse */
+static unsigned acl_chunk(ad_tun_acl_set_t *set, int dir, const ad_tun_pkt_info_t *const *info, unsigned n,
+                          uint8_t *verdicts, int32_t *rules)
+{
+    acl_key_t keys[ACL_CHUNK];
+    uint8_t idx[2][ACL_CHUNK];
+    unsigned nidx[2] = { 0, 0 };
+    int32_t best[ACL_CHUNK];
+
+    for (unsigned i = 0; i < n; i++) {
+        best[i] = ACL_NO_MATCH;
+        if (!info[i]) continue;
+        if (info[i]->family == AF_INET) idx[0][nidx[0]++] = (uint8_t)i;
+        else if (info[i]->family == AF_INET6) idx[1][nidx[1]++] = (uint8_t)i;
+        else continue;
+        acl_key_of(info[i], &keys[i]);
+    }
+
+    if (nidx[0]) acl_search(&set->space[dir][0], keys, idx[0], nidx[0], best);
+    if (nidx[1]) acl_search(&set->space[dir][1], keys, idx[1], nidx[1], best);
+
+    unsigned allowed = 0, defaults = 0;
+    for (unsigned i = 0; i < n; i++) {
+        uint8_t v;
+        if (best[i] == ACL_NO_MATCH) {
+            v = set->default_action[dir];
+            defaults++;
+            if (rules) rules[i] = AD_TUN_ACL_DEFAULT;
+        } else {
+            v = set->actions[best[i]];
+            __atomic_fetch_add(&set->hits[best[i]], 1, __ATOMIC_RELAXED);
+            if (rules) rules[i] = best[i];
+        }
+        verdicts[i] = v;
+        allowed += (v == AD_TUN_ACL_ALLOW);
+    }
+
+    __atomic_fetch_add(&set->packets[dir], n, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&set->dropped[dir], n - allowed, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&set->defaults[dir], defaults, __ATOMIC_RELAXED);
+    return allowed;
+}
+
+unsigned ad_tun_acl_classify(ad_tun_acl_t *acl, int dir, const ad_tun_pkt_info_t *info, unsigned n,
+                             uint8_t *verdicts, int32_t *rules)
+{
+    if (!acl || !info || !verdicts || (dir != AD_TUN_ACL_RX && dir != AD_TUN_ACL_TX)) return 0;
+
+    pthread_rwlock_rdlock(&acl->lock);
+    ad_tun_acl_set_t *set = acl->set;
+    unsigned allowed = 0;
+
+    for (unsigned off = 0; off < n; off += ACL_CHUNK) {
+        unsigned m = n - off < ACL_CHUNK ? n - off : ACL_CHUNK;
+        if (!set) {
+            memset(verdicts + off, AD_TUN_ACL_ALLOW, m);
+            if (rules) for (unsigned i = 0; i < m; i++) rules[off + i] = AD_TUN_ACL_DEFAULT;
+            allowed += m;
+            continue;
+        }
+
+        const ad_tun_pkt_info_t *ptrs[ACL_CHUNK];
+        for (unsigned i = 0; i < m; i++) ptrs[i] = &info[off + i];
+        allowed += acl_chunk(set, dir, ptrs, m, verdicts + off, rules ? rules + off : NULL);
+    }
+
+    pthread_rwlock_unlock(&acl->lock);
+    return allowed;
+}
+
+unsigned ad_tun_acl_filter(ad_tun_acl_t *acl, int dir, ad_tun_buf_t **bufs, unsigned n,
+                           ad_tun_buf_t **drops)
+{
+    if (!acl || !bufs || !drops || (dir != AD_TUN_ACL_RX && dir != AD_TUN_ACL_TX)) return 0;
+
+    pthread_rwlock_rdlock(&acl->lock);
+    ad_tun_acl_set_t *set = acl->set;
+    if (!set) {
+        pthread_rwlock_unlock(&acl->lock);
+        return n;
+    }
+
+    unsigned k = 0;
+    for (unsigned off = 0; off < n; off += ACL_CHUNK) {
+        unsigned m = n - off < ACL_CHUNK ? n - off : ACL_CHUNK;
+        ad_tun_pkt_info_t info[ACL_CHUNK];
+        const ad_tun_pkt_info_t *ptrs[ACL_CHUNK];
+        uint8_t verdicts[ACL_CHUNK];
+
+        for (unsigned i = 0; i < m; i++) {
+            const ad_tun_buf_t *b = bufs[off + i];
+            ptrs[i] = ad_tun_pkt_parse(b->data, b->len, &info[i]) == 0 ? &info[i] : NULL;
+        }
+        acl_chunk(set, dir, ptrs, m, verdicts, NULL);
+
+        for (unsigned i = 0; i < m; i++) {
+            ad_tun_buf_t *b = bufs[off + i];
+            if (verdicts[i] == AD_TUN_ACL_ALLOW) {
+                bufs[k++] = b;
+            } else {
+                b->next = *drops;
+                *drops = b;
+            }
+        }
+    }
+
+    pthread_rwlock_unlock(&acl->lock);
+    return k;
+}
+
+unsigned ad_tun_acl_hits(ad_tun_acl_t *acl, uint64_t *hits, unsigned max)
+{
+    if (!acl) return 0;
+
+    pthread_rwlock_rdlock(&acl->lock);
+    unsigned n = acl->set ? acl->set->nrules : 0;
+    for (unsigned i = 0; i < n && i < max && hits; i++) {
+        hits[i] = __atomic_load_n(&acl->set->hits[i], __ATOMIC_RELAXED);
+    }
+    pthread_rwlock_unlock(&acl->lock);
+    return n;
+}
+
+void ad_tun_acl_get_stats(ad_tun_acl_t *acl, ad_tun_acl_stats_t *stats)
+{
+    if (!stats) return;
+    memset(stats, 0, sizeof(*stats));
+    if (!acl) return;
+
+    pthread_rwlock_rdlock(&acl->lock);
+    ad_tun_acl_set_t *set = acl->set;
+    if (set) {
+        for (int d = 0; d < 2; d++) {
+            stats->packets[d] = __atomic_load_n(&set->packets[d], __ATOMIC_RELAXED);
+            stats->dropped[d] = __atomic_load_n(&set->dropped[d], __ATOMIC_RELAXED);
+            stats->defaults[d] = __atomic_load_n(&set->defaults[d], __ATOMIC_RELAXED);
+            unsigned t = set->space[d][0].count > set->space[d][1].count ?
+                         set->space[d][0].count : set->space[d][1].count;
+            if (t > stats->tuples) stats->tuples = t;
+        }
+        stats->rules = set->nrules;
+    }
+    pthread_rwlock_unlock(&acl->lock);
+}
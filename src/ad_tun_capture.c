@@ -0,0 +1,571 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Packet Capture     **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_capture.h"
+#include "../include/ad_tun_pkt.h"
+#include "../include/ad_tun_eth.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/* Defaults for ad_tun_capture_config_t */
+#define DEFAULT_CAPTURE_SLOTS 4096
+#define DEFAULT_CAPTURE_SNAPLEN 256
+
+#define CAPTURE_MAX_SNAPLEN 65535
+#define CAPTURE_WRITER_IDLE_NS 1000000      /* writer sleep when the ring is empty */
+#define CAPTURE_FILE_BUFFER (1 << 20)
+
+/* pcapng block types and options */
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS 2
+#define PCAPNG_EPB_INBOUND 1
+#define PCAPNG_EPB_OUTBOUND 2
+
+/* Ring slot header; the packet bytes follow it */
+typedef struct {
+    uint64_t seq;               /* Vyukov sequence number */
+    uint64_t ts_ns;             /* CLOCK_REALTIME */
+    uint32_t orig_len;
+    uint32_t cap_len;
+    uint32_t dir;
+} capture_slot_t;
+
+/* Capture state; set up by ad_tun_capture_start() */
+typedef struct {
+    ad_tun_capture_config_t cfg;
+    int filter_empty;
+    unsigned char *ring;        /* mmap'd slots */
+    ad_tun_mem_t ring_map;
+    size_t stride;
+    uint64_t mask;
+    uint64_t enq_pos __attribute__((aligned(64)));
+    uint64_t deq_pos __attribute__((aligned(64)));
+    FILE *out;
+    pthread_t writer;
+    int running;
+    ad_tun_capture_stats_t stats;
+} capture_state_t;
+
+int ad_tun_capture_active = 0;
+
+static capture_state_t g_cap;
+/* Producers currently inside ad_tun_capture_packet(); outlives g_cap resets */
+static int g_cap_users = 0;
+static int g_cap_started = 0;
+static pthread_mutex_t g_cap_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local unsigned t_sample_count;
+
+void ad_tun_capture_default_config(ad_tun_capture_config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->slots = DEFAULT_CAPTURE_SLOTS;
+    cfg->snaplen = DEFAULT_CAPTURE_SNAPLEN;
+    cfg->sample = 1;
+    cfg->directions = AD_TUN_CAPTURE_RX | AD_TUN_CAPTURE_TX;
+    cfg->linktype = AD_TUN_CAPTURE_LINK_RAW;
+}
+
+/* ---- Filter ---- */
+
+/* Parse ADDR or ADDR/LEN; returns 0 on success */
+static int capture_parse_net(const char *s, int need_len, uint8_t *addr, uint8_t *plen, uint8_t *family)
+{
+    char tmp[INET6_ADDRSTRLEN + 8];
+    if (strlen(s) >= sizeof(tmp)) return -1;
+    strcpy(tmp, s);
+
+    char *slash = strchr(tmp, '/');
+    if (slash) *slash = '\0';
+    else if (need_len) return -1;
+
+    memset(addr, 0, 16);
+    int max;
+    if (inet_pton(AF_INET, tmp, addr) == 1) {
+        *family = AF_INET;
+        max = 32;
+    } else if (inet_pton(AF_INET6, tmp, addr) == 1) {
+        *family = AF_INET6;
+        max = 128;
+    } else {
+        return -1;
+    }
+
+    if (slash) {
+        char *end;
+        long l = strtol(slash + 1, &end, 10);
+        if (*end != '\0' || l < 1 || l > max) return -1;
+        *plen = (uint8_t)l;
+    } else {
+        *plen = (uint8_t)max;
+    }
+    return 0;
+}
+
+ad_tun_error_t ad_tun_capture_parse_filter(const char *expr, ad_tun_capture_filter_t *filter)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!filter) return AD_TUN_ERR_CONFIG;
+    memset(filter, 0, sizeof(*filter));
+    if (!expr) return AD_TUN_OK;
+
+    char *copy = strdup(expr);
+    if (!copy) return AD_TUN_ERR_SYS;
+
+    ad_tun_error_t ret = AD_TUN_OK;
+    char *save = NULL;
+    char *tok = strtok_r(copy, " \t", &save);
+
+    while (tok) {
+        /* Optional direction qualifier */
+        int qual = 0;   /* 0 = either, 1 = src, 2 = dst */
+        if (strcmp(tok, "src") == 0) qual = 1;
+        else if (strcmp(tok, "dst") == 0) qual = 2;
+        if (qual) {
+            tok = strtok_r(NULL, " \t", &save);
+            if (!tok) goto bad;
+        }
+
+        if (!qual && strcmp(tok, "and") == 0) {
+            /* separator */
+        } else if (!qual && strcmp(tok, "ip") == 0) {
+            filter->family = AF_INET;
+        } else if (!qual && strcmp(tok, "ip6") == 0) {
+            filter->family = AF_INET6;
+        } else if (!qual && (strcmp(tok, "tcp") == 0 || strcmp(tok, "udp") == 0 ||
+                             strcmp(tok, "icmp") == 0 || strcmp(tok, "icmp6") == 0)) {
+            filter->has_proto = 1;
+            filter->proto = (tok[0] == 't') ? IPPROTO_TCP : (tok[0] == 'u') ? IPPROTO_UDP
+                          : (tok[4] == '6') ? IPPROTO_ICMPV6 : IPPROTO_ICMP;
+        } else if (!qual && strcmp(tok, "proto") == 0) {
+            char *arg = strtok_r(NULL, " \t", &save);
+            char *end;
+            long p = arg ? strtol(arg, &end, 10) : -1;
+            if (!arg || *end != '\0' || p < 0 || p > 255) goto bad;
+            filter->has_proto = 1;
+            filter->proto = (uint8_t)p;
+        } else if (strcmp(tok, "host") == 0 || strcmp(tok, "net") == 0) {
+            int is_net = (tok[0] == 'n');
+            char *arg = strtok_r(NULL, " \t", &save);
+            if (!arg) goto bad;
+
+            uint8_t *addr = (qual == 1) ? filter->src : (qual == 2) ? filter->dst : filter->host;
+            uint8_t *plen = (qual == 1) ? &filter->src_plen : (qual == 2) ? &filter->dst_plen
+                          : &filter->host_plen;
+            uint8_t *fam = (qual == 1) ? &filter->src_family : (qual == 2) ? &filter->dst_family
+                         : &filter->host_family;
+            if (capture_parse_net(arg, is_net, addr, plen, fam) != 0) goto bad;
+        } else if (strcmp(tok, "port") == 0) {
+            char *arg = strtok_r(NULL, " \t", &save);
+            char *end;
+            long p = arg ? strtol(arg, &end, 10) : -1;
+            if (!arg || *end != '\0' || p < 1 || p > 65535) goto bad;
+            if (qual == 1) filter->sport = (uint16_t)p;
+            else if (qual == 2) filter->dport = (uint16_t)p;
+            else filter->port = (uint16_t)p;
+        } else {
+            goto bad;
+        }
+
+        tok = strtok_r(NULL, " \t", &save);
+    }
+
+    free(copy);
+    return ret;
+
+bad:
+    zlog_error(zc, "ad_tun_capture_parse_filter: cannot parse '%s'", expr);
+    free(copy);
+    memset(filter, 0, sizeof(*filter));
+    return AD_TUN_ERR_CONFIG;
+}
+
+static int capture_prefix_match(const uint8_t *a, const uint8_t *net, unsigned plen)
+{
+    unsigned bytes = plen / 8;
+    unsigned bits = plen % 8;
+
+    if (memcmp(a, net, bytes) != 0) return 0;
+    if (bits) {
+        uint8_t m = (uint8_t)(0xff << (8 - bits));
+        if ((a[bytes] & m) != (net[bytes] & m)) return 0;
+    }
+    return 1;
+}
+
+static int capture_net_match(const ad_tun_pkt_info_t *info, const uint8_t *addr,
+                             uint8_t family, uint8_t plen, const uint8_t *net)
+{
+    return info->family == family && capture_prefix_match(addr, net, plen);
+}
+
+int ad_tun_capture_filter_match(const ad_tun_capture_filter_t *f, const ad_tun_pkt_info_t *info)
+{
+    if (f->family && info->family != f->family) return 0;
+    if (f->has_proto && info->proto != f->proto) return 0;
+
+    if (f->src_plen && !capture_net_match(info, info->src, f->src_family, f->src_plen, f->src)) return 0;
+    if (f->dst_plen && !capture_net_match(info, info->dst, f->dst_family, f->dst_plen, f->dst)) return 0;
+    if (f->host_plen &&
+        !capture_net_match(info, info->src, f->host_family, f->host_plen, f->host) &&
+        !capture_net_match(info, info->dst, f->host_family, f->host_plen, f->host)) {
+        return 0;
+    }
+
+    if (f->sport && info->sport != f->sport) return 0;
+    if (f->dport && info->dport != f->dport) return 0;
+    if (f->port && info->sport != f->port && info->dport != f->port) return 0;
+
+    return 1;
+}
+
+static int capture_match(const ad_tun_capture_filter_t *f, const void *pkt, size_t len)
+{
+    const unsigned char *p = pkt;
+    if (g_cap.cfg.linktype == AD_TUN_CAPTURE_LINK_ETHERNET) {
+        int off = ad_tun_eth_ip_offset(p, len);
+        if (off < 0) return 0;
+        p += off;
+        len -= (size_t)off;
+    }
+
+    ad_tun_pkt_info_t info;
+    if (ad_tun_pkt_parse(p, len, &info) != 0) return 0;
+
+    return ad_tun_capture_filter_match(f, &info);
+}
+
+/* ---- Ring ---- */
+
+static inline capture_slot_t *capture_slot(uint64_t pos)
+{
+    return (capture_slot_t *)(g_cap.ring + (pos & g_cap.mask) * g_cap.stride);
+}
+
+void ad_tun_capture_packet(unsigned dir, const void *pkt, size_t len)
+{
+    if (!pkt || len == 0) return;
+
+    /*
+     * Register as a user first so stop() waits for us before unmapping.
+     * Both sides store then load (users/active here, active/users in
+     * stop), so only seq_cst keeps either from missing the other.
+     */
+    __atomic_fetch_add(&g_cap_users, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&ad_tun_capture_active, __ATOMIC_SEQ_CST)) goto out;
+
+    __atomic_fetch_add(&g_cap.stats.seen, 1, __ATOMIC_RELAXED);
+
+    if (!(g_cap.cfg.directions & dir) ||
+        (!g_cap.filter_empty && !capture_match(&g_cap.cfg.filter, pkt, len))) {
+        __atomic_fetch_add(&g_cap.stats.filtered, 1, __ATOMIC_RELAXED);
+        goto out;
+    }
+
+    /* Per-thread counter keeps sampling free of shared cache lines */
+    if (g_cap.cfg.sample > 1 && (t_sample_count++ % g_cap.cfg.sample) != 0) {
+        __atomic_fetch_add(&g_cap.stats.sampled_out, 1, __ATOMIC_RELAXED);
+        goto out;
+    }
+
+    /* Claim a slot (bounded MPMC queue after D. Vyukov); drop instead of waiting */
+    uint64_t pos = __atomic_load_n(&g_cap.enq_pos, __ATOMIC_RELAXED);
+    capture_slot_t *slot;
+    for (;;) {
+        slot = capture_slot(pos);
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(seq - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&g_cap.enq_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            __atomic_fetch_add(&g_cap.stats.dropped, 1, __ATOMIC_RELAXED);
+            goto out;
+        } else {
+            pos = __atomic_load_n(&g_cap.enq_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    size_t cap = (len < g_cap.cfg.snaplen) ? len : g_cap.cfg.snaplen;
+    slot->ts_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    slot->orig_len = (uint32_t)len;
+    slot->cap_len = (uint32_t)cap;
+    slot->dir = dir;
+    memcpy(slot + 1, pkt, cap);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+out:
+    __atomic_fetch_sub(&g_cap_users, 1, __ATOMIC_RELEASE);
+}
+
+/* ---- pcapng writer ---- */
+
+static void pcapng_u32(FILE *f, uint32_t v) { fwrite(&v, 4, 1, f); }
+static void pcapng_u16(FILE *f, uint16_t v) { fwrite(&v, 2, 1, f); }
+
+static void pcapng_pad(FILE *f, size_t len)
+{
+    static const uint8_t zero[4];
+    if (len & 3) fwrite(zero, 1, 4 - (len & 3), f);
+}
+
+static int pcapng_write_header(FILE *f, const char *ifname)
+{
+    /* Section header block */
+    pcapng_u32(f, PCAPNG_SHB);
+    pcapng_u32(f, 28);
+    pcapng_u32(f, PCAPNG_BYTE_ORDER_MAGIC);
+    pcapng_u16(f, 1);
+    pcapng_u16(f, 0);
+    pcapng_u32(f, 0xffffffff);      /* section length unknown (-1) */
+    pcapng_u32(f, 0xffffffff);
+    pcapng_u32(f, 28);
+
+    /* Interface description block: raw IP or Ethernet, nanosecond timestamps */
+    size_t name_len = ifname ? strlen(ifname) : 0;
+    size_t name_opt = name_len ? 4 + ((name_len + 3) & ~(size_t)3) : 0;
+    uint32_t len = (uint32_t)(20 + name_opt + 8 + 4);
+
+    pcapng_u32(f, PCAPNG_IDB);
+    pcapng_u32(f, len);
+    pcapng_u16(f, (uint16_t)g_cap.cfg.linktype);
+    pcapng_u16(f, 0);
+    pcapng_u32(f, g_cap.cfg.snaplen);
+    if (name_len) {
+        pcapng_u16(f, PCAPNG_OPT_IF_NAME);
+        pcapng_u16(f, (uint16_t)name_len);
+        fwrite(ifname, 1, name_len, f);
+        pcapng_pad(f, name_len);
+    }
+    pcapng_u16(f, PCAPNG_OPT_IF_TSRESOL);
+    pcapng_u16(f, 1);
+    uint8_t resol[4] = {9, 0, 0, 0};
+    fwrite(resol, 1, 4, f);
+    pcapng_u16(f, PCAPNG_OPT_END);
+    pcapng_u16(f, 0);
+    pcapng_u32(f, len);
+
+    return ferror(f) ? -1 : 0;
+}
+
+static void pcapng_write_packet(FILE *f, const capture_slot_t *slot)
+{
+    uint32_t padded = (slot->cap_len + 3) & ~3u;
+    uint32_t len = 28 + padded + 8 + 4 + 4;
+
+    pcapng_u32(f, PCAPNG_EPB);
+    pcapng_u32(f, len);
+    pcapng_u32(f, 0);                                   /* interface id */
+    pcapng_u32(f, (uint32_t)(slot->ts_ns >> 32));
+    pcapng_u32(f, (uint32_t)slot->ts_ns);
+    pcapng_u32(f, slot->cap_len);
+    pcapng_u32(f, slot->orig_len);
+    fwrite(slot + 1, 1, slot->cap_len, f);
+    pcapng_pad(f, slot->cap_len);
+
+    /* Packets read from the device left the host through it */
+    pcapng_u16(f, PCAPNG_OPT_EPB_FLAGS);
+    pcapng_u16(f, 4);
+    pcapng_u32(f, (slot->dir == AD_TUN_CAPTURE_RX) ? PCAPNG_EPB_OUTBOUND : PCAPNG_EPB_INBOUND);
+    pcapng_u16(f, PCAPNG_OPT_END);
+    pcapng_u16(f, 0);
+    pcapng_u32(f, len);
+}
+
+/* Write out every published slot; returns the number written */
+static unsigned capture_flush_ring(void)
+{
+    unsigned n = 0;
+
+    for (;;) {
+        uint64_t pos = g_cap.deq_pos;
+        capture_slot_t *slot = capture_slot(pos);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) break;
+
+        pcapng_write_packet(g_cap.out, slot);
+        __atomic_store_n(&slot->seq, pos + g_cap.mask + 1, __ATOMIC_RELEASE);
+        g_cap.deq_pos = pos + 1;
+        n++;
+    }
+
+    if (n) __atomic_fetch_add(&g_cap.stats.written, n, __ATOMIC_RELAXED);
+    return n;
+}
+
+static void *capture_writer_thread(void *arg)
+{
+    (void)arg;
+    const struct timespec idle = { 0, CAPTURE_WRITER_IDLE_NS };
+
+    while (__atomic_load_n(&g_cap.running, __ATOMIC_ACQUIRE)) {
+        if (capture_flush_ring() == 0) {
+            fflush(g_cap.out);
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+/* ---- Control ---- */
+
+ad_tun_error_t ad_tun_capture_start(const ad_tun_capture_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!cfg || !cfg->path || cfg->slots == 0 || cfg->snaplen == 0 ||
+        cfg->snaplen > CAPTURE_MAX_SNAPLEN || cfg->directions == 0 ||
+        (cfg->linktype != 0 && cfg->linktype != AD_TUN_CAPTURE_LINK_RAW &&
+         cfg->linktype != AD_TUN_CAPTURE_LINK_ETHERNET)) {
+        zlog_error(zc, "ad_tun_capture_start: invalid configuration");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    pthread_mutex_lock(&g_cap_lock);
+    if (g_cap_started) {
+        pthread_mutex_unlock(&g_cap_lock);
+        zlog_error(zc, "ad_tun_capture_start: capture already running");
+        return AD_TUN_ERR_INVALID_STATE;
+    }
+
+    /* A producer that raced the last stop may still be on its way out */
+    while (__atomic_load_n(&g_cap_users, __ATOMIC_SEQ_CST) != 0) sched_yield();
+
+    memset(&g_cap, 0, sizeof(g_cap));
+    g_cap.cfg = *cfg;
+    g_cap.cfg.path = NULL;
+    g_cap.cfg.mem = NULL;
+    g_cap.cfg.ifname = NULL;
+    if (g_cap.cfg.linktype == 0) g_cap.cfg.linktype = AD_TUN_CAPTURE_LINK_RAW;
+
+    ad_tun_capture_filter_t none;
+    memset(&none, 0, sizeof(none));
+    g_cap.filter_empty = (memcmp(&cfg->filter, &none, sizeof(none)) == 0);
+
+    uint64_t slots = 1;
+    while (slots < cfg->slots) slots <<= 1;
+    g_cap.mask = slots - 1;
+    g_cap.stride = (sizeof(capture_slot_t) + cfg->snaplen + 63) & ~(size_t)63;
+
+    ad_tun_error_t err = ad_tun_mem_alloc(&g_cap.ring_map, (size_t)slots * g_cap.stride, cfg->mem);
+    if (err != AD_TUN_OK) {
+        zlog_error(zc, "ad_tun_capture_start: cannot map the capture ring");
+        pthread_mutex_unlock(&g_cap_lock);
+        return err;
+    }
+    g_cap.ring = g_cap.ring_map.ptr;
+    for (uint64_t i = 0; i < slots; i++) capture_slot(i)->seq = i;
+
+    g_cap.out = fopen(cfg->path, "wb");
+    if (!g_cap.out) {
+        zlog_error(zc, "ad_tun_capture_start: cannot open %s: %s", cfg->path, strerror(errno));
+        goto fail_unmap;
+    }
+    setvbuf(g_cap.out, NULL, _IOFBF, CAPTURE_FILE_BUFFER);
+
+    if (pcapng_write_header(g_cap.out, cfg->ifname) != 0) {
+        zlog_error(zc, "ad_tun_capture_start: cannot write %s", cfg->path);
+        goto fail_close;
+    }
+
+    g_cap.running = 1;
+    if (pthread_create(&g_cap.writer, NULL, capture_writer_thread, NULL) != 0) {
+        zlog_error(zc, "ad_tun_capture_start: cannot start writer thread");
+        goto fail_close;
+    }
+
+    g_cap_started = 1;
+    __atomic_store_n(&ad_tun_capture_active, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_cap_lock);
+
+    zlog_info(zc, "Packet capture started: %s (slots=%llu, snaplen=%u, sample=1/%u)",
+              cfg->path, (unsigned long long)slots, cfg->snaplen, cfg->sample ? cfg->sample : 1);
+    return AD_TUN_OK;
+
+fail_close:
+    fclose(g_cap.out);
+    g_cap.out = NULL;
+fail_unmap:
+    ad_tun_mem_free(&g_cap.ring_map);
+    g_cap.ring = NULL;
+    pthread_mutex_unlock(&g_cap_lock);
+    return AD_TUN_ERR_SYS;
+}
+
+void ad_tun_capture_stop(void)
+{
+    pthread_mutex_lock(&g_cap_lock);
+    if (!g_cap_started) {
+        pthread_mutex_unlock(&g_cap_lock);
+        return;
+    }
+
+    __atomic_store_n(&ad_tun_capture_active, 0, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&g_cap_users, __ATOMIC_SEQ_CST) != 0) sched_yield();
+
+    __atomic_store_n(&g_cap.running, 0, __ATOMIC_RELEASE);
+    pthread_join(g_cap.writer, NULL);
+
+    capture_flush_ring();
+    fclose(g_cap.out);
+    g_cap.out = NULL;
+    ad_tun_mem_free(&g_cap.ring_map);
+    g_cap.ring = NULL;
+    g_cap_started = 0;
+    pthread_mutex_unlock(&g_cap_lock);
+
+    zlog_info(zlog_get_category("ad_tun"),
+              "Packet capture stopped: seen=%llu written=%llu dropped=%llu",
+              (unsigned long long)g_cap.stats.seen, (unsigned long long)g_cap.stats.written,
+              (unsigned long long)g_cap.stats.dropped);
+}
+
+ad_tun_error_t ad_tun_capture_enable(int on)
+{
+    pthread_mutex_lock(&g_cap_lock);
+    if (!g_cap_started) {
+        pthread_mutex_unlock(&g_cap_lock);
+        return AD_TUN_ERR_INVALID_STATE;
+    }
+    __atomic_store_n(&ad_tun_capture_active, on ? 1 : 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_cap_lock);
+
+    zlog_info(zlog_get_category("ad_tun"), "Packet capture %s", on ? "resumed" : "paused");
+    return AD_TUN_OK;
+}
+
+void ad_tun_capture_get_stats(ad_tun_capture_stats_t *stats)
+{
+    if (!stats) return;
+
+    stats->seen = __atomic_load_n(&g_cap.stats.seen, __ATOMIC_RELAXED);
+    stats->filtered = __atomic_load_n(&g_cap.stats.filtered, __ATOMIC_RELAXED);
+    stats->sampled_out = __atomic_load_n(&g_cap.stats.sampled_out, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&g_cap.stats.dropped, __ATOMIC_RELAXED);
+    stats->written = __atomic_load_n(&g_cap.stats.written, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,361 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun AEAD Crypto        **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_crypto.h"
+#include "../include/ad_tun_pkt.h"
+#include "../include/ad_tun_latency.h"
+#include "../include/ad_tun_pool.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <openssl/evp.h>
+
+/* Nonce: 4 zero bytes followed by the 64-bit big-endian counter */
+#define NONCE_LEN 12
+
+#define REPLAY_BITS 64
+#define REPLAY_WINDOW ((AD_TUN_REPLAY_WORDS - 1) * REPLAY_BITS)
+
+/* ---- Replay window ---- */
+
+int ad_tun_replay_check(const ad_tun_replay_t *r, uint64_t counter)
+{
+    if (counter > r->top) return 1;
+    if (r->top - counter >= REPLAY_WINDOW) return 0;
+
+    uint64_t word = r->bitmap[(counter / REPLAY_BITS) % AD_TUN_REPLAY_WORDS];
+    return !(word & (1ULL << (counter % REPLAY_BITS)));
+}
+
+void ad_tun_replay_update(ad_tun_replay_t *r, uint64_t counter)
+{
+    if (counter > r->top) {
+        /* Clear the words the window slides over */
+        uint64_t cur = r->top / REPLAY_BITS;
+        uint64_t diff = counter / REPLAY_BITS - cur;
+        if (diff > AD_TUN_REPLAY_WORDS) diff = AD_TUN_REPLAY_WORDS;
+        for (uint64_t i = 1; i <= diff; i++) {
+            r->bitmap[(cur + i) % AD_TUN_REPLAY_WORDS] = 0;
+        }
+        r->top = counter;
+    }
+
+    r->bitmap[(counter / REPLAY_BITS) % AD_TUN_REPLAY_WORDS] |= 1ULL << (counter % REPLAY_BITS);
+}
+
+/* ---- Peers ---- */
+
+size_t ad_tun_aead_key_len(ad_tun_aead_t alg)
+{
+    switch (alg) {
+    case AD_TUN_AEAD_CHACHA20_POLY1305: return 32;
+    case AD_TUN_AEAD_AES_128_GCM: return 16;
+    case AD_TUN_AEAD_AES_256_GCM: return 32;
+    }
+    return 0;
+}
+
+/* OpenSSL picks the AES-NI/VAES or AVX2/AVX-512 code paths at run time */
+static const EVP_CIPHER *crypto_cipher(ad_tun_aead_t alg)
+{
+    switch (alg) {
+    case AD_TUN_AEAD_CHACHA20_POLY1305: return EVP_chacha20_poly1305();
+    case AD_TUN_AEAD_AES_128_GCM: return EVP_aes_128_gcm();
+    case AD_TUN_AEAD_AES_256_GCM: return EVP_aes_256_gcm();
+    }
+    return NULL;
+}
+
+static void crypto_peer_clear(ad_tun_crypto_peer_t *p)
+{
+    EVP_CIPHER_CTX_free((EVP_CIPHER_CTX *)p->tx_ctx);
+    EVP_CIPHER_CTX_free((EVP_CIPHER_CTX *)p->rx_ctx);
+    p->tx_ctx = p->rx_ctx = NULL;
+    p->in_use = 0;
+    p->tx_counter = 0;
+    memset(&p->replay, 0, sizeof(p->replay));
+}
+
+ad_tun_error_t ad_tun_crypto_init(ad_tun_crypto_t *c, unsigned max_peers)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!c || max_peers == 0) {
+        zlog_error(zc, "ad_tun_crypto_init: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    memset(c, 0, sizeof(*c));
+    c->peers = calloc(max_peers, sizeof(*c->peers));
+    if (!c->peers) {
+        zlog_error(zc, "ad_tun_crypto_init: allocation failed");
+        return AD_TUN_ERR_SYS;
+    }
+
+    for (unsigned i = 0; i < max_peers; i++) {
+        pthread_mutex_init(&c->peers[i].tx_lock, NULL);
+        pthread_mutex_init(&c->peers[i].rx_lock, NULL);
+    }
+    c->max_peers = max_peers;
+
+    zlog_debug(zc, "Crypto stage initialized: max_peers=%u", max_peers);
+    return AD_TUN_OK;
+}
+
+void ad_tun_crypto_free(ad_tun_crypto_t *c)
+{
+    if (!c || !c->peers) return;
+
+    for (unsigned i = 0; i < c->max_peers; i++) {
+        crypto_peer_clear(&c->peers[i]);
+        pthread_mutex_destroy(&c->peers[i].tx_lock);
+        pthread_mutex_destroy(&c->peers[i].rx_lock);
+    }
+
+    free(c->peers);
+    memset(c, 0, sizeof(*c));
+}
+
+static EVP_CIPHER_CTX *crypto_ctx_new(ad_tun_aead_t alg, const uint8_t *key, int enc)
+{
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) return NULL;
+
+    if (EVP_CipherInit_ex(ctx, crypto_cipher(alg), NULL, NULL, NULL, enc) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, NONCE_LEN, NULL) != 1 ||
+        EVP_CipherInit_ex(ctx, NULL, NULL, key, NULL, enc) != 1) {
+        EVP_CIPHER_CTX_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+ad_tun_error_t ad_tun_crypto_set_peer(ad_tun_crypto_t *c, uint32_t local_id, uint32_t remote_id,
+                                      ad_tun_aead_t alg, const uint8_t *tx_key, const uint8_t *rx_key)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!c || !c->peers || local_id >= c->max_peers || !tx_key || !rx_key ||
+        ad_tun_aead_key_len(alg) == 0) {
+        zlog_error(zc, "ad_tun_crypto_set_peer: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    EVP_CIPHER_CTX *tx = crypto_ctx_new(alg, tx_key, 1);
+    EVP_CIPHER_CTX *rx = crypto_ctx_new(alg, rx_key, 0);
+    if (!tx || !rx) {
+        zlog_error(zc, "ad_tun_crypto_set_peer: cipher setup failed for peer %u", local_id);
+        EVP_CIPHER_CTX_free(tx);
+        EVP_CIPHER_CTX_free(rx);
+        return AD_TUN_ERR_SYS;
+    }
+
+    ad_tun_crypto_peer_t *p = &c->peers[local_id];
+    pthread_mutex_lock(&p->tx_lock);
+    pthread_mutex_lock(&p->rx_lock);
+
+    crypto_peer_clear(p);
+    p->alg = alg;
+    p->remote_id = remote_id;
+    p->tx_ctx = tx;
+    p->rx_ctx = rx;
+    p->in_use = 1;
+
+    pthread_mutex_unlock(&p->rx_lock);
+    pthread_mutex_unlock(&p->tx_lock);
+
+    zlog_info(zc, "Crypto peer %u installed (remote id %u, alg %d)", local_id, remote_id, (int)alg);
+    return AD_TUN_OK;
+}
+
+void ad_tun_crypto_del_peer(ad_tun_crypto_t *c, uint32_t local_id)
+{
+    if (!c || !c->peers || local_id >= c->max_peers) return;
+
+    ad_tun_crypto_peer_t *p = &c->peers[local_id];
+    pthread_mutex_lock(&p->tx_lock);
+    pthread_mutex_lock(&p->rx_lock);
+    crypto_peer_clear(p);
+    pthread_mutex_unlock(&p->rx_lock);
+    pthread_mutex_unlock(&p->tx_lock);
+}
+
+/* ---- Data path ---- */
+
+static inline void crypto_nonce(uint8_t nonce[NONCE_LEN], const uint8_t *hdr)
+{
+    memset(nonce, 0, 4);
+    memcpy(nonce + 4, hdr + 4, 8);
+}
+
+/* Encrypt [p, p + len) in place with hdr as AAD and write the tag after it */
+static int crypto_seal(EVP_CIPHER_CTX *ctx, const uint8_t *hdr, uint8_t *p, size_t len)
+{
+    uint8_t nonce[NONCE_LEN];
+    int outl;
+
+    crypto_nonce(nonce, hdr);
+    if (EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, nonce) != 1 ||
+        EVP_EncryptUpdate(ctx, NULL, &outl, hdr, AD_TUN_CRYPTO_HDR_LEN) != 1 ||
+        EVP_EncryptUpdate(ctx, p, &outl, p, (int)len) != 1 ||
+        EVP_EncryptFinal_ex(ctx, p + outl, &outl) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, AD_TUN_CRYPTO_TAG_LEN, p + len) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Verify and decrypt [p, p + len + tag) in place */
+static int crypto_open(EVP_CIPHER_CTX *ctx, const uint8_t *hdr, uint8_t *p, size_t len)
+{
+    uint8_t nonce[NONCE_LEN];
+    int outl;
+
+    crypto_nonce(nonce, hdr);
+    if (EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, nonce) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, AD_TUN_CRYPTO_TAG_LEN, p + len) != 1 ||
+        EVP_DecryptUpdate(ctx, NULL, &outl, hdr, AD_TUN_CRYPTO_HDR_LEN) != 1 ||
+        EVP_DecryptUpdate(ctx, p, &outl, p, (int)len) != 1 ||
+        EVP_DecryptFinal_ex(ctx, p + outl, &outl) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+int ad_tun_crypto_encrypt_batch(ad_tun_crypto_t *c, uint32_t local_id,
+                                ad_tun_buf_t **bufs, unsigned n)
+{
+    if (!c || !c->peers || (n && !bufs)) return -EINVAL;
+    if (local_id >= c->max_peers) return -ENOENT;
+
+    AD_TUN_LAT_START(t_enc);
+
+    /* Check room up front so a batch is not cut short for lack of space */
+    for (unsigned i = 0; i < n; i++) {
+        if (ad_tun_buf_headroom(bufs[i]) < AD_TUN_CRYPTO_HDR_LEN ||
+            ad_tun_buf_tailroom(bufs[i]) < AD_TUN_CRYPTO_TAG_LEN || bufs[i]->len > INT32_MAX) {
+            return -ENOSPC;
+        }
+    }
+
+    ad_tun_crypto_peer_t *p = &c->peers[local_id];
+    pthread_mutex_lock(&p->tx_lock);
+
+    if (!p->in_use) {
+        pthread_mutex_unlock(&p->tx_lock);
+        return -ENOENT;
+    }
+    if (UINT64_MAX - p->tx_counter < n) {
+        pthread_mutex_unlock(&p->tx_lock);
+        zlog_warn(zlog_get_category("ad_tun"), "ad_tun_crypto: send counter of peer %u exhausted",
+                  local_id);
+        return -EOVERFLOW;
+    }
+
+    EVP_CIPHER_CTX *ctx = (EVP_CIPHER_CTX *)p->tx_ctx;
+    int ret = (int)n;
+
+    for (unsigned i = 0; i < n; i++) {
+        ad_tun_buf_t *b = bufs[i];
+        uint8_t *hdr = b->data - AD_TUN_CRYPTO_HDR_LEN;
+        uint64_t ctr = p->tx_counter++;
+
+        ad_tun_put_be32(hdr, p->remote_id);
+        ad_tun_put_be32(hdr + 4, (uint32_t)(ctr >> 32));
+        ad_tun_put_be32(hdr + 8, (uint32_t)ctr);
+
+        if (crypto_seal(ctx, hdr, b->data, b->len) != 0) {
+            zlog_error(zlog_get_category("ad_tun"), "ad_tun_crypto: encryption failed for peer %u",
+                       local_id);
+            /* Packets before i are sealed and stay usable; b is half-written */
+            ret = (i > 0) ? (int)i : -EIO;
+            break;
+        }
+
+        b->data = hdr;
+        b->len += AD_TUN_CRYPTO_OVERHEAD;
+    }
+
+    pthread_mutex_unlock(&p->tx_lock);
+
+    if (ret > 0) __atomic_fetch_add(&c->stats.encrypted, (uint64_t)ret, __ATOMIC_RELAXED);
+    AD_TUN_LAT_END(AD_TUN_LAT_ENCRYPT, t_enc);
+    return ret;
+}
+
+/* Decrypt one packet; called with the peer's rx lock held */
+static int crypto_decrypt_one(ad_tun_crypto_t *c, ad_tun_crypto_peer_t *p, ad_tun_buf_t *b)
+{
+    uint8_t *hdr = b->data;
+    uint64_t ctr = ((uint64_t)ad_tun_get_be32(hdr + 4) << 32) | ad_tun_get_be32(hdr + 8);
+
+    /* Cheap check first so replayed floods do not cost a decryption */
+    if (!ad_tun_replay_check(&p->replay, ctr)) {
+        __atomic_fetch_add(&c->stats.replayed, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    size_t len = b->len - AD_TUN_CRYPTO_OVERHEAD;
+    if (crypto_open((EVP_CIPHER_CTX *)p->rx_ctx, hdr, hdr + AD_TUN_CRYPTO_HDR_LEN, len) != 0) {
+        __atomic_fetch_add(&c->stats.auth_failed, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    ad_tun_replay_update(&p->replay, ctr);
+    b->data += AD_TUN_CRYPTO_HDR_LEN;
+    b->len = len;
+    return 0;
+}
+
+int ad_tun_crypto_decrypt_batch(ad_tun_crypto_t *c, ad_tun_buf_t **bufs, unsigned n)
+{
+    if (!c || !c->peers || (n && !bufs)) return -EINVAL;
+
+    AD_TUN_LAT_START(t_dec);
+
+    ad_tun_crypto_peer_t *locked = NULL;
+    unsigned good = 0;
+
+    for (unsigned i = 0; i < n; i++) {
+        ad_tun_buf_t *b = bufs[i];
+        int ok = 0;
+
+        if (b->len >= AD_TUN_CRYPTO_OVERHEAD && b->len - AD_TUN_CRYPTO_OVERHEAD <= INT32_MAX) {
+            uint32_t id = ad_tun_get_be32(b->data);
+            ad_tun_crypto_peer_t *p = (id < c->max_peers) ? &c->peers[id] : NULL;
+
+            /* Batches usually come from one peer: keep its lock across packets */
+            if (p != locked) {
+                if (locked) pthread_mutex_unlock(&locked->rx_lock);
+                if (p) pthread_mutex_lock(&p->rx_lock);
+                locked = p;
+            }
+
+            if (!p || !p->in_use) {
+                __atomic_fetch_add(&c->stats.unknown_peer, 1, __ATOMIC_RELAXED);
+            } else {
+                ok = (crypto_decrypt_one(c, p, b) == 0);
+            }
+        } else {
+            __atomic_fetch_add(&c->stats.auth_failed, 1, __ATOMIC_RELAXED);
+        }
+
+        /* Rejected packets collect in [good, i]; a valid one swaps with the first of them */
+        if (ok) {
+            bufs[i] = bufs[good];
+            bufs[good++] = b;
+        }
+    }
+
+    if (locked) pthread_mutex_unlock(&locked->rx_lock);
+
+    __atomic_fetch_add(&c->stats.decrypted, (uint64_t)good, __ATOMIC_RELAXED);
+    AD_TUN_LAT_END(AD_TUN_LAT_DECRYPT, t_dec);
+    return (int)good;
+}
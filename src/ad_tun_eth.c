@@ -0,0 +1,290 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Ethernet           **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_eth.h"
+#include "../include/ad_tun_pkt.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* Defaults for ad_tun_mac_config_t */
+#define DEFAULT_MAC_MAX_ENTRIES 4096
+#define DEFAULT_MAC_AGE_MS 300000
+
+#define MAC_MAX_TAGS 2
+
+int ad_tun_eth_parse_mac(const char *s, uint8_t mac[AD_TUN_ETH_ALEN])
+{
+    if (!s || !mac) return -EINVAL;
+
+    for (int i = 0; i < AD_TUN_ETH_ALEN; i++) {
+        int v = 0;
+        for (int d = 0; d < 2; d++, s++) {
+            int c = *s;
+            if (c >= '0' && c <= '9') v = v * 16 + (c - '0');
+            else if (c >= 'a' && c <= 'f') v = v * 16 + (c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F') v = v * 16 + (c - 'A' + 10);
+            else return -EINVAL;
+        }
+        mac[i] = (uint8_t)v;
+        if (i < AD_TUN_ETH_ALEN - 1) {
+            if (*s != ':' && *s != '-') return -EINVAL;
+            s++;
+        }
+    }
+    if (*s != '\0') return -EINVAL;
+
+    static const uint8_t zero[AD_TUN_ETH_ALEN];
+    if ((mac[0] & 1) || memcmp(mac, zero, sizeof(zero)) == 0) return -EINVAL;
+    return 0;
+}
+
+int ad_tun_eth_l3_offset(const unsigned char *frame, size_t len, uint16_t *proto, uint16_t *vlan)
+{
+    if (!frame || len < AD_TUN_ETH_HLEN) return -EINVAL;
+
+    size_t off = 12;
+    uint16_t type = ad_tun_get_be16(frame + off);
+    uint16_t vid = 0;
+
+    for (int tags = 0; tags < MAC_MAX_TAGS &&
+         (type == AD_TUN_ETH_P_8021Q || type == AD_TUN_ETH_P_8021AD); tags++) {
+        if (off + 6 > len) return -EINVAL;
+        if (tags == 0) vid = ad_tun_get_be16(frame + off + 2) & 0x0fff;
+        off += 4;
+        type = ad_tun_get_be16(frame + off);
+    }
+
+    if (proto) *proto = type;
+    if (vlan) *vlan = vid;
+    return (int)(off + 2);
+}
+
+int ad_tun_eth_ip_offset(const unsigned char *frame, size_t len)
+{
+    uint16_t proto;
+    int off = ad_tun_eth_l3_offset(frame, len, &proto, NULL);
+    if (off < 0 || (proto != AD_TUN_ETH_P_IP && proto != AD_TUN_ETH_P_IPV6)) return -EINVAL;
+    return off;
+}
+
+/* ---- MAC learning ---- */
+
+static uint64_t mac_key(const uint8_t *mac, uint16_t vlan)
+{
+    uint64_t k = 0;
+    for (int i = 0; i < AD_TUN_ETH_ALEN; i++) k = (k << 8) | mac[i];
+    return (k << 16) | vlan;
+}
+
+static unsigned mac_home(const ad_tun_mac_table_t *tbl, uint64_t key)
+{
+    return (unsigned)((key * 0x9E3779B97F4A7C15ull) >> 32) & tbl->mask;
+}
+
+/* Slot holding key, or the empty slot ending its probe sequence */
+static unsigned mac_probe(const ad_tun_mac_table_t *tbl, uint64_t key)
+{
+    unsigned i = mac_home(tbl, key);
+    while (tbl->slots[i].key != 0 && tbl->slots[i].key != key) i = (i + 1) & tbl->mask;
+    return i;
+}
+
+/* Delete slot i, shifting back entries of the same probe run */
+static void mac_delete(ad_tun_mac_table_t *tbl, unsigned i)
+{
+    unsigned j = i;
+    for (;;) {
+        j = (j + 1) & tbl->mask;
+        if (tbl->slots[j].key == 0) break;
+        unsigned k = mac_home(tbl, tbl->slots[j].key);
+        /* Move j into the hole unless its home lies cyclically in (i, j] */
+        if ((j > i) ? (k <= i || k > j) : (k <= i && k > j)) {
+            tbl->slots[i] = tbl->slots[j];
+            i = j;
+        }
+    }
+    tbl->slots[i].key = 0;
+    tbl->count--;
+}
+
+/* A clock behind seen_ms (another thread's now_ms) never expires the entry */
+static int mac_expired(const ad_tun_mac_table_t *tbl, const ad_tun_mac_entry_t *e, uint64_t now_ms)
+{
+    return now_ms > e->seen_ms && now_ms - e->seen_ms > tbl->cfg.age_ms;
+}
+
+ad_tun_error_t ad_tun_mac_init(ad_tun_mac_table_t *tbl, const ad_tun_mac_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!tbl) {
+        zlog_error(zc, "ad_tun_mac_init: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    memset(tbl, 0, sizeof(*tbl));
+    if (cfg) {
+        tbl->cfg = *cfg;
+    } else {
+        tbl->cfg.max_entries = DEFAULT_MAC_MAX_ENTRIES;
+        tbl->cfg.age_ms = DEFAULT_MAC_AGE_MS;
+    }
+
+    if (tbl->cfg.max_entries == 0 || tbl->cfg.max_entries > (1u << 24) || tbl->cfg.age_ms == 0) {
+        zlog_error(zc, "ad_tun_mac_init: max_entries must be in 1..2^24 and age_ms > 0");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    /* At most half full keeps probe runs short */
+    unsigned cap = 2;
+    while (cap < tbl->cfg.max_entries * 2) cap <<= 1;
+    tbl->slots = calloc(cap, sizeof(*tbl->slots));
+    if (!tbl->slots) {
+        zlog_error(zc, "ad_tun_mac_init: table allocation failed");
+        return AD_TUN_ERR_SYS;
+    }
+    tbl->mask = cap - 1;
+
+    zlog_debug(zc, "MAC table initialized: max_entries=%u, age_ms=%u",
+               tbl->cfg.max_entries, tbl->cfg.age_ms);
+    return AD_TUN_OK;
+}
+
+void ad_tun_mac_free(ad_tun_mac_table_t *tbl)
+{
+    if (!tbl) return;
+
+    free(tbl->slots);
+    memset(tbl, 0, sizeof(*tbl));
+}
+
+int ad_tun_mac_learn(ad_tun_mac_table_t *tbl, const uint8_t *mac, uint16_t vlan, int port, uint64_t now_ms)
+{
+    if (!tbl || !tbl->slots || !mac || port < 0) return -EINVAL;
+
+    uint64_t key = mac_key(mac, vlan);
+    if ((mac[0] & 1) || (key >> 16) == 0) return -EINVAL;
+
+    unsigned i = mac_probe(tbl, key);
+    ad_tun_mac_entry_t *e = &tbl->slots[i];
+
+    if (e->key == key) {
+        int moved = (e->port != port);
+        if (moved) {
+            e->port = port;
+            tbl->stats.moved++;
+        }
+        e->seen_ms = now_ms;
+        return moved;
+    }
+
+    if (tbl->count >= tbl->cfg.max_entries) {
+        /* Make room from expired addresses before giving up */
+        if (ad_tun_mac_expire(tbl, now_ms) == 0) {
+            tbl->stats.full++;
+            return -ENOSPC;
+        }
+        i = mac_probe(tbl, key);
+        e = &tbl->slots[i];
+    }
+
+    e->key = key;
+    e->seen_ms = now_ms;
+    e->port = port;
+    tbl->count++;
+    tbl->stats.learned++;
+    return 0;
+}
+
+int ad_tun_mac_lookup(ad_tun_mac_table_t *tbl, const uint8_t *mac, uint16_t vlan, uint64_t now_ms)
+{
+    if (!tbl || !tbl->slots || !mac) return -1;
+
+    /* Never learned, and an all-zero key would match an empty slot */
+    uint64_t key = mac_key(mac, vlan);
+    if ((mac[0] & 1) || (key >> 16) == 0) return -1;
+
+    unsigned i = mac_probe(tbl, key);
+    if (tbl->slots[i].key != key) return -1;
+
+    if (mac_expired(tbl, &tbl->slots[i], now_ms)) {
+        mac_delete(tbl, i);
+        tbl->stats.aged++;
+        return -1;
+    }
+    return tbl->slots[i].port;
+}
+
+int ad_tun_mac_forward(ad_tun_mac_table_t *tbl, const unsigned char *frame, size_t len,
+                       int in_port, uint64_t now_ms)
+{
+    uint16_t vlan;
+    if (!tbl || ad_tun_eth_l3_offset(frame, len, NULL, &vlan) < 0) {
+        if (tbl) tbl->stats.drops++;
+        return AD_TUN_MAC_DROP;
+    }
+
+    const uint8_t *dst = frame;
+    const uint8_t *src = frame + AD_TUN_ETH_ALEN;
+
+    /* A multicast source is invalid and never learned; the frame is still forwarded */
+    ad_tun_mac_learn(tbl, src, vlan, in_port, now_ms);
+
+    if (dst[0] & 1) {
+        tbl->stats.floods++;
+        return AD_TUN_MAC_FLOOD;
+    }
+
+    int port = ad_tun_mac_lookup(tbl, dst, vlan, now_ms);
+    if (port < 0) {
+        tbl->stats.floods++;
+        return AD_TUN_MAC_FLOOD;
+    }
+    if (port == in_port) {
+        tbl->stats.drops++;
+        return AD_TUN_MAC_DROP;
+    }
+    tbl->stats.hits++;
+    return port;
+}
+
+unsigned ad_tun_mac_flush_port(ad_tun_mac_table_t *tbl, int port)
+{
+    if (!tbl || !tbl->slots) return 0;
+
+    unsigned removed = 0;
+    for (unsigned i = 0; i <= tbl->mask; ) {
+        /* A deletion may shift another entry into i, so look at it again */
+        if (tbl->slots[i].key != 0 && tbl->slots[i].port == port) {
+            mac_delete(tbl, i);
+            removed++;
+        } else {
+            i++;
+        }
+    }
+    return removed;
+}
+
+unsigned ad_tun_mac_expire(ad_tun_mac_table_t *tbl, uint64_t now_ms)
+{
+    if (!tbl || !tbl->slots) return 0;
+
+    unsigned removed = 0;
+    for (unsigned i = 0; i <= tbl->mask; ) {
+        if (tbl->slots[i].key != 0 && mac_expired(tbl, &tbl->slots[i], now_ms)) {
+            mac_delete(tbl, i);
+            removed++;
+        } else {
+            i++;
+        }
+    }
+    tbl->stats.aged += removed;
+    return removed;
+}
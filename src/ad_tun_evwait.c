@@ -0,0 +1,65 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Eventfd Waits      **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_evwait.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+int ad_tun_evwait_arm(uint32_t *waiting, ad_tun_evwait_ready_fn ready, const void *obj)
+{
+    __atomic_fetch_add(waiting, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return ready(obj);
+}
+
+int ad_tun_evwait(uint32_t *waiting, int fd, ad_tun_evwait_ready_fn ready, const void *obj,
+                  int timeout_ms)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int rc = ad_tun_evwait_arm(waiting, ready, obj);
+    while (rc == 0) {
+        int left = timeout_ms;
+        if (timeout_ms > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long spent = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+            left = spent >= timeout_ms ? 0 : timeout_ms - (int)spent;
+        }
+
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int r = poll(&pfd, 1, left);
+        if (r < 0 && errno != EINTR) {
+            rc = -errno;
+            break;
+        }
+
+        /* The token may be left over from an earlier wake; check the object itself */
+        uint64_t v;
+        if (r > 0 && read(fd, &v, sizeof(v)) < 0 && errno != EAGAIN) {
+            rc = -errno;
+            break;
+        }
+        rc = ready(obj);
+        if (r == 0) break;
+    }
+    __atomic_fetch_sub(waiting, 1, __ATOMIC_RELAXED);
+    return rc;
+}
+
+int ad_tun_evwait_wake(uint32_t *waiting, int fd)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED) == 0) return 0;
+
+    uint64_t one = 1;
+    return write(fd, &one, sizeof(one)) == sizeof(one);
+}
@@ -0,0 +1,575 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Fragmentation      **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_frag.h"
+#include "../include/ad_tun_pkt.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+
+/* IPv6 extension header type values */
+#define NH_HOPOPTS  0
+#define NH_ROUTING  43
+#define NH_FRAGMENT 44
+#define NH_DSTOPTS  60
+
+/* Largest IP datagram payload that can be described by a fragment offset */
+#define MAX_DATAGRAM 65535
+
+/* IPv6 fragment identification counter, seeded on first use */
+static atomic_uint g_frag_ident;
+static atomic_int g_frag_ident_seeded;
+
+/* ---- Fragmentation ---- */
+
+/* Build the header of a non-first IPv4 fragment: only options with the copy bit survive */
+static size_t frag_ipv4_tail_header(const unsigned char *iph, size_t ihl, unsigned char *out)
+{
+    size_t n = 20;
+    memcpy(out, iph, 20);
+
+    size_t i = 20;
+    while (i < ihl) {
+        unsigned char type = iph[i];
+        if (type == 0) break;          /* end of option list */
+        if (type == 1) {               /* no-op */
+            i++;
+            continue;
+        }
+        if (i + 1 >= ihl) break;
+        size_t olen = iph[i + 1];
+        if (olen < 2 || i + olen > ihl) break;
+        if (type & 0x80) {
+            memcpy(out + n, iph + i, olen);
+            n += olen;
+        }
+        i += olen;
+    }
+
+    /* Pad to a 4-byte boundary with end-of-list */
+    while (n & 3) out[n++] = 0;
+
+    out[0] = (unsigned char)(0x40 | (n / 4));
+    return n;
+}
+
+static int frag_ipv4(ad_tun_pool_t *pool, const unsigned char *pkt, size_t len,
+                     const ad_tun_pkt_info_t *info, size_t mtu,
+                     ad_tun_buf_t **out, unsigned max_out)
+{
+    if (info->dont_frag) return -EMSGSIZE;
+
+    size_t ihl = info->l3_len;
+    size_t end = (info->tot_len < len) ? info->tot_len : len;
+    size_t payload = end - ihl;
+
+    unsigned char tail_hdr[60];
+    size_t tail_ihl = frag_ipv4_tail_header(pkt, ihl, tail_hdr);
+
+    size_t first_max = (mtu - ihl) & ~(size_t)7;
+    size_t tail_max = (mtu - tail_ihl) & ~(size_t)7;
+    if (mtu <= ihl || first_max == 0 || tail_max == 0) return -EMSGSIZE;
+
+    unsigned nfrags = 1;
+    if (payload > first_max) {
+        nfrags += (unsigned)((payload - first_max + tail_max - 1) / tail_max);
+    }
+    if (nfrags > max_out) return -EMSGSIZE;
+
+    unsigned got = ad_tun_pool_get_bulk(pool, out, nfrags);
+    if (got != nfrags) {
+        ad_tun_pool_put_bulk(pool, out, got);
+        return -ENOBUFS;
+    }
+
+    size_t pos = 0;
+    for (unsigned i = 0; i < nfrags; i++) {
+        const unsigned char *hdr = (i == 0) ? pkt : tail_hdr;
+        size_t hlen = (i == 0) ? ihl : tail_ihl;
+        size_t chunk = (i == 0) ? first_max : tail_max;
+        if (chunk > payload - pos) chunk = payload - pos;
+
+        unsigned char *d = out[i]->data;
+        memcpy(d, hdr, hlen);
+        memcpy(d + hlen, pkt + ihl + pos, chunk);
+
+        int last = (pos + chunk == payload);
+        uint16_t foff = (uint16_t)((info->frag_off + pos) >> 3);
+        /* The last piece keeps the MF flag of the original (it may itself be a fragment) */
+        uint16_t mf = (!last || info->more_frags) ? 0x2000 : 0;
+
+        ad_tun_put_be16(d + 2, (uint16_t)(hlen + chunk));
+        ad_tun_put_be16(d + 6, (uint16_t)(mf | foff));
+        ad_tun_ipv4_set_csum(d);
+
+        out[i]->len = hlen + chunk;
+        pos += chunk;
+    }
+
+    return (int)nfrags;
+}
+
+/* Length of the IPv6 unfragmentable part and offset of its last next-header byte */
+static int frag_ipv6_unfrag_len(const unsigned char *pkt, size_t len,
+                                size_t *unfrag_len, size_t *nh_off)
+{
+    size_t off = 40;
+    size_t last_nh = 6;
+    uint8_t nh = pkt[6];
+
+    for (;;) {
+        if (nh == NH_FRAGMENT) return -EINVAL;
+
+        int unfrag = (nh == NH_HOPOPTS || nh == NH_ROUTING);
+        /* Destination options belong to the unfragmentable part only before a routing header */
+        if (nh == NH_DSTOPTS && off + 8 <= len && pkt[off] == NH_ROUTING) unfrag = 1;
+        if (!unfrag) break;
+
+        if (off + 8 > len) return -EINVAL;
+        last_nh = off;
+        nh = pkt[off];
+        off += ((size_t)pkt[off + 1] + 1) * 8;
+        if (off > len) return -EINVAL;
+    }
+
+    *unfrag_len = off;
+    *nh_off = last_nh;
+    return 0;
+}
+
+static uint32_t frag_next_ident(void)
+{
+    if (!atomic_load_explicit(&g_frag_ident_seeded, memory_order_acquire)) {
+        unsigned int seed;
+        if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) != (ssize_t)sizeof(seed)) {
+            seed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+        }
+        unsigned int expected = 0;
+        atomic_compare_exchange_strong(&g_frag_ident, &expected, seed);
+        atomic_store_explicit(&g_frag_ident_seeded, 1, memory_order_release);
+    }
+    return atomic_fetch_add_explicit(&g_frag_ident, 1, memory_order_relaxed);
+}
+
+static int frag_ipv6(ad_tun_pool_t *pool, const unsigned char *pkt, size_t len,
+                     const ad_tun_pkt_info_t *info, size_t mtu,
+                     ad_tun_buf_t **out, unsigned max_out)
+{
+    size_t unfrag_len, nh_off;
+    if (frag_ipv6_unfrag_len(pkt, len, &unfrag_len, &nh_off) != 0) return -EINVAL;
+
+    size_t end = (info->tot_len < len) ? info->tot_len : len;
+    size_t payload = end - unfrag_len;
+    size_t hlen = unfrag_len + 8;
+
+    if (mtu <= hlen) return -EMSGSIZE;
+    size_t chunk_max = (mtu - hlen) & ~(size_t)7;
+    if (chunk_max == 0) return -EMSGSIZE;
+
+    unsigned nfrags = (unsigned)((payload + chunk_max - 1) / chunk_max);
+    if (nfrags == 0) nfrags = 1;
+    if (nfrags > max_out) return -EMSGSIZE;
+
+    unsigned got = ad_tun_pool_get_bulk(pool, out, nfrags);
+    if (got != nfrags) {
+        ad_tun_pool_put_bulk(pool, out, got);
+        return -ENOBUFS;
+    }
+
+    uint32_t ident = frag_next_ident();
+    uint8_t orig_nh = pkt[nh_off];
+
+    size_t pos = 0;
+    for (unsigned i = 0; i < nfrags; i++) {
+        size_t chunk = chunk_max;
+        if (chunk > payload - pos) chunk = payload - pos;
+
+        unsigned char *d = out[i]->data;
+        memcpy(d, pkt, unfrag_len);
+        d[nh_off] = NH_FRAGMENT;
+        ad_tun_put_be16(d + 4, (uint16_t)(hlen + chunk - 40));
+
+        unsigned char *fh = d + unfrag_len;
+        fh[0] = orig_nh;
+        fh[1] = 0;
+        ad_tun_put_be16(fh + 2, (uint16_t)(pos | (pos + chunk < payload ? 1 : 0)));
+        ad_tun_put_be32(fh + 4, ident);
+
+        memcpy(d + hlen, pkt + unfrag_len + pos, chunk);
+
+        out[i]->len = hlen + chunk;
+        pos += chunk;
+    }
+
+    return (int)nfrags;
+}
+
+/* Fragment a datagram into pool buffers */
+int ad_tun_frag_fragment(ad_tun_pool_t *pool, const unsigned char *pkt, size_t len,
+                         size_t mtu, ad_tun_buf_t **out, unsigned max_out)
+{
+    if (!pool || !pkt || !out || max_out == 0) return -EINVAL;
+
+    ad_tun_pkt_info_t info;
+    if (ad_tun_pkt_parse(pkt, len, &info) != 0) return -EINVAL;
+
+    /* Fragments must fit in a pool buffer */
+    if (mtu > pool->buf_size) mtu = pool->buf_size;
+
+    if (info.family == AF_INET) {
+        return frag_ipv4(pool, pkt, len, &info, mtu, out, max_out);
+    }
+    if (info.is_frag) return -EINVAL;
+    return frag_ipv6(pool, pkt, len, &info, mtu, out, max_out);
+}
+
+/* ---- Reassembly ---- */
+
+static uint32_t reasm_hash(const ad_tun_reasm_t *r, uint8_t family, uint8_t proto,
+                           const uint8_t *src, const uint8_t *dst, uint32_t id)
+{
+    /* FNV-1a over the key, keyed with a random seed to resist bucket flooding */
+    uint32_t h = 2166136261u ^ r->seed;
+    size_t alen = (family == AF_INET) ? 4 : 16;
+
+    for (size_t i = 0; i < alen; i++) h = (h ^ src[i]) * 16777619u;
+    for (size_t i = 0; i < alen; i++) h = (h ^ dst[i]) * 16777619u;
+    for (int i = 0; i < 4; i++) h = (h ^ ((id >> (8 * i)) & 0xff)) * 16777619u;
+    h = (h ^ proto) * 16777619u;
+    h = (h ^ family) * 16777619u;
+
+    return h & (r->nbuckets - 1);
+}
+
+static void reasm_age_unlink(ad_tun_reasm_t *r, int32_t idx)
+{
+    ad_tun_reasm_entry_t *e = &r->entries[idx];
+
+    if (e->prev >= 0) r->entries[e->prev].next = e->next;
+    else r->age_head = e->next;
+    if (e->next >= 0) r->entries[e->next].prev = e->prev;
+    else r->age_tail = e->prev;
+
+    e->prev = e->next = -1;
+}
+
+/* Remove an entry from all lists and return its buffers to the pool */
+static void reasm_release(ad_tun_reasm_t *r, int32_t idx)
+{
+    ad_tun_reasm_entry_t *e = &r->entries[idx];
+    uint32_t b = reasm_hash(r, e->family, e->proto, e->src, e->dst, e->id);
+
+    int32_t *link = &r->buckets[b];
+    while (*link >= 0 && *link != idx) link = &r->entries[*link].hnext;
+    if (*link == idx) *link = e->hnext;
+
+    reasm_age_unlink(r, idx);
+
+    for (uint16_t i = 0; i < e->nfrags; i++) {
+        ad_tun_pool_put(r->pool, e->frags[i].buf);
+    }
+
+    e->in_use = 0;
+    e->nfrags = 0;
+    e->hnext = r->free_head;
+    r->free_head = idx;
+    r->active--;
+}
+
+/* Evict the oldest partial datagram; returns 0 if the cache was empty */
+static int reasm_evict_oldest(ad_tun_reasm_t *r)
+{
+    if (r->age_head < 0) return 0;
+    reasm_release(r, r->age_head);
+    r->stats.evictions++;
+    return 1;
+}
+
+ad_tun_error_t ad_tun_reasm_init(ad_tun_reasm_t *r, ad_tun_pool_t *pool,
+                                 unsigned max_datagrams, unsigned timeout_ms)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!r || !pool || max_datagrams == 0 || timeout_ms == 0) {
+        zlog_error(zc, "ad_tun_reasm_init: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    memset(r, 0, sizeof(*r));
+
+    unsigned nb = 1;
+    while (nb < max_datagrams * 2) nb <<= 1;
+
+    r->entries = calloc(max_datagrams, sizeof(*r->entries));
+    r->buckets = malloc(nb * sizeof(*r->buckets));
+    if (!r->entries || !r->buckets) {
+        zlog_error(zc, "ad_tun_reasm_init: allocation failed");
+        free(r->entries);
+        free(r->buckets);
+        memset(r, 0, sizeof(*r));
+        return AD_TUN_ERR_SYS;
+    }
+
+    for (unsigned i = 0; i < nb; i++) r->buckets[i] = -1;
+    for (unsigned i = 0; i < max_datagrams; i++) {
+        r->entries[i].hnext = (i + 1 < max_datagrams) ? (int32_t)(i + 1) : -1;
+        r->entries[i].prev = r->entries[i].next = -1;
+    }
+
+    if (getrandom(&r->seed, sizeof(r->seed), GRND_NONBLOCK) != (ssize_t)sizeof(r->seed)) {
+        r->seed = (uint32_t)time(NULL) ^ (uint32_t)getpid();
+    }
+
+    r->nbuckets = nb;
+    r->max_datagrams = max_datagrams;
+    r->timeout_ms = timeout_ms;
+    r->free_head = 0;
+    r->age_head = r->age_tail = -1;
+    r->pool = pool;
+
+    zlog_debug(zc, "Reassembly cache initialized: max_datagrams=%u, timeout_ms=%u",
+               max_datagrams, timeout_ms);
+
+    return AD_TUN_OK;
+}
+
+void ad_tun_reasm_free(ad_tun_reasm_t *r)
+{
+    if (!r || !r->entries) return;
+
+    while (r->age_head >= 0) reasm_release(r, r->age_head);
+
+    free(r->entries);
+    free(r->buckets);
+    memset(r, 0, sizeof(*r));
+}
+
+unsigned ad_tun_reasm_expire(ad_tun_reasm_t *r, uint64_t now_ms)
+{
+    unsigned n = 0;
+
+    /* Entries share one timeout, so the age list is also expiry order */
+    while (r->age_head >= 0 && r->entries[r->age_head].expires_ms <= now_ms) {
+        reasm_release(r, r->age_head);
+        r->stats.timeouts++;
+        n++;
+    }
+    return n;
+}
+
+uint64_t ad_tun_reasm_next_expiry(const ad_tun_reasm_t *r)
+{
+    return (r->age_head >= 0) ? r->entries[r->age_head].expires_ms : 0;
+}
+
+/* Find or create the entry for a fragment key */
+static int32_t reasm_lookup(ad_tun_reasm_t *r, const ad_tun_pkt_info_t *info,
+                            uint8_t proto, uint64_t now_ms)
+{
+    uint32_t b = reasm_hash(r, (uint8_t)info->family, proto, info->src, info->dst, info->frag_id);
+    size_t alen = (info->family == AF_INET) ? 4 : 16;
+
+    for (int32_t i = r->buckets[b]; i >= 0; i = r->entries[i].hnext) {
+        ad_tun_reasm_entry_t *e = &r->entries[i];
+        if (e->id == info->frag_id && e->family == info->family && e->proto == proto &&
+            memcmp(e->src, info->src, alen) == 0 && memcmp(e->dst, info->dst, alen) == 0) {
+            return i;
+        }
+    }
+
+    if (r->free_head < 0 && !reasm_evict_oldest(r)) return -1;
+
+    int32_t idx = r->free_head;
+    ad_tun_reasm_entry_t *e = &r->entries[idx];
+    r->free_head = e->hnext;
+
+    memset(e, 0, sizeof(*e));
+    e->family = (uint8_t)info->family;
+    e->proto = proto;
+    e->id = info->frag_id;
+    memcpy(e->src, info->src, alen);
+    memcpy(e->dst, info->dst, alen);
+    e->expires_ms = now_ms + r->timeout_ms;
+    e->in_use = 1;
+
+    e->hnext = r->buckets[b];
+    r->buckets[b] = idx;
+
+    e->next = -1;
+    e->prev = r->age_tail;
+    if (r->age_tail >= 0) r->entries[r->age_tail].next = idx;
+    else r->age_head = idx;
+    r->age_tail = idx;
+
+    r->active++;
+    return idx;
+}
+
+/* Build the reassembled datagram into out */
+static ssize_t reasm_complete(ad_tun_reasm_t *r, int32_t idx, unsigned char *out, size_t out_cap)
+{
+    ad_tun_reasm_entry_t *e = &r->entries[idx];
+    size_t total = (size_t)e->hdr_len + e->total;
+
+    /* The length field cannot describe it: IPv4 total length, IPv6 payload length */
+    size_t len_field = (e->family == AF_INET) ? total : total - 40;
+    if (len_field > MAX_DATAGRAM) {
+        reasm_release(r, idx);
+        r->stats.invalid++;
+        return -EINVAL;
+    }
+
+    if (total > out_cap) {
+        reasm_release(r, idx);
+        return -EMSGSIZE;
+    }
+
+    /* The header comes from the first fragment, in front of its payload */
+    const unsigned char *first = e->frags[0].buf->data - e->pay_off;
+    memcpy(out, first, e->hdr_len);
+
+    size_t pos = e->hdr_len;
+    for (uint16_t i = 0; i < e->nfrags; i++) {
+        memcpy(out + pos, e->frags[i].buf->data, e->frags[i].len);
+        pos += e->frags[i].len;
+    }
+
+    if (e->family == AF_INET) {
+        ad_tun_put_be16(out + 2, (uint16_t)total);
+        /* Keep DF and the reserved bit, clear MF and the offset */
+        ad_tun_put_be16(out + 6, ad_tun_get_be16(out + 6) & 0xc000);
+        ad_tun_ipv4_set_csum(out);
+    } else {
+        out[e->nh_off] = e->nh_val;
+        ad_tun_put_be16(out + 4, (uint16_t)(total - 40));
+    }
+
+    r->stats.reassembled++;
+    reasm_release(r, idx);
+    return (ssize_t)total;
+}
+
+ssize_t ad_tun_reasm_input(ad_tun_reasm_t *r, const unsigned char *pkt, size_t len,
+                           uint64_t now_ms, unsigned char *out, size_t out_cap)
+{
+    ad_tun_pkt_info_t info;
+    if (ad_tun_pkt_parse(pkt, len, &info) != 0 || !info.is_frag) return -EINVAL;
+
+    ad_tun_reasm_expire(r, now_ms);
+
+    /* Offset of the fragment payload inside this packet */
+    size_t pay_off = (info.family == AF_INET) ? info.l3_len : (size_t)info.frag_hdr_off + 8;
+    size_t end = (info.tot_len < len) ? info.tot_len : len;
+    if (pay_off > end) {
+        r->stats.invalid++;
+        return -EINVAL;
+    }
+
+    size_t flen = end - pay_off;
+    size_t fend = (size_t)info.frag_off + flen;
+
+    /* Non-last fragments must carry a multiple of 8 bytes */
+    if ((info.more_frags && (flen == 0 || (flen & 7))) || fend > MAX_DATAGRAM ||
+        end > r->pool->buf_size) {
+        r->stats.invalid++;
+        return -EINVAL;
+    }
+
+    /* IPv6 keys on (src, dst, id); IPv4 also on protocol */
+    uint8_t key_proto = (info.family == AF_INET) ? info.proto : 0;
+    int32_t idx = reasm_lookup(r, &info, key_proto, now_ms);
+    if (idx < 0) return -ENOBUFS;
+
+    ad_tun_reasm_entry_t *e = &r->entries[idx];
+
+    /* Find the insertion point and reject overlaps (RFC 5722) */
+    uint16_t pos = 0;
+    while (pos < e->nfrags && e->frags[pos].off < info.frag_off) pos++;
+
+    if (pos < e->nfrags && e->frags[pos].off == info.frag_off && e->frags[pos].len == flen) {
+        r->stats.duplicates++;
+        return 0;
+    }
+
+    int overlap = 0;
+    if (pos > 0) {
+        const ad_tun_reasm_frag_t *p = &e->frags[pos - 1];
+        if ((size_t)p->off + p->len > info.frag_off) overlap = 1;
+    }
+    if (pos < e->nfrags && fend > e->frags[pos].off) overlap = 1;
+
+    if (!info.more_frags) {
+        if ((e->total && e->total != fend) ||
+            (e->nfrags && (size_t)e->frags[e->nfrags - 1].off + e->frags[e->nfrags - 1].len > fend)) {
+            overlap = 1;
+        }
+    } else if (e->total && fend > e->total) {
+        overlap = 1;
+    }
+
+    if (overlap || e->nfrags == AD_TUN_REASM_MAX_FRAGS) {
+        reasm_release(r, idx);
+        r->stats.invalid++;
+        return -EINVAL;
+    }
+
+    ad_tun_buf_t *buf = ad_tun_pool_get(r->pool);
+    while (!buf) {
+        /* Evict other datagrams before giving up on this one */
+        if (r->age_head == idx && e->next < 0) break;
+        if (r->age_head == idx) {
+            reasm_release(r, e->next);
+            r->stats.evictions++;
+        } else {
+            reasm_evict_oldest(r);
+        }
+        buf = ad_tun_pool_get(r->pool);
+    }
+    if (!buf) {
+        if (e->nfrags == 0) reasm_release(r, idx);
+        return -ENOBUFS;
+    }
+
+    memcpy(buf->data, pkt, end);
+    buf->data += pay_off;
+    buf->len = flen;
+
+    memmove(&e->frags[pos + 1], &e->frags[pos], (e->nfrags - pos) * sizeof(e->frags[0]));
+    e->frags[pos].buf = buf;
+    e->frags[pos].off = info.frag_off;
+    e->frags[pos].len = (uint16_t)flen;
+    e->nfrags++;
+    e->received += (uint32_t)flen;
+
+    if (!info.more_frags) e->total = (uint32_t)fend;
+
+    if (info.frag_off == 0) {
+        e->have_first = 1;
+        e->pay_off = (uint16_t)pay_off;
+        if (info.family == AF_INET) {
+            e->hdr_len = (uint16_t)pay_off;
+        } else {
+            e->hdr_len = info.frag_hdr_off;
+            e->nh_off = info.nh_off;
+            e->nh_val = pkt[info.frag_hdr_off];
+        }
+    }
+
+    if (e->have_first && e->total && e->received == e->total) {
+        return reasm_complete(r, idx, out, out_cap);
+    }
+
+    return 0;
+}
@@ -0,0 +1,419 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Software GRO       **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_gro.h"
+#include "../include/ad_tun_pkt.h"
+#include "../include/ad_tun_eth.h"
+#include "../include/ad_tun_latency.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/* Defaults for ad_tun_gro_config_t */
+#define DEFAULT_GRO_MAX_FLOWS 16
+#define DEFAULT_GRO_MAX_SEGS 64
+#define DEFAULT_GRO_FLUSH_TIMEOUT_US 0
+#define DEFAULT_GRO_HEADROOM 0
+
+/* Largest IP datagram a super-packet may grow to */
+#define GRO_MAX_SIZE 65535
+
+/* Ethernet header with two VLAN tags in front of it in Ethernet mode */
+#define GRO_MAX_L2 22
+
+/* TCP flag bits */
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+#define TCP_PSH 0x08
+#define TCP_ACK 0x10
+#define TCP_URG 0x20
+#define TCP_ECE 0x40
+#define TCP_CWR 0x80
+
+ad_tun_error_t ad_tun_gro_init(ad_tun_gro_t *gro, const ad_tun_gro_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!gro) {
+        zlog_error(zc, "ad_tun_gro_init: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    memset(gro, 0, sizeof(*gro));
+
+    if (cfg) {
+        gro->cfg = *cfg;
+    } else {
+        gro->cfg.max_flows = DEFAULT_GRO_MAX_FLOWS;
+        gro->cfg.max_segs = DEFAULT_GRO_MAX_SEGS;
+        gro->cfg.flush_timeout_us = DEFAULT_GRO_FLUSH_TIMEOUT_US;
+        gro->cfg.headroom = DEFAULT_GRO_HEADROOM;
+    }
+
+    if (gro->cfg.max_flows == 0 || gro->cfg.max_segs < 2) {
+        zlog_error(zc, "ad_tun_gro_init: max_flows must be > 0 and max_segs >= 2");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    if (gro->cfg.mem) {
+        if (ad_tun_mem_alloc(&gro->flows_map, gro->cfg.max_flows * sizeof(*gro->flows),
+                             gro->cfg.mem) == AD_TUN_OK) {
+            gro->flows = gro->flows_map.ptr;
+        }
+    } else {
+        gro->flows = calloc(gro->cfg.max_flows, sizeof(*gro->flows));
+    }
+    if (!gro->flows) {
+        zlog_error(zc, "ad_tun_gro_init: flow table allocation failed");
+        return AD_TUN_ERR_SYS;
+    }
+
+    /* One buffer per held flow plus as many for emitted, not yet released packets */
+    ad_tun_error_t err = ad_tun_pool_init_numa(&gro->pool, gro->cfg.max_flows * 2,
+                                               GRO_MAX_SIZE + (gro->cfg.ethernet ? GRO_MAX_L2 : 0),
+                                               gro->cfg.headroom, gro->cfg.mem);
+    if (err != AD_TUN_OK) {
+        if (gro->flows_map.ptr) ad_tun_mem_free(&gro->flows_map);
+        else free(gro->flows);
+        gro->flows = NULL;
+        return err;
+    }
+
+    zlog_debug(zc, "GRO initialized: max_flows=%u, max_segs=%u, flush_timeout_us=%u",
+               gro->cfg.max_flows, gro->cfg.max_segs, gro->cfg.flush_timeout_us);
+
+    return AD_TUN_OK;
+}
+
+void ad_tun_gro_free(ad_tun_gro_t *gro)
+{
+    if (!gro || !gro->flows) return;
+
+    for (unsigned i = 0; i < gro->nflows; i++) {
+        ad_tun_pool_put(&gro->pool, gro->flows[i].buf);
+    }
+
+    ad_tun_pool_free(&gro->pool);
+    if (gro->flows_map.ptr) ad_tun_mem_free(&gro->flows_map);
+    else free(gro->flows);
+    memset(gro, 0, sizeof(*gro));
+}
+
+void ad_tun_gro_release(ad_tun_gro_t *gro, ad_tun_gro_pkt_t *pkt)
+{
+    if (!pkt || !pkt->owned) return;
+
+    ad_tun_pool_put(&gro->pool, pkt->buf);
+    pkt->buf = NULL;
+    pkt->owned = 0;
+}
+
+/* Hash of the flow 5-tuple, used to skip most key comparisons */
+static uint32_t gro_flow_hash(const ad_tun_pkt_info_t *info)
+{
+    size_t alen = (info->family == AF_INET) ? 4 : 16;
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < alen; i++) h = (h ^ info->src[i]) * 16777619u;
+    for (size_t i = 0; i < alen; i++) h = (h ^ info->dst[i]) * 16777619u;
+    h = (h ^ info->sport) * 16777619u;
+    h = (h ^ info->dport) * 16777619u;
+
+    return h;
+}
+
+/*
+ * A packet can be coalesced if it is a plain TCP data segment: no IPv4
+ * options or IPv6 extension headers, not a fragment, and only ACK/PSH set.
+ */
+static int gro_is_candidate(const ad_tun_buf_t *b, size_t l2, const ad_tun_pkt_info_t *info)
+{
+    size_t len = b->len - l2;
+
+    if (info->proto != IPPROTO_TCP || info->is_frag) return 0;
+    if (info->tot_len != len) return 0;
+    if (info->family == AF_INET && info->l3_len != 20) return 0;
+    if (info->family == AF_INET6 && info->l3_len != 40) return 0;
+
+    const unsigned char *th = b->data + l2 + info->l3_len;
+    if ((size_t)info->l3_len + 20 > len) return 0;
+
+    size_t thl = (size_t)(th[12] >> 4) * 4;
+    if (thl < 20 || info->l3_len + thl >= len) return 0;
+
+    uint8_t flags = th[13];
+    if (!(flags & TCP_ACK)) return 0;
+    if (flags & (TCP_FIN | TCP_SYN | TCP_RST | TCP_URG | TCP_ECE | TCP_CWR)) return 0;
+
+    return 1;
+}
+
+/*
+ * The TCP checksum of a candidate verifies. Merging rewrites it into a
+ * NEEDS_CSUM pseudo-header sum, which would hide a corrupt segment.
+ */
+static int gro_csum_ok(ad_tun_gro_t *gro, const ad_tun_buf_t *b, size_t l2, const ad_tun_pkt_info_t *info)
+{
+    if (gro->cfg.csum_valid) return 1;
+
+    size_t alen = (info->family == AF_INET) ? 4 : 16;
+    size_t tcp_len = b->len - l2 - info->l3_len;
+
+    uint32_t sum = ad_tun_csum_partial(info->src, alen, 0);
+    sum = ad_tun_csum_partial(info->dst, alen, sum);
+    sum += IPPROTO_TCP + (uint32_t)tcp_len;
+    sum = ad_tun_csum_partial(b->data + l2 + info->l3_len, tcp_len, sum);
+    if (ad_tun_csum_fold(sum) == 0) return 1;
+
+    gro->stats.csum_bad++;
+    return 0;
+}
+
+/* Same 5-tuple as the held flow */
+static int gro_same_flow(const ad_tun_gro_flow_t *f, uint32_t hash, const ad_tun_pkt_info_t *info)
+{
+    if (f->hash != hash || f->family != info->family) return 0;
+
+    const unsigned char *h = f->buf->data + f->l2_len;
+    const unsigned char *th = h + f->l3_len;
+
+    if (info->family == AF_INET) {
+        if (memcmp(h + 12, info->src, 4) || memcmp(h + 16, info->dst, 4)) return 0;
+    } else {
+        if (memcmp(h + 8, info->src, 16) || memcmp(h + 24, info->dst, 16)) return 0;
+    }
+    return ad_tun_get_be16(th) == info->sport && ad_tun_get_be16(th + 2) == info->dport;
+}
+
+/* Headers of the new segment allow appending it to the super-packet */
+static int gro_can_merge(const ad_tun_gro_t *gro, const ad_tun_gro_flow_t *f,
+                         const ad_tun_buf_t *b, size_t plen)
+{
+    const unsigned char *h = f->buf->data + f->l2_len;
+    const unsigned char *p = b->data + f->l2_len;
+    const unsigned char *fth = h + f->l3_len;
+    const unsigned char *pth = p + f->l3_len;
+
+    if (f->segs >= gro->cfg.max_segs) return 0;
+    if (plen > f->mss) return 0;
+    if (f->buf->len - f->l2_len + plen > GRO_MAX_SIZE || plen > ad_tun_buf_tailroom(f->buf)) return 0;
+
+    /* Same MACs and VLAN tags */
+    if (f->l2_len && (b->len < f->l2_len || memcmp(f->buf->data, b->data, f->l2_len))) return 0;
+
+    /* IP fields that must be identical across segments */
+    if (f->family == AF_INET) {
+        if (h[1] != p[1] || h[8] != p[8] || ((h[6] ^ p[6]) & 0x40)) return 0;
+    } else {
+        if (memcmp(h, p, 4) || h[7] != p[7]) return 0;
+    }
+
+    /* TCP: in-order sequence, same ack, window and options */
+    if (ad_tun_get_be32(pth + 4) != f->next_seq) return 0;
+    if ((size_t)(pth[12] >> 4) * 4 != f->l4_len) return 0;
+    if (memcmp(fth + 8, pth + 8, 4)) return 0;
+    if (memcmp(fth + 14, pth + 14, 2)) return 0;
+    if (f->l4_len > 20 && memcmp(fth + 20, pth + 20, f->l4_len - 20)) return 0;
+
+    return 1;
+}
+
+/* Finalize a flow into an output packet and remove it from the table */
+static void gro_flush_flow(ad_tun_gro_t *gro, unsigned idx, ad_tun_gro_pkt_t *out)
+{
+    ad_tun_gro_flow_t *f = &gro->flows[idx];
+    unsigned char *h = f->buf->data + f->l2_len;
+    size_t ip_len = f->buf->len - f->l2_len;
+
+    memset(out, 0, sizeof(*out));
+    out->buf = f->buf;
+    out->segs = f->segs;
+    out->owned = 1;
+
+    if (f->segs > 1) {
+        size_t tcp_len = ip_len - f->l3_len;
+        unsigned char *th = h + f->l3_len;
+        uint32_t sum;
+
+        if (f->family == AF_INET) {
+            ad_tun_put_be16(h + 2, (uint16_t)ip_len);
+            ad_tun_ipv4_set_csum(h);
+            sum = ad_tun_csum_partial(h + 12, 8, 0);
+            out->vnet.gso_type = AD_TUN_GSO_TCPV4;
+        } else {
+            ad_tun_put_be16(h + 4, (uint16_t)(ip_len - 40));
+            sum = ad_tun_csum_partial(h + 8, 32, 0);
+            out->vnet.gso_type = AD_TUN_GSO_TCPV6;
+        }
+
+        /* Leave the pseudo-header sum in the TCP checksum, as NEEDS_CSUM expects */
+        sum += IPPROTO_TCP + (uint32_t)tcp_len;
+        ad_tun_put_be16(th + 16, (uint16_t)~ad_tun_csum_fold(sum));
+
+        out->vnet.flags = AD_TUN_VNET_F_NEEDS_CSUM;
+        out->vnet.hdr_len = (uint16_t)(f->l2_len + f->l3_len + f->l4_len);
+        out->vnet.gso_size = f->mss;
+        out->vnet.csum_start = (uint16_t)(f->l2_len + f->l3_len);
+        out->vnet.csum_offset = 16;
+
+        gro->stats.super_pkts++;
+    }
+
+    gro->nflows--;
+    memmove(&gro->flows[idx], &gro->flows[idx + 1], (gro->nflows - idx) * sizeof(*f));
+}
+
+static void gro_passthrough(ad_tun_gro_t *gro, ad_tun_buf_t *b, ad_tun_gro_pkt_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->buf = b;
+    out->segs = 1;
+    gro->stats.passthrough++;
+}
+
+/* Start a new flow with b as its first segment; returns 0 if no buffer is available */
+static int gro_start_flow(ad_tun_gro_t *gro, ad_tun_buf_t *b, size_t l2, const ad_tun_pkt_info_t *info,
+                          uint32_t hash, uint64_t now_us)
+{
+    ad_tun_buf_t *super = ad_tun_pool_get(&gro->pool);
+    if (!super) return 0;
+
+    memcpy(super->data, b->data, b->len);
+    super->len = b->len;
+
+    const unsigned char *th = b->data + l2 + info->l3_len;
+    ad_tun_gro_flow_t *f = &gro->flows[gro->nflows++];
+
+    f->buf = super;
+    f->first_us = now_us;
+    f->hash = hash;
+    f->family = (uint8_t)info->family;
+    f->l2_len = (uint16_t)l2;
+    f->l3_len = info->l3_len;
+    f->l4_len = (uint16_t)((th[12] >> 4) * 4);
+    f->mss = (uint16_t)(b->len - l2 - f->l3_len - f->l4_len);
+    f->next_seq = ad_tun_get_be32(th + 4) + f->mss;
+    f->segs = 1;
+
+    return 1;
+}
+
+int ad_tun_gro_batch(ad_tun_gro_t *gro, ad_tun_buf_t **in, unsigned n, uint64_t now_us,
+                     ad_tun_gro_pkt_t *out, unsigned max_out)
+{
+    if (!gro || !in || !out || max_out < n + gro->cfg.max_flows) return -EINVAL;
+
+    AD_TUN_LAT_START(t_gro);
+    unsigned nout = 0;
+
+    for (unsigned i = 0; i < n; i++) {
+        ad_tun_buf_t *b = in[i];
+        ad_tun_pkt_info_t info;
+        int l2 = gro->cfg.ethernet ? ad_tun_eth_ip_offset(b->data, b->len) : 0;
+
+        if (l2 < 0 || ad_tun_pkt_parse(b->data + l2, b->len - (size_t)l2, &info) != 0 ||
+            info.proto != IPPROTO_TCP) {
+            gro_passthrough(gro, b, &out[nout++]);
+            continue;
+        }
+
+        gro->stats.segs_in++;
+
+        uint32_t hash = gro_flow_hash(&info);
+        unsigned idx = gro->nflows;
+        for (unsigned j = 0; j < gro->nflows; j++) {
+            if (gro_same_flow(&gro->flows[j], hash, &info)) {
+                idx = j;
+                break;
+            }
+        }
+
+        if (!gro_is_candidate(b, (size_t)l2, &info) || !gro_csum_ok(gro, b, (size_t)l2, &info)) {
+            /* Flush what is held for this flow first so its order is kept */
+            if (idx < gro->nflows) gro_flush_flow(gro, idx, &out[nout++]);
+            gro_passthrough(gro, b, &out[nout++]);
+            continue;
+        }
+
+        const unsigned char *th = b->data + l2 + info.l3_len;
+        size_t thl = (size_t)(th[12] >> 4) * 4;
+        size_t plen = b->len - (size_t)l2 - info.l3_len - thl;
+
+        if (idx < gro->nflows) {
+            ad_tun_gro_flow_t *f = &gro->flows[idx];
+
+            if (gro_can_merge(gro, f, b, plen)) {
+                memcpy(f->buf->data + f->buf->len, b->data + l2 + info.l3_len + thl, plen);
+                f->buf->len += plen;
+                f->next_seq += (uint32_t)plen;
+                f->segs++;
+                gro->stats.coalesced++;
+
+                /* PSH or a short segment ends the run */
+                if (th[13] & TCP_PSH) {
+                    f->buf->data[f->l2_len + f->l3_len + 13] |= TCP_PSH;
+                    gro_flush_flow(gro, idx, &out[nout++]);
+                } else if (plen < f->mss) {
+                    gro_flush_flow(gro, idx, &out[nout++]);
+                }
+                continue;
+            }
+
+            gro_flush_flow(gro, idx, &out[nout++]);
+        }
+
+        /* A lone PSH segment has nothing to wait for */
+        if (th[13] & TCP_PSH) {
+            gro_passthrough(gro, b, &out[nout++]);
+            continue;
+        }
+
+        /* Make room by flushing the oldest flow */
+        if (gro->nflows == gro->cfg.max_flows) gro_flush_flow(gro, 0, &out[nout++]);
+
+        if (!gro_start_flow(gro, b, (size_t)l2, &info, hash, now_us)) {
+            gro_passthrough(gro, b, &out[nout++]);
+        }
+    }
+
+    if (gro->cfg.flush_timeout_us == 0) {
+        nout += (unsigned)ad_tun_gro_flush_all(gro, out + nout, max_out - nout);
+    } else {
+        nout += (unsigned)ad_tun_gro_flush_expired(gro, now_us, out + nout, max_out - nout);
+    }
+
+    AD_TUN_LAT_END(AD_TUN_LAT_GRO, t_gro);
+    return (int)nout;
+}
+
+int ad_tun_gro_flush_expired(ad_tun_gro_t *gro, uint64_t now_us,
+                             ad_tun_gro_pkt_t *out, unsigned max_out)
+{
+    unsigned nout = 0;
+
+    /* Flows are kept oldest first */
+    while (gro->nflows > 0 && nout < max_out &&
+           now_us - gro->flows[0].first_us >= gro->cfg.flush_timeout_us) {
+        gro_flush_flow(gro, 0, &out[nout++]);
+    }
+    return (int)nout;
+}
+
+int ad_tun_gro_flush_all(ad_tun_gro_t *gro, ad_tun_gro_pkt_t *out, unsigned max_out)
+{
+    unsigned nout = 0;
+
+    while (gro->nflows > 0 && nout < max_out) {
+        gro_flush_flow(gro, 0, &out[nout++]);
+    }
+    return (int)nout;
+}
@@ -0,0 +1,532 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Heavy Hitters      **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_hh.h"
+#include "../include/ad_tun_hash.h"
+#include "../include/ad_tun_pkt.h"
+#include "../include/ad_tun_eth.h"
+#include "../../prebuilt/inih/include/ini.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+/* Defaults for ad_tun_hh_config_t */
+#define DEFAULT_HH_WIDTH 65536
+#define DEFAULT_HH_DEPTH 4
+#define DEFAULT_HH_TOPK 256
+#define DEFAULT_HH_DECAY_MS 10000
+#define DEFAULT_HH_KEY AD_TUN_HH_KEY_FLOW
+#define DEFAULT_HH_METRIC AD_TUN_HH_BYTES
+
+/*
+ * Widest row accepted: 32 MB per row. Counters are 64-bit: with the bytes
+ * metric a 32-bit one saturates at 4 GiB, which one 10 Gb/s flow reaches in
+ * 3.4 s, well inside the default decay period.
+ */
+#define HH_MAX_WIDTH (1u << 22)
+/* Packets hashed and prefetched ahead of their counter updates */
+#define HH_CHUNK 16
+
+_Static_assert(sizeof(ad_tun_hh_key_t) == 40, "ad_tun_hh_key_t is hashed as five 64-bit words");
+
+struct ad_tun_hh_slot {
+    ad_tun_hh_key_t key;
+    uint64_t hash;
+    uint64_t count;
+    uint64_t error;
+    uint64_t packets;
+    uint64_t bytes;
+    uint32_t ipos;              /* Position in the index */
+};
+
+/* ---- Configuration ---- */
+
+void ad_tun_hh_default_config(ad_tun_hh_config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->width = DEFAULT_HH_WIDTH;
+    cfg->depth = DEFAULT_HH_DEPTH;
+    cfg->topk = DEFAULT_HH_TOPK;
+    cfg->decay_ms = DEFAULT_HH_DECAY_MS;
+    cfg->key = DEFAULT_HH_KEY;
+    cfg->metric = DEFAULT_HH_METRIC;
+}
+
+static int hh_ini_handler(void *user, const char *section,
+                          const char *name, const char *value)
+{
+    ad_tun_hh_config_t *cfg = (ad_tun_hh_config_t*)user;
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (strcmp(section, "heavy_hitters") != 0) return 1;
+
+    if (strcmp(name, "width") == 0) {
+        cfg->width = (unsigned)atoi(value);
+    } else if (strcmp(name, "depth") == 0) {
+        cfg->depth = (unsigned)atoi(value);
+    } else if (strcmp(name, "topk") == 0) {
+        cfg->topk = (unsigned)atoi(value);
+    } else if (strcmp(name, "decay_ms") == 0) {
+        cfg->decay_ms = (unsigned)atoi(value);
+    } else if (strcmp(name, "key") == 0) {
+        if (strcmp(value, "flow") == 0) cfg->key = AD_TUN_HH_KEY_FLOW;
+        else if (strcmp(value, "src") == 0) cfg->key = AD_TUN_HH_KEY_SRC;
+        else if (strcmp(value, "dst") == 0) cfg->key = AD_TUN_HH_KEY_DST;
+        else cfg->key = -1;
+    } else if (strcmp(name, "metric") == 0) {
+        if (strcmp(value, "packets") == 0) cfg->metric = AD_TUN_HH_PACKETS;
+        else if (strcmp(value, "bytes") == 0) cfg->metric = AD_TUN_HH_BYTES;
+        else cfg->metric = -1;
+    } else {
+        zlog_warn(zc, "Unknown heavy hitter key ignored: %s", name);
+    }
+    return 1;
+}
+
+ad_tun_error_t ad_tun_hh_load_config(const char *path, ad_tun_hh_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!path || !cfg) {
+        zlog_error(zc, "Invalid arguments to ad_tun_hh_load_config()");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    ad_tun_hh_default_config(cfg);
+
+    int rc = ini_parse(path, hh_ini_handler, cfg);
+    if (rc < 0) {
+        zlog_error(zc, "Failed to open config file: %s", path);
+        return AD_TUN_ERR_CONFIG;
+    } else if (rc > 0) {
+        zlog_error(zc, "Parsing error at line %d in config file %s", rc, path);
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    if (cfg->width == 0 || cfg->width > HH_MAX_WIDTH) {
+        zlog_warn(zc, "Config warning: 'width' should be 1..%u, using default %d",
+                  HH_MAX_WIDTH, DEFAULT_HH_WIDTH);
+        cfg->width = DEFAULT_HH_WIDTH;
+    }
+
+    if (cfg->depth == 0 || cfg->depth > AD_TUN_HH_MAX_DEPTH) {
+        zlog_warn(zc, "Config warning: 'depth' should be 1..%d, using default %d",
+                  AD_TUN_HH_MAX_DEPTH, DEFAULT_HH_DEPTH);
+        cfg->depth = DEFAULT_HH_DEPTH;
+    }
+
+    if (cfg->topk == 0 || cfg->topk > AD_TUN_HH_MAX_TOPK) {
+        zlog_warn(zc, "Config warning: 'topk' should be 1..%d, using default %d",
+                  AD_TUN_HH_MAX_TOPK, DEFAULT_HH_TOPK);
+        cfg->topk = DEFAULT_HH_TOPK;
+    }
+
+    if (cfg->key < 0) {
+        zlog_warn(zc, "Config warning: 'key' should be flow, src or dst, using flow");
+        cfg->key = DEFAULT_HH_KEY;
+    }
+
+    if (cfg->metric < 0) {
+        zlog_warn(zc, "Config warning: 'metric' should be packets or bytes, using bytes");
+        cfg->metric = DEFAULT_HH_METRIC;
+    }
+
+    zlog_info(zc, "Heavy hitter config loaded from %s: %ux%u counters, top %u, decay=%ums",
+              path, cfg->depth, cfg->width, cfg->topk, cfg->decay_ms);
+    return AD_TUN_OK;
+}
+
+/* ---- Sketch ---- */
+
+static uint32_t hh_pow2(uint32_t n)
+{
+    uint32_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+ad_tun_error_t ad_tun_hh_init(ad_tun_hh_t *hh, const ad_tun_hh_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!hh || !cfg || cfg->width == 0 || cfg->width > HH_MAX_WIDTH ||
+        cfg->depth == 0 || cfg->depth > AD_TUN_HH_MAX_DEPTH ||
+        cfg->topk == 0 || cfg->topk > AD_TUN_HH_MAX_TOPK ||
+        cfg->key < AD_TUN_HH_KEY_FLOW || cfg->key > AD_TUN_HH_KEY_DST ||
+        (cfg->metric != AD_TUN_HH_PACKETS && cfg->metric != AD_TUN_HH_BYTES)) {
+        zlog_error(zc, "ad_tun_hh_init: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    memset(hh, 0, sizeof(*hh));
+    hh->cfg = *cfg;
+    hh->wmask = hh_pow2(cfg->width) - 1;
+    hh->imask = hh_pow2(cfg->topk * 2) - 1;
+
+    size_t row_bytes = ((size_t)hh->wmask + 1) * sizeof(*hh->rows);
+    if (posix_memalign((void**)&hh->rows, 64, row_bytes * cfg->depth) != 0) {
+        hh->rows = NULL;
+        goto fail;
+    }
+    memset(hh->rows, 0, row_bytes * cfg->depth);
+
+    hh->heap = calloc(cfg->topk, sizeof(*hh->heap));
+    hh->index = calloc((size_t)hh->imask + 1, sizeof(*hh->index));
+    if (!hh->heap || !hh->index) goto fail;
+
+    pthread_mutex_init(&hh->lock, NULL);
+
+    zlog_info(zc, "Heavy hitter sketch initialized: %ux%u counters (%zu KB), top %u",
+              cfg->depth, hh->wmask + 1, row_bytes * cfg->depth / 1024, cfg->topk);
+    return AD_TUN_OK;
+
+fail:
+    zlog_error(zc, "ad_tun_hh_init: allocation failed");
+    free(hh->rows);
+    free(hh->heap);
+    free(hh->index);
+    memset(hh, 0, sizeof(*hh));
+    return AD_TUN_ERR_SYS;
+}
+
+void ad_tun_hh_free(ad_tun_hh_t *hh)
+{
+    if (!hh || !hh->rows) return;
+
+    pthread_mutex_destroy(&hh->lock);
+    free(hh->rows);
+    free(hh->heap);
+    free(hh->index);
+    memset(hh, 0, sizeof(*hh));
+}
+
+/* Build the key of one packet and its weight; returns -1 if it carries no IP header */
+static int hh_key(const ad_tun_hh_t *hh, const ad_tun_buf_t *b, ad_tun_hh_key_t *k, uint32_t *len)
+{
+    const unsigned char *p = b->data;
+    size_t n = b->len;
+
+    if (hh->cfg.l2) {
+        int off = ad_tun_eth_ip_offset(p, n);
+        if (off < 0) return -1;
+        p += off;
+        n -= (size_t)off;
+    }
+
+    ad_tun_pkt_info_t info;
+    if (ad_tun_pkt_parse(p, n, &info) != 0) return -1;
+
+    memset(k, 0, sizeof(*k));
+    size_t alen = (info.family == AF_INET) ? 4 : 16;
+    k->family = (uint8_t)info.family;
+    if (hh->cfg.key != AD_TUN_HH_KEY_DST) memcpy(k->src, info.src, alen);
+    if (hh->cfg.key != AD_TUN_HH_KEY_SRC) memcpy(k->dst, info.dst, alen);
+    if (hh->cfg.key == AD_TUN_HH_KEY_FLOW) {
+        k->proto = info.proto;
+        if (!info.is_frag) {
+            k->sport = info.sport;
+            k->dport = info.dport;
+        }
+    }
+    *len = (uint32_t)n;
+    return 0;
+}
+
+static inline uint64_t hh_hash(const ad_tun_hh_key_t *k)
+{
+    return ad_tun_hash_key40(k);
+}
+
+/* Counter of key hash h in row r: double hashing over the two halves of h */
+static inline uint64_t *hh_cell(const ad_tun_hh_t *hh, uint64_t h, unsigned r)
+{
+    uint32_t h1 = (uint32_t)h;
+    uint32_t h2 = (uint32_t)(h >> 32) | 1u;
+    return &hh->rows[(size_t)r * (hh->wmask + 1) + ((h1 + r * h2) & hh->wmask)];
+}
+
+/*
+ * Conservative update: raise only the counters below min + w; returns the
+ * new estimate. Written as selects rather than branches, which would be
+ * mispredicted about every other row.
+ */
+static uint64_t hh_sketch_add(const ad_tun_hh_t *hh, uint64_t *const *cell, uint32_t w)
+{
+    unsigned depth = hh->cfg.depth;
+    uint64_t min = UINT64_MAX;
+
+    for (unsigned r = 0; r < depth; r++) {
+        uint64_t c = *cell[r];
+        min = (c < min) ? c : min;
+    }
+
+    uint64_t est = (min > UINT64_MAX - w) ? UINT64_MAX : min + w;
+    for (unsigned r = 0; r < depth; r++) {
+        uint64_t c = *cell[r];
+        *cell[r] = (c < est) ? est : c;
+    }
+    return est;
+}
+
+/* ---- Top-K: min-heap on count, with an open-addressed index by key ---- */
+
+/* Index entries: heap position + 1 below, the hash's high half above as a tag */
+#define HH_IPOS(e) ((uint32_t)(e) - 1)
+#define HH_ITAG(h) ((h) & 0xffffffff00000000ull)
+
+/* Heap position of key k, or -1; the tag spares a heap access on most misses */
+static int hh_find(const ad_tun_hh_t *hh, uint64_t h, const ad_tun_hh_key_t *k)
+{
+    for (uint32_t i = (uint32_t)h & hh->imask; hh->index[i]; i = (i + 1) & hh->imask) {
+        if (HH_ITAG(hh->index[i]) != HH_ITAG(h)) continue;
+        const ad_tun_hh_slot_t *s = &hh->heap[HH_IPOS(hh->index[i])];
+        if (s->hash == h && memcmp(&s->key, k, sizeof(*k)) == 0) return (int)HH_IPOS(hh->index[i]);
+    }
+    return -1;
+}
+
+static void hh_index_add(ad_tun_hh_t *hh, unsigned pos)
+{
+    uint64_t h = hh->heap[pos].hash;
+    uint32_t i = (uint32_t)h & hh->imask;
+    while (hh->index[i]) i = (i + 1) & hh->imask;
+    hh->index[i] = HH_ITAG(h) | (pos + 1);
+    hh->heap[pos].ipos = i;
+}
+
+static int hh_index_used(void *tab, uint32_t slot)
+{
+    return ((ad_tun_hh_t *)tab)->index[slot] != 0;
+}
+
+static uint32_t hh_index_home(void *tab, uint32_t slot)
+{
+    ad_tun_hh_t *hh = tab;
+    return (uint32_t)hh->heap[HH_IPOS(hh->index[slot])].hash;
+}
+
+static void hh_index_move(void *tab, uint32_t dst, uint32_t src)
+{
+    ad_tun_hh_t *hh = tab;
+    hh->index[dst] = hh->index[src];
+    hh->heap[HH_IPOS(hh->index[dst])].ipos = dst;
+    hh->index[src] = 0;
+}
+
+static const ad_tun_hash_lp_ops_t hh_index_ops = { hh_index_used, hh_index_home, hh_index_move };
+
+/* Remove index slot i, shifting later entries of the probe run back */
+static void hh_index_del(ad_tun_hh_t *hh, uint32_t i)
+{
+    hh->index[i] = 0;
+    ad_tun_hash_lp_del(hh, hh->imask, i, &hh_index_ops);
+}
+
+static void hh_swap(ad_tun_hh_t *hh, unsigned a, unsigned b)
+{
+    ad_tun_hh_slot_t t = hh->heap[a];
+    hh->heap[a] = hh->heap[b];
+    hh->heap[b] = t;
+    hh->index[hh->heap[a].ipos] = HH_ITAG(hh->heap[a].hash) | (a + 1);
+    hh->index[hh->heap[b].ipos] = HH_ITAG(hh->heap[b].hash) | (b + 1);
+}
+
+static void hh_sift_up(ad_tun_hh_t *hh, unsigned pos)
+{
+    while (pos > 0) {
+        unsigned parent = (pos - 1) / 2;
+        if (hh->heap[parent].count <= hh->heap[pos].count) break;
+        hh_swap(hh, parent, pos);
+        pos = parent;
+    }
+}
+
+static void hh_sift_down(ad_tun_hh_t *hh, unsigned pos)
+{
+    for (;;) {
+        unsigned l = 2 * pos + 1, r = l + 1, min = pos;
+        if (l < hh->used && hh->heap[l].count < hh->heap[min].count) min = l;
+        if (r < hh->used && hh->heap[r].count < hh->heap[min].count) min = r;
+        if (min == pos) return;
+        hh_swap(hh, pos, min);
+        pos = min;
+    }
+}
+
+/* Account one packet of key k (sketch estimate est) in the top-K */
+static void hh_topk_add(ad_tun_hh_t *hh, uint64_t h, const ad_tun_hh_key_t *k,
+                        uint64_t est, uint32_t w, uint32_t len)
+{
+    /*
+     * A tracked key's estimate never falls below its entry's count, so a
+     * key estimated under the lightest entry is neither tracked nor admitted:
+     * most mice stop here without touching the index.
+     */
+    if (hh->used == hh->cfg.topk && est < hh->heap[0].count) return;
+
+    int pos = hh_find(hh, h, k);
+    if (pos >= 0) {
+        ad_tun_hh_slot_t *s = &hh->heap[pos];
+        s->count += w;
+        s->packets++;
+        s->bytes += len;
+        hh_sift_down(hh, (unsigned)pos);
+        return;
+    }
+
+    /* Only a key the sketch shows heavier than the lightest entry gets in */
+    unsigned at;
+    if (hh->used < hh->cfg.topk) {
+        at = hh->used++;
+    } else {
+        if (est <= hh->heap[0].count) return;
+        hh_index_del(hh, hh->heap[0].ipos);
+        hh->stats.evictions++;
+        at = 0;
+    }
+
+    ad_tun_hh_slot_t *s = &hh->heap[at];
+    s->key = *k;
+    s->hash = h;
+    s->count = est;
+    s->error = est - w;
+    s->packets = 1;
+    s->bytes = len;
+    hh_index_add(hh, at);
+    hh->stats.admissions++;
+
+    if (at == 0) hh_sift_down(hh, 0);
+    else hh_sift_up(hh, at);
+}
+
+void ad_tun_hh_update(ad_tun_hh_t *hh, ad_tun_buf_t *const *bufs, unsigned n)
+{
+    ad_tun_hh_key_t keys[HH_CHUNK];
+    uint64_t hashes[HH_CHUNK];
+    uint64_t *cells[HH_CHUNK][AD_TUN_HH_MAX_DEPTH];
+    uint32_t lens[HH_CHUNK];
+
+    pthread_mutex_lock(&hh->lock);
+
+    for (unsigned base = 0; base < n; base += HH_CHUNK) {
+        unsigned m = (n - base < HH_CHUNK) ? n - base : HH_CHUNK;
+        unsigned got = 0;
+
+        /* Hash the chunk first and prefetch its counters, so the misses overlap */
+        for (unsigned i = 0; i < m; i++) {
+            if (hh_key(hh, bufs[base + i], &keys[got], &lens[got]) != 0) {
+                hh->stats.unparsed++;
+                continue;
+            }
+            hashes[got] = hh_hash(&keys[got]);
+            for (unsigned r = 0; r < hh->cfg.depth; r++) {
+                cells[got][r] = hh_cell(hh, hashes[got], r);
+                __builtin_prefetch(cells[got][r], 1);
+            }
+            got++;
+        }
+
+        for (unsigned i = 0; i < got; i++) {
+            uint32_t w = (hh->cfg.metric == AD_TUN_HH_BYTES) ? lens[i] : 1u;
+            uint64_t est = hh_sketch_add(hh, cells[i], w);
+            hh_topk_add(hh, hashes[i], &keys[i], est, w, lens[i]);
+            hh->stats.packets++;
+            hh->stats.bytes += lens[i];
+        }
+    }
+
+    pthread_mutex_unlock(&hh->lock);
+}
+
+void ad_tun_hh_decay(ad_tun_hh_t *hh)
+{
+    pthread_mutex_lock(&hh->lock);
+
+    size_t cells = ((size_t)hh->wmask + 1) * hh->cfg.depth;
+    for (size_t i = 0; i < cells; i++) hh->rows[i] >>= 1;
+
+    /* Halving keeps the heap order, so no re-heapify */
+    for (unsigned i = 0; i < hh->used; i++) {
+        hh->heap[i].count >>= 1;
+        hh->heap[i].error = (hh->heap[i].error + 1) >> 1;
+        if (hh->heap[i].error > hh->heap[i].count) hh->heap[i].error = hh->heap[i].count;
+    }
+    hh->stats.decays++;
+
+    pthread_mutex_unlock(&hh->lock);
+}
+
+int ad_tun_hh_tick(ad_tun_hh_t *hh, uint64_t now_ms)
+{
+    if (hh->cfg.decay_ms == 0) return 0;
+
+    if (hh->last_decay == 0) {
+        hh->last_decay = now_ms ? now_ms : 1;
+        return 0;
+    }
+    if (now_ms - hh->last_decay < hh->cfg.decay_ms) return 0;
+
+    ad_tun_hh_decay(hh);
+    hh->last_decay = now_ms;
+    return 1;
+}
+
+uint64_t ad_tun_hh_estimate(ad_tun_hh_t *hh, const ad_tun_hh_key_t *key)
+{
+    uint64_t h = hh_hash(key);
+    uint64_t min = UINT64_MAX;
+
+    pthread_mutex_lock(&hh->lock);
+    for (unsigned r = 0; r < hh->cfg.depth; r++) {
+        uint64_t c = *hh_cell(hh, h, r);
+        if (c < min) min = c;
+    }
+    pthread_mutex_unlock(&hh->lock);
+
+    return min;
+}
+
+static int hh_entry_cmp(const void *a, const void *b)
+{
+    uint64_t ca = ((const ad_tun_hh_entry_t *)a)->count;
+    uint64_t cb = ((const ad_tun_hh_entry_t *)b)->count;
+    return (ca < cb) - (ca > cb);
+}
+
+unsigned ad_tun_hh_snapshot(ad_tun_hh_t *hh, ad_tun_hh_entry_t *out, unsigned max)
+{
+    pthread_mutex_lock(&hh->lock);
+    unsigned n = hh->used;
+    ad_tun_hh_entry_t *all = malloc((n ? n : 1) * sizeof(*all));
+    if (!all) {
+        pthread_mutex_unlock(&hh->lock);
+        return 0;
+    }
+    for (unsigned i = 0; i < n; i++) {
+        all[i].key = hh->heap[i].key;
+        all[i].count = hh->heap[i].count;
+        all[i].error = hh->heap[i].error;
+        all[i].packets = hh->heap[i].packets;
+        all[i].bytes = hh->heap[i].bytes;
+    }
+    pthread_mutex_unlock(&hh->lock);
+
+    qsort(all, n, sizeof(*all), hh_entry_cmp);
+    if (n > max) n = max;
+    if (n) memcpy(out, all, n * sizeof(*out));
+    free(all);
+    return n;
+}
+
+void ad_tun_hh_get_stats(ad_tun_hh_t *hh, ad_tun_hh_stats_t *stats)
+{
+    pthread_mutex_lock(&hh->lock);
+    *stats = hh->stats;
+    pthread_mutex_unlock(&hh->lock);
+}
@@ -0,0 +1,923 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun IPFIX Export       **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_ipfix.h"
+#include "../include/ad_tun_hash.h"
+#include "../include/ad_tun_pkt.h"
+#include "../include/ad_tun_eth.h"
+#include "../../prebuilt/inih/include/ini.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Defaults for ad_tun_ipfix_config_t */
+#define DEFAULT_IPFIX_COLLECTOR "127.0.0.1"
+#define DEFAULT_IPFIX_PORT 4739
+#define DEFAULT_IPFIX_WORKERS 1
+#define DEFAULT_IPFIX_WORKER_FLOWS 4096
+#define DEFAULT_IPFIX_MAX_FLOWS 65536
+#define DEFAULT_IPFIX_ACTIVE_MS 60000
+#define DEFAULT_IPFIX_IDLE_MS 15000
+#define DEFAULT_IPFIX_INTERVAL_MS 1000
+#define DEFAULT_IPFIX_TEMPLATE_MS 60000
+#define DEFAULT_IPFIX_SAMPLING 1
+#define DEFAULT_IPFIX_MTU 1400
+
+/* Limits of the table sizes */
+#define IPFIX_MAX_WORKER_FLOWS (1u << 20)
+#define IPFIX_MAX_FLOWS (1u << 22)
+/* Smallest message that holds the header and both templates */
+#define IPFIX_MIN_MTU 256
+/* Largest UDP payload */
+#define IPFIX_MAX_MTU 65507
+
+/* RFC 7011 framing */
+#define IPFIX_VERSION 10
+#define IPFIX_HDR_LEN 16
+#define IPFIX_SET_HDR_LEN 4
+#define IPFIX_TEMPLATE_SET_ID 2
+#define IPFIX_TEMPLATE_V4 256
+#define IPFIX_TEMPLATE_V6 257
+
+/* Data record sizes of the two templates */
+#define IPFIX_REC_TAIL_LEN (2 + 2 + 1 + 1 + 1 + 1 + 8 + 8 + 8 + 8 + 4)
+#define IPFIX_REC_V4_LEN (4 + 4 + IPFIX_REC_TAIL_LEN)
+#define IPFIX_REC_V6_LEN (16 + 16 + IPFIX_REC_TAIL_LEN)
+
+/* Flow key: the 5-tuple plus ToS and direction */
+typedef struct {
+    uint8_t src[16];
+    uint8_t dst[16];
+    uint16_t sport;
+    uint16_t dport;
+    uint8_t proto;
+    uint8_t tos;
+    uint8_t dir;
+    uint8_t family;
+} ipfix_key_t;
+
+_Static_assert(sizeof(ipfix_key_t) == 40, "ipfix_key_t is hashed as five 64-bit words");
+
+/* Worker table slot, empty while packets is 0 */
+typedef struct {
+    ipfix_key_t key;
+    uint32_t hash;
+    uint32_t pad;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t first;
+    uint64_t last;
+} ipfix_wslot_t;
+
+/*
+ * The worker writes busy, its tables and its counters; the exporter writes
+ * epoch and pending. The worker records into tables[epoch & 1].
+ */
+struct ad_tun_ipfix_worker {
+    ipfix_wslot_t *tab[2];
+    uint32_t *used[2];          /* Occupied slots of each table, for merging and clearing */
+    unsigned nused[2];
+    uint32_t mask;
+    unsigned epoch;
+    int busy;                   /* Inside ad_tun_ipfix_record() */
+    int pending;                /* Exporter: table of epoch - 1 not merged yet */
+    unsigned skip;              /* Packets until the next sample */
+    uint64_t packets;
+    uint64_t sampled;
+    uint64_t unparsed;
+    uint64_t full;
+} __attribute__((aligned(64)));
+
+/* Exporter cache entry; packets and bytes count since the last export */
+struct ad_tun_ipfix_flow {
+    ipfix_key_t key;
+    uint32_t hash;
+    uint32_t used;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t first;             /* First packet since the last export */
+    uint64_t last;
+};
+
+int ad_tun_ipfix_bound;
+
+/* Binding of the calling thread for ad_tun_ipfix_packet() */
+static _Thread_local ad_tun_ipfix_t *t_ipfix;
+static _Thread_local unsigned t_ipfix_worker;
+
+/* ---- Configuration ---- */
+
+void ad_tun_ipfix_default_config(ad_tun_ipfix_config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    snprintf(cfg->collector, sizeof(cfg->collector), "%s", DEFAULT_IPFIX_COLLECTOR);
+    cfg->port = DEFAULT_IPFIX_PORT;
+    cfg->workers = DEFAULT_IPFIX_WORKERS;
+    cfg->worker_flows = DEFAULT_IPFIX_WORKER_FLOWS;
+    cfg->max_flows = DEFAULT_IPFIX_MAX_FLOWS;
+    cfg->active_timeout_ms = DEFAULT_IPFIX_ACTIVE_MS;
+    cfg->idle_timeout_ms = DEFAULT_IPFIX_IDLE_MS;
+    cfg->interval_ms = DEFAULT_IPFIX_INTERVAL_MS;
+    cfg->template_ms = DEFAULT_IPFIX_TEMPLATE_MS;
+    cfg->sampling = DEFAULT_IPFIX_SAMPLING;
+    cfg->mtu = DEFAULT_IPFIX_MTU;
+}
+
+static int ipfix_ini_handler(void *user, const char *section,
+                             const char *name, const char *value)
+{
+    ad_tun_ipfix_config_t *cfg = (ad_tun_ipfix_config_t*)user;
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (strcmp(section, "ipfix") != 0) return 1;
+
+    if (strcmp(name, "collector") == 0) {
+        if (value[0] == '\0' || strlen(value) >= sizeof(cfg->collector)) {
+            zlog_warn(zc, "Config warning: 'collector' should be a host name or address, using %s",
+                      DEFAULT_IPFIX_COLLECTOR);
+            snprintf(cfg->collector, sizeof(cfg->collector), "%s", DEFAULT_IPFIX_COLLECTOR);
+        } else {
+            snprintf(cfg->collector, sizeof(cfg->collector), "%s", value);
+        }
+    } else if (strcmp(name, "port") == 0) {
+        int port = atoi(value);
+        cfg->port = (port > 0 && port <= 65535) ? (uint16_t)port : 0;
+    } else if (strcmp(name, "domain_id") == 0) {
+        cfg->domain_id = (uint32_t)strtoul(value, NULL, 10);
+    } else if (strcmp(name, "workers") == 0) {
+        cfg->workers = (unsigned)atoi(value);
+    } else if (strcmp(name, "worker_flows") == 0) {
+        cfg->worker_flows = (unsigned)atoi(value);
+    } else if (strcmp(name, "max_flows") == 0) {
+        cfg->max_flows = (unsigned)atoi(value);
+    } else if (strcmp(name, "active_timeout_ms") == 0) {
+        cfg->active_timeout_ms = (unsigned)atoi(value);
+    } else if (strcmp(name, "idle_timeout_ms") == 0) {
+        cfg->idle_timeout_ms = (unsigned)atoi(value);
+    } else if (strcmp(name, "interval_ms") == 0) {
+        cfg->interval_ms = (unsigned)atoi(value);
+    } else if (strcmp(name, "template_ms") == 0) {
+        cfg->template_ms = (unsigned)atoi(value);
+    } else if (strcmp(name, "sampling") == 0) {
+        cfg->sampling = (unsigned)atoi(value);
+    } else if (strcmp(name, "mtu") == 0) {
+        cfg->mtu = (unsigned)atoi(value);
+    } else {
+        zlog_warn(zc, "Unknown ipfix key ignored: %s", name);
+    }
+    return 1;
+}
+
+ad_tun_error_t ad_tun_ipfix_load_config(const char *path, ad_tun_ipfix_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!path || !cfg) {
+        zlog_error(zc, "Invalid arguments to ad_tun_ipfix_load_config()");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    ad_tun_ipfix_default_config(cfg);
+
+    int rc = ini_parse(path, ipfix_ini_handler, cfg);
+    if (rc < 0) {
+        zlog_error(zc, "Failed to open config file: %s", path);
+        return AD_TUN_ERR_CONFIG;
+    } else if (rc > 0) {
+        zlog_error(zc, "Parsing error at line %d in config file %s", rc, path);
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    if (cfg->port == 0) {
+        zlog_warn(zc, "Config warning: 'port' should be 1..65535, using default %d",
+                  DEFAULT_IPFIX_PORT);
+        cfg->port = DEFAULT_IPFIX_PORT;
+    }
+
+    if (cfg->workers == 0 || cfg->workers > AD_TUN_IPFIX_MAX_WORKERS) {
+        zlog_warn(zc, "Config warning: 'workers' should be 1..%d, using default %d",
+                  AD_TUN_IPFIX_MAX_WORKERS, DEFAULT_IPFIX_WORKERS);
+        cfg->workers = DEFAULT_IPFIX_WORKERS;
+    }
+
+    if (cfg->worker_flows == 0 || cfg->worker_flows > IPFIX_MAX_WORKER_FLOWS) {
+        zlog_warn(zc, "Config warning: 'worker_flows' should be 1..%u, using default %d",
+                  IPFIX_MAX_WORKER_FLOWS, DEFAULT_IPFIX_WORKER_FLOWS);
+        cfg->worker_flows = DEFAULT_IPFIX_WORKER_FLOWS;
+    }
+
+    if (cfg->max_flows == 0 || cfg->max_flows > IPFIX_MAX_FLOWS) {
+        zlog_warn(zc, "Config warning: 'max_flows' should be 1..%u, using default %d",
+                  IPFIX_MAX_FLOWS, DEFAULT_IPFIX_MAX_FLOWS);
+        cfg->max_flows = DEFAULT_IPFIX_MAX_FLOWS;
+    }
+
+    if (cfg->active_timeout_ms == 0) {
+        zlog_warn(zc, "Config warning: 'active_timeout_ms' should be positive, using default %d",
+                  DEFAULT_IPFIX_ACTIVE_MS);
+        cfg->active_timeout_ms = DEFAULT_IPFIX_ACTIVE_MS;
+    }
+
+    if (cfg->idle_timeout_ms == 0) {
+        zlog_warn(zc, "Config warning: 'idle_timeout_ms' should be positive, using default %d",
+                  DEFAULT_IPFIX_IDLE_MS);
+        cfg->idle_timeout_ms = DEFAULT_IPFIX_IDLE_MS;
+    }
+
+    if (cfg->interval_ms == 0) {
+        zlog_warn(zc, "Config warning: 'interval_ms' should be positive, using default %d",
+                  DEFAULT_IPFIX_INTERVAL_MS);
+        cfg->interval_ms = DEFAULT_IPFIX_INTERVAL_MS;
+    }
+
+    if (cfg->template_ms == 0) {
+        zlog_warn(zc, "Config warning: 'template_ms' should be positive, using default %d",
+                  DEFAULT_IPFIX_TEMPLATE_MS);
+        cfg->template_ms = DEFAULT_IPFIX_TEMPLATE_MS;
+    }
+
+    if (cfg->sampling == 0) {
+        zlog_warn(zc, "Config warning: 'sampling' should be at least 1, using default %d",
+                  DEFAULT_IPFIX_SAMPLING);
+        cfg->sampling = DEFAULT_IPFIX_SAMPLING;
+    }
+
+    if (cfg->mtu < IPFIX_MIN_MTU || cfg->mtu > IPFIX_MAX_MTU) {
+        zlog_warn(zc, "Config warning: 'mtu' should be %d..%d, using default %d",
+                  IPFIX_MIN_MTU, IPFIX_MAX_MTU, DEFAULT_IPFIX_MTU);
+        cfg->mtu = DEFAULT_IPFIX_MTU;
+    }
+
+    zlog_info(zc, "IPFIX config loaded from %s: collector %s:%u, %u workers, "
+              "active=%ums idle=%ums, sampling 1/%u",
+              path, cfg->collector, cfg->port, cfg->workers,
+              cfg->active_timeout_ms, cfg->idle_timeout_ms, cfg->sampling);
+    return AD_TUN_OK;
+}
+
+/* ---- Recording (worker threads) ---- */
+
+uint64_t ad_tun_ipfix_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static uint32_t ipfix_pow2(uint32_t n)
+{
+    uint32_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+static inline uint32_t ipfix_hash(const ipfix_key_t *k)
+{
+    return (uint32_t)ad_tun_hash_key40(k);
+}
+
+/* Build the flow key of one packet and its IP length; returns -1 if it carries no IP header */
+static int ipfix_key(const ad_tun_ipfix_t *ex, const unsigned char *p, size_t n, int dir,
+                     ipfix_key_t *k, uint32_t *len)
+{
+    if (ex->cfg.l2) {
+        int off = ad_tun_eth_ip_offset(p, n);
+        if (off < 0) return -1;
+        p += off;
+        n -= (size_t)off;
+    }
+
+    ad_tun_pkt_info_t info;
+    if (ad_tun_pkt_parse(p, n, &info) != 0) return -1;
+
+    memset(k, 0, sizeof(*k));
+    size_t alen = (info.family == AF_INET) ? 4 : 16;
+    memcpy(k->src, info.src, alen);
+    memcpy(k->dst, info.dst, alen);
+    if (!info.is_frag) {
+        k->sport = info.sport;
+        k->dport = info.dport;
+    }
+    k->proto = info.proto;
+    k->tos = info.tos;
+    k->dir = (uint8_t)dir;
+    k->family = (uint8_t)info.family;
+    *len = (uint32_t)n;
+    return 0;
+}
+
+/* Add one sampled packet to table t of worker w; returns -1 if the table is full */
+static int ipfix_wadd(ad_tun_ipfix_worker_t *w, unsigned t, const ipfix_key_t *k,
+                      uint32_t len, uint64_t now)
+{
+    ipfix_wslot_t *tab = w->tab[t];
+    uint32_t h = ipfix_hash(k);
+
+    for (uint32_t i = h & w->mask;; i = (i + 1) & w->mask) {
+        ipfix_wslot_t *s = &tab[i];
+        if (s->packets == 0) {
+            if (w->nused[t] == w->mask / 2 + 1) return -1;
+            s->key = *k;
+            s->hash = h;
+            s->packets = 1;
+            s->bytes = len;
+            s->first = now;
+            s->last = now;
+            w->used[t][w->nused[t]++] = i;
+            return 0;
+        }
+        if (s->hash == h && memcmp(&s->key, k, sizeof(*k)) == 0) {
+            s->packets++;
+            s->bytes += len;
+            s->last = now;
+            return 0;
+        }
+    }
+}
+
+/* Record n packets, each given by its data pointer and length */
+static void ipfix_record(ad_tun_ipfix_t *ex, ad_tun_ipfix_worker_t *w,
+                         const unsigned char *const *data, const size_t *lens,
+                         ad_tun_buf_t *const *bufs, unsigned n, int dir)
+{
+    /*
+     * busy is raised before the epoch is read: an exporter that bumps the
+     * epoch and then sees busy clear knows no call can still be writing
+     * into the old table. An exchange is a full barrier on its own (xchg),
+     * cheaper than the store-plus-fence of a seq_cst store.
+     */
+    (void)__atomic_exchange_n(&w->busy, 1, __ATOMIC_SEQ_CST);
+    unsigned t = __atomic_load_n(&w->epoch, __ATOMIC_SEQ_CST) & 1;
+
+    uint64_t now = ad_tun_ipfix_now_ms();
+    unsigned sampled = 0, unparsed = 0, full = 0;
+
+    for (unsigned i = 0; i < n; i++) {
+        if (--w->skip != 0) continue;
+        w->skip = ex->cfg.sampling;
+        sampled++;
+
+        const unsigned char *p = bufs ? bufs[i]->data : data[i];
+        size_t plen = bufs ? bufs[i]->len : lens[i];
+        ipfix_key_t k;
+        uint32_t len;
+        if (ipfix_key(ex, p, plen, dir, &k, &len) != 0) {
+            unparsed++;
+            continue;
+        }
+        if (ipfix_wadd(w, t, &k, len, now) != 0) full++;
+    }
+
+    /* Single writer: plain read-modify-write, atomic only towards readers */
+    __atomic_store_n(&w->packets, w->packets + n, __ATOMIC_RELAXED);
+    if (sampled) __atomic_store_n(&w->sampled, w->sampled + sampled, __ATOMIC_RELAXED);
+    if (unparsed) __atomic_store_n(&w->unparsed, w->unparsed + unparsed, __ATOMIC_RELAXED);
+    if (full) __atomic_store_n(&w->full, w->full + full, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&w->busy, 0, __ATOMIC_RELEASE);
+}
+
+void ad_tun_ipfix_record(ad_tun_ipfix_t *ex, unsigned w, ad_tun_buf_t *const *bufs,
+                         unsigned n, int dir)
+{
+    if (!ex || !ex->workers || w >= ex->cfg.workers || n == 0) return;
+    ipfix_record(ex, &ex->workers[w], NULL, NULL, bufs, n, dir);
+}
+
+void ad_tun_ipfix_packet(int dir, const void *pkt, size_t len)
+{
+    ad_tun_ipfix_t *ex = t_ipfix;
+    if (!ex) return;
+
+    const unsigned char *data = pkt;
+    ipfix_record(ex, &ex->workers[t_ipfix_worker], &data, &len, NULL, 1, dir);
+}
+
+ad_tun_error_t ad_tun_ipfix_bind(ad_tun_ipfix_t *ex, unsigned w)
+{
+    if (ex && (!ex->workers || w >= ex->cfg.workers)) {
+        zlog_error(zlog_get_category("ad_tun"), "ad_tun_ipfix_bind: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    if (ex && !t_ipfix) __atomic_add_fetch(&ad_tun_ipfix_bound, 1, __ATOMIC_RELAXED);
+    if (!ex && t_ipfix) __atomic_sub_fetch(&ad_tun_ipfix_bound, 1, __ATOMIC_RELAXED);
+    t_ipfix = ex;
+    t_ipfix_worker = w;
+    return AD_TUN_OK;
+}
+
+/* ---- Message building ---- */
+
+static void ipfix_put64(unsigned char *p, uint64_t v)
+{
+    ad_tun_put_be32(p, (uint32_t)(v >> 32));
+    ad_tun_put_be32(p + 4, (uint32_t)v);
+}
+
+/* Send the message being built, if it holds any set */
+static void ipfix_send(ad_tun_ipfix_t *ex, uint64_t now)
+{
+    if (ex->set_off) {
+        ad_tun_put_be16(ex->msg + ex->set_off + 2, (uint16_t)(ex->msg_len - ex->set_off));
+        ex->set_off = 0;
+    }
+    if (ex->msg_len <= IPFIX_HDR_LEN) return;
+
+    ad_tun_put_be16(ex->msg, IPFIX_VERSION);
+    ad_tun_put_be16(ex->msg + 2, (uint16_t)ex->msg_len);
+    ad_tun_put_be32(ex->msg + 4, (uint32_t)(now / 1000));
+    ad_tun_put_be32(ex->msg + 8, ex->seq);
+    ad_tun_put_be32(ex->msg + 12, ex->cfg.domain_id);
+
+    if (send(ex->fd, ex->msg, ex->msg_len, MSG_DONTWAIT) < 0) {
+        ex->stats.send_errors++;
+        zlog_debug(zlog_get_category("ad_tun"), "IPFIX export failed: %s", strerror(errno));
+    } else {
+        ex->stats.messages++;
+    }
+
+    /* The sequence number counts records handed to the transport, lost or not */
+    ex->seq += ex->msg_records;
+    ex->msg_records = 0;
+    ex->msg_len = IPFIX_HDR_LEN;
+}
+
+/* Make room for len bytes in a set of set_id, starting a new set or message as needed */
+static unsigned char *ipfix_reserve(ad_tun_ipfix_t *ex, uint16_t set_id, size_t len, uint64_t now)
+{
+    if (ex->set_off && ex->set_id == set_id && ex->msg_len + len <= ex->cfg.mtu) {
+        unsigned char *p = ex->msg + ex->msg_len;
+        ex->msg_len += len;
+        return p;
+    }
+
+    if (ex->set_off) {
+        ad_tun_put_be16(ex->msg + ex->set_off + 2, (uint16_t)(ex->msg_len - ex->set_off));
+        ex->set_off = 0;
+    }
+    if (ex->msg_len + IPFIX_SET_HDR_LEN + len > ex->cfg.mtu) ipfix_send(ex, now);
+
+    ex->set_off = ex->msg_len;
+    ex->set_id = set_id;
+    ad_tun_put_be16(ex->msg + ex->msg_len, set_id);
+    ex->msg_len += IPFIX_SET_HDR_LEN;
+
+    unsigned char *p = ex->msg + ex->msg_len;
+    ex->msg_len += len;
+    return p;
+}
+
+/* Information elements after the addresses, shared by both templates */
+static const uint16_t g_ipfix_tail[][2] = {
+    { 7, 2 },       /* sourceTransportPort */
+    { 11, 2 },      /* destinationTransportPort */
+    { 4, 1 },       /* protocolIdentifier */
+    { 5, 1 },       /* ipClassOfService */
+    { 61, 1 },      /* flowDirection */
+    { 136, 1 },     /* flowEndReason */
+    { 2, 8 },       /* packetDeltaCount */
+    { 1, 8 },       /* octetDeltaCount */
+    { 152, 8 },     /* flowStartMilliseconds */
+    { 153, 8 },     /* flowEndMilliseconds */
+    { 305, 4 },     /* samplingPacketInterval */
+};
+
+#define IPFIX_TAIL_FIELDS (sizeof(g_ipfix_tail) / sizeof(g_ipfix_tail[0]))
+#define IPFIX_TEMPLATE_LEN (4 + 4 * (2 + IPFIX_TAIL_FIELDS))
+
+static void ipfix_put_template(unsigned char *p, uint16_t id, uint16_t src_ie,
+                               uint16_t dst_ie, uint16_t alen)
+{
+    ad_tun_put_be16(p, id);
+    ad_tun_put_be16(p + 2, (uint16_t)(2 + IPFIX_TAIL_FIELDS));
+    p += 4;
+    ad_tun_put_be16(p, src_ie);
+    ad_tun_put_be16(p + 2, alen);
+    ad_tun_put_be16(p + 4, dst_ie);
+    ad_tun_put_be16(p + 6, alen);
+    p += 8;
+    for (size_t i = 0; i < IPFIX_TAIL_FIELDS; i++, p += 4) {
+        ad_tun_put_be16(p, g_ipfix_tail[i][0]);
+        ad_tun_put_be16(p + 2, g_ipfix_tail[i][1]);
+    }
+}
+
+/* Queue both templates if they were never sent or template_ms has passed */
+static void ipfix_templates(ad_tun_ipfix_t *ex, uint64_t now)
+{
+    if (ex->last_template && now - ex->last_template < ex->cfg.template_ms) return;
+
+    unsigned char *p = ipfix_reserve(ex, IPFIX_TEMPLATE_SET_ID, 2 * IPFIX_TEMPLATE_LEN, now);
+    ipfix_put_template(p, IPFIX_TEMPLATE_V4, 8, 12, 4);
+    ipfix_put_template(p + IPFIX_TEMPLATE_LEN, IPFIX_TEMPLATE_V6, 27, 28, 16);
+    ex->last_template = now ? now : 1;
+}
+
+/* Queue one data record */
+static void ipfix_export(ad_tun_ipfix_t *ex, const ipfix_key_t *k, uint64_t packets,
+                         uint64_t bytes, uint64_t first, uint64_t last, int reason, uint64_t now)
+{
+    int v4 = (k->family == AF_INET);
+    size_t alen = v4 ? 4 : 16;
+    unsigned char *p = ipfix_reserve(ex, v4 ? IPFIX_TEMPLATE_V4 : IPFIX_TEMPLATE_V6,
+                                     v4 ? IPFIX_REC_V4_LEN : IPFIX_REC_V6_LEN, now);
+
+    memcpy(p, k->src, alen);
+    memcpy(p + alen, k->dst, alen);
+    p += 2 * alen;
+    ad_tun_put_be16(p, k->sport);
+    ad_tun_put_be16(p + 2, k->dport);
+    p[4] = k->proto;
+    p[5] = k->tos;
+    p[6] = k->dir;
+    p[7] = (unsigned char)reason;
+    ipfix_put64(p + 8, packets);
+    ipfix_put64(p + 16, bytes);
+    ipfix_put64(p + 24, first);
+    ipfix_put64(p + 32, last);
+    ad_tun_put_be32(p + 40, ex->cfg.sampling);
+
+    ex->msg_records++;
+    ex->stats.records++;
+}
+
+/* ---- Flow cache (exporter) ---- */
+
+static int ipfix_cache_used(void *tab, uint32_t slot)
+{
+    return ((ad_tun_ipfix_flow_t *)tab)[slot].used;
+}
+
+static uint32_t ipfix_cache_home(void *tab, uint32_t slot)
+{
+    return ((ad_tun_ipfix_flow_t *)tab)[slot].hash;
+}
+
+static void ipfix_cache_move(void *tab, uint32_t dst, uint32_t src)
+{
+    ad_tun_ipfix_flow_t *flows = tab;
+    flows[dst] = flows[src];
+    flows[src].used = 0;
+}
+
+static const ad_tun_hash_lp_ops_t ipfix_cache_ops = { ipfix_cache_used, ipfix_cache_home, ipfix_cache_move };
+
+/* Remove cache slot i, shifting later entries of the probe run back */
+static void ipfix_cache_del(ad_tun_ipfix_t *ex, uint32_t i)
+{
+    ex->flows[i].used = 0;
+    ex->nflows--;
+    ad_tun_hash_lp_del(ex->flows, ex->fmask, i, &ipfix_cache_ops);
+}
+
+/* Fold one worker slot into the cache; exports it at once if the cache is full */
+static void ipfix_cache_add(ad_tun_ipfix_t *ex, const ipfix_wslot_t *s, uint64_t now)
+{
+    uint32_t i = s->hash & ex->fmask;
+    for (; ex->flows[i].used; i = (i + 1) & ex->fmask) {
+        ad_tun_ipfix_flow_t *f = &ex->flows[i];
+        if (f->hash != s->hash || memcmp(&f->key, &s->key, sizeof(s->key)) != 0) continue;
+        if (f->packets == 0 || s->first < f->first) f->first = s->first;
+        if (s->last > f->last) f->last = s->last;
+        f->packets += s->packets;
+        f->bytes += s->bytes;
+        return;
+    }
+
+    if (ex->nflows == ex->cfg.max_flows) {
+        ipfix_export(ex, &s->key, s->packets, s->bytes, s->first, s->last,
+                     AD_TUN_IPFIX_END_RESOURCES, now);
+        ex->stats.cache_full++;
+        return;
+    }
+
+    ad_tun_ipfix_flow_t *f = &ex->flows[i];
+    f->key = s->key;
+    f->hash = s->hash;
+    f->used = 1;
+    f->packets = s->packets;
+    f->bytes = s->bytes;
+    f->first = s->first;
+    f->last = s->last;
+    ex->nflows++;
+}
+
+/* Merge table t of worker w into the cache and clear it for reuse */
+static void ipfix_merge(ad_tun_ipfix_t *ex, ad_tun_ipfix_worker_t *w, unsigned t, uint64_t now)
+{
+    for (unsigned i = 0; i < w->nused[t]; i++) {
+        ipfix_wslot_t *s = &w->tab[t][w->used[t][i]];
+        ipfix_cache_add(ex, s, now);
+        s->packets = 0;
+    }
+    w->nused[t] = 0;
+    ex->stats.merges++;
+}
+
+/*
+ * Retire the worker's current table: bump the epoch, then merge the old
+ * table once the worker is seen outside ad_tun_ipfix_record(). A worker
+ * caught inside keeps the table pending until a later round.
+ */
+static void ipfix_rotate(ad_tun_ipfix_t *ex, ad_tun_ipfix_worker_t *w, uint64_t now)
+{
+    if (!w->pending) {
+        __atomic_store_n(&w->epoch, w->epoch + 1, __ATOMIC_SEQ_CST);
+        w->pending = 1;
+    }
+    if (__atomic_load_n(&w->busy, __ATOMIC_SEQ_CST)) {
+        ex->stats.merge_waits++;
+        return;
+    }
+    ipfix_merge(ex, w, (w->epoch - 1) & 1, now);
+    w->pending = 0;
+}
+
+/* Export flows past their timeouts; end every flow if force is set */
+static void ipfix_expire(ad_tun_ipfix_t *ex, uint64_t now, int force)
+{
+    uint32_t i = 0;
+    while (i <= ex->fmask) {
+        ad_tun_ipfix_flow_t *f = &ex->flows[i];
+        if (!f->used) {
+            i++;
+            continue;
+        }
+
+        int reason = 0;
+        if (force) {
+            reason = AD_TUN_IPFIX_END_FORCED;
+        } else if (now >= f->last && now - f->last >= ex->cfg.idle_timeout_ms) {
+            reason = AD_TUN_IPFIX_END_IDLE;
+        } else if (f->packets && now >= f->first && now - f->first >= ex->cfg.active_timeout_ms) {
+            ipfix_export(ex, &f->key, f->packets, f->bytes, f->first, f->last,
+                         AD_TUN_IPFIX_END_ACTIVE, now);
+            f->packets = 0;
+            f->bytes = 0;
+        }
+
+        if (!reason) {
+            i++;
+            continue;
+        }
+        /* A flow already reported by an active timeout and silent since has nothing left */
+        if (f->packets) {
+            ipfix_export(ex, &f->key, f->packets, f->bytes, f->first, f->last, reason, now);
+        }
+        /* The deletion may shift a later entry into slot i: look at it again */
+        ipfix_cache_del(ex, i);
+    }
+}
+
+void ad_tun_ipfix_poll(ad_tun_ipfix_t *ex, uint64_t now_ms)
+{
+    if (!ex || !ex->workers) return;
+    if (now_ms == 0) now_ms = ad_tun_ipfix_now_ms();
+
+    pthread_mutex_lock(&ex->lock);
+    ipfix_templates(ex, now_ms);
+    for (unsigned i = 0; i < ex->cfg.workers; i++) ipfix_rotate(ex, &ex->workers[i], now_ms);
+    ipfix_expire(ex, now_ms, 0);
+    ipfix_send(ex, now_ms);
+    pthread_mutex_unlock(&ex->lock);
+}
+
+void ad_tun_ipfix_flush(ad_tun_ipfix_t *ex)
+{
+    if (!ex || !ex->workers) return;
+    uint64_t now = ad_tun_ipfix_now_ms();
+
+    pthread_mutex_lock(&ex->lock);
+    ipfix_templates(ex, now);
+    for (unsigned i = 0; i < ex->cfg.workers; i++) {
+        ad_tun_ipfix_worker_t *w = &ex->workers[i];
+        ipfix_merge(ex, w, 0, now);
+        ipfix_merge(ex, w, 1, now);
+        w->pending = 0;
+    }
+    ipfix_expire(ex, now, 1);
+    ipfix_send(ex, now);
+    pthread_mutex_unlock(&ex->lock);
+
+    zlog_info(zlog_get_category("ad_tun"), "IPFIX flows flushed to %s:%u",
+              ex->cfg.collector, ex->cfg.port);
+}
+
+/* ---- Exporter thread ---- */
+
+static void *ipfix_thread(void *arg)
+{
+    ad_tun_ipfix_t *ex = arg;
+    struct pollfd pfd = { .fd = ex->wake_fd, .events = POLLIN };
+
+    for (;;) {
+        int rc = poll(&pfd, 1, (int)ex->cfg.interval_ms);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            zlog_error(zlog_get_category("ad_tun"), "IPFIX exporter poll() failed: %s",
+                       strerror(errno));
+            break;
+        }
+        if (rc > 0) break;
+        ad_tun_ipfix_poll(ex, 0);
+    }
+    return NULL;
+}
+
+/* ---- API ---- */
+
+ad_tun_error_t ad_tun_ipfix_init(ad_tun_ipfix_t *ex, const ad_tun_ipfix_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!ex || !cfg || cfg->collector[0] == '\0' || cfg->port == 0 ||
+        cfg->workers == 0 || cfg->workers > AD_TUN_IPFIX_MAX_WORKERS ||
+        cfg->worker_flows == 0 || cfg->worker_flows > IPFIX_MAX_WORKER_FLOWS ||
+        cfg->max_flows == 0 || cfg->max_flows > IPFIX_MAX_FLOWS ||
+        cfg->active_timeout_ms == 0 || cfg->idle_timeout_ms == 0 ||
+        cfg->interval_ms == 0 || cfg->template_ms == 0 || cfg->sampling == 0 ||
+        cfg->mtu < IPFIX_MIN_MTU || cfg->mtu > IPFIX_MAX_MTU) {
+        zlog_error(zc, "ad_tun_ipfix_init: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    memset(ex, 0, sizeof(*ex));
+    ex->cfg = *cfg;
+    ex->cfg.collector[sizeof(ex->cfg.collector) - 1] = '\0';
+    ex->fd = -1;
+    ex->wake_fd = -1;
+    ex->msg_len = IPFIX_HDR_LEN;
+
+    char port[8];
+    snprintf(port, sizeof(port), "%u", cfg->port);
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    int rc = getaddrinfo(ex->cfg.collector, port, &hints, &res);
+    if (rc != 0) {
+        zlog_error(zc, "ad_tun_ipfix_init: cannot resolve collector %s: %s",
+                   ex->cfg.collector, gai_strerror(rc));
+        return AD_TUN_ERR_CONFIG;
+    }
+    int err = 0;
+    for (struct addrinfo *ai = res; ai && ex->fd < 0; ai = ai->ai_next) {
+        ex->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (ex->fd >= 0 && connect(ex->fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            close(ex->fd);
+            ex->fd = -1;
+        }
+        if (ex->fd < 0) err = errno;
+    }
+    freeaddrinfo(res);
+    if (ex->fd < 0) {
+        zlog_error(zc, "ad_tun_ipfix_init: cannot reach collector %s:%u: %s",
+                   ex->cfg.collector, cfg->port, strerror(err));
+        return AD_TUN_ERR_SYS;
+    }
+
+    uint32_t wslots = ipfix_pow2(cfg->worker_flows * 2);
+    ex->fmask = ipfix_pow2(cfg->max_flows * 2) - 1;
+    ex->flows = calloc((size_t)ex->fmask + 1, sizeof(*ex->flows));
+    ex->msg = malloc(cfg->mtu);
+    if (!ex->flows || !ex->msg) goto fail;
+
+    if (posix_memalign((void**)&ex->workers, 64, cfg->workers * sizeof(*ex->workers)) != 0) {
+        ex->workers = NULL;
+        goto fail;
+    }
+    memset(ex->workers, 0, cfg->workers * sizeof(*ex->workers));
+    for (unsigned i = 0; i < cfg->workers; i++) {
+        ad_tun_ipfix_worker_t *w = &ex->workers[i];
+        w->mask = wslots - 1;
+        w->skip = 1;
+        for (unsigned t = 0; t < 2; t++) {
+            w->tab[t] = calloc(wslots, sizeof(*w->tab[t]));
+            /* Load stays at or under one half: nused stops at wslots / 2 */
+            w->used[t] = malloc((wslots / 2) * sizeof(*w->used[t]));
+            if (!w->tab[t] || !w->used[t]) goto fail;
+        }
+    }
+
+    pthread_mutex_init(&ex->lock, NULL);
+
+    zlog_info(zc, "IPFIX exporter initialized: collector %s:%u, %u workers x %u flows, "
+              "cache %u flows", ex->cfg.collector, cfg->port, cfg->workers, wslots / 2,
+              cfg->max_flows);
+    return AD_TUN_OK;
+
+fail:
+    zlog_error(zc, "ad_tun_ipfix_init: allocation failed");
+    if (ex->workers) {
+        for (unsigned i = 0; i < cfg->workers; i++) {
+            for (unsigned t = 0; t < 2; t++) {
+                free(ex->workers[i].tab[t]);
+                free(ex->workers[i].used[t]);
+            }
+        }
+    }
+    free(ex->workers);
+    free(ex->flows);
+    free(ex->msg);
+    close(ex->fd);
+    memset(ex, 0, sizeof(*ex));
+    ex->fd = -1;
+    ex->wake_fd = -1;
+    return AD_TUN_ERR_SYS;
+}
+
+void ad_tun_ipfix_free(ad_tun_ipfix_t *ex)
+{
+    if (!ex || !ex->workers) return;
+
+    ad_tun_ipfix_stop(ex);
+
+    for (unsigned i = 0; i < ex->cfg.workers; i++) {
+        for (unsigned t = 0; t < 2; t++) {
+            free(ex->workers[i].tab[t]);
+            free(ex->workers[i].used[t]);
+        }
+    }
+    free(ex->workers);
+    free(ex->flows);
+    free(ex->msg);
+    close(ex->fd);
+    pthread_mutex_destroy(&ex->lock);
+    memset(ex, 0, sizeof(*ex));
+    ex->fd = -1;
+    ex->wake_fd = -1;
+}
+
+ad_tun_error_t ad_tun_ipfix_start(ad_tun_ipfix_t *ex)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!ex || !ex->workers) return AD_TUN_ERR_CONFIG;
+    if (ex->running) return AD_TUN_ERR_INVALID_STATE;
+
+    ex->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (ex->wake_fd < 0) {
+        zlog_error(zc, "ad_tun_ipfix_start: eventfd() failed: %s", strerror(errno));
+        return AD_TUN_ERR_SYS;
+    }
+    if (pthread_create(&ex->thread, NULL, ipfix_thread, ex) != 0) {
+        zlog_error(zc, "ad_tun_ipfix_start: pthread_create() failed");
+        close(ex->wake_fd);
+        ex->wake_fd = -1;
+        return AD_TUN_ERR_SYS;
+    }
+
+    ex->running = 1;
+    zlog_info(zc, "IPFIX exporter started, every %ums", ex->cfg.interval_ms);
+    return AD_TUN_OK;
+}
+
+void ad_tun_ipfix_stop(ad_tun_ipfix_t *ex)
+{
+    if (!ex || !ex->running) return;
+
+    uint64_t one = 1;
+    if (write(ex->wake_fd, &one, sizeof(one)) < 0) {
+        zlog_warn(zlog_get_category("ad_tun"), "ad_tun_ipfix_stop: wake-up failed: %s",
+                  strerror(errno));
+    }
+    pthread_join(ex->thread, NULL);
+
+    close(ex->wake_fd);
+    ex->wake_fd = -1;
+    ex->running = 0;
+    zlog_info(zlog_get_category("ad_tun"), "IPFIX exporter stopped");
+}
+
+void ad_tun_ipfix_get_stats(ad_tun_ipfix_t *ex, ad_tun_ipfix_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (!ex || !ex->workers) return;
+
+    pthread_mutex_lock(&ex->lock);
+    *stats = ex->stats;
+    stats->flows = ex->nflows;
+    pthread_mutex_unlock(&ex->lock);
+
+    for (unsigned i = 0; i < ex->cfg.workers; i++) {
+        ad_tun_ipfix_worker_t *w = &ex->workers[i];
+        stats->packets += __atomic_load_n(&w->packets, __ATOMIC_RELAXED);
+        stats->sampled += __atomic_load_n(&w->sampled, __ATOMIC_RELAXED);
+        stats->unparsed += __atomic_load_n(&w->unparsed, __ATOMIC_RELAXED);
+        stats->worker_full += __atomic_load_n(&w->full, __ATOMIC_RELAXED);
+    }
+}
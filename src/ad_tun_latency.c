@@ -0,0 +1,237 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Latency            **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_latency.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define LAT_CALIBRATE_NS 10000000       /* calibration interval */
+#define LAT_DIRECT (2u << AD_TUN_LAT_SUB_BITS)
+
+/* Histograms of one thread; written only by that thread */
+typedef struct lat_thread {
+    ad_tun_lat_hist_t hist[AD_TUN_LAT_STAGES];
+    unsigned gen;                       /* reset generation the data belongs to */
+    struct lat_thread *prev;
+    struct lat_thread *next;
+} lat_thread_t;
+
+static const char *const g_stage_names[AD_TUN_LAT_STAGES] = {
+    "read", "reasm", "gro", "shaper", "encrypt", "decrypt", "wq", "frag", "write", "total", "app"
+};
+
+static pthread_once_t g_lat_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_lat_key;
+static pthread_mutex_t g_lat_lock = PTHREAD_MUTEX_INITIALIZER;
+static lat_thread_t *g_lat_threads;                 /* live threads */
+static ad_tun_lat_hist_t g_lat_retired[AD_TUN_LAT_STAGES];  /* data of exited threads */
+static unsigned g_lat_gen;
+static uint64_t g_lat_mult;                         /* ns per tick, 32.32 fixed point */
+static _Thread_local lat_thread_t *t_lat;
+
+int ad_tun_lat_enabled(void)
+{
+#ifdef AD_TUN_LATENCY
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+static uint64_t lat_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void ad_tun_lat_calibrate(void)
+{
+    uint64_t c0 = lat_clock_ns();
+    uint64_t t0 = ad_tun_lat_ticks();
+
+    struct timespec pause = { 0, LAT_CALIBRATE_NS };
+    nanosleep(&pause, NULL);
+
+    uint64_t c1 = lat_clock_ns();
+    uint64_t t1 = ad_tun_lat_ticks();
+
+    uint64_t ticks = t1 - t0;
+    uint64_t mult = ticks ? (uint64_t)(((unsigned __int128)(c1 - c0) << 32) / ticks) : (1ULL << 32);
+    __atomic_store_n(&g_lat_mult, mult, __ATOMIC_RELAXED);
+
+    zlog_debug(zlog_get_category("ad_tun"), "Latency clock calibrated: %.3f ticks/ns",
+               (double)ticks / (double)(c1 - c0));
+}
+
+/* Fold the data of an exiting thread into the retired histograms */
+static void lat_thread_exit(void *arg)
+{
+    lat_thread_t *t = arg;
+
+    pthread_mutex_lock(&g_lat_lock);
+    if (t->gen == g_lat_gen) {
+        for (unsigned s = 0; s < AD_TUN_LAT_STAGES; s++) ad_tun_lat_merge(&g_lat_retired[s], &t->hist[s]);
+    }
+    if (t->prev) t->prev->next = t->next;
+    else g_lat_threads = t->next;
+    if (t->next) t->next->prev = t->prev;
+    pthread_mutex_unlock(&g_lat_lock);
+
+    free(t);
+}
+
+static void lat_once(void)
+{
+    pthread_key_create(&g_lat_key, lat_thread_exit);
+    ad_tun_lat_calibrate();
+}
+
+uint64_t ad_tun_lat_ticks_to_ns(uint64_t ticks)
+{
+    pthread_once(&g_lat_once, lat_once);
+    return (uint64_t)(((unsigned __int128)ticks * __atomic_load_n(&g_lat_mult, __ATOMIC_RELAXED)) >> 32);
+}
+
+/* Register the calling thread on its first recording */
+static lat_thread_t *lat_thread_get(void)
+{
+    if (t_lat) return t_lat;
+
+    pthread_once(&g_lat_once, lat_once);
+
+    lat_thread_t *t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+
+    pthread_mutex_lock(&g_lat_lock);
+    t->gen = g_lat_gen;
+    t->next = g_lat_threads;
+    if (g_lat_threads) g_lat_threads->prev = t;
+    g_lat_threads = t;
+    pthread_mutex_unlock(&g_lat_lock);
+
+    pthread_setspecific(g_lat_key, t);
+    t_lat = t;
+    return t;
+}
+
+static inline unsigned lat_index(uint64_t v)
+{
+    if (v < LAT_DIRECT) return (unsigned)v;
+
+    unsigned msb = 63u - (unsigned)__builtin_clzll(v);
+    unsigned shift = msb - AD_TUN_LAT_SUB_BITS;
+    return shift * (1u << AD_TUN_LAT_SUB_BITS) + (unsigned)(v >> shift);
+}
+
+/* Highest value that falls into bucket idx */
+static uint64_t lat_bucket_high(unsigned idx)
+{
+    if (idx < LAT_DIRECT) return idx;
+
+    unsigned shift = idx / (1u << AD_TUN_LAT_SUB_BITS) - 1;
+    uint64_t sub = (idx % (1u << AD_TUN_LAT_SUB_BITS)) + (1u << AD_TUN_LAT_SUB_BITS);
+    return ((sub + 1) << shift) - 1;
+}
+
+void ad_tun_lat_record(ad_tun_lat_stage_t stage, uint64_t ns)
+{
+    if ((unsigned)stage >= AD_TUN_LAT_STAGES) return;
+
+    lat_thread_t *t = lat_thread_get();
+    if (!t) return;
+
+    /* A reset happened since our last recording: start over */
+    unsigned gen = __atomic_load_n(&g_lat_gen, __ATOMIC_ACQUIRE);
+    if (t->gen != gen) {
+        memset(t->hist, 0, sizeof(t->hist));
+        __atomic_store_n(&t->gen, gen, __ATOMIC_RELEASE);
+    }
+
+    /* Single writer: plain increments published with relaxed stores */
+    ad_tun_lat_hist_t *h = &t->hist[stage];
+    unsigned i = lat_index(ns);
+    __atomic_store_n(&h->buckets[i], h->buckets[i] + 1, __ATOMIC_RELAXED);
+    if (h->count == 0 || ns < h->min_ns) __atomic_store_n(&h->min_ns, ns, __ATOMIC_RELAXED);
+    if (ns > h->max_ns) __atomic_store_n(&h->max_ns, ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->sum_ns, h->sum_ns + ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+}
+
+void ad_tun_lat_record_ticks(ad_tun_lat_stage_t stage, uint64_t ticks)
+{
+    ad_tun_lat_record(stage, ad_tun_lat_ticks_to_ns(ticks));
+}
+
+void ad_tun_lat_merge(ad_tun_lat_hist_t *dst, const ad_tun_lat_hist_t *src)
+{
+    uint64_t count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    if (count == 0) return;
+
+    uint64_t min = __atomic_load_n(&src->min_ns, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&src->max_ns, __ATOMIC_RELAXED);
+    if (dst->count == 0 || min < dst->min_ns) dst->min_ns = min;
+    if (max > dst->max_ns) dst->max_ns = max;
+
+    dst->count += count;
+    dst->sum_ns += __atomic_load_n(&src->sum_ns, __ATOMIC_RELAXED);
+    for (unsigned i = 0; i < AD_TUN_LAT_BUCKETS; i++) {
+        dst->buckets[i] += __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+    }
+}
+
+void ad_tun_lat_snapshot(ad_tun_lat_hist_t *out)
+{
+    if (!out) return;
+    memset(out, 0, sizeof(*out) * AD_TUN_LAT_STAGES);
+
+    pthread_mutex_lock(&g_lat_lock);
+    for (unsigned s = 0; s < AD_TUN_LAT_STAGES; s++) ad_tun_lat_merge(&out[s], &g_lat_retired[s]);
+
+    /* Threads that have not noticed a reset yet hold stale data */
+    for (lat_thread_t *t = g_lat_threads; t; t = t->next) {
+        if (__atomic_load_n(&t->gen, __ATOMIC_ACQUIRE) != g_lat_gen) continue;
+        for (unsigned s = 0; s < AD_TUN_LAT_STAGES; s++) ad_tun_lat_merge(&out[s], &t->hist[s]);
+    }
+    pthread_mutex_unlock(&g_lat_lock);
+}
+
+uint64_t ad_tun_lat_percentile(const ad_tun_lat_hist_t *h, double pct)
+{
+    if (!h || h->count == 0) return 0;
+    if (pct < 0) pct = 0;
+    if (pct > 100) pct = 100;
+
+    uint64_t rank = (uint64_t)((double)h->count * pct / 100.0 + 0.5);
+    if (rank == 0) rank = 1;
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < AD_TUN_LAT_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t v = lat_bucket_high(i);
+            return (v > h->max_ns) ? h->max_ns : v;
+        }
+    }
+    return h->max_ns;
+}
+
+void ad_tun_lat_reset(void)
+{
+    pthread_mutex_lock(&g_lat_lock);
+    memset(g_lat_retired, 0, sizeof(g_lat_retired));
+    __atomic_store_n(&g_lat_gen, g_lat_gen + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_lat_lock);
+}
+
+const char *ad_tun_lat_stage_name(ad_tun_lat_stage_t stage)
+{
+    return ((unsigned)stage < AD_TUN_LAT_STAGES) ? g_stage_names[stage] : "unknown";
+}
@@ -0,0 +1,661 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Manager            **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#define _GNU_SOURCE
+
+#include "../include/ad_tun_mgr.h"
+#include "../include/ad_tun_nl.h"
+#include "../include/ad_tun_eth.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <linux/rtnetlink.h>
+
+#define DEFAULT_MGR_MTU 1500
+#define MGR_INITIAL_CAP 64
+
+/* Work shared by the creation / teardown threads */
+typedef struct {
+    ad_tun_mgr_t *mgr;
+    unsigned *idx;              /* tunnels to process */
+    unsigned n;
+    unsigned next;              /* claimed with an atomic increment */
+    int create;                 /* 1 = open devices, 0 = close them */
+} mgr_job_t;
+
+/* Owner of each netlink request of a start, to attribute failures */
+typedef struct {
+    ad_tun_mgr_t *mgr;
+    uint32_t base;
+    unsigned *owner;
+} mgr_nl_ctx_t;
+
+static uint64_t mgr_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* FNV-1a of an interface name */
+static uint32_t mgr_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void ad_tun_mgr_default_config(ad_tun_mgr_config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+}
+
+ad_tun_error_t ad_tun_mgr_init(ad_tun_mgr_t *mgr, const ad_tun_mgr_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!mgr) {
+        zlog_error(zc, "ad_tun_mgr_init: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    memset(mgr, 0, sizeof(*mgr));
+    if (cfg) mgr->cfg = *cfg;
+    else ad_tun_mgr_default_config(&mgr->cfg);
+
+    if (mgr->cfg.threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        mgr->cfg.threads = (cpus > 0) ? (unsigned)cpus : 1;
+    }
+    if (mgr->cfg.threads > AD_TUN_MGR_MAX_THREADS) mgr->cfg.threads = AD_TUN_MGR_MAX_THREADS;
+
+    mgr->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (mgr->epfd < 0) {
+        zlog_error(zc, "ad_tun_mgr_init: epoll_create1() failed: %s", strerror(errno));
+        return AD_TUN_ERR_SYS;
+    }
+
+    zlog_debug(zc, "Tunnel manager initialized with %u threads", mgr->cfg.threads);
+    return AD_TUN_OK;
+}
+
+void ad_tun_mgr_free(ad_tun_mgr_t *mgr)
+{
+    if (!mgr) return;
+
+    ad_tun_mgr_stop_all(mgr);
+    for (unsigned i = 0; i < mgr->count; i++) ad_tun_free_config(&mgr->tuns[i].cfg);
+    if (mgr->epfd >= 0) close(mgr->epfd);
+    free(mgr->tuns);
+    free(mgr->names);
+    memset(mgr, 0, sizeof(*mgr));
+    mgr->epfd = -1;
+}
+
+/* ---- Name index ---- */
+
+static void mgr_index_insert(unsigned *names, unsigned cap, const char *name, unsigned idx)
+{
+    unsigned slot = mgr_hash(name) & (cap - 1);
+    while (names[slot]) slot = (slot + 1) & (cap - 1);
+    names[slot] = idx + 1;
+}
+
+/* Keep the index at most half full */
+static int mgr_index_grow(ad_tun_mgr_t *mgr)
+{
+    if ((mgr->count + 1) * 2 <= mgr->names_cap) return 0;
+
+    unsigned cap = mgr->names_cap ? mgr->names_cap * 2 : MGR_INITIAL_CAP * 2;
+    unsigned *names = calloc(cap, sizeof(*names));
+    if (!names) return -ENOMEM;
+
+    for (unsigned i = 0; i < mgr->count; i++) {
+        mgr_index_insert(names, cap, mgr->tuns[i].cfg.ifname, i);
+    }
+    free(mgr->names);
+    mgr->names = names;
+    mgr->names_cap = cap;
+    return 0;
+}
+
+int ad_tun_mgr_find(const ad_tun_mgr_t *mgr, const char *ifname)
+{
+    if (!mgr || !ifname || mgr->names_cap == 0) return -1;
+
+    unsigned slot = mgr_hash(ifname) & (mgr->names_cap - 1);
+    while (mgr->names[slot]) {
+        unsigned idx = mgr->names[slot] - 1;
+        if (strcmp(mgr->tuns[idx].cfg.ifname, ifname) == 0) return (int)idx;
+        slot = (slot + 1) & (mgr->names_cap - 1);
+    }
+    return -1;
+}
+
+/* ---- Declaration ---- */
+
+int ad_tun_mgr_add(ad_tun_mgr_t *mgr, const ad_tun_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!mgr || !cfg || !cfg->ifname || cfg->ifname[0] == '\0' || strlen(cfg->ifname) >= IFNAMSIZ) {
+        zlog_error(zc, "ad_tun_mgr_add: invalid interface name");
+        return -EINVAL;
+    }
+
+    int family;
+    unsigned char addr[16];
+    unsigned plen;
+    if ((cfg->ipv4 && ad_tun_nl_parse_prefix(cfg->ipv4, &family, addr, &plen) != 0) ||
+        (cfg->ipv6 && ad_tun_nl_parse_prefix(cfg->ipv6, &family, addr, &plen) != 0)) {
+        zlog_error(zc, "ad_tun_mgr_add: %s: invalid address", cfg->ifname);
+        return -EINVAL;
+    }
+    uint8_t mac[AD_TUN_ETH_ALEN];
+    if (cfg->mac && ad_tun_eth_parse_mac(cfg->mac, mac) != 0) {
+        zlog_error(zc, "ad_tun_mgr_add: %s: invalid MAC address", cfg->ifname);
+        return -EINVAL;
+    }
+
+    if (ad_tun_mgr_find(mgr, cfg->ifname) >= 0) {
+        zlog_error(zc, "ad_tun_mgr_add: %s declared twice", cfg->ifname);
+        return -EEXIST;
+    }
+
+    if (mgr->count == mgr->cap) {
+        unsigned cap = mgr->cap ? mgr->cap * 2 : MGR_INITIAL_CAP;
+        ad_tun_mgr_tun_t *tuns = realloc(mgr->tuns, cap * sizeof(*tuns));
+        if (!tuns) return -ENOMEM;
+        mgr->tuns = tuns;
+        mgr->cap = cap;
+    }
+    if (mgr_index_grow(mgr) != 0) return -ENOMEM;
+
+    ad_tun_mgr_tun_t *t = &mgr->tuns[mgr->count];
+    memset(t, 0, sizeof(*t));
+    t->cfg = *cfg;
+    t->cfg.ifname = strdup(cfg->ifname);
+    t->cfg.ipv4 = cfg->ipv4 ? strdup(cfg->ipv4) : NULL;
+    t->cfg.ipv6 = cfg->ipv6 ? strdup(cfg->ipv6) : NULL;
+    t->cfg.mac = cfg->mac ? strdup(cfg->mac) : NULL;
+    if (!t->cfg.ifname || (cfg->ipv4 && !t->cfg.ipv4) || (cfg->ipv6 && !t->cfg.ipv6) ||
+        (cfg->mac && !t->cfg.mac)) {
+        ad_tun_free_config(&t->cfg);
+        return -ENOMEM;
+    }
+    if (t->cfg.mtu <= 0) t->cfg.mtu = DEFAULT_MGR_MTU;
+    if (t->cfg.offload || t->cfg.fragment || t->cfg.reassemble || t->cfg.queues > 1) {
+        zlog_warn(zc, "ad_tun_mgr_add: %s: offload/fragment/reassemble/queues only apply to ad_tun_start()",
+                  t->cfg.ifname);
+    }
+    t->fd = -1;
+    t->state = AD_TUN_MGR_DOWN;
+
+    mgr_index_insert(mgr->names, mgr->names_cap, t->cfg.ifname, mgr->count);
+    return (int)mgr->count++;
+}
+
+static int mgr_ini_filter(const struct dirent *d)
+{
+    size_t len = strlen(d->d_name);
+    return len > 4 && strcmp(d->d_name + len - 4, ".ini") == 0;
+}
+
+int ad_tun_mgr_load_file(ad_tun_mgr_t *mgr, const char *path)
+{
+    if (!mgr || !path) return -EINVAL;
+
+    ad_tun_config_set_t set;
+    if (ad_tun_load_config_set(path, &set) != AD_TUN_OK) return -EINVAL;
+
+    int added = 0;
+    for (unsigned i = 0; i < set.count; i++) {
+        int rc = ad_tun_mgr_add(mgr, &set.tuns[i]);
+        if (rc == -ENOMEM) {
+            added = rc;
+            break;
+        }
+        if (rc >= 0) added++;
+    }
+    ad_tun_free_config_set(&set);
+    return added;
+}
+
+int ad_tun_mgr_load_dir(ad_tun_mgr_t *mgr, const char *path)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!mgr || !path) return -EINVAL;
+
+    struct dirent **list;
+    int n = scandir(path, &list, mgr_ini_filter, alphasort);
+    if (n < 0) {
+        int err = errno;
+        zlog_error(zc, "ad_tun_mgr_load_dir: cannot read %s: %s", path, strerror(err));
+        return -err;
+    }
+
+    int added = 0;
+    for (int i = 0; i < n; i++) {
+        char file[4096];
+        snprintf(file, sizeof(file), "%s/%s", path, list[i]->d_name);
+        free(list[i]);
+
+        int rc = ad_tun_mgr_load_file(mgr, file);
+        if (rc < 0) zlog_warn(zc, "ad_tun_mgr_load_dir: skipping %s", file);
+        else added += rc;
+    }
+    free(list);
+
+    zlog_info(zc, "Loaded %d tunnel configs from %s", added, path);
+    return added;
+}
+
+const ad_tun_mgr_tun_t *ad_tun_mgr_get(const ad_tun_mgr_t *mgr, unsigned idx)
+{
+    return (mgr && idx < mgr->count) ? &mgr->tuns[idx] : NULL;
+}
+
+/* ---- Device creation / teardown ---- */
+
+/* Open the device of one tunnel; returns 0 or a positive errno */
+static int mgr_open_one(ad_tun_mgr_tun_t *t, int sock)
+{
+    int fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return errno;
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = (t->cfg.mode == AD_TUN_MODE_TAP ? IFF_TAP : IFF_TUN) | IFF_NO_PI;
+    strncpy(ifr.ifr_name, t->cfg.ifname, IFNAMSIZ - 1);
+
+    if (ioctl(fd, TUNSETIFF, &ifr) < 0 ||
+        (t->cfg.persist && ioctl(fd, TUNSETPERSIST, 1) < 0) ||
+        ioctl(sock, SIOCGIFINDEX, &ifr) < 0) {
+        int err = errno;
+        close(fd);
+        return err;
+    }
+
+    t->ifindex = ifr.ifr_ifindex;
+    t->fd = fd;
+    return 0;
+}
+
+static void *mgr_worker(void *arg)
+{
+    mgr_job_t *job = arg;
+    int sock = job->create ? socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0) : -1;
+
+    for (;;) {
+        unsigned i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->n) break;
+
+        ad_tun_mgr_tun_t *t = &job->mgr->tuns[job->idx[i]];
+        if (job->create) {
+            t->err = (sock < 0) ? EMFILE : mgr_open_one(t, sock);
+            t->state = t->err ? AD_TUN_MGR_FAILED : AD_TUN_MGR_UP;
+        } else {
+            close(t->fd);
+            t->fd = -1;
+            t->ifindex = 0;
+            t->state = AD_TUN_MGR_DOWN;
+        }
+    }
+
+    if (sock >= 0) close(sock);
+    return NULL;
+}
+
+/* Run a job on the calling thread plus up to threads - 1 helpers */
+static void mgr_run(ad_tun_mgr_t *mgr, mgr_job_t *job)
+{
+    pthread_t tids[AD_TUN_MGR_MAX_THREADS];
+    unsigned want = mgr->cfg.threads;
+    if (want > job->n) want = job->n;
+
+    unsigned started = 0;
+    for (unsigned i = 1; i < want; i++) {
+        if (pthread_create(&tids[started], NULL, mgr_worker, job) != 0) break;
+        started++;
+    }
+    mgr_worker(job);
+    for (unsigned i = 0; i < started; i++) pthread_join(tids[i], NULL);
+}
+
+static void mgr_nl_error(void *arg, uint32_t seq, int err)
+{
+    mgr_nl_ctx_t *ctx = arg;
+    ad_tun_mgr_tun_t *t = &ctx->mgr->tuns[ctx->owner[seq - ctx->base]];
+
+    zlog_warn(zlog_get_category("ad_tun"), "Failed to configure %s: %s", t->cfg.ifname, strerror(err));
+    t->err = err;
+}
+
+/* Queue link and address setup of one tunnel, recording request owners */
+static int mgr_queue_config(ad_tun_nl_t *nl, mgr_nl_ctx_t *ctx, unsigned idx)
+{
+    ad_tun_mgr_tun_t *t = &ctx->mgr->tuns[idx];
+    const char *addrs[2] = { t->cfg.ipv4, t->cfg.ipv6 };
+    uint32_t seq;
+
+    /*
+     * Without an IPv6 address skip IPv6 link-local generation, which must
+     * happen before the link comes up; addrconf work per device otherwise
+     * dominates configuration time with thousands of tunnels.
+     */
+    if (!t->cfg.ipv6) {
+        struct {
+            struct rtattr af;
+            struct rtattr mode;
+            uint32_t value;         /* u8 attribute padded to 4 bytes */
+        } spec;
+        memset(&spec, 0, sizeof(spec));
+        spec.af.rta_type = AF_INET6;
+        spec.af.rta_len = sizeof(spec);
+        spec.mode.rta_type = IFLA_INET6_ADDR_GEN_MODE;
+        spec.mode.rta_len = RTA_LENGTH(1);
+        spec.value = IN6_ADDR_GEN_MODE_NONE;
+
+        seq = ad_tun_nl_link_set(nl, t->ifindex, 0, -1);
+        if (!seq || ad_tun_nl_attr(nl, IFLA_AF_SPEC, &spec, sizeof(spec)) != 0) return -ENOMEM;
+        ctx->owner[seq - ctx->base] = idx;
+    }
+
+    seq = ad_tun_nl_link_set(nl, t->ifindex, (unsigned)t->cfg.mtu, 1);
+    if (!seq) return -ENOMEM;
+    ctx->owner[seq - ctx->base] = idx;
+    if (ctx->mgr->cfg.group && ad_tun_nl_attr(nl, IFLA_GROUP, &ctx->mgr->cfg.group, sizeof(uint32_t)) != 0) {
+        return -ENOMEM;
+    }
+    uint8_t mac[AD_TUN_ETH_ALEN];
+    if (t->cfg.mode == AD_TUN_MODE_TAP && t->cfg.mac && ad_tun_eth_parse_mac(t->cfg.mac, mac) == 0 &&
+        ad_tun_nl_attr(nl, IFLA_ADDRESS, mac, sizeof(mac)) != 0) {
+        return -ENOMEM;
+    }
+
+    for (int a = 0; a < 2; a++) {
+        int family;
+        unsigned char addr[16];
+        unsigned plen;
+        if (!addrs[a] || ad_tun_nl_parse_prefix(addrs[a], &family, addr, &plen) != 0) continue;
+
+        seq = ad_tun_nl_addr(nl, 1, t->ifindex, family, addr, plen);
+        if (!seq) return -ENOMEM;
+        ctx->owner[seq - ctx->base] = idx;
+    }
+    return 0;
+}
+
+int ad_tun_mgr_start(ad_tun_mgr_t *mgr, unsigned first, unsigned n)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!mgr || first > mgr->count || n > mgr->count - first) return -EINVAL;
+
+    unsigned *idx = malloc((n ? n : 1) * sizeof(*idx));
+    unsigned *owner = malloc((n ? n : 1) * 4 * sizeof(*owner));
+    if (!idx || !owner) {
+        free(idx);
+        free(owner);
+        return -ENOMEM;
+    }
+
+    unsigned todo = 0;
+    for (unsigned i = first; i < first + n; i++) {
+        if (mgr->tuns[i].state != AD_TUN_MGR_UP) idx[todo++] = i;
+    }
+
+    /* Phase 1: create devices in parallel */
+    uint64_t t0 = mgr_now_ns();
+    mgr_job_t job = { .mgr = mgr, .idx = idx, .n = todo, .next = 0, .create = 1 };
+    mgr_run(mgr, &job);
+    uint64_t t1 = mgr_now_ns();
+
+    /* Phase 2: one netlink transaction for every link and address */
+    ad_tun_nl_t nl;
+    int up = 0;
+    int rc = -EIO;
+    if (ad_tun_nl_open(&nl) == AD_TUN_OK) {
+        mgr_nl_ctx_t ctx = { .mgr = mgr, .base = nl.seq + 1, .owner = owner };
+        for (unsigned i = 0; i < todo; i++) {
+            ad_tun_mgr_tun_t *t = &mgr->tuns[idx[i]];
+            if (t->state == AD_TUN_MGR_UP && mgr_queue_config(&nl, &ctx, idx[i]) != 0) {
+                zlog_warn(zc, "Failed to configure %s: %s", t->cfg.ifname, strerror(ENOMEM));
+                t->err = ENOMEM;
+            }
+        }
+        rc = ad_tun_nl_commit(&nl, mgr_nl_error, &ctx);
+        if (rc < 0) zlog_error(zc, "ad_tun_mgr_start: netlink transaction failed: %s", strerror(-rc));
+        ad_tun_nl_close(&nl);
+    }
+    uint64_t t2 = mgr_now_ns();
+
+    /* Phase 3: shared epoll set */
+    for (unsigned i = 0; i < todo; i++) {
+        ad_tun_mgr_tun_t *t = &mgr->tuns[idx[i]];
+        if (t->state != AD_TUN_MGR_UP) {
+            zlog_warn(zc, "Failed to create %s: %s", t->cfg.ifname, strerror(t->err));
+            continue;
+        }
+        /* A device left down or without its addresses is not up */
+        if (rc < 0 && !t->err) t->err = -rc;
+        if (t->err) {
+            close(t->fd);
+            t->fd = -1;
+            t->ifindex = 0;
+            t->state = AD_TUN_MGR_FAILED;
+            continue;
+        }
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = idx[i] };
+        if (epoll_ctl(mgr->epfd, EPOLL_CTL_ADD, t->fd, &ev) < 0) {
+            zlog_warn(zc, "Failed to watch %s: %s", t->cfg.ifname, strerror(errno));
+        }
+        up++;
+    }
+
+    mgr->create_ns = t1 - t0;
+    mgr->config_ns = t2 - t1;
+    free(idx);
+    free(owner);
+
+    zlog_info(zc, "Started %d/%u tunnels (create %.1f ms, configure %.1f ms)",
+              up, todo, (double)mgr->create_ns / 1e6, (double)mgr->config_ns / 1e6);
+    return up;
+}
+
+int ad_tun_mgr_start_all(ad_tun_mgr_t *mgr)
+{
+    if (!mgr) return -EINVAL;
+    return ad_tun_mgr_start(mgr, 0, mgr->count);
+}
+
+static unsigned mgr_open_count(const ad_tun_mgr_t *mgr)
+{
+    unsigned open = 0;
+    for (unsigned i = 0; i < mgr->count; i++) open += (mgr->tuns[i].fd >= 0);
+    return open;
+}
+
+/* Links of the group found by a dump, to tell foreign members apart */
+typedef struct {
+    uint32_t group;
+    const int *owned;           /* sorted ifindexes of the open tunnels */
+    unsigned nowned;
+    unsigned foreign;
+} mgr_group_ctx_t;
+
+static int mgr_cmp_int(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static int mgr_group_cb(void *arg, const struct nlmsghdr *h)
+{
+    mgr_group_ctx_t *ctx = arg;
+    if (h->nlmsg_type != RTM_NEWLINK) return 0;
+
+    const struct ifinfomsg *ifi = NLMSG_DATA(h);
+    int len = (int)h->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+    for (const struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type != IFLA_GROUP || *(const uint32_t *)RTA_DATA(rta) != ctx->group) continue;
+        if (!bsearch(&ifi->ifi_index, ctx->owned, ctx->nowned, sizeof(int), mgr_cmp_int)) {
+            ctx->foreign++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Delete every link of the manager's device group; fds are closed afterwards.
+ * RTM_DELLINK by group takes any link in it, so this only happens when a
+ * dump shows the group holds nothing but the manager's own tunnels.
+ */
+static void mgr_delete_group(ad_tun_mgr_t *mgr)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+    ad_tun_nl_t nl;
+
+    int *owned = malloc((mgr->count ? mgr->count : 1) * sizeof(*owned));
+    if (!owned) return;
+    unsigned nowned = 0;
+    for (unsigned i = 0; i < mgr->count; i++) {
+        if (mgr->tuns[i].fd >= 0) owned[nowned++] = mgr->tuns[i].ifindex;
+    }
+    qsort(owned, nowned, sizeof(*owned), mgr_cmp_int);
+
+    if (ad_tun_nl_open(&nl) != AD_TUN_OK) {
+        free(owned);
+        return;
+    }
+
+    mgr_group_ctx_t gctx = { .group = mgr->cfg.group, .owned = owned, .nowned = nowned, .foreign = 0 };
+    int drc = ad_tun_nl_dump(&nl, RTM_GETLINK, AF_UNSPEC, mgr_group_cb, &gctx);
+    free(owned);
+    if (drc != 0 || gctx.foreign) {
+        zlog_warn(zc, "Device group %u %s, closing devices one by one", mgr->cfg.group,
+                  drc != 0 ? "cannot be listed" : "holds other links");
+        ad_tun_nl_close(&nl);
+        return;
+    }
+
+    struct ifinfomsg ifi;
+    memset(&ifi, 0, sizeof(ifi));
+    ifi.ifi_family = AF_UNSPEC;
+
+    int rc = -ENOMEM;
+    if (ad_tun_nl_request(&nl, RTM_DELLINK, 0, &ifi, sizeof(ifi)) &&
+        ad_tun_nl_attr(&nl, IFLA_GROUP, &mgr->cfg.group, sizeof(uint32_t)) == 0) {
+        rc = ad_tun_nl_commit(&nl, NULL, NULL);
+    }
+    if (rc != 0) zlog_warn(zc, "Deleting device group %u failed (rc=%d)", mgr->cfg.group, rc);
+    ad_tun_nl_close(&nl);
+}
+
+void ad_tun_mgr_stop(ad_tun_mgr_t *mgr, unsigned first, unsigned n)
+{
+    if (!mgr || first > mgr->count || n > mgr->count - first) return;
+
+    unsigned *idx = malloc((n ? n : 1) * sizeof(*idx));
+    if (!idx) return;
+
+    unsigned todo = 0;
+    int persist = 0;
+    for (unsigned i = first; i < first + n; i++) {
+        if (mgr->tuns[i].fd >= 0) {
+            idx[todo++] = i;
+            persist |= mgr->tuns[i].cfg.persist;
+        } else if (mgr->tuns[i].state == AD_TUN_MGR_FAILED) {
+            mgr->tuns[i].state = AD_TUN_MGR_DOWN;
+        }
+    }
+
+    /* Everything open is going away: unregister the whole group in one batch */
+    if (mgr->cfg.group && !persist && todo > 1 && todo == mgr_open_count(mgr)) {
+        mgr_delete_group(mgr);
+    }
+
+    /* Closing unregisters the device, which waits on the kernel; do it in parallel */
+    mgr_job_t job = { .mgr = mgr, .idx = idx, .n = todo, .next = 0, .create = 0 };
+    mgr_run(mgr, &job);
+    free(idx);
+
+    zlog_info(zlog_get_category("ad_tun"), "Stopped %u tunnels", todo);
+}
+
+void ad_tun_mgr_stop_all(ad_tun_mgr_t *mgr)
+{
+    if (!mgr) return;
+    ad_tun_mgr_stop(mgr, 0, mgr->count);
+}
+
+/* ---- I/O ---- */
+
+int ad_tun_mgr_epoll_fd(const ad_tun_mgr_t *mgr)
+{
+    return mgr ? mgr->epfd : -1;
+}
+
+int ad_tun_mgr_wait(ad_tun_mgr_t *mgr, ad_tun_mgr_event_t *events, unsigned max, int timeout_ms)
+{
+    if (!mgr || !events || max == 0) return -EINVAL;
+
+    struct epoll_event evs[64];
+    if (max > 64) max = 64;
+
+    int n;
+    do {
+        n = epoll_wait(mgr->epfd, evs, (int)max, timeout_ms);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) return -errno;
+
+    for (int i = 0; i < n; i++) {
+        events[i].tun = evs[i].data.u32;
+        events[i].events = evs[i].events;
+    }
+    return n;
+}
+
+ssize_t ad_tun_mgr_read(ad_tun_mgr_t *mgr, unsigned idx, void *buf, size_t len)
+{
+    if (!mgr || idx >= mgr->count || !buf) return -EINVAL;
+
+    int fd = mgr->tuns[idx].fd;
+    if (fd < 0) return -EBADF;
+
+    ssize_t n = read(fd, buf, len);
+    return (n < 0) ? -errno : n;
+}
+
+ssize_t ad_tun_mgr_write(ad_tun_mgr_t *mgr, unsigned idx, const void *buf, size_t len)
+{
+    if (!mgr || idx >= mgr->count || !buf) return -EINVAL;
+
+    int fd = mgr->tuns[idx].fd;
+    if (fd < 0) return -EBADF;
+
+    ssize_t n = write(fd, buf, len);
+    return (n < 0) ? -errno : n;
+}
@@ -0,0 +1,776 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Link Monitor       **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#define _GNU_SOURCE
+
+#include "../include/ad_tun_monitor.h"
+#include "../include/ad_tun_nl.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#define MON_INITIAL_BUCKETS 256
+#define MON_RECV_BUF 65536
+#define MON_SOCK_BUF (8 << 20)
+#define MON_MAX_EVENTS 8            /* events one message can produce */
+
+#ifndef IFF_LOWER_UP
+#define IFF_LOWER_UP 0x10000
+#endif
+
+typedef struct {
+    int family;
+    unsigned plen;
+    unsigned char addr[16];
+} mon_addr_t;
+
+struct ad_tun_mon_link {
+    int ifindex;
+    char name[AD_TUN_MON_NAME_LEN];
+    unsigned flags;
+    unsigned mtu;
+    mon_addr_t *addrs;
+    unsigned naddrs;
+    unsigned addrs_cap;
+    unsigned gen;                   /* last dump that saw the link */
+    struct ad_tun_mon_watch *watch;
+    struct ad_tun_mon_link *next;
+};
+
+struct ad_tun_mon_watch {
+    char name[AD_TUN_MON_NAME_LEN];
+    unsigned mtu;                   /* 0 = not enforced */
+    mon_addr_t want[2];             /* IPv4, IPv6; family 0 = none */
+    uint64_t events;
+    uint64_t repairs;
+    struct ad_tun_mon_link *link;
+    struct ad_tun_mon_watch *next;
+};
+
+/* Events produced by one message, delivered after the lock is dropped */
+typedef struct {
+    ad_tun_mon_event_t ev[MON_MAX_EVENTS];
+    unsigned n;
+    int repair;                     /* a watched link may need repair */
+} mon_batch_t;
+
+/* Dump callback state */
+typedef struct {
+    ad_tun_mon_t *mon;
+    unsigned gen;
+} mon_dump_ctx_t;
+
+/* FNV-1a of an interface name */
+static uint32_t mon_hash_name(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t mon_hash_index(int ifindex)
+{
+    return (uint32_t)ifindex * 2654435761u;
+}
+
+const char *ad_tun_mon_event_name(ad_tun_mon_event_type_t type)
+{
+    static const char *names[] = {
+        "link-new", "link-del", "link-up", "link-down", "carrier-up", "carrier-down",
+        "mtu", "addr-add", "addr-del", "repaired", "resync"
+    };
+    return ((unsigned)type < sizeof(names) / sizeof(names[0])) ? names[type] : "unknown";
+}
+
+/* ---- Tables ---- */
+
+static struct ad_tun_mon_link *mon_link_find(ad_tun_mon_t *mon, int ifindex)
+{
+    struct ad_tun_mon_link *l = mon->links[mon_hash_index(ifindex) & (mon->links_cap - 1)];
+    while (l && l->ifindex != ifindex) l = l->next;
+    return l;
+}
+
+static struct ad_tun_mon_watch *mon_watch_find(ad_tun_mon_t *mon, const char *name)
+{
+    struct ad_tun_mon_watch *w = mon->watches[mon_hash_name(name) & (mon->watches_cap - 1)];
+    while (w && strcmp(w->name, name) != 0) w = w->next;
+    return w;
+}
+
+/* Double a chained table once it holds more entries than buckets */
+static int mon_rehash(void ***table, unsigned *cap, unsigned count, int links)
+{
+    if (count < *cap) return 0;
+
+    unsigned ncap = *cap * 2;
+    void **nt = calloc(ncap, sizeof(*nt));
+    if (!nt) return -ENOMEM;
+
+    for (unsigned i = 0; i < *cap; i++) {
+        void *e = (*table)[i];
+        while (e) {
+            void *next;
+            uint32_t h;
+            if (links) {
+                struct ad_tun_mon_link *l = e;
+                next = l->next;
+                h = mon_hash_index(l->ifindex) & (ncap - 1);
+                l->next = nt[h];
+            } else {
+                struct ad_tun_mon_watch *w = e;
+                next = w->next;
+                h = mon_hash_name(w->name) & (ncap - 1);
+                w->next = nt[h];
+            }
+            nt[h] = e;
+            e = next;
+        }
+    }
+    free(*table);
+    *table = nt;
+    *cap = ncap;
+    return 0;
+}
+
+static void mon_link_remove(ad_tun_mon_t *mon, struct ad_tun_mon_link *link)
+{
+    struct ad_tun_mon_link **p = &mon->links[mon_hash_index(link->ifindex) & (mon->links_cap - 1)];
+    while (*p != link) p = &(*p)->next;
+    *p = link->next;
+    mon->nlinks--;
+
+    if (link->watch) link->watch->link = NULL;
+    free(link->addrs);
+    free(link);
+}
+
+static int mon_addr_find(const struct ad_tun_mon_link *link, const mon_addr_t *a)
+{
+    size_t alen = (a->family == AF_INET) ? 4 : 16;
+    for (unsigned i = 0; i < link->naddrs; i++) {
+        if (link->addrs[i].family == a->family && memcmp(link->addrs[i].addr, a->addr, alen) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/* ---- Event handling ---- */
+
+static void mon_emit(mon_batch_t *b, ad_tun_mon_event_type_t type, struct ad_tun_mon_link *link,
+                     const mon_addr_t *a)
+{
+    if (!link->watch || b->n == MON_MAX_EVENTS) return;
+
+    ad_tun_mon_event_t *ev = &b->ev[b->n++];
+    memset(ev, 0, sizeof(*ev));
+    ev->type = type;
+    memcpy(ev->ifname, link->name, sizeof(ev->ifname));
+    ev->ifindex = link->ifindex;
+    ev->mtu = link->mtu;
+    if (a) {
+        ev->family = a->family;
+        memcpy(ev->addr, a->addr, sizeof(ev->addr));
+        ev->plen = a->plen;
+    }
+    link->watch->events++;
+    b->repair = 1;
+}
+
+static void mon_handle_link(ad_tun_mon_t *mon, const struct nlmsghdr *h, mon_batch_t *b, unsigned gen)
+{
+    const struct ifinfomsg *ifi = NLMSG_DATA(h);
+    int len = (int)h->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+    if (len < 0) return;
+
+    struct ad_tun_mon_link *link = mon_link_find(mon, ifi->ifi_index);
+
+    if (h->nlmsg_type == RTM_DELLINK) {
+        if (link) {
+            mon_emit(b, AD_TUN_MON_LINK_DEL, link, NULL);
+            b->repair = 0;
+            mon_link_remove(mon, link);
+        }
+        return;
+    }
+
+    const char *name = NULL;
+    unsigned mtu = link ? link->mtu : 0;
+    for (const struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFLA_IFNAME) name = RTA_DATA(rta);
+        else if (rta->rta_type == IFLA_MTU) mtu = *(const uint32_t *)RTA_DATA(rta);
+    }
+
+    int created = 0;
+    if (!link) {
+        if (mon_rehash((void ***)&mon->links, &mon->links_cap, mon->nlinks + 1, 1) != 0) return;
+        link = calloc(1, sizeof(*link));
+        if (!link) return;
+        link->ifindex = ifi->ifi_index;
+        link->flags = ifi->ifi_flags;
+        link->mtu = mtu;
+        unsigned slot = mon_hash_index(link->ifindex) & (mon->links_cap - 1);
+        link->next = mon->links[slot];
+        mon->links[slot] = link;
+        mon->nlinks++;
+        created = 1;
+    }
+    link->gen = gen;
+
+    /* New or renamed: (re)attach the watch of that name */
+    if (name && strncmp(link->name, name, sizeof(link->name)) != 0) {
+        if (link->watch) link->watch->link = NULL;
+        strncpy(link->name, name, sizeof(link->name) - 1);
+        link->watch = mon_watch_find(mon, link->name);
+        if (link->watch) {
+            link->watch->link = link;
+            created = 1;
+        }
+    }
+
+    if (created) {
+        mon_emit(b, AD_TUN_MON_LINK_NEW, link, NULL);
+    } else {
+        unsigned changed = link->flags ^ ifi->ifi_flags;
+        link->flags = ifi->ifi_flags;
+        if (changed & IFF_UP) {
+            mon_emit(b, (link->flags & IFF_UP) ? AD_TUN_MON_LINK_UP : AD_TUN_MON_LINK_DOWN, link, NULL);
+        }
+        if (changed & IFF_LOWER_UP) {
+            mon_emit(b, (link->flags & IFF_LOWER_UP) ? AD_TUN_MON_CARRIER_UP : AD_TUN_MON_CARRIER_DOWN,
+                     link, NULL);
+        }
+        if (mtu != link->mtu) {
+            link->mtu = mtu;
+            mon_emit(b, AD_TUN_MON_MTU, link, NULL);
+        }
+    }
+    link->flags = ifi->ifi_flags;
+}
+
+static void mon_handle_addr(ad_tun_mon_t *mon, const struct nlmsghdr *h, mon_batch_t *b)
+{
+    const struct ifaddrmsg *ifa = NLMSG_DATA(h);
+    int len = (int)h->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa));
+    if (len < 0 || (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6)) return;
+
+    struct ad_tun_mon_link *link = mon_link_find(mon, (int)ifa->ifa_index);
+    if (!link) return;
+
+    mon_addr_t a;
+    memset(&a, 0, sizeof(a));
+    a.family = ifa->ifa_family;
+    a.plen = ifa->ifa_prefixlen;
+    size_t alen = (a.family == AF_INET) ? 4 : 16;
+
+    /* IFA_LOCAL is the interface's own address; IFA_ADDRESS the peer on point-to-point links */
+    const void *local = NULL, *address = NULL;
+    for (const struct rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (RTA_PAYLOAD(rta) < alen) continue;
+        if (rta->rta_type == IFA_LOCAL) local = RTA_DATA(rta);
+        else if (rta->rta_type == IFA_ADDRESS) address = RTA_DATA(rta);
+    }
+    if (!local) local = address;
+    if (!local) return;
+    memcpy(a.addr, local, alen);
+
+    int idx = mon_addr_find(link, &a);
+    if (h->nlmsg_type == RTM_NEWADDR) {
+        if (idx >= 0) return;
+        if (link->naddrs == link->addrs_cap) {
+            unsigned cap = link->addrs_cap ? link->addrs_cap * 2 : 4;
+            mon_addr_t *addrs = realloc(link->addrs, cap * sizeof(*addrs));
+            if (!addrs) return;
+            link->addrs = addrs;
+            link->addrs_cap = cap;
+        }
+        link->addrs[link->naddrs++] = a;
+        mon_emit(b, AD_TUN_MON_ADDR_ADD, link, &a);
+    } else if (idx >= 0) {
+        link->addrs[idx] = link->addrs[--link->naddrs];
+        mon_emit(b, AD_TUN_MON_ADDR_DEL, link, &a);
+    }
+}
+
+static void mon_handle(ad_tun_mon_t *mon, const struct nlmsghdr *h, mon_batch_t *b, unsigned gen)
+{
+    switch (h->nlmsg_type) {
+    case RTM_NEWLINK:
+    case RTM_DELLINK:
+        mon_handle_link(mon, h, b, gen);
+        break;
+    case RTM_NEWADDR:
+    case RTM_DELADDR:
+        mon_handle_addr(mon, h, b);
+        break;
+    default:
+        break;
+    }
+}
+
+/* ---- Repair ---- */
+
+/* Queue whatever the watch's link lacks; returns the number of requests */
+static unsigned mon_queue_repair(ad_tun_nl_t *nl, struct ad_tun_mon_watch *w)
+{
+    struct ad_tun_mon_link *link = w->link;
+    if (!link) return 0;
+
+    unsigned n = 0;
+    int up = (link->flags & IFF_UP) ? -1 : 1;
+    unsigned mtu = (w->mtu && link->mtu != w->mtu) ? w->mtu : 0;
+    if (up > 0 || mtu) {
+        n += ad_tun_nl_link_set(nl, link->ifindex, mtu, up) != 0;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (w->want[i].family && mon_addr_find(link, &w->want[i]) < 0) {
+            n += ad_tun_nl_addr(nl, 1, link->ifindex, w->want[i].family, w->want[i].addr, w->want[i].plen) != 0;
+        }
+    }
+    return n;
+}
+
+/* Repair one watch by name; called without the lock */
+static void mon_repair(ad_tun_mon_t *mon, ad_tun_nl_t *nl, const char *name)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    pthread_mutex_lock(&mon->lock);
+    struct ad_tun_mon_watch *w = mon_watch_find(mon, name);
+    unsigned n = w ? mon_queue_repair(nl, w) : 0;
+    if (n) w->repairs++;
+    ad_tun_mon_event_t ev;
+    memset(&ev, 0, sizeof(ev));
+    if (n) {
+        ev.type = AD_TUN_MON_REPAIRED;
+        memcpy(ev.ifname, w->name, sizeof(ev.ifname));
+        ev.ifindex = w->link->ifindex;
+        ev.mtu = w->mtu;
+        w->events++;
+    }
+    pthread_mutex_unlock(&mon->lock);
+
+    if (!n) return;
+
+    int rc = ad_tun_nl_commit(nl, NULL, NULL);
+    if (rc != 0) {
+        zlog_warn(zc, "Repair of %s failed (rc=%d)", name, rc);
+        return;
+    }
+    zlog_info(zc, "Restored configuration of %s", name);
+    if (mon->cfg.cb) mon->cfg.cb(&ev, mon->cfg.arg);
+}
+
+static void mon_dispatch(ad_tun_mon_t *mon, ad_tun_nl_t *nl, mon_batch_t *b)
+{
+    for (unsigned i = 0; i < b->n; i++) {
+        if (mon->cfg.cb) mon->cfg.cb(&b->ev[i], mon->cfg.arg);
+    }
+    if (mon->cfg.repair && b->repair && nl && b->n) mon_repair(mon, nl, b->ev[0].ifname);
+}
+
+/* ---- Dumps ---- */
+
+static int mon_dump_cb(void *arg, const struct nlmsghdr *h)
+{
+    mon_dump_ctx_t *ctx = arg;
+    mon_batch_t b;
+    b.n = 0;
+    b.repair = 0;
+    mon_handle(ctx->mon, h, &b, ctx->gen);
+    return 0;
+}
+
+/* Re-read every link and address; called with the lock held, reports nothing */
+static int mon_load(ad_tun_mon_t *mon, ad_tun_nl_t *nl)
+{
+    mon_dump_ctx_t ctx = { .mon = mon, .gen = ++mon->gen };
+
+    int rc;
+    do {
+        rc = ad_tun_nl_dump(nl, RTM_GETLINK, AF_UNSPEC, mon_dump_cb, &ctx);
+    } while (rc == -EINTR);
+    if (rc != 0) return rc;
+
+    /* Drop links that vanished and rebuild address lists from scratch */
+    for (unsigned i = 0; i < mon->links_cap; i++) {
+        struct ad_tun_mon_link *l = mon->links[i];
+        while (l) {
+            struct ad_tun_mon_link *next = l->next;
+            if (l->gen != ctx.gen) mon_link_remove(mon, l);
+            else l->naddrs = 0;
+            l = next;
+        }
+    }
+
+    do {
+        rc = ad_tun_nl_dump(nl, RTM_GETADDR, AF_UNSPEC, mon_dump_cb, &ctx);
+    } while (rc == -EINTR);
+    return rc;
+}
+
+/* ---- Thread ---- */
+
+static void mon_resync(ad_tun_mon_t *mon, ad_tun_nl_t *nl)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    pthread_mutex_lock(&mon->lock);
+    int rc = mon_load(mon, nl);
+    mon->resyncs++;
+    pthread_mutex_unlock(&mon->lock);
+
+    if (rc != 0) {
+        zlog_error(zc, "Link monitor resync failed: %s", strerror(-rc));
+        return;
+    }
+    zlog_warn(zc, "Link monitor lost events, state re-read from the kernel");
+
+    ad_tun_mon_event_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = AD_TUN_MON_RESYNC;
+    if (mon->cfg.cb) mon->cfg.cb(&ev, mon->cfg.arg);
+
+    if (!mon->cfg.repair) return;
+
+    /* Anything may have changed while events were dropped */
+    pthread_mutex_lock(&mon->lock);
+    unsigned n = 0;
+    for (unsigned i = 0; i < mon->watches_cap; i++) {
+        for (struct ad_tun_mon_watch *w = mon->watches[i]; w; w = w->next) {
+            unsigned q = mon_queue_repair(nl, w);
+            if (q) w->repairs++;
+            n += q;
+        }
+    }
+    pthread_mutex_unlock(&mon->lock);
+    if (n) ad_tun_nl_commit(nl, NULL, NULL);
+}
+
+static void *mon_thread(void *arg)
+{
+    ad_tun_mon_t *mon = arg;
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+    unsigned char *rbuf = malloc(MON_RECV_BUF);
+
+    ad_tun_nl_t nl;
+    int have_nl = (ad_tun_nl_open(&nl) == AD_TUN_OK);
+    if (!have_nl) zlog_warn(zc, "Link monitor cannot repair or resync without a netlink socket");
+
+    struct pollfd pfd[2] = {
+        { .fd = mon->fd, .events = POLLIN },
+        { .fd = mon->wake_fd, .events = POLLIN },
+    };
+
+    while (rbuf) {
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            zlog_error(zc, "Link monitor poll() failed: %s", strerror(errno));
+            break;
+        }
+        if (pfd[1].revents & POLLIN) break;
+
+        for (;;) {
+            ssize_t n = recv(mon->fd, rbuf, MON_RECV_BUF, MSG_DONTWAIT);
+            if (n < 0) {
+                if (errno == ENOBUFS) {
+                    if (have_nl) mon_resync(mon, &nl);
+                    continue;
+                }
+                break;
+            }
+
+            for (struct nlmsghdr *h = (struct nlmsghdr *)rbuf; NLMSG_OK(h, (unsigned)n);
+                 h = NLMSG_NEXT(h, n)) {
+                mon_batch_t b;
+                b.n = 0;
+                b.repair = 0;
+                pthread_mutex_lock(&mon->lock);
+                mon_handle(mon, h, &b, mon->gen);
+                pthread_mutex_unlock(&mon->lock);
+                mon_dispatch(mon, have_nl ? &nl : NULL, &b);
+            }
+        }
+    }
+
+    if (have_nl) ad_tun_nl_close(&nl);
+    free(rbuf);
+    return NULL;
+}
+
+/* ---- API ---- */
+
+ad_tun_error_t ad_tun_mon_init(ad_tun_mon_t *mon, const ad_tun_mon_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!mon) {
+        zlog_error(zc, "ad_tun_mon_init: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    memset(mon, 0, sizeof(*mon));
+    if (cfg) mon->cfg = *cfg;
+    mon->fd = -1;
+    mon->wake_fd = -1;
+
+    mon->links = calloc(MON_INITIAL_BUCKETS, sizeof(*mon->links));
+    mon->watches = calloc(MON_INITIAL_BUCKETS, sizeof(*mon->watches));
+    if (!mon->links || !mon->watches) {
+        free(mon->links);
+        free(mon->watches);
+        zlog_error(zc, "ad_tun_mon_init: memory allocation failed");
+        return AD_TUN_ERR_SYS;
+    }
+    mon->links_cap = MON_INITIAL_BUCKETS;
+    mon->watches_cap = MON_INITIAL_BUCKETS;
+
+    pthread_mutex_init(&mon->lock, NULL);
+    return AD_TUN_OK;
+}
+
+void ad_tun_mon_free(ad_tun_mon_t *mon)
+{
+    if (!mon || !mon->links) return;
+
+    ad_tun_mon_stop(mon);
+
+    for (unsigned i = 0; i < mon->links_cap; i++) {
+        struct ad_tun_mon_link *l = mon->links[i];
+        while (l) {
+            struct ad_tun_mon_link *next = l->next;
+            free(l->addrs);
+            free(l);
+            l = next;
+        }
+    }
+    for (unsigned i = 0; i < mon->watches_cap; i++) {
+        struct ad_tun_mon_watch *w = mon->watches[i];
+        while (w) {
+            struct ad_tun_mon_watch *next = w->next;
+            free(w);
+            w = next;
+        }
+    }
+    free(mon->links);
+    free(mon->watches);
+    pthread_mutex_destroy(&mon->lock);
+    memset(mon, 0, sizeof(*mon));
+    mon->fd = -1;
+    mon->wake_fd = -1;
+}
+
+ad_tun_error_t ad_tun_mon_start(ad_tun_mon_t *mon)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!mon || !mon->links) return AD_TUN_ERR_CONFIG;
+    if (mon->running) return AD_TUN_ERR_INVALID_STATE;
+
+    /* Subscribe before the dump so no change falls in between */
+    mon->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (mon->fd < 0) {
+        zlog_error(zc, "ad_tun_mon_start: socket() failed: %s", strerror(errno));
+        return AD_TUN_ERR_SYS;
+    }
+    int sz = MON_SOCK_BUF;
+    if (setsockopt(mon->fd, SOL_SOCKET, SO_RCVBUFFORCE, &sz, sizeof(sz)) < 0) {
+        setsockopt(mon->fd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+    }
+
+    struct sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+
+    ad_tun_nl_t nl;
+    int rc = -1;
+    if (bind(mon->fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        zlog_error(zc, "ad_tun_mon_start: bind() failed: %s", strerror(errno));
+    } else if ((mon->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+        zlog_error(zc, "ad_tun_mon_start: eventfd() failed: %s", strerror(errno));
+    } else if (ad_tun_nl_open(&nl) == AD_TUN_OK) {
+        pthread_mutex_lock(&mon->lock);
+        rc = mon_load(mon, &nl);
+        pthread_mutex_unlock(&mon->lock);
+        ad_tun_nl_close(&nl);
+        if (rc != 0) zlog_error(zc, "ad_tun_mon_start: initial dump failed: %s", strerror(-rc));
+    }
+
+    if (rc == 0 && pthread_create(&mon->thread, NULL, mon_thread, mon) != 0) {
+        zlog_error(zc, "ad_tun_mon_start: pthread_create() failed");
+        rc = -1;
+    }
+    if (rc != 0) {
+        close(mon->fd);
+        if (mon->wake_fd >= 0) close(mon->wake_fd);
+        mon->fd = -1;
+        mon->wake_fd = -1;
+        return AD_TUN_ERR_SYS;
+    }
+
+    mon->running = 1;
+    zlog_info(zc, "Link monitor started (%u links, %u watched)", mon->nlinks, mon->nwatches);
+
+    /* Watches added before start get their initial check now */
+    if (mon->cfg.repair) {
+        pthread_mutex_lock(&mon->lock);
+        unsigned n = 0;
+        ad_tun_nl_t rnl;
+        if (ad_tun_nl_open(&rnl) == AD_TUN_OK) {
+            for (unsigned i = 0; i < mon->watches_cap; i++) {
+                for (struct ad_tun_mon_watch *w = mon->watches[i]; w; w = w->next) {
+                    unsigned q = mon_queue_repair(&rnl, w);
+                    if (q) w->repairs++;
+                    n += q;
+                }
+            }
+            pthread_mutex_unlock(&mon->lock);
+            if (n) ad_tun_nl_commit(&rnl, NULL, NULL);
+            ad_tun_nl_close(&rnl);
+        } else {
+            pthread_mutex_unlock(&mon->lock);
+        }
+    }
+    return AD_TUN_OK;
+}
+
+void ad_tun_mon_stop(ad_tun_mon_t *mon)
+{
+    if (!mon || !mon->running) return;
+
+    uint64_t one = 1;
+    if (write(mon->wake_fd, &one, sizeof(one)) < 0) {
+        zlog_warn(zlog_get_category("ad_tun"), "ad_tun_mon_stop: wake-up failed: %s", strerror(errno));
+    }
+    pthread_join(mon->thread, NULL);
+
+    close(mon->fd);
+    close(mon->wake_fd);
+    mon->fd = -1;
+    mon->wake_fd = -1;
+    mon->running = 0;
+    zlog_info(zlog_get_category("ad_tun"), "Link monitor stopped");
+}
+
+int ad_tun_mon_watch(ad_tun_mon_t *mon, const ad_tun_config_t *cfg)
+{
+    if (!mon || !mon->links || !cfg || !cfg->ifname || cfg->ifname[0] == '\0' ||
+        strlen(cfg->ifname) >= AD_TUN_MON_NAME_LEN) {
+        return -EINVAL;
+    }
+
+    mon_addr_t want[2];
+    memset(want, 0, sizeof(want));
+    const char *addrs[2] = { cfg->ipv4, cfg->ipv6 };
+    for (int i = 0; i < 2; i++) {
+        if (addrs[i] && addrs[i][0] &&
+            ad_tun_nl_parse_prefix(addrs[i], &want[i].family, want[i].addr, &want[i].plen) != 0) {
+            return -EINVAL;
+        }
+    }
+
+    pthread_mutex_lock(&mon->lock);
+
+    struct ad_tun_mon_watch *w = mon_watch_find(mon, cfg->ifname);
+    if (!w) {
+        if (mon_rehash((void ***)&mon->watches, &mon->watches_cap, mon->nwatches + 1, 0) != 0 ||
+            !(w = calloc(1, sizeof(*w)))) {
+            pthread_mutex_unlock(&mon->lock);
+            return -ENOMEM;
+        }
+        strcpy(w->name, cfg->ifname);
+        unsigned slot = mon_hash_name(w->name) & (mon->watches_cap - 1);
+        w->next = mon->watches[slot];
+        mon->watches[slot] = w;
+        mon->nwatches++;
+
+        int ifindex = (int)if_nametoindex(w->name);
+        struct ad_tun_mon_link *link = ifindex > 0 ? mon_link_find(mon, ifindex) : NULL;
+        if (link && strcmp(link->name, w->name) == 0) {
+            link->watch = w;
+            w->link = link;
+        }
+    }
+    w->mtu = cfg->mtu > 0 ? (unsigned)cfg->mtu : 0;
+    memcpy(w->want, want, sizeof(want));
+
+    char name[AD_TUN_MON_NAME_LEN];
+    strcpy(name, w->name);
+    int check = mon->cfg.repair && mon->running && w->link;
+    pthread_mutex_unlock(&mon->lock);
+
+    if (check) {
+        ad_tun_nl_t nl;
+        if (ad_tun_nl_open(&nl) == AD_TUN_OK) {
+            mon_repair(mon, &nl, name);
+            ad_tun_nl_close(&nl);
+        }
+    }
+    return 0;
+}
+
+int ad_tun_mon_unwatch(ad_tun_mon_t *mon, const char *ifname)
+{
+    if (!mon || !mon->links || !ifname) return -EINVAL;
+
+    pthread_mutex_lock(&mon->lock);
+    struct ad_tun_mon_watch **p = &mon->watches[mon_hash_name(ifname) & (mon->watches_cap - 1)];
+    while (*p && strcmp((*p)->name, ifname) != 0) p = &(*p)->next;
+
+    struct ad_tun_mon_watch *w = *p;
+    if (!w) {
+        pthread_mutex_unlock(&mon->lock);
+        return -ENOENT;
+    }
+    *p = w->next;
+    if (w->link) w->link->watch = NULL;
+    mon->nwatches--;
+    pthread_mutex_unlock(&mon->lock);
+
+    free(w);
+    return 0;
+}
+
+int ad_tun_mon_status(ad_tun_mon_t *mon, const char *ifname, ad_tun_mon_status_t *out)
+{
+    if (!mon || !mon->links || !ifname || !out) return -EINVAL;
+
+    pthread_mutex_lock(&mon->lock);
+    struct ad_tun_mon_watch *w = mon_watch_find(mon, ifname);
+    if (!w) {
+        pthread_mutex_unlock(&mon->lock);
+        return -ENOENT;
+    }
+
+    memset(out, 0, sizeof(*out));
+    out->events = w->events;
+    out->repairs = w->repairs;
+    if (w->link) {
+        out->ifindex = w->link->ifindex;
+        out->up = (w->link->flags & IFF_UP) != 0;
+        out->carrier = (w->link->flags & IFF_LOWER_UP) != 0;
+        out->mtu = w->link->mtu;
+        out->has_ipv4 = w->want[0].family && mon_addr_find(w->link, &w->want[0]) >= 0;
+        out->has_ipv6 = w->want[1].family && mon_addr_find(w->link, &w->want[1]) >= 0;
+    }
+    pthread_mutex_unlock(&mon->lock);
+    return 0;
+}
@@ -0,0 +1,918 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun NAT                **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_nat.h"
+#include "../include/ad_tun_pkt.h"
+#include "../include/ad_tun_nl.h"
+#include "../../prebuilt/inih/include/ini.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/* Defaults for ad_tun_nat_config_t (RFC 4787 and RFC 5382 minimums) */
+#define DEFAULT_NAT_PORT_LO 1024
+#define DEFAULT_NAT_PORT_HI 65535
+#define DEFAULT_NAT_TCP_TIMEOUT 7440
+#define DEFAULT_NAT_TCP_TRANSITORY_TIMEOUT 240
+#define DEFAULT_NAT_UDP_TIMEOUT 300
+#define DEFAULT_NAT_ICMP_TIMEOUT 60
+#define DEFAULT_NAT_MAX_MAPPINGS 65536
+#define DEFAULT_NAT_SHARDS 8
+
+/* Packets handled per chunk */
+#define NAT_CHUNK 64
+
+/* Mapped protocols; ICMP maps echo identifiers */
+enum { NAT_TCP = 0, NAT_UDP, NAT_ICMP, NAT_NPROTO };
+
+/* Timeout classes, each with its own LRU list */
+enum { NAT_T_EST = 0, NAT_T_TRANS, NAT_T_UDP, NAT_T_ICMP, NAT_NCLASS };
+
+/* Per-packet outcome of the first pass */
+enum { NAT_KEEP = 0xfd, NAT_DROP = 0xfe, NAT_PASS = 0xff };
+
+#define TCP_FIN 0x01
+#define TCP_RST 0x04
+
+typedef struct {
+    uint8_t int_addr[4];
+    uint16_t int_port;
+    uint16_t ext_port;
+    uint8_t addr_idx;
+    uint8_t proto;
+    uint8_t tclass;
+    uint8_t closing;            /* FIN or RST seen */
+    uint64_t last_ns;
+    int32_t hnext;              /* Hash chain, or free list */
+    int32_t prev, next;         /* LRU list of tclass */
+} nat_entry_t;
+
+struct ad_tun_nat_shard {
+    pthread_mutex_t lock;
+    nat_entry_t *entries;
+    unsigned cap;
+    int32_t free_head;
+    int32_t *heads;             /* Outbound lookup: hash of the internal side */
+    uint32_t hmask;
+    int32_t *ports;             /* Inbound lookup: [proto][addr][port - base] -> entry, -1 = free */
+    uint16_t base;
+    unsigned cursor[NAT_NPROTO];
+    int32_t lru_head[NAT_NCLASS];
+    int32_t lru_tail[NAT_NCLASS];
+    ad_tun_nat_stats_t stats;
+} __attribute__((aligned(64)));
+
+/* First-pass result for one packet */
+typedef struct {
+    ad_tun_pkt_info_t info;
+    uint8_t shard;              /* Shard index or NAT_KEEP/NAT_DROP/NAT_PASS */
+    uint8_t proto;
+    uint8_t addr_idx;
+    uint8_t icmp_error;
+    uint16_t port;              /* Internal (out) or external (in) port or echo id */
+    uint16_t inner;             /* ICMP error: offset of the quoted IP header */
+} nat_pkt_t;
+
+/* ---- Configuration ---- */
+
+void ad_tun_nat_default_config(ad_tun_nat_config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->port_lo = DEFAULT_NAT_PORT_LO;
+    cfg->port_hi = DEFAULT_NAT_PORT_HI;
+    cfg->tcp_timeout = DEFAULT_NAT_TCP_TIMEOUT;
+    cfg->tcp_transitory_timeout = DEFAULT_NAT_TCP_TRANSITORY_TIMEOUT;
+    cfg->udp_timeout = DEFAULT_NAT_UDP_TIMEOUT;
+    cfg->icmp_timeout = DEFAULT_NAT_ICMP_TIMEOUT;
+    cfg->max_mappings = DEFAULT_NAT_MAX_MAPPINGS;
+    cfg->shards = DEFAULT_NAT_SHARDS;
+}
+
+/* Parse a prefix of the given family with its host bits cleared */
+static int nat_parse_prefix(const char *s, int want, uint8_t *addr, uint8_t *plen)
+{
+    int family;
+    unsigned len;
+    unsigned char a[16];
+    if (ad_tun_nl_parse_prefix(s, &family, a, &len) != 0 || family != want) return -EINVAL;
+
+    for (unsigned i = 0; i < 16; i++) {
+        unsigned keep = (len >= (i + 1) * 8) ? 8 : (len > i * 8 ? len - i * 8 : 0);
+        a[i] &= (uint8_t)(0xff00 >> keep);
+    }
+    memcpy(addr, a, family == AF_INET ? 4 : 16);
+    *plen = (uint8_t)len;
+    return 0;
+}
+
+static int nat_add_external(ad_tun_nat_config_t *cfg, const char *value)
+{
+    char buf[512];
+    if (strlen(value) >= sizeof(buf)) return -EINVAL;
+    strcpy(buf, value);
+
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ", \t", &save); tok; tok = strtok_r(NULL, ", \t", &save)) {
+        uint8_t plen;
+        if (cfg->naddrs == AD_TUN_NAT_MAX_ADDRS) return -EINVAL;
+        if (nat_parse_prefix(tok, AF_INET, cfg->addrs[cfg->naddrs], &plen) != 0 || plen != 32) return -EINVAL;
+        cfg->naddrs++;
+    }
+    return 0;
+}
+
+static int nat_parse_nptv6(ad_tun_nat_config_t *cfg, const char *value)
+{
+    char a[128], b[128];
+    uint8_t la, lb;
+    if (sscanf(value, "%127s %127s", a, b) != 2) return -EINVAL;
+    if (nat_parse_prefix(a, AF_INET6, cfg->npt_internal, &la) != 0 ||
+        nat_parse_prefix(b, AF_INET6, cfg->npt_external, &lb) != 0) return -EINVAL;
+    if (la != lb || la == 0 || la > 64) return -EINVAL;
+    cfg->npt_plen = la;
+    cfg->nptv6 = 1;
+    return 0;
+}
+
+/* State carried through ini_parse() */
+typedef struct {
+    ad_tun_nat_config_t *cfg;
+    int seen_nat;
+} nat_parse_ctx_t;
+
+static int nat_ini_handler(void *user, const char *section,
+                           const char *name, const char *value)
+{
+    nat_parse_ctx_t *ctx = (nat_parse_ctx_t*)user;
+    ad_tun_nat_config_t *cfg = ctx->cfg;
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (strcmp(section, "nat") != 0) return 1;
+    ctx->seen_nat = 1;
+
+    if (strcmp(name, "enabled") == 0) {
+        cfg->enabled = atoi(value);
+    } else if (strcmp(name, "external") == 0) {
+        if (nat_add_external(cfg, value) != 0) {
+            zlog_error(zc, "Config error: 'external' is invalid or too many addresses (%s)", value);
+            return 0;
+        }
+    } else if (strcmp(name, "internal") == 0) {
+        if (nat_parse_prefix(value, AF_INET, cfg->internal, &cfg->internal_plen) != 0) {
+            zlog_error(zc, "Config error: 'internal' is invalid (%s)", value);
+            return 0;
+        }
+    } else if (strcmp(name, "ports") == 0) {
+        unsigned lo, hi;
+        char extra;
+        if (sscanf(value, "%u-%u%c", &lo, &hi, &extra) != 2 || lo == 0 || lo > hi || hi > 65535) {
+            zlog_error(zc, "Config error: 'ports' is invalid (%s)", value);
+            return 0;
+        }
+        cfg->port_lo = (uint16_t)lo;
+        cfg->port_hi = (uint16_t)hi;
+    } else if (strcmp(name, "nptv6") == 0) {
+        if (nat_parse_nptv6(cfg, value) != 0) {
+            zlog_error(zc, "Config error: 'nptv6' needs two IPv6 prefixes of the same length up to /64 (%s)",
+                       value);
+            return 0;
+        }
+    } else if (strcmp(name, "tcp_timeout") == 0) {
+        cfg->tcp_timeout = (unsigned)atoi(value);
+    } else if (strcmp(name, "tcp_transitory_timeout") == 0) {
+        cfg->tcp_transitory_timeout = (unsigned)atoi(value);
+    } else if (strcmp(name, "udp_timeout") == 0) {
+        cfg->udp_timeout = (unsigned)atoi(value);
+    } else if (strcmp(name, "icmp_timeout") == 0) {
+        cfg->icmp_timeout = (unsigned)atoi(value);
+    } else if (strcmp(name, "max_mappings") == 0) {
+        cfg->max_mappings = (unsigned)atoi(value);
+    } else if (strcmp(name, "shards") == 0) {
+        cfg->shards = (unsigned)atoi(value);
+    } else {
+        zlog_warn(zc, "Unknown NAT key ignored: %s", name);
+    }
+    return 1;
+}
+
+ad_tun_error_t ad_tun_nat_load_config(const char *path, ad_tun_nat_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!path || !cfg) {
+        zlog_error(zc, "Invalid arguments to ad_tun_nat_load_config()");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    ad_tun_nat_default_config(cfg);
+
+    nat_parse_ctx_t ctx = { cfg, 0 };
+    int rc = ini_parse(path, nat_ini_handler, &ctx);
+    if (rc < 0) {
+        zlog_error(zc, "Failed to open config file: %s", path);
+        return AD_TUN_ERR_CONFIG;
+    } else if (rc > 0) {
+        zlog_error(zc, "Parsing error at line %d in config file %s", rc, path);
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    if (!ctx.seen_nat) {
+        zlog_debug(zc, "No [nat] section in %s, NAT disabled", path);
+        ad_tun_nat_default_config(cfg);
+        return AD_TUN_OK;
+    }
+
+    if (cfg->enabled != 0 && cfg->enabled != 1) {
+        zlog_warn(zc, "Config warning: 'enabled' should be 0 or 1, NAT disabled");
+        cfg->enabled = 0;
+    }
+
+    if (cfg->shards == 0 || cfg->shards > AD_TUN_NAT_MAX_SHARDS) {
+        zlog_warn(zc, "Config warning: 'shards' is invalid, using default %d", DEFAULT_NAT_SHARDS);
+        cfg->shards = DEFAULT_NAT_SHARDS;
+    }
+
+    if (cfg->max_mappings == 0) {
+        zlog_warn(zc, "Config warning: 'max_mappings' is invalid, using default %d", DEFAULT_NAT_MAX_MAPPINGS);
+        cfg->max_mappings = DEFAULT_NAT_MAX_MAPPINGS;
+    }
+
+    zlog_info(zc, "NAT config loaded from %s: enabled=%d, external=%u, ports=%u-%u, nptv6=%d",
+              path, cfg->enabled, cfg->naddrs, cfg->port_lo, cfg->port_hi, cfg->nptv6);
+    return AD_TUN_OK;
+}
+
+/* ---- Table ---- */
+
+static uint64_t nat_timeout_ns(const ad_tun_nat_t *nat, unsigned tclass)
+{
+    unsigned s;
+    switch (tclass) {
+    case NAT_T_EST: s = nat->cfg.tcp_timeout; break;
+    case NAT_T_TRANS: s = nat->cfg.tcp_transitory_timeout; break;
+    case NAT_T_UDP: s = nat->cfg.udp_timeout; break;
+    default: s = nat->cfg.icmp_timeout; break;
+    }
+    return (uint64_t)s * 1000000000ULL;
+}
+
+static inline uint32_t nat_hash(const uint8_t *addr, uint16_t port, unsigned proto)
+{
+    uint64_t k = ((uint64_t)ad_tun_get_be32(addr) << 32) | ((uint64_t)port << 16) | proto;
+    k *= 0x9e3779b97f4a7c15ULL;
+    return (uint32_t)(k >> 32);
+}
+
+static inline int32_t *nat_port_slot(const ad_tun_nat_t *nat, ad_tun_nat_shard_t *sh,
+                                     unsigned proto, unsigned addr_idx, uint16_t port)
+{
+    return &sh->ports[((size_t)proto * nat->cfg.naddrs + addr_idx) * nat->ports_per_shard + (port - sh->base)];
+}
+
+static void nat_lru_unlink(ad_tun_nat_shard_t *sh, int32_t i)
+{
+    nat_entry_t *e = &sh->entries[i];
+    if (e->prev >= 0) sh->entries[e->prev].next = e->next;
+    else sh->lru_head[e->tclass] = e->next;
+    if (e->next >= 0) sh->entries[e->next].prev = e->prev;
+    else sh->lru_tail[e->tclass] = e->prev;
+}
+
+static void nat_lru_push(ad_tun_nat_shard_t *sh, int32_t i)
+{
+    nat_entry_t *e = &sh->entries[i];
+    e->next = -1;
+    e->prev = sh->lru_tail[e->tclass];
+    if (e->prev >= 0) sh->entries[e->prev].next = i;
+    else sh->lru_head[e->tclass] = i;
+    sh->lru_tail[e->tclass] = i;
+}
+
+/* Refresh a mapping, moving it to another timeout class if needed */
+static void nat_touch(ad_tun_nat_shard_t *sh, int32_t i, unsigned tclass, uint64_t now_ns)
+{
+    nat_entry_t *e = &sh->entries[i];
+    e->last_ns = now_ns;
+    if (sh->lru_tail[e->tclass] == i && e->tclass == tclass) return;
+    nat_lru_unlink(sh, i);
+    e->tclass = (uint8_t)tclass;
+    nat_lru_push(sh, i);
+}
+
+static void nat_entry_free(ad_tun_nat_t *nat, ad_tun_nat_shard_t *sh, int32_t i)
+{
+    nat_entry_t *e = &sh->entries[i];
+
+    int32_t *pp = &sh->heads[nat_hash(e->int_addr, e->int_port, e->proto) & sh->hmask];
+    while (*pp != i) pp = &sh->entries[*pp].hnext;
+    *pp = e->hnext;
+
+    nat_lru_unlink(sh, i);
+    *nat_port_slot(nat, sh, e->proto, e->addr_idx, e->ext_port) = -1;
+
+    e->hnext = sh->free_head;
+    sh->free_head = i;
+    sh->stats.mappings--;
+}
+
+/* A clock behind last_ns (another thread's now_ns) never expires the entry */
+static int nat_expired(const ad_tun_nat_t *nat, const nat_entry_t *e, uint64_t now_ns)
+{
+    return now_ns > e->last_ns && now_ns - e->last_ns > nat_timeout_ns(nat, e->tclass);
+}
+
+static unsigned nat_shard_expire(ad_tun_nat_t *nat, ad_tun_nat_shard_t *sh, uint64_t now_ns)
+{
+    unsigned n = 0;
+
+    for (unsigned c = 0; c < NAT_NCLASS; c++) {
+        while (sh->lru_head[c] >= 0 && nat_expired(nat, &sh->entries[sh->lru_head[c]], now_ns)) {
+            nat_entry_free(nat, sh, sh->lru_head[c]);
+            n++;
+        }
+    }
+    sh->stats.expired += n;
+    return n;
+}
+
+static int32_t nat_find_out(ad_tun_nat_shard_t *sh, const uint8_t *addr, uint16_t port, unsigned proto)
+{
+    int32_t i = sh->heads[nat_hash(addr, port, proto) & sh->hmask];
+    while (i >= 0) {
+        const nat_entry_t *e = &sh->entries[i];
+        if (e->int_port == port && e->proto == proto && memcmp(e->int_addr, addr, 4) == 0) return i;
+        i = e->hnext;
+    }
+    return -1;
+}
+
+/* Free external port of the shard on addr, preferring the internal port */
+static int nat_pick_port(const ad_tun_nat_t *nat, ad_tun_nat_shard_t *sh, unsigned proto,
+                         unsigned addr_idx, uint16_t want)
+{
+    unsigned per = nat->ports_per_shard;
+
+    if (want >= sh->base && (unsigned)(want - sh->base) < per && *nat_port_slot(nat, sh, proto, addr_idx, want) < 0) {
+        return want;
+    }
+
+    int32_t *slots = nat_port_slot(nat, sh, proto, addr_idx, sh->base);
+    unsigned c = sh->cursor[proto];
+    for (unsigned j = 0; j < per; j++) {
+        unsigned k = c + j < per ? c + j : c + j - per;
+        if (slots[k] < 0) {
+            sh->cursor[proto] = k + 1 < per ? k + 1 : 0;
+            return sh->base + k;
+        }
+    }
+    return -1;
+}
+
+static int32_t nat_create(ad_tun_nat_t *nat, ad_tun_nat_shard_t *sh, const uint8_t *addr, uint16_t port,
+                          unsigned proto, uint64_t now_ns)
+{
+    if (sh->free_head < 0) nat_shard_expire(nat, sh, now_ns);
+    if (sh->free_head < 0) return -1;
+
+    /* Paired pooling: an internal address keeps its external address while it has ports */
+    unsigned first = nat_hash(addr, 0, 0) % nat->cfg.naddrs;
+    int ext = -1;
+    unsigned a = first;
+    for (int pass = 0; pass < 2 && ext < 0; pass++) {
+        if (pass == 1 && nat_shard_expire(nat, sh, now_ns) == 0) break;
+        for (unsigned t = 0; t < nat->cfg.naddrs && ext < 0; t++) {
+            a = (first + t) % nat->cfg.naddrs;
+            ext = nat_pick_port(nat, sh, proto, a, port);
+        }
+    }
+    if (ext < 0) return -1;
+
+    int32_t i = sh->free_head;
+    nat_entry_t *e = &sh->entries[i];
+    sh->free_head = e->hnext;
+
+    memcpy(e->int_addr, addr, 4);
+    e->int_port = port;
+    e->ext_port = (uint16_t)ext;
+    e->addr_idx = (uint8_t)a;
+    e->proto = (uint8_t)proto;
+    e->tclass = proto == NAT_TCP ? NAT_T_TRANS : (proto == NAT_UDP ? NAT_T_UDP : NAT_T_ICMP);
+    e->closing = 0;
+    e->last_ns = now_ns;
+
+    uint32_t h = nat_hash(addr, port, proto) & sh->hmask;
+    e->hnext = sh->heads[h];
+    sh->heads[h] = i;
+    *nat_port_slot(nat, sh, proto, a, (uint16_t)ext) = i;
+    nat_lru_push(sh, i);
+
+    sh->stats.created++;
+    sh->stats.mappings++;
+    return i;
+}
+
+static void nat_shard_free(ad_tun_nat_shard_t *sh)
+{
+    free(sh->entries);
+    free(sh->heads);
+    free(sh->ports);
+    pthread_mutex_destroy(&sh->lock);
+}
+
+static int ones_add(unsigned a, unsigned b)
+{
+    unsigned s = a + b;
+    return (int)((s & 0xffff) + (s >> 16));
+}
+
+ad_tun_error_t ad_tun_nat_init(ad_tun_nat_t *nat, const ad_tun_nat_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!nat || !cfg || cfg->shards == 0 || cfg->shards > AD_TUN_NAT_MAX_SHARDS ||
+        cfg->naddrs > AD_TUN_NAT_MAX_ADDRS || cfg->port_lo == 0 || cfg->port_lo > cfg->port_hi ||
+        cfg->max_mappings < cfg->shards || cfg->internal_plen > 32 ||
+        (cfg->nptv6 && (cfg->npt_plen == 0 || cfg->npt_plen > 64)) ||
+        (unsigned)(cfg->port_hi - cfg->port_lo + 1) < cfg->shards) {
+        zlog_error(zc, "ad_tun_nat_init: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    memset(nat, 0, sizeof(*nat));
+    nat->cfg = *cfg;
+    nat->nshards = cfg->shards;
+    nat->ports_per_shard = (unsigned)(cfg->port_hi - cfg->port_lo + 1) / cfg->shards;
+
+    if (cfg->nptv6) {
+        /* Checksum-neutral mapping: internal minus external, added to one word (RFC 6296 3.2) */
+        uint16_t si = ad_tun_csum_fold(ad_tun_csum_partial(cfg->npt_internal, 16, 0));
+        uint16_t se = ad_tun_csum_fold(ad_tun_csum_partial(cfg->npt_external, 16, 0));
+        nat->npt_adjust = (uint16_t)ones_add(se, (uint16_t)~si);
+        nat->npt_word = cfg->npt_plen <= 48 ? 3 : 4;
+    }
+
+    if (cfg->naddrs == 0) {
+        zlog_info(zc, "NAT initialized without IPv4 addresses: nptv6=%d", cfg->nptv6);
+        return AD_TUN_OK;
+    }
+
+    if (posix_memalign((void**)&nat->shards, 64, nat->nshards * sizeof(*nat->shards)) != 0) {
+        zlog_error(zc, "ad_tun_nat_init: allocation failed");
+        return AD_TUN_ERR_SYS;
+    }
+    memset(nat->shards, 0, nat->nshards * sizeof(*nat->shards));
+
+    unsigned cap = cfg->max_mappings / nat->nshards;
+    uint32_t buckets = 16;
+    while (buckets < cap) buckets <<= 1;
+
+    for (unsigned s = 0; s < nat->nshards; s++) {
+        ad_tun_nat_shard_t *sh = &nat->shards[s];
+        pthread_mutex_init(&sh->lock, NULL);
+        sh->cap = cap;
+        sh->base = (uint16_t)(cfg->port_lo + s * nat->ports_per_shard);
+        sh->hmask = buckets - 1;
+        sh->entries = malloc(cap * sizeof(*sh->entries));
+        sh->heads = malloc(buckets * sizeof(*sh->heads));
+        size_t nports = (size_t)NAT_NPROTO * cfg->naddrs * nat->ports_per_shard;
+        sh->ports = malloc(nports * sizeof(*sh->ports));
+        if (!sh->entries || !sh->heads || !sh->ports) {
+            zlog_error(zc, "ad_tun_nat_init: allocation failed");
+            nat->nshards = s + 1;
+            ad_tun_nat_free(nat);
+            return AD_TUN_ERR_SYS;
+        }
+
+        memset(sh->heads, 0xff, buckets * sizeof(*sh->heads));
+        memset(sh->ports, 0xff, nports * sizeof(*sh->ports));
+        for (unsigned i = 0; i < cap; i++) sh->entries[i].hnext = i + 1 < cap ? (int32_t)i + 1 : -1;
+        sh->free_head = 0;
+        for (unsigned c = 0; c < NAT_NCLASS; c++) sh->lru_head[c] = sh->lru_tail[c] = -1;
+    }
+
+    zlog_info(zc, "NAT initialized: external=%u, shards=%u, ports/shard=%u, mappings/shard=%u, nptv6=%d",
+              cfg->naddrs, nat->nshards, nat->ports_per_shard, cap, cfg->nptv6);
+    return AD_TUN_OK;
+}
+
+void ad_tun_nat_free(ad_tun_nat_t *nat)
+{
+    if (!nat) return;
+
+    if (nat->shards) {
+        for (unsigned s = 0; s < nat->nshards; s++) nat_shard_free(&nat->shards[s]);
+        free(nat->shards);
+    }
+    memset(nat, 0, sizeof(*nat));
+}
+
+unsigned ad_tun_nat_expire(ad_tun_nat_t *nat, uint64_t now_ns)
+{
+    unsigned n = 0;
+    if (!nat || !nat->shards) return 0;
+
+    for (unsigned s = 0; s < nat->nshards; s++) {
+        pthread_mutex_lock(&nat->shards[s].lock);
+        n += nat_shard_expire(nat, &nat->shards[s], now_ns);
+        pthread_mutex_unlock(&nat->shards[s].lock);
+    }
+    return n;
+}
+
+void ad_tun_nat_get_stats(ad_tun_nat_t *nat, ad_tun_nat_stats_t *stats)
+{
+    if (!stats) return;
+    memset(stats, 0, sizeof(*stats));
+    if (!nat) return;
+
+    uint64_t *dst = (uint64_t*)stats;
+    const unsigned fields = sizeof(*stats) / sizeof(uint64_t);
+
+    const uint64_t *g = (const uint64_t*)&nat->stats;
+    for (unsigned f = 0; f < fields; f++) dst[f] = __atomic_load_n(&g[f], __ATOMIC_RELAXED);
+
+    for (unsigned s = 0; nat->shards && s < nat->nshards; s++) {
+        pthread_mutex_lock(&nat->shards[s].lock);
+        const uint64_t *src = (const uint64_t*)&nat->shards[s].stats;
+        for (unsigned f = 0; f < fields; f++) dst[f] += src[f];
+        pthread_mutex_unlock(&nat->shards[s].lock);
+    }
+}
+
+/* ---- Rewriting ---- */
+
+/* Rewrite len bytes at field, keeping the checksums covering them right */
+static void nat_set(unsigned char *field, const void *val, size_t len, unsigned char *c1, unsigned char *c2)
+{
+    if (c1) ad_tun_csum_adjust(c1, field, val, len);
+    if (c2) ad_tun_csum_adjust(c2, field, val, len);
+    memcpy(field, val, len);
+}
+
+/* Adjust a checksum that is itself covered by an outer checksum (ICMP errors) */
+static void nat_nested_adjust(unsigned char *csum, unsigned char *outer, const void *old, const void *val,
+                              size_t len)
+{
+    unsigned char v[2] = { csum[0], csum[1] };
+    ad_tun_csum_adjust(v, old, val, len);
+    nat_set(csum, v, 2, outer, NULL);
+}
+
+/* Offsets of the port (or echo id) and checksum fields in an L4 header */
+static void nat_l4_fields(unsigned proto, int dst, unsigned *port_off, unsigned *csum_off)
+{
+    switch (proto) {
+    case NAT_TCP: *port_off = dst ? 2 : 0; *csum_off = 16; break;
+    case NAT_UDP: *port_off = dst ? 2 : 0; *csum_off = 6; break;
+    default: *port_off = 4; *csum_off = 2; break;
+    }
+}
+
+static unsigned nat_l4_min(unsigned proto)
+{
+    return proto == NAT_TCP ? 20 : 8;
+}
+
+/* Rewrite the address at p + addr_off and the port of the L4 header at l4 */
+static void nat_rewrite(unsigned char *p, unsigned addr_off, unsigned char *l4, unsigned proto, int dst,
+                        const uint8_t *addr, uint16_t port)
+{
+    unsigned port_off, csum_off;
+    nat_l4_fields(proto, dst, &port_off, &csum_off);
+
+    unsigned char *l4c = l4 + csum_off;
+    int udp_none = proto == NAT_UDP && l4c[0] == 0 && l4c[1] == 0;
+    if (udp_none) l4c = NULL;
+
+    /* ICMP has no pseudo header */
+    nat_set(p + addr_off, addr, 4, p + 10, proto == NAT_ICMP ? NULL : l4c);
+
+    unsigned char be[2];
+    ad_tun_put_be16(be, port);
+    nat_set(l4 + port_off, be, 2, l4c, NULL);
+
+    if (proto == NAT_UDP && !udp_none && l4c[0] == 0 && l4c[1] == 0) l4c[0] = l4c[1] = 0xff;
+}
+
+/* Checksum-neutral NPTv6 rewrite of the prefix of addr (RFC 6296) */
+static int nat_npt(const ad_tun_nat_t *nat, uint8_t *addr, const uint8_t *to, uint16_t adjust)
+{
+    unsigned plen = nat->cfg.npt_plen;
+    unsigned w = nat->npt_word;
+
+    /* Past /48 the first IID word that is not 0xffff carries the adjustment */
+    if (plen > 48) {
+        while (w < 8 && ad_tun_get_be16(addr + 2 * w) == 0xffff) w++;
+        if (w == 8) return -1;
+    } else if (ad_tun_get_be16(addr + 2 * w) == 0xffff) {
+        return -1;
+    }
+
+    unsigned full = plen / 8, rest = plen % 8;
+    memcpy(addr, to, full);
+    if (rest) {
+        uint8_t m = (uint8_t)(0xff00 >> rest);
+        addr[full] = (uint8_t)((to[full] & m) | (addr[full] & ~m));
+    }
+
+    unsigned v = (unsigned)ones_add(ad_tun_get_be16(addr + 2 * w), adjust);
+    if (v == 0xffff) v = 0;
+    ad_tun_put_be16(addr + 2 * w, (uint16_t)v);
+    return 0;
+}
+
+static int nat_prefix_match(const uint8_t *a, const uint8_t *p, unsigned plen)
+{
+    unsigned full = plen / 8, rest = plen % 8;
+    if (memcmp(a, p, full) != 0) return 0;
+    return rest == 0 || ((a[full] ^ p[full]) & (uint8_t)(0xff00 >> rest)) == 0;
+}
+
+/* ---- Batches ---- */
+
+static inline void nat_count(uint64_t *field)
+{
+    __atomic_fetch_add(field, 1, __ATOMIC_RELAXED);
+}
+
+/* Map an L4 protocol to a NAT protocol; ICMP needs echo type want */
+static int nat_proto_of(const ad_tun_pkt_info_t *info, const unsigned char *l4, int want_echo_type)
+{
+    if (info->proto == IPPROTO_TCP) return NAT_TCP;
+    if (info->proto == IPPROTO_UDP) return NAT_UDP;
+    if (info->proto == IPPROTO_ICMP && l4[0] == want_echo_type && l4[1] == 0) return NAT_ICMP;
+    return -1;
+}
+
+/* First pass outbound: decide what a packet needs, and its shard */
+static void nat_classify_out(ad_tun_nat_t *nat, ad_tun_buf_t *b, nat_pkt_t *pk)
+{
+    ad_tun_pkt_info_t *info = &pk->info;
+
+    if (ad_tun_pkt_parse(b->data, b->len, info) != 0) {
+        pk->shard = NAT_DROP;
+        return;
+    }
+
+    if (info->family == AF_INET6) {
+        pk->shard = NAT_PASS;
+        if (nat->cfg.nptv6 && nat_prefix_match(info->src, nat->cfg.npt_internal, nat->cfg.npt_plen)) {
+            pk->shard = nat_npt(nat, b->data + 8, nat->cfg.npt_external, nat->npt_adjust) == 0 ? NAT_KEEP : NAT_DROP;
+        }
+        return;
+    }
+
+    if (!nat->shards || (nat->cfg.internal_plen &&
+                         !nat_prefix_match(info->src, nat->cfg.internal, nat->cfg.internal_plen))) {
+        pk->shard = NAT_PASS;
+        return;
+    }
+
+    const unsigned char *l4 = b->data + info->l3_len;
+    int proto = info->is_frag || b->len < (size_t)info->l3_len + 8 ? -1 : nat_proto_of(info, l4, 8);
+    if (proto < 0 || b->len < (size_t)info->l3_len + nat_l4_min((unsigned)proto)) {
+        pk->shard = NAT_DROP;
+        return;
+    }
+
+    pk->proto = (uint8_t)proto;
+    pk->port = proto == NAT_ICMP ? ad_tun_get_be16(l4 + 4) : info->sport;
+    pk->shard = (uint8_t)(nat_hash(info->src, pk->port, (unsigned)proto) % nat->nshards);
+}
+
+/* Shard owning an external port, or NAT_PASS */
+static uint8_t nat_shard_of_port(const ad_tun_nat_t *nat, uint16_t port)
+{
+    if (port < nat->cfg.port_lo) return NAT_PASS;
+    unsigned s = (unsigned)(port - nat->cfg.port_lo) / nat->ports_per_shard;
+    return s < nat->nshards ? (uint8_t)s : NAT_PASS;
+}
+
+/* First pass inbound */
+static void nat_classify_in(ad_tun_nat_t *nat, ad_tun_buf_t *b, nat_pkt_t *pk)
+{
+    ad_tun_pkt_info_t *info = &pk->info;
+    pk->shard = NAT_PASS;
+    pk->icmp_error = 0;
+
+    if (ad_tun_pkt_parse(b->data, b->len, info) != 0) return;
+
+    if (info->family == AF_INET6) {
+        if (nat->cfg.nptv6 && nat_prefix_match(info->dst, nat->cfg.npt_external, nat->cfg.npt_plen)) {
+            uint16_t back = (uint16_t)~nat->npt_adjust;
+            pk->shard = nat_npt(nat, b->data + 24, nat->cfg.npt_internal, back) == 0 ? NAT_KEEP : NAT_DROP;
+        }
+        return;
+    }
+
+    if (!nat->shards) return;
+    unsigned a;
+    for (a = 0; a < nat->cfg.naddrs; a++) {
+        if (memcmp(info->dst, nat->cfg.addrs[a], 4) == 0) break;
+    }
+    if (a == nat->cfg.naddrs) return;
+    pk->addr_idx = (uint8_t)a;
+
+    unsigned char *l4 = b->data + info->l3_len;
+    if (info->is_frag || b->len < (size_t)info->l3_len + 8) {
+        pk->shard = NAT_DROP;
+        return;
+    }
+
+    int proto = nat_proto_of(info, l4, 0);
+    if (proto < 0 && info->proto == IPPROTO_ICMP && (l4[0] == 3 || l4[0] == 11 || l4[0] == 12)) {
+        /* Error quoting one of our packets: the quoted source is the external side */
+        size_t in_off = info->l3_len + 8;
+        const unsigned char *in = b->data + in_off;
+        if (b->len < in_off + 20 || (in[0] >> 4) != 4) return;
+        size_t in_l4 = in_off + (size_t)(in[0] & 0x0f) * 4;
+        if (b->len < in_l4 + 8 || memcmp(in + 12, nat->cfg.addrs[a], 4) != 0) return;
+
+        const unsigned char *q = b->data + in_l4;
+        if (in[9] == IPPROTO_TCP) proto = NAT_TCP;
+        else if (in[9] == IPPROTO_UDP) proto = NAT_UDP;
+        else if (in[9] == IPPROTO_ICMP && q[0] == 8) proto = NAT_ICMP;
+        else return;
+
+        pk->icmp_error = 1;
+        pk->inner = (uint16_t)in_off;
+        pk->port = proto == NAT_ICMP ? ad_tun_get_be16(q + 4) : ad_tun_get_be16(q);
+    } else if (proto < 0) {
+        return;
+    } else {
+        if (b->len < (size_t)info->l3_len + nat_l4_min((unsigned)proto)) {
+            pk->shard = NAT_DROP;
+            return;
+        }
+        pk->port = proto == NAT_ICMP ? ad_tun_get_be16(l4 + 4) : info->dport;
+    }
+
+    pk->proto = (uint8_t)proto;
+    pk->shard = nat_shard_of_port(nat, pk->port);
+    if (pk->shard == NAT_PASS) nat_count(&nat->stats.no_mapping);
+}
+
+static void nat_tcp_state(nat_entry_t *e, const unsigned char *tcp, int inbound, unsigned *tclass)
+{
+    uint8_t flags = tcp[13];
+    if (flags & (TCP_FIN | TCP_RST)) e->closing = 1;
+    if (e->closing) *tclass = NAT_T_TRANS;
+    else if (inbound) *tclass = NAT_T_EST;
+    else *tclass = e->tclass;
+}
+
+/* Translate one outbound packet under the shard lock */
+static uint8_t nat_do_out(ad_tun_nat_t *nat, ad_tun_nat_shard_t *sh, ad_tun_buf_t *b, nat_pkt_t *pk,
+                          uint64_t now_ns)
+{
+    int32_t i = nat_find_out(sh, pk->info.src, pk->port, pk->proto);
+    if (i >= 0 && nat_expired(nat, &sh->entries[i], now_ns)) {
+        nat_entry_free(nat, sh, i);
+        sh->stats.expired++;
+        i = -1;
+    }
+    if (i < 0) i = nat_create(nat, sh, pk->info.src, pk->port, pk->proto, now_ns);
+    if (i < 0) {
+        sh->stats.exhausted++;
+        return NAT_DROP;
+    }
+
+    nat_entry_t *e = &sh->entries[i];
+    unsigned char *l4 = b->data + pk->info.l3_len;
+    unsigned tclass = e->tclass;
+    if (e->proto == NAT_TCP) nat_tcp_state(e, l4, 0, &tclass);
+    nat_touch(sh, i, tclass, now_ns);
+
+    nat_rewrite(b->data, 12, l4, pk->proto, 0, nat->cfg.addrs[e->addr_idx], e->ext_port);
+    sh->stats.out++;
+    return NAT_KEEP;
+}
+
+/* Translate the destination of an ICMP error and the source of the packet it quotes */
+static void nat_do_icmp_error(ad_tun_buf_t *b, nat_pkt_t *pk, const nat_entry_t *e)
+{
+    unsigned char *p = b->data;
+    unsigned char *icmpc = p + pk->info.l3_len + 2;
+    unsigned char *in = p + pk->inner;
+    unsigned char *q = in + (in[0] & 0x0f) * 4;
+    size_t avail = b->len - (size_t)(q - p);
+
+    unsigned port_off, csum_off;
+    nat_l4_fields(e->proto, 0, &port_off, &csum_off);
+    unsigned char *qc = avail >= csum_off + 2 ? q + csum_off : NULL;
+    if (qc && e->proto == NAT_UDP && qc[0] == 0 && qc[1] == 0) qc = NULL;
+
+    /* Quoted address: quoted IP checksum, quoted L4 pseudo header, ICMP checksum */
+    nat_set(p + 16, e->int_addr, 4, p + 10, NULL);
+    nat_nested_adjust(in + 10, icmpc, in + 12, e->int_addr, 4);
+    if (qc && e->proto != NAT_ICMP) nat_nested_adjust(qc, icmpc, in + 12, e->int_addr, 4);
+    nat_set(in + 12, e->int_addr, 4, icmpc, NULL);
+
+    unsigned char be[2];
+    ad_tun_put_be16(be, e->int_port);
+    if (qc) nat_nested_adjust(qc, icmpc, q + port_off, be, 2);
+    nat_set(q + port_off, be, 2, icmpc, NULL);
+}
+
+/* Translate one inbound packet under the shard lock */
+static uint8_t nat_do_in(ad_tun_nat_t *nat, ad_tun_nat_shard_t *sh, ad_tun_buf_t *b, nat_pkt_t *pk,
+                         uint64_t now_ns)
+{
+    int32_t i = *nat_port_slot(nat, sh, pk->proto, pk->addr_idx, pk->port);
+    if (i >= 0 && nat_expired(nat, &sh->entries[i], now_ns)) {
+        nat_entry_free(nat, sh, i);
+        sh->stats.expired++;
+        i = -1;
+    }
+    if (i < 0) {
+        sh->stats.no_mapping++;
+        return NAT_PASS;
+    }
+
+    nat_entry_t *e = &sh->entries[i];
+    if (pk->icmp_error) {
+        nat_do_icmp_error(b, pk, e);
+        sh->stats.icmp_errors++;
+        return NAT_KEEP;
+    }
+
+    unsigned char *l4 = b->data + pk->info.l3_len;
+    unsigned tclass = e->tclass;
+    if (e->proto == NAT_TCP) nat_tcp_state(e, l4, 1, &tclass);
+    nat_touch(sh, i, tclass, now_ns);
+
+    nat_rewrite(b->data, 16, l4, pk->proto, 1, e->int_addr, e->int_port);
+    sh->stats.in++;
+    return NAT_KEEP;
+}
+
+static unsigned nat_batch(ad_tun_nat_t *nat, ad_tun_buf_t **bufs, unsigned n, uint64_t now_ns,
+                          ad_tun_buf_t **drops, int out)
+{
+    if (!nat || !bufs || !drops) return 0;
+
+    nat_pkt_t pk[NAT_CHUNK];
+    unsigned k = 0;
+
+    for (unsigned off = 0; off < n; off += NAT_CHUNK) {
+        unsigned m = n - off < NAT_CHUNK ? n - off : NAT_CHUNK;
+        uint64_t pending = 0;
+
+        for (unsigned i = 0; i < m; i++) {
+            if (out) nat_classify_out(nat, bufs[off + i], &pk[i]);
+            else nat_classify_in(nat, bufs[off + i], &pk[i]);
+            if (pk[i].shard < AD_TUN_NAT_MAX_SHARDS) pending |= 1ULL << pk[i].shard;
+        }
+
+        /* One lock round per shard and chunk */
+        while (pending) {
+            unsigned s = (unsigned)__builtin_ctzll(pending);
+            pending &= pending - 1;
+            ad_tun_nat_shard_t *sh = &nat->shards[s];
+
+            pthread_mutex_lock(&sh->lock);
+            for (unsigned i = 0; i < m; i++) {
+                if (pk[i].shard != s) continue;
+                pk[i].shard = out ? nat_do_out(nat, sh, bufs[off + i], &pk[i], now_ns)
+                                  : nat_do_in(nat, sh, bufs[off + i], &pk[i], now_ns);
+            }
+            pthread_mutex_unlock(&sh->lock);
+        }
+
+        for (unsigned i = 0; i < m; i++) {
+            ad_tun_buf_t *b = bufs[off + i];
+            if (pk[i].shard == NAT_DROP) {
+                nat_count(&nat->stats.dropped);
+                b->next = *drops;
+                *drops = b;
+                continue;
+            }
+            if (pk[i].shard == NAT_PASS) nat_count(&nat->stats.passed);
+            else if (pk[i].info.family == AF_INET6) nat_count(out ? &nat->stats.out : &nat->stats.in);
+            bufs[k++] = b;
+        }
+    }
+    return k;
+}
+
+unsigned ad_tun_nat_out(ad_tun_nat_t *nat, ad_tun_buf_t **bufs, unsigned n, uint64_t now_ns,
+                        ad_tun_buf_t **drops)
+{
+    return nat_batch(nat, bufs, n, now_ns, drops, 1);
+}
+
+unsigned ad_tun_nat_in(ad_tun_nat_t *nat, ad_tun_buf_t **bufs, unsigned n, uint64_t now_ns,
+                       ad_tun_buf_t **drops)
+{
+    return nat_batch(nat, bufs, n, now_ns, drops, 0);
+}
@@ -0,0 +1,338 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Netlink Helper     **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_nl.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#define NL_INITIAL_CAP 65536
+#define NL_CHUNK_BYTES 32768        /* per sendmsg(), well below the default socket buffer */
+#define NL_CHUNK_MSGS 128           /* acks per chunk must fit the receive buffer */
+#define NL_SOCK_BUF (4 << 20)
+#define NL_RECV_TIMEOUT_S 5
+
+#ifndef NETLINK_CAP_ACK
+#define NETLINK_CAP_ACK 10
+#endif
+
+ad_tun_error_t ad_tun_nl_open(ad_tun_nl_t *nl)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!nl) {
+        zlog_error(zc, "ad_tun_nl_open: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    memset(nl, 0, sizeof(*nl));
+    nl->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (nl->fd < 0) {
+        zlog_error(zc, "ad_tun_nl_open: socket() failed: %s", strerror(errno));
+        return AD_TUN_ERR_SYS;
+    }
+
+    /* Larger buffers when allowed; acks then only carry the header back */
+    int sz = NL_SOCK_BUF;
+    if (setsockopt(nl->fd, SOL_SOCKET, SO_RCVBUFFORCE, &sz, sizeof(sz)) < 0) {
+        setsockopt(nl->fd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+    }
+    int one = 1;
+    setsockopt(nl->fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+    struct timeval tv = { NL_RECV_TIMEOUT_S, 0 };
+    setsockopt(nl->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    struct sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    if (bind(nl->fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        zlog_error(zc, "ad_tun_nl_open: bind() failed: %s", strerror(errno));
+        close(nl->fd);
+        nl->fd = -1;
+        return AD_TUN_ERR_SYS;
+    }
+
+    nl->seq = (uint32_t)time(NULL) | 1;
+    return AD_TUN_OK;
+}
+
+void ad_tun_nl_close(ad_tun_nl_t *nl)
+{
+    if (!nl) return;
+    if (nl->fd >= 0) close(nl->fd);
+    free(nl->buf);
+    memset(nl, 0, sizeof(*nl));
+    nl->fd = -1;
+}
+
+/* Make room for len more bytes */
+static int nl_reserve(ad_tun_nl_t *nl, size_t len)
+{
+    if (nl->len + len <= nl->cap) return 0;
+
+    size_t cap = nl->cap ? nl->cap : NL_INITIAL_CAP;
+    while (cap < nl->len + len) cap *= 2;
+
+    unsigned char *buf = realloc(nl->buf, cap);
+    if (!buf) return -ENOMEM;
+    nl->buf = buf;
+    nl->cap = cap;
+    return 0;
+}
+
+uint32_t ad_tun_nl_request(ad_tun_nl_t *nl, uint16_t type, uint16_t flags,
+                           const void *payload, size_t len)
+{
+    size_t total = NLMSG_ALIGN(NLMSG_HDRLEN + len);
+    if (nl_reserve(nl, total) != 0) return 0;
+
+    struct nlmsghdr *h = (struct nlmsghdr *)(nl->buf + nl->len);
+    memset(h, 0, total);
+    h->nlmsg_len = (uint32_t)(NLMSG_HDRLEN + len);
+    h->nlmsg_type = type;
+    h->nlmsg_flags = (uint16_t)(flags | NLM_F_REQUEST | NLM_F_ACK);
+    if (++nl->seq == 0) nl->seq = 1;
+    h->nlmsg_seq = nl->seq;
+    memcpy(NLMSG_DATA(h), payload, len);
+
+    nl->last = nl->len;
+    nl->len += total;
+    nl->pending++;
+    return h->nlmsg_seq;
+}
+
+int ad_tun_nl_attr(ad_tun_nl_t *nl, uint16_t type, const void *data, size_t len)
+{
+    if (nl->pending == 0) return -EINVAL;
+
+    size_t last = nl->last;
+    size_t alen = RTA_SPACE(len);
+    if (nl_reserve(nl, alen) != 0) return -ENOMEM;
+
+    struct nlmsghdr *h = (struct nlmsghdr *)(nl->buf + last);
+    struct rtattr *rta = (struct rtattr *)(nl->buf + last + NLMSG_ALIGN(h->nlmsg_len));
+    memset(rta, 0, alen);
+    rta->rta_type = type;
+    rta->rta_len = (unsigned short)RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+
+    h->nlmsg_len = NLMSG_ALIGN(h->nlmsg_len) + (uint32_t)alen;
+    nl->len = last + h->nlmsg_len;
+    return 0;
+}
+
+uint32_t ad_tun_nl_link_set(ad_tun_nl_t *nl, int ifindex, unsigned mtu, int up)
+{
+    struct ifinfomsg ifi;
+    memset(&ifi, 0, sizeof(ifi));
+    ifi.ifi_family = AF_UNSPEC;
+    ifi.ifi_index = ifindex;
+    if (up >= 0) {
+        ifi.ifi_change = IFF_UP;
+        ifi.ifi_flags = up ? IFF_UP : 0;
+    }
+
+    uint32_t seq = ad_tun_nl_request(nl, RTM_NEWLINK, 0, &ifi, sizeof(ifi));
+    if (seq && mtu) {
+        uint32_t v = mtu;
+        if (ad_tun_nl_attr(nl, IFLA_MTU, &v, sizeof(v)) != 0) return 0;
+    }
+    return seq;
+}
+
+uint32_t ad_tun_nl_link_del(ad_tun_nl_t *nl, int ifindex)
+{
+    struct ifinfomsg ifi;
+    memset(&ifi, 0, sizeof(ifi));
+    ifi.ifi_family = AF_UNSPEC;
+    ifi.ifi_index = ifindex;
+    return ad_tun_nl_request(nl, RTM_DELLINK, 0, &ifi, sizeof(ifi));
+}
+
+uint32_t ad_tun_nl_addr(ad_tun_nl_t *nl, int add, int ifindex, int family,
+                        const void *addr, unsigned plen)
+{
+    struct ifaddrmsg ifa;
+    memset(&ifa, 0, sizeof(ifa));
+    ifa.ifa_family = (unsigned char)family;
+    ifa.ifa_prefixlen = (unsigned char)plen;
+    ifa.ifa_index = (unsigned)ifindex;
+
+    size_t alen = (family == AF_INET) ? 4 : 16;
+    uint32_t seq = add ? ad_tun_nl_request(nl, RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE, &ifa, sizeof(ifa))
+                       : ad_tun_nl_request(nl, RTM_DELADDR, 0, &ifa, sizeof(ifa));
+    if (!seq) return 0;
+    if (ad_tun_nl_attr(nl, IFA_LOCAL, addr, alen) != 0 ||
+        ad_tun_nl_attr(nl, IFA_ADDRESS, addr, alen) != 0) {
+        return 0;
+    }
+    return seq;
+}
+
+/* Read acknowledgements until every request in [first, last] is answered */
+static int nl_wait_acks(ad_tun_nl_t *nl, uint32_t first, uint32_t last,
+                        ad_tun_nl_err_fn fn, void *arg)
+{
+    unsigned char rbuf[16384];
+    uint32_t want = last - first + 1;
+    int failed = 0;
+
+    while (want > 0) {
+        ssize_t n = recv(nl->fd, rbuf, sizeof(rbuf), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+
+        for (struct nlmsghdr *h = (struct nlmsghdr *)rbuf; NLMSG_OK(h, (unsigned)n);
+             h = NLMSG_NEXT(h, n)) {
+            if (h->nlmsg_type != NLMSG_ERROR) continue;
+            if ((uint32_t)(h->nlmsg_seq - first) > last - first) continue;
+
+            const struct nlmsgerr *e = NLMSG_DATA(h);
+            if (e->error != 0) {
+                failed++;
+                if (fn) fn(arg, h->nlmsg_seq, -e->error);
+            }
+            want--;
+        }
+    }
+    return failed;
+}
+
+int ad_tun_nl_commit(ad_tun_nl_t *nl, ad_tun_nl_err_fn fn, void *arg)
+{
+    if (!nl || nl->fd < 0) return -EINVAL;
+
+    int failed = 0;
+    size_t off = 0;
+
+    while (off < nl->len) {
+        /* Collect a chunk of whole messages */
+        size_t end = off;
+        unsigned msgs = 0;
+        uint32_t first = ((struct nlmsghdr *)(nl->buf + off))->nlmsg_seq;
+        uint32_t last = first;
+        while (end < nl->len && msgs < NL_CHUNK_MSGS) {
+            struct nlmsghdr *h = (struct nlmsghdr *)(nl->buf + end);
+            size_t mlen = NLMSG_ALIGN(h->nlmsg_len);
+            if (msgs > 0 && end + mlen - off > NL_CHUNK_BYTES) break;
+            last = h->nlmsg_seq;
+            end += mlen;
+            msgs++;
+        }
+
+        ssize_t sent;
+        do {
+            sent = send(nl->fd, nl->buf + off, end - off, 0);
+        } while (sent < 0 && errno == EINTR);
+        if (sent < 0) {
+            int err = errno;
+            nl->len = 0;
+            nl->pending = 0;
+            return -err;
+        }
+
+        int r = nl_wait_acks(nl, first, last, fn, arg);
+        if (r < 0) {
+            nl->len = 0;
+            nl->pending = 0;
+            return r;
+        }
+        failed += r;
+        off = end;
+    }
+
+    nl->len = 0;
+    nl->pending = 0;
+    return failed;
+}
+
+int ad_tun_nl_dump(ad_tun_nl_t *nl, uint16_t type, unsigned char family,
+                   ad_tun_nl_msg_fn fn, void *arg)
+{
+    if (!nl || nl->fd < 0 || nl->pending || !fn) return -EINVAL;
+
+    struct {
+        struct nlmsghdr h;
+        struct rtgenmsg g;
+    } req;
+    memset(&req, 0, sizeof(req));
+    req.h.nlmsg_len = NLMSG_LENGTH(sizeof(req.g));
+    req.h.nlmsg_type = type;
+    req.h.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    if (++nl->seq == 0) nl->seq = 1;
+    req.h.nlmsg_seq = nl->seq;
+    req.g.rtgen_family = family;
+
+    if (send(nl->fd, &req, req.h.nlmsg_len, 0) < 0) return -errno;
+
+    unsigned char rbuf[32768];
+    int stopped = 0;
+    for (;;) {
+        ssize_t n = recv(nl->fd, rbuf, sizeof(rbuf), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+
+        for (struct nlmsghdr *h = (struct nlmsghdr *)rbuf; NLMSG_OK(h, (unsigned)n);
+             h = NLMSG_NEXT(h, n)) {
+            if (h->nlmsg_seq != req.h.nlmsg_seq) continue;
+            if (h->nlmsg_type == NLMSG_DONE) {
+                return (h->nlmsg_flags & NLM_F_DUMP_INTR) ? -EINTR : 0;
+            }
+            if (h->nlmsg_type == NLMSG_ERROR) {
+                const struct nlmsgerr *e = NLMSG_DATA(h);
+                return e->error;
+            }
+            /* Keep reading after an early stop so the socket stays usable */
+            if (!stopped && fn(arg, h) != 0) stopped = 1;
+        }
+    }
+}
+
+int ad_tun_nl_parse_prefix(const char *s, int *family, unsigned char *addr, unsigned *plen)
+{
+    char tmp[INET6_ADDRSTRLEN + 8];
+    if (!s || strlen(s) >= sizeof(tmp)) return -EINVAL;
+    strcpy(tmp, s);
+
+    char *slash = strchr(tmp, '/');
+    if (slash) *slash = '\0';
+
+    memset(addr, 0, 16);
+    unsigned max;
+    if (inet_pton(AF_INET, tmp, addr) == 1) {
+        *family = AF_INET;
+        max = 32;
+    } else if (inet_pton(AF_INET6, tmp, addr) == 1) {
+        *family = AF_INET6;
+        max = 128;
+    } else {
+        return -EINVAL;
+    }
+
+    *plen = max;
+    if (slash) {
+        char *end;
+        unsigned long l = strtoul(slash + 1, &end, 10);
+        if (end == slash + 1 || *end != '\0' || l > max) return -EINVAL;
+        *plen = (unsigned)l;
+    }
+    return 0;
+}
@@ -0,0 +1,245 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun NUMA Memory        **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#define _GNU_SOURCE
+
+#include "../include/ad_tun_numa.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <net/if.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+
+#define NUMA_HUGE_SIZE ((size_t)2 << 20)
+#define NUMA_MAX_NODES 1024
+#define NUMA_MASK_BITS (8 * sizeof(unsigned long))
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+int ad_tun_numa_nodes(void)
+{
+    FILE *f = fopen("/sys/devices/system/node/possible", "r");
+    if (!f) return 1;
+
+    /* "0", "0-3" or "0,2-3": the last number is the highest node */
+    char line[256];
+    int nodes = 1;
+    if (fgets(line, sizeof(line), f)) {
+        char *p = line + strcspn(line, "\n");
+        while (p > line && (p[-1] < '0' || p[-1] > '9')) p--;
+        while (p > line && p[-1] >= '0' && p[-1] <= '9') p--;
+        int hi = atoi(p);
+        if (hi >= 0 && hi < NUMA_MAX_NODES) nodes = hi + 1;
+    }
+    fclose(f);
+    return nodes;
+}
+
+int ad_tun_numa_node_of_cpu(int cpu)
+{
+    if (cpu < 0) {
+        unsigned c, node;
+        if (syscall(SYS_getcpu, &c, &node, NULL) != 0) return -ENOENT;
+        return (int)node;
+    }
+
+    /* The CPU directory links to its node as "nodeN" */
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *d = opendir(path);
+    if (!d) return -ENOENT;
+
+    int node = -ENOENT;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (strncmp(de->d_name, "node", 4) == 0 && de->d_name[4] >= '0' && de->d_name[4] <= '9') {
+            node = atoi(de->d_name + 4);
+            break;
+        }
+    }
+    closedir(d);
+    return node;
+}
+
+int ad_tun_numa_node_of_dev(const char *ifname)
+{
+    if (!ifname || !ifname[0] || strlen(ifname) >= IFNAMSIZ || strchr(ifname, '/')) return -EINVAL;
+
+    char path[96];
+    snprintf(path, sizeof(path), "/sys/class/net/%s", ifname);
+    struct stat st;
+    if (stat(path, &st) != 0) return -ENODEV;
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", ifname);
+    FILE *f = fopen(path, "r");
+    if (!f) return -ENOENT;
+
+    int node = -1;
+    if (fscanf(f, "%d", &node) != 1) node = -1;
+    fclose(f);
+    return node >= 0 ? node : -ENOENT;
+}
+
+int ad_tun_numa_node_of_addr(const void *addr)
+{
+    int node = -1;
+    if (syscall(SYS_get_mempolicy, &node, NULL, 0, addr, MPOL_F_NODE | MPOL_F_ADDR) != 0) return -errno;
+    return node;
+}
+
+/* Anonymous private mapping, NULL on failure */
+static void *numa_map(size_t len, int flags)
+{
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/* Mapping of len bytes aligned to NUMA_HUGE_SIZE, so THP can back all of it */
+static void *numa_map_aligned(size_t len)
+{
+    unsigned char *p = numa_map(len + NUMA_HUGE_SIZE, 0);
+    if (!p) return NULL;
+
+    uintptr_t start = ((uintptr_t)p + NUMA_HUGE_SIZE - 1) & ~(uintptr_t)(NUMA_HUGE_SIZE - 1);
+    size_t head = start - (uintptr_t)p;
+    if (head) munmap(p, head);
+    munmap((unsigned char *)start + len, NUMA_HUGE_SIZE - head);
+    return (void *)start;
+}
+
+static int numa_bind(void *p, size_t len, int node, int strict)
+{
+    unsigned long mask[NUMA_MAX_NODES / NUMA_MASK_BITS];
+    memset(mask, 0, sizeof(mask));
+    mask[node / NUMA_MASK_BITS] = 1ul << (node % NUMA_MASK_BITS);
+
+    if (syscall(SYS_mbind, p, len, strict ? MPOL_BIND : MPOL_PREFERRED,
+                mask, (unsigned long)NUMA_MAX_NODES + 1, 0) != 0) return -errno;
+    return 0;
+}
+
+/* Fault every page in, after the policy is set */
+static int numa_populate(void *p, size_t len, int hugetlb)
+{
+    if (madvise(p, len, MADV_POPULATE_WRITE) == 0) return 0;
+    if (errno != EINVAL) return -errno;
+
+    /* Older kernel: touching a hugetlb page that cannot be had raises SIGBUS */
+    if (hugetlb) return -EOPNOTSUPP;
+
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t off = 0; off < len; off += (size_t)page) ((volatile unsigned char *)p)[off] = 0;
+    return 0;
+}
+
+ad_tun_error_t ad_tun_mem_alloc(ad_tun_mem_t *m, size_t len, const ad_tun_mem_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!m || len == 0) {
+        zlog_error(zc, "ad_tun_mem_alloc: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+    memset(m, 0, sizeof(*m));
+    m->node = -1;
+
+    int node = cfg ? cfg->node : AD_TUN_NUMA_ANY;
+    unsigned flags = cfg ? cfg->flags : 0;
+    int strict = (flags & AD_TUN_MEM_STRICT) != 0;
+
+    if (node == AD_TUN_NUMA_LOCAL) {
+        node = ad_tun_numa_node_of_cpu(-1);
+        if (node < 0) node = AD_TUN_NUMA_ANY;
+    }
+    if (node < AD_TUN_NUMA_ANY || node >= ad_tun_numa_nodes()) {
+        zlog_error(zc, "ad_tun_mem_alloc: node %d does not exist", node);
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    long page = sysconf(_SC_PAGESIZE);
+    size_t align = (flags & AD_TUN_MEM_HUGE) ? NUMA_HUGE_SIZE : (size_t)page;
+    if (len > SIZE_MAX - 2 * NUMA_HUGE_SIZE) {
+        zlog_error(zc, "ad_tun_mem_alloc: %zu bytes is too large", len);
+        return AD_TUN_ERR_CONFIG;
+    }
+    m->len = (len + align - 1) & ~(align - 1);
+
+    /* Reserved hugetlb pages first; they either all fault in on the node or the block is dropped */
+    if (flags & AD_TUN_MEM_HUGE) {
+        m->ptr = numa_map(m->len, MAP_HUGETLB);
+        if (m->ptr) {
+            if ((node >= 0 && numa_bind(m->ptr, m->len, node, strict) != 0) ||
+                numa_populate(m->ptr, m->len, 1) != 0) {
+                munmap(m->ptr, m->len);
+                m->ptr = NULL;
+            } else {
+                m->huge = 1;
+                m->node = node;
+            }
+        }
+        if (!m->ptr) {
+            m->ptr = numa_map_aligned(m->len);
+            if (m->ptr && madvise(m->ptr, m->len, MADV_HUGEPAGE) == 0) m->huge = 2;
+        }
+    } else {
+        m->ptr = numa_map(m->len, 0);
+    }
+
+    if (!m->ptr) {
+        zlog_error(zc, "ad_tun_mem_alloc: mmap of %zu bytes failed: %s", m->len, strerror(errno));
+        memset(m, 0, sizeof(*m));
+        return AD_TUN_ERR_SYS;
+    }
+
+    if (m->huge != 1) {
+        if (node >= 0) {
+            int err = numa_bind(m->ptr, m->len, node, strict);
+            if (err == 0) {
+                m->node = node;
+            } else if (strict) {
+                zlog_error(zc, "ad_tun_mem_alloc: cannot bind to node %d: %s", node, strerror(-err));
+                ad_tun_mem_free(m);
+                return AD_TUN_ERR_SYS;
+            } else {
+                zlog_warn(zc, "ad_tun_mem_alloc: cannot bind to node %d, using any node: %s",
+                          node, strerror(-err));
+            }
+        }
+
+        int err = numa_populate(m->ptr, m->len, 0);
+        if (err != 0) {
+            zlog_error(zc, "ad_tun_mem_alloc: cannot fault in %zu bytes on node %d: %s",
+                       m->len, node, strerror(-err));
+            ad_tun_mem_free(m);
+            return AD_TUN_ERR_SYS;
+        }
+    }
+
+    zlog_debug(zc, "Memory allocated: len=%zu, node=%d, pages=%s", m->len, m->node,
+               m->huge == 1 ? "hugetlb" : m->huge == 2 ? "thp" : "base");
+    return AD_TUN_OK;
+}
+
+void ad_tun_mem_free(ad_tun_mem_t *m)
+{
+    if (!m || !m->ptr) return;
+
+    munmap(m->ptr, m->len);
+    memset(m, 0, sizeof(*m));
+    m->node = -1;
+}
@@ -0,0 +1,274 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Ordered Dispatch   **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_order.h"
+#include "../include/ad_tun_evwait.h"
+#include "../include/ad_tun_pkt.h"
+#include "../include/ad_tun_eth.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Defaults for ad_tun_order_config_t */
+#define DEFAULT_ORDER_WORKERS 4
+#define DEFAULT_ORDER_BUCKETS 4096
+#define DEFAULT_ORDER_DEPTH 1024
+#define DEFAULT_ORDER_REBALANCE 64
+
+struct ad_tun_order_worker {
+    /* Written by the dispatcher */
+    uint64_t head __attribute__((aligned(64)));    /* Packets published */
+    /* Written by the worker */
+    uint64_t read __attribute__((aligned(64)));    /* Packets dequeued */
+    uint64_t tail;                                  /* Packets done */
+    uint32_t waiting __attribute__((aligned(64))); /* Worker asleep in ad_tun_order_wait() */
+    int efd;
+    ad_tun_buf_t **slots;
+};
+
+void ad_tun_order_default_config(ad_tun_order_config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->workers = DEFAULT_ORDER_WORKERS;
+    cfg->buckets = DEFAULT_ORDER_BUCKETS;
+    cfg->depth = DEFAULT_ORDER_DEPTH;
+    cfg->rebalance = DEFAULT_ORDER_REBALANCE;
+}
+
+static uint32_t order_pow2(uint32_t n)
+{
+    uint32_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+ad_tun_error_t ad_tun_order_init(ad_tun_order_t *ord, const ad_tun_order_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!ord || !cfg || cfg->workers == 0 || cfg->workers > AD_TUN_ORDER_MAX_WORKERS ||
+        cfg->buckets == 0 || cfg->buckets > (1u << 24) || cfg->depth == 0 || cfg->depth > (1u << 24)) {
+        zlog_error(zc, "ad_tun_order_init: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    memset(ord, 0, sizeof(*ord));
+    ord->cfg = *cfg;
+    ord->bmask = order_pow2(cfg->buckets) - 1;
+    ord->qmask = order_pow2(cfg->depth) - 1;
+
+    if (posix_memalign((void**)&ord->workers, 64, cfg->workers * sizeof(*ord->workers)) != 0) {
+        ord->workers = NULL;
+        zlog_error(zc, "ad_tun_order_init: allocation failed");
+        return AD_TUN_ERR_SYS;
+    }
+    memset(ord->workers, 0, cfg->workers * sizeof(*ord->workers));
+    for (unsigned w = 0; w < cfg->workers; w++) ord->workers[w].efd = -1;
+
+    ord->buckets = malloc(((size_t)ord->bmask + 1) * sizeof(*ord->buckets));
+    if (!ord->buckets) goto fail;
+    for (uint32_t b = 0; b <= ord->bmask; b++) {
+        ord->buckets[b].last = 0;
+        ord->buckets[b].worker = b % cfg->workers;
+    }
+
+    for (unsigned w = 0; w < cfg->workers; w++) {
+        ad_tun_order_worker_t *wk = &ord->workers[w];
+        wk->slots = malloc(((size_t)ord->qmask + 1) * sizeof(*wk->slots));
+        wk->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (!wk->slots || wk->efd < 0) goto fail;
+    }
+
+    zlog_info(zc, "Ordered dispatch initialized: workers=%u, buckets=%u, depth=%u, rebalance=%u",
+              cfg->workers, ord->bmask + 1, ord->qmask + 1, cfg->rebalance);
+    return AD_TUN_OK;
+
+fail:
+    zlog_error(zc, "ad_tun_order_init: allocation failed: %s", strerror(errno));
+    ad_tun_order_free(ord);
+    return AD_TUN_ERR_SYS;
+}
+
+void ad_tun_order_free(ad_tun_order_t *ord)
+{
+    if (!ord) return;
+
+    if (ord->workers) {
+        for (unsigned w = 0; w < ord->cfg.workers; w++) {
+            free(ord->workers[w].slots);
+            if (ord->workers[w].efd >= 0) close(ord->workers[w].efd);
+        }
+        free(ord->workers);
+    }
+    free(ord->buckets);
+    memset(ord, 0, sizeof(*ord));
+}
+
+/* FNV-1a over the 5-tuple; fragments and unparsed packets hash on what is known */
+static uint32_t order_flow_hash(const ad_tun_order_t *ord, const ad_tun_buf_t *b)
+{
+    const unsigned char *p = b->data;
+    size_t len = b->len;
+
+    if (ord->cfg.l2) {
+        int off = ad_tun_eth_ip_offset(p, len);
+        if (off < 0) return 0;
+        p += off;
+        len -= (size_t)off;
+    }
+
+    ad_tun_pkt_info_t info;
+    if (ad_tun_pkt_parse(p, len, &info) != 0) return 0;
+
+    uint32_t h = 2166136261u;
+    size_t alen = (info.family == AF_INET) ? 4 : 16;
+    uint16_t sport = info.is_frag ? 0 : info.sport;
+    uint16_t dport = info.is_frag ? 0 : info.dport;
+
+    for (size_t i = 0; i < alen; i++) h = (h ^ info.src[i]) * 16777619u;
+    for (size_t i = 0; i < alen; i++) h = (h ^ info.dst[i]) * 16777619u;
+    h = (h ^ sport) * 16777619u;
+    h = (h ^ dport) * 16777619u;
+    h = (h ^ info.proto) * 16777619u;
+
+    /* Fold so a small bucket mask still sees every byte */
+    return h ^ (h >> 16);
+}
+
+/* Signal worker w if it sleeps */
+static void order_wake(ad_tun_order_t *ord, ad_tun_order_worker_t *wk)
+{
+    if (ad_tun_evwait_wake(&wk->waiting, wk->efd)) ord->stats.wakeups++;
+}
+
+/* Least loaded worker */
+static unsigned order_min_load(const uint64_t *load, unsigned nw)
+{
+    unsigned m = 0;
+    for (unsigned w = 1; w < nw; w++) {
+        if (load[w] < load[m]) m = w;
+    }
+    return m;
+}
+
+unsigned ad_tun_order_dispatch(ad_tun_order_t *ord, ad_tun_buf_t *const *bufs, unsigned n)
+{
+    if (!ord || !ord->workers || !bufs) return 0;
+
+    unsigned nw = ord->cfg.workers;
+    uint64_t head[AD_TUN_ORDER_MAX_WORKERS];
+    uint64_t tail[AD_TUN_ORDER_MAX_WORKERS];
+    uint64_t load[AD_TUN_ORDER_MAX_WORKERS];
+    uint64_t touched = 0;
+
+    /* One look at each worker's progress per call; a stale tail only delays a move */
+    for (unsigned w = 0; w < nw; w++) {
+        head[w] = ord->workers[w].head;
+        tail[w] = __atomic_load_n(&ord->workers[w].tail, __ATOMIC_ACQUIRE);
+        load[w] = head[w] - tail[w];
+    }
+    unsigned minw = order_min_load(load, nw);
+
+    unsigned i;
+    for (i = 0; i < n; i++) {
+        ad_tun_order_bucket_t *bk = &ord->buckets[order_flow_hash(ord, bufs[i]) & ord->bmask];
+        unsigned w = bk->worker;
+
+        /* Nothing of this bucket in flight: it may follow the load */
+        if (ord->cfg.rebalance && bk->last <= tail[w] && load[w] >= load[minw] + ord->cfg.rebalance) {
+            bk->worker = minw;
+            w = minw;
+            ord->stats.migrations++;
+        }
+
+        if (load[w] > ord->qmask) {
+            ord->stats.full++;
+            break;
+        }
+
+        ord->workers[w].slots[head[w] & ord->qmask] = bufs[i];
+        head[w]++;
+        load[w]++;
+        bk->last = head[w];
+        touched |= 1ull << w;
+        if (w == minw) minw = order_min_load(load, nw);
+    }
+
+    for (unsigned w = 0; w < nw; w++) {
+        if (!(touched & (1ull << w))) continue;
+        __atomic_store_n(&ord->workers[w].head, head[w], __ATOMIC_RELEASE);
+        order_wake(ord, &ord->workers[w]);
+    }
+
+    ord->stats.dispatched += i;
+    return i;
+}
+
+unsigned ad_tun_order_dequeue(ad_tun_order_t *ord, unsigned w, ad_tun_buf_t **bufs, unsigned n)
+{
+    if (!ord || w >= ord->cfg.workers || !bufs) return 0;
+
+    ad_tun_order_worker_t *wk = &ord->workers[w];
+    uint64_t head = __atomic_load_n(&wk->head, __ATOMIC_ACQUIRE);
+    uint64_t avail = head - wk->read;
+    unsigned k = avail < n ? (unsigned)avail : n;
+
+    for (unsigned i = 0; i < k; i++) bufs[i] = wk->slots[(wk->read + i) & ord->qmask];
+    wk->read += k;
+    return k;
+}
+
+void ad_tun_order_done(ad_tun_order_t *ord, unsigned w, unsigned n)
+{
+    if (!ord || w >= ord->cfg.workers) return;
+
+    ad_tun_order_worker_t *wk = &ord->workers[w];
+    uint64_t outstanding = wk->read - wk->tail;
+    if (n > outstanding) n = (unsigned)outstanding;
+    __atomic_store_n(&wk->tail, wk->tail + n, __ATOMIC_RELEASE);
+}
+
+static int order_ready(const void *obj)
+{
+    const ad_tun_order_worker_t *wk = obj;
+    return __atomic_load_n(&wk->head, __ATOMIC_ACQUIRE) != wk->read;
+}
+
+int ad_tun_order_wait(ad_tun_order_t *ord, unsigned w, int timeout_ms)
+{
+    if (!ord || w >= ord->cfg.workers) return -EINVAL;
+
+    ad_tun_order_worker_t *wk = &ord->workers[w];
+    return ad_tun_evwait(&wk->waiting, wk->efd, order_ready, wk, timeout_ms);
+}
+
+unsigned ad_tun_order_pending(const ad_tun_order_t *ord, unsigned w)
+{
+    if (!ord || w >= ord->cfg.workers) return 0;
+
+    const ad_tun_order_worker_t *wk = &ord->workers[w];
+    uint64_t tail = __atomic_load_n(&wk->tail, __ATOMIC_ACQUIRE);
+    return (unsigned)(__atomic_load_n(&wk->head, __ATOMIC_ACQUIRE) - tail);
+}
+
+void ad_tun_order_get_stats(const ad_tun_order_t *ord, ad_tun_order_stats_t *stats)
+{
+    if (!stats) return;
+    memset(stats, 0, sizeof(*stats));
+    if (!ord || !ord->workers) return;
+
+    *stats = ord->stats;
+    stats->completed = 0;
+    for (unsigned w = 0; w < ord->cfg.workers; w++) {
+        stats->completed += __atomic_load_n(&ord->workers[w].tail, __ATOMIC_ACQUIRE);
+    }
+}
@@ -0,0 +1,297 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Pipeline           **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_pipe.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int pipe_per_packet(ad_tun_stage_type_t t)
+{
+    return t == AD_TUN_STAGE_PARSE || t == AD_TUN_STAGE_CLASSIFY || t == AD_TUN_STAGE_FILTER;
+}
+
+/* Prepend a rejected packet to the drop chain */
+static inline void pipe_reject(ad_tun_pipe_batch_t *b, ad_tun_buf_t *buf)
+{
+    buf->next = b->drops;
+    b->drops = buf;
+    b->ndrops++;
+}
+
+void ad_tun_pipe_drop(ad_tun_pipe_batch_t *b, unsigned i)
+{
+    if (i >= b->n) return;
+
+    pipe_reject(b, b->bufs[i]);
+    unsigned rest = b->n - i - 1;
+    memmove(&b->bufs[i], &b->bufs[i + 1], rest * sizeof(*b->bufs));
+    if (b->info) memmove(&b->info[i], &b->info[i + 1], rest * sizeof(*b->info));
+    if (b->cls) memmove(&b->cls[i], &b->cls[i + 1], rest * sizeof(*b->cls));
+    b->n--;
+}
+
+unsigned ad_tun_pipe_shape(ad_tun_pipe_batch_t *b, ad_tun_shaper_t *sh)
+{
+    ad_tun_buf_t *drops = NULL;
+    int out = ad_tun_shaper_submit(sh, b->bufs, b->n, b->now_ns, b->scratch, b->n, &drops);
+    if (out < 0) {
+        for (unsigned i = 0; i < b->n; i++) pipe_reject(b, b->bufs[i]);
+        b->n = 0;
+        return 0;
+    }
+
+    while (drops) {
+        ad_tun_buf_t *next = drops->next;
+        pipe_reject(b, drops);
+        drops = next;
+    }
+
+    /* Conforming packets keep their order but lose their info/cls slots */
+    unsigned held = b->n - (unsigned)out;
+    memcpy(b->bufs, b->scratch, (size_t)out * sizeof(*b->bufs));
+    b->n = (unsigned)out;
+    b->info = NULL;
+    b->cls = NULL;
+    return held;
+}
+
+void ad_tun_pipe_encrypt(ad_tun_pipe_batch_t *b, ad_tun_crypto_t *c, uint32_t peer)
+{
+    if (b->n == 0) return;
+
+    /* A cipher failure keeps the packets sealed before it */
+    int done = ad_tun_crypto_encrypt_batch(c, peer, b->bufs, b->n);
+    if (done < 0) done = 0;
+    for (unsigned i = (unsigned)done; i < b->n; i++) pipe_reject(b, b->bufs[i]);
+    b->n = (unsigned)done;
+}
+
+void ad_tun_pipe_send(ad_tun_pipe_batch_t *b, ad_tun_pipe_write_fn fn, void *arg)
+{
+    if (b->n == 0) return;
+
+    int sent = fn ? fn(arg, b->bufs, b->n) : ad_tun_write_batch(b->bufs, b->n);
+    if (sent < 0) sent = 0;
+    for (unsigned i = (unsigned)sent; i < b->n; i++) pipe_reject(b, b->bufs[i]);
+    b->n = (unsigned)sent;
+}
+
+const char *ad_tun_pipe_stage_name(ad_tun_stage_type_t type)
+{
+    switch (type) {
+    case AD_TUN_STAGE_PARSE: return "parse";
+    case AD_TUN_STAGE_CLASSIFY: return "classify";
+    case AD_TUN_STAGE_FILTER: return "filter";
+    case AD_TUN_STAGE_SHAPE: return "shape";
+    case AD_TUN_STAGE_ENCRYPT: return "encrypt";
+    case AD_TUN_STAGE_CUSTOM: return "custom";
+    case AD_TUN_STAGE_SEND: return "send";
+    }
+    return "unknown";
+}
+
+ad_tun_error_t ad_tun_pipe_init(ad_tun_pipe_t *p, const ad_tun_stage_t *stages, unsigned nstages,
+                                unsigned max_batch)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!p || !stages || nstages == 0 || nstages > AD_TUN_PIPE_MAX_STAGES || max_batch == 0) {
+        zlog_error(zc, "ad_tun_pipe_init: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    memset(p, 0, sizeof(*p));
+
+    int parsed = 0, shaped = 0;
+    for (unsigned i = 0; i < nstages; i++) {
+        const ad_tun_stage_t *st = &stages[i];
+        const char *why = NULL;
+
+        switch (st->type) {
+        case AD_TUN_STAGE_PARSE:
+            /* Packets released by the shaper come back without their info */
+            if (shaped) why = "comes after a shape stage";
+            parsed = 1;
+            break;
+        case AD_TUN_STAGE_CLASSIFY:
+            if (!parsed || shaped) why = "needs a parse stage before it and no shape stage";
+            break;
+        case AD_TUN_STAGE_FILTER:
+            if (!parsed || shaped) why = "needs a parse stage before it and no shape stage";
+            else if (!st->filter) why = "has no filter";
+            break;
+        case AD_TUN_STAGE_SHAPE:
+            if (!st->shaper) why = "has no shaper";
+            else if (shaped++) why = "is the second shape stage";
+            break;
+        case AD_TUN_STAGE_ENCRYPT:
+            if (!st->crypto) why = "has no crypto context";
+            break;
+        case AD_TUN_STAGE_CUSTOM:
+            if (!st->fn) why = "has no function";
+            break;
+        case AD_TUN_STAGE_SEND:
+            if (i != nstages - 1) why = "is not the last stage";
+            break;
+        default:
+            why = "has an unknown type";
+        }
+
+        if (why) {
+            zlog_error(zc, "ad_tun_pipe_init: stage %u (%s) %s", i,
+                       ad_tun_pipe_stage_name(st->type), why);
+            return AD_TUN_ERR_CONFIG;
+        }
+    }
+
+    p->info = malloc(max_batch * sizeof(*p->info));
+    p->cls = malloc(max_batch * sizeof(*p->cls));
+    p->scratch = malloc(max_batch * sizeof(*p->scratch));
+    if (!p->info || !p->cls || !p->scratch) {
+        zlog_error(zc, "ad_tun_pipe_init: allocation failed");
+        ad_tun_pipe_free(p);
+        return AD_TUN_ERR_SYS;
+    }
+
+    memcpy(p->stages, stages, nstages * sizeof(*stages));
+    p->nstages = nstages;
+    p->max_batch = max_batch;
+
+    zlog_debug(zc, "Pipeline initialized: stages=%u, max_batch=%u", nstages, max_batch);
+    return AD_TUN_OK;
+}
+
+void ad_tun_pipe_free(ad_tun_pipe_t *p)
+{
+    if (!p) return;
+
+    free(p->info);
+    free(p->cls);
+    free(p->scratch);
+    memset(p, 0, sizeof(*p));
+}
+
+/* Per-packet stages [first, end) in one pass, compacting survivors */
+static void pipe_fused(ad_tun_pipe_t *p, ad_tun_pipe_batch_t *b, unsigned first, unsigned end)
+{
+    unsigned k = 0;
+
+    for (unsigned i = 0; i < b->n; i++) {
+        ad_tun_buf_t *buf = b->bufs[i];
+        unsigned s;
+
+        for (s = first; s < end; s++) {
+            const ad_tun_stage_t *st = &p->stages[s];
+            int keep = 1;
+
+            switch (st->type) {
+            case AD_TUN_STAGE_PARSE:
+                keep = ad_tun_stage_parse(buf, &b->info[k]);
+                break;
+            case AD_TUN_STAGE_CLASSIFY:
+                b->cls[k] = ad_tun_stage_classify(&b->info[k], st->dscp_map);
+                break;
+            case AD_TUN_STAGE_FILTER:
+                keep = ad_tun_stage_filter(&b->info[k], st->filter, st->invert);
+                break;
+            default:
+                break;
+            }
+            if (!keep) break;
+        }
+
+        if (s == end) {
+            b->bufs[k++] = buf;
+        } else {
+            pipe_reject(b, buf);
+            p->stats.drops[s]++;
+        }
+    }
+    b->n = k;
+}
+
+/* Run stages [first, nstages) over a batch */
+static void pipe_run_from(ad_tun_pipe_t *p, ad_tun_pipe_batch_t *b, unsigned first)
+{
+    for (unsigned s = first; s < p->nstages && b->n; ) {
+        const ad_tun_stage_t *st = &p->stages[s];
+
+        if (pipe_per_packet(st->type)) {
+            unsigned end = s + 1;
+            while (end < p->nstages && pipe_per_packet(p->stages[end].type)) end++;
+            pipe_fused(p, b, s, end);
+            s = end;
+            continue;
+        }
+
+        unsigned before = b->ndrops;
+        switch (st->type) {
+        case AD_TUN_STAGE_SHAPE:
+            ad_tun_pipe_shape(b, st->shaper);
+            break;
+        case AD_TUN_STAGE_ENCRYPT:
+            ad_tun_pipe_encrypt(b, st->crypto, st->peer);
+            break;
+        case AD_TUN_STAGE_CUSTOM:
+            st->fn(st->arg, b);
+            break;
+        case AD_TUN_STAGE_SEND:
+            ad_tun_pipe_send(b, st->write_fn, st->write_arg);
+            break;
+        default:
+            break;
+        }
+        p->stats.drops[s] += b->ndrops - before;
+        s++;
+    }
+}
+
+int ad_tun_pipe_run(ad_tun_pipe_t *p, ad_tun_buf_t **bufs, unsigned n, uint64_t now_ns,
+                    ad_tun_buf_t **drops)
+{
+    if (!p || !p->nstages || !bufs || !drops || n > p->max_batch) return -EINVAL;
+
+    ad_tun_pipe_batch_t b = {
+        .bufs = bufs, .n = n, .info = p->info, .cls = p->cls,
+        .scratch = p->scratch, .drops = *drops, .ndrops = 0, .now_ns = now_ns,
+    };
+    pipe_run_from(p, &b, 0);
+
+    *drops = b.drops;
+    p->stats.batches++;
+    p->stats.in += n;
+    p->stats.out += b.n;
+    p->stats.dropped += b.ndrops;
+    return (int)b.n;
+}
+
+int ad_tun_pipe_poll(ad_tun_pipe_t *p, uint64_t now_ns, ad_tun_buf_t **out, ad_tun_buf_t **drops)
+{
+    if (!p || !out || !drops) return -EINVAL;
+
+    for (unsigned s = 0; s < p->nstages; s++) {
+        if (p->stages[s].type != AD_TUN_STAGE_SHAPE) continue;
+
+        int n = ad_tun_shaper_poll(p->stages[s].shaper, now_ns, out, p->max_batch);
+        if (n <= 0) return 0;
+
+        ad_tun_pipe_batch_t b = {
+            .bufs = out, .n = (unsigned)n, .info = NULL, .cls = NULL,
+            .scratch = p->scratch, .drops = *drops, .ndrops = 0, .now_ns = now_ns,
+        };
+        pipe_run_from(p, &b, s + 1);
+
+        *drops = b.drops;
+        p->stats.out += b.n;
+        p->stats.dropped += b.ndrops;
+        return (int)b.n;
+    }
+    return 0;
+}
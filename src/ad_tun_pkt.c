@@ -0,0 +1,185 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Packet Helpers     **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_pkt.h"
+
+#include <errno.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/* IPv6 extension header type values */
+#define NH_HOPOPTS  0
+#define NH_ROUTING  43
+#define NH_FRAGMENT 44
+#define NH_AH       51
+#define NH_DSTOPTS  60
+
+/* Read TCP/UDP ports if the L4 header is present */
+static void pkt_parse_ports(const unsigned char *data, size_t len, ad_tun_pkt_info_t *info)
+{
+    if (info->proto != IPPROTO_TCP && info->proto != IPPROTO_UDP) return;
+    if ((size_t)info->l3_len + 4 > len) return;
+
+    info->sport = ad_tun_get_be16(data + info->l3_len);
+    info->dport = ad_tun_get_be16(data + info->l3_len + 2);
+}
+
+static int pkt_parse_ipv4(const unsigned char *data, size_t len, ad_tun_pkt_info_t *info)
+{
+    if (len < 20) return -EINVAL;
+
+    size_t ihl = (size_t)(data[0] & 0x0f) * 4;
+    if (ihl < 20 || ihl > len) return -EINVAL;
+
+    uint16_t frag = ad_tun_get_be16(data + 6);
+
+    info->family = AF_INET;
+    info->tos = data[1];
+    info->tot_len = ad_tun_get_be16(data + 2);
+    info->proto = data[9];
+    info->l3_len = (uint16_t)ihl;
+    memcpy(info->src, data + 12, 4);
+    memcpy(info->dst, data + 16, 4);
+
+    if (info->tot_len < ihl) return -EINVAL;
+
+    info->dont_frag = (frag & 0x4000) != 0;
+    info->more_frags = (frag & 0x2000) != 0;
+    info->frag_off = (uint16_t)((frag & 0x1fff) << 3);
+    info->frag_id = ad_tun_get_be16(data + 4);
+    info->is_frag = info->more_frags || info->frag_off != 0;
+
+    /* Ports only exist in the first fragment */
+    if (info->frag_off == 0) pkt_parse_ports(data, len, info);
+
+    return 0;
+}
+
+static int pkt_parse_ipv6(const unsigned char *data, size_t len, ad_tun_pkt_info_t *info)
+{
+    if (len < 40) return -EINVAL;
+
+    info->family = AF_INET6;
+    info->tos = (uint8_t)(((data[0] & 0x0f) << 4) | (data[1] >> 4));
+    info->tot_len = 40u + ad_tun_get_be16(data + 4);
+    memcpy(info->src, data + 8, 16);
+    memcpy(info->dst, data + 24, 16);
+
+    uint8_t nh = data[6];
+    size_t nh_off = 6;
+    size_t off = 40;
+
+    /* Walk extension headers until an upper-layer header is reached */
+    for (;;) {
+        if (nh == NH_HOPOPTS || nh == NH_ROUTING || nh == NH_DSTOPTS || nh == NH_AH) {
+            if (off + 8 > len) return -EINVAL;
+            size_t hlen = (nh == NH_AH) ? ((size_t)data[off + 1] + 2) * 4
+                                        : ((size_t)data[off + 1] + 1) * 8;
+            nh_off = off;
+            nh = data[off];
+            off += hlen;
+            continue;
+        }
+
+        if (nh == NH_FRAGMENT) {
+            if (off + 8 > len) return -EINVAL;
+            uint16_t frag = ad_tun_get_be16(data + off + 2);
+
+            info->is_frag = 1;
+            info->frag_hdr_off = (uint16_t)off;
+            info->nh_off = (uint16_t)nh_off;
+            info->frag_off = frag & 0xfff8;
+            info->more_frags = frag & 0x0001;
+            info->frag_id = ad_tun_get_be32(data + off + 4);
+
+            nh_off = off;
+            nh = data[off];
+            off += 8;
+
+            /* Non-first fragments carry no further headers we can parse */
+            if (info->frag_off != 0) break;
+            continue;
+        }
+
+        break;
+    }
+
+    if (off > len) return -EINVAL;
+
+    info->proto = nh;
+    info->l3_len = (uint16_t)off;
+
+    if (info->frag_off == 0) pkt_parse_ports(data, len, info);
+
+    return 0;
+}
+
+/* Parse IP headers of a raw packet */
+int ad_tun_pkt_parse(const unsigned char *data, size_t len, ad_tun_pkt_info_t *info)
+{
+    memset(info, 0, sizeof(*info));
+
+    if (!data || len == 0) return -EINVAL;
+
+    switch (data[0] >> 4) {
+    case 4:
+        return pkt_parse_ipv4(data, len, info);
+    case 6:
+        return pkt_parse_ipv6(data, len, info);
+    default:
+        return -EINVAL;
+    }
+}
+
+/* Ones' complement sum over big-endian 16-bit words */
+uint32_t ad_tun_csum_partial(const void *data, size_t len, uint32_t sum)
+{
+    const unsigned char *p = data;
+    uint64_t acc = sum;
+
+    while (len >= 2) {
+        acc += (uint32_t)((p[0] << 8) | p[1]);
+        p += 2;
+        len -= 2;
+    }
+    if (len) acc += (uint32_t)(p[0] << 8);
+
+    while (acc >> 32) acc = (acc & 0xffffffffu) + (acc >> 32);
+    return (uint32_t)acc;
+}
+
+/* Fold and complement */
+uint16_t ad_tun_csum_fold(uint32_t sum)
+{
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+/* Recompute IPv4 header checksum */
+void ad_tun_ipv4_set_csum(unsigned char *iph)
+{
+    size_t ihl = (size_t)(iph[0] & 0x0f) * 4;
+
+    iph[10] = 0;
+    iph[11] = 0;
+    ad_tun_put_be16(iph + 10, ad_tun_csum_fold(ad_tun_csum_partial(iph, ihl, 0)));
+}
+
+/* HC' = ~(~HC + ~m + m'), RFC 1624 eqn. 3 */
+void ad_tun_csum_adjust(unsigned char *csum, const void *old, const void *new_, size_t len)
+{
+    const unsigned char *o = old, *n = new_;
+    uint32_t sum = (uint16_t)~ad_tun_get_be16(csum);
+
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        sum += (uint16_t)~ad_tun_get_be16(o + i);
+        sum += ad_tun_get_be16(n + i);
+    }
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    ad_tun_put_be16(csum, (uint16_t)~sum);
+}
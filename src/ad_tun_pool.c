@@ -0,0 +1,201 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Buffer Pool        **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_pool.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Buffers are aligned to a cache line so adjacent packets do not share one */
+#define POOL_ALIGN 64
+
+/* Initialize a pool of fixed-size buffers */
+ad_tun_error_t ad_tun_pool_init(ad_tun_pool_t *pool, unsigned count,
+                                size_t buf_size, size_t headroom)
+{
+    return ad_tun_pool_init_numa(pool, count, buf_size, headroom, NULL);
+}
+
+/* Initialize a pool, on the heap or in a placed mapping */
+ad_tun_error_t ad_tun_pool_init_numa(ad_tun_pool_t *pool, unsigned count, size_t buf_size,
+                                     size_t headroom, const ad_tun_mem_config_t *mem)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!pool || count == 0 || buf_size == 0) {
+        zlog_error(zc, "ad_tun_pool_init: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    memset(pool, 0, sizeof(*pool));
+
+    size_t stride = (headroom + buf_size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+    pool->mem_len = stride * count;
+
+    if (mem) {
+        /* Descriptors first, then the buffers, all faulted in on the node */
+        size_t desc_len = ((size_t)count * sizeof(*pool->bufs) + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+        ad_tun_error_t err = ad_tun_mem_alloc(&pool->map, desc_len + pool->mem_len, mem);
+        if (err != AD_TUN_OK) {
+            zlog_error(zc, "ad_tun_pool_init: failed to map %zu bytes", desc_len + pool->mem_len);
+            return err;
+        }
+        pool->bufs = pool->map.ptr;
+        pool->mem = (unsigned char *)pool->map.ptr + desc_len;
+    } else {
+        pool->bufs = calloc(count, sizeof(*pool->bufs));
+        if (!pool->bufs) {
+            zlog_error(zc, "ad_tun_pool_init: descriptor allocation failed");
+            return AD_TUN_ERR_SYS;
+        }
+
+        pool->mem = aligned_alloc(POOL_ALIGN, pool->mem_len);
+        if (!pool->mem) {
+            zlog_error(zc, "ad_tun_pool_init: failed to allocate %zu bytes", pool->mem_len);
+            free(pool->bufs);
+            pool->bufs = NULL;
+            return AD_TUN_ERR_SYS;
+        }
+    }
+
+    /* Thread the free list so the lowest addresses are handed out first */
+    for (unsigned i = count; i-- > 0;) {
+        ad_tun_buf_t *b = &pool->bufs[i];
+        b->head = pool->mem + (size_t)i * stride;
+        b->size = stride;
+        b->data = b->head + headroom;
+        b->len = 0;
+        b->next = pool->free_list;
+        pool->free_list = b;
+    }
+
+    pool->count = count;
+    pool->avail = count;
+    pool->buf_size = buf_size;
+    pool->headroom = headroom;
+    pthread_mutex_init(&pool->lock, NULL);
+
+    zlog_debug(zc, "Buffer pool initialized: count=%u, buf_size=%zu, headroom=%zu, node=%d",
+               count, buf_size, headroom, pool->map.ptr ? pool->map.node : -1);
+
+    return AD_TUN_OK;
+}
+
+/* Release pool storage */
+void ad_tun_pool_free(ad_tun_pool_t *pool)
+{
+    if (!pool || !pool->bufs) return;
+
+    if (pool->avail != pool->count) {
+        zlog_warn(zlog_get_category("ad_tun"),
+                  "ad_tun_pool_free: %u buffers still outstanding",
+                  pool->count - pool->avail);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    if (pool->map.ptr) {
+        ad_tun_mem_free(&pool->map);
+    } else {
+        free(pool->mem);
+        free(pool->bufs);
+    }
+    memset(pool, 0, sizeof(*pool));
+}
+
+/* Reset a descriptor before handing it out */
+static inline void pool_reset_buf(const ad_tun_pool_t *pool, ad_tun_buf_t *b)
+{
+    b->next = NULL;
+    b->data = b->head + pool->headroom;
+    b->len = 0;
+    b->ts = 0;
+}
+
+/* Take a single buffer */
+ad_tun_buf_t *ad_tun_pool_get(ad_tun_pool_t *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    ad_tun_buf_t *b = pool->free_list;
+    if (b) {
+        pool->free_list = b->next;
+        pool->avail--;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (b) pool_reset_buf(pool, b);
+    return b;
+}
+
+/* Take up to n buffers */
+unsigned ad_tun_pool_get_bulk(ad_tun_pool_t *pool, ad_tun_buf_t **bufs, unsigned n)
+{
+    unsigned got = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (got < n && pool->free_list) {
+        bufs[got] = pool->free_list;
+        pool->free_list = bufs[got]->next;
+        got++;
+    }
+    pool->avail -= got;
+    pthread_mutex_unlock(&pool->lock);
+
+    for (unsigned i = 0; i < got; i++) {
+        pool_reset_buf(pool, bufs[i]);
+    }
+    return got;
+}
+
+/* Return a single buffer */
+void ad_tun_pool_put(ad_tun_pool_t *pool, ad_tun_buf_t *buf)
+{
+    if (!buf) return;
+
+    pthread_mutex_lock(&pool->lock);
+    buf->next = pool->free_list;
+    pool->free_list = buf;
+    pool->avail++;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* Return n buffers */
+void ad_tun_pool_put_bulk(ad_tun_pool_t *pool, ad_tun_buf_t **bufs, unsigned n)
+{
+    pthread_mutex_lock(&pool->lock);
+    for (unsigned i = 0; i < n; i++) {
+        if (!bufs[i]) continue;
+        bufs[i]->next = pool->free_list;
+        pool->free_list = bufs[i];
+        pool->avail++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* Return a linked chain of buffers */
+void ad_tun_pool_put_chain(ad_tun_pool_t *pool, ad_tun_buf_t *chain)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (chain) {
+        ad_tun_buf_t *next = chain->next;
+        chain->next = pool->free_list;
+        pool->free_list = chain;
+        pool->avail++;
+        chain = next;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* Number of free buffers */
+unsigned ad_tun_pool_available(ad_tun_pool_t *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    unsigned n = pool->avail;
+    pthread_mutex_unlock(&pool->lock);
+
+    return n;
+}
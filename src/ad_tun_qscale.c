@@ -0,0 +1,373 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Queue Scaling      **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_qscale.h"
+#include "../../prebuilt/inih/include/ini.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Defaults for ad_tun_qscale_config_t */
+#define DEFAULT_QS_MIN_QUEUES 1
+#define DEFAULT_QS_MAX_QUEUES 4
+#define DEFAULT_QS_INTERVAL_MS 1000
+#define DEFAULT_QS_UP_PPS 200000
+#define DEFAULT_QS_DOWN_PPS 50000
+#define DEFAULT_QS_UP_FULL_PCT 50
+#define DEFAULT_QS_DOWN_FULL_PCT 5
+#define DEFAULT_QS_UP_INTERVALS 2
+#define DEFAULT_QS_DOWN_INTERVALS 5
+
+/* ---- Configuration ---- */
+
+void ad_tun_qscale_default_config(ad_tun_qscale_config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->min_queues = DEFAULT_QS_MIN_QUEUES;
+    cfg->max_queues = DEFAULT_QS_MAX_QUEUES;
+    cfg->interval_ms = DEFAULT_QS_INTERVAL_MS;
+    cfg->up_pps = DEFAULT_QS_UP_PPS;
+    cfg->down_pps = DEFAULT_QS_DOWN_PPS;
+    cfg->up_full_pct = DEFAULT_QS_UP_FULL_PCT;
+    cfg->down_full_pct = DEFAULT_QS_DOWN_FULL_PCT;
+    cfg->up_intervals = DEFAULT_QS_UP_INTERVALS;
+    cfg->down_intervals = DEFAULT_QS_DOWN_INTERVALS;
+}
+
+static int qscale_ini_handler(void *user, const char *section,
+                              const char *name, const char *value)
+{
+    ad_tun_qscale_config_t *cfg = (ad_tun_qscale_config_t*)user;
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (strcmp(section, "queue_scaling") != 0) return 1;
+
+    if (strcmp(name, "min_queues") == 0) {
+        cfg->min_queues = (unsigned)atoi(value);
+    } else if (strcmp(name, "max_queues") == 0) {
+        cfg->max_queues = (unsigned)atoi(value);
+    } else if (strcmp(name, "interval_ms") == 0) {
+        cfg->interval_ms = (unsigned)atoi(value);
+    } else if (strcmp(name, "up_pps") == 0) {
+        cfg->up_pps = strtoull(value, NULL, 10);
+    } else if (strcmp(name, "down_pps") == 0) {
+        cfg->down_pps = strtoull(value, NULL, 10);
+    } else if (strcmp(name, "up_full_pct") == 0) {
+        cfg->up_full_pct = (unsigned)atoi(value);
+    } else if (strcmp(name, "down_full_pct") == 0) {
+        cfg->down_full_pct = (unsigned)atoi(value);
+    } else if (strcmp(name, "up_intervals") == 0) {
+        cfg->up_intervals = (unsigned)atoi(value);
+    } else if (strcmp(name, "down_intervals") == 0) {
+        cfg->down_intervals = (unsigned)atoi(value);
+    } else {
+        zlog_warn(zc, "Unknown queue scaling key ignored: %s", name);
+    }
+    return 1;
+}
+
+/* Down thresholds must sit below the up ones, or the controller would flap */
+static int qscale_thresholds_ok(const ad_tun_qscale_config_t *cfg)
+{
+    if (cfg->up_pps && cfg->down_pps >= cfg->up_pps) return 0;
+    if (cfg->up_full_pct && cfg->down_full_pct >= cfg->up_full_pct) return 0;
+    return cfg->up_full_pct <= 100 && cfg->down_full_pct <= 100;
+}
+
+ad_tun_error_t ad_tun_qscale_load_config(const char *path, ad_tun_qscale_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!path || !cfg) {
+        zlog_error(zc, "Invalid arguments to ad_tun_qscale_load_config()");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    ad_tun_qscale_default_config(cfg);
+
+    int rc = ini_parse(path, qscale_ini_handler, cfg);
+    if (rc < 0) {
+        zlog_error(zc, "Failed to open config file: %s", path);
+        return AD_TUN_ERR_CONFIG;
+    } else if (rc > 0) {
+        zlog_error(zc, "Parsing error at line %d in config file %s", rc, path);
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    if (cfg->max_queues == 0 || cfg->max_queues > AD_TUN_MAX_QUEUES) {
+        zlog_warn(zc, "Config warning: 'max_queues' should be 1..%d, using default %d",
+                  AD_TUN_MAX_QUEUES, DEFAULT_QS_MAX_QUEUES);
+        cfg->max_queues = DEFAULT_QS_MAX_QUEUES;
+    }
+
+    if (cfg->min_queues == 0 || cfg->min_queues > cfg->max_queues) {
+        zlog_warn(zc, "Config warning: 'min_queues' should be 1..max_queues, using 1");
+        cfg->min_queues = 1;
+    }
+
+    if (cfg->interval_ms == 0) {
+        zlog_warn(zc, "Config warning: 'interval_ms' is invalid, using default %d", DEFAULT_QS_INTERVAL_MS);
+        cfg->interval_ms = DEFAULT_QS_INTERVAL_MS;
+    }
+
+    if (cfg->up_intervals == 0) {
+        zlog_warn(zc, "Config warning: 'up_intervals' is invalid, using default %d", DEFAULT_QS_UP_INTERVALS);
+        cfg->up_intervals = DEFAULT_QS_UP_INTERVALS;
+    }
+
+    if (cfg->down_intervals == 0) {
+        zlog_warn(zc, "Config warning: 'down_intervals' is invalid, using default %d", DEFAULT_QS_DOWN_INTERVALS);
+        cfg->down_intervals = DEFAULT_QS_DOWN_INTERVALS;
+    }
+
+    if (!qscale_thresholds_ok(cfg)) {
+        zlog_error(zc, "Config error: down_pps/down_full_pct must be below up_pps/up_full_pct (at most 100%%)");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    zlog_info(zc, "Queue scaling config loaded from %s: queues=%u-%u, interval=%ums",
+              path, cfg->min_queues, cfg->max_queues, cfg->interval_ms);
+    return AD_TUN_OK;
+}
+
+/* ---- Controller ---- */
+
+/* Default queue switch: the running device */
+static ad_tun_error_t qscale_set_device(void *arg, unsigned q, int on)
+{
+    (void)arg;
+    return ad_tun_set_queue_enabled(q, on);
+}
+
+ad_tun_error_t ad_tun_qscale_init(ad_tun_qscale_t *ctl, const ad_tun_qscale_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!ctl || !cfg || cfg->min_queues == 0 || cfg->min_queues > cfg->max_queues ||
+        cfg->max_queues > AD_TUN_MAX_QUEUES || cfg->up_intervals == 0 || cfg->down_intervals == 0 ||
+        !qscale_thresholds_ok(cfg)) {
+        zlog_error(zc, "ad_tun_qscale_init: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+    if (!cfg->set_fn && ad_tun_get_num_queues() < (int)cfg->max_queues) {
+        zlog_error(zc, "ad_tun_qscale_init: device has %d queues open, max_queues is %u",
+                   ad_tun_get_num_queues(), cfg->max_queues);
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    memset(ctl, 0, sizeof(*ctl));
+    ctl->cfg = *cfg;
+    if (!ctl->cfg.set_fn) ctl->cfg.set_fn = qscale_set_device;
+
+    if (posix_memalign((void**)&ctl->queues, 64, cfg->max_queues * sizeof(*ctl->queues)) != 0) {
+        zlog_error(zc, "ad_tun_qscale_init: allocation failed");
+        ctl->queues = NULL;
+        return AD_TUN_ERR_SYS;
+    }
+    memset(ctl->queues, 0, cfg->max_queues * sizeof(*ctl->queues));
+
+    /* Start at the floor; every queue was attached when it was opened */
+    for (unsigned q = cfg->max_queues; q-- > cfg->min_queues;) {
+        if (ctl->cfg.set_fn(ctl->cfg.set_arg, q, 0) != AD_TUN_OK) {
+            zlog_error(zc, "ad_tun_qscale_init: cannot detach queue %u", q);
+            while (++q < cfg->max_queues) ctl->cfg.set_fn(ctl->cfg.set_arg, q, 1);
+            free(ctl->queues);
+            ctl->queues = NULL;
+            return AD_TUN_ERR_SYS;
+        }
+        ctl->queues[q].state = AD_TUN_QSCALE_DRAINING;
+    }
+    ctl->active = cfg->min_queues;
+    ctl->stats.active = ctl->active;
+
+    pthread_mutex_init(&ctl->lock, NULL);
+    pthread_cond_init(&ctl->wake, NULL);
+
+    zlog_info(zc, "Queue scaling initialized: queues=%u-%u, interval=%ums",
+              cfg->min_queues, cfg->max_queues, cfg->interval_ms);
+    return AD_TUN_OK;
+}
+
+void ad_tun_qscale_free(ad_tun_qscale_t *ctl)
+{
+    if (!ctl || !ctl->queues) return;
+
+    pthread_cond_destroy(&ctl->wake);
+    pthread_mutex_destroy(&ctl->lock);
+    free(ctl->queues);
+    memset(ctl, 0, sizeof(*ctl));
+}
+
+void ad_tun_qscale_record(ad_tun_qscale_t *ctl, unsigned q, unsigned pkts, int full)
+{
+    if (q >= ctl->cfg.max_queues) return;
+
+    /* Single writer: plain increments published with relaxed stores */
+    ad_tun_qscale_queue_t *qs = &ctl->queues[q];
+    __atomic_store_n(&qs->pkts, qs->pkts + pkts, __ATOMIC_RELAXED);
+    __atomic_store_n(&qs->reads, qs->reads + 1, __ATOMIC_RELAXED);
+    if (full) __atomic_store_n(&qs->full, qs->full + 1, __ATOMIC_RELAXED);
+}
+
+/* Rates of queue q since the previous decision; returns reads and full batches in the interval */
+static void qscale_sample(ad_tun_qscale_queue_t *qs, uint64_t dt_ns, uint64_t *reads, uint64_t *full)
+{
+    uint64_t pkts = __atomic_load_n(&qs->pkts, __ATOMIC_RELAXED);
+    uint64_t r = __atomic_load_n(&qs->reads, __ATOMIC_RELAXED);
+    uint64_t f = __atomic_load_n(&qs->full, __ATOMIC_RELAXED);
+
+    *reads = r - qs->last_reads;
+    *full = f - qs->last_full;
+    qs->pps = (uint64_t)((unsigned __int128)(pkts - qs->last_pkts) * 1000000000u / dt_ns);
+    qs->full_pct = *reads ? (unsigned)(*full * 100 / *reads) : 0;
+
+    qs->last_pkts = pkts;
+    qs->last_reads = r;
+    qs->last_full = f;
+}
+
+/* Switch queue q with the lock held; returns 0 on success */
+static int qscale_switch(ad_tun_qscale_t *ctl, unsigned q, int on)
+{
+    if (ctl->cfg.set_fn(ctl->cfg.set_arg, q, on) != AD_TUN_OK) {
+        ctl->stats.errors++;
+        return -1;
+    }
+    __atomic_store_n(&ctl->queues[q].state, on ? AD_TUN_QSCALE_ACTIVE : AD_TUN_QSCALE_DRAINING,
+                     __ATOMIC_RELEASE);
+    if (on) pthread_cond_broadcast(&ctl->wake);
+    return 0;
+}
+
+int ad_tun_qscale_tick(ad_tun_qscale_t *ctl, uint64_t now_ns)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+    const ad_tun_qscale_config_t *cfg = &ctl->cfg;
+    int ret = 0;
+
+    pthread_mutex_lock(&ctl->lock);
+
+    if (ctl->last_ns == 0 || now_ns <= ctl->last_ns) {
+        /* First call: only take the baseline */
+        uint64_t r, f;
+        for (unsigned q = 0; q < cfg->max_queues; q++) qscale_sample(&ctl->queues[q], 1, &r, &f);
+        ctl->last_ns = now_ns;
+        pthread_mutex_unlock(&ctl->lock);
+        return 0;
+    }
+
+    uint64_t dt = now_ns - ctl->last_ns;
+    if (dt < (uint64_t)cfg->interval_ms * 1000000u) {
+        pthread_mutex_unlock(&ctl->lock);
+        return 0;
+    }
+    ctl->last_ns = now_ns;
+
+    uint64_t sum_pps = 0, reads = 0, full = 0;
+    for (unsigned q = 0; q < cfg->max_queues; q++) {
+        uint64_t r, f;
+        qscale_sample(&ctl->queues[q], dt, &r, &f);
+        if (q >= ctl->active) continue;
+        sum_pps += ctl->queues[q].pps;
+        reads += r;
+        full += f;
+    }
+
+    uint64_t avg_pps = sum_pps / ctl->active;
+    unsigned full_pct = reads ? (unsigned)(full * 100 / reads) : 0;
+
+    int high = (cfg->up_pps && avg_pps > cfg->up_pps) ||
+               (cfg->up_full_pct && full_pct >= cfg->up_full_pct);
+    int low = (cfg->down_pps || cfg->down_full_pct) &&
+              (!cfg->down_pps || avg_pps < cfg->down_pps) &&
+              (!cfg->down_full_pct || full_pct < cfg->down_full_pct);
+
+    ctl->up_streak = high ? ctl->up_streak + 1 : 0;
+    ctl->down_streak = (low && !high) ? ctl->down_streak + 1 : 0;
+
+    if (ctl->up_streak >= cfg->up_intervals && ctl->active < cfg->max_queues) {
+        unsigned q = ctl->active;
+        if (qscale_switch(ctl, q, 1) == 0) {
+            ctl->active++;
+            ctl->stats.ups++;
+            ret = 1;
+            zlog_info(zc, "Queue scaling: attached queue %u (%llu pps/queue, %u%% full), %u active",
+                      q, (unsigned long long)avg_pps, full_pct, ctl->active);
+        } else {
+            zlog_warn(zc, "Queue scaling: cannot attach queue %u", q);
+        }
+        ctl->up_streak = 0;
+    } else if (ctl->down_streak >= cfg->down_intervals && ctl->active > cfg->min_queues) {
+        unsigned q = ctl->active - 1;
+        if (qscale_switch(ctl, q, 0) == 0) {
+            ctl->active--;
+            ctl->stats.downs++;
+            ret = -1;
+            zlog_info(zc, "Queue scaling: detached queue %u (%llu pps/queue, %u%% full), %u active",
+                      q, (unsigned long long)avg_pps, full_pct, ctl->active);
+        } else {
+            zlog_warn(zc, "Queue scaling: cannot detach queue %u", q);
+        }
+        ctl->down_streak = 0;
+    }
+    ctl->stats.active = ctl->active;
+
+    pthread_mutex_unlock(&ctl->lock);
+    return ret;
+}
+
+int ad_tun_qscale_worker_wait(ad_tun_qscale_t *ctl, unsigned q)
+{
+    if (q >= ctl->cfg.max_queues) return 0;
+    ad_tun_qscale_queue_t *qs = &ctl->queues[q];
+
+    /* Fast path: no lock while the queue is attached */
+    if (__atomic_load_n(&qs->state, __ATOMIC_ACQUIRE) == AD_TUN_QSCALE_ACTIVE &&
+        !__atomic_load_n(&ctl->stopping, __ATOMIC_RELAXED)) {
+        return 1;
+    }
+
+    pthread_mutex_lock(&ctl->lock);
+    int parked = 0;
+    if (qs->state == AD_TUN_QSCALE_DRAINING && !ctl->stopping) {
+        __atomic_store_n(&qs->state, AD_TUN_QSCALE_PARKED, __ATOMIC_RELEASE);
+        ctl->stats.parks++;
+        parked = 1;
+    }
+    while (qs->state != AD_TUN_QSCALE_ACTIVE && !ctl->stopping) {
+        pthread_cond_wait(&ctl->wake, &ctl->lock);
+    }
+    int run = !ctl->stopping;
+    if (parked && run) ctl->stats.wakes++;
+    pthread_mutex_unlock(&ctl->lock);
+
+    return run;
+}
+
+void ad_tun_qscale_stop(ad_tun_qscale_t *ctl)
+{
+    pthread_mutex_lock(&ctl->lock);
+    __atomic_store_n(&ctl->stopping, 1, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&ctl->wake);
+    pthread_mutex_unlock(&ctl->lock);
+}
+
+int ad_tun_qscale_queue_state(ad_tun_qscale_t *ctl, unsigned q)
+{
+    if (q >= ctl->cfg.max_queues) return -1;
+    return __atomic_load_n(&ctl->queues[q].state, __ATOMIC_ACQUIRE);
+}
+
+void ad_tun_qscale_get_stats(ad_tun_qscale_t *ctl, ad_tun_qscale_stats_t *stats)
+{
+    if (!stats) return;
+
+    pthread_mutex_lock(&ctl->lock);
+    *stats = ctl->stats;
+    pthread_mutex_unlock(&ctl->lock);
+}
@@ -0,0 +1,491 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Routes             **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_route.h"
+#include "../include/ad_tun_nl.h"
+#include "../../prebuilt/inih/include/ini.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#define ROUTE_INITIAL_CAP 64
+#define ROUTE_V6_DEFAULT_METRIC 1024    /* what the kernel stores for IPv6 metric 0 */
+#define ROUTE_MAX_ERRORS_LOGGED 8
+
+/* State carried through ini_parse() */
+typedef struct {
+    ad_tun_route_set_t *set;
+    const char *ifname;         /* NULL, a name or "*" */
+    uint32_t metric;            /* defaults for the route lines that follow */
+    uint32_t table;
+    char section[64];           /* section the defaults belong to */
+    char last_name[IFNAMSIZ];   /* if_nametoindex() cache for "*" */
+    int last_index;
+    int nomem;
+} route_parse_ctx_t;
+
+/* Rejected-request logging for commits */
+typedef struct {
+    const char *what;
+    unsigned errors;
+    int missing_ok;             /* ESRCH on removal counts as done */
+    unsigned missing;
+} route_err_ctx_t;
+
+void ad_tun_route_set_init(ad_tun_route_set_t *set)
+{
+    memset(set, 0, sizeof(*set));
+}
+
+void ad_tun_route_set_free(ad_tun_route_set_t *set)
+{
+    if (!set) return;
+    free(set->routes);
+    memset(set, 0, sizeof(*set));
+}
+
+int ad_tun_route_set_add(ad_tun_route_set_t *set, const ad_tun_route_t *route)
+{
+    if (set->count == set->cap) {
+        unsigned cap = set->cap ? set->cap * 2 : ROUTE_INITIAL_CAP;
+        ad_tun_route_t *routes = realloc(set->routes, cap * sizeof(*routes));
+        if (!routes) return -ENOMEM;
+        set->routes = routes;
+        set->cap = cap;
+    }
+    set->routes[set->count++] = *route;
+    return 0;
+}
+
+/* Parse a table id or name */
+static int route_parse_table(const char *s, uint32_t *out)
+{
+    if (strcmp(s, "main") == 0) *out = RT_TABLE_MAIN;
+    else if (strcmp(s, "local") == 0) *out = RT_TABLE_LOCAL;
+    else if (strcmp(s, "default") == 0) *out = RT_TABLE_DEFAULT;
+    else {
+        char *end;
+        unsigned long v = strtoul(s, &end, 0);
+        if (end == s || *end != '\0' || v == 0 || v > UINT32_MAX) return -EINVAL;
+        *out = (uint32_t)v;
+    }
+    return 0;
+}
+
+static int route_parse_u32(const char *s, uint32_t *out)
+{
+    char *end;
+    unsigned long v = strtoul(s, &end, 0);
+    if (end == s || *end != '\0' || v > UINT32_MAX) return -EINVAL;
+    *out = (uint32_t)v;
+    return 0;
+}
+
+int ad_tun_route_parse(const char *spec, uint32_t metric, uint32_t table, ad_tun_route_t *out)
+{
+    char buf[256];
+    if (!spec || !out || strlen(spec) >= sizeof(buf)) return -EINVAL;
+    strcpy(buf, spec);
+
+    memset(out, 0, sizeof(*out));
+    out->metric = metric;
+    out->table = table;
+
+    char *save = NULL;
+    char *tok = strtok_r(buf, " \t", &save);
+    if (!tok) return -EINVAL;
+
+    int family;
+    unsigned plen;
+    if (ad_tun_nl_parse_prefix(tok, &family, out->dst, &plen) != 0) return -EINVAL;
+    out->family = (uint8_t)family;
+    out->plen = (uint8_t)plen;
+
+    /* Clear host bits so "10.1.2.3/16" and "10.1.0.0/16" are the same route */
+    unsigned bytes = (family == AF_INET) ? 4 : 16;
+    for (unsigned i = 0; i < bytes; i++) {
+        unsigned keep = (plen >= (i + 1) * 8) ? 8 : (plen > i * 8 ? plen - i * 8 : 0);
+        out->dst[i] &= (uint8_t)(0xff00 >> keep);
+    }
+
+    while ((tok = strtok_r(NULL, " \t", &save)) != NULL) {
+        char *val = strtok_r(NULL, " \t", &save);
+        if (!val) return -EINVAL;
+        if (strcmp(tok, "metric") == 0) {
+            if (route_parse_u32(val, &out->metric) != 0) return -EINVAL;
+        } else if (strcmp(tok, "table") == 0) {
+            if (route_parse_table(val, &out->table) != 0) return -EINVAL;
+        } else {
+            return -EINVAL;
+        }
+    }
+
+    if (out->family == AF_INET6 && out->metric == 0) out->metric = ROUTE_V6_DEFAULT_METRIC;
+    return 0;
+}
+
+static int route_ini_handler(void *user, const char *section,
+                             const char *name, const char *value)
+{
+    route_parse_ctx_t *ctx = (route_parse_ctx_t*)user;
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    /* Pick the sections asked for */
+    int ifindex = 0;
+    if (!ctx->ifname) {
+        if (strcmp(section, "routes") != 0) return 1;
+    } else {
+        if (strncmp(section, "routes:", 7) != 0) return 1;
+        const char *tun = section + 7;
+        if (strcmp(ctx->ifname, "*") != 0) {
+            if (strcmp(tun, ctx->ifname) != 0) return 1;
+        } else {
+            if (strcmp(tun, ctx->last_name) != 0) {
+                strncpy(ctx->last_name, tun, sizeof(ctx->last_name) - 1);
+                ctx->last_name[sizeof(ctx->last_name) - 1] = '\0';
+                ctx->last_index = (int)if_nametoindex(tun);
+                if (!ctx->last_index) zlog_warn(zc, "Routes of missing interface %s skipped", tun);
+            }
+            if (!ctx->last_index) return 1;
+            ifindex = ctx->last_index;
+        }
+    }
+
+    /* Section defaults reset at every new section */
+    if (strncmp(ctx->section, section, sizeof(ctx->section)) != 0) {
+        strncpy(ctx->section, section, sizeof(ctx->section) - 1);
+        ctx->metric = 0;
+        ctx->table = AD_TUN_ROUTE_TABLE_MAIN;
+    }
+
+    if (strcmp(name, "route") == 0) {
+        ad_tun_route_t r;
+        if (ad_tun_route_parse(value, ctx->metric, ctx->table, &r) != 0) {
+            zlog_error(zc, "Config error: [%s] invalid route '%s'", section, value);
+            return 0;
+        }
+        r.ifindex = ifindex;
+        if (ad_tun_route_set_add(ctx->set, &r) != 0) {
+            ctx->nomem = 1;
+            return 0;
+        }
+    } else if (strcmp(name, "metric") == 0) {
+        if (route_parse_u32(value, &ctx->metric) != 0) {
+            zlog_error(zc, "Config error: [%s] invalid metric '%s'", section, value);
+            return 0;
+        }
+    } else if (strcmp(name, "table") == 0) {
+        if (route_parse_table(value, &ctx->table) != 0) {
+            zlog_error(zc, "Config error: [%s] invalid table '%s'", section, value);
+            return 0;
+        }
+    } else {
+        zlog_warn(zc, "Unknown routes key ignored: [%s] %s", section, name);
+    }
+    return 1;
+}
+
+ad_tun_error_t ad_tun_route_load_config(const char *path, const char *ifname, ad_tun_route_set_t *set)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!path || !set) {
+        zlog_error(zc, "Invalid arguments to ad_tun_route_load_config()");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    route_parse_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.set = set;
+    ctx.ifname = ifname;
+    unsigned before = set->count;
+
+    int rc = ini_parse(path, route_ini_handler, &ctx);
+    if (rc < 0) {
+        zlog_error(zc, "Failed to open config file: %s", path);
+        return AD_TUN_ERR_CONFIG;
+    } else if (ctx.nomem) {
+        zlog_error(zc, "Memory allocation failed while loading routes from %s", path);
+        return AD_TUN_ERR_CONFIG;
+    } else if (rc > 0) {
+        zlog_error(zc, "Parsing error at line %d in config file %s", rc, path);
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    zlog_info(zc, "Loaded %u routes from %s", set->count - before, path);
+    return AD_TUN_OK;
+}
+
+/* ---- Installation ---- */
+
+static void route_log_error(void *arg, uint32_t seq, int err)
+{
+    route_err_ctx_t *ctx = arg;
+    (void)seq;
+
+    if (ctx->missing_ok && err == ESRCH) {
+        ctx->missing++;
+        return;
+    }
+    if (ctx->errors++ < ROUTE_MAX_ERRORS_LOGGED) {
+        zlog_warn(zlog_get_category("ad_tun"), "Failed to %s route: %s", ctx->what, strerror(err));
+    }
+}
+
+/* Queue one RTM_NEWROUTE / RTM_DELROUTE */
+static int route_queue(ad_tun_nl_t *nl, const ad_tun_route_t *r, int ifindex, int add)
+{
+    struct rtmsg rtm;
+    memset(&rtm, 0, sizeof(rtm));
+    rtm.rtm_family = r->family;
+    rtm.rtm_dst_len = r->plen;
+    rtm.rtm_table = r->table < 256 ? (unsigned char)r->table : RT_TABLE_UNSPEC;
+    rtm.rtm_protocol = AD_TUN_RTPROT;
+    rtm.rtm_scope = add ? RT_SCOPE_LINK : RT_SCOPE_NOWHERE;
+    rtm.rtm_type = RTN_UNICAST;
+
+    uint32_t seq = add ? ad_tun_nl_request(nl, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE, &rtm, sizeof(rtm))
+                       : ad_tun_nl_request(nl, RTM_DELROUTE, 0, &rtm, sizeof(rtm));
+    if (!seq) return -ENOMEM;
+
+    uint32_t oif = (uint32_t)(ifindex > 0 ? ifindex : r->ifindex);
+    size_t alen = (r->family == AF_INET) ? 4 : 16;
+    if ((r->plen && ad_tun_nl_attr(nl, RTA_DST, r->dst, alen) != 0) ||
+        ad_tun_nl_attr(nl, RTA_OIF, &oif, sizeof(oif)) != 0 ||
+        ad_tun_nl_attr(nl, RTA_PRIORITY, &r->metric, sizeof(r->metric)) != 0 ||
+        ad_tun_nl_attr(nl, RTA_TABLE, &r->table, sizeof(r->table)) != 0) {
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+/* Send one batch of adds or removes; with missing_ok a route already gone is not a failure */
+static int route_batch(ad_tun_nl_t *nl, const ad_tun_route_t *routes, unsigned n, int ifindex, int add,
+                       int missing_ok)
+{
+    route_err_ctx_t ectx = { add ? "install" : "remove", 0, missing_ok, 0 };
+
+    for (unsigned i = 0; i < n; i++) {
+        if (route_queue(nl, &routes[i], ifindex, add) != 0) {
+            ad_tun_nl_commit(nl, NULL, NULL);
+            return -ENOMEM;
+        }
+    }
+
+    int rc = ad_tun_nl_commit(nl, route_log_error, &ectx);
+    if (ectx.errors > ROUTE_MAX_ERRORS_LOGGED) {
+        zlog_warn(zlog_get_category("ad_tun"), "... %u route requests rejected in total", ectx.errors);
+    }
+    return (rc > 0) ? rc - (int)ectx.missing : rc;
+}
+
+static int route_run(const ad_tun_route_t *routes, unsigned n, int ifindex, int add)
+{
+    if (!routes && n) return -EINVAL;
+
+    ad_tun_nl_t nl;
+    if (ad_tun_nl_open(&nl) != AD_TUN_OK) return -EIO;
+    int rc = route_batch(&nl, routes, n, ifindex, add, 0);
+    ad_tun_nl_close(&nl);
+    return rc;
+}
+
+int ad_tun_route_install(const ad_tun_route_t *routes, unsigned n, int ifindex)
+{
+    return route_run(routes, n, ifindex, 1);
+}
+
+int ad_tun_route_remove(const ad_tun_route_t *routes, unsigned n, int ifindex)
+{
+    return route_run(routes, n, ifindex, 0);
+}
+
+/* ---- Sync ---- */
+
+/* Dump state: ad_tun routes in scope */
+typedef struct {
+    ad_tun_route_set_t *have;
+    int ifindex;
+    int nomem;
+} route_dump_ctx_t;
+
+static int route_dump_cb(void *arg, const struct nlmsghdr *h)
+{
+    route_dump_ctx_t *ctx = arg;
+    if (h->nlmsg_type != RTM_NEWROUTE) return 0;
+
+    const struct rtmsg *rtm = NLMSG_DATA(h);
+    int len = (int)h->nlmsg_len - NLMSG_LENGTH(sizeof(*rtm));
+    if (len < 0 || rtm->rtm_protocol != AD_TUN_RTPROT || rtm->rtm_type != RTN_UNICAST ||
+        (rtm->rtm_flags & RTM_F_CLONED)) {
+        return 0;
+    }
+
+    ad_tun_route_t r;
+    memset(&r, 0, sizeof(r));
+    r.family = rtm->rtm_family;
+    r.plen = rtm->rtm_dst_len;
+    r.table = rtm->rtm_table;
+    size_t alen = (r.family == AF_INET) ? 4 : 16;
+
+    for (const struct rtattr *rta = RTM_RTA(rtm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        switch (rta->rta_type) {
+        case RTA_DST:
+            if (RTA_PAYLOAD(rta) >= alen) memcpy(r.dst, RTA_DATA(rta), alen);
+            break;
+        case RTA_OIF:
+            r.ifindex = *(const int *)RTA_DATA(rta);
+            break;
+        case RTA_PRIORITY:
+            r.metric = *(const uint32_t *)RTA_DATA(rta);
+            break;
+        case RTA_TABLE:
+            r.table = *(const uint32_t *)RTA_DATA(rta);
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (r.ifindex == 0 || (ctx->ifindex > 0 && r.ifindex != ctx->ifindex)) return 0;
+    if (ad_tun_route_set_add(ctx->have, &r) != 0) {
+        ctx->nomem = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/* Order of the kernel's route key: an add with NLM_F_REPLACE overwrites a route with the same key */
+static int route_key_cmp(const ad_tun_route_t *a, const ad_tun_route_t *b)
+{
+    if (a->family != b->family) return a->family < b->family ? -1 : 1;
+    if (a->table != b->table) return a->table < b->table ? -1 : 1;
+    if (a->plen != b->plen) return a->plen < b->plen ? -1 : 1;
+    int c = memcmp(a->dst, b->dst, sizeof(a->dst));
+    if (c != 0) return c;
+    if (a->metric != b->metric) return a->metric < b->metric ? -1 : 1;
+    return 0;
+}
+
+static int route_cmp(const void *pa, const void *pb)
+{
+    const ad_tun_route_t *a = pa, *b = pb;
+
+    int c = route_key_cmp(a, b);
+    if (c != 0) return c;
+    if (a->ifindex != b->ifindex) return a->ifindex < b->ifindex ? -1 : 1;
+    return 0;
+}
+
+int ad_tun_route_sync(const ad_tun_route_set_t *set, int ifindex, ad_tun_route_stats_t *stats)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+    ad_tun_route_stats_t st;
+    memset(&st, 0, sizeof(st));
+
+    if (!set) return -EINVAL;
+
+    ad_tun_route_set_t want, have, add, del;
+    ad_tun_route_set_init(&want);
+    ad_tun_route_set_init(&have);
+    ad_tun_route_set_init(&add);
+    ad_tun_route_set_init(&del);
+
+    ad_tun_nl_t nl;
+    if (ad_tun_nl_open(&nl) != AD_TUN_OK) return -EIO;
+
+    int rc = 0;
+    want.routes = malloc((set->count ? set->count : 1) * sizeof(ad_tun_route_t));
+    if (!want.routes) {
+        rc = -ENOMEM;
+        goto out;
+    }
+    memcpy(want.routes, set->routes, set->count * sizeof(ad_tun_route_t));
+    want.count = want.cap = set->count;
+    for (unsigned i = 0; i < want.count; i++) {
+        if (ifindex > 0) want.routes[i].ifindex = ifindex;
+    }
+
+    /* A dump interrupted by a concurrent change is retried from scratch */
+    route_dump_ctx_t dctx = { &have, ifindex, 0 };
+    do {
+        have.count = 0;
+        rc = ad_tun_nl_dump(&nl, RTM_GETROUTE, AF_INET, route_dump_cb, &dctx);
+        if (rc == 0) rc = ad_tun_nl_dump(&nl, RTM_GETROUTE, AF_INET6, route_dump_cb, &dctx);
+    } while (rc == -EINTR);
+    if (rc == 0 && dctx.nomem) rc = -ENOMEM;
+    if (rc != 0) goto out;
+
+    qsort(want.routes, want.count, sizeof(ad_tun_route_t), route_cmp);
+    qsort(have.routes, have.count, sizeof(ad_tun_route_t), route_cmp);
+
+    /* Merge the sorted lists */
+    unsigned i = 0, j = 0;
+    while (i < want.count || j < have.count) {
+        int c = (i == want.count) ? 1 : (j == have.count) ? -1 : route_cmp(&want.routes[i], &have.routes[j]);
+        if (c == 0) {
+            st.unchanged++;
+            i++;
+            j++;
+            /* Duplicates in the set */
+            while (i < want.count && route_cmp(&want.routes[i], &want.routes[i - 1]) == 0) i++;
+            continue;
+        }
+        ad_tun_route_set_t *dst = (c < 0) ? &add : &del;
+        const ad_tun_route_t *r = (c < 0) ? &want.routes[i++] : &have.routes[j++];
+        if (c < 0 && dst->count && route_cmp(r, &dst->routes[dst->count - 1]) == 0) continue;
+        if (ad_tun_route_set_add(dst, r) != 0) {
+            rc = -ENOMEM;
+            goto out;
+        }
+    }
+
+    /*
+     * A route moving to another interface keeps its key, so its add
+     * replaces the old one in place: drop those from the removals.
+     */
+    unsigned kept = 0;
+    for (unsigned d = 0, a = 0; d < del.count; d++) {
+        while (a < add.count && route_key_cmp(&add.routes[a], &del.routes[d]) < 0) a++;
+        if (a < add.count && route_key_cmp(&add.routes[a], &del.routes[d]) == 0) continue;
+        del.routes[kept++] = del.routes[d];
+    }
+    del.count = kept;
+
+    /* Make before break: new routes first; a stale route already gone is fine */
+    int failed = 0;
+    rc = route_batch(&nl, add.routes, add.count, 0, 1, 0);
+    if (rc >= 0) {
+        failed += rc;
+        rc = route_batch(&nl, del.routes, del.count, 0, 0, 1);
+        if (rc >= 0) failed += rc;
+    }
+    if (rc >= 0) {
+        st.added = add.count;
+        st.removed = del.count;
+        st.failed = (unsigned)failed;
+        rc = failed;
+        zlog_info(zc, "Route sync: %u added, %u removed, %u unchanged, %u failed",
+                  st.added, st.removed, st.unchanged, st.failed);
+    }
+
+out:
+    if (rc < 0) zlog_error(zc, "Route sync failed: %s", strerror(-rc));
+    ad_tun_nl_close(&nl);
+    ad_tun_route_set_free(&want);
+    ad_tun_route_set_free(&have);
+    ad_tun_route_set_free(&add);
+    ad_tun_route_set_free(&del);
+    if (stats) *stats = st;
+    return rc;
+}
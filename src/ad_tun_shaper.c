@@ -0,0 +1,723 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Traffic Shaper     **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_shaper.h"
+#include "../include/ad_tun_pkt.h"
+#include "../include/ad_tun_latency.h"
+#include "../../prebuilt/inih/include/ini.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+
+/* Defaults for ad_tun_shaper_config_t */
+#define DEFAULT_SHAPER_BURST 65536
+#define DEFAULT_SHAPER_FLOW_BUCKETS 1024
+#define DEFAULT_SHAPER_QUEUE_LIMIT 4096
+#define DEFAULT_SHAPER_TICK_US 100
+
+/* Lowest non-zero rate accepted, keeps per-byte costs within 64 bits */
+#define SHAPER_MIN_RATE 8000
+
+/* Fixed-point shift of ad_tun_tb_t.ns_per_byte */
+#define TB_SHIFT 20
+
+#define WHEEL_MASK (AD_TUN_SHAPER_WHEEL_SLOTS - 1)
+
+/* ---- Configuration ---- */
+
+void ad_tun_shaper_default_config(ad_tun_shaper_config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->burst = DEFAULT_SHAPER_BURST;
+    cfg->flow_burst = DEFAULT_SHAPER_BURST;
+    cfg->flow_buckets = DEFAULT_SHAPER_FLOW_BUCKETS;
+    cfg->queue_limit = DEFAULT_SHAPER_QUEUE_LIMIT;
+    cfg->tick_us = DEFAULT_SHAPER_TICK_US;
+    cfg->nclasses = 1;
+    strcpy(cfg->classes[0].name, "default");
+    cfg->classes[0].burst = DEFAULT_SHAPER_BURST;
+}
+
+/* Parse a rate in bits per second with an optional k/m/g (decimal) suffix */
+static int shaper_parse_rate(const char *value, uint64_t *out)
+{
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(value, &end, 10);
+    if (end == value || errno != 0) return -1;
+
+    uint64_t mult = 1;
+    switch (*end) {
+    case 'k': case 'K': mult = 1000ULL; end++; break;
+    case 'm': case 'M': mult = 1000000ULL; end++; break;
+    case 'g': case 'G': mult = 1000000000ULL; end++; break;
+    default: break;
+    }
+    if (strncasecmp(end, "bit", 3) == 0) end += 3;
+    while (isspace((unsigned char)*end)) end++;
+    if (*end != '\0' || v > UINT64_MAX / mult) return -1;
+
+    *out = v * mult;
+    return 0;
+}
+
+/* Parse a size in bytes with an optional k/m (binary) suffix */
+static int shaper_parse_size(const char *value, uint32_t *out)
+{
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(value, &end, 10);
+    if (end == value || errno != 0) return -1;
+
+    switch (*end) {
+    case 'k': case 'K': v <<= 10; end++; break;
+    case 'm': case 'M': v <<= 20; end++; break;
+    default: break;
+    }
+    while (isspace((unsigned char)*end)) end++;
+    if (*end != '\0' || v > UINT32_MAX) return -1;
+
+    *out = (uint32_t)v;
+    return 0;
+}
+
+/* State carried through ini_parse() */
+typedef struct {
+    ad_tun_shaper_config_t *cfg;
+    int seen_shaper;
+    int seen_class;
+    int default_set;
+    uint8_t dscp_set[64];
+} shaper_parse_ctx_t;
+
+/* Find the class for a [shaper:<name>] section, creating it on first use */
+static int shaper_class_for(shaper_parse_ctx_t *ctx, const char *name)
+{
+    ad_tun_shaper_config_t *cfg = ctx->cfg;
+
+    /* The implicit default class is replaced by the first declared one */
+    if (!ctx->seen_class) {
+        ctx->seen_class = 1;
+        cfg->nclasses = 0;
+    }
+
+    for (unsigned i = 0; i < cfg->nclasses; i++) {
+        if (strcmp(cfg->classes[i].name, name) == 0) return (int)i;
+    }
+
+    if (cfg->nclasses >= AD_TUN_SHAPER_MAX_CLASSES || strlen(name) >= sizeof(cfg->classes[0].name)) {
+        return -1;
+    }
+
+    ad_tun_shaper_class_cfg_t *c = &cfg->classes[cfg->nclasses];
+    memset(c, 0, sizeof(*c));
+    strcpy(c->name, name);
+    c->burst = DEFAULT_SHAPER_BURST;
+    return (int)cfg->nclasses++;
+}
+
+static void shaper_parse_dscp(shaper_parse_ctx_t *ctx, unsigned cls, const char *value)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+    const char *p = value;
+
+    while (*p) {
+        while (*p == ',' || isspace((unsigned char)*p)) p++;
+        if (!*p) break;
+
+        char *end;
+        long d = strtol(p, &end, 0);
+        if (end == p || d < 0 || d > 63) {
+            zlog_warn(zc, "Config warning: invalid DSCP value in '%s' ignored", value);
+            while (*p && *p != ',' && !isspace((unsigned char)*p)) p++;
+            continue;
+        }
+        ctx->cfg->dscp_map[d] = (uint8_t)cls;
+        ctx->dscp_set[d] = 1;
+        p = end;
+    }
+}
+
+static int shaper_ini_handler(void *user, const char *section,
+                              const char *name, const char *value)
+{
+    shaper_parse_ctx_t *ctx = (shaper_parse_ctx_t*)user;
+    ad_tun_shaper_config_t *cfg = ctx->cfg;
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (strcmp(section, "shaper") == 0) {
+        ctx->seen_shaper = 1;
+
+        if (strcmp(name, "enabled") == 0) {
+            cfg->enabled = atoi(value);
+        } else if (strcmp(name, "rate") == 0 || strcmp(name, "flow_rate") == 0) {
+            uint64_t *dst = (name[0] == 'r') ? &cfg->rate : &cfg->flow_rate;
+            if (shaper_parse_rate(value, dst) != 0) {
+                zlog_warn(zc, "Config warning: '%s' is invalid (%s), ignored", name, value);
+            }
+        } else if (strcmp(name, "burst") == 0 || strcmp(name, "flow_burst") == 0) {
+            uint32_t *dst = (name[0] == 'b') ? &cfg->burst : &cfg->flow_burst;
+            if (shaper_parse_size(value, dst) != 0) {
+                zlog_warn(zc, "Config warning: '%s' is invalid (%s), ignored", name, value);
+            }
+        } else if (strcmp(name, "flow_buckets") == 0) {
+            cfg->flow_buckets = (unsigned)atoi(value);
+        } else if (strcmp(name, "queue_limit") == 0) {
+            cfg->queue_limit = (unsigned)atoi(value);
+        } else if (strcmp(name, "tick_us") == 0) {
+            cfg->tick_us = (unsigned)atoi(value);
+        } else {
+            zlog_warn(zc, "Unknown shaper key ignored: %s", name);
+        }
+        return 1;
+    }
+
+    if (strncmp(section, "shaper:", 7) != 0) {
+        zlog_debug(zc, "Ignoring section: %s", section);
+        return 1;
+    }
+
+    if (section[7] == '\0') {
+        zlog_error(zc, "Config error: shaper class section without a name");
+        return 0;
+    }
+
+    int cls = shaper_class_for(ctx, section + 7);
+    if (cls < 0) {
+        zlog_error(zc, "Config error: too many shaper classes or name too long: %s", section + 7);
+        return 0;
+    }
+
+    ad_tun_shaper_class_cfg_t *c = &cfg->classes[cls];
+    if (strcmp(name, "rate") == 0) {
+        if (shaper_parse_rate(value, &c->rate) != 0) {
+            zlog_warn(zc, "Config warning: [%s] 'rate' is invalid (%s), ignored", section, value);
+        }
+    } else if (strcmp(name, "burst") == 0) {
+        if (shaper_parse_size(value, &c->burst) != 0) {
+            zlog_warn(zc, "Config warning: [%s] 'burst' is invalid (%s), ignored", section, value);
+        }
+    } else if (strcmp(name, "dscp") == 0) {
+        shaper_parse_dscp(ctx, (unsigned)cls, value);
+    } else if (strcmp(name, "default") == 0) {
+        if (atoi(value) == 1) {
+            cfg->default_class = (unsigned)cls;
+            ctx->default_set = 1;
+        }
+    } else {
+        zlog_warn(zc, "Unknown shaper key ignored: [%s] %s", section, name);
+    }
+
+    return 1;
+}
+
+/* Raise rates below the supported minimum */
+static void shaper_check_rate(const char *what, uint64_t *rate)
+{
+    if (*rate != 0 && *rate < SHAPER_MIN_RATE) {
+        zlog_warn(zlog_get_category("ad_tun"),
+                  "Config warning: %s rate %llu bit/s is too low, using %d",
+                  what, (unsigned long long)*rate, SHAPER_MIN_RATE);
+        *rate = SHAPER_MIN_RATE;
+    }
+}
+
+ad_tun_error_t ad_tun_shaper_load_config(const char *path, ad_tun_shaper_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!path || !cfg) {
+        zlog_error(zc, "Invalid arguments to ad_tun_shaper_load_config()");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    ad_tun_shaper_default_config(cfg);
+
+    shaper_parse_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.cfg = cfg;
+
+    int rc = ini_parse(path, shaper_ini_handler, &ctx);
+    if (rc < 0) {
+        zlog_error(zc, "Failed to open config file: %s", path);
+        return AD_TUN_ERR_CONFIG;
+    } else if (rc > 0) {
+        zlog_error(zc, "Parsing error at line %d in config file %s", rc, path);
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    if (!ctx.seen_shaper) {
+        zlog_debug(zc, "No [shaper] section in %s, shaping disabled", path);
+        ad_tun_shaper_default_config(cfg);
+        return AD_TUN_OK;
+    }
+
+    if (cfg->enabled != 0 && cfg->enabled != 1) {
+        zlog_warn(zc, "Config warning: 'enabled' should be 0 or 1, shaping disabled");
+        cfg->enabled = 0;
+    }
+
+    if (cfg->queue_limit == 0) {
+        zlog_warn(zc, "Config warning: 'queue_limit' is invalid, using default %d",
+                  DEFAULT_SHAPER_QUEUE_LIMIT);
+        cfg->queue_limit = DEFAULT_SHAPER_QUEUE_LIMIT;
+    }
+
+    if (cfg->tick_us == 0) {
+        zlog_warn(zc, "Config warning: 'tick_us' is invalid, using default %d", DEFAULT_SHAPER_TICK_US);
+        cfg->tick_us = DEFAULT_SHAPER_TICK_US;
+    }
+
+    if (cfg->flow_rate && cfg->flow_buckets == 0) {
+        zlog_warn(zc, "Config warning: 'flow_buckets' is invalid, using default %d",
+                  DEFAULT_SHAPER_FLOW_BUCKETS);
+        cfg->flow_buckets = DEFAULT_SHAPER_FLOW_BUCKETS;
+    }
+
+    shaper_check_rate("interface", &cfg->rate);
+    shaper_check_rate("flow", &cfg->flow_rate);
+    for (unsigned i = 0; i < cfg->nclasses; i++) {
+        shaper_check_rate(cfg->classes[i].name, &cfg->classes[i].rate);
+    }
+
+    /* DSCP values not named by any class go to the default class */
+    for (unsigned d = 0; d < 64; d++) {
+        if (!ctx.dscp_set[d]) cfg->dscp_map[d] = (uint8_t)cfg->default_class;
+    }
+
+    zlog_info(zc, "Shaper config loaded from %s: enabled=%d, rate=%llu, classes=%u, flow_rate=%llu",
+              path, cfg->enabled, (unsigned long long)cfg->rate, cfg->nclasses,
+              (unsigned long long)cfg->flow_rate);
+
+    return AD_TUN_OK;
+}
+
+/* ---- Token buckets ---- */
+
+static void tb_init(ad_tun_tb_t *tb, uint64_t rate, uint32_t burst, uint64_t now_ns)
+{
+    memset(tb, 0, sizeof(*tb));
+    if (rate == 0) return;
+
+    tb->ns_per_byte = ((8ULL * 1000000000ULL) << TB_SHIFT) / rate;
+    tb->depth = (int64_t)(((unsigned __int128)burst * tb->ns_per_byte) >> TB_SHIFT);
+    tb->tokens = tb->depth;
+    tb->last_ns = now_ns;
+}
+
+static inline int64_t tb_cost(const ad_tun_tb_t *tb, size_t len)
+{
+    return (int64_t)(((unsigned __int128)len * tb->ns_per_byte) >> TB_SHIFT);
+}
+
+/* Refill tb and return how long to wait before len bytes conform, 0 if they do */
+static inline uint64_t tb_wait(ad_tun_tb_t *tb, size_t len, uint64_t now_ns)
+{
+    if (tb->ns_per_byte == 0) return 0;
+
+    if (now_ns > tb->last_ns) {
+        tb->tokens += (int64_t)(now_ns - tb->last_ns);
+        if (tb->tokens > tb->depth) tb->tokens = tb->depth;
+        tb->last_ns = now_ns;
+    }
+
+    /* A packet larger than the bucket needs a full bucket and leaves it negative */
+    int64_t need = tb_cost(tb, len);
+    if (need > tb->depth) need = tb->depth;
+
+    return (tb->tokens >= need) ? 0 : (uint64_t)(need - tb->tokens);
+}
+
+static inline void tb_consume(ad_tun_tb_t *tb, size_t len)
+{
+    if (tb->ns_per_byte) tb->tokens -= tb_cost(tb, len);
+}
+
+/* Wait time of a packet against every bucket on its path */
+static uint64_t shaper_wait(ad_tun_shaper_t *sh, const ad_tun_shaper_desc_t *d, uint64_t now_ns)
+{
+    size_t len = d->buf->len;
+    uint64_t w = tb_wait(&sh->iface, len, now_ns);
+    uint64_t wc = tb_wait(&sh->classes[d->cls], len, now_ns);
+    if (wc > w) w = wc;
+    if (sh->flows) {
+        uint64_t wf = tb_wait(&sh->flows[d->flow], len, now_ns);
+        if (wf > w) w = wf;
+    }
+    return w;
+}
+
+static void shaper_consume(ad_tun_shaper_t *sh, const ad_tun_shaper_desc_t *d)
+{
+    size_t len = d->buf->len;
+    tb_consume(&sh->iface, len);
+    tb_consume(&sh->classes[d->cls], len);
+    if (sh->flows) tb_consume(&sh->flows[d->flow], len);
+    sh->stats.bytes += len;
+}
+
+/* ---- Classification ---- */
+
+static uint32_t shaper_flow_hash(const ad_tun_shaper_t *sh, const ad_tun_pkt_info_t *info)
+{
+    /* FNV-1a over the 5-tuple; fragments hash on addresses only so they stay together */
+    uint32_t h = 2166136261u ^ sh->seed;
+    size_t alen = (info->family == AF_INET) ? 4 : 16;
+    uint16_t sport = info->is_frag ? 0 : info->sport;
+    uint16_t dport = info->is_frag ? 0 : info->dport;
+
+    for (size_t i = 0; i < alen; i++) h = (h ^ info->src[i]) * 16777619u;
+    for (size_t i = 0; i < alen; i++) h = (h ^ info->dst[i]) * 16777619u;
+    h = (h ^ (sport >> 8)) * 16777619u;
+    h = (h ^ (sport & 0xff)) * 16777619u;
+    h = (h ^ (dport >> 8)) * 16777619u;
+    h = (h ^ (dport & 0xff)) * 16777619u;
+    h = (h ^ info->proto) * 16777619u;
+
+    return h;
+}
+
+static void shaper_classify(const ad_tun_shaper_t *sh, const ad_tun_buf_t *buf,
+                            ad_tun_shaper_desc_t *d)
+{
+    const unsigned char *p = buf->data;
+    uint8_t tos = 0;
+
+    d->flow = 0;
+    if (sh->flows) {
+        ad_tun_pkt_info_t info;
+        if (ad_tun_pkt_parse(p, buf->len, &info) == 0) {
+            tos = info.tos;
+            d->flow = shaper_flow_hash(sh, &info) & sh->flow_mask;
+        }
+    } else if (buf->len >= 2) {
+        /* Only the DSCP is needed: read it straight from the header */
+        if ((p[0] >> 4) == 4) tos = p[1];
+        else if ((p[0] >> 4) == 6) tos = (uint8_t)((p[0] << 4) | (p[1] >> 4));
+    }
+
+    d->cls = sh->cfg.dscp_map[tos >> 2];
+}
+
+/* ---- Timer wheel ---- */
+
+static void wheel_add(ad_tun_shaper_t *sh, uint32_t qid, uint64_t when_ns, uint64_t base_tick)
+{
+    ad_tun_shaper_queue_t *q = &sh->queues[qid];
+    uint64_t t = (when_ns + sh->tick_ns - 1) / sh->tick_ns;
+
+    if (t <= base_tick) t = base_tick + 1;
+    if (t > base_tick + AD_TUN_SHAPER_WHEEL_SLOTS - 1) t = base_tick + AD_TUN_SHAPER_WHEEL_SLOTS - 1;
+
+    unsigned slot = (unsigned)(t & WHEEL_MASK);
+    q->wnext = -1;
+    if (sh->wheel_tail[slot] >= 0) sh->queues[sh->wheel_tail[slot]].wnext = (int32_t)qid;
+    else sh->wheel_head[slot] = (int32_t)qid;
+    sh->wheel_tail[slot] = (int32_t)qid;
+
+    q->scheduled = 1;
+    sh->scheduled++;
+}
+
+static int32_t wheel_pop(ad_tun_shaper_t *sh, unsigned slot)
+{
+    int32_t qid = sh->wheel_head[slot];
+    if (qid < 0) return -1;
+
+    ad_tun_shaper_queue_t *q = &sh->queues[qid];
+    sh->wheel_head[slot] = q->wnext;
+    if (q->wnext < 0) sh->wheel_tail[slot] = -1;
+    q->wnext = -1;
+    q->scheduled = 0;
+    sh->scheduled--;
+    return qid;
+}
+
+static void wheel_push_front(ad_tun_shaper_t *sh, unsigned slot, int32_t qid)
+{
+    ad_tun_shaper_queue_t *q = &sh->queues[qid];
+    q->wnext = sh->wheel_head[slot];
+    if (q->wnext < 0) sh->wheel_tail[slot] = qid;
+    sh->wheel_head[slot] = qid;
+    q->scheduled = 1;
+    sh->scheduled++;
+}
+
+/* ---- Shaper ---- */
+
+ad_tun_error_t ad_tun_shaper_init(ad_tun_shaper_t *sh, const ad_tun_shaper_config_t *cfg,
+                                  uint64_t now_ns)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!sh) {
+        zlog_error(zc, "ad_tun_shaper_init: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    memset(sh, 0, sizeof(*sh));
+    if (cfg) sh->cfg = *cfg;
+    else ad_tun_shaper_default_config(&sh->cfg);
+    cfg = &sh->cfg;
+
+    if (cfg->nclasses == 0 || cfg->nclasses > AD_TUN_SHAPER_MAX_CLASSES ||
+        cfg->default_class >= cfg->nclasses || cfg->queue_limit == 0 || cfg->tick_us == 0 ||
+        (cfg->flow_rate && cfg->flow_buckets == 0)) {
+        zlog_error(zc, "ad_tun_shaper_init: invalid configuration");
+        return AD_TUN_ERR_CONFIG;
+    }
+    for (unsigned d = 0; d < 64; d++) {
+        if (cfg->dscp_map[d] >= cfg->nclasses) {
+            zlog_error(zc, "ad_tun_shaper_init: DSCP %u maps to unknown class %u", d, cfg->dscp_map[d]);
+            return AD_TUN_ERR_CONFIG;
+        }
+    }
+
+    tb_init(&sh->iface, cfg->rate, cfg->burst, now_ns);
+    for (unsigned i = 0; i < cfg->nclasses; i++) {
+        tb_init(&sh->classes[i], cfg->classes[i].rate, cfg->classes[i].burst, now_ns);
+    }
+
+    sh->nqueues = cfg->nclasses;
+    if (cfg->flow_rate) {
+        unsigned nb = 1;
+        while (nb < cfg->flow_buckets) nb <<= 1;
+        sh->flow_mask = nb - 1;
+        sh->nqueues = nb;
+
+        sh->flows = malloc(nb * sizeof(*sh->flows));
+        if (!sh->flows) goto oom;
+        for (unsigned i = 0; i < nb; i++) {
+            tb_init(&sh->flows[i], cfg->flow_rate, cfg->flow_burst, now_ns);
+        }
+    }
+
+    sh->queues = malloc(sh->nqueues * sizeof(*sh->queues));
+    sh->descs = malloc(cfg->queue_limit * sizeof(*sh->descs));
+    if (!sh->queues || !sh->descs) goto oom;
+
+    for (unsigned i = 0; i < sh->nqueues; i++) {
+        sh->queues[i].head = sh->queues[i].tail = sh->queues[i].wnext = -1;
+        sh->queues[i].scheduled = 0;
+    }
+    for (unsigned i = 0; i < cfg->queue_limit; i++) {
+        sh->descs[i].buf = NULL;
+        sh->descs[i].next = (i + 1 < cfg->queue_limit) ? (int32_t)(i + 1) : -1;
+    }
+    sh->free_desc = 0;
+
+    for (unsigned i = 0; i < AD_TUN_SHAPER_WHEEL_SLOTS; i++) {
+        sh->wheel_head[i] = sh->wheel_tail[i] = -1;
+    }
+    sh->tick_ns = (uint64_t)cfg->tick_us * 1000;
+    sh->wheel_tick = now_ns / sh->tick_ns;
+
+    if (getrandom(&sh->seed, sizeof(sh->seed), GRND_NONBLOCK) != (ssize_t)sizeof(sh->seed)) {
+        sh->seed = (uint32_t)time(NULL) ^ (uint32_t)getpid();
+    }
+
+    zlog_debug(zc, "Shaper initialized: rate=%llu, classes=%u, flow_buckets=%u, queue_limit=%u",
+               (unsigned long long)cfg->rate, cfg->nclasses, sh->flows ? sh->nqueues : 0,
+               cfg->queue_limit);
+
+    return AD_TUN_OK;
+
+oom:
+    zlog_error(zc, "ad_tun_shaper_init: allocation failed");
+    free(sh->flows);
+    free(sh->queues);
+    free(sh->descs);
+    memset(sh, 0, sizeof(*sh));
+    return AD_TUN_ERR_SYS;
+}
+
+void ad_tun_shaper_free(ad_tun_shaper_t *sh)
+{
+    if (!sh || !sh->queues) return;
+
+    if (sh->held) {
+        zlog_warn(zlog_get_category("ad_tun"), "Shaper freed with %u packets still held", sh->held);
+    }
+
+    free(sh->flows);
+    free(sh->queues);
+    free(sh->descs);
+    memset(sh, 0, sizeof(*sh));
+}
+
+static inline uint32_t shaper_qid(const ad_tun_shaper_t *sh, const ad_tun_shaper_desc_t *d)
+{
+    return sh->flows ? d->flow : d->cls;
+}
+
+int ad_tun_shaper_submit(ad_tun_shaper_t *sh, ad_tun_buf_t **in, unsigned n, uint64_t now_ns,
+                         ad_tun_buf_t **out, unsigned max_out, ad_tun_buf_t **drops)
+{
+    if (!sh || !sh->queues || (n && (!in || !out)) || max_out < n || !drops) return -EINVAL;
+
+    AD_TUN_LAT_START(t_shaper);
+
+    /* Nothing on the wheel: move it to the present so new deferrals are placed correctly */
+    if (sh->scheduled == 0) sh->wheel_tick = now_ns / sh->tick_ns;
+
+    unsigned nout = 0;
+    for (unsigned i = 0; i < n; i++) {
+        ad_tun_shaper_desc_t d;
+        d.buf = in[i];
+        shaper_classify(sh, in[i], &d);
+
+        uint32_t qid = shaper_qid(sh, &d);
+        ad_tun_shaper_queue_t *q = &sh->queues[qid];
+        uint64_t wait = 0;
+
+        /* Packets queue behind earlier ones of the same bucket to keep their order */
+        if (q->head < 0) {
+            wait = shaper_wait(sh, &d, now_ns);
+            if (wait == 0) {
+                shaper_consume(sh, &d);
+                out[nout++] = in[i];
+                sh->stats.passed++;
+                continue;
+            }
+        }
+
+        if (sh->free_desc < 0) {
+            in[i]->next = *drops;
+            *drops = in[i];
+            sh->stats.dropped++;
+            continue;
+        }
+
+        int32_t idx = sh->free_desc;
+        ad_tun_shaper_desc_t *slot = &sh->descs[idx];
+        sh->free_desc = slot->next;
+        *slot = d;
+        slot->next = -1;
+
+        if (q->tail >= 0) sh->descs[q->tail].next = idx;
+        else q->head = idx;
+        q->tail = idx;
+        sh->held++;
+
+        if (!q->scheduled) wheel_add(sh, qid, now_ns + wait, sh->wheel_tick);
+    }
+
+    AD_TUN_LAT_END(AD_TUN_LAT_SHAPER, t_shaper);
+    return (int)nout;
+}
+
+/* Release conforming packets from the head of a queue; returns the wait of the new head */
+static uint64_t shaper_release(ad_tun_shaper_t *sh, ad_tun_shaper_queue_t *q, uint64_t now_ns,
+                               ad_tun_buf_t **out, unsigned max_out, unsigned *nout)
+{
+    while (q->head >= 0 && *nout < max_out) {
+        int32_t idx = q->head;
+        ad_tun_shaper_desc_t *d = &sh->descs[idx];
+
+        uint64_t wait = shaper_wait(sh, d, now_ns);
+        if (wait) return wait;
+
+        shaper_consume(sh, d);
+        out[(*nout)++] = d->buf;
+        sh->stats.delayed++;
+
+        q->head = d->next;
+        if (q->head < 0) q->tail = -1;
+        d->buf = NULL;
+        d->next = sh->free_desc;
+        sh->free_desc = idx;
+        sh->held--;
+    }
+    return 0;
+}
+
+int ad_tun_shaper_poll(ad_tun_shaper_t *sh, uint64_t now_ns, ad_tun_buf_t **out, unsigned max_out)
+{
+    if (!sh || !sh->queues || !out) return -EINVAL;
+
+    uint64_t target = now_ns / sh->tick_ns;
+    unsigned nout = 0;
+
+    if (sh->scheduled == 0) {
+        if (target > sh->wheel_tick) sh->wheel_tick = target;
+        return 0;
+    }
+
+    /* After a long gap every slot is due: one lap of the wheel covers them all */
+    if (target > sh->wheel_tick + AD_TUN_SHAPER_WHEEL_SLOTS) {
+        sh->wheel_tick = target - AD_TUN_SHAPER_WHEEL_SLOTS;
+    }
+
+    while (sh->wheel_tick < target) {
+        uint64_t t = sh->wheel_tick + 1;
+        unsigned slot = (unsigned)(t & WHEEL_MASK);
+        int32_t qid;
+
+        while ((qid = wheel_pop(sh, slot)) >= 0) {
+            ad_tun_shaper_queue_t *q = &sh->queues[qid];
+            uint64_t wait = shaper_release(sh, q, now_ns, out, max_out, &nout);
+
+            if (q->head < 0) continue;
+            if (wait == 0) {
+                /* out is full: resume from this queue next time */
+                wheel_push_front(sh, slot, qid);
+                return (int)nout;
+            }
+            wheel_add(sh, (uint32_t)qid, now_ns + wait, t);
+        }
+
+        sh->wheel_tick = t;
+    }
+
+    return (int)nout;
+}
+
+uint64_t ad_tun_shaper_next_timeout(const ad_tun_shaper_t *sh)
+{
+    if (!sh || sh->scheduled == 0) return 0;
+    return (sh->wheel_tick + 1) * sh->tick_ns;
+}
+
+ad_tun_buf_t *ad_tun_shaper_drain(ad_tun_shaper_t *sh)
+{
+    ad_tun_buf_t *head = NULL;
+    ad_tun_buf_t **link = &head;
+
+    if (!sh || !sh->queues) return NULL;
+
+    for (unsigned slot = 0; slot < AD_TUN_SHAPER_WHEEL_SLOTS; slot++) {
+        int32_t qid;
+        while ((qid = wheel_pop(sh, slot)) >= 0) {
+            ad_tun_shaper_queue_t *q = &sh->queues[qid];
+            while (q->head >= 0) {
+                int32_t idx = q->head;
+                ad_tun_shaper_desc_t *d = &sh->descs[idx];
+
+                *link = d->buf;
+                link = &d->buf->next;
+
+                q->head = d->next;
+                d->buf = NULL;
+                d->next = sh->free_desc;
+                sh->free_desc = idx;
+                sh->held--;
+            }
+            q->tail = -1;
+        }
+    }
+
+    *link = NULL;
+    return head;
+}
@@ -0,0 +1,589 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Shared Memory Ring **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#define _GNU_SOURCE
+
+#include "../include/ad_tun_shm.h"
+#include "../include/ad_tun_evwait.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Defaults for ad_tun_shm_config_t */
+#define DEFAULT_SHM_SLOTS 1024
+#define DEFAULT_SHM_SLOT_SIZE 2048
+
+#define SHM_MAGIC 0x61647368u   /* "adsh" */
+#define SHM_VERSION 1
+#define SHM_MAX_SLOTS (1u << 24)
+#define SHM_MAX_SLOT_SIZE (1u << 20)
+
+/* Shared header; each line is written by one side only */
+struct ad_tun_shm_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t slot_size;
+    uint32_t stride;
+    int32_t mode;
+    uint64_t map_len;
+
+    uint64_t head __attribute__((aligned(64)));     /* Next slot producers fill */
+    uint64_t tail __attribute__((aligned(64)));     /* Next slot consumers drain */
+
+    uint32_t readers_waiting __attribute__((aligned(64)));
+    uint32_t writers_waiting __attribute__((aligned(64)));
+
+    ad_tun_shm_stats_t stats __attribute__((aligned(64)));
+} __attribute__((aligned(64)));
+
+/* Per-slot header, followed by the packet */
+typedef struct {
+    uint64_t seq;               /* MPMC: pos = free, pos + 1 = filled (Vyukov) */
+    uint32_t len;
+    uint32_t pad;
+    uint64_t ts;
+} shm_slot_t;
+
+void ad_tun_shm_default_config(ad_tun_shm_config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->slots = DEFAULT_SHM_SLOTS;
+    cfg->slot_size = DEFAULT_SHM_SLOT_SIZE;
+    cfg->mode = AD_TUN_SHM_SPSC;
+}
+
+static inline shm_slot_t *shm_slot(const ad_tun_shm_ring_t *ring, uint64_t pos)
+{
+    return (shm_slot_t*)(ring->slots + (size_t)(pos & ring->mask) * ring->stride);
+}
+
+static void shm_close_fds(int mem_fd, int data_fd, int space_fd)
+{
+    if (mem_fd >= 0) close(mem_fd);
+    if (data_fd >= 0) close(data_fd);
+    if (space_fd >= 0) close(space_fd);
+}
+
+/* Map and check the region behind mem_fd; takes the descriptors */
+static ad_tun_error_t shm_map(ad_tun_shm_ring_t *ring, int mem_fd, int data_fd, int space_fd)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+    struct stat st;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->mem_fd = ring->data_fd = ring->space_fd = -1;
+
+    if (fstat(mem_fd, &st) < 0) {
+        zlog_error(zc, "ad_tun_shm_attach: fstat failed: %s", strerror(errno));
+        shm_close_fds(mem_fd, data_fd, space_fd);
+        return AD_TUN_ERR_SYS;
+    }
+
+    /* Unless the size is sealed the peer could truncate the mapping (SIGBUS) */
+    int seals = fcntl(mem_fd, F_GET_SEALS);
+    if (seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) != (F_SEAL_SHRINK | F_SEAL_GROW)) {
+        zlog_error(zc, "ad_tun_shm_attach: descriptor size is not sealed");
+        shm_close_fds(mem_fd, data_fd, space_fd);
+        return AD_TUN_ERR_CONFIG;
+    }
+    if ((size_t)st.st_size < sizeof(ad_tun_shm_hdr_t)) {
+        zlog_error(zc, "ad_tun_shm_attach: descriptor is not a ring");
+        shm_close_fds(mem_fd, data_fd, space_fd);
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
+    if (base == MAP_FAILED) {
+        zlog_error(zc, "ad_tun_shm_attach: mmap failed: %s", strerror(errno));
+        shm_close_fds(mem_fd, data_fd, space_fd);
+        return AD_TUN_ERR_SYS;
+    }
+
+    /* The region may come from a less trusted process: check it adds up */
+    ad_tun_shm_hdr_t *hdr = base;
+    if (hdr->magic != SHM_MAGIC || hdr->version != SHM_VERSION || hdr->map_len != (uint64_t)st.st_size ||
+        hdr->slots == 0 || hdr->slots > SHM_MAX_SLOTS || (hdr->slots & (hdr->slots - 1)) != 0 ||
+        hdr->slot_size == 0 || hdr->slot_size > SHM_MAX_SLOT_SIZE ||
+        hdr->stride < sizeof(shm_slot_t) + hdr->slot_size || hdr->stride % 64 != 0 ||
+        sizeof(*hdr) + (uint64_t)hdr->slots * hdr->stride != hdr->map_len ||
+        (hdr->mode != AD_TUN_SHM_SPSC && hdr->mode != AD_TUN_SHM_MPMC)) {
+        zlog_error(zc, "ad_tun_shm_attach: descriptor is not a ring");
+        munmap(base, (size_t)st.st_size);
+        shm_close_fds(mem_fd, data_fd, space_fd);
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    ring->hdr = hdr;
+    ring->slots = (unsigned char*)base + sizeof(*hdr);
+    ring->map_len = (size_t)st.st_size;
+    ring->mask = hdr->slots - 1;
+    ring->stride = hdr->stride;
+    ring->slot_size = hdr->slot_size;
+    ring->mode = hdr->mode;
+    ring->mem_fd = mem_fd;
+    ring->data_fd = data_fd;
+    ring->space_fd = space_fd;
+    ring->cached_head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    ring->cached_tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+    return AD_TUN_OK;
+}
+
+ad_tun_error_t ad_tun_shm_create(ad_tun_shm_ring_t *ring, const ad_tun_shm_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!ring || !cfg || cfg->slots == 0 || cfg->slots > SHM_MAX_SLOTS ||
+        cfg->slot_size == 0 || cfg->slot_size > SHM_MAX_SLOT_SIZE ||
+        (cfg->mode != AD_TUN_SHM_SPSC && cfg->mode != AD_TUN_SHM_MPMC)) {
+        zlog_error(zc, "ad_tun_shm_create: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    uint32_t slots = 1;
+    while (slots < cfg->slots) slots <<= 1;
+    uint32_t stride = (uint32_t)((sizeof(shm_slot_t) + cfg->slot_size + 63) & ~(size_t)63);
+    size_t len = sizeof(ad_tun_shm_hdr_t) + (size_t)slots * stride;
+
+    int mem_fd = memfd_create(cfg->name ? cfg->name : "ad_tun_shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    int data_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mem_fd < 0 || data_fd < 0 || space_fd < 0 || ftruncate(mem_fd, (off_t)len) < 0) {
+        zlog_error(zc, "ad_tun_shm_create: %s", strerror(errno));
+        shm_close_fds(mem_fd, data_fd, space_fd);
+        return AD_TUN_ERR_SYS;
+    }
+
+    /* A peer must not be able to shrink the region under us (SIGBUS) */
+    if (fcntl(mem_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        zlog_error(zc, "ad_tun_shm_create: cannot seal memfd: %s", strerror(errno));
+        shm_close_fds(mem_fd, data_fd, space_fd);
+        return AD_TUN_ERR_SYS;
+    }
+
+    void *base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
+    if (base == MAP_FAILED) {
+        zlog_error(zc, "ad_tun_shm_create: mmap failed: %s", strerror(errno));
+        shm_close_fds(mem_fd, data_fd, space_fd);
+        return AD_TUN_ERR_SYS;
+    }
+
+    ad_tun_shm_hdr_t *hdr = base;
+    hdr->magic = SHM_MAGIC;
+    hdr->version = SHM_VERSION;
+    hdr->slots = slots;
+    hdr->slot_size = cfg->slot_size;
+    hdr->stride = stride;
+    hdr->mode = cfg->mode;
+    hdr->map_len = len;
+
+    unsigned char *s = (unsigned char*)base + sizeof(*hdr);
+    for (uint32_t i = 0; i < slots; i++) ((shm_slot_t*)(s + (size_t)i * stride))->seq = i;
+    munmap(base, len);
+
+    ad_tun_error_t rc = shm_map(ring, mem_fd, data_fd, space_fd);
+    if (rc == AD_TUN_OK) {
+        zlog_info(zc, "Shared memory ring created: %u slots of %u bytes, %s, %zu bytes",
+                  slots, cfg->slot_size, cfg->mode == AD_TUN_SHM_MPMC ? "mpmc" : "spsc", len);
+    }
+    return rc;
+}
+
+ad_tun_error_t ad_tun_shm_attach(ad_tun_shm_ring_t *ring, int mem_fd, int data_fd, int space_fd)
+{
+    if (!ring || mem_fd < 0 || data_fd < 0 || space_fd < 0) {
+        zlog_error(zlog_get_category("ad_tun"), "ad_tun_shm_attach: invalid arguments");
+        shm_close_fds(mem_fd, data_fd, space_fd);
+        return AD_TUN_ERR_CONFIG;
+    }
+    return shm_map(ring, mem_fd, data_fd, space_fd);
+}
+
+void ad_tun_shm_close(ad_tun_shm_ring_t *ring)
+{
+    if (!ring || !ring->hdr) return;
+
+    munmap(ring->hdr, ring->map_len);
+    shm_close_fds(ring->mem_fd, ring->data_fd, ring->space_fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->mem_fd = ring->data_fd = ring->space_fd = -1;
+}
+
+ad_tun_error_t ad_tun_shm_send_fds(const ad_tun_shm_ring_t *ring, int sock)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!ring || !ring->hdr || sock < 0) {
+        zlog_error(zc, "ad_tun_shm_send_fds: invalid arguments");
+        return AD_TUN_ERR_SYS;
+    }
+
+    int fds[3] = { ring->mem_fd, ring->data_fd, ring->space_fd };
+    char tag = 'R';
+    struct iovec iov = { &tag, 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } ctl;
+    memset(&ctl, 0, sizeof(ctl));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+    ssize_t r;
+    do {
+        r = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (r < 0 && errno == EINTR);
+    if (r != 1) {
+        zlog_error(zc, "ad_tun_shm_send_fds: sendmsg failed: %s", strerror(errno));
+        return AD_TUN_ERR_SYS;
+    }
+    return AD_TUN_OK;
+}
+
+ad_tun_error_t ad_tun_shm_recv_fds(ad_tun_shm_ring_t *ring, int sock)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!ring || sock < 0) {
+        zlog_error(zc, "ad_tun_shm_recv_fds: invalid arguments");
+        return AD_TUN_ERR_SYS;
+    }
+
+    int fds[3];
+    char tag;
+    struct iovec iov = { &tag, 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } ctl;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+
+    ssize_t r;
+    do {
+        r = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (r < 0 && errno == EINTR);
+    if (r != 1) {
+        zlog_error(zc, "ad_tun_shm_recv_fds: recvmsg failed: %s", r < 0 ? strerror(errno) : "short read");
+        return AD_TUN_ERR_SYS;
+    }
+
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    if (!c || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) {
+        zlog_error(zc, "ad_tun_shm_recv_fds: no descriptors received");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    size_t got = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(c), (got < 3 ? got : 3) * sizeof(int));
+    if (got != 3 || tag != 'R' || (msg.msg_flags & MSG_CTRUNC)) {
+        for (size_t i = 0; i < got && i < 3; i++) close(fds[i]);
+        zlog_error(zc, "ad_tun_shm_recv_fds: unexpected message");
+        return AD_TUN_ERR_CONFIG;
+    }
+    return ad_tun_shm_attach(ring, fds[0], fds[1], fds[2]);
+}
+
+/* Signal fd if someone sleeps on it */
+static void shm_wake(ad_tun_shm_ring_t *ring, uint32_t *waiting, int fd)
+{
+    if (ad_tun_evwait_wake(waiting, fd)) {
+        __atomic_fetch_add(&ring->hdr->stats.wakeups, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Claim up to n free slots; returns the count and their first position */
+static unsigned shm_claim_free(ad_tun_shm_ring_t *ring, unsigned n, uint64_t *first)
+{
+    ad_tun_shm_hdr_t *hdr = ring->hdr;
+    uint64_t size = (uint64_t)ring->mask + 1;
+
+    if (ring->mode == AD_TUN_SHM_SPSC) {
+        uint64_t head = hdr->head;
+        if (size - (head - ring->cached_tail) < n) {
+            ring->cached_tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+        }
+        uint64_t room = size - (head - ring->cached_tail);
+        *first = head;
+        return room < n ? (unsigned)room : n;
+    }
+
+    /* Vyukov MPMC, claiming a run of slots with one CAS */
+    uint64_t pos = __atomic_load_n(&hdr->head, __ATOMIC_RELAXED);
+    for (;;) {
+        unsigned k = 0;
+        while (k < n && __atomic_load_n(&shm_slot(ring, pos + k)->seq, __ATOMIC_ACQUIRE) == pos + k) k++;
+        if (k == 0) {
+            int64_t diff = (int64_t)(__atomic_load_n(&shm_slot(ring, pos)->seq, __ATOMIC_ACQUIRE) - pos);
+            if (diff < 0) return 0;
+            pos = __atomic_load_n(&hdr->head, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&hdr->head, &pos, pos + k, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            *first = pos;
+            return k;
+        }
+    }
+}
+
+/* Claim up to n filled slots */
+static unsigned shm_claim_filled(ad_tun_shm_ring_t *ring, unsigned n, uint64_t *first)
+{
+    ad_tun_shm_hdr_t *hdr = ring->hdr;
+
+    if (ring->mode == AD_TUN_SHM_SPSC) {
+        uint64_t tail = hdr->tail;
+        if (ring->cached_head - tail < n) {
+            ring->cached_head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+        }
+        uint64_t avail = ring->cached_head - tail;
+        *first = tail;
+        return avail < n ? (unsigned)avail : n;
+    }
+
+    uint64_t pos = __atomic_load_n(&hdr->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        unsigned k = 0;
+        while (k < n && __atomic_load_n(&shm_slot(ring, pos + k)->seq, __ATOMIC_ACQUIRE) == pos + k + 1) k++;
+        if (k == 0) {
+            int64_t diff = (int64_t)(__atomic_load_n(&shm_slot(ring, pos)->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+            if (diff < 0) return 0;
+            pos = __atomic_load_n(&hdr->tail, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&hdr->tail, &pos, pos + k, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            *first = pos;
+            return k;
+        }
+    }
+}
+
+/* Publish k filled slots starting at first */
+static void shm_publish(ad_tun_shm_ring_t *ring, uint64_t first, unsigned k)
+{
+    if (ring->mode == AD_TUN_SHM_SPSC) {
+        __atomic_store_n(&ring->hdr->head, first + k, __ATOMIC_RELEASE);
+    } else {
+        for (unsigned i = 0; i < k; i++) {
+            __atomic_store_n(&shm_slot(ring, first + i)->seq, first + i + 1, __ATOMIC_RELEASE);
+        }
+    }
+    shm_wake(ring, &ring->hdr->readers_waiting, ring->data_fd);
+}
+
+/* Free k drained slots starting at first */
+static void shm_free_slots(ad_tun_shm_ring_t *ring, uint64_t first, unsigned k)
+{
+    if (ring->mode == AD_TUN_SHM_SPSC) {
+        __atomic_store_n(&ring->hdr->tail, first + k, __ATOMIC_RELEASE);
+    } else {
+        for (unsigned i = 0; i < k; i++) {
+            __atomic_store_n(&shm_slot(ring, first + i)->seq, first + i + ring->mask + 1, __ATOMIC_RELEASE);
+        }
+    }
+    shm_wake(ring, &ring->hdr->writers_waiting, ring->space_fd);
+}
+
+unsigned ad_tun_shm_enqueue(ad_tun_shm_ring_t *ring, ad_tun_buf_t *const *bufs, unsigned n)
+{
+    if (!ring || !ring->hdr || !bufs || n == 0) return 0;
+
+    /* Oversized packets are skipped without taking a slot */
+    unsigned fit = 0;
+    for (unsigned i = 0; i < n; i++) fit += bufs[i]->len <= ring->slot_size;
+
+    uint64_t first = 0;
+    unsigned k = fit ? shm_claim_free(ring, fit, &first) : 0;
+
+    unsigned i = 0, stored = 0, skipped = 0;
+    for (; i < n; i++) {
+        const ad_tun_buf_t *b = bufs[i];
+        if (b->len > ring->slot_size) {
+            skipped++;
+            continue;
+        }
+        if (stored == k) break;
+
+        shm_slot_t *s = shm_slot(ring, first + stored);
+        s->len = (uint32_t)b->len;
+        s->ts = b->ts;
+        memcpy(s + 1, b->data, b->len);
+        stored++;
+    }
+
+    ad_tun_shm_stats_t *st = &ring->hdr->stats;
+    if (stored) {
+        shm_publish(ring, first, stored);
+        __atomic_fetch_add(&st->enqueued, stored, __ATOMIC_RELAXED);
+    }
+    if (skipped) __atomic_fetch_add(&st->oversize, skipped, __ATOMIC_RELAXED);
+    if (i < n) __atomic_fetch_add(&st->full, 1, __ATOMIC_RELAXED);
+    return i;
+}
+
+unsigned ad_tun_shm_dequeue(ad_tun_shm_ring_t *ring, ad_tun_pool_t *pool, ad_tun_buf_t **bufs, unsigned n)
+{
+    if (!ring || !ring->hdr || !pool || !bufs || n == 0) return 0;
+
+    unsigned got = ad_tun_pool_get_bulk(pool, bufs, n);
+    uint64_t first = 0;
+    unsigned k = got ? shm_claim_filled(ring, got, &first) : 0;
+
+    unsigned out = 0, skipped = 0;
+    for (unsigned i = 0; i < k; i++) {
+        const shm_slot_t *s = shm_slot(ring, first + i);
+        ad_tun_buf_t *b = bufs[out];
+        uint32_t len = s->len;
+
+        /* len comes from another process; never trust it past the slot or buffer */
+        if (len > ring->slot_size || len > ad_tun_buf_tailroom(b)) {
+            skipped++;
+            continue;
+        }
+        memcpy(b->data, s + 1, len);
+        b->len = len;
+        b->ts = s->ts;
+        out++;
+    }
+
+    if (k) {
+        shm_free_slots(ring, first, k);
+        __atomic_fetch_add(&ring->hdr->stats.dequeued, k - skipped, __ATOMIC_RELAXED);
+    }
+    if (skipped) __atomic_fetch_add(&ring->hdr->stats.oversize, skipped, __ATOMIC_RELAXED);
+    if (out < got) ad_tun_pool_put_bulk(pool, bufs + out, got - out);
+    return out;
+}
+
+unsigned ad_tun_shm_peek(ad_tun_shm_ring_t *ring, const unsigned char **pkts, uint32_t *lens, unsigned n)
+{
+    if (!ring || !ring->hdr || ring->mode != AD_TUN_SHM_SPSC || !pkts || !lens) return 0;
+
+    uint64_t first;
+    unsigned k = shm_claim_filled(ring, n, &first);
+    for (unsigned i = 0; i < k; i++) {
+        const shm_slot_t *s = shm_slot(ring, first + i);
+        pkts[i] = (const unsigned char*)(s + 1);
+        lens[i] = s->len <= ring->slot_size ? s->len : 0;
+    }
+    return k;
+}
+
+void ad_tun_shm_release(ad_tun_shm_ring_t *ring, unsigned n)
+{
+    if (!ring || !ring->hdr || ring->mode != AD_TUN_SHM_SPSC || n == 0) return;
+
+    uint64_t tail = ring->hdr->tail;
+    if (n > ring->cached_head - tail) n = (unsigned)(ring->cached_head - tail);
+    shm_free_slots(ring, tail, n);
+    __atomic_fetch_add(&ring->hdr->stats.dequeued, n, __ATOMIC_RELAXED);
+}
+
+unsigned ad_tun_shm_count(const ad_tun_shm_ring_t *ring)
+{
+    if (!ring || !ring->hdr) return 0;
+
+    uint64_t tail = __atomic_load_n(&ring->hdr->tail, __ATOMIC_ACQUIRE);
+    uint64_t head = __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE);
+    if (ring->mode == AD_TUN_SHM_SPSC) return (unsigned)(head - tail);
+
+    /* MPMC: head counts claimed slots; count only the filled ones from tail on */
+    unsigned n = 0;
+    while (tail + n < head && n <= ring->mask &&
+           __atomic_load_n(&shm_slot(ring, tail + n)->seq, __ATOMIC_ACQUIRE) == tail + n + 1) {
+        n++;
+    }
+    return n;
+}
+
+static int shm_has_room(const ad_tun_shm_ring_t *ring)
+{
+    uint64_t tail = __atomic_load_n(&ring->hdr->tail, __ATOMIC_ACQUIRE);
+    uint64_t head = __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE);
+    return head - tail <= ring->mask;
+}
+
+static int shm_readable(const void *ring)
+{
+    return ad_tun_shm_count(ring) > 0;
+}
+
+static int shm_writable(const void *ring)
+{
+    return shm_has_room(ring);
+}
+
+int ad_tun_shm_wait_readable(ad_tun_shm_ring_t *ring, int timeout_ms)
+{
+    if (!ring || !ring->hdr) return -EINVAL;
+    return ad_tun_evwait(&ring->hdr->readers_waiting, ring->data_fd, shm_readable, ring, timeout_ms);
+}
+
+int ad_tun_shm_wait_writable(ad_tun_shm_ring_t *ring, int timeout_ms)
+{
+    if (!ring || !ring->hdr) return -EINVAL;
+    return ad_tun_evwait(&ring->hdr->writers_waiting, ring->space_fd, shm_writable, ring, timeout_ms);
+}
+
+int ad_tun_shm_arm_readable(ad_tun_shm_ring_t *ring)
+{
+    if (!ring || !ring->hdr) return 0;
+
+    if (ad_tun_evwait_arm(&ring->hdr->readers_waiting, shm_readable, ring)) {
+        __atomic_fetch_sub(&ring->hdr->readers_waiting, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+    return 0;
+}
+
+void ad_tun_shm_disarm_readable(ad_tun_shm_ring_t *ring)
+{
+    if (!ring || !ring->hdr) return;
+
+    uint64_t v;
+    if (read(ring->data_fd, &v, sizeof(v)) < 0 && errno != EAGAIN) {
+        zlog_warn(zlog_get_category("ad_tun"), "ad_tun_shm_disarm_readable: read failed: %s", strerror(errno));
+    }
+    __atomic_fetch_sub(&ring->hdr->readers_waiting, 1, __ATOMIC_RELAXED);
+}
+
+void ad_tun_shm_get_stats(const ad_tun_shm_ring_t *ring, ad_tun_shm_stats_t *stats)
+{
+    if (!stats) return;
+    memset(stats, 0, sizeof(*stats));
+    if (!ring || !ring->hdr) return;
+
+    const ad_tun_shm_stats_t *s = &ring->hdr->stats;
+    stats->enqueued = __atomic_load_n(&s->enqueued, __ATOMIC_RELAXED);
+    stats->dequeued = __atomic_load_n(&s->dequeued, __ATOMIC_RELAXED);
+    stats->full = __atomic_load_n(&s->full, __ATOMIC_RELAXED);
+    stats->oversize = __atomic_load_n(&s->oversize, __ATOMIC_RELAXED);
+    stats->wakeups = __atomic_load_n(&s->wakeups, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,362 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Write Queue        **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+#include "../include/ad_tun_wq.h"
+#include "../include/ad_tun_latency.h"
+#include "../../prebuilt/zlog/include/zlog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* Defaults for ad_tun_wq_config_t */
+#define DEFAULT_WQ_CLASSES 3
+#define DEFAULT_WQ_LIMIT 128
+#define DEFAULT_WQ_QUANTUM 1500
+#define DEFAULT_WQ_HIGH_WM 256
+#define DEFAULT_WQ_LOW_WM 64
+#define DEFAULT_WQ_BUF_SIZE 9000
+
+/* Default writer */
+static ssize_t wq_write_tun(void *arg, const char *buf, size_t len)
+{
+    (void)arg;
+    return ad_tun_write(buf, len);
+}
+
+void ad_tun_wq_default_config(ad_tun_wq_config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->nclasses = DEFAULT_WQ_CLASSES;
+    cfg->sched = AD_TUN_WQ_STRICT;
+    for (unsigned i = 0; i < AD_TUN_WQ_MAX_CLASSES; i++) {
+        cfg->limit[i] = DEFAULT_WQ_LIMIT;
+        cfg->quantum[i] = DEFAULT_WQ_QUANTUM;
+    }
+    cfg->high_wm = DEFAULT_WQ_HIGH_WM;
+    cfg->low_wm = DEFAULT_WQ_LOW_WM;
+    cfg->buf_size = DEFAULT_WQ_BUF_SIZE;
+}
+
+ad_tun_error_t ad_tun_wq_init(ad_tun_wq_t *wq, const ad_tun_wq_config_t *cfg)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+
+    if (!wq) {
+        zlog_error(zc, "ad_tun_wq_init: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    memset(wq, 0, sizeof(*wq));
+    if (cfg) wq->cfg = *cfg;
+    else ad_tun_wq_default_config(&wq->cfg);
+    cfg = &wq->cfg;
+
+    if (cfg->nclasses == 0 || cfg->nclasses > AD_TUN_WQ_MAX_CLASSES || cfg->buf_size == 0 ||
+        (cfg->high_wm && cfg->low_wm > cfg->high_wm)) {
+        zlog_error(zc, "ad_tun_wq_init: invalid configuration");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    unsigned total = 0;
+    for (unsigned i = 0; i < cfg->nclasses; i++) {
+        if (cfg->limit[i] == 0 || (cfg->sched == AD_TUN_WQ_DRR && cfg->quantum[i] == 0)) {
+            zlog_error(zc, "ad_tun_wq_init: class %u needs a limit and a DRR quantum", i);
+            return AD_TUN_ERR_CONFIG;
+        }
+        total += cfg->limit[i];
+    }
+
+    if (!wq->cfg.write_fn) wq->cfg.write_fn = wq_write_tun;
+
+    /* The class limits bound the queue, so the pool never runs dry first */
+    ad_tun_error_t err = ad_tun_pool_init_numa(&wq->pool, total, cfg->buf_size, 0, cfg->mem);
+    if (err != AD_TUN_OK) return err;
+
+    pthread_mutex_init(&wq->lock, NULL);
+    wq->epfd = -1;
+    wq->ep_fd = -1;
+
+    zlog_debug(zc, "Write queue initialized: classes=%u, sched=%s, capacity=%u, watermarks=%u/%u",
+               cfg->nclasses, cfg->sched == AD_TUN_WQ_DRR ? "drr" : "strict", total,
+               cfg->high_wm, cfg->low_wm);
+
+    return AD_TUN_OK;
+}
+
+void ad_tun_wq_free(ad_tun_wq_t *wq)
+{
+    if (!wq || !wq->pool.bufs) return;
+
+    for (unsigned i = 0; i < wq->cfg.nclasses; i++) {
+        ad_tun_pool_put_chain(&wq->pool, wq->classes[i].head);
+    }
+
+    ad_tun_pool_free(&wq->pool);
+    pthread_mutex_destroy(&wq->lock);
+    memset(wq, 0, sizeof(*wq));
+}
+
+ad_tun_error_t ad_tun_wq_attach_epoll(ad_tun_wq_t *wq, int epfd, int fd,
+                                      const struct epoll_event *ev)
+{
+    if (!wq || epfd < 0 || fd < 0 || !ev) {
+        zlog_error(zlog_get_category("ad_tun"), "ad_tun_wq_attach_epoll: invalid arguments");
+        return AD_TUN_ERR_CONFIG;
+    }
+
+    pthread_mutex_lock(&wq->lock);
+    wq->epfd = epfd;
+    wq->ep_fd = fd;
+    wq->ep_ev = *ev;
+    wq->ep_ev.events &= ~(uint32_t)EPOLLOUT;
+    wq->ep_armed = 0;
+    pthread_mutex_unlock(&wq->lock);
+
+    return AD_TUN_OK;
+}
+
+/* Request or cancel EPOLLOUT; called with the lock held */
+static void wq_set_epollout(ad_tun_wq_t *wq, int on)
+{
+    if (wq->epfd < 0 || wq->ep_armed == on) return;
+
+    struct epoll_event ev = wq->ep_ev;
+    if (on) ev.events |= EPOLLOUT;
+
+    if (epoll_ctl(wq->epfd, EPOLL_CTL_MOD, wq->ep_fd, &ev) < 0) {
+        zlog_error(zlog_get_category("ad_tun"), "ad_tun_wq: epoll_ctl(MOD) failed: %s",
+                   strerror(errno));
+        return;
+    }
+    wq->ep_armed = on;
+}
+
+/* Watermark transitions; called with the lock held after total changed */
+static void wq_check_pressure(ad_tun_wq_t *wq)
+{
+    if (!wq->pressure && wq->cfg.high_wm && wq->total >= wq->cfg.high_wm) {
+        wq->pressure = 1;
+        wq->stats.pressure_on++;
+        if (wq->cfg.on_pressure) wq->cfg.on_pressure(wq->cfg.pressure_arg, 1);
+    } else if (wq->pressure && wq->total <= wq->cfg.low_wm) {
+        wq->pressure = 0;
+        if (wq->cfg.on_pressure) wq->cfg.on_pressure(wq->cfg.pressure_arg, 0);
+    }
+}
+
+ssize_t ad_tun_wq_enqueue(ad_tun_wq_t *wq, unsigned cls, const char *buf, size_t len)
+{
+    if (!wq || !buf || len == 0 || cls >= wq->cfg.nclasses) return -EINVAL;
+    if (len > wq->cfg.buf_size) return -EMSGSIZE;
+
+    pthread_mutex_lock(&wq->lock);
+
+    ad_tun_wq_class_t *c = &wq->classes[cls];
+    if (c->count >= wq->cfg.limit[cls]) {
+        wq->stats.rejected++;
+        pthread_mutex_unlock(&wq->lock);
+        return -ENOBUFS;
+    }
+
+    /* Slots are reserved under the lock so the copy can run without it */
+    c->count++;
+    wq->total++;
+    pthread_mutex_unlock(&wq->lock);
+
+    ad_tun_buf_t *b = ad_tun_pool_get(&wq->pool);
+    memcpy(b->data, buf, len);
+    b->len = len;
+    b->next = NULL;
+    AD_TUN_LAT_STAMP(b);
+
+    pthread_mutex_lock(&wq->lock);
+    if (c->tail) c->tail->next = b;
+    else c->head = b;
+    c->tail = b;
+    wq->nonempty |= 1u << cls;
+    wq->stats.enqueued++;
+    wq_check_pressure(wq);
+    pthread_mutex_unlock(&wq->lock);
+
+    return (ssize_t)len;
+}
+
+/*
+ * Pick the class to serve next; called with the lock held and at least one
+ * packet linked in. Returns -1 if only reserved (not yet linked) slots remain.
+ */
+static int wq_pick(ad_tun_wq_t *wq)
+{
+    if (!wq->nonempty) return -1;
+
+    if (wq->cfg.sched == AD_TUN_WQ_STRICT) return __builtin_ctz(wq->nonempty);
+
+    for (;;) {
+        unsigned cur = wq->drr_cur;
+        ad_tun_wq_class_t *c = &wq->classes[cur];
+
+        if (c->head) {
+            if (c->deficit >= (int32_t)c->head->len) return (int)cur;
+        } else {
+            c->deficit = 0;
+        }
+
+        wq->drr_cur = (cur + 1) % wq->cfg.nclasses;
+        ad_tun_wq_class_t *next = &wq->classes[wq->drr_cur];
+        if (next->head) next->deficit += (int32_t)wq->cfg.quantum[wq->drr_cur];
+    }
+}
+
+/* Unlink the head of class cls; called with the lock held */
+static ad_tun_buf_t *wq_pop(ad_tun_wq_t *wq, unsigned cls)
+{
+    ad_tun_wq_class_t *c = &wq->classes[cls];
+    ad_tun_buf_t *b = c->head;
+
+    c->head = b->next;
+    if (!c->head) {
+        c->tail = NULL;
+        wq->nonempty &= ~(1u << cls);
+    }
+    b->next = NULL;
+    if (wq->cfg.sched == AD_TUN_WQ_DRR) c->deficit -= (int32_t)b->len;
+    return b;
+}
+
+/* Put a packet the writer refused back at the head of its class; called with the lock held */
+static void wq_unpop(ad_tun_wq_t *wq, unsigned cls, ad_tun_buf_t *b)
+{
+    ad_tun_wq_class_t *c = &wq->classes[cls];
+
+    b->next = c->head;
+    c->head = b;
+    if (!c->tail) c->tail = b;
+    wq->nonempty |= 1u << cls;
+    if (wq->cfg.sched == AD_TUN_WQ_DRR) c->deficit += (int32_t)b->len;
+}
+
+/* Drain loop; the caller has set draining */
+static int wq_run(ad_tun_wq_t *wq)
+{
+    zlog_category_t *zc = zlog_get_category("ad_tun");
+    ad_tun_buf_t *done = NULL;
+    int done_cls = 0;
+    int sent = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&wq->lock);
+
+        /* Account for the packet written in the previous round */
+        if (done) {
+            wq->classes[done_cls].count--;
+            wq->total--;
+            wq_check_pressure(wq);
+        }
+
+        int cls = wq_pick(wq);
+        if (cls < 0) {
+            wq->draining = 0;
+            if (wq->total == 0) wq_set_epollout(wq, 0);
+            pthread_mutex_unlock(&wq->lock);
+            break;
+        }
+        ad_tun_buf_t *b = wq_pop(wq, (unsigned)cls);
+        pthread_mutex_unlock(&wq->lock);
+
+        if (done) ad_tun_pool_put(&wq->pool, done);
+        done = NULL;
+
+        ssize_t n = wq->cfg.write_fn(wq->cfg.write_arg, (const char *)b->data, b->len);
+        if (n == -EAGAIN) {
+            pthread_mutex_lock(&wq->lock);
+            wq_unpop(wq, (unsigned)cls, b);
+            wq->blocked = 1;
+            wq->draining = 0;
+            wq->stats.blocked++;
+            wq_set_epollout(wq, 1);
+            pthread_mutex_unlock(&wq->lock);
+            return sent;
+        }
+
+        if (n < 0) {
+            zlog_warn(zc, "ad_tun_wq: dropping %zu byte packet of class %d: %s",
+                      b->len, cls, strerror((int)-n));
+            __atomic_fetch_add(&wq->stats.errors, 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_fetch_add(&wq->stats.sent, 1, __ATOMIC_RELAXED);
+            AD_TUN_LAT_SINCE(AD_TUN_LAT_WQ, b);
+            sent++;
+        }
+
+        done = b;
+        done_cls = cls;
+    }
+
+    if (done) ad_tun_pool_put(&wq->pool, done);
+    return sent;
+}
+
+int ad_tun_wq_drain(ad_tun_wq_t *wq)
+{
+    if (!wq) return -EINVAL;
+
+    pthread_mutex_lock(&wq->lock);
+    if (wq->draining) {
+        pthread_mutex_unlock(&wq->lock);
+        return 0;
+    }
+    wq->draining = 1;
+    wq->blocked = 0;
+    pthread_mutex_unlock(&wq->lock);
+
+    return wq_run(wq);
+}
+
+ssize_t ad_tun_wq_send(ad_tun_wq_t *wq, unsigned cls, const char *buf, size_t len)
+{
+    ssize_t r = ad_tun_wq_enqueue(wq, cls, buf, len);
+    if (r < 0) return r;
+
+    pthread_mutex_lock(&wq->lock);
+    if (wq->draining || wq->blocked) {
+        /* Whoever is draining, or the next EPOLLOUT, picks the packet up */
+        pthread_mutex_unlock(&wq->lock);
+        return r;
+    }
+    wq->draining = 1;
+    pthread_mutex_unlock(&wq->lock);
+
+    wq_run(wq);
+    return r;
+}
+
+unsigned ad_tun_wq_count(ad_tun_wq_t *wq, int cls)
+{
+    if (!wq || cls >= (int)wq->cfg.nclasses) return 0;
+
+    pthread_mutex_lock(&wq->lock);
+    unsigned n = (cls < 0) ? wq->total : wq->classes[cls].count;
+    pthread_mutex_unlock(&wq->lock);
+    return n;
+}
+
+int ad_tun_wq_blocked(ad_tun_wq_t *wq)
+{
+    pthread_mutex_lock(&wq->lock);
+    int b = wq->blocked;
+    pthread_mutex_unlock(&wq->lock);
+    return b;
+}
+
+int ad_tun_wq_pressure(ad_tun_wq_t *wq)
+{
+    pthread_mutex_lock(&wq->lock);
+    int p = wq->pressure;
+    pthread_mutex_unlock(&wq->lock);
+    return p;
+}
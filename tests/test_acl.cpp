@@ -0,0 +1,281 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "ad_tun_acl.h"
+#include "ad_tun_pool.h"
+}
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+static ad_tun_pkt_info_t make_info4(const char *src, const char *dst, uint8_t proto,
+                                    uint16_t sport, uint16_t dport) {
+    ad_tun_pkt_info_t i;
+    memset(&i, 0, sizeof(i));
+    i.family = AF_INET;
+    i.proto = proto;
+    inet_pton(AF_INET, src, i.src);
+    inet_pton(AF_INET, dst, i.dst);
+    i.sport = sport;
+    i.dport = dport;
+    return i;
+}
+
+/* First-match evaluation the compiled set must agree with */
+static bool prefix_match(const uint8_t *a, const uint8_t *p, unsigned plen) {
+    for (unsigned b = 0; b < plen; b++) {
+        if (((a[b / 8] ^ p[b / 8]) >> (7 - b % 8)) & 1) return false;
+    }
+    return true;
+}
+
+static int32_t linear_match(const ad_tun_acl_rules_t *rules, int dir, const ad_tun_pkt_info_t *i) {
+    for (unsigned r = 0; r < rules->count; r++) {
+        const ad_tun_acl_rule_t *x = &rules->rules[r];
+        if (!(x->dirs & (1u << dir))) continue;
+        if (x->family && x->family != i->family) continue;
+        if (x->proto && x->proto != i->proto) continue;
+        if (!prefix_match(i->src, x->src, x->src_plen) || !prefix_match(i->dst, x->dst, x->dst_plen)) continue;
+        if (i->sport < x->sport_lo || i->sport > x->sport_hi) continue;
+        if (i->dport < x->dport_lo || i->dport > x->dport_hi) continue;
+        return (int32_t)r;
+    }
+    return AD_TUN_ACL_DEFAULT;
+}
+
+TEST(AclParseTest, ParsesRules) {
+    ad_tun_acl_rule_t r;
+
+    ASSERT_EQ(ad_tun_acl_parse_rule("drop rx udp from 10.1.2.3/16 to any dport 53", &r), 0);
+    EXPECT_EQ(r.action, AD_TUN_ACL_DROP);
+    EXPECT_EQ(r.dirs, 1u << AD_TUN_ACL_RX);
+    EXPECT_EQ(r.family, AF_INET);
+    EXPECT_EQ(r.proto, IPPROTO_UDP);
+    EXPECT_EQ(r.src_plen, 16);
+    unsigned char want[4] = { 10, 1, 0, 0 };
+    EXPECT_EQ(memcmp(r.src, want, 4), 0);
+    EXPECT_EQ(r.dst_plen, 0);
+    EXPECT_EQ(r.dport_lo, 53);
+    EXPECT_EQ(r.dport_hi, 53);
+    EXPECT_EQ(r.sport_lo, 0);
+    EXPECT_EQ(r.sport_hi, 65535);
+
+    ASSERT_EQ(ad_tun_acl_parse_rule("allow proto 47 to 2001:db8::/32 sport 1000-2000", &r), 0);
+    EXPECT_EQ(r.action, AD_TUN_ACL_ALLOW);
+    EXPECT_EQ(r.dirs, 3u);
+    EXPECT_EQ(r.family, AF_INET6);
+    EXPECT_EQ(r.proto, 47);
+    EXPECT_EQ(r.sport_lo, 1000);
+    EXPECT_EQ(r.sport_hi, 2000);
+
+    ASSERT_EQ(ad_tun_acl_parse_rule("allow", &r), 0);
+    EXPECT_EQ(r.family, 0);
+    EXPECT_EQ(r.proto, 0);
+}
+
+TEST(AclParseTest, RejectsBadRules) {
+    ad_tun_acl_rule_t r;
+    EXPECT_EQ(ad_tun_acl_parse_rule("", &r), -EINVAL);
+    EXPECT_EQ(ad_tun_acl_parse_rule("reject", &r), -EINVAL);
+    EXPECT_EQ(ad_tun_acl_parse_rule("drop from 10.0.0.0/8 to fd00::/8", &r), -EINVAL);
+    EXPECT_EQ(ad_tun_acl_parse_rule("drop dport 2000-1000", &r), -EINVAL);
+    EXPECT_EQ(ad_tun_acl_parse_rule("drop dport 70000", &r), -EINVAL);
+    EXPECT_EQ(ad_tun_acl_parse_rule("drop proto 256", &r), -EINVAL);
+    EXPECT_EQ(ad_tun_acl_parse_rule("drop from", &r), -EINVAL);
+    EXPECT_EQ(ad_tun_acl_parse_rule("drop via 10.0.0.1", &r), -EINVAL);
+    EXPECT_EQ(ad_tun_acl_parse_rule(nullptr, &r), -EINVAL);
+}
+
+TEST(AclTest, LoadsConfig) {
+    ad_tun_acl_rules_t rules;
+    ad_tun_acl_rules_init(&rules);
+    ASSERT_EQ(ad_tun_acl_load_config("../../test_configs/acl.ini", &rules), AD_TUN_OK);
+    EXPECT_EQ(rules.count, 4u);
+    EXPECT_EQ(rules.default_action[AD_TUN_ACL_RX], AD_TUN_ACL_DROP);
+    EXPECT_EQ(rules.default_action[AD_TUN_ACL_TX], AD_TUN_ACL_ALLOW);
+    EXPECT_EQ(rules.rules[1].dirs, 1u << AD_TUN_ACL_TX);
+    ad_tun_acl_rules_free(&rules);
+
+    ad_tun_acl_rules_init(&rules);
+    EXPECT_EQ(ad_tun_acl_load_config("../../test_configs/acl_bad.ini", &rules), AD_TUN_ERR_CONFIG);
+    EXPECT_EQ(ad_tun_acl_load_config("../../test_configs/nonexistent.ini", &rules), AD_TUN_ERR_CONFIG);
+    ad_tun_acl_rules_free(&rules);
+}
+
+TEST(AclTest, FirstMatchWinsAcrossTuples) {
+    ad_tun_acl_t acl;
+    ASSERT_EQ(ad_tun_acl_init(&acl), AD_TUN_OK);
+    ASSERT_EQ(ad_tun_acl_reload(&acl, "../../test_configs/acl.ini"), AD_TUN_OK);
+
+    ad_tun_pkt_info_t pkts[] = {
+        make_info4("10.81.0.9", "10.81.0.2", IPPROTO_UDP, 5000, 53),     /* rule 0 */
+        make_info4("10.81.0.9", "10.81.0.2", IPPROTO_UDP, 5000, 54),     /* default rx: drop */
+        make_info4("192.168.1.1", "10.81.0.2", IPPROTO_TCP, 80, 8080),   /* rule 2 (rule 1 is tx) */
+        make_info4("10.9.9.9", "10.81.0.2", IPPROTO_TCP, 80, 1023),      /* default rx: drop */
+    };
+    uint8_t v[4];
+    int32_t r[4];
+    EXPECT_EQ(ad_tun_acl_classify(&acl, AD_TUN_ACL_RX, pkts, 4, v, r), 2u);
+    EXPECT_EQ(r[0], 0);
+    EXPECT_EQ(r[1], AD_TUN_ACL_DEFAULT);
+    EXPECT_EQ(r[2], 2);
+    EXPECT_EQ(r[3], AD_TUN_ACL_DEFAULT);
+    EXPECT_EQ(v[1], AD_TUN_ACL_DROP);
+
+    /* Transmit: rule 1 comes before rule 2, and the default allows */
+    EXPECT_EQ(ad_tun_acl_classify(&acl, AD_TUN_ACL_TX, pkts, 4, v, r), 3u);
+    EXPECT_EQ(r[0], AD_TUN_ACL_DEFAULT);
+    EXPECT_EQ(r[2], 1);
+    EXPECT_EQ(v[2], AD_TUN_ACL_DROP);
+
+    uint64_t hits[8];
+    ASSERT_EQ(ad_tun_acl_hits(&acl, hits, 8), 4u);
+    EXPECT_EQ(hits[0], 1u);
+    EXPECT_EQ(hits[1], 1u);
+    EXPECT_EQ(hits[2], 1u);
+    EXPECT_EQ(hits[3], 0u);
+
+    ad_tun_acl_stats_t st;
+    ad_tun_acl_get_stats(&acl, &st);
+    EXPECT_EQ(st.rules, 4u);
+    EXPECT_EQ(st.packets[AD_TUN_ACL_RX], 4u);
+    EXPECT_EQ(st.dropped[AD_TUN_ACL_RX], 2u);
+    EXPECT_EQ(st.defaults[AD_TUN_ACL_TX], 3u);
+
+    /* A failed reload keeps the old set */
+    EXPECT_EQ(ad_tun_acl_reload(&acl, "../../test_configs/acl_bad.ini"), AD_TUN_ERR_CONFIG);
+    EXPECT_EQ(ad_tun_acl_hits(&acl, nullptr, 0), 4u);
+
+    ad_tun_acl_free(&acl);
+}
+
+/* Many random rules with ranges and mixed families must agree with a linear scan */
+TEST(AclTest, MatchesLinearScan) {
+    std::mt19937 rng(42);
+    ad_tun_acl_rules_t rules;
+    ad_tun_acl_rules_init(&rules);
+    rules.default_action[AD_TUN_ACL_TX] = AD_TUN_ACL_DROP;
+
+    const uint8_t protos[] = { 0, IPPROTO_TCP, IPPROTO_UDP };
+    for (int n = 0; n < 3000; n++) {
+        ad_tun_acl_rule_t r;
+        memset(&r, 0, sizeof(r));
+        r.action = rng() % 2;
+        r.dirs = 1 + rng() % 3;
+        r.family = (rng() % 4 == 0) ? AF_INET6 : AF_INET;
+        r.proto = protos[rng() % 3];
+        unsigned max = r.family == AF_INET ? 32 : 128;
+        r.src_plen = (uint8_t)(rng() % 3 == 0 ? 0 : 8 + rng() % (max - 7));
+        r.dst_plen = (uint8_t)(rng() % 2 == 0 ? 0 : 8 + rng() % (max - 7));
+        /* Small address space so random packets hit */
+        r.src[0] = r.dst[0] = 10;
+        r.src[1] = (uint8_t)(rng() % 4);
+        r.dst[1] = (uint8_t)(rng() % 4);
+        for (unsigned i = 0; i < 16; i++) {
+            unsigned keep = (r.src_plen >= (i + 1) * 8) ? 8 : (r.src_plen > i * 8 ? r.src_plen - i * 8 : 0);
+            r.src[i] &= (uint8_t)(0xff00 >> keep);
+            keep = (r.dst_plen >= (i + 1) * 8) ? 8 : (r.dst_plen > i * 8 ? r.dst_plen - i * 8 : 0);
+            r.dst[i] &= (uint8_t)(0xff00 >> keep);
+        }
+        r.sport_hi = 65535;
+        r.dport_lo = (uint16_t)(rng() % 2000);
+        r.dport_hi = (uint16_t)(r.dport_lo + (rng() % 3 == 0 ? 0 : rng() % 3000));
+        ASSERT_EQ(ad_tun_acl_rules_add(&rules, &r), 0);
+    }
+
+    ad_tun_acl_t acl;
+    ASSERT_EQ(ad_tun_acl_init(&acl), AD_TUN_OK);
+    ASSERT_EQ(ad_tun_acl_compile(&acl, &rules), AD_TUN_OK);
+
+    std::vector<ad_tun_pkt_info_t> pkts(1000);
+    for (auto &p : pkts) {
+        memset(&p, 0, sizeof(p));
+        p.family = (rng() % 4 == 0) ? AF_INET6 : AF_INET;
+        p.proto = protos[1 + rng() % 2];
+        p.src[0] = p.dst[0] = 10;
+        p.src[1] = (uint8_t)(rng() % 4);
+        p.dst[1] = (uint8_t)(rng() % 4);
+        p.src[2] = (uint8_t)rng();
+        p.dst[3] = (uint8_t)rng();
+        p.sport = (uint16_t)rng();
+        p.dport = (uint16_t)(rng() % 5000);
+    }
+
+    for (int dir = 0; dir < 2; dir++) {
+        std::vector<uint8_t> v(pkts.size());
+        std::vector<int32_t> r(pkts.size());
+        ad_tun_acl_classify(&acl, dir, pkts.data(), (unsigned)pkts.size(), v.data(), r.data());
+
+        unsigned matched = 0;
+        for (size_t i = 0; i < pkts.size(); i++) {
+            int32_t want = linear_match(&rules, dir, &pkts[i]);
+            ASSERT_EQ(r[i], want) << "packet " << i << " dir " << dir;
+            uint8_t action = want == AD_TUN_ACL_DEFAULT ? rules.default_action[dir] : rules.rules[want].action;
+            ASSERT_EQ(v[i], action);
+            matched += want != AD_TUN_ACL_DEFAULT;
+        }
+        EXPECT_GT(matched, 100u);
+    }
+
+    ad_tun_acl_free(&acl);
+    ad_tun_acl_rules_free(&rules);
+}
+
+TEST(AclTest, FiltersBuffersWhileReloading) {
+    ad_tun_pool_t pool;
+    ASSERT_EQ(ad_tun_pool_init(&pool, 64, 128, 0), AD_TUN_OK);
+    ad_tun_acl_t acl;
+    ASSERT_EQ(ad_tun_acl_init(&acl), AD_TUN_OK);
+
+    ad_tun_acl_rule_t drop53;
+    ASSERT_EQ(ad_tun_acl_parse_rule("drop udp dport 53", &drop53), 0);
+    ad_tun_acl_rules_t rules;
+    ad_tun_acl_rules_init(&rules);
+    ASSERT_EQ(ad_tun_acl_rules_add(&rules, &drop53), 0);
+
+    std::atomic<bool> stop{ false };
+    std::thread reloader([&] {
+        while (!stop.load()) EXPECT_EQ(ad_tun_acl_compile(&acl, &rules), AD_TUN_OK);
+    });
+
+    for (int round = 0; round < 200; round++) {
+        ad_tun_buf_t *b[16], *drops = nullptr;
+        ASSERT_EQ(ad_tun_pool_get_bulk(&pool, b, 16), 16u);
+        for (unsigned i = 0; i < 16; i++) {
+            unsigned char *p = b[i]->data;
+            memset(p, 0, 28);
+            p[0] = 0x45;
+            ad_tun_put_be16(p + 2, 28);
+            p[9] = IPPROTO_UDP;
+            ad_tun_put_be16(p + 22, i % 2 ? 53 : 80);
+            b[i]->len = 28;
+        }
+        b[15]->len = 4;     /* does not parse: default action */
+
+        /* Before the first compile everything passes */
+        unsigned kept = ad_tun_acl_filter(&acl, AD_TUN_ACL_RX, b, 16, &drops);
+        if (drops) {
+            ASSERT_EQ(kept, 9u);
+            for (unsigned i = 0; i < kept - 1; i++) EXPECT_EQ(b[i]->data[23], 80);
+        } else {
+            ASSERT_EQ(kept, 16u);
+        }
+        ad_tun_pool_put_chain(&pool, drops);
+        ad_tun_pool_put_bulk(&pool, b, kept);
+    }
+
+    stop = true;
+    reloader.join();
+    EXPECT_EQ(ad_tun_pool_available(&pool), 64u);
+
+    ad_tun_acl_free(&acl);
+    ad_tun_acl_rules_free(&rules);
+    ad_tun_pool_free(&pool);
+}
@@ -0,0 +1,265 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "ad_tun_capture.h"
+}
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Minimal IPv4/UDP packet; checksums are not needed by the filter */
+static std::vector<unsigned char> udp4(const char *src, const char *dst,
+                                       uint16_t sport, uint16_t dport, size_t payload = 32) {
+    std::vector<unsigned char> p(20 + 8 + payload, 0xab);
+    p[0] = 0x45;
+    p[1] = 0;
+    p[2] = (uint8_t)(p.size() >> 8);
+    p[3] = (uint8_t)p.size();
+    p[4] = p[5] = p[6] = p[7] = 0;
+    p[8] = 64;
+    p[9] = IPPROTO_UDP;
+    p[10] = p[11] = 0;
+    inet_pton(AF_INET, src, &p[12]);
+    inet_pton(AF_INET, dst, &p[16]);
+    p[20] = (uint8_t)(sport >> 8);
+    p[21] = (uint8_t)sport;
+    p[22] = (uint8_t)(dport >> 8);
+    p[23] = (uint8_t)dport;
+    p[24] = (uint8_t)((8 + payload) >> 8);
+    p[25] = (uint8_t)(8 + payload);
+    p[26] = p[27] = 0;
+    return p;
+}
+
+/* Wrap a packet in an Ethernet header with the given EtherType */
+static std::vector<unsigned char> eth(std::vector<unsigned char> p, uint16_t type = 0x0800) {
+    unsigned char h[14] = { 0x02, 0, 0, 0, 0, 0x02, 0x02, 0, 0, 0, 0, 0x01 };
+    h[12] = (uint8_t)(type >> 8);
+    h[13] = (uint8_t)type;
+    p.insert(p.begin(), h, h + sizeof(h));
+    return p;
+}
+
+static uint32_t rd32(const std::vector<unsigned char> &f, size_t off) {
+    uint32_t v;
+    memcpy(&v, &f[off], 4);
+    return v;
+}
+
+struct Epb {
+    uint32_t cap_len;
+    uint32_t orig_len;
+    uint32_t flags;
+};
+
+/* Walk a pcapng file and return its enhanced packet blocks */
+static std::vector<Epb> read_pcapng(const std::string &path, uint32_t *idb_snaplen,
+                                    uint32_t linktype = AD_TUN_CAPTURE_LINK_RAW) {
+    std::vector<unsigned char> f;
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) return {};
+    unsigned char tmp[4096];
+    size_t n;
+    while ((n = fread(tmp, 1, sizeof(tmp), fp)) > 0) f.insert(f.end(), tmp, tmp + n);
+    fclose(fp);
+
+    std::vector<Epb> out;
+    size_t off = 0;
+    while (off + 12 <= f.size()) {
+        uint32_t type = rd32(f, off);
+        uint32_t len = rd32(f, off + 4);
+        if (len < 12 || off + len > f.size() || rd32(f, off + len - 4) != len) {
+            ADD_FAILURE() << "corrupt block at " << off;
+            break;
+        }
+        if (type == 0x0A0D0D0A) {
+            EXPECT_EQ(0x1A2B3C4Du, rd32(f, off + 8));
+        } else if (type == 1) {
+            *idb_snaplen = rd32(f, off + 12);
+            EXPECT_EQ(linktype, rd32(f, off + 8) & 0xffff);
+        } else if (type == 6) {
+            Epb e;
+            e.cap_len = rd32(f, off + 20);
+            e.orig_len = rd32(f, off + 24);
+            size_t opt = off + 28 + ((e.cap_len + 3) & ~3u);
+            e.flags = (rd32(f, opt) & 0xffff) == 2 ? rd32(f, opt + 4) : 0;
+            out.push_back(e);
+        }
+        off += len;
+    }
+    return out;
+}
+
+class CaptureTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        char tmpl[] = "/tmp/ad_tun_capture_XXXXXX";
+        int fd = mkstemp(tmpl);
+        ASSERT_GE(fd, 0);
+        close(fd);
+        path = tmpl;
+
+        ad_tun_capture_default_config(&cfg);
+        cfg.path = path.c_str();
+        cfg.ifname = "adtun0";
+    }
+
+    void TearDown() override {
+        ad_tun_capture_stop();
+        unlink(path.c_str());
+    }
+
+    void offer(unsigned dir, const std::vector<unsigned char> &p) {
+        ad_tun_capture_hook(dir, p.data(), p.size());
+    }
+
+    std::string path;
+    ad_tun_capture_config_t cfg;
+};
+
+TEST(CaptureFilter, ParsesExpression) {
+    ad_tun_capture_filter_t f;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_capture_parse_filter(
+        "ip and udp and src net 10.0.0.0/8 and dst host 192.168.1.1 and port 53", &f));
+    EXPECT_EQ(AF_INET, f.family);
+    EXPECT_EQ(1, f.has_proto);
+    EXPECT_EQ(IPPROTO_UDP, f.proto);
+    EXPECT_EQ(8, f.src_plen);
+    EXPECT_EQ(10, f.src[0]);
+    EXPECT_EQ(32, f.dst_plen);
+    EXPECT_EQ(53, f.port);
+
+    ASSERT_EQ(AD_TUN_OK, ad_tun_capture_parse_filter("ip6 and host fd00::1 and dst port 443", &f));
+    EXPECT_EQ(AF_INET6, f.family);
+    EXPECT_EQ(128, f.host_plen);
+    EXPECT_EQ(443, f.dport);
+
+    ASSERT_EQ(AD_TUN_OK, ad_tun_capture_parse_filter("", &f));
+    EXPECT_EQ(0, f.family);
+
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_capture_parse_filter("port 70000", &f));
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_capture_parse_filter("net 10.0.0.1", &f));
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_capture_parse_filter("src", &f));
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_capture_parse_filter("vlan 3", &f));
+}
+
+TEST_F(CaptureTest, DisabledIsNoop) {
+    EXPECT_EQ(0, ad_tun_capture_active);
+    offer(AD_TUN_CAPTURE_RX, udp4("10.0.0.1", "10.0.0.2", 1000, 53));
+
+    ad_tun_capture_stats_t st;
+    ad_tun_capture_get_stats(&st);
+    EXPECT_EQ(0u, st.seen);
+    EXPECT_EQ(AD_TUN_ERR_INVALID_STATE, ad_tun_capture_enable(1));
+}
+
+TEST_F(CaptureTest, WritesPcapng) {
+    cfg.snaplen = 40;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_capture_start(&cfg));
+    EXPECT_EQ(AD_TUN_ERR_INVALID_STATE, ad_tun_capture_start(&cfg));
+
+    offer(AD_TUN_CAPTURE_RX, udp4("10.0.0.1", "10.0.0.2", 1000, 53, 100));
+    offer(AD_TUN_CAPTURE_TX, udp4("10.0.0.2", "10.0.0.1", 53, 1000, 4));
+    ad_tun_capture_stop();
+
+    uint32_t snaplen = 0;
+    std::vector<Epb> pkts = read_pcapng(path, &snaplen);
+    EXPECT_EQ(40u, snaplen);
+    ASSERT_EQ(2u, pkts.size());
+    EXPECT_EQ(40u, pkts[0].cap_len);
+    EXPECT_EQ(128u, pkts[0].orig_len);
+    EXPECT_EQ(2u, pkts[0].flags);   /* outbound */
+    EXPECT_EQ(32u, pkts[1].cap_len);
+    EXPECT_EQ(32u, pkts[1].orig_len);
+    EXPECT_EQ(1u, pkts[1].flags);   /* inbound */
+
+    ad_tun_capture_stats_t st;
+    ad_tun_capture_get_stats(&st);
+    EXPECT_EQ(2u, st.written);
+}
+
+TEST_F(CaptureTest, FilterAndDirection) {
+    cfg.directions = AD_TUN_CAPTURE_RX;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_capture_parse_filter("udp and dst port 53", &cfg.filter));
+    ASSERT_EQ(AD_TUN_OK, ad_tun_capture_start(&cfg));
+
+    offer(AD_TUN_CAPTURE_RX, udp4("10.0.0.1", "10.0.0.2", 1000, 53));
+    offer(AD_TUN_CAPTURE_RX, udp4("10.0.0.1", "10.0.0.2", 1000, 54));
+    offer(AD_TUN_CAPTURE_TX, udp4("10.0.0.1", "10.0.0.2", 1000, 53));
+    std::vector<unsigned char> junk(10, 0);
+    offer(AD_TUN_CAPTURE_RX, junk);
+    ad_tun_capture_stop();
+
+    ad_tun_capture_stats_t st;
+    ad_tun_capture_get_stats(&st);
+    EXPECT_EQ(4u, st.seen);
+    EXPECT_EQ(3u, st.filtered);
+    EXPECT_EQ(1u, st.written);
+}
+
+TEST_F(CaptureTest, EthernetFrames) {
+    cfg.linktype = AD_TUN_CAPTURE_LINK_ETHERNET;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_capture_parse_filter("udp and dst port 53", &cfg.filter));
+    ASSERT_EQ(AD_TUN_OK, ad_tun_capture_start(&cfg));
+
+    offer(AD_TUN_CAPTURE_RX, eth(udp4("10.0.0.1", "10.0.0.2", 1000, 53)));
+    offer(AD_TUN_CAPTURE_RX, eth(udp4("10.0.0.1", "10.0.0.2", 1000, 54)));
+    offer(AD_TUN_CAPTURE_RX, eth(std::vector<unsigned char>(28, 0), 0x0806));   /* ARP */
+    ad_tun_capture_stop();
+
+    ad_tun_capture_stats_t st;
+    ad_tun_capture_get_stats(&st);
+    EXPECT_EQ(2u, st.filtered);
+    EXPECT_EQ(1u, st.written);
+
+    uint32_t snaplen = 0;
+    std::vector<Epb> pkts = read_pcapng(path, &snaplen, AD_TUN_CAPTURE_LINK_ETHERNET);
+    ASSERT_EQ(1u, pkts.size());
+    EXPECT_EQ(14u + 60u, pkts[0].orig_len);
+
+    cfg.linktype = 113;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_capture_start(&cfg));
+}
+
+TEST_F(CaptureTest, SamplingAndPause) {
+    cfg.sample = 4;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_capture_start(&cfg));
+
+    auto p = udp4("10.0.0.1", "10.0.0.2", 1000, 53);
+    for (int i = 0; i < 40; i++) offer(AD_TUN_CAPTURE_RX, p);
+
+    ASSERT_EQ(AD_TUN_OK, ad_tun_capture_enable(0));
+    EXPECT_EQ(0, ad_tun_capture_active);
+    for (int i = 0; i < 40; i++) offer(AD_TUN_CAPTURE_RX, p);
+    ASSERT_EQ(AD_TUN_OK, ad_tun_capture_enable(1));
+    ad_tun_capture_stop();
+
+    ad_tun_capture_stats_t st;
+    ad_tun_capture_get_stats(&st);
+    EXPECT_EQ(40u, st.seen);
+    EXPECT_EQ(30u, st.sampled_out);
+    EXPECT_EQ(10u, st.written);
+}
+
+TEST_F(CaptureTest, FullRingDrops) {
+    cfg.slots = 4;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_capture_start(&cfg));
+
+    auto p = udp4("10.0.0.1", "10.0.0.2", 1000, 53);
+    for (int i = 0; i < 10000; i++) offer(AD_TUN_CAPTURE_RX, p);
+    ad_tun_capture_stop();
+
+    ad_tun_capture_stats_t st;
+    ad_tun_capture_get_stats(&st);
+    EXPECT_EQ(10000u, st.written + st.dropped);
+
+    uint32_t snaplen = 0;
+    EXPECT_EQ(st.written, read_pcapng(path, &snaplen).size());
+}
@@ -1,5 +1,9 @@
 #include <gtest/gtest.h>
 
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
 extern "C" {
 #include "ad_tun.h"
 }
@@ -144,4 +148,153 @@ TEST(ConfigTest, DuplicateIfnameUsesLast) {
     EXPECT_STREQ(cfg.ipv4, "10.10.1.2/24");
 
     ad_tun_free_config(&cfg);
-}
\ No newline at end of file
+}
+
+TEST(ConfigTest, FragmentationKeysParsed) {
+    ad_tun_config_t cfg;
+
+    ASSERT_EQ(AD_TUN_OK,
+              ad_tun_load_config("../../test_configs/fragment.ini", &cfg));
+
+    EXPECT_EQ(cfg.mtu, 1400);
+    EXPECT_EQ(cfg.fragment, 1);
+    EXPECT_EQ(cfg.reassemble, 1);
+
+    ad_tun_free_config(&cfg);
+}
+
+TEST(ConfigTest, FragmentationDisabledByDefault) {
+    ad_tun_config_t cfg;
+
+    ASSERT_EQ(AD_TUN_OK, ad_tun_load_config("../../test_configs/good.ini", &cfg));
+
+    EXPECT_EQ(cfg.fragment, 0);
+    EXPECT_EQ(cfg.reassemble, 0);
+
+    ad_tun_free_config(&cfg);
+}
+
+TEST(ConfigTest, OffloadKeyParsed) {
+    ad_tun_config_t cfg;
+
+    ASSERT_EQ(AD_TUN_OK, ad_tun_load_config("../../test_configs/offload.ini", &cfg));
+
+    EXPECT_EQ(cfg.offload, 1);
+
+    ad_tun_free_config(&cfg);
+}
+
+TEST(ConfigTest, TapModeParsed) {
+    ad_tun_config_t cfg;
+
+    ASSERT_EQ(AD_TUN_OK, ad_tun_load_config("../../test_configs/tap.ini", &cfg));
+
+    EXPECT_EQ(cfg.mode, AD_TUN_MODE_TAP);
+    EXPECT_STREQ(cfg.mac, "02:ad:00:00:10:02");
+    EXPECT_EQ(cfg.fragment, 0);   // not supported on frames
+
+    ad_tun_free_config(&cfg);
+
+    ASSERT_EQ(AD_TUN_OK, ad_tun_load_config("../../test_configs/good.ini", &cfg));
+    EXPECT_EQ(cfg.mode, AD_TUN_MODE_TUN);
+    EXPECT_EQ(cfg.mac, (const char*)NULL);
+    ad_tun_free_config(&cfg);
+}
+
+TEST(ConfigTest, MulticastMacFails) {
+    ad_tun_config_t cfg;
+
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_load_config("../../test_configs/tap_bad_mac.ini", &cfg));
+}
+
+TEST(ConfigSetTest, SectionsInheritDefaults) {
+    ad_tun_config_set_t set;
+
+    ASSERT_EQ(AD_TUN_OK, ad_tun_load_config_set("../../test_configs/multi.ini", &set));
+    ASSERT_EQ(set.count, 2u);
+
+    /* Repeated section continues the same tunnel; [defaults] may come later */
+    EXPECT_STREQ(set.tuns[0].ifname, "cust1");
+    EXPECT_STREQ(set.tuns[0].ipv4, "10.20.1.1/24");
+    EXPECT_STREQ(set.tuns[0].ipv6, "fd20:1::1/64");
+    EXPECT_EQ(set.tuns[0].mtu, 1420);
+    EXPECT_EQ(set.tuns[0].offload, 1);
+    EXPECT_EQ(set.tuns[0].fragment, 1);
+    EXPECT_EQ(set.tuns[0].queues, 4);
+
+    EXPECT_STREQ(set.tuns[1].ifname, "ad_cust2");
+    EXPECT_EQ(set.tuns[1].ipv6, (const char*)NULL);
+    EXPECT_EQ(set.tuns[1].mtu, 1400);
+    EXPECT_EQ(set.tuns[1].persist, 0);   // invalid, DEFAULT_PERSIST
+    EXPECT_EQ(set.tuns[1].fragment, 0);
+    EXPECT_EQ(set.tuns[1].queues, 1);     // out of range, DEFAULT_QUEUES
+
+    ad_tun_free_config_set(&set);
+    EXPECT_EQ(set.tuns, (ad_tun_config_t*)NULL);
+}
+
+TEST(ConfigSetTest, TapModeInheritedMacNot) {
+    ad_tun_config_set_t set;
+
+    ASSERT_EQ(AD_TUN_OK, ad_tun_load_config_set("../../test_configs/tap_multi.ini", &set));
+    ASSERT_EQ(set.count, 3u);
+
+    EXPECT_EQ(set.tuns[0].mode, AD_TUN_MODE_TAP);
+    EXPECT_STREQ(set.tuns[0].mac, "02:ad:00:00:30:01");
+    EXPECT_EQ(set.tuns[1].mode, AD_TUN_MODE_TAP);
+    EXPECT_EQ(set.tuns[1].mac, (const char*)NULL);
+    EXPECT_EQ(set.tuns[2].mode, AD_TUN_MODE_TUN);
+
+    ad_tun_free_config_set(&set);
+}
+
+TEST(ConfigSetTest, PlainSectionIsOneTunnel) {
+    ad_tun_config_set_t set;
+
+    ASSERT_EQ(AD_TUN_OK, ad_tun_load_config_set("../../test_configs/good.ini", &set));
+    ASSERT_EQ(set.count, 1u);
+    EXPECT_STREQ(set.tuns[0].ifname, "ad_tun0");
+    EXPECT_EQ(set.tuns[0].mtu, 2400);
+
+    ad_tun_free_config_set(&set);
+}
+
+TEST(ConfigSetTest, MissingIpv4Fails) {
+    ad_tun_config_set_t set;
+
+    EXPECT_EQ(AD_TUN_ERR_CONFIG,
+              ad_tun_load_config_set("../../test_configs/multi_missing_ipv4.ini", &set));
+}
+
+TEST(ConfigSetTest, NoTunnelSectionFails) {
+    ad_tun_config_set_t set;
+
+    EXPECT_EQ(AD_TUN_ERR_CONFIG,
+              ad_tun_load_config_set("../../test_configs/wrong_section.ini", &set));
+    EXPECT_EQ(AD_TUN_ERR_CONFIG,
+              ad_tun_load_config_set("../../test_configs/this_file_does_not_exist.ini", &set));
+}
+
+TEST(ConfigSetTest, LoadsManyTunnels) {
+    char path[] = "/tmp/ad_tun_cfgset_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    FILE *f = fdopen(fd, "w");
+    ASSERT_NE(f, nullptr);
+
+    const unsigned n = 20000;
+    fprintf(f, "[defaults]\nmtu = 1420\n\n");
+    for (unsigned i = 0; i < n; i++) {
+        fprintf(f, "[tun:t%u]\nipv4 = 100.%u.%u.1/30\n\n", i, 64 + (i >> 14), (i >> 6) & 0xff);
+    }
+    fclose(f);
+
+    ad_tun_config_set_t set;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_load_config_set(path, &set));
+    ASSERT_EQ(set.count, n);
+    EXPECT_STREQ(set.tuns[12345].ifname, "t12345");
+    EXPECT_EQ(set.tuns[n - 1].mtu, 1420);
+
+    ad_tun_free_config_set(&set);
+    unlink(path);
+}
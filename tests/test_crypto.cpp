@@ -0,0 +1,171 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "ad_tun_crypto.h"
+#include "ad_tun_pool.h"
+#include "ad_tun_pkt.h"
+}
+
+static const uint8_t kKeyA[32] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+                                  17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32};
+static const uint8_t kKeyB[32] = {32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                  16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
+
+/* Two endpoints: alice's peer slot 1 talks to bob's peer slot 2 */
+class CryptoTest : public ::testing::TestWithParam<ad_tun_aead_t> {
+protected:
+    void SetUp() override {
+        ASSERT_EQ(AD_TUN_OK, ad_tun_pool_init(&pool, 64, 1500 + AD_TUN_CRYPTO_TAG_LEN,
+                                              AD_TUN_CRYPTO_HDR_LEN));
+        ASSERT_EQ(AD_TUN_OK, ad_tun_crypto_init(&alice, 4));
+        ASSERT_EQ(AD_TUN_OK, ad_tun_crypto_init(&bob, 4));
+        ASSERT_EQ(AD_TUN_OK, ad_tun_crypto_set_peer(&alice, 1, 2, GetParam(), kKeyA, kKeyB));
+        ASSERT_EQ(AD_TUN_OK, ad_tun_crypto_set_peer(&bob, 2, 1, GetParam(), kKeyB, kKeyA));
+    }
+
+    void TearDown() override {
+        ad_tun_crypto_free(&alice);
+        ad_tun_crypto_free(&bob);
+        EXPECT_EQ(pool.count, ad_tun_pool_available(&pool));
+        ad_tun_pool_free(&pool);
+    }
+
+    void fill(std::vector<ad_tun_buf_t*> &bufs) {
+        ASSERT_EQ(bufs.size(), ad_tun_pool_get_bulk(&pool, bufs.data(), (unsigned)bufs.size()));
+        for (size_t i = 0; i < bufs.size(); i++) {
+            bufs[i]->len = 20 + i * 40;
+            for (size_t j = 0; j < bufs[i]->len; j++) bufs[i]->data[j] = (unsigned char)(i + j);
+        }
+    }
+
+    ad_tun_pool_t pool;
+    ad_tun_crypto_t alice;
+    ad_tun_crypto_t bob;
+};
+
+TEST_P(CryptoTest, BatchRoundTrip) {
+    std::vector<ad_tun_buf_t*> bufs(32);
+    fill(bufs);
+    std::vector<std::string> plain;
+    for (auto *b : bufs) plain.emplace_back((const char *)b->data, b->len);
+
+    ASSERT_EQ(32, ad_tun_crypto_encrypt_batch(&alice, 1, bufs.data(), 32));
+    for (size_t i = 0; i < bufs.size(); i++) {
+        ASSERT_EQ(plain[i].size() + AD_TUN_CRYPTO_OVERHEAD, bufs[i]->len);
+        EXPECT_EQ(2u, ad_tun_get_be32(bufs[i]->data));
+        EXPECT_NE(0, memcmp(plain[i].data(), bufs[i]->data + AD_TUN_CRYPTO_HDR_LEN, plain[i].size()));
+    }
+
+    ASSERT_EQ(32, ad_tun_crypto_decrypt_batch(&bob, bufs.data(), 32));
+    for (size_t i = 0; i < bufs.size(); i++) {
+        ASSERT_EQ(plain[i].size(), bufs[i]->len);
+        EXPECT_EQ(0, memcmp(plain[i].data(), bufs[i]->data, bufs[i]->len));
+        EXPECT_EQ(0u, ad_tun_buf_headroom(bufs[i]) - AD_TUN_CRYPTO_HDR_LEN);
+    }
+    EXPECT_EQ(32u, bob.stats.decrypted);
+
+    ad_tun_pool_put_bulk(&pool, bufs.data(), 32);
+}
+
+TEST_P(CryptoTest, TamperedAndReplayedPacketsRejected) {
+    std::vector<ad_tun_buf_t*> bufs(4);
+    fill(bufs);
+    ASSERT_EQ(4, ad_tun_crypto_encrypt_batch(&alice, 1, bufs.data(), 4));
+
+    /* Keep a copy of packet 0 to replay later */
+    std::string saved((const char *)bufs[0]->data, bufs[0]->len);
+
+    bufs[1]->data[AD_TUN_CRYPTO_HDR_LEN] ^= 1;     /* flip a ciphertext bit */
+    bufs[2]->data[11] ^= 1;                         /* change the counter in the header */
+    ad_tun_buf_t *b3 = bufs[3];
+
+    ASSERT_EQ(2, ad_tun_crypto_decrypt_batch(&bob, bufs.data(), 4));
+    EXPECT_EQ(b3, bufs[1]);
+    EXPECT_EQ(2u, bob.stats.auth_failed);
+
+    /* Replay packet 0 */
+    ad_tun_buf_t *r = ad_tun_pool_get(&pool);
+    memcpy(r->data, saved.data(), saved.size());
+    r->len = saved.size();
+    EXPECT_EQ(0, ad_tun_crypto_decrypt_batch(&bob, &r, 1));
+    EXPECT_EQ(1u, bob.stats.replayed);
+
+    ad_tun_pool_put(&pool, r);
+    ad_tun_pool_put_bulk(&pool, bufs.data(), 4);
+}
+
+TEST_P(CryptoTest, LargeMixedBatchPartitionedInPlace) {
+    std::vector<ad_tun_buf_t*> bufs(64);
+    ASSERT_EQ(64u, ad_tun_pool_get_bulk(&pool, bufs.data(), 64));
+    for (size_t i = 0; i < bufs.size(); i++) {
+        bufs[i]->len = 20 + (i % 32) * 40;
+        memset(bufs[i]->data, (int)i, bufs[i]->len);
+    }
+    ASSERT_EQ(64, ad_tun_crypto_encrypt_batch(&alice, 1, bufs.data(), 64));
+
+    std::vector<ad_tun_buf_t*> orig = bufs;
+    std::vector<ad_tun_buf_t*> valid;
+    for (size_t i = 0; i < bufs.size(); i++) {
+        if (i % 3 == 1) bufs[i]->data[AD_TUN_CRYPTO_HDR_LEN] ^= 1;
+        else valid.push_back(bufs[i]);
+    }
+
+    ASSERT_EQ((int)valid.size(), ad_tun_crypto_decrypt_batch(&bob, bufs.data(), 64));
+    for (size_t i = 0; i < valid.size(); i++) EXPECT_EQ(valid[i], bufs[i]);
+
+    /* Every buffer is still there exactly once */
+    std::sort(bufs.begin(), bufs.end());
+    std::sort(orig.begin(), orig.end());
+    EXPECT_EQ(orig, bufs);
+
+    ad_tun_pool_put_bulk(&pool, bufs.data(), 64);
+}
+
+TEST_P(CryptoTest, UnknownPeerAndMissingHeadroom) {
+    std::vector<ad_tun_buf_t*> bufs(2);
+    fill(bufs);
+
+    EXPECT_EQ(-ENOENT, ad_tun_crypto_encrypt_batch(&alice, 3, bufs.data(), 2));
+
+    bufs[1]->data = bufs[1]->head;
+    EXPECT_EQ(-ENOSPC, ad_tun_crypto_encrypt_batch(&alice, 1, bufs.data(), 2));
+    bufs[1]->data = bufs[1]->head + AD_TUN_CRYPTO_HDR_LEN;
+
+    ASSERT_EQ(2, ad_tun_crypto_encrypt_batch(&alice, 1, bufs.data(), 2));
+    ad_tun_crypto_del_peer(&bob, 2);
+    EXPECT_EQ(0, ad_tun_crypto_decrypt_batch(&bob, bufs.data(), 2));
+    EXPECT_EQ(2u, bob.stats.unknown_peer);
+
+    ad_tun_pool_put_bulk(&pool, bufs.data(), 2);
+}
+
+INSTANTIATE_TEST_SUITE_P(Algorithms, CryptoTest,
+                         ::testing::Values(AD_TUN_AEAD_CHACHA20_POLY1305,
+                                           AD_TUN_AEAD_AES_128_GCM,
+                                           AD_TUN_AEAD_AES_256_GCM));
+
+TEST(ReplayTest, WindowSlides) {
+    ad_tun_replay_t r;
+    memset(&r, 0, sizeof(r));
+
+    EXPECT_TRUE(ad_tun_replay_check(&r, 0));
+    ad_tun_replay_update(&r, 0);
+    EXPECT_FALSE(ad_tun_replay_check(&r, 0));
+
+    /* Out of order within the window is fine, once */
+    ad_tun_replay_update(&r, 100);
+    EXPECT_TRUE(ad_tun_replay_check(&r, 50));
+    ad_tun_replay_update(&r, 50);
+    EXPECT_FALSE(ad_tun_replay_check(&r, 50));
+
+    /* A big jump forgets the old bits and rejects anything behind the window */
+    ad_tun_replay_update(&r, 100000);
+    EXPECT_FALSE(ad_tun_replay_check(&r, 100));
+    EXPECT_TRUE(ad_tun_replay_check(&r, 100000 - 100));
+    EXPECT_FALSE(ad_tun_replay_check(&r, 100000));
+    EXPECT_TRUE(ad_tun_replay_check(&r, 100001));
+}
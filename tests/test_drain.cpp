@@ -0,0 +1,219 @@
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+extern "C" {
+#include "ad_tun.h"
+}
+
+/* Starts test_drain0 on 10.203.0.2/24, or skips when no device can be made */
+class DrainTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ad_tun_config_t cfg = {};
+        cfg.ifname = "test_drain0";
+        cfg.ipv4 = "10.203.0.2/24";
+        cfg.mtu = 1500;
+        cfg.fragment = 1;
+
+        if (ad_tun_init(&cfg) != AD_TUN_OK) {
+            ad_tun_cleanup();
+            GTEST_SKIP() << "Skipping: ad_tun_init failed";
+        }
+        if (ad_tun_start() != AD_TUN_OK) {
+            ad_tun_cleanup();
+            GTEST_SKIP() << "Skipping: ad_tun_start failed (device may be unavailable)";
+        }
+    }
+
+    void TearDown() override {
+        if (ad_tun_get_state() == AD_TUN_STATE_RUNNING) ad_tun_stop();
+        ad_tun_cleanup();
+    }
+};
+
+/* Minimal IPv4 header towards a peer on the tunnel subnet */
+static void ip_pkt(char *p, size_t len) {
+    memset(p, 0, len);
+    p[0] = 0x45;
+    p[2] = (char)(len >> 8);
+    p[3] = (char)len;
+    p[8] = 64;
+    p[9] = 17;
+    p[12] = 10; p[13] = (char)203; p[15] = 2;
+    p[16] = 10; p[17] = (char)203; p[19] = 9;
+}
+
+struct FlushState {
+    int queued;
+    int calls;
+    ssize_t own_write;
+    ssize_t other_write;
+    ssize_t read;
+    ad_tun_state_t state;
+};
+
+/* Writes one queued packet per call, checking what other callers see meanwhile */
+static int flush_one(void *arg) {
+    FlushState *f = (FlushState *)arg;
+    f->calls++;
+    f->state = ad_tun_get_state();
+
+    char pkt[28];
+    ip_pkt(pkt, sizeof(pkt));
+    std::thread other([&] { f->other_write = ad_tun_write(pkt, sizeof(pkt)); });
+    other.join();
+
+    char buf[64];
+    f->read = ad_tun_read(buf, sizeof(buf));
+    if (f->queued > 0) {
+        f->own_write = ad_tun_write(pkt, sizeof(pkt));
+        f->queued--;
+    }
+    return f->queued;
+}
+
+static int flush_never(void *arg) {
+    (*(int *)arg)++;
+    return 1;
+}
+
+struct RxCount {
+    unsigned total;
+    unsigned udp_to_peer;
+};
+
+static void count_rx(void *arg, const char *buf, size_t len) {
+    RxCount *c = (RxCount *)arg;
+    c->total++;
+    if (len >= 20 && (buf[0] & 0xf0) == 0x40 && buf[9] == 17 &&
+        (unsigned char)buf[17] == 203 && buf[19] == 9) {
+        c->udp_to_peer++;
+    }
+}
+
+TEST(DrainStateTest, DrainWithoutStartFails) {
+    ad_tun_drain_result_t r;
+    EXPECT_EQ(AD_TUN_ERR_INVALID_STATE, ad_tun_stop_drain(NULL, &r));
+    EXPECT_EQ(AD_TUN_ERR_INVALID_STATE, ad_tun_restart_drain(NULL, &r));
+}
+
+TEST_F(DrainTest, FlushWritesGetThroughOthersRefused) {
+    FlushState f = {};
+    f.queued = 3;
+    ad_tun_drain_opts_t opts = {};
+    opts.timeout_ms = 5000;
+    opts.flush = flush_one;
+    opts.flush_arg = &f;
+
+    ad_tun_drain_result_t r;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_stop_drain(&opts, &r));
+
+    EXPECT_EQ(f.calls, 3);
+    EXPECT_EQ(f.state, AD_TUN_STATE_DRAINING);
+    EXPECT_EQ(f.own_write, 28);
+    EXPECT_EQ(f.other_write, -ESHUTDOWN);
+    EXPECT_EQ(f.read, -ESHUTDOWN);
+    EXPECT_EQ(r.flush_left, 0);
+    EXPECT_EQ(r.timed_out, 0);
+    EXPECT_EQ(r.inflight_at_timeout, 0u);
+    EXPECT_EQ(AD_TUN_STATE_STOPPED, ad_tun_get_state());
+
+    char buf[32];
+    EXPECT_EQ(-EIO, ad_tun_write(buf, sizeof(buf)));
+}
+
+TEST_F(DrainTest, KernelQueuedPacketsReadOut) {
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_GE(s, 0);
+    struct sockaddr_in to = {};
+    to.sin_family = AF_INET;
+    to.sin_port = htons(9);
+    inet_pton(AF_INET, "10.203.0.9", &to.sin_addr);
+
+    const unsigned sent = 20;
+    char payload[64] = "drain";
+    for (unsigned i = 0; i < sent; i++) {
+        ASSERT_EQ((ssize_t)sizeof(payload),
+                  sendto(s, payload, sizeof(payload), 0, (struct sockaddr *)&to, sizeof(to)));
+    }
+    close(s);
+
+    RxCount c = {};
+    ad_tun_drain_opts_t opts = {};
+    opts.timeout_ms = 5000;
+    opts.on_rx = count_rx;
+    opts.rx_arg = &c;
+
+    ad_tun_drain_result_t r;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_stop_drain(&opts, &r));
+    EXPECT_EQ(c.udp_to_peer, sent);
+    EXPECT_EQ(r.rx_drained, (uint64_t)c.total);
+    EXPECT_EQ(r.timed_out, 0);
+}
+
+TEST_F(DrainTest, TimeoutStillStops) {
+    int calls = 0;
+    ad_tun_drain_opts_t opts = {};
+    opts.timeout_ms = 50;
+    opts.flush = flush_never;
+    opts.flush_arg = &calls;
+
+    auto t0 = std::chrono::steady_clock::now();
+    ad_tun_drain_result_t r;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_stop_drain(&opts, &r));
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - t0).count();
+
+    EXPECT_EQ(r.timed_out, 1);
+    EXPECT_EQ(r.flush_left, 1);
+    EXPECT_GT(calls, 1);
+    EXPECT_GE(ms, 50);
+    EXPECT_LT(ms, 2000);
+    EXPECT_EQ(AD_TUN_STATE_STOPPED, ad_tun_get_state());
+}
+
+TEST_F(DrainTest, RestartDrainComesBackUp) {
+    ad_tun_drain_result_t r;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_restart_drain(NULL, &r));
+    EXPECT_EQ(AD_TUN_STATE_RUNNING, ad_tun_get_state());
+    EXPECT_EQ(r.timed_out, 0);
+
+    char pkt[28];
+    ip_pkt(pkt, sizeof(pkt));
+    EXPECT_EQ(28, ad_tun_write(pkt, sizeof(pkt)));
+}
+
+TEST_F(DrainTest, StopWaitsForWritesInFlight) {
+    /* Fragmented writes use the fragment pool that stop frees */
+    std::atomic<bool> go{true};
+    std::atomic<unsigned> written{0};
+    ssize_t last[2] = {0, 0};
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 2; t++) {
+        writers.emplace_back([&, t] {
+            char pkt[3000];
+            ip_pkt(pkt, sizeof(pkt));
+            while (go) {
+                last[t] = ad_tun_write(pkt, sizeof(pkt));
+                if (last[t] == -EIO || last[t] == -ESHUTDOWN) break;
+                written++;
+            }
+        });
+    }
+    while (written < 100) std::this_thread::yield();
+
+    ASSERT_EQ(AD_TUN_OK, ad_tun_stop());
+    EXPECT_EQ(AD_TUN_STATE_STOPPED, ad_tun_get_state());
+    go = false;
+    for (auto &w : writers) w.join();
+    for (ssize_t r : last) EXPECT_TRUE(r == -EIO || r == -ESHUTDOWN || r == 3000) << r;
+}
@@ -0,0 +1,303 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include "ad_tun.h"
+#include "ad_tun_eth.h"
+#include "ad_tun_mgr.h"
+#include "ad_tun_pkt.h"
+#include "ad_tun_pool.h"
+}
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const uint8_t kMacA[6] = { 0x02, 0, 0, 0, 0, 0x0a };
+static const uint8_t kMacB[6] = { 0x02, 0, 0, 0, 0, 0x0b };
+static const uint8_t kBcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+/* Ethernet frame with an optional 802.1Q tag and a zero payload */
+static std::vector<unsigned char> frame(const uint8_t *dst, const uint8_t *src, uint16_t type,
+                                        int vlan = -1, size_t payload = 46) {
+    std::vector<unsigned char> f;
+    f.insert(f.end(), dst, dst + 6);
+    f.insert(f.end(), src, src + 6);
+    if (vlan >= 0) {
+        f.push_back(0x81);
+        f.push_back(0x00);
+        f.push_back((uint8_t)(vlan >> 8));
+        f.push_back((uint8_t)vlan);
+    }
+    f.push_back((uint8_t)(type >> 8));
+    f.push_back((uint8_t)type);
+    f.resize(f.size() + payload, 0);
+    return f;
+}
+
+/* Hardware address of an interface, empty if unavailable */
+static std::vector<uint8_t> hwaddr(const char *ifname) {
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    int rc = ioctl(s, SIOCGIFHWADDR, &ifr);
+    close(s);
+    if (rc < 0) return {};
+    return std::vector<uint8_t>(ifr.ifr_hwaddr.sa_data, ifr.ifr_hwaddr.sa_data + 6);
+}
+
+TEST(EthTest, ParsesMac) {
+    uint8_t mac[6];
+    ASSERT_EQ(0, ad_tun_eth_parse_mac("02:Ad:00:11:22:ff", mac));
+    const uint8_t want[6] = { 0x02, 0xad, 0x00, 0x11, 0x22, 0xff };
+    EXPECT_EQ(0, memcmp(mac, want, 6));
+    EXPECT_EQ(0, ad_tun_eth_parse_mac("02-ad-00-11-22-ff", mac));
+
+    EXPECT_EQ(-EINVAL, ad_tun_eth_parse_mac("02:ad:00:11:22", mac));
+    EXPECT_EQ(-EINVAL, ad_tun_eth_parse_mac("02:ad:00:11:22:ff:00", mac));
+    EXPECT_EQ(-EINVAL, ad_tun_eth_parse_mac("02:ad:0:11:22:ff", mac));
+    EXPECT_EQ(-EINVAL, ad_tun_eth_parse_mac("01:00:5e:00:00:01", mac));   /* multicast */
+    EXPECT_EQ(-EINVAL, ad_tun_eth_parse_mac("00:00:00:00:00:00", mac));
+    EXPECT_EQ(-EINVAL, ad_tun_eth_parse_mac(nullptr, mac));
+}
+
+TEST(EthTest, FindsNetworkHeader) {
+    uint16_t proto, vlan;
+    std::vector<unsigned char> f = frame(kMacA, kMacB, AD_TUN_ETH_P_IP);
+    EXPECT_EQ(14, ad_tun_eth_l3_offset(f.data(), f.size(), &proto, &vlan));
+    EXPECT_EQ(AD_TUN_ETH_P_IP, proto);
+    EXPECT_EQ(0, vlan);
+
+    f = frame(kMacA, kMacB, AD_TUN_ETH_P_IPV6, 100);
+    EXPECT_EQ(18, ad_tun_eth_l3_offset(f.data(), f.size(), &proto, &vlan));
+    EXPECT_EQ(AD_TUN_ETH_P_IPV6, proto);
+    EXPECT_EQ(100, vlan);
+    EXPECT_EQ(18, ad_tun_eth_ip_offset(f.data(), f.size()));
+
+    f = frame(kMacA, kMacB, AD_TUN_ETH_P_ARP);
+    EXPECT_EQ(-EINVAL, ad_tun_eth_ip_offset(f.data(), f.size()));
+    EXPECT_EQ(-EINVAL, ad_tun_eth_l3_offset(f.data(), 13, nullptr, nullptr));
+}
+
+class MacTableTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ad_tun_mac_config_t cfg = { 4, 1000 };
+        ASSERT_EQ(AD_TUN_OK, ad_tun_mac_init(&tbl, &cfg));
+    }
+
+    void TearDown() override {
+        ad_tun_mac_free(&tbl);
+    }
+
+    ad_tun_mac_table_t tbl;
+};
+
+TEST_F(MacTableTest, LearnsAndForwards) {
+    /* Unknown destination floods and teaches the source */
+    std::vector<unsigned char> ab = frame(kMacB, kMacA, AD_TUN_ETH_P_IP);
+    EXPECT_EQ(AD_TUN_MAC_FLOOD, ad_tun_mac_forward(&tbl, ab.data(), ab.size(), 0, 0));
+    EXPECT_EQ(0, ad_tun_mac_lookup(&tbl, kMacA, 0, 0));
+
+    std::vector<unsigned char> ba = frame(kMacA, kMacB, AD_TUN_ETH_P_IP);
+    EXPECT_EQ(0, ad_tun_mac_forward(&tbl, ba.data(), ba.size(), 1, 10));
+    EXPECT_EQ(1, ad_tun_mac_forward(&tbl, ab.data(), ab.size(), 0, 20));
+
+    /* Broadcast always floods; a destination on the input port is dropped (and A moves to 1) */
+    std::vector<unsigned char> bc = frame(kBcast, kMacA, AD_TUN_ETH_P_ARP);
+    EXPECT_EQ(AD_TUN_MAC_FLOOD, ad_tun_mac_forward(&tbl, bc.data(), bc.size(), 0, 30));
+    EXPECT_EQ(AD_TUN_MAC_DROP, ad_tun_mac_forward(&tbl, ab.data(), ab.size(), 1, 40));
+    EXPECT_EQ(AD_TUN_MAC_DROP, ad_tun_mac_forward(&tbl, ab.data(), 10, 0, 40));
+
+    /* VLANs are separate address spaces */
+    EXPECT_EQ(-1, ad_tun_mac_lookup(&tbl, kMacA, 5, 40));
+    std::vector<unsigned char> tagged = frame(kMacB, kMacA, AD_TUN_ETH_P_IP, 5);
+    EXPECT_EQ(AD_TUN_MAC_FLOOD, ad_tun_mac_forward(&tbl, tagged.data(), tagged.size(), 2, 50));
+    EXPECT_EQ(2, ad_tun_mac_lookup(&tbl, kMacA, 5, 50));
+    EXPECT_EQ(1, ad_tun_mac_lookup(&tbl, kMacA, 0, 50));
+
+    EXPECT_EQ(3u, tbl.stats.learned);
+    EXPECT_EQ(1u, tbl.stats.moved);
+    EXPECT_EQ(2u, tbl.stats.hits);
+    EXPECT_EQ(3u, tbl.stats.floods);
+    EXPECT_EQ(2u, tbl.stats.drops);
+}
+
+TEST_F(MacTableTest, MovesAgesAndFlushes) {
+    EXPECT_EQ(0, ad_tun_mac_learn(&tbl, kMacA, 0, 0, 0));
+    EXPECT_EQ(1, ad_tun_mac_learn(&tbl, kMacA, 0, 3, 100));
+    EXPECT_EQ(3, ad_tun_mac_lookup(&tbl, kMacA, 0, 100));
+    EXPECT_EQ(1u, tbl.stats.moved);
+
+    EXPECT_EQ(-EINVAL, ad_tun_mac_learn(&tbl, kBcast, 0, 0, 0));
+
+    /* Not refreshed for longer than age_ms */
+    EXPECT_EQ(-1, ad_tun_mac_lookup(&tbl, kMacA, 0, 1200));
+    EXPECT_EQ(0u, tbl.count);
+
+    for (uint8_t i = 1; i <= 4; i++) {
+        uint8_t mac[6] = { 0x02, 0, 0, 0, 1, i };
+        EXPECT_EQ(0, ad_tun_mac_learn(&tbl, mac, 0, i % 2, 2000));
+    }
+    EXPECT_EQ(-ENOSPC, ad_tun_mac_learn(&tbl, kMacB, 0, 0, 2000));
+    EXPECT_EQ(1u, tbl.stats.full);
+
+    EXPECT_EQ(2u, ad_tun_mac_flush_port(&tbl, 1));
+    EXPECT_EQ(2u, tbl.count);
+    EXPECT_EQ(0, ad_tun_mac_learn(&tbl, kMacB, 0, 0, 2500));
+
+    /* A full table reclaims expired addresses before refusing */
+    EXPECT_EQ(0, ad_tun_mac_learn(&tbl, kMacA, 0, 0, 2500));
+    uint8_t late[6] = { 0x02, 0, 0, 0, 2, 1 };
+    EXPECT_EQ(0, ad_tun_mac_learn(&tbl, late, 0, 0, 3100));
+    EXPECT_EQ(3u, tbl.count);
+
+    EXPECT_EQ(3u, ad_tun_mac_expire(&tbl, 5000));
+    EXPECT_EQ(0u, tbl.count);
+
+    /* A caller whose clock lags the last refresh must not wrap into expiry */
+    EXPECT_EQ(0, ad_tun_mac_learn(&tbl, kMacA, 0, 2, 6000));
+    EXPECT_EQ(2, ad_tun_mac_lookup(&tbl, kMacA, 0, 5999));
+    EXPECT_EQ(0u, ad_tun_mac_expire(&tbl, 5000));
+    EXPECT_EQ(1u, tbl.count);
+}
+
+TEST_F(MacTableTest, ZeroDestinationFloods) {
+    static const uint8_t zero[6] = {};
+    std::vector<unsigned char> za = frame(zero, kMacA, AD_TUN_ETH_P_IP);
+
+    /* An empty slot has key 0: a zero address must not match it */
+    EXPECT_EQ(AD_TUN_MAC_FLOOD, ad_tun_mac_forward(&tbl, za.data(), za.size(), 1, 0));
+    EXPECT_EQ(-1, ad_tun_mac_lookup(&tbl, zero, 0, 0));
+    EXPECT_EQ(1u, tbl.count);
+    EXPECT_EQ(0u, tbl.stats.aged);
+
+    /* Learning still works afterwards */
+    EXPECT_EQ(0, ad_tun_mac_learn(&tbl, kMacB, 0, 2, 10));
+    EXPECT_EQ(2u, tbl.count);
+    EXPECT_EQ(AD_TUN_MAC_FLOOD, ad_tun_mac_forward(&tbl, za.data(), za.size(), 1, 5000));
+    EXPECT_EQ(0u, tbl.stats.aged);
+}
+
+TEST_F(MacTableTest, SurvivesChurn) {
+    ad_tun_mac_free(&tbl);
+    ad_tun_mac_config_t cfg = { 1024, 50 };
+    ASSERT_EQ(AD_TUN_OK, ad_tun_mac_init(&tbl, &cfg));
+
+    /*
+     * Each round outlives the previous one's addresses, so a full table
+     * reclaims them; flushing and expiry shift entries around the slots.
+     */
+    for (unsigned round = 0; round < 20; round++) {
+        uint64_t now = round * 60;
+        for (unsigned i = 0; i < 600; i++) {
+            uint8_t mac[6] = { 0x02, 0, 0, (uint8_t)round, (uint8_t)(i >> 8), (uint8_t)i };
+            ad_tun_mac_learn(&tbl, mac, (uint16_t)(i % 3), (int)(i % 7), now);
+        }
+        ad_tun_mac_flush_port(&tbl, (int)(round % 7));
+        ad_tun_mac_expire(&tbl, now);
+        for (unsigned i = 0; i < 600; i++) {
+            uint8_t mac[6] = { 0x02, 0, 0, (uint8_t)round, (uint8_t)(i >> 8), (uint8_t)i };
+            int want = (i % 7 == round % 7) ? -1 : (int)(i % 7);
+            ASSERT_EQ(want, ad_tun_mac_lookup(&tbl, mac, (uint16_t)(i % 3), now)) << round << " " << i;
+        }
+    }
+}
+
+/* ARP request "who has 10.77.0.1, tell 10.77.0.2" from kMacB */
+static std::vector<unsigned char> arp_request() {
+    std::vector<unsigned char> f = frame(kBcast, kMacB, AD_TUN_ETH_P_ARP, -1, 28);
+    unsigned char *a = f.data() + 14;
+    const unsigned char hdr[8] = { 0, 1, 0x08, 0, 6, 4, 0, 1 };
+    memcpy(a, hdr, 8);
+    memcpy(a + 8, kMacB, 6);
+    inet_pton(AF_INET, "10.77.0.2", a + 14);
+    inet_pton(AF_INET, "10.77.0.1", a + 24);
+    return f;
+}
+
+TEST(TapTest, AnswersArpWithConfiguredMac) {
+    ad_tun_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.ifname = "adtap0";
+    cfg.ipv4 = "10.77.0.1/24";
+    cfg.mtu = 1500;
+    cfg.mode = AD_TUN_MODE_TAP;
+    cfg.mac = "02:ad:00:00:00:01";
+    cfg.fragment = 1;
+
+    if (ad_tun_init(&cfg) != AD_TUN_OK) GTEST_SKIP() << "Skipping: ad_tun_init failed";
+    if (ad_tun_start() != AD_TUN_OK) {
+        ad_tun_cleanup();
+        GTEST_SKIP() << "Skipping: ad_tun_start failed (device may be unavailable)";
+    }
+    EXPECT_EQ(0, ad_tun_get_config_copy().fragment);
+
+    const uint8_t want_mac[6] = { 0x02, 0xad, 0, 0, 0, 1 };
+    EXPECT_EQ(std::vector<uint8_t>(want_mac, want_mac + 6), hwaddr("adtap0"));
+
+    std::vector<unsigned char> req = arp_request();
+    ASSERT_EQ((ssize_t)req.size(), ad_tun_write((const char *)req.data(), req.size()));
+
+    /* The kernel also sends its own traffic; look for the ARP reply */
+    ad_tun_pool_t pool;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_pool_init(&pool, 8, 2048, 0));
+    bool answered = false;
+    for (int tries = 0; tries < 50 && !answered; tries++) {
+        struct pollfd pfd = { ad_tun_get_fd(), POLLIN, 0 };
+        if (poll(&pfd, 1, 100) <= 0) continue;
+
+        ad_tun_buf_t *bufs[8];
+        ASSERT_EQ(8u, ad_tun_pool_get_bulk(&pool, bufs, 8));
+        int n = ad_tun_read_batch(bufs, 8);
+        for (int i = 0; i < n; i++) {
+            const unsigned char *f = bufs[i]->data;
+            if (bufs[i]->len >= 42 && ad_tun_get_be16(f + 12) == AD_TUN_ETH_P_ARP &&
+                ad_tun_get_be16(f + 20) == 2) {
+                EXPECT_EQ(0, memcmp(f, kMacB, 6));
+                EXPECT_EQ(0, memcmp(f + 6, want_mac, 6));
+                EXPECT_EQ(0, memcmp(f + 22, want_mac, 6));
+                answered = true;
+            }
+        }
+        ad_tun_pool_put_bulk(&pool, bufs, 8);
+    }
+    EXPECT_TRUE(answered);
+
+    ad_tun_pool_free(&pool);
+    ad_tun_stop();
+    ad_tun_cleanup();
+}
+
+TEST(TapTest, ManagerCreatesTaps) {
+    ad_tun_mgr_t mgr;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_mgr_init(&mgr, nullptr));
+
+    ad_tun_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.ifname = "adtap1";
+    cfg.ipv4 = "10.78.0.1/24";
+    cfg.mode = AD_TUN_MODE_TAP;
+    cfg.mac = "02:ad:00:00:00:02";
+    ASSERT_EQ(0, ad_tun_mgr_add(&mgr, &cfg));
+
+    cfg.ifname = "adtap2";
+    cfg.mac = "01:00:5e:00:00:01";
+    EXPECT_EQ(-EINVAL, ad_tun_mgr_add(&mgr, &cfg));
+
+    if (ad_tun_mgr_start_all(&mgr) != 1) {
+        ad_tun_mgr_free(&mgr);
+        GTEST_SKIP() << "Skipping: TAP devices unavailable";
+    }
+    const uint8_t want_mac[6] = { 0x02, 0xad, 0, 0, 0, 2 };
+    EXPECT_EQ(std::vector<uint8_t>(want_mac, want_mac + 6), hwaddr("adtap1"));
+    EXPECT_EQ(0, ad_tun_mgr_get(&mgr, 0)->err);
+
+    ad_tun_mgr_free(&mgr);
+}
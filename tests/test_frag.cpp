@@ -0,0 +1,214 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+extern "C" {
+#include "ad_tun_frag.h"
+#include "ad_tun_pkt.h"
+}
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+static std::vector<unsigned char> make_ipv4_udp(size_t total_len, uint16_t id) {
+    std::vector<unsigned char> p(total_len);
+    for (size_t i = 0; i < total_len; i++) p[i] = (unsigned char)(i * 7);
+
+    p[0] = 0x45;
+    p[1] = 0;
+    ad_tun_put_be16(&p[2], (uint16_t)total_len);
+    ad_tun_put_be16(&p[4], id);
+    ad_tun_put_be16(&p[6], 0);
+    p[8] = 64;
+    p[9] = IPPROTO_UDP;
+    const unsigned char src[4] = {10, 0, 0, 1};
+    const unsigned char dst[4] = {10, 0, 0, 2};
+    memcpy(&p[12], src, 4);
+    memcpy(&p[16], dst, 4);
+    ad_tun_ipv4_set_csum(p.data());
+    return p;
+}
+
+static std::vector<unsigned char> make_ipv6_udp(size_t total_len) {
+    std::vector<unsigned char> p(total_len);
+    for (size_t i = 0; i < total_len; i++) p[i] = (unsigned char)(i * 13);
+
+    p[0] = 0x60;
+    p[1] = p[2] = p[3] = 0;
+    ad_tun_put_be16(&p[4], (uint16_t)(total_len - 40));
+    p[6] = IPPROTO_UDP;
+    p[7] = 64;
+    memset(&p[8], 0, 32);
+    p[8] = 0xfd;
+    p[23] = 1;
+    p[24] = 0xfd;
+    p[39] = 2;
+    return p;
+}
+
+class FragTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ASSERT_EQ(AD_TUN_OK, ad_tun_pool_init(&frag_pool, 64, 1500, 0));
+        ASSERT_EQ(AD_TUN_OK, ad_tun_pool_init(&reasm_pool, 64, 1500, 0));
+        ASSERT_EQ(AD_TUN_OK, ad_tun_reasm_init(&reasm, &reasm_pool, 8, 1000));
+    }
+
+    void TearDown() override {
+        ad_tun_reasm_free(&reasm);
+        EXPECT_EQ(reasm_pool.count, ad_tun_pool_available(&reasm_pool));
+        EXPECT_EQ(frag_pool.count, ad_tun_pool_available(&frag_pool));
+        ad_tun_pool_free(&reasm_pool);
+        ad_tun_pool_free(&frag_pool);
+    }
+
+    ad_tun_pool_t frag_pool;
+    ad_tun_pool_t reasm_pool;
+    ad_tun_reasm_t reasm;
+};
+
+TEST_F(FragTest, Ipv4RoundTrip) {
+    std::vector<unsigned char> pkt = make_ipv4_udp(4000, 0x1234);
+    ad_tun_buf_t *frags[8];
+
+    int n = ad_tun_frag_fragment(&frag_pool, pkt.data(), pkt.size(), 1500, frags, 8);
+    ASSERT_EQ(3, n);
+
+    for (int i = 0; i < n; i++) {
+        EXPECT_LE(frags[i]->len, 1500u);
+        ad_tun_pkt_info_t info;
+        ASSERT_EQ(0, ad_tun_pkt_parse(frags[i]->data, frags[i]->len, &info));
+        EXPECT_TRUE(info.is_frag);
+        EXPECT_EQ(0, ad_tun_csum_fold(ad_tun_csum_partial(frags[i]->data, 20, 0)));
+    }
+
+    std::vector<unsigned char> out(65535);
+    /* Deliver out of order */
+    EXPECT_EQ(0, ad_tun_reasm_input(&reasm, frags[2]->data, frags[2]->len, 0, out.data(), out.size()));
+    EXPECT_EQ(0, ad_tun_reasm_input(&reasm, frags[0]->data, frags[0]->len, 0, out.data(), out.size()));
+    ssize_t r = ad_tun_reasm_input(&reasm, frags[1]->data, frags[1]->len, 0, out.data(), out.size());
+    ASSERT_EQ((ssize_t)pkt.size(), r);
+
+    pkt[10] = pkt[11] = 0;
+    out[10] = out[11] = 0;
+    EXPECT_EQ(0, memcmp(pkt.data(), out.data(), pkt.size()));
+    EXPECT_EQ(1u, reasm.stats.reassembled);
+    EXPECT_EQ(0u, reasm.active);
+
+    ad_tun_pool_put_bulk(&frag_pool, frags, (unsigned)n);
+}
+
+TEST_F(FragTest, Ipv6RoundTrip) {
+    std::vector<unsigned char> pkt = make_ipv6_udp(3000);
+    ad_tun_buf_t *frags[8];
+
+    int n = ad_tun_frag_fragment(&frag_pool, pkt.data(), pkt.size(), 1280, frags, 8);
+    ASSERT_EQ(3, n);
+
+    ad_tun_pkt_info_t info;
+    ASSERT_EQ(0, ad_tun_pkt_parse(frags[1]->data, frags[1]->len, &info));
+    EXPECT_TRUE(info.is_frag);
+    EXPECT_EQ(40, info.frag_hdr_off);
+    EXPECT_EQ(IPPROTO_UDP, info.proto);
+
+    std::vector<unsigned char> out(65535);
+    EXPECT_EQ(0, ad_tun_reasm_input(&reasm, frags[1]->data, frags[1]->len, 0, out.data(), out.size()));
+    EXPECT_EQ(0, ad_tun_reasm_input(&reasm, frags[2]->data, frags[2]->len, 0, out.data(), out.size()));
+    ssize_t r = ad_tun_reasm_input(&reasm, frags[0]->data, frags[0]->len, 0, out.data(), out.size());
+    ASSERT_EQ((ssize_t)pkt.size(), r);
+    EXPECT_EQ(0, memcmp(pkt.data(), out.data(), pkt.size()));
+
+    ad_tun_pool_put_bulk(&frag_pool, frags, (unsigned)n);
+}
+
+TEST_F(FragTest, DontFragmentRejected) {
+    std::vector<unsigned char> pkt = make_ipv4_udp(3000, 1);
+    ad_tun_put_be16(&pkt[6], 0x4000);
+    ad_tun_buf_t *frags[8];
+
+    EXPECT_EQ(-EMSGSIZE, ad_tun_frag_fragment(&frag_pool, pkt.data(), pkt.size(), 1500, frags, 8));
+}
+
+TEST_F(FragTest, OverlapDropsDatagram) {
+    std::vector<unsigned char> pkt = make_ipv4_udp(4000, 7);
+    ad_tun_buf_t *frags[8];
+    int n = ad_tun_frag_fragment(&frag_pool, pkt.data(), pkt.size(), 1500, frags, 8);
+    ASSERT_EQ(3, n);
+
+    std::vector<unsigned char> out(65535);
+    EXPECT_EQ(0, ad_tun_reasm_input(&reasm, frags[0]->data, frags[0]->len, 0, out.data(), out.size()));
+
+    /* Shift the second fragment's offset back by 8 bytes so it overlaps the first */
+    std::vector<unsigned char> bad(frags[1]->data, frags[1]->data + frags[1]->len);
+    uint16_t foff = ad_tun_get_be16(&bad[6]);
+    ad_tun_put_be16(&bad[6], (uint16_t)(foff - 1));
+    EXPECT_EQ(-EINVAL, ad_tun_reasm_input(&reasm, bad.data(), bad.size(), 0, out.data(), out.size()));
+    EXPECT_EQ(0u, reasm.active);
+    EXPECT_EQ(1u, reasm.stats.invalid);
+
+    ad_tun_pool_put_bulk(&frag_pool, frags, (unsigned)n);
+}
+
+TEST_F(FragTest, OversizedDatagramDropped) {
+    /* Fragments that fit within 65535 bytes of payload but not with the header */
+    std::vector<unsigned char> out(70000);
+    const size_t step = 1480, last_end = 65532;
+    ssize_t rc = 0;
+    for (size_t off = 0; off < last_end; off += step) {
+        size_t flen = (last_end - off < step) ? last_end - off : step;
+        std::vector<unsigned char> f = make_ipv4_udp(20 + flen, 11);
+        uint16_t more = (off + flen < last_end) ? 0x2000 : 0;
+        ad_tun_put_be16(&f[6], (uint16_t)(more | (off / 8)));
+        ad_tun_ipv4_set_csum(f.data());
+        rc = ad_tun_reasm_input(&reasm, f.data(), f.size(), 0, out.data(), out.size());
+        if (more) {
+            ASSERT_EQ(0, rc) << off;
+        }
+    }
+
+    EXPECT_EQ(-EINVAL, rc);
+    EXPECT_EQ(0u, reasm.active);
+    EXPECT_EQ(1u, reasm.stats.invalid);
+    EXPECT_EQ(0u, reasm.stats.reassembled);
+}
+
+TEST_F(FragTest, PartialDatagramExpires) {
+    std::vector<unsigned char> pkt = make_ipv4_udp(4000, 9);
+    ad_tun_buf_t *frags[8];
+    int n = ad_tun_frag_fragment(&frag_pool, pkt.data(), pkt.size(), 1500, frags, 8);
+    ASSERT_EQ(3, n);
+
+    std::vector<unsigned char> out(65535);
+    EXPECT_EQ(0, ad_tun_reasm_input(&reasm, frags[0]->data, frags[0]->len, 100, out.data(), out.size()));
+    EXPECT_EQ(1100u, ad_tun_reasm_next_expiry(&reasm));
+    EXPECT_EQ(0u, ad_tun_reasm_expire(&reasm, 1099));
+    EXPECT_EQ(1u, ad_tun_reasm_expire(&reasm, 1100));
+    EXPECT_EQ(0u, reasm.active);
+    EXPECT_EQ(reasm_pool.count, ad_tun_pool_available(&reasm_pool));
+
+    ad_tun_pool_put_bulk(&frag_pool, frags, (unsigned)n);
+}
+
+TEST_F(FragTest, CacheIsBounded) {
+    std::vector<unsigned char> out(65535);
+
+    /* Twice as many partial datagrams as the cache allows */
+    for (uint16_t id = 0; id < 16; id++) {
+        std::vector<unsigned char> pkt = make_ipv4_udp(4000, id);
+        ad_tun_buf_t *frags[8];
+        int n = ad_tun_frag_fragment(&frag_pool, pkt.data(), pkt.size(), 1500, frags, 8);
+        ASSERT_EQ(3, n);
+        EXPECT_EQ(0, ad_tun_reasm_input(&reasm, frags[0]->data, frags[0]->len, 0,
+                                        out.data(), out.size()));
+        ad_tun_pool_put_bulk(&frag_pool, frags, (unsigned)n);
+    }
+
+    EXPECT_EQ(8u, reasm.active);
+    EXPECT_EQ(8u, reasm.stats.evictions);
+}
+
+TEST(PktTest, NonIpRejected) {
+    unsigned char junk[20] = {0x10};
+    ad_tun_pkt_info_t info;
+    EXPECT_EQ(-EINVAL, ad_tun_pkt_parse(junk, sizeof(junk), &info));
+}
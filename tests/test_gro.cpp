@@ -0,0 +1,256 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+extern "C" {
+#include "ad_tun_gro.h"
+#include "ad_tun_pkt.h"
+#include "ad_tun_eth.h"
+}
+
+#include <netinet/in.h>
+
+#include "test_packets.h"
+
+static const size_t kMss = 1000;
+
+/* IPv4/TCP segment with kMss payload bytes, ACK set */
+static void make_tcp4(ad_tun_buf_t *b, uint16_t sport, uint32_t seq, size_t plen, uint8_t flags) {
+    unsigned char *p = b->data;
+    size_t len = 20 + 20 + plen;
+
+    memset(p, 0, 40);
+    p[0] = 0x45;
+    ad_tun_put_be16(p + 2, (uint16_t)len);
+    p[8] = 64;
+    p[9] = IPPROTO_TCP;
+    p[12] = 10; p[15] = 1;
+    p[16] = 10; p[19] = 2;
+    ad_tun_ipv4_set_csum(p);
+
+    unsigned char *th = p + 20;
+    ad_tun_put_be16(th, sport);
+    ad_tun_put_be16(th + 2, 80);
+    ad_tun_put_be32(th + 4, seq);
+    ad_tun_put_be32(th + 8, 4242);
+    th[12] = 5 << 4;
+    th[13] = flags;
+    ad_tun_put_be16(th + 14, 512);
+
+    for (size_t i = 0; i < plen; i++) p[40 + i] = (unsigned char)(seq + i);
+    b->len = len;
+
+    uint32_t sum = ad_tun_csum_partial(p + 12, 8, 0) + IPPROTO_TCP + (uint32_t)(len - 20);
+    ad_tun_put_be16(th + 16, ad_tun_csum_fold(ad_tun_csum_partial(th, len - 20, sum)));
+}
+
+static void make_udp4(ad_tun_buf_t *b) {
+    test_udp4(b, 0x0a000001u, 0x0a000002u, 4000, 9, 28);
+}
+
+class GroTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ASSERT_EQ(AD_TUN_OK, ad_tun_pool_init(&pool, 64, 2048, 0));
+        ASSERT_EQ(AD_TUN_OK, ad_tun_gro_init(&gro, NULL));
+    }
+
+    void TearDown() override {
+        ad_tun_gro_free(&gro);
+        ad_tun_pool_free(&pool);
+    }
+
+    ad_tun_pool_t pool;
+    ad_tun_gro_t gro;
+};
+
+TEST_F(GroTest, CoalescesInOrderSegments) {
+    ad_tun_buf_t *in[10];
+    ASSERT_EQ(10u, ad_tun_pool_get_bulk(&pool, in, 10));
+    for (int i = 0; i < 10; i++) make_tcp4(in[i], 1000, 1 + i * kMss, kMss, 0x10);
+
+    std::vector<ad_tun_gro_pkt_t> out(10 + gro.cfg.max_flows);
+    int n = ad_tun_gro_batch(&gro, in, 10, 0, out.data(), (unsigned)out.size());
+    ASSERT_EQ(1, n);
+
+    EXPECT_EQ(10u, out[0].segs);
+    EXPECT_EQ(40 + 10 * kMss, out[0].buf->len);
+    EXPECT_EQ(AD_TUN_GSO_TCPV4, out[0].vnet.gso_type);
+    EXPECT_EQ(kMss, out[0].vnet.gso_size);
+    EXPECT_EQ(40, out[0].vnet.hdr_len);
+    EXPECT_EQ(20, out[0].vnet.csum_start);
+    EXPECT_EQ(16, out[0].vnet.csum_offset);
+
+    ad_tun_pkt_info_t info;
+    ASSERT_EQ(0, ad_tun_pkt_parse(out[0].buf->data, out[0].buf->len, &info));
+    EXPECT_EQ(out[0].buf->len, info.tot_len);
+    EXPECT_EQ(0, ad_tun_csum_fold(ad_tun_csum_partial(out[0].buf->data, 20, 0)));
+    /* Payload of the last segment landed at the end */
+    EXPECT_EQ((unsigned char)(1 + 9 * kMss), out[0].buf->data[40 + 9 * kMss]);
+
+    ad_tun_gro_release(&gro, &out[0]);
+    ad_tun_pool_put_bulk(&pool, in, 10);
+    EXPECT_EQ(1u, gro.stats.super_pkts);
+    EXPECT_EQ(9u, gro.stats.coalesced);
+}
+
+TEST_F(GroTest, SequenceGapSplitsSuperPacket) {
+    ad_tun_buf_t *in[4];
+    ASSERT_EQ(4u, ad_tun_pool_get_bulk(&pool, in, 4));
+    make_tcp4(in[0], 1000, 1, kMss, 0x10);
+    make_tcp4(in[1], 1000, 1 + kMss, kMss, 0x10);
+    make_tcp4(in[2], 1000, 1 + 3 * kMss, kMss, 0x10);   /* gap */
+    make_tcp4(in[3], 1000, 1 + 4 * kMss, kMss, 0x10);
+
+    std::vector<ad_tun_gro_pkt_t> out(4 + gro.cfg.max_flows);
+    int n = ad_tun_gro_batch(&gro, in, 4, 0, out.data(), (unsigned)out.size());
+    ASSERT_EQ(2, n);
+    EXPECT_EQ(2u, out[0].segs);
+    EXPECT_EQ(2u, out[1].segs);
+
+    for (int i = 0; i < n; i++) ad_tun_gro_release(&gro, &out[i]);
+    ad_tun_pool_put_bulk(&pool, in, 4);
+}
+
+TEST_F(GroTest, NonTcpPassesThroughAndKeepsFlowOrder) {
+    ad_tun_buf_t *in[4];
+    ASSERT_EQ(4u, ad_tun_pool_get_bulk(&pool, in, 4));
+    make_tcp4(in[0], 1000, 1, kMss, 0x10);
+    make_udp4(in[1]);
+    make_tcp4(in[2], 1000, 1 + kMss, kMss, 0x10);
+    make_tcp4(in[3], 1000, 1 + 2 * kMss, 0, 0x11);       /* FIN: not coalescable */
+
+    std::vector<ad_tun_gro_pkt_t> out(4 + gro.cfg.max_flows);
+    int n = ad_tun_gro_batch(&gro, in, 4, 0, out.data(), (unsigned)out.size());
+    ASSERT_EQ(3, n);
+
+    EXPECT_EQ(in[1], out[0].buf);
+    EXPECT_FALSE(out[0].owned);
+    EXPECT_EQ(2u, out[1].segs);
+    EXPECT_EQ(in[3], out[2].buf);
+    EXPECT_EQ(AD_TUN_GSO_NONE, out[2].vnet.gso_type);
+
+    for (int i = 0; i < n; i++) ad_tun_gro_release(&gro, &out[i]);
+    ad_tun_pool_put_bulk(&pool, in, 4);
+}
+
+TEST_F(GroTest, BadChecksumNotMerged) {
+    ad_tun_buf_t *in[3];
+    ASSERT_EQ(3u, ad_tun_pool_get_bulk(&pool, in, 3));
+    for (int i = 0; i < 3; i++) make_tcp4(in[i], 1000, 1 + i * kMss, kMss, 0x10);
+    in[1]->data[40 + 7] ^= 0x01;   /* corrupted in transit */
+
+    std::vector<ad_tun_gro_pkt_t> out(3 + gro.cfg.max_flows);
+    int n = ad_tun_gro_batch(&gro, in, 3, 0, out.data(), (unsigned)out.size());
+    ASSERT_EQ(3, n);
+
+    /* Passed through unchanged, so the receiver still sees the bad checksum */
+    EXPECT_EQ(in[1], out[1].buf);
+    EXPECT_EQ(0, out[1].owned);
+    EXPECT_EQ(AD_TUN_GSO_NONE, out[1].vnet.gso_type);
+    EXPECT_EQ(1u, gro.stats.csum_bad);
+    EXPECT_EQ(0u, gro.stats.coalesced);
+
+    for (int i = 0; i < n; i++) ad_tun_gro_release(&gro, &out[i]);
+    ad_tun_pool_put_bulk(&pool, in, 3);
+}
+
+TEST_F(GroTest, TrustedChecksumsSkipVerification) {
+    ad_tun_gro_free(&gro);
+    ad_tun_gro_config_t cfg = {16, 64, 0, 0, 0, NULL, 1};
+    ASSERT_EQ(AD_TUN_OK, ad_tun_gro_init(&gro, &cfg));
+
+    ad_tun_buf_t *in[2];
+    ASSERT_EQ(2u, ad_tun_pool_get_bulk(&pool, in, 2));
+    for (int i = 0; i < 2; i++) {
+        make_tcp4(in[i], 1000, 1 + i * kMss, kMss, 0x10);
+        ad_tun_put_be16(in[i]->data + 36, 0);   /* left to the offload */
+    }
+
+    std::vector<ad_tun_gro_pkt_t> out(2 + cfg.max_flows);
+    int n = ad_tun_gro_batch(&gro, in, 2, 0, out.data(), (unsigned)out.size());
+    ASSERT_EQ(1, n);
+    EXPECT_EQ(2u, out[0].segs);
+    EXPECT_EQ(0u, gro.stats.csum_bad);
+
+    ad_tun_gro_release(&gro, &out[0]);
+    ad_tun_pool_put_bulk(&pool, in, 2);
+}
+
+TEST_F(GroTest, HeldFlowFlushedOnTimeout) {
+    ad_tun_gro_free(&gro);
+    ad_tun_gro_config_t cfg = {16, 64, 100, 0};
+    ASSERT_EQ(AD_TUN_OK, ad_tun_gro_init(&gro, &cfg));
+
+    ad_tun_buf_t *in[2];
+    ASSERT_EQ(2u, ad_tun_pool_get_bulk(&pool, in, 2));
+    make_tcp4(in[0], 1000, 1, kMss, 0x10);
+    make_tcp4(in[1], 1000, 1 + kMss, kMss, 0x10);
+
+    std::vector<ad_tun_gro_pkt_t> out(2 + cfg.max_flows);
+    EXPECT_EQ(0, ad_tun_gro_batch(&gro, in, 1, 1000, out.data(), (unsigned)out.size()));
+    EXPECT_EQ(0, ad_tun_gro_batch(&gro, in + 1, 1, 1050, out.data(), (unsigned)out.size()));
+    EXPECT_EQ(0, ad_tun_gro_flush_expired(&gro, 1099, out.data(), (unsigned)out.size()));
+    ASSERT_EQ(1, ad_tun_gro_flush_expired(&gro, 1100, out.data(), (unsigned)out.size()));
+    EXPECT_EQ(2u, out[0].segs);
+
+    ad_tun_gro_release(&gro, &out[0]);
+    ad_tun_pool_put_bulk(&pool, in, 2);
+}
+
+/* Prepend an Ethernet header with an optional VLAN tag to the packet in b */
+static void add_eth(ad_tun_buf_t *b, uint8_t dst_last, bool tagged) {
+    size_t l2 = tagged ? 18 : 14;
+    memmove(b->data + l2, b->data, b->len);
+    unsigned char *e = b->data;
+    memset(e, 0, l2);
+    e[0] = 0x02; e[5] = dst_last;
+    e[6] = 0x02; e[11] = 0x01;
+    if (tagged) {
+        ad_tun_put_be16(e + 12, AD_TUN_ETH_P_8021Q);
+        ad_tun_put_be16(e + 14, 7);
+    }
+    ad_tun_put_be16(e + l2 - 2, AD_TUN_ETH_P_IP);
+    b->len += l2;
+}
+
+TEST_F(GroTest, CoalescesEthernetFrames) {
+    ad_tun_gro_free(&gro);
+    ad_tun_gro_config_t cfg = {16, 64, 0, 0, 1};
+    ASSERT_EQ(AD_TUN_OK, ad_tun_gro_init(&gro, &cfg));
+
+    /* Four tagged segments, then one to another MAC which must not merge */
+    ad_tun_buf_t *in[6];
+    ASSERT_EQ(6u, ad_tun_pool_get_bulk(&pool, in, 6));
+    for (int i = 0; i < 5; i++) {
+        make_tcp4(in[i], 1000, 1 + i * kMss, kMss, 0x10);
+        add_eth(in[i], i < 4 ? 0x0b : 0x0c, true);
+    }
+    std::vector<unsigned char> arp(60, 0);
+    memcpy(in[5]->data, arp.data(), arp.size());
+    ad_tun_put_be16(in[5]->data + 12, AD_TUN_ETH_P_ARP);
+    in[5]->len = arp.size();
+
+    std::vector<ad_tun_gro_pkt_t> out(6 + cfg.max_flows);
+    int n = ad_tun_gro_batch(&gro, in, 6, 0, out.data(), (unsigned)out.size());
+    ASSERT_EQ(3, n);
+
+    EXPECT_EQ(4u, out[0].segs);
+    EXPECT_EQ(18 + 40 + 4 * kMss, out[0].buf->len);
+    EXPECT_EQ(18 + 40, out[0].vnet.hdr_len);
+    EXPECT_EQ(18 + 20, out[0].vnet.csum_start);
+    EXPECT_EQ(0x0b, out[0].buf->data[5]);
+
+    ad_tun_pkt_info_t info;
+    ASSERT_EQ(0, ad_tun_pkt_parse(out[0].buf->data + 18, out[0].buf->len - 18, &info));
+    EXPECT_EQ(out[0].buf->len - 18, info.tot_len);
+    EXPECT_EQ(0, ad_tun_csum_fold(ad_tun_csum_partial(out[0].buf->data + 18, 20, 0)));
+
+    /* Non-IP frames pass through untouched, in order */
+    EXPECT_EQ(in[5], out[1].buf);
+    EXPECT_EQ(1u, out[2].segs);
+    EXPECT_EQ(0x0c, out[2].buf->data[5]);
+
+    for (int i = 0; i < n; i++) ad_tun_gro_release(&gro, &out[i]);
+    ad_tun_pool_put_bulk(&pool, in, 6);
+}
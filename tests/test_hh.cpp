@@ -0,0 +1,234 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+#include <sys/socket.h>
+#include <vector>
+
+extern "C" {
+#include "ad_tun_hh.h"
+#include "ad_tun_pkt.h"
+#include "ad_tun_pool.h"
+}
+
+#include "test_packets.h"
+
+/* UDP packet (10.0.src_hi.src_lo:sport -> 10.0.1.1:53) of len bytes */
+static void udp_pkt(ad_tun_buf_t *b, uint16_t src, uint16_t sport, uint16_t len) {
+    test_udp4(b, 0x0a000000u | src, 0x0a000101u, sport, 53, len);
+}
+
+class HhTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ASSERT_EQ(AD_TUN_OK, ad_tun_pool_init(&pool, 256, 256, 0));
+        ad_tun_hh_default_config(&cfg);
+        cfg.width = 4096;
+        cfg.topk = 32;
+        cfg.metric = AD_TUN_HH_PACKETS;
+    }
+
+    void TearDown() override {
+        ad_tun_hh_free(&hh);
+        ad_tun_pool_free(&pool);
+    }
+
+    /* Count one packet per (src, sport) pair, in batches */
+    void feed(const std::vector<std::pair<uint16_t, uint16_t>> &pkts, uint16_t len = 64) {
+        ad_tun_buf_t *batch[64];
+        size_t i = 0;
+        while (i < pkts.size()) {
+            unsigned n = 0;
+            for (; n < 64 && i < pkts.size(); n++, i++) {
+                batch[n] = ad_tun_pool_get(&pool);
+                udp_pkt(batch[n], pkts[i].first, pkts[i].second, len);
+            }
+            ad_tun_hh_update(&hh, batch, n);
+            ad_tun_pool_put_bulk(&pool, batch, n);
+        }
+    }
+
+    static ad_tun_hh_key_t flow_key(uint16_t src, uint16_t sport) {
+        ad_tun_hh_key_t k;
+        memset(&k, 0, sizeof(k));
+        k.family = AF_INET;
+        k.proto = 17;
+        k.src[0] = 10; k.src[2] = (uint8_t)(src >> 8); k.src[3] = (uint8_t)src;
+        k.dst[0] = 10; k.dst[2] = 1; k.dst[3] = 1;
+        k.sport = sport;
+        k.dport = 53;
+        return k;
+    }
+
+    ad_tun_pool_t pool;
+    ad_tun_hh_config_t cfg;
+    ad_tun_hh_t hh = {};
+};
+
+TEST_F(HhTest, InvalidConfigRejected) {
+    cfg.depth = AD_TUN_HH_MAX_DEPTH + 1;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_hh_init(&hh, &cfg));
+    cfg.depth = 4;
+    cfg.topk = 0;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_hh_init(&hh, &cfg));
+    cfg.topk = 8;
+    cfg.metric = 7;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_hh_init(&hh, &cfg));
+}
+
+TEST_F(HhTest, HeavyFlowsFoundAmongMice) {
+    ASSERT_EQ(AD_TUN_OK, ad_tun_hh_init(&hh, &cfg));
+
+    /* 10 elephants of 500..950 packets hidden in 40000 one- or two-packet flows */
+    std::vector<std::pair<uint16_t, uint16_t>> pkts;
+    for (uint16_t e = 0; e < 10; e++) {
+        for (int i = 0; i < 500 + 50 * e; i++) pkts.push_back({1, (uint16_t)(1000 + e)});
+    }
+    for (uint32_t m = 0; m < 40000; m++) {
+        uint16_t src = (uint16_t)(2 + m / 1000), sport = (uint16_t)(m % 1000);
+        pkts.push_back({src, sport});
+        if (m % 3 == 0) pkts.push_back({src, sport});
+    }
+    std::mt19937 rng(7);
+    std::shuffle(pkts.begin(), pkts.end(), rng);
+    feed(pkts);
+
+    ad_tun_hh_entry_t top[32];
+    ASSERT_EQ(32u, ad_tun_hh_snapshot(&hh, top, 32));
+    for (unsigned i = 0; i < 10; i++) {
+        uint16_t e = (uint16_t)(9 - i);
+        ad_tun_hh_key_t want = flow_key(1, (uint16_t)(1000 + e));
+        EXPECT_EQ(0, memcmp(&top[i].key, &want, sizeof(want))) << "rank " << i;
+
+        uint64_t truth = 500 + 50 * e;
+        EXPECT_GE(top[i].count, truth);
+        EXPECT_LE(top[i].count - top[i].error, truth);
+        EXPECT_LE(top[i].packets, truth);
+        EXPECT_EQ(top[i].bytes, top[i].packets * 64);
+    }
+    for (unsigned i = 1; i < 32; i++) EXPECT_GE(top[i - 1].count, top[i].count);
+
+    ad_tun_hh_stats_t st;
+    ad_tun_hh_get_stats(&hh, &st);
+    EXPECT_EQ(st.packets, pkts.size());
+    EXPECT_EQ(st.unparsed, 0u);
+    /* Mice rarely beat the lightest entry */
+    EXPECT_LT(st.admissions, 2000u);
+}
+
+TEST_F(HhTest, EstimateNeverLow) {
+    cfg.width = 256;
+    cfg.depth = 2;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_hh_init(&hh, &cfg));
+
+    std::vector<std::pair<uint16_t, uint16_t>> pkts;
+    for (uint16_t f = 0; f < 2000; f++) {
+        for (int i = 0; i <= f % 5; i++) pkts.push_back({7, f});
+    }
+    feed(pkts);
+    for (uint16_t f = 0; f < 2000; f++) {
+        ad_tun_hh_key_t k = flow_key(7, f);
+        EXPECT_GE(ad_tun_hh_estimate(&hh, &k), (uint64_t)(f % 5 + 1));
+    }
+}
+
+TEST_F(HhTest, SourceKeyAggregatesAndCountsBytes) {
+    cfg.key = AD_TUN_HH_KEY_SRC;
+    cfg.metric = AD_TUN_HH_BYTES;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_hh_init(&hh, &cfg));
+
+    std::vector<std::pair<uint16_t, uint16_t>> pkts;
+    for (uint16_t p = 0; p < 300; p++) pkts.push_back({5, p});
+    for (uint16_t p = 0; p < 100; p++) pkts.push_back({6, p});
+    feed(pkts, 100);
+
+    ad_tun_hh_entry_t top[4];
+    ASSERT_EQ(2u, ad_tun_hh_snapshot(&hh, top, 4));
+    EXPECT_EQ(top[0].key.src[3], 5);
+    EXPECT_EQ(top[0].key.sport, 0);
+    EXPECT_EQ(top[0].key.dst[0], 0);
+    EXPECT_EQ(top[0].count, 30000u);
+    EXPECT_EQ(top[0].packets, 300u);
+    EXPECT_EQ(top[1].key.src[3], 6);
+    EXPECT_EQ(top[1].bytes, 10000u);
+}
+
+TEST_F(HhTest, ByteCountsPassFourGiB) {
+    cfg.metric = AD_TUN_HH_BYTES;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_hh_init(&hh, &cfg));
+
+    /* One 64000-byte packet counted 70000 times: about 4.5e9 bytes */
+    ad_tun_pool_t big;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_pool_init(&big, 1, 65536, 0));
+    ad_tun_buf_t *b = ad_tun_pool_get(&big);
+    udp_pkt(b, 5, 1000, 64000);
+    ad_tun_buf_t *batch[64];
+    for (auto &p : batch) p = b;
+    for (unsigned i = 0; i < 70000 / 64; i++) ad_tun_hh_update(&hh, batch, 64);
+    ad_tun_hh_update(&hh, batch, 70000 % 64);
+    ad_tun_pool_put(&big, b);
+    ad_tun_pool_free(&big);
+
+    const uint64_t want = 70000ull * 64000;
+    ad_tun_hh_key_t k = flow_key(5, 1000);
+    EXPECT_EQ(want, ad_tun_hh_estimate(&hh, &k));
+    ad_tun_hh_entry_t top[1];
+    ASSERT_EQ(1u, ad_tun_hh_snapshot(&hh, top, 1));
+    EXPECT_EQ(want, top[0].count);
+}
+
+TEST_F(HhTest, DecayHalvesOnTick) {
+    cfg.decay_ms = 1000;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_hh_init(&hh, &cfg));
+
+    std::vector<std::pair<uint16_t, uint16_t>> pkts(100, {3, 9});
+    feed(pkts);
+
+    EXPECT_EQ(0, ad_tun_hh_tick(&hh, 5000));    // starting time
+    EXPECT_EQ(0, ad_tun_hh_tick(&hh, 5999));
+    EXPECT_EQ(1, ad_tun_hh_tick(&hh, 6000));
+
+    ad_tun_hh_entry_t top[1];
+    ASSERT_EQ(1u, ad_tun_hh_snapshot(&hh, top, 1));
+    EXPECT_EQ(top[0].count, 50u);
+    EXPECT_EQ(top[0].packets, 100u);
+    ad_tun_hh_key_t k = flow_key(3, 9);
+    EXPECT_EQ(ad_tun_hh_estimate(&hh, &k), 50u);
+
+    ad_tun_hh_stats_t st;
+    ad_tun_hh_get_stats(&hh, &st);
+    EXPECT_EQ(st.decays, 1u);
+}
+
+TEST_F(HhTest, UnparsedSkipped) {
+    ASSERT_EQ(AD_TUN_OK, ad_tun_hh_init(&hh, &cfg));
+    ad_tun_buf_t *b = ad_tun_pool_get(&pool);
+    memset(b->data, 0, 16);
+    b->len = 16;
+    ad_tun_hh_update(&hh, &b, 1);
+    ad_tun_pool_put(&pool, b);
+
+    ad_tun_hh_stats_t st;
+    ad_tun_hh_get_stats(&hh, &st);
+    EXPECT_EQ(st.unparsed, 1u);
+    EXPECT_EQ(st.packets, 0u);
+}
+
+TEST(HhConfigTest, LoadsSection) {
+    ad_tun_hh_config_t c;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_hh_load_config("../../test_configs/heavy_hitters.ini", &c));
+    EXPECT_EQ(c.width, 16384u);
+    EXPECT_EQ(c.depth, 3u);
+    EXPECT_EQ(c.topk, 64u);
+    EXPECT_EQ(c.decay_ms, 5000u);
+    EXPECT_EQ(c.key, AD_TUN_HH_KEY_SRC);
+    EXPECT_EQ(c.metric, AD_TUN_HH_PACKETS);
+
+    /* Out-of-range values fall back to the defaults */
+    ad_tun_hh_config_t d;
+    ad_tun_hh_default_config(&d);
+    ASSERT_EQ(AD_TUN_OK, ad_tun_hh_load_config("../../test_configs/heavy_hitters_bad.ini", &c));
+    EXPECT_EQ(c.depth, d.depth);
+    EXPECT_EQ(c.topk, d.topk);
+    EXPECT_EQ(c.key, d.key);
+}
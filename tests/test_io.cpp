@@ -2,6 +2,7 @@
 
 extern "C" {
 #include "ad_tun.h"
+#include "ad_tun_pool.h"
 }
 
 TEST(IOTest, ReadWithoutStartFails) {
@@ -48,3 +49,102 @@ TEST(IOTest, ReadWriteWhileRunning) {
     EXPECT_EQ(AD_TUN_OK, ad_tun_stop());
     EXPECT_EQ(AD_TUN_OK, ad_tun_cleanup());
 }
+
+TEST(IOTest, OversizedWriteIsFragmented) {
+    ad_tun_config_t cfg = {
+        .ifname = "test_io1",
+        .ipv4 = "10.201.0.2/24",
+        .ipv6 = NULL,
+        .mtu = 1400,
+        .persist = 0,
+        .fragment = 1,
+        .reassemble = 1
+    };
+
+    ad_tun_error_t rc = ad_tun_init(&cfg);
+    if (rc != AD_TUN_OK) {
+        ad_tun_cleanup();
+        GTEST_SKIP() << "Skipping: ad_tun_init failed";
+    }
+
+    if (ad_tun_start() != AD_TUN_OK) {
+        ad_tun_cleanup();
+        GTEST_SKIP() << "Skipping: ad_tun_start failed (device may be unavailable)";
+    }
+
+    /* 3000-byte IPv4/UDP datagram towards a peer on the tunnel subnet */
+    char pkt[3000] = {0};
+    pkt[0] = 0x45;
+    pkt[2] = (char)(sizeof(pkt) >> 8);
+    pkt[3] = (char)(sizeof(pkt) & 0xff);
+    pkt[8] = 64;
+    pkt[9] = 17;
+    pkt[12] = 10; pkt[13] = (char)201; pkt[14] = 0; pkt[15] = 9;
+    pkt[16] = 10; pkt[17] = (char)201; pkt[18] = 0; pkt[19] = 2;
+
+    ad_tun_frag_stats_t before, after;
+    ad_tun_get_frag_stats(&before);
+    ssize_t wn = ad_tun_write(pkt, sizeof(pkt));
+    EXPECT_TRUE(wn == (ssize_t)sizeof(pkt) || wn == -EAGAIN || wn == -EIO);
+    ad_tun_get_frag_stats(&after);
+    if (wn == (ssize_t)sizeof(pkt)) {
+        EXPECT_EQ(before.fragmented + 1, after.fragmented);
+    }
+
+    EXPECT_EQ(AD_TUN_OK, ad_tun_stop());
+    EXPECT_EQ(AD_TUN_OK, ad_tun_cleanup());
+}
+
+TEST(IOTest, BatchIoWithOffload) {
+    ad_tun_config_t cfg = {
+        .ifname = "test_io2",
+        .ipv4 = "10.202.0.2/24",
+        .ipv6 = NULL,
+        .mtu = 1500,
+        .persist = 0,
+        .fragment = 0,
+        .reassemble = 0,
+        .offload = 1
+    };
+
+    ad_tun_error_t rc = ad_tun_init(&cfg);
+    if (rc != AD_TUN_OK) {
+        ad_tun_cleanup();
+        GTEST_SKIP() << "Skipping: ad_tun_init failed";
+    }
+
+    if (ad_tun_start() != AD_TUN_OK) {
+        ad_tun_cleanup();
+        GTEST_SKIP() << "Skipping: ad_tun_start failed (device may be unavailable)";
+    }
+
+    ad_tun_pool_t pool;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_pool_init(&pool, 8, 2048, 0));
+
+    ad_tun_buf_t *bufs[4];
+    ASSERT_EQ(4u, ad_tun_pool_get_bulk(&pool, bufs, 4));
+    for (int i = 0; i < 4; i++) {
+        memset(bufs[i]->data, 0, 28);
+        bufs[i]->data[0] = 0x45;
+        bufs[i]->data[3] = 28;
+        bufs[i]->data[8] = 64;
+        bufs[i]->data[9] = 17;
+        bufs[i]->len = 28;
+    }
+
+    int wn = ad_tun_write_batch(bufs, 4);
+    EXPECT_TRUE(wn > 0 || wn == -EAGAIN || wn == -EIO);
+
+    ad_tun_vnet_hdr_t hdr = {0};
+    ssize_t gn = ad_tun_write_gso(&hdr, (const char *)bufs[0]->data, bufs[0]->len);
+    EXPECT_TRUE(gn >= 0 || gn == -EAGAIN || gn == -EIO);
+
+    int rn = ad_tun_read_batch(bufs, 4);
+    EXPECT_TRUE(rn > 0 || rn == -EAGAIN);
+
+    ad_tun_pool_put_bulk(&pool, bufs, 4);
+    ad_tun_pool_free(&pool);
+
+    EXPECT_EQ(AD_TUN_OK, ad_tun_stop());
+    EXPECT_EQ(AD_TUN_OK, ad_tun_cleanup());
+}
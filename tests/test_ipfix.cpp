@@ -0,0 +1,464 @@
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+extern "C" {
+#include "ad_tun_ipfix.h"
+#include "ad_tun_pkt.h"
+#include "ad_tun_pool.h"
+}
+
+#include "test_packets.h"
+
+/* UDP packet 10.0.0.src:sport -> 10.0.1.1:53 of len bytes */
+static void udp4(ad_tun_buf_t *b, uint8_t src, uint16_t sport, uint16_t len) {
+    test_udp4(b, 0x0a000000u | src, 0x0a000101u, sport, 53, len, 0x10);
+}
+
+/* UDP packet fd00::src:sport -> fd00::1:443 of len bytes */
+static void udp6(ad_tun_buf_t *b, uint8_t src, uint16_t sport, uint16_t len) {
+    unsigned char *p = b->data;
+    memset(p, 0, len);
+    p[0] = 0x60;
+    ad_tun_put_be16(p + 4, (uint16_t)(len - 40));
+    p[6] = 17;
+    p[7] = 64;
+    p[8] = 0xfd; p[23] = src;
+    p[24] = 0xfd; p[39] = 1;
+    ad_tun_put_be16(p + 40, sport);
+    ad_tun_put_be16(p + 42, 443);
+    ad_tun_put_be16(p + 44, (uint16_t)(len - 40));
+    b->len = len;
+}
+
+struct Record {
+    uint16_t tmpl;
+    uint8_t src_last;
+    uint16_t sport;
+    uint16_t dport;
+    uint8_t proto;
+    uint8_t tos;
+    uint8_t dir;
+    uint8_t reason;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t start;
+    uint64_t end;
+    uint32_t sampling;
+};
+
+struct Message {
+    uint32_t seq;
+    uint32_t domain;
+    std::vector<uint16_t> templates;
+    std::vector<Record> records;
+};
+
+static uint64_t get_be64(const unsigned char *p) {
+    return ((uint64_t)ad_tun_get_be32(p) << 32) | ad_tun_get_be32(p + 4);
+}
+
+/* Decode one message, data records by the layout of templates 256 and 257 */
+static bool parse(const unsigned char *p, size_t n, Message *m) {
+    if (n < 16 || ad_tun_get_be16(p) != 10 || ad_tun_get_be16(p + 2) != n) return false;
+    m->seq = ad_tun_get_be32(p + 8);
+    m->domain = ad_tun_get_be32(p + 12);
+
+    for (size_t off = 16; off < n;) {
+        uint16_t id = ad_tun_get_be16(p + off);
+        uint16_t len = ad_tun_get_be16(p + off + 2);
+        if (len < 4 || off + len > n) return false;
+        const unsigned char *q = p + off + 4, *end = p + off + len;
+
+        if (id == 2) {
+            while (q + 4 <= end) {
+                m->templates.push_back(ad_tun_get_be16(q));
+                q += 4 + 4 * ad_tun_get_be16(q + 2);
+            }
+        } else {
+            size_t alen = (id == 256) ? 4 : 16;
+            while (q + 2 * alen + 44 <= end) {
+                Record r;
+                r.tmpl = id;
+                r.src_last = q[alen - 1];
+                q += 2 * alen;
+                r.sport = ad_tun_get_be16(q);
+                r.dport = ad_tun_get_be16(q + 2);
+                r.proto = q[4];
+                r.tos = q[5];
+                r.dir = q[6];
+                r.reason = q[7];
+                r.packets = get_be64(q + 8);
+                r.bytes = get_be64(q + 16);
+                r.start = get_be64(q + 24);
+                r.end = get_be64(q + 32);
+                r.sampling = ad_tun_get_be32(q + 40);
+                m->records.push_back(r);
+                q += 44;
+            }
+        }
+        off += len;
+    }
+    return true;
+}
+
+class IpfixTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ASSERT_EQ(AD_TUN_OK, ad_tun_pool_init(&pool, 256, 256, 0));
+
+        /* Collector: a UDP socket on an ephemeral loopback port */
+        sock = socket(AF_INET, SOCK_DGRAM, 0);
+        ASSERT_GE(sock, 0);
+        struct sockaddr_in sa = {};
+        sa.sin_family = AF_INET;
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ASSERT_EQ(0, bind(sock, (struct sockaddr *)&sa, sizeof(sa)));
+        socklen_t sl = sizeof(sa);
+        ASSERT_EQ(0, getsockname(sock, (struct sockaddr *)&sa, &sl));
+
+        ad_tun_ipfix_default_config(&cfg);
+        cfg.port = ntohs(sa.sin_port);
+        cfg.domain_id = 7;
+    }
+
+    void TearDown() override {
+        ad_tun_ipfix_free(&ex);
+        ad_tun_pool_free(&pool);
+        if (sock >= 0) close(sock);
+    }
+
+    /* Record count packets of one flow as worker w */
+    void feed(unsigned w, uint8_t src, uint16_t sport, unsigned count, uint16_t len = 100,
+              int dir = AD_TUN_IPFIX_DIR_READ, bool v6 = false) {
+        ad_tun_buf_t *batch[32];
+        while (count) {
+            unsigned n = count < 32 ? count : 32;
+            for (unsigned i = 0; i < n; i++) {
+                batch[i] = ad_tun_pool_get(&pool);
+                if (v6) udp6(batch[i], src, sport, len);
+                else udp4(batch[i], src, sport, len);
+            }
+            ad_tun_ipfix_record(&ex, w, batch, n, dir);
+            ad_tun_pool_put_bulk(&pool, batch, n);
+            count -= n;
+        }
+    }
+
+    /* Messages the collector got until it stays quiet for wait_ms */
+    std::vector<Message> collect(int wait_ms = 200) {
+        std::vector<Message> out;
+        unsigned char buf[65536];
+        struct pollfd pfd = { sock, POLLIN, 0 };
+        while (poll(&pfd, 1, wait_ms) > 0) {
+            ssize_t n = recv(sock, buf, sizeof(buf), 0);
+            if (n <= 0) break;
+            Message m;
+            EXPECT_TRUE(parse(buf, (size_t)n, &m));
+            out.push_back(m);
+        }
+        return out;
+    }
+
+    static std::vector<Record> records(const std::vector<Message> &msgs) {
+        std::vector<Record> out;
+        for (const Message &m : msgs) out.insert(out.end(), m.records.begin(), m.records.end());
+        return out;
+    }
+
+    ad_tun_pool_t pool;
+    ad_tun_ipfix_config_t cfg;
+    ad_tun_ipfix_t ex = {};
+    int sock = -1;
+};
+
+TEST_F(IpfixTest, InvalidConfigRejected) {
+    cfg.workers = 0;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_ipfix_init(&ex, &cfg));
+    cfg.workers = AD_TUN_IPFIX_MAX_WORKERS + 1;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_ipfix_init(&ex, &cfg));
+    cfg.workers = 1;
+    cfg.sampling = 0;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_ipfix_init(&ex, &cfg));
+    cfg.sampling = 1;
+    cfg.mtu = 100;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_ipfix_init(&ex, &cfg));
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_ipfix_bind(&ex, 0));
+}
+
+TEST_F(IpfixTest, WorkersMergedAndIdleFlowsEnded) {
+    cfg.workers = 2;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_ipfix_init(&ex, &cfg));
+    uint64_t t0 = ad_tun_ipfix_now_ms();
+
+    feed(0, 1, 1000, 3);
+    feed(1, 1, 1000, 2);
+    feed(1, 2, 2000, 4, 60, AD_TUN_IPFIX_DIR_WRITE);
+
+    /* First round: templates only, the flows are neither idle nor old */
+    ad_tun_ipfix_poll(&ex, t0);
+    std::vector<Message> msgs = collect();
+    ASSERT_EQ(1u, msgs.size());
+    EXPECT_EQ(7u, msgs[0].domain);
+    EXPECT_EQ(0u, msgs[0].seq);
+    EXPECT_EQ((std::vector<uint16_t>{256, 257}), msgs[0].templates);
+    EXPECT_TRUE(msgs[0].records.empty());
+
+    ad_tun_ipfix_stats_t st;
+    ad_tun_ipfix_get_stats(&ex, &st);
+    EXPECT_EQ(2u, st.flows);
+
+    ad_tun_ipfix_poll(&ex, t0 + cfg.idle_timeout_ms + 100);
+    msgs = collect();
+    ASSERT_EQ(1u, msgs.size());
+    EXPECT_EQ(0u, msgs[0].seq);
+    std::vector<Record> r = records(msgs);
+    ASSERT_EQ(2u, r.size());
+    if (r[0].src_last != 1) std::swap(r[0], r[1]);
+
+    EXPECT_EQ(256, r[0].tmpl);
+    EXPECT_EQ(1000, r[0].sport);
+    EXPECT_EQ(53, r[0].dport);
+    EXPECT_EQ(17, r[0].proto);
+    EXPECT_EQ(0x10, r[0].tos);
+    EXPECT_EQ(AD_TUN_IPFIX_DIR_READ, r[0].dir);
+    EXPECT_EQ(AD_TUN_IPFIX_END_IDLE, r[0].reason);
+    EXPECT_EQ(5u, r[0].packets);
+    EXPECT_EQ(500u, r[0].bytes);
+    EXPECT_LE(r[0].start, r[0].end);
+    EXPECT_GE(r[0].start + 100, t0);
+    EXPECT_EQ(1u, r[0].sampling);
+
+    EXPECT_EQ(2, r[1].src_last);
+    EXPECT_EQ(AD_TUN_IPFIX_DIR_WRITE, r[1].dir);
+    EXPECT_EQ(4u, r[1].packets);
+    EXPECT_EQ(240u, r[1].bytes);
+
+    ad_tun_ipfix_get_stats(&ex, &st);
+    EXPECT_EQ(0u, st.flows);
+    EXPECT_EQ(9u, st.packets);
+    EXPECT_EQ(2u, st.records);
+
+    /* The sequence number counts the records sent before */
+    feed(0, 3, 3000, 1);
+    ad_tun_ipfix_poll(&ex, t0 + 2 * (cfg.idle_timeout_ms + 100));
+    msgs = collect();
+    ASSERT_EQ(1u, msgs.size());
+    EXPECT_EQ(2u, msgs[0].seq);
+}
+
+TEST_F(IpfixTest, ActiveTimeoutReportsDeltas) {
+    cfg.active_timeout_ms = 1000;
+    cfg.idle_timeout_ms = 600000;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_ipfix_init(&ex, &cfg));
+    uint64_t t0 = ad_tun_ipfix_now_ms();
+
+    feed(0, 1, 1000, 4);
+    ad_tun_ipfix_poll(&ex, t0);
+    EXPECT_TRUE(records(collect()).empty());
+
+    ad_tun_ipfix_poll(&ex, t0 + 1500);
+    std::vector<Record> r = records(collect());
+    ASSERT_EQ(1u, r.size());
+    EXPECT_EQ(AD_TUN_IPFIX_END_ACTIVE, r[0].reason);
+    EXPECT_EQ(4u, r[0].packets);
+
+    /* Still cached, and the next report only carries what came since */
+    feed(0, 1, 1000, 3);
+    ad_tun_ipfix_poll(&ex, t0 + 3000);
+    r = records(collect());
+    ASSERT_EQ(1u, r.size());
+    EXPECT_EQ(AD_TUN_IPFIX_END_ACTIVE, r[0].reason);
+    EXPECT_EQ(3u, r[0].packets);
+    EXPECT_EQ(300u, r[0].bytes);
+
+    /* Nothing new: the forced end has no record to send */
+    ad_tun_ipfix_flush(&ex);
+    EXPECT_TRUE(records(collect()).empty());
+    ad_tun_ipfix_stats_t st;
+    ad_tun_ipfix_get_stats(&ex, &st);
+    EXPECT_EQ(0u, st.flows);
+    EXPECT_EQ(2u, st.records);
+}
+
+TEST_F(IpfixTest, SamplingRecordsOneInN) {
+    cfg.sampling = 10;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_ipfix_init(&ex, &cfg));
+
+    feed(0, 1, 1000, 100);
+    ad_tun_ipfix_flush(&ex);
+    std::vector<Record> r = records(collect());
+    ASSERT_EQ(1u, r.size());
+    EXPECT_EQ(10u, r[0].packets);
+    EXPECT_EQ(10u, r[0].sampling);
+    EXPECT_EQ(AD_TUN_IPFIX_END_FORCED, r[0].reason);
+
+    ad_tun_ipfix_stats_t st;
+    ad_tun_ipfix_get_stats(&ex, &st);
+    EXPECT_EQ(100u, st.packets);
+    EXPECT_EQ(10u, st.sampled);
+}
+
+TEST_F(IpfixTest, FullCacheExportsAtOnce) {
+    cfg.max_flows = 2;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_ipfix_init(&ex, &cfg));
+
+    for (uint16_t f = 0; f < 5; f++) feed(0, 1, (uint16_t)(1000 + f), 1);
+    ad_tun_ipfix_poll(&ex, 0);
+    std::vector<Record> r = records(collect());
+    ASSERT_EQ(3u, r.size());
+    for (const Record &rec : r) EXPECT_EQ(AD_TUN_IPFIX_END_RESOURCES, rec.reason);
+
+    ad_tun_ipfix_stats_t st;
+    ad_tun_ipfix_get_stats(&ex, &st);
+    EXPECT_EQ(3u, st.cache_full);
+    EXPECT_EQ(2u, st.flows);
+
+    ad_tun_ipfix_flush(&ex);
+    EXPECT_EQ(2u, records(collect()).size());
+}
+
+TEST_F(IpfixTest, FullWorkerTableCounted) {
+    cfg.worker_flows = 4;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_ipfix_init(&ex, &cfg));
+
+    for (uint16_t f = 0; f < 6; f++) feed(0, 1, (uint16_t)(1000 + f), 1);
+    ad_tun_ipfix_stats_t st;
+    ad_tun_ipfix_get_stats(&ex, &st);
+    EXPECT_EQ(2u, st.worker_full);
+
+    /* The next interval starts in the other, empty table */
+    ad_tun_ipfix_poll(&ex, 0);
+    for (uint16_t f = 0; f < 4; f++) feed(0, 2, (uint16_t)(1000 + f), 1);
+    ad_tun_ipfix_get_stats(&ex, &st);
+    EXPECT_EQ(2u, st.worker_full);
+}
+
+TEST_F(IpfixTest, FlushSendsIpv6AndSplitsMessages) {
+    cfg.mtu = 300;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_ipfix_init(&ex, &cfg));
+
+    for (uint16_t f = 0; f < 10; f++) feed(0, 5, (uint16_t)(4000 + f), 2, 80, AD_TUN_IPFIX_DIR_READ, true);
+    ad_tun_ipfix_flush(&ex);
+    std::vector<Message> msgs = collect();
+    ASSERT_GT(msgs.size(), 1u);
+
+    std::vector<Record> r = records(msgs);
+    ASSERT_EQ(10u, r.size());
+    for (const Record &rec : r) {
+        EXPECT_EQ(257, rec.tmpl);
+        EXPECT_EQ(5, rec.src_last);
+        EXPECT_EQ(443, rec.dport);
+        EXPECT_EQ(2u, rec.packets);
+        EXPECT_EQ(160u, rec.bytes);
+        EXPECT_EQ(AD_TUN_IPFIX_END_FORCED, rec.reason);
+    }
+
+    uint32_t seq = 0;
+    for (const Message &m : msgs) {
+        EXPECT_EQ(seq, m.seq);
+        seq += (uint32_t)m.records.size();
+    }
+}
+
+TEST_F(IpfixTest, BoundThreadRecordsThroughHook) {
+    ASSERT_EQ(AD_TUN_OK, ad_tun_ipfix_init(&ex, &cfg));
+    ad_tun_buf_t *b = ad_tun_pool_get(&pool);
+    udp4(b, 9, 9000, 64);
+
+    /* Unbound threads are not recorded */
+    ad_tun_ipfix_hook(AD_TUN_IPFIX_DIR_READ, b->data, b->len);
+
+    ASSERT_EQ(AD_TUN_OK, ad_tun_ipfix_bind(&ex, 0));
+    EXPECT_EQ(1, ad_tun_ipfix_bound);
+    std::thread other([&] { ad_tun_ipfix_hook(AD_TUN_IPFIX_DIR_READ, b->data, b->len); });
+    other.join();
+    ad_tun_ipfix_hook(AD_TUN_IPFIX_DIR_READ, b->data, b->len);
+    ad_tun_ipfix_hook(AD_TUN_IPFIX_DIR_READ, b->data, b->len);
+    ASSERT_EQ(AD_TUN_OK, ad_tun_ipfix_bind(NULL, 0));
+    EXPECT_EQ(0, ad_tun_ipfix_bound);
+    ad_tun_ipfix_hook(AD_TUN_IPFIX_DIR_READ, b->data, b->len);
+    ad_tun_pool_put(&pool, b);
+
+    ad_tun_ipfix_flush(&ex);
+    std::vector<Record> r = records(collect());
+    ASSERT_EQ(1u, r.size());
+    EXPECT_EQ(2u, r[0].packets);
+    EXPECT_EQ(9000, r[0].sport);
+}
+
+TEST_F(IpfixTest, ConcurrentRecordingLosesNothing) {
+    cfg.interval_ms = 1;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_ipfix_init(&ex, &cfg));
+    ASSERT_EQ(AD_TUN_OK, ad_tun_ipfix_start(&ex));
+    EXPECT_EQ(AD_TUN_ERR_INVALID_STATE, ad_tun_ipfix_start(&ex));
+
+    const unsigned total = 200000;
+    std::thread worker([&] {
+        ad_tun_buf_t *batch[16];
+        for (unsigned i = 0; i < 16; i++) {
+            batch[i] = ad_tun_pool_get(&pool);
+            udp4(batch[i], 1, (uint16_t)(1000 + i % 3), 100);
+        }
+        for (unsigned done = 0; done < total; done += 16) {
+            ad_tun_ipfix_record(&ex, 0, batch, 16, AD_TUN_IPFIX_DIR_READ);
+        }
+        ad_tun_pool_put_bulk(&pool, batch, 16);
+    });
+    worker.join();
+
+    ad_tun_ipfix_stop(&ex);
+    ad_tun_ipfix_flush(&ex);
+
+    uint64_t packets = 0;
+    for (const Record &rec : records(collect())) packets += rec.packets;
+    EXPECT_EQ(total, packets);
+
+    ad_tun_ipfix_stats_t st;
+    ad_tun_ipfix_get_stats(&ex, &st);
+    EXPECT_EQ(total, st.packets);
+    EXPECT_GT(st.merges, 1u);
+}
+
+TEST_F(IpfixTest, ThreadSendsTemplates) {
+    cfg.interval_ms = 20;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_ipfix_init(&ex, &cfg));
+    ASSERT_EQ(AD_TUN_OK, ad_tun_ipfix_start(&ex));
+
+    std::vector<Message> msgs = collect(1000);
+    ad_tun_ipfix_stop(&ex);
+    ASSERT_FALSE(msgs.empty());
+    EXPECT_EQ(2u, msgs[0].templates.size());
+}
+
+TEST(IpfixConfigTest, LoadsSection) {
+    ad_tun_ipfix_config_t c;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_ipfix_load_config("../../test_configs/ipfix.ini", &c));
+    EXPECT_STREQ(c.collector, "192.0.2.10");
+    EXPECT_EQ(c.port, 2055);
+    EXPECT_EQ(c.domain_id, 42u);
+    EXPECT_EQ(c.workers, 4u);
+    EXPECT_EQ(c.worker_flows, 8192u);
+    EXPECT_EQ(c.max_flows, 100000u);
+    EXPECT_EQ(c.active_timeout_ms, 30000u);
+    EXPECT_EQ(c.idle_timeout_ms, 5000u);
+    EXPECT_EQ(c.interval_ms, 500u);
+    EXPECT_EQ(c.sampling, 100u);
+    EXPECT_EQ(c.mtu, 1200u);
+
+    /* Out-of-range values fall back to the defaults */
+    ad_tun_ipfix_config_t d;
+    ad_tun_ipfix_default_config(&d);
+    ASSERT_EQ(AD_TUN_OK, ad_tun_ipfix_load_config("../../test_configs/ipfix_bad.ini", &c));
+    EXPECT_EQ(c.port, d.port);
+    EXPECT_EQ(c.workers, d.workers);
+    EXPECT_EQ(c.sampling, d.sampling);
+    EXPECT_EQ(c.mtu, d.mtu);
+}
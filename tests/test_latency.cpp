@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "ad_tun_latency.h"
+}
+
+class LatencyTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ad_tun_lat_reset();
+        hists.resize(AD_TUN_LAT_STAGES);
+    }
+
+    const ad_tun_lat_hist_t &snap(ad_tun_lat_stage_t stage) {
+        ad_tun_lat_snapshot(hists.data());
+        return hists[stage];
+    }
+
+    std::vector<ad_tun_lat_hist_t> hists;
+};
+
+TEST_F(LatencyTest, PercentilesWithinBucketPrecision) {
+    for (uint64_t v = 1; v <= 10000; v++) ad_tun_lat_record(AD_TUN_LAT_APP, v * 1000);
+
+    const ad_tun_lat_hist_t &h = snap(AD_TUN_LAT_APP);
+    EXPECT_EQ(10000u, h.count);
+    EXPECT_EQ(1000u, h.min_ns);
+    EXPECT_EQ(10000000u, h.max_ns);
+
+    const double pcts[] = { 50, 90, 99, 99.9 };
+    for (double p : pcts) {
+        double expect = p / 100.0 * 10000 * 1000;
+        double got = (double)ad_tun_lat_percentile(&h, p);
+        EXPECT_GE(got, expect * 0.99) << "p" << p;
+        EXPECT_LE(got, expect * (1.0 + 1.0 / 16) + 1000) << "p" << p;
+    }
+    EXPECT_EQ(10000000u, ad_tun_lat_percentile(&h, 100));
+}
+
+TEST_F(LatencyTest, SmallValuesAreExact) {
+    for (uint64_t v = 0; v < 32; v++) ad_tun_lat_record(AD_TUN_LAT_APP, v);
+
+    const ad_tun_lat_hist_t &h = snap(AD_TUN_LAT_APP);
+    EXPECT_EQ(32u, h.count);
+    EXPECT_EQ(0u, ad_tun_lat_percentile(&h, 1));
+    EXPECT_EQ(15u, ad_tun_lat_percentile(&h, 50));
+    EXPECT_EQ(31u, ad_tun_lat_percentile(&h, 100));
+}
+
+TEST_F(LatencyTest, MergesThreadsIncludingExited) {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([t] {
+            for (int i = 0; i < 1000; i++) ad_tun_lat_record(AD_TUN_LAT_READ, 100 * (t + 1));
+        });
+    }
+    for (auto &th : threads) th.join();
+    ad_tun_lat_record(AD_TUN_LAT_READ, 50);
+
+    const ad_tun_lat_hist_t &h = snap(AD_TUN_LAT_READ);
+    EXPECT_EQ(4001u, h.count);
+    EXPECT_EQ(50u, h.min_ns);
+    EXPECT_EQ(400u, h.max_ns);
+    EXPECT_EQ(1000u * (100 + 200 + 300 + 400) + 50, h.sum_ns);
+}
+
+TEST_F(LatencyTest, ResetAndMerge) {
+    ad_tun_lat_record(AD_TUN_LAT_WRITE, 10);
+    ad_tun_lat_reset();
+    EXPECT_EQ(0u, snap(AD_TUN_LAT_WRITE).count);
+
+    ad_tun_lat_record(AD_TUN_LAT_WRITE, 20);
+    ad_tun_lat_hist_t a = snap(AD_TUN_LAT_WRITE);
+    ad_tun_lat_hist_t b = a;
+    ad_tun_lat_merge(&a, &b);
+    EXPECT_EQ(2u, a.count);
+    EXPECT_EQ(40u, a.sum_ns);
+    EXPECT_EQ(20u, a.min_ns);
+}
+
+TEST_F(LatencyTest, TicksCalibrated) {
+    uint64_t t0 = ad_tun_lat_ticks();
+    struct timespec ts = { 0, 5000000 };
+    nanosleep(&ts, nullptr);
+    uint64_t ns = ad_tun_lat_ticks_to_ns(ad_tun_lat_ticks() - t0);
+
+    EXPECT_GE(ns, 4000000u);
+    EXPECT_LT(ns, 500000000u);
+    EXPECT_STREQ("gro", ad_tun_lat_stage_name(AD_TUN_LAT_GRO));
+}
@@ -0,0 +1,263 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+extern "C" {
+#include "ad_tun_mgr.h"
+}
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define MGR_TUNNELS 16
+
+/* True if ifname carries the IPv4 address addr */
+static bool has_ipv4(const char *ifname, const char *addr) {
+    struct ifaddrs *ifa = nullptr;
+    if (getifaddrs(&ifa) != 0) return false;
+
+    bool found = false;
+    for (struct ifaddrs *i = ifa; i; i = i->ifa_next) {
+        if (!i->ifa_addr || i->ifa_addr->sa_family != AF_INET || strcmp(i->ifa_name, ifname) != 0) continue;
+        char buf[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &((struct sockaddr_in *)i->ifa_addr)->sin_addr, buf, sizeof(buf));
+        if (strcmp(buf, addr) == 0) found = true;
+    }
+    freeifaddrs(ifa);
+    return found;
+}
+
+class MgrTest : public ::testing::Test {
+protected:
+    ad_tun_mgr_t mgr;
+
+    void SetUp() override {
+        ad_tun_mgr_config_t cfg;
+        ad_tun_mgr_default_config(&cfg);
+        cfg.threads = 4;
+        ASSERT_EQ(ad_tun_mgr_init(&mgr, &cfg), AD_TUN_OK);
+    }
+
+    void TearDown() override {
+        ad_tun_mgr_free(&mgr);
+    }
+
+    void declare(unsigned n) {
+        for (unsigned i = 0; i < n; i++) {
+            std::string name = "admgr" + std::to_string(i);
+            std::string ipv4 = "10.77." + std::to_string(i) + ".1/24";
+            ad_tun_config_t cfg;
+            memset(&cfg, 0, sizeof(cfg));
+            cfg.ifname = name.c_str();
+            cfg.ipv4 = ipv4.c_str();
+            cfg.mtu = 1400;
+            ASSERT_EQ(ad_tun_mgr_add(&mgr, &cfg), (int)i);
+        }
+    }
+
+    void start(unsigned n) {
+        int up = ad_tun_mgr_start_all(&mgr);
+        if (up <= 0) GTEST_SKIP() << "Skipping: TUN devices unavailable";
+        ASSERT_EQ(up, (int)n);
+    }
+};
+
+TEST_F(MgrTest, AddAndFind) {
+    declare(100);
+    EXPECT_EQ(mgr.count, 100u);
+    EXPECT_EQ(ad_tun_mgr_find(&mgr, "admgr42"), 42);
+    EXPECT_EQ(ad_tun_mgr_find(&mgr, "admgr100"), -1);
+
+    const ad_tun_mgr_tun_t *t = ad_tun_mgr_get(&mgr, 7);
+    ASSERT_NE(t, nullptr);
+    EXPECT_STREQ(t->cfg.ipv4, "10.77.7.1/24");
+    EXPECT_EQ(t->state, AD_TUN_MGR_DOWN);
+    EXPECT_EQ(t->fd, -1);
+    EXPECT_EQ(ad_tun_mgr_get(&mgr, 100), nullptr);
+}
+
+TEST_F(MgrTest, RejectsDuplicatesAndBadInput) {
+    declare(1);
+
+    ad_tun_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.ifname = "admgr0";
+    EXPECT_EQ(ad_tun_mgr_add(&mgr, &cfg), -EEXIST);
+
+    cfg.ifname = "this-name-is-too-long";
+    EXPECT_EQ(ad_tun_mgr_add(&mgr, &cfg), -EINVAL);
+
+    cfg.ifname = "admgrx";
+    cfg.ipv4 = "10.1.2.300/24";
+    EXPECT_EQ(ad_tun_mgr_add(&mgr, &cfg), -EINVAL);
+    EXPECT_EQ(mgr.count, 1u);
+}
+
+TEST_F(MgrTest, StartsAndConfiguresAll) {
+    declare(MGR_TUNNELS);
+    start(MGR_TUNNELS);
+
+    for (unsigned i = 0; i < MGR_TUNNELS; i++) {
+        const ad_tun_mgr_tun_t *t = ad_tun_mgr_get(&mgr, i);
+        EXPECT_EQ(t->state, AD_TUN_MGR_UP);
+        EXPECT_GE(t->fd, 0);
+        EXPECT_EQ(t->ifindex, (int)if_nametoindex(t->cfg.ifname));
+
+        std::string addr = "10.77." + std::to_string(i) + ".1";
+        EXPECT_TRUE(has_ipv4(t->cfg.ifname, addr.c_str())) << t->cfg.ifname;
+    }
+
+    ad_tun_mgr_stop_all(&mgr);
+    EXPECT_EQ(if_nametoindex("admgr0"), 0u);
+    EXPECT_EQ(ad_tun_mgr_get(&mgr, 0)->state, AD_TUN_MGR_DOWN);
+}
+
+TEST_F(MgrTest, SharedEpollReportsTunnel) {
+    declare(MGR_TUNNELS);
+    start(MGR_TUNNELS);
+
+    /* A datagram to a peer in the subnet of tunnel 5 leaves through its device */
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_GE(s, 0);
+    struct sockaddr_in dst;
+    memset(&dst, 0, sizeof(dst));
+    dst.sin_family = AF_INET;
+    dst.sin_port = htons(9999);
+    inet_pton(AF_INET, "10.77.5.2", &dst.sin_addr);
+    ASSERT_EQ(sendto(s, "ping", 4, 0, (struct sockaddr *)&dst, sizeof(dst)), 4);
+    close(s);
+
+    ad_tun_mgr_event_t ev[8];
+    bool seen = false;
+    for (int tries = 0; tries < 10 && !seen; tries++) {
+        int n = ad_tun_mgr_wait(&mgr, ev, 8, 100);
+        ASSERT_GE(n, 0);
+        for (int i = 0; i < n; i++) {
+            unsigned char buf[2048];
+            ssize_t r;
+            while ((r = ad_tun_mgr_read(&mgr, ev[i].tun, buf, sizeof(buf))) > 0) {
+                /* IPv6 router solicitations may show up as well */
+                if (ev[i].tun == 5 && (buf[0] >> 4) == 4 && buf[9] == IPPROTO_UDP) seen = true;
+            }
+            EXPECT_EQ(r, -EAGAIN);
+        }
+    }
+    EXPECT_TRUE(seen);
+}
+
+TEST_F(MgrTest, LoadsDirectory) {
+    char dir[] = "/tmp/ad_tun_mgr_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+
+    const char *names[] = { "b.ini", "a.ini", "ignored.txt" };
+    const char *ifnames[] = { "admgrb", "admgra", "admgrz" };
+    for (int i = 0; i < 3; i++) {
+        std::string path = std::string(dir) + "/" + names[i];
+        FILE *f = fopen(path.c_str(), "w");
+        ASSERT_NE(f, nullptr);
+        fprintf(f, "[ad_tun]\nifname = %s\nipv4 = 10.78.%d.1/24\nmtu = 1400\n", ifnames[i], i);
+        fclose(f);
+    }
+
+    EXPECT_EQ(ad_tun_mgr_load_dir(&mgr, dir), 2);
+    EXPECT_EQ(ad_tun_mgr_find(&mgr, "admgra"), 0);
+    EXPECT_EQ(ad_tun_mgr_find(&mgr, "admgrb"), 1);
+    EXPECT_EQ(ad_tun_mgr_find(&mgr, "admgrz"), -1);
+    EXPECT_LT(ad_tun_mgr_load_dir(&mgr, "/nonexistent/ad_tun"), 0);
+
+    for (int i = 0; i < 3; i++) {
+        std::string path = std::string(dir) + "/" + names[i];
+        unlink(path.c_str());
+    }
+    rmdir(dir);
+}
+
+TEST_F(MgrTest, RejectedConfigLeavesTunnelFailed) {
+    declare(2);
+    ad_tun_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.ifname = "admgrbad";
+    cfg.mtu = 1 << 20;                  /* above what the kernel accepts for TUN */
+    ASSERT_EQ(ad_tun_mgr_add(&mgr, &cfg), 2);
+
+    int up = ad_tun_mgr_start_all(&mgr);
+    if (up <= 0) GTEST_SKIP() << "Skipping: TUN devices unavailable";
+    EXPECT_EQ(up, 2);
+
+    const ad_tun_mgr_tun_t *t = ad_tun_mgr_get(&mgr, 2);
+    EXPECT_EQ(t->state, AD_TUN_MGR_FAILED);
+    EXPECT_EQ(t->fd, -1);
+    EXPECT_NE(t->err, 0);
+    EXPECT_EQ(ad_tun_mgr_get(&mgr, 0)->state, AD_TUN_MGR_UP);
+
+    ad_tun_mgr_stop_all(&mgr);
+    EXPECT_EQ(if_nametoindex("admgrbad"), 0u);
+}
+
+TEST_F(MgrTest, GroupTeardownRemovesAllDevices) {
+    ad_tun_mgr_free(&mgr);
+    ad_tun_mgr_config_t cfg;
+    ad_tun_mgr_default_config(&cfg);
+    cfg.group = 4242;
+    ASSERT_EQ(ad_tun_mgr_init(&mgr, &cfg), AD_TUN_OK);
+
+    declare(MGR_TUNNELS);
+    start(MGR_TUNNELS);
+
+    ad_tun_mgr_stop_all(&mgr);
+    for (unsigned i = 0; i < MGR_TUNNELS; i++) {
+        const ad_tun_mgr_tun_t *t = ad_tun_mgr_get(&mgr, i);
+        EXPECT_EQ(if_nametoindex(t->cfg.ifname), 0u) << t->cfg.ifname;
+        EXPECT_EQ(t->fd, -1);
+    }
+}
+
+TEST_F(MgrTest, GroupTeardownSparesForeignLinks) {
+    ad_tun_mgr_free(&mgr);
+    ad_tun_mgr_config_t cfg;
+    ad_tun_mgr_default_config(&cfg);
+    cfg.group = 4243;
+    ASSERT_EQ(ad_tun_mgr_init(&mgr, &cfg), AD_TUN_OK);
+
+    /* Another owner's link in the same group */
+    ad_tun_mgr_t other;
+    ASSERT_EQ(ad_tun_mgr_init(&other, &cfg), AD_TUN_OK);
+    ad_tun_config_t tcfg;
+    memset(&tcfg, 0, sizeof(tcfg));
+    tcfg.ifname = "admgrother";
+    ASSERT_EQ(ad_tun_mgr_add(&other, &tcfg), 0);
+    if (ad_tun_mgr_start_all(&other) != 1) {
+        ad_tun_mgr_free(&other);
+        GTEST_SKIP() << "Skipping: TUN devices unavailable";
+    }
+
+    declare(MGR_TUNNELS);
+    start(MGR_TUNNELS);
+    ad_tun_mgr_stop_all(&mgr);
+
+    EXPECT_EQ(if_nametoindex("admgr0"), 0u);
+    EXPECT_NE(if_nametoindex("admgrother"), 0u);
+    EXPECT_GE(ad_tun_mgr_get(&other, 0)->fd, 0);
+    ad_tun_mgr_free(&other);
+}
+
+TEST_F(MgrTest, LoadsMultiSectionFile) {
+    EXPECT_EQ(ad_tun_mgr_load_file(&mgr, "../../test_configs/multi.ini"), 2);
+    EXPECT_EQ(ad_tun_mgr_find(&mgr, "cust1"), 0);
+    EXPECT_EQ(ad_tun_mgr_find(&mgr, "ad_cust2"), 1);
+    EXPECT_EQ(ad_tun_mgr_get(&mgr, 0)->cfg.mtu, 1420);
+
+    /* Names are taken now */
+    EXPECT_EQ(ad_tun_mgr_load_file(&mgr, "../../test_configs/multi.ini"), 0);
+    EXPECT_EQ(ad_tun_mgr_load_file(&mgr, "../../test_configs/multi_missing_ipv4.ini"), -EINVAL);
+    EXPECT_EQ(mgr.count, 2u);
+}
@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "ad_tun_monitor.h"
+#include "ad_tun_mgr.h"
+#include "ad_tun_nl.h"
+}
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/socket.h>
+
+/* Events seen by the callback */
+struct EventLog {
+    std::mutex lock;
+    std::vector<ad_tun_mon_event_t> events;
+
+    bool seen(ad_tun_mon_event_type_t type) {
+        std::lock_guard<std::mutex> g(lock);
+        for (const auto &e : events) {
+            if (e.type == type) return true;
+        }
+        return false;
+    }
+};
+
+static void record_event(const ad_tun_mon_event_t *ev, void *arg) {
+    EventLog *log = static_cast<EventLog *>(arg);
+    std::lock_guard<std::mutex> g(log->lock);
+    log->events.push_back(*ev);
+}
+
+/* Poll cond for up to two seconds */
+static bool wait_for(const std::function<bool()> &cond) {
+    for (int i = 0; i < 200; i++) {
+        if (cond()) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return cond();
+}
+
+class MonitorTest : public ::testing::Test {
+protected:
+    ad_tun_mgr_t mgr;
+    ad_tun_mon_t mon;
+    ad_tun_config_t cfg;
+    EventLog log;
+    bool tun_up = false;
+
+    void SetUp() override {
+        memset(&cfg, 0, sizeof(cfg));
+        cfg.ifname = "admon0";
+        cfg.ipv4 = "10.79.0.1/24";
+        cfg.mtu = 1400;
+        ASSERT_EQ(ad_tun_mgr_init(&mgr, nullptr), AD_TUN_OK);
+        ASSERT_EQ(ad_tun_mgr_add(&mgr, &cfg), 0);
+    }
+
+    void TearDown() override {
+        ad_tun_mon_free(&mon);
+        ad_tun_mgr_free(&mgr);
+    }
+
+    void start(int repair, bool create = true) {
+        if (create) {
+            if (ad_tun_mgr_start_all(&mgr) != 1) GTEST_SKIP() << "Skipping: TUN devices unavailable";
+            tun_up = true;
+        }
+        ad_tun_mon_config_t mcfg;
+        memset(&mcfg, 0, sizeof(mcfg));
+        mcfg.cb = record_event;
+        mcfg.arg = &log;
+        mcfg.repair = repair;
+        ASSERT_EQ(ad_tun_mon_init(&mon, &mcfg), AD_TUN_OK);
+        ASSERT_EQ(ad_tun_mon_watch(&mon, &cfg), 0);
+        if (ad_tun_mon_start(&mon) != AD_TUN_OK) GTEST_SKIP() << "Skipping: rtnetlink unavailable";
+    }
+
+    ad_tun_mon_status_t status() {
+        ad_tun_mon_status_t st;
+        EXPECT_EQ(ad_tun_mon_status(&mon, "admon0", &st), 0);
+        return st;
+    }
+
+    /* Take the link down, drop its address and change its MTU */
+    void break_config() {
+        ad_tun_nl_t nl;
+        ASSERT_EQ(ad_tun_nl_open(&nl), AD_TUN_OK);
+        int ifindex = (int)if_nametoindex("admon0");
+        unsigned char addr[16] = { 10, 79, 0, 1 };
+        ad_tun_nl_addr(&nl, 0, ifindex, AF_INET, addr, 24);
+        ad_tun_nl_link_set(&nl, ifindex, 1300, 0);
+        EXPECT_EQ(ad_tun_nl_commit(&nl, nullptr, nullptr), 0);
+        ad_tun_nl_close(&nl);
+    }
+};
+
+TEST_F(MonitorTest, InitialStateFromDump) {
+    start(0);
+
+    ad_tun_mon_status_t st = status();
+    EXPECT_EQ(st.ifindex, (int)if_nametoindex("admon0"));
+    EXPECT_EQ(st.up, 1);
+    EXPECT_EQ(st.mtu, 1400u);
+    EXPECT_EQ(st.has_ipv4, 1);
+    EXPECT_EQ(st.has_ipv6, 0);
+
+    ad_tun_mon_status_t none;
+    EXPECT_EQ(ad_tun_mon_status(&mon, "nonexistent0", &none), -ENOENT);
+}
+
+TEST_F(MonitorTest, ReportsExternalChanges) {
+    start(0);
+    break_config();
+
+    ASSERT_TRUE(wait_for([&] { return log.seen(AD_TUN_MON_LINK_DOWN); }));
+    ASSERT_TRUE(wait_for([&] { return log.seen(AD_TUN_MON_ADDR_DEL); }));
+    ASSERT_TRUE(wait_for([&] { return log.seen(AD_TUN_MON_MTU); }));
+
+    ad_tun_mon_status_t st = status();
+    EXPECT_EQ(st.up, 0);
+    EXPECT_EQ(st.has_ipv4, 0);
+    EXPECT_EQ(st.mtu, 1300u);
+    EXPECT_EQ(st.repairs, 0u);
+    EXPECT_FALSE(log.seen(AD_TUN_MON_REPAIRED));
+}
+
+TEST_F(MonitorTest, RepairsWatchedLink) {
+    start(1);
+    break_config();
+
+    EXPECT_TRUE(wait_for([&] {
+        ad_tun_mon_status_t st = status();
+        return st.up && st.has_ipv4 && st.mtu == 1400;
+    }));
+    EXPECT_TRUE(log.seen(AD_TUN_MON_REPAIRED));
+    EXPECT_GT(status().repairs, 0u);
+}
+
+TEST_F(MonitorTest, ReportsCreationAndRemoval) {
+    start(0, false);
+    if (HasFatalFailure() || IsSkipped()) return;
+    EXPECT_EQ(status().ifindex, 0);
+
+    if (ad_tun_mgr_start_all(&mgr) != 1) GTEST_SKIP() << "Skipping: TUN devices unavailable";
+    ASSERT_TRUE(wait_for([&] { return log.seen(AD_TUN_MON_LINK_NEW); }));
+    EXPECT_TRUE(wait_for([&] { return status().has_ipv4 == 1; }));
+
+    ad_tun_mgr_stop_all(&mgr);
+    ASSERT_TRUE(wait_for([&] { return log.seen(AD_TUN_MON_LINK_DEL); }));
+    EXPECT_EQ(status().ifindex, 0);
+
+    EXPECT_EQ(ad_tun_mon_unwatch(&mon, "admon0"), 0);
+    EXPECT_EQ(ad_tun_mon_unwatch(&mon, "admon0"), -ENOENT);
+}
@@ -0,0 +1,377 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include "ad_tun_nat.h"
+#include "ad_tun_pkt.h"
+}
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+static const uint64_t kSec = 1000000000ULL;
+
+/* Ones' complement sum of the pseudo header and L4 data of an IPv4 or IPv6 packet */
+static uint16_t l4_csum(const unsigned char *p, size_t len) {
+    uint32_t sum;
+    size_t l3;
+    uint8_t proto;
+    if ((p[0] >> 4) == 4) {
+        l3 = (size_t)(p[0] & 0x0f) * 4;
+        proto = p[9];
+        sum = ad_tun_csum_partial(p + 12, 8, 0);
+    } else {
+        l3 = 40;
+        proto = p[6];
+        sum = ad_tun_csum_partial(p + 8, 32, 0);
+    }
+    if (proto != IPPROTO_ICMP) {
+        sum += proto;
+        sum += (uint32_t)(len - l3);
+    } else {
+        sum = 0;
+    }
+    return ad_tun_csum_fold(ad_tun_csum_partial(p + l3, len - l3, sum));
+}
+
+static size_t csum_off(uint8_t proto) {
+    return proto == IPPROTO_TCP ? 16 : (proto == IPPROTO_UDP ? 6 : 2);
+}
+
+/* IPv4 packet with valid checksums; ICMP carries an echo request or reply */
+static std::vector<unsigned char> ip4(const char *src, const char *dst, uint8_t proto,
+                                      uint16_t sport, uint16_t dport, uint8_t tcp_flags = 0x10) {
+    size_t l4 = proto == IPPROTO_TCP ? 20 : 8;
+    std::vector<unsigned char> p(20 + l4 + 12, 0);
+    p[0] = 0x45;
+    ad_tun_put_be16(&p[2], (uint16_t)p.size());
+    p[8] = 64;
+    p[9] = proto;
+    inet_pton(AF_INET, src, &p[12]);
+    inet_pton(AF_INET, dst, &p[16]);
+    ad_tun_ipv4_set_csum(&p[0]);
+
+    unsigned char *h = &p[20];
+    if (proto == IPPROTO_ICMP) {
+        h[0] = (uint8_t)sport;              /* type */
+        ad_tun_put_be16(h + 4, dport);      /* id */
+    } else {
+        ad_tun_put_be16(h, sport);
+        ad_tun_put_be16(h + 2, dport);
+        if (proto == IPPROTO_UDP) ad_tun_put_be16(h + 4, (uint16_t)(p.size() - 20));
+        else { h[12] = 5 << 4; h[13] = tcp_flags; }
+    }
+    for (size_t i = 20 + l4; i < p.size(); i++) p[i] = (unsigned char)i;
+    ad_tun_put_be16(h + csum_off(proto), l4_csum(&p[0], p.size()));
+    return p;
+}
+
+static bool csums_ok(const unsigned char *p, size_t len) {
+    if ((p[0] >> 4) == 4 && ad_tun_csum_fold(ad_tun_csum_partial(p, 20, 0)) != 0) return false;
+    return l4_csum(p, len) == 0;
+}
+
+static std::string addr4(const unsigned char *a) {
+    char s[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, a, s, sizeof(s));
+    return s;
+}
+
+class NatTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ad_tun_nat_default_config(&cfg);
+        cfg.enabled = 1;
+        cfg.naddrs = 1;
+        inet_pton(AF_INET, "198.51.100.1", cfg.addrs[0]);
+        cfg.shards = 1;
+    }
+
+    void TearDown() override { ad_tun_nat_free(&nat); }
+
+    /* Run one packet through out or in; returns false if it was dropped */
+    bool run(std::vector<unsigned char> &p, bool out, uint64_t now = kSec) {
+        ad_tun_buf_t b;
+        memset(&b, 0, sizeof(b));
+        b.data = &p[0];
+        b.len = p.size();
+        ad_tun_buf_t *bufs[1] = { &b }, *drops = nullptr;
+        unsigned k = out ? ad_tun_nat_out(&nat, bufs, 1, now, &drops)
+                         : ad_tun_nat_in(&nat, bufs, 1, now, &drops);
+        EXPECT_EQ(k == 0, drops == &b);
+        return k == 1;
+    }
+
+    ad_tun_nat_config_t cfg;
+    ad_tun_nat_t nat{};
+};
+
+TEST_F(NatTest, LoadsConfig) {
+    ad_tun_nat_config_t c;
+    ASSERT_EQ(ad_tun_nat_load_config("../../test_configs/nat.ini", &c), AD_TUN_OK);
+    EXPECT_EQ(c.enabled, 1);
+    EXPECT_EQ(c.naddrs, 3u);
+    EXPECT_EQ(addr4(c.addrs[2]), "198.51.100.3");
+    EXPECT_EQ(addr4(c.internal), "10.10.0.0");
+    EXPECT_EQ(c.internal_plen, 16);
+    EXPECT_EQ(c.port_lo, 20000);
+    EXPECT_EQ(c.port_hi, 29999);
+    EXPECT_EQ(c.udp_timeout, 60u);
+    EXPECT_EQ(c.tcp_transitory_timeout, 30u);
+    EXPECT_EQ(c.tcp_timeout, 7440u);
+    EXPECT_EQ(c.shards, 4u);
+    EXPECT_EQ(c.nptv6, 1);
+    EXPECT_EQ(c.npt_plen, 48);
+
+    EXPECT_EQ(ad_tun_nat_load_config("../../test_configs/nat_bad.ini", &c), AD_TUN_ERR_CONFIG);
+    EXPECT_EQ(ad_tun_nat_load_config("../../test_configs/nonexistent.ini", &c), AD_TUN_ERR_CONFIG);
+
+    /* No [nat] section: defaults, disabled */
+    ASSERT_EQ(ad_tun_nat_load_config("../../test_configs/good.ini", &c), AD_TUN_OK);
+    EXPECT_EQ(c.enabled, 0);
+    EXPECT_EQ(c.naddrs, 0u);
+
+    ASSERT_EQ(ad_tun_nat_load_config("../../test_configs/nat.ini", &c), AD_TUN_OK);
+    ASSERT_EQ(ad_tun_nat_init(&nat, &c), AD_TUN_OK);
+    EXPECT_EQ(nat.ports_per_shard, 2500u);
+}
+
+TEST_F(NatTest, RejectsBadConfig) {
+    cfg.port_lo = 5000;
+    cfg.port_hi = 4000;
+    EXPECT_EQ(ad_tun_nat_init(&nat, &cfg), AD_TUN_ERR_CONFIG);
+    ad_tun_nat_default_config(&cfg);
+    cfg.shards = 0;
+    EXPECT_EQ(ad_tun_nat_init(&nat, &cfg), AD_TUN_ERR_CONFIG);
+}
+
+TEST_F(NatTest, UdpAndTcpRoundTrip) {
+    ASSERT_EQ(ad_tun_nat_init(&nat, &cfg), AD_TUN_OK);
+
+    for (uint8_t proto : { (uint8_t)IPPROTO_UDP, (uint8_t)IPPROTO_TCP }) {
+        auto p = ip4("10.10.0.5", "203.0.113.9", proto, 40000, 53);
+        ASSERT_TRUE(run(p, true));
+        EXPECT_EQ(addr4(&p[12]), "198.51.100.1");
+        EXPECT_EQ(ad_tun_get_be16(&p[20]), 40000);  /* Free, so preserved */
+        EXPECT_TRUE(csums_ok(&p[0], p.size()));
+
+        auto r = ip4("203.0.113.9", "198.51.100.1", proto, 53, 40000);
+        ASSERT_TRUE(run(r, false));
+        EXPECT_EQ(addr4(&r[16]), "10.10.0.5");
+        EXPECT_EQ(ad_tun_get_be16(&r[22]), 40000);
+        EXPECT_TRUE(csums_ok(&r[0], r.size()));
+    }
+
+    ad_tun_nat_stats_t st;
+    ad_tun_nat_get_stats(&nat, &st);
+    EXPECT_EQ(st.out, 2u);
+    EXPECT_EQ(st.in, 2u);
+    EXPECT_EQ(st.created, 2u);
+    EXPECT_EQ(st.mappings, 2u);
+}
+
+TEST_F(NatTest, IcmpEchoAndUdpWithoutChecksum) {
+    ASSERT_EQ(ad_tun_nat_init(&nat, &cfg), AD_TUN_OK);
+
+    auto p = ip4("10.10.0.5", "203.0.113.9", IPPROTO_ICMP, 8, 77);
+    ASSERT_TRUE(run(p, true));
+    EXPECT_EQ(addr4(&p[12]), "198.51.100.1");
+    EXPECT_EQ(ad_tun_get_be16(&p[24]), 1024);  /* Id 77 is outside the range */
+    EXPECT_TRUE(csums_ok(&p[0], p.size()));
+
+    auto r = ip4("203.0.113.9", "198.51.100.1", IPPROTO_ICMP, 0, 1024);
+    ASSERT_TRUE(run(r, false));
+    EXPECT_EQ(addr4(&r[16]), "10.10.0.5");
+    EXPECT_EQ(ad_tun_get_be16(&r[24]), 77);
+    EXPECT_TRUE(csums_ok(&r[0], r.size()));
+
+    /* A zero UDP checksum stays zero */
+    auto u = ip4("10.10.0.5", "203.0.113.9", IPPROTO_UDP, 5000, 53);
+    u[26] = u[27] = 0;
+    ASSERT_TRUE(run(u, true));
+    EXPECT_EQ(u[26] | u[27], 0);
+
+    /* Other ICMP and fragments are dropped on the way out */
+    auto t = ip4("10.10.0.5", "203.0.113.9", IPPROTO_ICMP, 13, 1);
+    EXPECT_FALSE(run(t, true));
+    auto f = ip4("10.10.0.5", "203.0.113.9", IPPROTO_UDP, 5001, 53);
+    f[6] = 0x20;  /* MF */
+    ad_tun_ipv4_set_csum(&f[0]);
+    EXPECT_FALSE(run(f, true));
+}
+
+TEST_F(NatTest, AllocatesAndExhaustsPorts) {
+    cfg.port_lo = 2000;
+    cfg.port_hi = 2002;
+    ASSERT_EQ(ad_tun_nat_init(&nat, &cfg), AD_TUN_OK);
+
+    const char *hosts[] = { "10.10.0.1", "10.10.0.2", "10.10.0.3", "10.10.0.4" };
+    uint16_t got[3];
+    for (int i = 0; i < 3; i++) {
+        auto p = ip4(hosts[i], "203.0.113.9", IPPROTO_UDP, 2001, 53);
+        ASSERT_TRUE(run(p, true, kSec + i));
+        got[i] = ad_tun_get_be16(&p[20]);
+    }
+    EXPECT_EQ(got[0], 2001);
+    EXPECT_NE(got[1], got[0]);
+    EXPECT_NE(got[2], got[0]);
+    EXPECT_NE(got[2], got[1]);
+
+    /* Same flow again reuses its mapping */
+    auto again = ip4(hosts[1], "198.18.0.1", IPPROTO_UDP, 2001, 443);
+    ASSERT_TRUE(run(again, true, 2 * kSec));
+    EXPECT_EQ(ad_tun_get_be16(&again[20]), got[1]);
+
+    auto p = ip4(hosts[3], "203.0.113.9", IPPROTO_UDP, 2001, 53);
+    EXPECT_FALSE(run(p, true, 3 * kSec));
+
+    /* TCP has its own ports */
+    auto t = ip4(hosts[3], "203.0.113.9", IPPROTO_TCP, 2001, 80);
+    EXPECT_TRUE(run(t, true, 3 * kSec));
+
+    ad_tun_nat_stats_t st;
+    ad_tun_nat_get_stats(&nat, &st);
+    EXPECT_EQ(st.exhausted, 1u);
+    EXPECT_EQ(st.mappings, 4u);
+
+    /* Once the UDP timeout passes a new host gets a port, reclaimed on demand */
+    uint64_t later = 2 * kSec + (uint64_t)cfg.udp_timeout * kSec;
+    auto q = ip4(hosts[3], "203.0.113.9", IPPROTO_UDP, 2001, 53);
+    EXPECT_TRUE(run(q, true, later));
+    ad_tun_nat_get_stats(&nat, &st);
+    /* hosts[0] and hosts[2], plus the unanswered TCP mapping; hosts[1] was refreshed */
+    EXPECT_EQ(st.expired, 3u);
+
+    EXPECT_EQ(ad_tun_nat_expire(&nat, later + (uint64_t)(cfg.udp_timeout + 1) * kSec), 2u);
+    ad_tun_nat_get_stats(&nat, &st);
+    EXPECT_EQ(st.mappings, 0u);
+}
+
+TEST_F(NatTest, ExpireIgnoresClockBehindMapping) {
+    ASSERT_EQ(ad_tun_nat_init(&nat, &cfg), AD_TUN_OK);
+
+    auto p = ip4("10.10.0.5", "203.0.113.9", IPPROTO_UDP, 5001, 53);
+    ASSERT_TRUE(run(p, true, 10 * kSec));
+
+    /* A caller whose clock lags the packet's must not wrap into expiry */
+    EXPECT_EQ(ad_tun_nat_expire(&nat, 9 * kSec), 0u);
+    ad_tun_nat_stats_t st;
+    ad_tun_nat_get_stats(&nat, &st);
+    EXPECT_EQ(st.mappings, 1u);
+}
+
+TEST_F(NatTest, TcpTimeoutFollowsState) {
+    ASSERT_EQ(ad_tun_nat_init(&nat, &cfg), AD_TUN_OK);
+    uint64_t trans = (uint64_t)cfg.tcp_transitory_timeout * kSec;
+
+    /* Unanswered: transitory timeout */
+    auto syn = ip4("10.10.0.5", "203.0.113.9", IPPROTO_TCP, 3000, 80, 0x02);
+    ASSERT_TRUE(run(syn, true, kSec));
+    EXPECT_EQ(ad_tun_nat_expire(&nat, 2 * kSec + trans), 1u);
+
+    /* Answered: established timeout */
+    syn = ip4("10.10.0.5", "203.0.113.9", IPPROTO_TCP, 3000, 80, 0x02);
+    ASSERT_TRUE(run(syn, true, 10 * trans));
+    auto synack = ip4("203.0.113.9", "198.51.100.1", IPPROTO_TCP, 80, 3000, 0x12);
+    ASSERT_TRUE(run(synack, false, 10 * trans));
+    EXPECT_EQ(ad_tun_nat_expire(&nat, 12 * trans), 0u);
+
+    /* FIN: back to transitory */
+    auto fin = ip4("10.10.0.5", "203.0.113.9", IPPROTO_TCP, 3000, 80, 0x11);
+    ASSERT_TRUE(run(fin, true, 12 * trans));
+    EXPECT_EQ(ad_tun_nat_expire(&nat, 14 * trans), 1u);
+
+    /* Returning traffic without a mapping passes untouched */
+    auto stray = ip4("203.0.113.9", "198.51.100.1", IPPROTO_TCP, 80, 3000);
+    auto orig = stray;
+    ASSERT_TRUE(run(stray, false, 14 * trans));
+    EXPECT_EQ(stray, orig);
+    ad_tun_nat_stats_t st;
+    ad_tun_nat_get_stats(&nat, &st);
+    EXPECT_EQ(st.no_mapping, 1u);
+}
+
+TEST_F(NatTest, TranslatesQuotedPacketOfIcmpError) {
+    ASSERT_EQ(ad_tun_nat_init(&nat, &cfg), AD_TUN_OK);
+
+    for (uint8_t proto : { (uint8_t)IPPROTO_UDP, (uint8_t)IPPROTO_TCP }) {
+        auto p = ip4("10.10.0.5", "203.0.113.9", proto, 6000, 53);
+        ASSERT_TRUE(run(p, true));
+
+        /* Port unreachable from a router, quoting the translated packet */
+        std::vector<unsigned char> e(20 + 8, 0);
+        e.insert(e.end(), p.begin(), p.end());
+        e[0] = 0x45;
+        ad_tun_put_be16(&e[2], (uint16_t)e.size());
+        e[8] = 64;
+        e[9] = IPPROTO_ICMP;
+        inet_pton(AF_INET, "192.0.2.1", &e[12]);
+        inet_pton(AF_INET, "198.51.100.1", &e[16]);
+        ad_tun_ipv4_set_csum(&e[0]);
+        e[20] = 3;
+        e[21] = 3;
+        ad_tun_put_be16(&e[22], ad_tun_csum_fold(ad_tun_csum_partial(&e[20], e.size() - 20, 0)));
+
+        ASSERT_TRUE(run(e, false));
+        EXPECT_EQ(addr4(&e[16]), "10.10.0.5");
+        EXPECT_EQ(ad_tun_csum_fold(ad_tun_csum_partial(&e[0], 20, 0)), 0);
+        EXPECT_EQ(ad_tun_csum_fold(ad_tun_csum_partial(&e[20], e.size() - 20, 0)), 0);
+
+        const unsigned char *in = &e[28];
+        EXPECT_EQ(addr4(in + 12), "10.10.0.5");
+        EXPECT_EQ(ad_tun_get_be16(in + 20), 6000);
+        EXPECT_TRUE(csums_ok(in, e.size() - 28));
+    }
+
+    ad_tun_nat_stats_t st;
+    ad_tun_nat_get_stats(&nat, &st);
+    EXPECT_EQ(st.icmp_errors, 2u);
+}
+
+TEST_F(NatTest, Nptv6IsChecksumNeutral) {
+    cfg.naddrs = 0;
+    cfg.nptv6 = 1;
+    inet_pton(AF_INET6, "fd01:203:405::", cfg.npt_internal);
+    inet_pton(AF_INET6, "2001:db8:1::", cfg.npt_external);
+    cfg.npt_plen = 48;
+    ASSERT_EQ(ad_tun_nat_init(&nat, &cfg), AD_TUN_OK);
+
+    std::vector<unsigned char> p(40 + 8 + 16, 0);
+    p[0] = 0x60;
+    ad_tun_put_be16(&p[4], 24);
+    p[6] = IPPROTO_UDP;
+    p[7] = 64;
+    inet_pton(AF_INET6, "fd01:203:405:77::1", &p[8]);
+    inet_pton(AF_INET6, "2001:db8:ffff::2", &p[24]);
+    ad_tun_put_be16(&p[40], 1234);
+    ad_tun_put_be16(&p[42], 53);
+    ad_tun_put_be16(&p[44], 24);
+    for (size_t i = 48; i < p.size(); i++) p[i] = (unsigned char)i;
+    ad_tun_put_be16(&p[46], l4_csum(&p[0], p.size()));
+    auto orig = p;
+
+    ASSERT_TRUE(run(p, true));
+    char s[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, &p[8], s, sizeof(s));
+    EXPECT_EQ(std::string(s).rfind("2001:db8:1:", 0), 0u) << s;
+    EXPECT_EQ(memcmp(&p[16], &orig[16], 8), 0);  /* Interface id untouched */
+    EXPECT_EQ(memcmp(&p[40], &orig[40], p.size() - 40), 0);  /* L4 checksum untouched... */
+    EXPECT_TRUE(csums_ok(&p[0], p.size()));                   /* ...and still right */
+
+    /* The reply maps back to the original address */
+    std::vector<unsigned char> r = p;
+    memcpy(&r[8], &p[24], 16);
+    memcpy(&r[24], &p[8], 16);
+    ASSERT_TRUE(run(r, false));
+    EXPECT_EQ(memcmp(&r[24], &orig[8], 16), 0);
+
+    /* Other prefixes pass */
+    auto other = orig;
+    inet_pton(AF_INET6, "fd99::1", &other[8]);
+    auto keep = other;
+    ASSERT_TRUE(run(other, true));
+    EXPECT_EQ(other, keep);
+}
@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+
+extern "C" {
+#include "ad_tun_numa.h"
+#include "ad_tun_pool.h"
+#include "ad_tun_gro.h"
+#include "ad_tun_wq.h"
+}
+
+TEST(NumaTest, FindsNodes) {
+    int nodes = ad_tun_numa_nodes();
+    ASSERT_GE(nodes, 1);
+
+    int here = ad_tun_numa_node_of_cpu(-1);
+    EXPECT_GE(here, 0);
+    EXPECT_LT(here, nodes);
+    EXPECT_EQ(ad_tun_numa_node_of_cpu(1 << 20), -ENOENT);
+
+    /* Loopback has no device behind it */
+    EXPECT_EQ(ad_tun_numa_node_of_dev("lo"), -ENOENT);
+    EXPECT_EQ(ad_tun_numa_node_of_dev("adnonexist0"), -ENODEV);
+    EXPECT_EQ(ad_tun_numa_node_of_dev("../lo"), -EINVAL);
+    EXPECT_EQ(ad_tun_numa_node_of_dev(nullptr), -EINVAL);
+}
+
+TEST(NumaTest, AllocatesOnLocalNode) {
+    ad_tun_mem_config_t cfg = { AD_TUN_NUMA_LOCAL, AD_TUN_MEM_STRICT };
+    ad_tun_mem_t m;
+    ASSERT_EQ(ad_tun_mem_alloc(&m, 100000, &cfg), AD_TUN_OK);
+
+    EXPECT_GE(m.len, 100000u);
+    EXPECT_EQ(m.huge, 0);
+    int node = ad_tun_numa_node_of_addr(m.ptr);
+    if (node == -ENOSYS) GTEST_SKIP() << "Skipping: kernel without NUMA support";
+    EXPECT_EQ(node, m.node);
+    EXPECT_EQ(ad_tun_numa_node_of_addr((char*)m.ptr + m.len - 1), m.node);
+
+    /* Zeroed like calloc */
+    const unsigned char *p = (const unsigned char*)m.ptr;
+    for (size_t i = 0; i < m.len; i += 4096) ASSERT_EQ(p[i], 0);
+
+    ad_tun_mem_free(&m);
+    EXPECT_EQ(m.ptr, nullptr);
+    ad_tun_mem_free(&m);
+}
+
+TEST(NumaTest, RejectsMissingNode) {
+    ad_tun_mem_t m;
+    ad_tun_mem_config_t cfg = { ad_tun_numa_nodes(), 0 };
+    EXPECT_EQ(ad_tun_mem_alloc(&m, 4096, &cfg), AD_TUN_ERR_CONFIG);
+    cfg.node = -3;
+    EXPECT_EQ(ad_tun_mem_alloc(&m, 4096, &cfg), AD_TUN_ERR_CONFIG);
+    EXPECT_EQ(ad_tun_mem_alloc(&m, 0, nullptr), AD_TUN_ERR_CONFIG);
+
+    /* No placement at all is plain anonymous memory */
+    ASSERT_EQ(ad_tun_mem_alloc(&m, 1, nullptr), AD_TUN_OK);
+    EXPECT_EQ(m.node, -1);
+    ad_tun_mem_free(&m);
+}
+
+TEST(NumaTest, HugepagesOrFallback) {
+    ad_tun_mem_config_t cfg = { 0, AD_TUN_MEM_HUGE };
+    ad_tun_mem_t m;
+    ASSERT_EQ(ad_tun_mem_alloc(&m, 3 << 20, &cfg), AD_TUN_OK);
+
+    /* Either reserved hugetlb pages or a THP-aligned mapping */
+    EXPECT_EQ(m.len, (size_t)4 << 20);
+    EXPECT_EQ((uintptr_t)m.ptr & ((2 << 20) - 1), 0u);
+    EXPECT_NE(m.huge, 0);
+    EXPECT_EQ(m.node, 0);
+    memset(m.ptr, 0xab, m.len);
+
+    ad_tun_mem_free(&m);
+}
+
+TEST(NumaTest, PoolLivesInOneMapping) {
+    ad_tun_mem_config_t cfg = { AD_TUN_NUMA_LOCAL, 0 };
+    ad_tun_pool_t pool;
+    ASSERT_EQ(ad_tun_pool_init_numa(&pool, 256, 2048, 64, &cfg), AD_TUN_OK);
+
+    const char *lo = (const char*)pool.map.ptr;
+    const char *hi = lo + pool.map.len;
+    EXPECT_GE((const char*)pool.bufs, lo);
+    EXPECT_LE((const char*)pool.mem + pool.mem_len, hi);
+
+    ad_tun_buf_t *b[256];
+    ASSERT_EQ(ad_tun_pool_get_bulk(&pool, b, 256), 256u);
+    for (unsigned i = 0; i < 256; i++) {
+        EXPECT_GE((const char*)b[i]->head, lo);
+        EXPECT_LE((const char*)b[i]->head + b[i]->size, hi);
+        EXPECT_EQ((uintptr_t)b[i]->head % 64, 0u);
+        EXPECT_EQ(ad_tun_buf_headroom(b[i]), 64u);
+    }
+    EXPECT_EQ(ad_tun_pool_get(&pool), nullptr);
+    ad_tun_pool_put_bulk(&pool, b, 256);
+    EXPECT_EQ(ad_tun_pool_available(&pool), 256u);
+
+    ad_tun_pool_free(&pool);
+}
+
+TEST(NumaTest, StagesAcceptPlacement) {
+    ad_tun_mem_config_t mem = { AD_TUN_NUMA_LOCAL, AD_TUN_MEM_HUGE };
+
+    ad_tun_gro_config_t gcfg = { 16, 64, 0, 0, 0, &mem };
+    ad_tun_gro_t gro;
+    ASSERT_EQ(ad_tun_gro_init(&gro, &gcfg), AD_TUN_OK);
+    EXPECT_NE(gro.flows_map.ptr, nullptr);
+    EXPECT_NE(gro.pool.map.ptr, nullptr);
+    ad_tun_gro_free(&gro);
+
+    ad_tun_wq_config_t wcfg;
+    ad_tun_wq_default_config(&wcfg);
+    wcfg.mem = &mem;
+    ad_tun_wq_t wq;
+    ASSERT_EQ(ad_tun_wq_init(&wq, &wcfg), AD_TUN_OK);
+    EXPECT_NE(wq.pool.map.ptr, nullptr);
+    ad_tun_wq_free(&wq);
+}
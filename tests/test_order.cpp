@@ -0,0 +1,256 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "ad_tun_order.h"
+#include "ad_tun_pkt.h"
+#include "ad_tun_pool.h"
+}
+
+#include "test_packets.h"
+
+/* UDP packet of flow (10.0.0.1:sport -> 10.0.1.1:53) carrying seq */
+static void udp_pkt(ad_tun_buf_t *b, uint16_t sport, uint32_t seq) {
+    ad_tun_put_be32(test_udp4(b, 0x0a000001u, 0x0a000101u, sport, 53, 32), seq);
+}
+
+static uint16_t sport_of(const ad_tun_buf_t *b) { return ad_tun_get_be16(b->data + 20); }
+static uint32_t seq_of(const ad_tun_buf_t *b) { return ad_tun_get_be32(b->data + 28); }
+
+class OrderTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ASSERT_EQ(AD_TUN_OK, ad_tun_pool_init(&pool, 4096, 256, 0));
+        ad_tun_order_default_config(&cfg);
+    }
+
+    void TearDown() override {
+        ad_tun_order_free(&ord);
+        ad_tun_pool_free(&pool);
+    }
+
+    ad_tun_buf_t *pkt(uint16_t sport, uint32_t seq) {
+        ad_tun_buf_t *b = ad_tun_pool_get(&pool);
+        udp_pkt(b, sport, seq);
+        return b;
+    }
+
+    /* Worker that got the single packet of sport, found by dispatching one */
+    unsigned worker_of(uint16_t sport) {
+        ad_tun_buf_t *b = pkt(sport, 0);
+        EXPECT_EQ(1u, ad_tun_order_dispatch(&ord, &b, 1));
+        for (unsigned w = 0; w < cfg.workers; w++) {
+            ad_tun_buf_t *got;
+            if (ad_tun_order_dequeue(&ord, w, &got, 1) == 1) {
+                ad_tun_order_done(&ord, w, 1);
+                ad_tun_pool_put(&pool, got);
+                return w;
+            }
+        }
+        return ~0u;
+    }
+
+    ad_tun_pool_t pool;
+    ad_tun_order_config_t cfg;
+    ad_tun_order_t ord = {};
+};
+
+TEST_F(OrderTest, InvalidConfigRejected) {
+    cfg.workers = 0;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_order_init(&ord, &cfg));
+    cfg.workers = AD_TUN_ORDER_MAX_WORKERS + 1;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_order_init(&ord, &cfg));
+    cfg.workers = 2;
+    cfg.depth = 0;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_order_init(&ord, &cfg));
+}
+
+TEST_F(OrderTest, FlowStaysOnOneWorkerInOrder) {
+    cfg.rebalance = 0;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_order_init(&ord, &cfg));
+
+    std::vector<ad_tun_buf_t *> in;
+    for (uint32_t seq = 0; seq < 50; seq++) {
+        for (uint16_t f = 0; f < 16; f++) in.push_back(pkt((uint16_t)(1000 + f), seq));
+    }
+    ASSERT_EQ(in.size(), ad_tun_order_dispatch(&ord, in.data(), (unsigned)in.size()));
+
+    int owner[16];
+    uint32_t next[16] = {0};
+    for (int &o : owner) o = -1;
+    unsigned total = 0;
+    for (unsigned w = 0; w < cfg.workers; w++) {
+        ad_tun_buf_t *out[1024];
+        unsigned n = ad_tun_order_dequeue(&ord, w, out, 1024);
+        for (unsigned i = 0; i < n; i++) {
+            unsigned f = sport_of(out[i]) - 1000u;
+            if (owner[f] < 0) owner[f] = (int)w;
+            EXPECT_EQ(owner[f], (int)w);
+            EXPECT_EQ(next[f]++, seq_of(out[i]));
+        }
+        ad_tun_order_done(&ord, w, n);
+        ad_tun_pool_put_bulk(&pool, out, n);
+        total += n;
+    }
+    EXPECT_EQ(total, in.size());
+
+    ad_tun_order_stats_t st;
+    ad_tun_order_get_stats(&ord, &st);
+    EXPECT_EQ(st.dispatched, in.size());
+    EXPECT_EQ(st.completed, in.size());
+}
+
+TEST_F(OrderTest, BusyFlowStaysIdleFlowsMove) {
+    cfg.workers = 2;
+    cfg.buckets = 64;
+    cfg.rebalance = 2;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_order_init(&ord, &cfg));
+
+    /* Load worker 0 with a flow whose packets are still in flight */
+    uint16_t hot = 1000;
+    while (worker_of(hot) != 0) hot++;
+    std::vector<ad_tun_buf_t *> burst;
+    for (uint32_t s = 0; s < 8; s++) burst.push_back(pkt(hot, s));
+    ASSERT_EQ(8u, ad_tun_order_dispatch(&ord, burst.data(), 8));
+
+    /* Other flows pinned to worker 0 are idle and follow the shorter queue */
+    for (uint16_t f = 2000; f < 2100; f++) {
+        ad_tun_buf_t *b = pkt(f, 0);
+        ASSERT_EQ(1u, ad_tun_order_dispatch(&ord, &b, 1));
+    }
+    ad_tun_buf_t *b = pkt(hot, 8);
+    ASSERT_EQ(1u, ad_tun_order_dispatch(&ord, &b, 1));
+
+    ad_tun_order_stats_t st;
+    ad_tun_order_get_stats(&ord, &st);
+    EXPECT_GT(st.migrations, 0u);
+
+    /* The hot flow never left worker 0 and kept its order */
+    ad_tun_buf_t *out[256];
+    unsigned n = ad_tun_order_dequeue(&ord, 0, out, 256);
+    uint32_t next = 0;
+    for (unsigned i = 0; i < n; i++) {
+        if (sport_of(out[i]) == hot) {
+            EXPECT_EQ(next++, seq_of(out[i]));
+        }
+    }
+    EXPECT_EQ(next, 9u);
+    ad_tun_order_done(&ord, 0, n);
+    ad_tun_pool_put_bulk(&pool, out, n);
+
+    n = ad_tun_order_dequeue(&ord, 1, out, 256);
+    for (unsigned i = 0; i < n; i++) EXPECT_NE(sport_of(out[i]), hot);
+    ad_tun_order_done(&ord, 1, n);
+    ad_tun_pool_put_bulk(&pool, out, n);
+}
+
+TEST_F(OrderTest, FullQueueStopsUntilDone) {
+    cfg.workers = 1;
+    cfg.depth = 8;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_order_init(&ord, &cfg));
+
+    std::vector<ad_tun_buf_t *> in;
+    for (uint32_t s = 0; s < 20; s++) in.push_back(pkt(1000, s));
+    EXPECT_EQ(8u, ad_tun_order_dispatch(&ord, in.data(), 20));
+
+    /* Dequeued but not done still holds the slots */
+    ad_tun_buf_t *out[8];
+    EXPECT_EQ(4u, ad_tun_order_dequeue(&ord, 0, out, 4));
+    EXPECT_EQ(0u, ad_tun_order_dispatch(&ord, in.data() + 8, 12));
+    EXPECT_EQ(8u, ad_tun_order_pending(&ord, 0));
+
+    ad_tun_order_done(&ord, 0, 4);
+    EXPECT_EQ(4u, ad_tun_order_pending(&ord, 0));
+    EXPECT_EQ(4u, ad_tun_order_dispatch(&ord, in.data() + 8, 12));
+
+    ad_tun_order_stats_t st;
+    ad_tun_order_get_stats(&ord, &st);
+    EXPECT_EQ(st.full, 3u);
+    EXPECT_EQ(st.dispatched, 12u);
+
+    for (ad_tun_buf_t *b : in) ad_tun_pool_put(&pool, b);
+}
+
+TEST_F(OrderTest, WaitSleepsUntilDispatch) {
+    cfg.workers = 2;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_order_init(&ord, &cfg));
+    EXPECT_EQ(0, ad_tun_order_wait(&ord, 0, 0));
+    EXPECT_EQ(-EINVAL, ad_tun_order_wait(&ord, 2, 0));
+
+    unsigned w = worker_of(1000);
+    std::atomic<int> woke{-2};
+    std::thread t([&] { woke = ad_tun_order_wait(&ord, w, 5000); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    ad_tun_buf_t *b = pkt(1000, 1);
+    ASSERT_EQ(1u, ad_tun_order_dispatch(&ord, &b, 1));
+    t.join();
+    EXPECT_EQ(woke.load(), 1);
+
+    ad_tun_buf_t *got;
+    ASSERT_EQ(1u, ad_tun_order_dequeue(&ord, w, &got, 1));
+    ad_tun_order_done(&ord, w, 1);
+    ad_tun_pool_put(&pool, got);
+}
+
+TEST_F(OrderTest, ParallelWorkersKeepFlowOrder) {
+    cfg.workers = 4;
+    cfg.buckets = 256;
+    cfg.depth = 256;
+    cfg.rebalance = 8;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_order_init(&ord, &cfg));
+
+    const unsigned flows = 64, per_flow = 500;
+    std::mutex wire_lock;
+    std::vector<uint32_t> next(flows, 0);
+    std::atomic<unsigned> errors{0}, written{0};
+    std::atomic<bool> stop{false};
+
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w < cfg.workers; w++) {
+        workers.emplace_back([&, w] {
+            ad_tun_buf_t *out[32];
+            while (!stop || ad_tun_order_pending(&ord, w) > 0) {
+                if (ad_tun_order_wait(&ord, w, 10) <= 0) continue;
+                unsigned n = ad_tun_order_dequeue(&ord, w, out, 32);
+                /* Uneven work so queues drift apart and buckets move */
+                if (w == 0) std::this_thread::sleep_for(std::chrono::microseconds(200));
+                {
+                    std::lock_guard<std::mutex> g(wire_lock);
+                    for (unsigned i = 0; i < n; i++) {
+                        unsigned f = sport_of(out[i]) - 1000u;
+                        if (seq_of(out[i]) != next[f]++) errors++;
+                    }
+                }
+                ad_tun_order_done(&ord, w, n);
+                ad_tun_pool_put_bulk(&pool, out, n);
+                written += n;
+            }
+        });
+    }
+
+    for (uint32_t s = 0; s < per_flow; s++) {
+        ad_tun_buf_t *batch[flows];
+        for (unsigned f = 0; f < flows; f++) {
+            batch[f] = ad_tun_pool_get(&pool);
+            while (!batch[f]) {
+                std::this_thread::yield();
+                batch[f] = ad_tun_pool_get(&pool);
+            }
+            udp_pkt(batch[f], (uint16_t)(1000 + f), s);
+        }
+        unsigned done = 0;
+        while (done < flows) done += ad_tun_order_dispatch(&ord, batch + done, flows - done);
+    }
+    stop = true;
+    for (auto &t : workers) t.join();
+
+    EXPECT_EQ(errors.load(), 0u);
+    EXPECT_EQ(written.load(), flows * per_flow);
+}
@@ -0,0 +1,36 @@
+#ifndef AD_TUN_TESTS_TEST_PACKETS_H_
+#define AD_TUN_TESTS_TEST_PACKETS_H_
+
+#include <cstdint>
+#include <cstring>
+
+extern "C" {
+#include "ad_tun.h"
+#include "ad_tun_pkt.h"
+}
+
+/*
+ * IPv4/UDP packet src:sport -> dst:dport of len bytes (at least 28), with
+ * the IP header checksum set and a zero payload. Addresses in host order,
+ * e.g. 0x0a000001 for 10.0.0.1. Returns the payload.
+ */
+static inline unsigned char *test_udp4(ad_tun_buf_t *b, uint32_t src, uint32_t dst, uint16_t sport,
+                                       uint16_t dport, uint16_t len, uint8_t tos = 0) {
+    unsigned char *p = b->data;
+    memset(p, 0, len);
+    p[0] = 0x45;
+    p[1] = tos;
+    ad_tun_put_be16(p + 2, len);
+    p[8] = 64;
+    p[9] = 17;
+    ad_tun_put_be32(p + 12, src);
+    ad_tun_put_be32(p + 16, dst);
+    ad_tun_ipv4_set_csum(p);
+    ad_tun_put_be16(p + 20, sport);
+    ad_tun_put_be16(p + 22, dport);
+    ad_tun_put_be16(p + 24, (uint16_t)(len - 20));
+    b->len = len;
+    return p + 28;
+}
+
+#endif
@@ -0,0 +1,255 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include "ad_tun_pipe.h"
+#include "ad_tun_pool.h"
+}
+
+#include "ad_tun_pipeline.hpp"
+#include "test_packets.h"
+
+/* IPv4/UDP packet with the given DSCP and destination port */
+static void make_udp4(ad_tun_buf_t *b, uint8_t dscp, uint16_t dport) {
+    test_udp4(b, 0x0a000001u, 0x0a000002u, 4000, dport, 28, (uint8_t)(dscp << 2));
+}
+
+/* Writer that records packets and takes at most limit per call */
+struct sink {
+    std::vector<ad_tun_buf_t*> got;
+    unsigned limit = ~0u;
+
+    static int write(void *arg, ad_tun_buf_t *const *bufs, unsigned n) {
+        sink *s = (sink*)arg;
+        if (n > s->limit) n = s->limit;
+        s->got.insert(s->got.end(), bufs, bufs + n);
+        return (int)n;
+    }
+};
+
+/* Records the class of each packet reaching it, drops class 5 */
+static std::vector<uint8_t> g_classes;
+
+static void drop_cs5(void *, ad_tun_pipe_batch_t *b) {
+    for (unsigned i = 0; i < b->n; ) {
+        g_classes.push_back(b->cls[i]);
+        if (b->cls[i] == 5) ad_tun_pipe_drop(b, i);
+        else i++;
+    }
+}
+
+static unsigned chain_len(ad_tun_buf_t *c) {
+    unsigned n = 0;
+    for (; c; c = c->next) n++;
+    return n;
+}
+
+class PipeTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ASSERT_EQ(AD_TUN_OK, ad_tun_pool_init(&pool, 64, 256, 0));
+        ASSERT_EQ(AD_TUN_OK, ad_tun_capture_parse_filter("udp and dst port 53", &dns));
+        g_classes.clear();
+    }
+
+    void TearDown() override {
+        EXPECT_EQ(pool.count, ad_tun_pool_available(&pool));
+        ad_tun_pool_free(&pool);
+    }
+
+    /* 8 packets: DNS on even slots (odd ones hit port 80), DSCP 46 (EF, class 5) on slot 2 */
+    void fill(ad_tun_buf_t **b) {
+        ASSERT_EQ(8u, ad_tun_pool_get_bulk(&pool, b, 8));
+        for (unsigned i = 0; i < 8; i++) make_udp4(b[i], i == 2 ? 46 : (uint8_t)(i * 8), i % 2 ? 80 : 53);
+        b[6]->len = 10;     /* truncated: rejected by parse */
+    }
+
+    ad_tun_pool_t pool;
+    ad_tun_capture_filter_t dns;
+};
+
+TEST_F(PipeTest, RuntimePipelineRunsStages) {
+    sink out;
+    ad_tun_stage_t st[5];
+    memset(st, 0, sizeof(st));
+    st[0].type = AD_TUN_STAGE_PARSE;
+    st[1].type = AD_TUN_STAGE_FILTER;
+    st[1].filter = &dns;
+    st[2].type = AD_TUN_STAGE_CLASSIFY;
+    st[3].type = AD_TUN_STAGE_CUSTOM;
+    st[3].fn = drop_cs5;
+    st[4].type = AD_TUN_STAGE_SEND;
+    st[4].write_fn = sink::write;
+    st[4].write_arg = &out;
+
+    ad_tun_pipe_t p;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_pipe_init(&p, st, 5, 8));
+
+    ad_tun_buf_t *b[8], *drops = NULL;
+    fill(b);
+    ad_tun_buf_t *first = b[0], *second = b[4];
+    ASSERT_EQ(2, ad_tun_pipe_run(&p, b, 8, 0, &drops));
+
+    /* 0 and 4 pass; 6 fails parse, odd ones fail the filter, 2 is EF */
+    ASSERT_EQ(2u, out.got.size());
+    EXPECT_EQ(first, out.got[0]);
+    EXPECT_EQ(second, out.got[1]);
+    EXPECT_EQ((std::vector<uint8_t>{ 0, 5, 4 }), g_classes);
+
+    EXPECT_EQ(6u, chain_len(drops));
+    EXPECT_EQ(1u, p.stats.drops[0]);
+    EXPECT_EQ(4u, p.stats.drops[1]);
+    EXPECT_EQ(1u, p.stats.drops[3]);
+    EXPECT_EQ(8u, p.stats.in);
+    EXPECT_EQ(2u, p.stats.out);
+    EXPECT_EQ(6u, p.stats.dropped);
+
+    ad_tun_pool_put_chain(&pool, drops);
+    ad_tun_pool_put_bulk(&pool, b, 2);
+    EXPECT_EQ(-EINVAL, ad_tun_pipe_run(&p, b, 9, 0, &drops));
+    ad_tun_pipe_free(&p);
+}
+
+TEST_F(PipeTest, RuntimePipelineRejectsBadOrder) {
+    ad_tun_pipe_t p;
+    ad_tun_stage_t st[2];
+    memset(st, 0, sizeof(st));
+
+    st[0].type = AD_TUN_STAGE_CLASSIFY;
+    st[1].type = AD_TUN_STAGE_PARSE;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_pipe_init(&p, st, 2, 8));
+
+    st[0].type = AD_TUN_STAGE_SEND;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_pipe_init(&p, st, 2, 8));
+
+    st[0].type = AD_TUN_STAGE_PARSE;
+    st[1].type = AD_TUN_STAGE_FILTER;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_pipe_init(&p, st, 2, 8));
+
+    st[1].type = AD_TUN_STAGE_SHAPE;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_pipe_init(&p, st, 2, 8));
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_pipe_init(&p, st, 0, 8));
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_pipe_init(&p, st, 1, 0));
+
+    /* Packets leave the shaper without parsed info, so parsing again is refused */
+    ad_tun_shaper_config_t cfg;
+    ad_tun_shaper_default_config(&cfg);
+    ad_tun_shaper_t sh;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_shaper_init(&sh, &cfg, 0));
+    st[0].type = AD_TUN_STAGE_SHAPE;
+    st[0].shaper = &sh;
+    st[1].type = AD_TUN_STAGE_PARSE;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_pipe_init(&p, st, 2, 8));
+    ad_tun_shaper_free(&sh);
+}
+
+/* Same chain as RuntimePipelineRunsStages, composed at compile time */
+TEST_F(PipeTest, CompiledPipelineMatchesRuntime) {
+    sink out;
+    ad_tun::pipeline p(8,
+        ad_tun::stage::parse{},
+        ad_tun::stage::filter{dns},
+        ad_tun::stage::classify{},
+        ad_tun::stage::batch{[](ad_tun_pipe_batch_t &b) { drop_cs5(nullptr, &b); }},
+        ad_tun::stage::send{sink::write, &out});
+
+    ad_tun_buf_t *b[8], *drops = nullptr;
+    fill(b);
+    ad_tun_buf_t *first = b[0], *second = b[4];
+    ASSERT_EQ(2, p.run(b, 0, drops));
+
+    ASSERT_EQ(2u, out.got.size());
+    EXPECT_EQ(first, out.got[0]);
+    EXPECT_EQ(second, out.got[1]);
+    EXPECT_EQ((std::vector<uint8_t>{ 0, 5, 4 }), g_classes);
+
+    EXPECT_EQ(6u, chain_len(drops));
+    EXPECT_EQ(1u, p.stats().drops[0]);
+    EXPECT_EQ(4u, p.stats().drops[1]);
+    EXPECT_EQ(1u, p.stats().drops[3]);
+    EXPECT_EQ(6u, p.stats().dropped);
+
+    ad_tun_pool_put_chain(&pool, drops);
+    ad_tun_pool_put_bulk(&pool, b, 2);
+}
+
+TEST_F(PipeTest, CompiledPerPacketStageAndShortWrite) {
+    sink out;
+    out.limit = 3;
+    unsigned seen = 0;
+    ad_tun::pipeline p(8,
+        ad_tun::stage::parse{},
+        ad_tun::stage::each{[&](ad_tun_buf_t *, const ad_tun_pkt_info_t &info, uint8_t) {
+            seen++;
+            return info.dport == 53;
+        }},
+        ad_tun::stage::send{sink::write, &out});
+
+    ad_tun_buf_t *b[8], *drops = nullptr;
+    fill(b);
+    /* Packets 0, 2, 4 pass; the writer takes them all */
+    EXPECT_EQ(3, p.run(b, 0, drops));
+    EXPECT_EQ(7u, seen);
+    EXPECT_EQ(5u, chain_len(drops));
+    ad_tun_pool_put_chain(&pool, drops);
+    ad_tun_pool_put_bulk(&pool, b, 3);
+
+    /* A short write drops what the writer did not take */
+    out.limit = 1;
+    drops = nullptr;
+    fill(b);
+    EXPECT_EQ(1, p.run(b, 0, drops));
+    EXPECT_EQ(7u, chain_len(drops));
+    EXPECT_EQ(2u, p.stats().drops[2]);
+    ad_tun_pool_put_chain(&pool, drops);
+    ad_tun_pool_put_bulk(&pool, b, 1);
+}
+
+TEST_F(PipeTest, ShapedPacketsResumeOnPoll) {
+    ad_tun_shaper_config_t cfg;
+    ad_tun_shaper_default_config(&cfg);
+    cfg.enabled = 1;
+    cfg.rate = 8 * 28 * 1000;       /* one 28-byte packet per ms */
+    cfg.burst = 2 * 28;
+    ad_tun_shaper_t sh;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_shaper_init(&sh, &cfg, 0));
+
+    sink out;
+    ad_tun_stage_t st[3];
+    memset(st, 0, sizeof(st));
+    st[0].type = AD_TUN_STAGE_PARSE;
+    st[1].type = AD_TUN_STAGE_SHAPE;
+    st[1].shaper = &sh;
+    st[2].type = AD_TUN_STAGE_SEND;
+    st[2].write_fn = sink::write;
+    st[2].write_arg = &out;
+    ad_tun_pipe_t p;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_pipe_init(&p, st, 3, 8));
+
+    ad_tun_buf_t *b[8], *drops = NULL;
+    fill(b);
+    int now = ad_tun_pipe_run(&p, b, 8, 0, &drops);
+    EXPECT_GE(now, 1);
+    EXPECT_LT(now, 7);
+    EXPECT_EQ(1u, chain_len(drops));
+    ad_tun_pool_put_chain(&pool, drops);
+    drops = NULL;
+
+    /* Held packets come back through the send stage */
+    ad_tun_buf_t *later[8];
+    unsigned total = (unsigned)now;
+    for (uint64_t t = 1; t <= 20 && total < 7; t++) {
+        int n = ad_tun_pipe_poll(&p, t * 1000000ULL, later, &drops);
+        ASSERT_GE(n, 0);
+        total += (unsigned)n;
+    }
+    EXPECT_EQ(7u, total);
+    EXPECT_EQ(7u, out.got.size());
+    EXPECT_EQ(nullptr, drops);
+
+    ad_tun_pool_put_bulk(&pool, out.got.data(), (unsigned)out.got.size());
+    ad_tun_pipe_free(&p);
+    ad_tun_shaper_free(&sh);
+}
@@ -0,0 +1,268 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+extern "C" {
+#include "ad_tun.h"
+#include "ad_tun_qscale.h"
+}
+
+#define SEC 1000000000ull
+
+/* Stand-in for TUNSETQUEUE: remembers which queues are attached */
+struct FakeQueues {
+    int attached[AD_TUN_MAX_QUEUES];
+    unsigned calls;
+    int fail;
+};
+
+static ad_tun_error_t fake_set(void *arg, unsigned q, int on) {
+    FakeQueues *f = (FakeQueues *)arg;
+    f->calls++;
+    if (f->fail) return AD_TUN_ERR_SYS;
+    f->attached[q] = on;
+    return AD_TUN_OK;
+}
+
+class QscaleTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        for (int &a : fake.attached) a = 1;
+        fake.calls = 0;
+        fake.fail = 0;
+        ad_tun_qscale_default_config(&cfg);
+        cfg.min_queues = 1;
+        cfg.max_queues = 4;
+        cfg.interval_ms = 1000;
+        cfg.up_pps = 1000;
+        cfg.down_pps = 100;
+        cfg.up_full_pct = 50;
+        cfg.down_full_pct = 5;
+        cfg.up_intervals = 2;
+        cfg.down_intervals = 3;
+        cfg.set_fn = fake_set;
+        cfg.set_arg = &fake;
+    }
+
+    void TearDown() override { ad_tun_qscale_free(&ctl); }
+
+    /* One interval in which every active queue reads pps packets, in batches of 32 */
+    int interval(uint64_t pps, bool full) {
+        for (unsigned q = 0; q < ctl.active; q++) {
+            for (uint64_t n = 0; n < pps; n += 32) ad_tun_qscale_record(&ctl, q, 32, full);
+        }
+        now += SEC;
+        return ad_tun_qscale_tick(&ctl, now);
+    }
+
+    FakeQueues fake;
+    ad_tun_qscale_config_t cfg;
+    ad_tun_qscale_t ctl = {};
+    uint64_t now = 5 * SEC;
+};
+
+TEST_F(QscaleTest, InitDetachesAboveMin) {
+    cfg.min_queues = 2;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_qscale_init(&ctl, &cfg));
+
+    EXPECT_EQ(fake.attached[0], 1);
+    EXPECT_EQ(fake.attached[1], 1);
+    EXPECT_EQ(fake.attached[2], 0);
+    EXPECT_EQ(fake.attached[3], 0);
+    EXPECT_EQ(fake.attached[4], 1);     // above max_queues, left alone
+    EXPECT_EQ(ad_tun_qscale_queue_state(&ctl, 1), AD_TUN_QSCALE_ACTIVE);
+    EXPECT_EQ(ad_tun_qscale_queue_state(&ctl, 2), AD_TUN_QSCALE_DRAINING);
+    EXPECT_EQ(ad_tun_qscale_queue_state(&ctl, 4), -1);
+
+    ad_tun_qscale_stats_t st;
+    ad_tun_qscale_get_stats(&ctl, &st);
+    EXPECT_EQ(st.active, 2u);
+}
+
+TEST_F(QscaleTest, InvalidConfigRejected) {
+    ad_tun_qscale_config_t bad = cfg;
+    bad.min_queues = 5;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_qscale_init(&ctl, &bad));
+
+    bad = cfg;
+    bad.down_pps = bad.up_pps;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_qscale_init(&ctl, &bad));
+
+    /* The default switch needs a running device with enough queues */
+    bad = cfg;
+    bad.set_fn = NULL;
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_qscale_init(&ctl, &bad));
+
+    fake.fail = 1;
+    EXPECT_EQ(AD_TUN_ERR_SYS, ad_tun_qscale_init(&ctl, &cfg));
+}
+
+TEST_F(QscaleTest, ScalesUpWithHysteresisToMax) {
+    ASSERT_EQ(AD_TUN_OK, ad_tun_qscale_init(&ctl, &cfg));
+    EXPECT_EQ(0, ad_tun_qscale_tick(&ctl, now));    // baseline
+
+    EXPECT_EQ(0, interval(5000, false));            // first busy interval
+    EXPECT_EQ(1, interval(5000, false));
+    EXPECT_EQ(fake.attached[1], 1);
+    EXPECT_EQ(ad_tun_qscale_queue_state(&ctl, 1), AD_TUN_QSCALE_ACTIVE);
+
+    /* A quiet interval in between restarts the count */
+    EXPECT_EQ(0, interval(5000, false));
+    EXPECT_EQ(0, interval(500, false));
+    EXPECT_EQ(0, interval(5000, false));
+    EXPECT_EQ(1, interval(5000, false));
+
+    /* Full batches alone count as load */
+    EXPECT_EQ(0, interval(500, true));
+    EXPECT_EQ(1, interval(500, true));
+    EXPECT_EQ(ctl.active, 4u);
+
+    EXPECT_EQ(0, interval(5000, true));
+    EXPECT_EQ(0, interval(5000, true));
+    EXPECT_EQ(ctl.active, 4u);
+
+    ad_tun_qscale_stats_t st;
+    ad_tun_qscale_get_stats(&ctl, &st);
+    EXPECT_EQ(st.ups, 3u);
+    EXPECT_EQ(st.active, 4u);
+}
+
+TEST_F(QscaleTest, ScalesDownToMin) {
+    cfg.min_queues = 2;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_qscale_init(&ctl, &cfg));
+    ad_tun_qscale_tick(&ctl, now);
+    interval(5000, false);
+    ASSERT_EQ(1, interval(5000, false));
+    ASSERT_EQ(ctl.active, 3u);
+
+    EXPECT_EQ(0, interval(10, false));
+    EXPECT_EQ(0, interval(10, false));
+    EXPECT_EQ(-1, interval(10, false));
+    EXPECT_EQ(fake.attached[2], 0);
+    EXPECT_EQ(ad_tun_qscale_queue_state(&ctl, 2), AD_TUN_QSCALE_DRAINING);
+
+    for (int i = 0; i < 10; i++) EXPECT_EQ(0, interval(0, false));
+    EXPECT_EQ(ctl.active, 2u);
+    EXPECT_EQ(fake.attached[1], 1);
+}
+
+TEST_F(QscaleTest, EarlyTickAndFailedSwitch) {
+    ASSERT_EQ(AD_TUN_OK, ad_tun_qscale_init(&ctl, &cfg));
+    ad_tun_qscale_tick(&ctl, now);
+
+    /* Less than interval_ms after the last decision: nothing sampled */
+    for (int i = 0; i < 10; i++) {
+        for (int n = 0; n < 100; n++) ad_tun_qscale_record(&ctl, 0, 32, 1);
+        EXPECT_EQ(0, ad_tun_qscale_tick(&ctl, now + SEC / 10));
+    }
+
+    fake.fail = 1;
+    EXPECT_EQ(0, interval(5000, false));
+    EXPECT_EQ(0, interval(5000, false));
+    EXPECT_EQ(ctl.active, 1u);
+
+    ad_tun_qscale_stats_t st;
+    ad_tun_qscale_get_stats(&ctl, &st);
+    EXPECT_EQ(st.errors, 1u);
+    EXPECT_EQ(st.ups, 0u);
+}
+
+TEST_F(QscaleTest, WorkerParksAndWakes) {
+    ASSERT_EQ(AD_TUN_OK, ad_tun_qscale_init(&ctl, &cfg));
+    ad_tun_qscale_tick(&ctl, now);
+
+    std::atomic<unsigned> served{0};
+    std::thread worker([&] {
+        while (ad_tun_qscale_worker_wait(&ctl, 1)) {
+            served++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    /* Queue 1 starts detached, so its worker parks */
+    for (int i = 0; i < 1000 && ad_tun_qscale_queue_state(&ctl, 1) != AD_TUN_QSCALE_PARKED; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(ad_tun_qscale_queue_state(&ctl, 1), AD_TUN_QSCALE_PARKED);
+    EXPECT_EQ(served.load(), 0u);
+
+    interval(5000, false);
+    ASSERT_EQ(1, interval(5000, false));
+    for (int i = 0; i < 1000 && served.load() == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_GT(served.load(), 0u);
+
+    ad_tun_qscale_stop(&ctl);
+    worker.join();
+    EXPECT_EQ(0, ad_tun_qscale_worker_wait(&ctl, 0));
+
+    ad_tun_qscale_stats_t st;
+    ad_tun_qscale_get_stats(&ctl, &st);
+    EXPECT_EQ(st.parks, 1u);
+    EXPECT_EQ(st.wakes, 1u);
+}
+
+TEST(QscaleConfigTest, LoadsSection) {
+    ad_tun_qscale_config_t c;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_qscale_load_config("../../test_configs/qscale.ini", &c));
+    EXPECT_EQ(c.min_queues, 2u);
+    EXPECT_EQ(c.max_queues, 8u);
+    EXPECT_EQ(c.interval_ms, 500u);
+    EXPECT_EQ(c.up_pps, 100000u);
+    EXPECT_EQ(c.down_pps, 20000u);
+    EXPECT_EQ(c.up_full_pct, 40u);
+    EXPECT_EQ(c.down_full_pct, 10u);
+    EXPECT_EQ(c.up_intervals, 3u);
+    EXPECT_EQ(c.down_intervals, 6u);
+
+    ad_tun_config_t tc;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_load_config("../../test_configs/qscale.ini", &tc));
+    EXPECT_EQ(tc.queues, 8);
+    ad_tun_free_config(&tc);
+
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_qscale_load_config("../../test_configs/qscale_bad.ini", &c));
+}
+
+TEST(QscaleDeviceTest, MultiQueueAttachDetach) {
+    ad_tun_config_t cfg = {};
+    cfg.ifname = "test_mq0";
+    cfg.ipv4 = "10.202.0.2/24";
+    cfg.mtu = 1500;
+    cfg.queues = 4;
+
+    if (ad_tun_init(&cfg) != AD_TUN_OK) {
+        ad_tun_cleanup();
+        GTEST_SKIP() << "Skipping: ad_tun_init failed";
+    }
+    if (ad_tun_start() != AD_TUN_OK) {
+        ad_tun_cleanup();
+        GTEST_SKIP() << "Skipping: ad_tun_start failed (device may be unavailable)";
+    }
+
+    ASSERT_EQ(ad_tun_get_num_queues(), 4);
+    EXPECT_EQ(ad_tun_get_queue_fd(0), ad_tun_get_fd());
+    EXPECT_NE(ad_tun_get_queue_fd(3), ad_tun_get_queue_fd(2));
+    EXPECT_EQ(ad_tun_get_queue_fd(4), -1);
+
+    ad_tun_qscale_config_t qc;
+    ad_tun_qscale_default_config(&qc);
+    ad_tun_qscale_t ctl = {};
+    ASSERT_EQ(AD_TUN_OK, ad_tun_qscale_init(&ctl, &qc));
+
+    /* Detached twice fails in the kernel, attach brings it back */
+    EXPECT_EQ(AD_TUN_ERR_SYS, ad_tun_set_queue_enabled(3, 0));
+    EXPECT_EQ(AD_TUN_OK, ad_tun_set_queue_enabled(3, 1));
+    EXPECT_EQ(AD_TUN_ERR_CONFIG, ad_tun_set_queue_enabled(4, 1));
+
+    ad_tun_buf_t *none[1] = {NULL};
+    EXPECT_EQ(-EINVAL, ad_tun_read_batch_queue(7, none, 1));
+
+    ad_tun_qscale_free(&ctl);
+    EXPECT_EQ(AD_TUN_OK, ad_tun_stop());
+    EXPECT_EQ(ad_tun_get_num_queues(), 0);
+    EXPECT_EQ(AD_TUN_ERR_INVALID_STATE, ad_tun_set_queue_enabled(0, 1));
+    EXPECT_EQ(AD_TUN_OK, ad_tun_cleanup());
+}
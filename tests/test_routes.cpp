@@ -0,0 +1,237 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+extern "C" {
+#include "ad_tun_route.h"
+#include "ad_tun_mgr.h"
+}
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/socket.h>
+
+TEST(RouteParseTest, ParsesPrefixMetricAndTable) {
+    ad_tun_route_t r;
+
+    ASSERT_EQ(ad_tun_route_parse("10.1.2.3/16", 5, AD_TUN_ROUTE_TABLE_MAIN, &r), 0);
+    EXPECT_EQ(r.family, AF_INET);
+    EXPECT_EQ(r.plen, 16);
+    unsigned char want[4] = { 10, 1, 0, 0 };
+    EXPECT_EQ(memcmp(r.dst, want, 4), 0);
+    EXPECT_EQ(r.metric, 5u);
+    EXPECT_EQ(r.table, 254u);
+
+    ASSERT_EQ(ad_tun_route_parse("192.168.1.1 metric 7 table 100", 0, 254, &r), 0);
+    EXPECT_EQ(r.plen, 32);
+    EXPECT_EQ(r.metric, 7u);
+    EXPECT_EQ(r.table, 100u);
+
+    ASSERT_EQ(ad_tun_route_parse("2001:db8::/32 table local", 0, 254, &r), 0);
+    EXPECT_EQ(r.family, AF_INET6);
+    EXPECT_EQ(r.plen, 32);
+    EXPECT_EQ(r.table, 255u);
+    EXPECT_EQ(r.metric, 1024u);
+
+    ASSERT_EQ(ad_tun_route_parse("0.0.0.0/0", 0, 254, &r), 0);
+    EXPECT_EQ(r.plen, 0);
+}
+
+TEST(RouteParseTest, RejectsBadSpecs) {
+    ad_tun_route_t r;
+    EXPECT_EQ(ad_tun_route_parse("", 0, 254, &r), -EINVAL);
+    EXPECT_EQ(ad_tun_route_parse("10.0.0.0/33", 0, 254, &r), -EINVAL);
+    EXPECT_EQ(ad_tun_route_parse("10.0.0.0/8 metric", 0, 254, &r), -EINVAL);
+    EXPECT_EQ(ad_tun_route_parse("10.0.0.0/8 metric x", 0, 254, &r), -EINVAL);
+    EXPECT_EQ(ad_tun_route_parse("10.0.0.0/8 table 0", 0, 254, &r), -EINVAL);
+    EXPECT_EQ(ad_tun_route_parse("10.0.0.0/8 via 10.0.0.1", 0, 254, &r), -EINVAL);
+    EXPECT_EQ(ad_tun_route_parse(nullptr, 0, 254, &r), -EINVAL);
+}
+
+TEST(RouteConfigTest, LoadsGlobalSection) {
+    ad_tun_route_set_t set;
+    ad_tun_route_set_init(&set);
+    ASSERT_EQ(ad_tun_route_load_config("../../test_configs/routes.ini", nullptr, &set), AD_TUN_OK);
+    ASSERT_EQ(set.count, 4u);
+
+    EXPECT_EQ(set.routes[0].metric, 0u);
+    EXPECT_EQ(set.routes[0].table, 254u);
+    EXPECT_EQ(set.routes[1].plen, 16);
+    EXPECT_EQ(set.routes[1].dst[2], 0);
+    EXPECT_EQ(set.routes[1].metric, 50u);
+    EXPECT_EQ(set.routes[2].plen, 32);
+    EXPECT_EQ(set.routes[2].metric, 20u);
+    EXPECT_EQ(set.routes[2].table, 100u);
+    EXPECT_EQ(set.routes[3].family, AF_INET6);
+    EXPECT_EQ(set.routes[3].metric, 20u);
+    EXPECT_EQ(set.routes[3].table, 254u);
+    for (unsigned i = 0; i < set.count; i++) EXPECT_EQ(set.routes[i].ifindex, 0);
+
+    ad_tun_route_set_free(&set);
+}
+
+TEST(RouteConfigTest, LoadsInterfaceSection) {
+    ad_tun_route_set_t set;
+    ad_tun_route_set_init(&set);
+    ASSERT_EQ(ad_tun_route_load_config("../../test_configs/routes.ini", "adrt0", &set), AD_TUN_OK);
+    ASSERT_EQ(set.count, 2u);
+    EXPECT_EQ(set.routes[0].plen, 12);
+    EXPECT_EQ(set.routes[1].family, AF_INET6);
+    EXPECT_EQ(set.routes[1].metric, 10u);
+    ad_tun_route_set_free(&set);
+
+    ad_tun_route_set_init(&set);
+    EXPECT_EQ(ad_tun_route_load_config("../../test_configs/nonexistent.ini", nullptr, &set), AD_TUN_ERR_CONFIG);
+    EXPECT_EQ(ad_tun_route_load_config(nullptr, nullptr, &set), AD_TUN_ERR_CONFIG);
+    ad_tun_route_set_free(&set);
+}
+
+class RouteTest : public ::testing::Test {
+protected:
+    ad_tun_mgr_t mgr;
+    int ifindex = 0;
+
+    void SetUp() override {
+        ad_tun_config_t cfg;
+        memset(&cfg, 0, sizeof(cfg));
+        cfg.ifname = "adrt0";
+        cfg.ipv4 = "10.80.0.1/24";
+        cfg.ipv6 = "fd80::1/64";
+        ASSERT_EQ(ad_tun_mgr_init(&mgr, nullptr), AD_TUN_OK);
+        ASSERT_EQ(ad_tun_mgr_add(&mgr, &cfg), 0);
+        if (ad_tun_mgr_start_all(&mgr) != 1) GTEST_SKIP() << "Skipping: TUN devices unavailable";
+        ifindex = ad_tun_mgr_get(&mgr, 0)->ifindex;
+    }
+
+    void TearDown() override {
+        ad_tun_mgr_free(&mgr);
+    }
+
+    /* Host routes 10.81.x.y for i in [from, to) plus one IPv6 /64 per 16 */
+    static void fill(ad_tun_route_set_t *set, unsigned from, unsigned to) {
+        for (unsigned i = from; i < to; i++) {
+            char spec[64];
+            snprintf(spec, sizeof(spec), "10.81.%u.%u", i >> 8, i & 0xff);
+            ad_tun_route_t r;
+            ASSERT_EQ(ad_tun_route_parse(spec, 0, AD_TUN_ROUTE_TABLE_MAIN, &r), 0);
+            ASSERT_EQ(ad_tun_route_set_add(set, &r), 0);
+            if (i % 16 == 0) {
+                snprintf(spec, sizeof(spec), "fd81:%x::/64", i);
+                ASSERT_EQ(ad_tun_route_parse(spec, 0, AD_TUN_ROUTE_TABLE_MAIN, &r), 0);
+                ASSERT_EQ(ad_tun_route_set_add(set, &r), 0);
+            }
+        }
+    }
+};
+
+TEST_F(RouteTest, InstallsAndRemovesInBulk) {
+    ad_tun_route_set_t set;
+    ad_tun_route_set_init(&set);
+    fill(&set, 0, 4096);
+
+    EXPECT_EQ(ad_tun_route_install(set.routes, set.count, ifindex), 0);
+
+    /* Everything installed is seen as unchanged */
+    ad_tun_route_stats_t st;
+    EXPECT_EQ(ad_tun_route_sync(&set, ifindex, &st), 0);
+    EXPECT_EQ(st.unchanged, set.count);
+    EXPECT_EQ(st.added, 0u);
+    EXPECT_EQ(st.removed, 0u);
+
+    EXPECT_EQ(ad_tun_route_remove(set.routes, set.count, ifindex), 0);
+
+    /* Second removal fails for every route */
+    EXPECT_EQ(ad_tun_route_remove(set.routes, 16, ifindex), 16);
+
+    ad_tun_route_set_t empty;
+    ad_tun_route_set_init(&empty);
+    EXPECT_EQ(ad_tun_route_sync(&empty, ifindex, &st), 0);
+    EXPECT_EQ(st.unchanged + st.removed + st.added, 0u);
+
+    ad_tun_route_set_free(&set);
+}
+
+TEST_F(RouteTest, SyncAppliesDifference) {
+    ad_tun_route_set_t set;
+    ad_tun_route_set_init(&set);
+    fill(&set, 0, 2048);
+    ad_tun_route_stats_t st;
+    EXPECT_EQ(ad_tun_route_sync(&set, ifindex, &st), 0);
+    EXPECT_EQ(st.added, set.count);
+
+    /* Reload: drop [0, 512), keep [512, 2048), add [2048, 2560) */
+    ad_tun_route_set_t next;
+    ad_tun_route_set_init(&next);
+    fill(&next, 512, 2560);
+    EXPECT_EQ(ad_tun_route_sync(&next, ifindex, &st), 0);
+    EXPECT_EQ(st.removed, 512u + 32u);
+    EXPECT_EQ(st.added, 512u + 32u);
+    EXPECT_EQ(st.unchanged, 1536u + 96u);
+    EXPECT_EQ(st.failed, 0u);
+
+    /* A metric change replaces the route */
+    next.routes[0].metric = 77;
+    EXPECT_EQ(ad_tun_route_sync(&next, ifindex, &st), 0);
+    EXPECT_EQ(st.added, 1u);
+    EXPECT_EQ(st.removed, 1u);
+
+    ad_tun_route_set_t empty;
+    ad_tun_route_set_init(&empty);
+    EXPECT_EQ(ad_tun_route_sync(&empty, ifindex, &st), 0);
+    EXPECT_EQ(st.removed, next.count);
+
+    ad_tun_route_set_free(&set);
+    ad_tun_route_set_free(&next);
+}
+
+TEST_F(RouteTest, SyncLeavesForeignRoutes) {
+    /* The kernel's own prefix route for 10.80.0.0/24 must survive */
+    ad_tun_route_set_t empty;
+    ad_tun_route_set_init(&empty);
+    ad_tun_route_stats_t st;
+    EXPECT_EQ(ad_tun_route_sync(&empty, 0, &st), 0);
+    EXPECT_EQ(st.removed, 0u);
+
+    ad_tun_route_t r;
+    ASSERT_EQ(ad_tun_route_parse("10.80.0.0/24", 0, AD_TUN_ROUTE_TABLE_MAIN, &r), 0);
+    r.ifindex = ifindex;
+    ASSERT_EQ(ad_tun_route_set_add(&empty, &r), 0);
+    EXPECT_EQ(ad_tun_route_sync(&empty, 0, &st), 0);
+    EXPECT_EQ(st.added, 1u);
+    EXPECT_EQ(ad_tun_route_sync(&empty, 0, &st), 0);
+    EXPECT_EQ(st.unchanged, 1u);
+
+    ad_tun_route_set_free(&empty);
+}
+
+TEST_F(RouteTest, SyncMovesRouteBetweenInterfaces) {
+    ad_tun_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.ifname = "adrt1";
+    ASSERT_EQ(ad_tun_mgr_add(&mgr, &cfg), 1);
+    ASSERT_EQ(ad_tun_mgr_start(&mgr, 1, 1), 1);
+    int other = ad_tun_mgr_get(&mgr, 1)->ifindex;
+
+    ad_tun_route_set_t set;
+    ad_tun_route_set_init(&set);
+    fill(&set, 0, 16);
+    for (unsigned i = 0; i < set.count; i++) set.routes[i].ifindex = ifindex;
+    ad_tun_route_stats_t st;
+    EXPECT_EQ(ad_tun_route_sync(&set, 0, &st), 0);
+
+    /* Same keys on another interface: replaced in place, nothing left to remove */
+    for (unsigned i = 0; i < set.count; i++) set.routes[i].ifindex = other;
+    EXPECT_EQ(ad_tun_route_sync(&set, 0, &st), 0);
+    EXPECT_EQ(st.added, set.count);
+    EXPECT_EQ(st.removed, 0u);
+    EXPECT_EQ(st.failed, 0u);
+
+    EXPECT_EQ(ad_tun_route_sync(&set, 0, &st), 0);
+    EXPECT_EQ(st.unchanged, set.count);
+
+    ad_tun_route_set_t empty;
+    ad_tun_route_set_init(&empty);
+    EXPECT_EQ(ad_tun_route_sync(&empty, 0, &st), 0);
+    EXPECT_EQ(st.removed, set.count);
+    ad_tun_route_set_free(&set);
+}
@@ -0,0 +1,191 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+extern "C" {
+#include "ad_tun_shaper.h"
+#include "ad_tun_pool.h"
+#include "ad_tun_pkt.h"
+}
+
+#include "test_packets.h"
+
+static const uint64_t kMs = 1000000ULL;
+
+/* IPv4/UDP packet of len bytes with the given DSCP and source port */
+static void make_udp4(ad_tun_buf_t *b, size_t len, uint8_t dscp, uint16_t sport) {
+    test_udp4(b, 0x0a000001u, 0x0a000002u, sport, 9, (uint16_t)len, (uint8_t)(dscp << 2));
+}
+
+class ShaperTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ASSERT_EQ(AD_TUN_OK, ad_tun_pool_init(&pool, 256, 1500, 0));
+        ad_tun_shaper_default_config(&cfg);
+    }
+
+    void TearDown() override {
+        ad_tun_pool_put_chain(&pool, ad_tun_shaper_drain(&sh));
+        ad_tun_shaper_free(&sh);
+        EXPECT_EQ(pool.count, ad_tun_pool_available(&pool));
+        ad_tun_pool_free(&pool);
+    }
+
+    /* Submit count packets and return how many were released right away */
+    int submit(unsigned count, size_t len, uint8_t dscp, uint16_t sport, uint64_t now) {
+        std::vector<ad_tun_buf_t*> in(count), out(count);
+        EXPECT_EQ(count, ad_tun_pool_get_bulk(&pool, in.data(), count));
+        for (auto *b : in) make_udp4(b, len, dscp, sport);
+
+        ad_tun_buf_t *drops = NULL;
+        int n = ad_tun_shaper_submit(&sh, in.data(), count, now, out.data(), count, &drops);
+        ad_tun_pool_put_bulk(&pool, out.data(), (unsigned)n);
+        ad_tun_pool_put_chain(&pool, drops);
+        return n;
+    }
+
+    int poll(uint64_t now) {
+        ad_tun_buf_t *out[256];
+        int n = ad_tun_shaper_poll(&sh, now, out, 256);
+        ad_tun_pool_put_bulk(&pool, out, (unsigned)n);
+        return n;
+    }
+
+    ad_tun_pool_t pool;
+    ad_tun_shaper_config_t cfg;
+    ad_tun_shaper_t sh;
+};
+
+TEST_F(ShaperTest, UnlimitedPassesEverything) {
+    ASSERT_EQ(AD_TUN_OK, ad_tun_shaper_init(&sh, NULL, 0));
+    EXPECT_EQ(64, submit(64, 1500, 0, 1, 0));
+    EXPECT_EQ(0u, ad_tun_shaper_next_timeout(&sh));
+}
+
+TEST_F(ShaperTest, BurstThenRate) {
+    cfg.rate = 8000000;      /* 1 MB/s: one 1000-byte packet per ms */
+    cfg.burst = 10000;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_shaper_init(&sh, &cfg, 0));
+
+    EXPECT_EQ(10, submit(20, 1000, 0, 1, 0));
+    EXPECT_EQ(10u, sh.held);
+    EXPECT_NE(0u, ad_tun_shaper_next_timeout(&sh));
+
+    EXPECT_EQ(0, poll(kMs / 2));
+    EXPECT_EQ(1, poll(kMs));
+
+    /* Every held packet leaves within its slot, none early */
+    int released = 1;
+    for (uint64_t t = 2; t <= 10; t++) {
+        released += poll(t * kMs);
+        EXPECT_EQ((int)t, released);
+    }
+    EXPECT_EQ(0u, sh.held);
+    EXPECT_EQ(10u, sh.stats.passed);
+    EXPECT_EQ(10u, sh.stats.delayed);
+    EXPECT_EQ(0u, ad_tun_shaper_next_timeout(&sh));
+}
+
+TEST_F(ShaperTest, QueuedFlowKeepsOrder) {
+    cfg.rate = 8000000;
+    cfg.burst = 1000;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_shaper_init(&sh, &cfg, 0));
+
+    ad_tun_buf_t *in[3], *out[3];
+    ASSERT_EQ(3u, ad_tun_pool_get_bulk(&pool, in, 3));
+    for (auto *b : in) make_udp4(b, 1000, 0, 1);
+
+    ad_tun_buf_t *drops = NULL;
+    ASSERT_EQ(1, ad_tun_shaper_submit(&sh, in, 2, 0, out, 3, &drops));
+    EXPECT_EQ(in[0], out[0]);
+
+    /* Credit is available again, but in[2] must wait behind in[1] */
+    ASSERT_EQ(0, ad_tun_shaper_submit(&sh, in + 2, 1, 2 * kMs, out, 3, &drops));
+    ASSERT_EQ(1, ad_tun_shaper_poll(&sh, 2 * kMs, out, 3));
+    EXPECT_EQ(in[1], out[0]);
+    ASSERT_EQ(1, ad_tun_shaper_poll(&sh, 3 * kMs, out, 3));
+    EXPECT_EQ(in[2], out[0]);
+
+    ad_tun_pool_put_bulk(&pool, in, 3);
+}
+
+TEST_F(ShaperTest, DscpSelectsClass) {
+    cfg.nclasses = 2;
+    strcpy(cfg.classes[1].name, "voice");
+    cfg.classes[1].rate = 8000000;
+    cfg.classes[1].burst = 2000;
+    cfg.dscp_map[46] = 1;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_shaper_init(&sh, &cfg, 0));
+
+    EXPECT_EQ(2, submit(8, 1000, 46, 1, 0));
+    EXPECT_EQ(8, submit(8, 1000, 0, 1, 0));
+}
+
+TEST_F(ShaperTest, PerFlowBucketsAreIndependent) {
+    cfg.flow_rate = 8000000;
+    cfg.flow_burst = 3000;
+    cfg.flow_buckets = 4096;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_shaper_init(&sh, &cfg, 0));
+
+    EXPECT_EQ(3, submit(5, 1000, 0, 1000, 0));
+    EXPECT_EQ(3, submit(5, 1000, 0, 2000, 0));
+    EXPECT_EQ(4, poll(2 * kMs));
+}
+
+TEST_F(ShaperTest, QueueLimitDrops) {
+    cfg.rate = 8000000;
+    cfg.burst = 1000;
+    cfg.queue_limit = 4;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_shaper_init(&sh, &cfg, 0));
+
+    EXPECT_EQ(1, submit(10, 1000, 0, 1, 0));
+    EXPECT_EQ(4u, sh.held);
+    EXPECT_EQ(5u, sh.stats.dropped);
+}
+
+TEST_F(ShaperTest, LongIdleGapReleasesHeldPackets) {
+    cfg.rate = 8000000;
+    cfg.burst = 1000;
+    cfg.tick_us = 10;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_shaper_init(&sh, &cfg, 0));
+
+    EXPECT_EQ(1, submit(3, 1000, 0, 1, 0));
+    /* Far beyond one lap of the wheel */
+    EXPECT_EQ(1, poll(1000 * kMs));
+    EXPECT_EQ(1, poll(1001 * kMs));
+    EXPECT_EQ(0u, sh.held);
+}
+
+TEST_F(ShaperTest, LoadConfig) {
+    ASSERT_EQ(AD_TUN_OK, ad_tun_shaper_load_config("../../test_configs/shaper.ini", &cfg));
+
+    EXPECT_EQ(1, cfg.enabled);
+    EXPECT_EQ(100000000u, cfg.rate);
+    EXPECT_EQ(65536u, cfg.burst);
+    EXPECT_EQ(10000000u, cfg.flow_rate);
+    EXPECT_EQ(16384u, cfg.flow_burst);
+    EXPECT_EQ(512u, cfg.queue_limit);
+    EXPECT_EQ(50u, cfg.tick_us);
+
+    ASSERT_EQ(3u, cfg.nclasses);
+    EXPECT_STREQ("voice", cfg.classes[0].name);
+    EXPECT_EQ(2000000u, cfg.classes[0].rate);
+    EXPECT_EQ(8192u, cfg.classes[0].burst);
+    EXPECT_EQ(0u, cfg.classes[2].rate);   /* invalid rate ignored */
+
+    EXPECT_EQ(1u, cfg.default_class);
+    EXPECT_EQ(0, cfg.dscp_map[46]);
+    EXPECT_EQ(0, cfg.dscp_map[40]);
+    EXPECT_EQ(1, cfg.dscp_map[8]);
+    EXPECT_EQ(1, cfg.dscp_map[0]);
+
+    ASSERT_EQ(AD_TUN_OK, ad_tun_shaper_init(&sh, &cfg, 0));
+    EXPECT_EQ(128u, sh.nqueues);
+}
+
+TEST_F(ShaperTest, NoShaperSectionDisabled) {
+    ASSERT_EQ(AD_TUN_OK, ad_tun_shaper_load_config("../../test_configs/good.ini", &cfg));
+    EXPECT_EQ(0, cfg.enabled);
+    EXPECT_EQ(1u, cfg.nclasses);
+    ASSERT_EQ(AD_TUN_OK, ad_tun_shaper_init(&sh, &cfg, 0));
+}
@@ -0,0 +1,304 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "ad_tun_shm.h"
+#include "ad_tun_pool.h"
+}
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Fill b with len bytes derived from tag */
+static void fill(ad_tun_buf_t *b, uint32_t tag, size_t len) {
+    memcpy(b->data, &tag, sizeof(tag));
+    for (size_t i = sizeof(tag); i < len; i++) b->data[i] = (unsigned char)(tag + i);
+    b->len = len;
+}
+
+static uint32_t tag_of(const ad_tun_buf_t *b) {
+    uint32_t t;
+    memcpy(&t, b->data, sizeof(t));
+    return t;
+}
+
+class ShmTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ASSERT_EQ(AD_TUN_OK, ad_tun_pool_init(&pool, 256, 2048, 0));
+        ad_tun_shm_default_config(&cfg);
+        cfg.slots = 64;
+        cfg.slot_size = 1500;
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv));
+    }
+
+    void TearDown() override {
+        close(sv[0]);
+        close(sv[1]);
+        ad_tun_pool_free(&pool);
+    }
+
+    /* Enqueue count packets with tags first.. through ring */
+    unsigned send(ad_tun_shm_ring_t *ring, uint32_t first, unsigned count, size_t len = 100) {
+        std::vector<ad_tun_buf_t *> bufs(count);
+        unsigned got = ad_tun_pool_get_bulk(&pool, bufs.data(), count);
+        EXPECT_EQ(got, count);
+        for (unsigned i = 0; i < got; i++) fill(bufs[i], first + i, len);
+        unsigned n = ad_tun_shm_enqueue(ring, bufs.data(), got);
+        ad_tun_pool_put_bulk(&pool, bufs.data(), got);
+        return n;
+    }
+
+    ad_tun_pool_t pool;
+    ad_tun_shm_config_t cfg;
+    int sv[2];
+};
+
+TEST_F(ShmTest, PassesPacketsBetweenMappings) {
+    ad_tun_shm_ring_t tx, rx;
+    ASSERT_EQ(ad_tun_shm_create(&tx, &cfg), AD_TUN_OK);
+    EXPECT_EQ(tx.mask, 63u);
+    ASSERT_EQ(ad_tun_shm_send_fds(&tx, sv[0]), AD_TUN_OK);
+    ASSERT_EQ(ad_tun_shm_recv_fds(&rx, sv[1]), AD_TUN_OK);
+    EXPECT_NE((void *)rx.hdr, (void *)tx.hdr);  /* Separate mapping of the same memory */
+
+    EXPECT_EQ(send(&tx, 1000, 10, 1500), 10u);
+    EXPECT_EQ(ad_tun_shm_count(&rx), 10u);
+
+    ad_tun_buf_t *bufs[16];
+    ASSERT_EQ(ad_tun_shm_dequeue(&rx, &pool, bufs, 16), 10u);
+    for (unsigned i = 0; i < 10; i++) {
+        EXPECT_EQ(tag_of(bufs[i]), 1000 + i);
+        EXPECT_EQ(bufs[i]->len, 1500u);
+        EXPECT_EQ(bufs[i]->data[1499], (unsigned char)(1000 + i + 1499));
+    }
+    ad_tun_pool_put_bulk(&pool, bufs, 10);
+    EXPECT_EQ(ad_tun_pool_available(&pool), 256u);
+    EXPECT_EQ(ad_tun_shm_count(&tx), 0u);
+
+    ad_tun_shm_stats_t st;
+    ad_tun_shm_get_stats(&tx, &st);
+    EXPECT_EQ(st.enqueued, 10u);
+    EXPECT_EQ(st.dequeued, 10u);
+
+    ad_tun_shm_close(&rx);
+    ad_tun_shm_close(&tx);
+}
+
+TEST_F(ShmTest, StopsWhenFullAndSkipsOversize) {
+    cfg.slots = 5;  /* Rounded to 8 */
+    ad_tun_shm_ring_t r;
+    ASSERT_EQ(ad_tun_shm_create(&r, &cfg), AD_TUN_OK);
+
+    EXPECT_EQ(send(&r, 0, 6), 6u);
+    EXPECT_EQ(send(&r, 6, 6), 2u);
+    EXPECT_EQ(ad_tun_shm_count(&r), 8u);
+    EXPECT_EQ(ad_tun_shm_wait_writable(&r, 0), 0);
+
+    ad_tun_buf_t *bufs[4];
+    ASSERT_EQ(ad_tun_shm_dequeue(&r, &pool, bufs, 3), 3u);
+    EXPECT_EQ(tag_of(bufs[0]), 0u);
+    ad_tun_pool_put_bulk(&pool, bufs, 3);
+    EXPECT_EQ(ad_tun_shm_wait_writable(&r, 0), 1);
+
+    /* A packet bigger than a slot is taken but not stored */
+    ad_tun_buf_t *b[2];
+    ASSERT_EQ(ad_tun_pool_get_bulk(&pool, b, 2), 2u);
+    fill(b[0], 77, 1600);
+    fill(b[1], 78, 60);
+    EXPECT_EQ(ad_tun_shm_enqueue(&r, b, 2), 2u);
+    ad_tun_pool_put_bulk(&pool, b, 2);
+    EXPECT_EQ(ad_tun_shm_count(&r), 6u);
+
+    ad_tun_shm_stats_t st;
+    ad_tun_shm_get_stats(&r, &st);
+    EXPECT_EQ(st.full, 1u);
+    EXPECT_EQ(st.oversize, 1u);
+    EXPECT_EQ(st.enqueued, 9u);
+    ad_tun_shm_close(&r);
+}
+
+TEST_F(ShmTest, PeekWithoutCopy) {
+    ad_tun_shm_ring_t r;
+    ASSERT_EQ(ad_tun_shm_create(&r, &cfg), AD_TUN_OK);
+    EXPECT_EQ(send(&r, 5, 4), 4u);
+
+    const unsigned char *pkts[8];
+    uint32_t lens[8];
+    ASSERT_EQ(ad_tun_shm_peek(&r, pkts, lens, 8), 4u);
+    uint32_t t;
+    memcpy(&t, pkts[2], sizeof(t));
+    EXPECT_EQ(t, 7u);
+    EXPECT_EQ(lens[2], 100u);
+
+    ad_tun_shm_release(&r, 3);
+    ASSERT_EQ(ad_tun_shm_peek(&r, pkts, lens, 8), 1u);
+    memcpy(&t, pkts[0], sizeof(t));
+    EXPECT_EQ(t, 8u);
+    ad_tun_shm_release(&r, 1);
+    EXPECT_EQ(ad_tun_shm_count(&r), 0u);
+    ad_tun_shm_close(&r);
+
+    /* Not offered on MPMC rings */
+    cfg.mode = AD_TUN_SHM_MPMC;
+    ASSERT_EQ(ad_tun_shm_create(&r, &cfg), AD_TUN_OK);
+    EXPECT_EQ(send(&r, 5, 1), 1u);
+    EXPECT_EQ(ad_tun_shm_peek(&r, pkts, lens, 8), 0u);
+    ad_tun_shm_close(&r);
+}
+
+TEST_F(ShmTest, RejectsForeignDescriptors) {
+    int fd = memfd_create("not_a_ring", 0);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(ftruncate(fd, 1 << 16), 0);
+    ad_tun_shm_ring_t r;
+    EXPECT_EQ(ad_tun_shm_attach(&r, fd, dup(sv[0]), dup(sv[1])), AD_TUN_ERR_CONFIG);
+
+    /* A valid ring image in a memfd whose size can still change */
+    ad_tun_shm_ring_t good;
+    ASSERT_EQ(ad_tun_shm_create(&good, &cfg), AD_TUN_OK);
+    std::vector<unsigned char> image(good.map_len);
+    memcpy(image.data(), good.hdr, good.map_len);
+    ad_tun_shm_close(&good);
+    fd = memfd_create("unsealed_ring", MFD_ALLOW_SEALING);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(write(fd, image.data(), image.size()), (ssize_t)image.size());
+    EXPECT_EQ(ad_tun_shm_attach(&r, fd, dup(sv[0]), dup(sv[1])), AD_TUN_ERR_CONFIG);
+
+    /* The same image sealed is accepted */
+    fd = memfd_create("sealed_ring", MFD_ALLOW_SEALING);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(write(fd, image.data(), image.size()), (ssize_t)image.size());
+    ASSERT_EQ(fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW), 0);
+    ASSERT_EQ(ad_tun_shm_attach(&r, fd, dup(sv[0]), dup(sv[1])), AD_TUN_OK);
+    ad_tun_shm_close(&r);
+
+    cfg.slot_size = 0;
+    EXPECT_EQ(ad_tun_shm_create(&r, &cfg), AD_TUN_ERR_CONFIG);
+}
+
+/* The TUN owner fans packets out to a worker process and collects the replies */
+TEST_F(ShmTest, WorkerProcessEchoes) {
+    const unsigned kTotal = 20000;
+    ad_tun_shm_ring_t to, from;
+    ASSERT_EQ(ad_tun_shm_create(&to, &cfg), AD_TUN_OK);
+    ASSERT_EQ(ad_tun_shm_create(&from, &cfg), AD_TUN_OK);
+
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+        ad_tun_shm_ring_t in, out;
+        if (ad_tun_shm_recv_fds(&in, sv[1]) != AD_TUN_OK || ad_tun_shm_recv_fds(&out, sv[1]) != AD_TUN_OK) _exit(1);
+        unsigned done = 0;
+        while (done < kTotal) {
+            if (ad_tun_shm_wait_readable(&in, 5000) != 1) _exit(2);
+            ad_tun_buf_t *bufs[32];
+            unsigned n = ad_tun_shm_dequeue(&in, &pool, bufs, 32);
+            for (unsigned i = 0; i < n; i++) bufs[i]->data[4] ^= 0xff;
+            unsigned sent = 0;
+            while (sent < n) {
+                sent += ad_tun_shm_enqueue(&out, bufs + sent, n - sent);
+                if (sent < n && ad_tun_shm_wait_writable(&out, 5000) != 1) _exit(3);
+            }
+            ad_tun_pool_put_bulk(&pool, bufs, n);
+            done += n;
+        }
+        _exit(0);
+    }
+
+    ASSERT_EQ(ad_tun_shm_send_fds(&to, sv[0]), AD_TUN_OK);
+    ASSERT_EQ(ad_tun_shm_send_fds(&from, sv[0]), AD_TUN_OK);
+
+    unsigned sent = 0, got = 0;
+    bool ordered = true;
+    while (got < kTotal) {
+        if (sent < kTotal) {
+            unsigned k = send(&to, sent, std::min(16u, kTotal - sent));
+            if (k == 0) {
+                ASSERT_EQ(ad_tun_shm_wait_writable(&to, 5000), 1);
+            }
+            sent += k;
+        }
+        ad_tun_buf_t *bufs[32];
+        unsigned n = ad_tun_shm_dequeue(&from, &pool, bufs, 32);
+        for (unsigned i = 0; i < n; i++) {
+            ordered &= tag_of(bufs[i]) == got + i && bufs[i]->data[4] == (unsigned char)~(got + i + 4);
+        }
+        ad_tun_pool_put_bulk(&pool, bufs, n);
+        got += n;
+        if (n == 0 && sent == kTotal) {
+            ASSERT_EQ(ad_tun_shm_wait_readable(&from, 5000), 1);
+        }
+    }
+    EXPECT_TRUE(ordered);
+
+    int status;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    ad_tun_shm_stats_t st;
+    ad_tun_shm_get_stats(&from, &st);
+    EXPECT_EQ(st.enqueued, kTotal);
+    EXPECT_EQ(st.dequeued, kTotal);
+    ad_tun_shm_close(&to);
+    ad_tun_shm_close(&from);
+}
+
+TEST_F(ShmTest, MpmcDeliversEachPacketOnce) {
+    const unsigned kThreads = 4, kPerThread = 20000;
+    cfg.mode = AD_TUN_SHM_MPMC;
+    cfg.slots = 256;
+    cfg.slot_size = 64;
+    ad_tun_shm_ring_t r;
+    ASSERT_EQ(ad_tun_shm_create(&r, &cfg), AD_TUN_OK);
+
+    std::vector<std::atomic<int>> seen(kThreads * kPerThread);
+    std::atomic<unsigned> received{0};
+    std::vector<std::thread> threads;
+
+    for (unsigned t = 0; t < kThreads; t++) {
+        threads.emplace_back([&, t] {
+            unsigned char storage[8][64];
+            ad_tun_buf_t b[8], *bufs[8];
+            for (unsigned i = 0; i < 8; i++) {
+                memset(&b[i], 0, sizeof(b[i]));
+                b[i].head = b[i].data = storage[i];
+                b[i].size = sizeof(storage[i]);
+                bufs[i] = &b[i];
+            }
+            for (unsigned s = 0; s < kPerThread;) {
+                unsigned k = std::min(8u, kPerThread - s);
+                for (unsigned i = 0; i < k; i++) fill(&b[i], t * kPerThread + s + i, 32);
+                unsigned done = 0;
+                while (done < k) {
+                    done += ad_tun_shm_enqueue(&r, bufs + done, k - done);
+                    if (done < k) std::this_thread::yield();
+                }
+                s += k;
+            }
+        });
+        threads.emplace_back([&] {
+            ad_tun_buf_t *bufs[16];
+            while (received.load() < kThreads * kPerThread) {
+                unsigned n = ad_tun_shm_dequeue(&r, &pool, bufs, 16);
+                for (unsigned i = 0; i < n; i++) seen[tag_of(bufs[i])].fetch_add(1);
+                ad_tun_pool_put_bulk(&pool, bufs, n);
+                received += n;
+                if (n == 0) std::this_thread::yield();
+            }
+        });
+    }
+    for (auto &th : threads) th.join();
+
+    unsigned once = 0;
+    for (auto &s : seen) once += s.load() == 1;
+    EXPECT_EQ(once, kThreads * kPerThread);
+    ad_tun_shm_close(&r);
+}
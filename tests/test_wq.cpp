@@ -0,0 +1,231 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "ad_tun_wq.h"
+}
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+/* Writer that accepts `capacity` packets and then reports EAGAIN */
+struct MockWriter {
+    int capacity = 1 << 30;
+    std::vector<std::string> written;
+
+    static ssize_t write(void *arg, const char *buf, size_t len) {
+        MockWriter *w = static_cast<MockWriter*>(arg);
+        if (w->capacity == 0) return -EAGAIN;
+        w->capacity--;
+        w->written.emplace_back(buf, len);
+        return (ssize_t)len;
+    }
+};
+
+static void on_pressure(void *arg, int on) {
+    static_cast<std::vector<int>*>(arg)->push_back(on);
+}
+
+class WqTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ad_tun_wq_default_config(&cfg);
+        cfg.write_fn = MockWriter::write;
+        cfg.write_arg = &writer;
+    }
+
+    void TearDown() override {
+        ad_tun_wq_free(&wq);
+    }
+
+    ssize_t send(unsigned cls, const std::string &s) {
+        return ad_tun_wq_send(&wq, cls, s.data(), s.size());
+    }
+
+    MockWriter writer;
+    ad_tun_wq_config_t cfg;
+    ad_tun_wq_t wq;
+};
+
+TEST_F(WqTest, EagainKeepsPacketsInOrder) {
+    ASSERT_EQ(AD_TUN_OK, ad_tun_wq_init(&wq, &cfg));
+    writer.capacity = 2;
+
+    for (int i = 0; i < 5; i++) EXPECT_EQ(2, send(1, "p" + std::to_string(i)));
+    EXPECT_EQ(2u, writer.written.size());
+    EXPECT_EQ(3u, ad_tun_wq_count(&wq, -1));
+    EXPECT_TRUE(ad_tun_wq_blocked(&wq));
+
+    writer.capacity = 100;
+    EXPECT_EQ(3, ad_tun_wq_drain(&wq));
+    ASSERT_EQ(5u, writer.written.size());
+    for (int i = 0; i < 5; i++) EXPECT_EQ("p" + std::to_string(i), writer.written[i]);
+    EXPECT_FALSE(ad_tun_wq_blocked(&wq));
+    EXPECT_EQ(0u, ad_tun_wq_count(&wq, -1));
+}
+
+TEST_F(WqTest, StrictPriorityServesControlFirst) {
+    ASSERT_EQ(AD_TUN_OK, ad_tun_wq_init(&wq, &cfg));
+    writer.capacity = 0;
+
+    send(2, "bulk0");
+    send(2, "bulk1");
+    send(1, "data0");
+    send(0, "ctrl0");
+
+    writer.capacity = 100;
+    ad_tun_wq_drain(&wq);
+    ASSERT_EQ(4u, writer.written.size());
+    EXPECT_EQ("ctrl0", writer.written[0]);
+    EXPECT_EQ("data0", writer.written[1]);
+    EXPECT_EQ("bulk0", writer.written[2]);
+    EXPECT_EQ("bulk1", writer.written[3]);
+}
+
+TEST_F(WqTest, DrrSharesByQuantum) {
+    cfg.nclasses = 2;
+    cfg.sched = AD_TUN_WQ_DRR;
+    cfg.quantum[0] = 2000;
+    cfg.quantum[1] = 1000;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_wq_init(&wq, &cfg));
+
+    std::string a(1000, 'a'), b(1000, 'b');
+    for (int i = 0; i < 30; i++) {
+        ASSERT_EQ(1000, ad_tun_wq_enqueue(&wq, 0, a.data(), a.size()));
+        ASSERT_EQ(1000, ad_tun_wq_enqueue(&wq, 1, b.data(), b.size()));
+    }
+
+    writer.capacity = 30;
+    ad_tun_wq_drain(&wq);
+    int na = 0;
+    for (auto &s : writer.written) na += (s[0] == 'a');
+    EXPECT_EQ(20, na);
+
+    writer.capacity = 100;
+    ad_tun_wq_drain(&wq);
+    EXPECT_EQ(60u, writer.written.size());
+}
+
+TEST_F(WqTest, FullClassRejectsAndWatermarksFire) {
+    std::vector<int> events;
+    cfg.limit[0] = 4;
+    cfg.high_wm = 3;
+    cfg.low_wm = 1;
+    cfg.on_pressure = on_pressure;
+    cfg.pressure_arg = &events;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_wq_init(&wq, &cfg));
+    writer.capacity = 0;
+
+    for (int i = 0; i < 4; i++) EXPECT_EQ(1, send(0, "x"));
+    EXPECT_EQ(-ENOBUFS, send(0, "x"));
+    EXPECT_EQ(1u, wq.stats.rejected);
+    ASSERT_EQ(1u, events.size());
+    EXPECT_EQ(1, events[0]);
+    EXPECT_TRUE(ad_tun_wq_pressure(&wq));
+
+    writer.capacity = 2;
+    ad_tun_wq_drain(&wq);
+    EXPECT_EQ(1u, events.size());       /* 2 left, above the low watermark */
+    writer.capacity = 1;
+    ad_tun_wq_drain(&wq);
+    ASSERT_EQ(2u, events.size());
+    EXPECT_EQ(0, events[1]);
+    EXPECT_FALSE(ad_tun_wq_pressure(&wq));
+}
+
+TEST_F(WqTest, OversizedAndBadClassRejected) {
+    cfg.buf_size = 16;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_wq_init(&wq, &cfg));
+
+    EXPECT_EQ(-EMSGSIZE, send(0, std::string(17, 'x')));
+    EXPECT_EQ(-EINVAL, send(cfg.nclasses, "x"));
+}
+
+static ssize_t pipe_write(void *arg, const char *buf, size_t len) {
+    ssize_t n = write(*static_cast<int*>(arg), buf, len);
+    if (n < 0) return -errno;
+    return n;
+}
+
+TEST_F(WqTest, EpolloutDrivesDraining) {
+    int p[2];
+    ASSERT_EQ(0, pipe2(p, O_NONBLOCK));
+    cfg.write_fn = pipe_write;
+    cfg.write_arg = &p[1];
+    cfg.limit[0] = 1024;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_wq_init(&wq, &cfg));
+
+    int ep = epoll_create1(0);
+    struct epoll_event ev = {};
+    ev.events = EPOLLERR;
+    ev.data.u32 = 7;
+    ASSERT_EQ(0, epoll_ctl(ep, EPOLL_CTL_ADD, p[1], &ev));
+    ASSERT_EQ(AD_TUN_OK, ad_tun_wq_attach_epoll(&wq, ep, p[1], &ev));
+
+    /* Fill the pipe until the queue starts holding packets */
+    std::string pkt(4000, 'z');
+    int sent = 0;
+    while (!ad_tun_wq_blocked(&wq)) {
+        ASSERT_EQ(4000, send(0, pkt));
+        sent++;
+    }
+    for (int i = 0; i < 3; i++, sent++) ASSERT_EQ(4000, send(0, pkt));
+    EXPECT_EQ(4u, ad_tun_wq_count(&wq, 0));
+
+    struct epoll_event got;
+    EXPECT_EQ(0, epoll_wait(ep, &got, 1, 0));   /* pipe still full */
+
+    std::vector<char> sink(1 << 20);
+    ssize_t drained = read(p[0], sink.data(), sink.size());
+    ASSERT_GT(drained, 0);
+    ASSERT_EQ(1, epoll_wait(ep, &got, 1, 1000));
+    EXPECT_TRUE(got.events & EPOLLOUT);
+    EXPECT_EQ(7u, got.data.u32);
+
+    EXPECT_EQ(4, ad_tun_wq_drain(&wq));
+    EXPECT_EQ(0u, ad_tun_wq_count(&wq, -1));
+    EXPECT_EQ(0, epoll_wait(ep, &got, 1, 0));   /* EPOLLOUT cancelled */
+
+    ssize_t total = drained;
+    ssize_t n;
+    while ((n = read(p[0], sink.data(), sink.size())) > 0) total += n;
+    EXPECT_EQ((ssize_t)sent * 4000, total);
+
+    close(ep);
+    close(p[0]);
+    close(p[1]);
+}
+
+TEST_F(WqTest, ConcurrentProducersKeepPerProducerOrder) {
+    cfg.nclasses = 4;
+    for (int i = 0; i < 4; i++) cfg.limit[i] = 4096;
+    cfg.high_wm = 0;
+    ASSERT_EQ(AD_TUN_OK, ad_tun_wq_init(&wq, &cfg));
+
+    const int kPerThread = 2000;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([this, t] {
+            for (int i = 0; i < kPerThread; i++) {
+                char msg[16];
+                int len = snprintf(msg, sizeof(msg), "%d:%d", t, i);
+                ASSERT_EQ(len, ad_tun_wq_send(&wq, (unsigned)t, msg, (size_t)len));
+            }
+        });
+    }
+    for (auto &th : threads) th.join();
+    ad_tun_wq_drain(&wq);
+
+    ASSERT_EQ(4u * kPerThread, writer.written.size());
+    int next[4] = {0, 0, 0, 0};
+    for (auto &s : writer.written) {
+        int t, i;
+        ASSERT_EQ(2, sscanf(s.c_str(), "%d:%d", &t, &i));
+        EXPECT_EQ(next[t], i);
+        next[t] = i + 1;
+    }
+}
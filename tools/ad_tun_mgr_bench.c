@@ -0,0 +1,173 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Manager Bench      **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+/*
+ * Creates, configures and tears down N tunnels with the bulk manager and
+ * reports the time of each phase. Every tunnel gets a /30 out of
+ * 100.64.0.0/10, which leaves room for one million interfaces. Run inside
+ * a throw-away network namespace:
+ *
+ *   unshare -rn ./ad_tun_mgr_bench -n 10000
+ *
+ * With -r, that many /32 routes out of 10.0.0.0/8 are spread over the
+ * tunnels, then installed, re-synced unchanged, and removed.
+ */
+
+#define _GNU_SOURCE
+
+#include "../include/ad_tun_mgr.h"
+#include "../include/ad_tun_route.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <net/if.h>
+#include <sys/socket.h>
+
+#define DEFAULT_BENCH_COUNT 1000
+#define DEFAULT_BENCH_PREFIX "adb"
+#define MAX_BENCH_COUNT (1u << 20)
+#define MAX_BENCH_ROUTES (1u << 24)
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-n count] [-t threads] [-p prefix] [-g group] [-r routes]\n"
+            "  -n  tunnels to create (default %u)\n"
+            "  -t  creation threads (default: online CPUs)\n"
+            "  -p  interface name prefix (default \"%s\")\n"
+            "  -g  device group for batched teardown (default 0 = none)\n"
+            "  -r  routes to install over the tunnels (default 0)\n",
+            prog, DEFAULT_BENCH_COUNT, DEFAULT_BENCH_PREFIX);
+}
+
+/* Install, re-sync and remove nroutes host routes spread over the tunnels */
+static int bench_routes(ad_tun_mgr_t *mgr, unsigned nroutes)
+{
+    ad_tun_route_set_t set;
+    ad_tun_route_set_init(&set);
+    for (unsigned i = 0; i < nroutes; i++) {
+        uint32_t a = (10u << 24) | i;
+        ad_tun_route_t r;
+        memset(&r, 0, sizeof(r));
+        r.family = AF_INET;
+        r.plen = 32;
+        r.dst[0] = (uint8_t)(a >> 24);
+        r.dst[1] = (uint8_t)(a >> 16);
+        r.dst[2] = (uint8_t)(a >> 8);
+        r.dst[3] = (uint8_t)a;
+        r.table = AD_TUN_ROUTE_TABLE_MAIN;
+        r.ifindex = ad_tun_mgr_get(mgr, i % mgr->count)->ifindex;
+        if (ad_tun_route_set_add(&set, &r) != 0) {
+            ad_tun_route_set_free(&set);
+            return -1;
+        }
+    }
+
+    ad_tun_route_stats_t st;
+    double t0 = now_ms();
+    int add_failed = ad_tun_route_install(set.routes, set.count, 0);
+    double t1 = now_ms();
+    int sync_failed = ad_tun_route_sync(&set, 0, &st);
+    double t2 = now_ms();
+    int del_failed = ad_tun_route_remove(set.routes, set.count, 0);
+    double t3 = now_ms();
+    ad_tun_route_set_free(&set);
+
+    printf("routes:    %u (%d/%d/%d rejected)\n", nroutes, add_failed, sync_failed, del_failed);
+    printf("install:   %9.1f ms\n", t1 - t0);
+    printf("resync:    %9.1f ms (%u unchanged)\n", t2 - t1, st.unchanged);
+    printf("remove:    %9.1f ms\n", t3 - t2);
+    return (add_failed || sync_failed || del_failed) ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned count = DEFAULT_BENCH_COUNT;
+    unsigned nroutes = 0;
+    const char *prefix = DEFAULT_BENCH_PREFIX;
+    ad_tun_mgr_config_t mcfg;
+    ad_tun_mgr_default_config(&mcfg);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:p:g:r:h")) != -1) {
+        switch (opt) {
+        case 'n': count = (unsigned)strtoul(optarg, NULL, 0); break;
+        case 't': mcfg.threads = (unsigned)strtoul(optarg, NULL, 0); break;
+        case 'p': prefix = optarg; break;
+        case 'g': mcfg.group = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'r': nroutes = (unsigned)strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if (count == 0 || count > MAX_BENCH_COUNT || strlen(prefix) > 7 || nroutes > MAX_BENCH_ROUTES) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    ad_tun_mgr_t mgr;
+    if (ad_tun_mgr_init(&mgr, &mcfg) != AD_TUN_OK) {
+        fprintf(stderr, "ad_tun_mgr_init failed\n");
+        return 1;
+    }
+
+    double t0 = now_ms();
+    for (unsigned i = 0; i < count; i++) {
+        char name[IFNAMSIZ];
+        char ipv4[32];
+        uint32_t a = (100u << 24) | (64u << 16) | (i << 2) | 1;
+        snprintf(name, sizeof(name), "%s%u", prefix, i);
+        snprintf(ipv4, sizeof(ipv4), "%u.%u.%u.%u/30", a >> 24, (a >> 16) & 0xff, (a >> 8) & 0xff, a & 0xff);
+
+        ad_tun_config_t cfg;
+        memset(&cfg, 0, sizeof(cfg));
+        cfg.ifname = name;
+        cfg.ipv4 = ipv4;
+        cfg.mtu = 1420;
+        if (ad_tun_mgr_add(&mgr, &cfg) < 0) {
+            fprintf(stderr, "cannot declare %s\n", name);
+            ad_tun_mgr_free(&mgr);
+            return 1;
+        }
+    }
+    double t1 = now_ms();
+
+    int up = ad_tun_mgr_start_all(&mgr);
+    double t2 = now_ms();
+
+    unsigned failed = 0;
+    for (unsigned i = 0; i < count; i++) {
+        if (ad_tun_mgr_get(&mgr, i)->state != AD_TUN_MGR_UP || ad_tun_mgr_get(&mgr, i)->err) failed++;
+    }
+
+    if (nroutes && bench_routes(&mgr, nroutes) != 0) failed++;
+
+    double t3 = now_ms();
+    ad_tun_mgr_stop_all(&mgr);
+    double t4 = now_ms();
+
+    printf("tunnels:   %u (%d up, %u with errors), %u threads\n", count, up, failed, mgr.cfg.threads);
+    printf("declare:   %9.1f ms\n", t1 - t0);
+    printf("create:    %9.1f ms (%.1f us/tunnel)\n", (double)mgr.create_ns / 1e6,
+           (double)mgr.create_ns / 1e3 / count);
+    printf("configure: %9.1f ms (%.1f us/tunnel)\n", (double)mgr.config_ns / 1e6,
+           (double)mgr.config_ns / 1e3 / count);
+    printf("start:     %9.1f ms\n", t2 - t1);
+    printf("teardown:  %9.1f ms\n", t4 - t3);
+
+    ad_tun_mgr_free(&mgr);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,670 @@
+/*************************************************
+**************************************************
+**              Name: AD Tun Replay             **
+**              Author: Arkaprava Das           **
+**************************************************
+**************************************************/
+
+/*
+ * Replays a pcap/pcapng trace through the ad_tun write path while a second
+ * thread drains the read side, and reports throughput and latency.
+ *
+ * Packets written to the TUN device enter the kernel; with -d they are
+ * readdressed to a peer in the tunnel subnet so that, with forwarding
+ * enabled, the kernel routes them straight back out of the device, where
+ * the reader matches them to their write time. Inside a user and network
+ * namespace this needs no privileges and no network (reverse path filtering
+ * is turned off because trace sources are not routed via the device):
+ *
+ *   unshare -rn sh -c 'sysctl -qw net.ipv4.ip_forward=1 net.ipv6.conf.all.forwarding=1 \
+ *                          net.ipv4.conf.all.rp_filter=0 net.ipv4.conf.default.rp_filter=0;
+ *                      ./ad_tun_replay -c replay.ini -f trace.pcapng -d 10.8.0.3 -D fd00::3'
+ */
+
+#define _GNU_SOURCE
+
+#include "../include/ad_tun.h"
+#include "../include/ad_tun_pkt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+/* Exported by the library; ad_tun_helper.h defines globals and cannot be included here */
+const char *ad_tun_strerror(ad_tun_error_t err);
+
+#define DEFAULT_DRAIN_MS 200
+#define MAX_LAT_SAMPLES (1u << 20)
+#define INFLIGHT_SLOTS (1u << 16)
+#define KEY_BYTES 64                /* L4 bytes hashed to match a read to its write */
+#define SPIN_NS 100000              /* busy-wait below this gap, sleep above */
+#define READ_BUF_SIZE 65536
+
+/* Link types carrying IP */
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW_OLD 12
+#define LINKTYPE_LOOP 108
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+#define PCAPNG_MAX_IFACES 64
+
+typedef enum {
+    MODE_RECORDED = 0,
+    MODE_RATE,
+    MODE_FLOOD
+} replay_mode_t;
+
+/* One IP packet of the trace, pointing into the mapped file */
+typedef struct {
+    unsigned char *data;
+    uint32_t len;
+    uint64_t ts_ns;
+    uint64_t key;
+} replay_pkt_t;
+
+typedef struct {
+    replay_pkt_t *pkts;
+    size_t count;
+    size_t cap;
+    size_t skipped;             /* non-IP, truncated or unsupported frames */
+} replay_trace_t;
+
+/* Interface of a pcapng section */
+typedef struct {
+    unsigned linktype;
+    uint64_t units_per_sec;
+} pcapng_iface_t;
+
+/* Write time of a packet still in flight */
+typedef struct {
+    uint64_t key;
+    uint64_t ts_ns;
+} inflight_t;
+
+static inflight_t g_inflight[INFLIGHT_SLOTS];
+static uint64_t *g_lat;
+static size_t g_lat_count;
+static uint64_t g_rx_pkts, g_rx_bytes, g_rx_matched;
+static volatile sig_atomic_t g_interrupted;
+static int g_reader_stop;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    g_interrupted = 1;
+}
+
+/* ---- Trace loading ---- */
+
+static uint16_t rd16(const unsigned char *p, int swap)
+{
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return swap ? __builtin_bswap16(v) : v;
+}
+
+static uint32_t rd32(const unsigned char *p, int swap)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+/* FNV-1a over the start of the L4 header and payload, which forwarding leaves untouched */
+static uint64_t packet_key(const unsigned char *pkt, size_t len)
+{
+    ad_tun_pkt_info_t info;
+    size_t off = 0;
+    if (ad_tun_pkt_parse(pkt, len, &info) == 0) off = info.l3_len;
+
+    uint64_t h = 1469598103934665603ULL ^ len;
+    size_t end = (len - off > KEY_BYTES) ? off + KEY_BYTES : len;
+    for (size_t i = off; i < end; i++) {
+        h ^= pkt[i];
+        h *= 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+/* Strip the link-layer header; returns the IP packet or NULL */
+static unsigned char *l3_start(unsigned linktype, unsigned char *frame, uint32_t *len)
+{
+    size_t off;
+    uint16_t proto;
+
+    switch (linktype) {
+    case LINKTYPE_RAW:
+    case LINKTYPE_RAW_OLD:
+    case LINKTYPE_IPV4:
+    case LINKTYPE_IPV6:
+        off = 0;
+        break;
+    case LINKTYPE_NULL:
+    case LINKTYPE_LOOP:
+        off = 4;
+        break;
+    case LINKTYPE_ETHERNET:
+        off = 14;
+        if (*len < off) return NULL;
+        proto = ad_tun_get_be16(frame + 12);
+        while ((proto == 0x8100 || proto == 0x88a8) && *len >= off + 4) {
+            proto = ad_tun_get_be16(frame + off + 2);
+            off += 4;
+        }
+        if (proto != 0x0800 && proto != 0x86dd) return NULL;
+        break;
+    case LINKTYPE_LINUX_SLL:
+        off = 16;
+        if (*len < off) return NULL;
+        proto = ad_tun_get_be16(frame + 14);
+        if (proto != 0x0800 && proto != 0x86dd) return NULL;
+        break;
+    case LINKTYPE_LINUX_SLL2:
+        off = 20;
+        if (*len < off) return NULL;
+        proto = ad_tun_get_be16(frame);
+        if (proto != 0x0800 && proto != 0x86dd) return NULL;
+        break;
+    default:
+        return NULL;
+    }
+
+    if (*len <= off) return NULL;
+    unsigned char *ip = frame + off;
+    unsigned version = ip[0] >> 4;
+    if (version != 4 && version != 6) return NULL;
+
+    *len -= (uint32_t)off;
+    return ip;
+}
+
+static int trace_add(replay_trace_t *t, unsigned linktype, unsigned char *frame,
+                     uint32_t cap_len, uint32_t orig_len, uint64_t ts_ns)
+{
+    if (cap_len < orig_len) {
+        t->skipped++;   /* truncated by the capture snaplen */
+        return 0;
+    }
+
+    uint32_t len = cap_len;
+    unsigned char *ip = l3_start(linktype, frame, &len);
+    if (!ip) {
+        t->skipped++;
+        return 0;
+    }
+
+    if (t->count == t->cap) {
+        size_t cap = t->cap ? t->cap * 2 : 4096;
+        replay_pkt_t *p = realloc(t->pkts, cap * sizeof(*p));
+        if (!p) return -1;
+        t->pkts = p;
+        t->cap = cap;
+    }
+
+    replay_pkt_t *p = &t->pkts[t->count++];
+    p->data = ip;
+    p->len = len;
+    p->ts_ns = ts_ns;
+    return 0;
+}
+
+static uint64_t ts_to_ns(uint64_t ts, uint64_t units_per_sec)
+{
+    return (ts / units_per_sec) * 1000000000ULL + (ts % units_per_sec) * 1000000000ULL / units_per_sec;
+}
+
+static int load_pcap(replay_trace_t *t, unsigned char *map, size_t size)
+{
+    uint32_t magic = rd32(map, 0);
+    int swap = (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1);
+    int nsec = (magic == 0xa1b23c4d || magic == 0x4d3cb2a1);
+    unsigned linktype = rd32(map + 20, swap) & 0xffff;
+
+    size_t off = 24;
+    while (off + 16 <= size) {
+        uint64_t sec = rd32(map + off, swap);
+        uint64_t frac = rd32(map + off + 4, swap);
+        uint32_t cap_len = rd32(map + off + 8, swap);
+        uint32_t orig_len = rd32(map + off + 12, swap);
+        off += 16;
+        if (cap_len > size - off) break;
+
+        uint64_t ts = sec * 1000000000ULL + (nsec ? frac : frac * 1000);
+        if (trace_add(t, linktype, map + off, cap_len, orig_len, ts) != 0) return -1;
+        off += cap_len;
+    }
+    return 0;
+}
+
+/* Read the interface options we care about from an IDB */
+static void pcapng_parse_idb(pcapng_iface_t *ifc, const unsigned char *b, uint32_t blen, int swap)
+{
+    ifc->linktype = rd16(b + 8, swap);
+    ifc->units_per_sec = 1000000;
+
+    size_t off = 16;
+    while (off + 4 <= blen - 4) {
+        uint16_t code = rd16(b + off, swap);
+        uint16_t olen = rd16(b + off + 2, swap);
+        if (code == 0 || off + 4 + olen > blen - 4) break;
+        if (code == 9 && olen >= 1) {
+            uint8_t r = b[off + 4];
+            uint64_t ups = 1;
+            for (unsigned i = 0; i < (r & 0x7f) && ups < 1000000000000000000ULL; i++) {
+                ups *= (r & 0x80) ? 2 : 10;
+            }
+            ifc->units_per_sec = ups;
+        }
+        off += 4 + ((olen + 3u) & ~3u);
+    }
+}
+
+static int load_pcapng(replay_trace_t *t, unsigned char *map, size_t size)
+{
+    pcapng_iface_t ifaces[PCAPNG_MAX_IFACES];
+    unsigned nifaces = 0;
+    int swap = 0;
+    size_t off = 0;
+
+    while (off + 12 <= size) {
+        unsigned char *b = map + off;
+        uint32_t type = rd32(b, 0);
+
+        if (type == 0x0A0D0D0A) {
+            /* New section: byte order and interfaces start over */
+            swap = (rd32(b + 8, 0) == 0x4D3C2B1A);
+            nifaces = 0;
+        }
+
+        uint32_t blen = rd32(b + 4, swap);
+        if (blen < 12 || blen > size - off) break;
+
+        if (type == 1 && blen >= 20 && nifaces < PCAPNG_MAX_IFACES) {
+            pcapng_parse_idb(&ifaces[nifaces++], b, blen, swap);
+        } else if (type == 6 && blen >= 32) {
+            uint32_t id = rd32(b + 8, swap);
+            uint64_t ts = ((uint64_t)rd32(b + 12, swap) << 32) | rd32(b + 16, swap);
+            uint32_t cap_len = rd32(b + 20, swap);
+            uint32_t orig_len = rd32(b + 24, swap);
+            if (id < nifaces && cap_len <= blen - 32) {
+                if (trace_add(t, ifaces[id].linktype, b + 28, cap_len, orig_len,
+                              ts_to_ns(ts, ifaces[id].units_per_sec)) != 0) {
+                    return -1;
+                }
+            } else {
+                t->skipped++;
+            }
+        } else if (type == 3 && blen >= 16 && nifaces > 0) {
+            /* Simple packet block: no timestamp, interface 0 */
+            uint32_t orig_len = rd32(b + 8, swap);
+            uint32_t cap_len = (orig_len < blen - 16) ? orig_len : blen - 16;
+            if (trace_add(t, ifaces[0].linktype, b + 12, cap_len, orig_len, 0) != 0) return -1;
+        }
+
+        off += blen;
+    }
+    return 0;
+}
+
+/* Map a trace read-write and private, so readdressing never touches the file */
+static unsigned char *map_trace(const char *path, size_t *size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "ad_tun_replay: cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 24) {
+        fprintf(stderr, "ad_tun_replay: %s is not a capture file\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "ad_tun_replay: mmap failed: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    *size = (size_t)st.st_size;
+    return map;
+}
+
+/* ---- Readdressing ---- */
+
+/* RFC 1624 incremental update of a checksum field for a changed address */
+static void csum_replace(unsigned char *field, const unsigned char *from, const unsigned char *to,
+                         size_t len, int udp)
+{
+    uint16_t old = ad_tun_get_be16(field);
+    if (udp && old == 0) return;    /* IPv4 UDP without checksum */
+
+    uint32_t sum = (uint16_t)~old;
+    for (size_t i = 0; i < len; i += 2) {
+        sum += (uint16_t)~ad_tun_get_be16(from + i);
+        sum += ad_tun_get_be16(to + i);
+    }
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+
+    uint16_t csum = (uint16_t)~sum;
+    if (udp && csum == 0) csum = 0xffff;
+    ad_tun_put_be16(field, csum);
+}
+
+static void readdress(replay_pkt_t *p, const struct in_addr *dst4, const struct in6_addr *dst6)
+{
+    ad_tun_pkt_info_t info;
+    if (ad_tun_pkt_parse(p->data, p->len, &info) != 0) return;
+
+    size_t alen;
+    unsigned char *dst;
+    const unsigned char *to;
+
+    if (info.family == AF_INET && dst4) {
+        alen = 4;
+        dst = p->data + 16;
+        to = (const unsigned char *)dst4;
+    } else if (info.family == AF_INET6 && dst6) {
+        alen = 16;
+        dst = p->data + 24;
+        to = (const unsigned char *)dst6;
+    } else {
+        return;
+    }
+
+    /* TCP, UDP and ICMPv6 checksums cover the pseudo header */
+    if (!info.is_frag || info.frag_off == 0) {
+        unsigned char *l4 = p->data + info.l3_len;
+        size_t l4_len = p->len - info.l3_len;
+        if (info.proto == IPPROTO_TCP && l4_len >= 18) {
+            csum_replace(l4 + 16, dst, to, alen, 0);
+        } else if (info.proto == IPPROTO_UDP && l4_len >= 8) {
+            csum_replace(l4 + 6, dst, to, alen, info.family == AF_INET);
+        } else if (info.proto == IPPROTO_ICMPV6 && l4_len >= 4) {
+            csum_replace(l4 + 2, dst, to, alen, 0);
+        }
+    }
+
+    memcpy(dst, to, alen);
+    if (info.family == AF_INET) ad_tun_ipv4_set_csum(p->data);
+}
+
+/* ---- Reader ---- */
+
+static int lat_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void *reader_thread(void *arg)
+{
+    (void)arg;
+    static char buf[READ_BUF_SIZE];
+    struct pollfd pfd = { .fd = ad_tun_get_fd(), .events = POLLIN };
+
+    while (!__atomic_load_n(&g_reader_stop, __ATOMIC_ACQUIRE)) {
+        if (poll(&pfd, 1, 10) <= 0) continue;
+
+        for (;;) {
+            ssize_t n = ad_tun_read(buf, sizeof(buf));
+            if (n < 0) break;
+
+            uint64_t now = now_ns();
+            __atomic_fetch_add(&g_rx_pkts, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&g_rx_bytes, (uint64_t)n, __ATOMIC_RELAXED);
+
+            uint64_t key = packet_key((const unsigned char *)buf, (size_t)n);
+            inflight_t *e = &g_inflight[key & (INFLIGHT_SLOTS - 1)];
+            if (__atomic_load_n(&e->key, __ATOMIC_ACQUIRE) == key) {
+                uint64_t sent = __atomic_load_n(&e->ts_ns, __ATOMIC_RELAXED);
+                __atomic_store_n(&e->key, 0, __ATOMIC_RELAXED);
+                g_rx_matched++;
+                if (g_lat_count < MAX_LAT_SAMPLES && now >= sent) g_lat[g_lat_count++] = now - sent;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* ---- Writer ---- */
+
+static void wait_until(uint64_t target)
+{
+    uint64_t now = now_ns();
+    if (target > now + SPIN_NS) {
+        uint64_t wake = target - SPIN_NS / 2;
+        struct timespec ts = { (time_t)(wake / 1000000000ULL), (long)(wake % 1000000000ULL) };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    while (now_ns() < target) {
+        /* spin */
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s -c CONFIG -f TRACE [options]\n"
+            "  -c CONFIG   ad_tun INI file describing the device\n"
+            "  -f TRACE    pcap or pcapng file\n"
+            "  -m MODE     recorded (default), rate or flood\n"
+            "  -x SPEED    speed factor for recorded timing (default 1.0)\n"
+            "  -r PPS      packets per second for -m rate\n"
+            "  -n LOOPS    replay the trace LOOPS times (default 1)\n"
+            "  -d ADDR     rewrite IPv4 destinations to ADDR\n"
+            "  -D ADDR     rewrite IPv6 destinations to ADDR\n"
+            "  -w MS       keep reading MS milliseconds after the last write (default %d)\n",
+            prog, DEFAULT_DRAIN_MS);
+}
+
+int main(int argc, char **argv)
+{
+    const char *cfg_path = NULL, *trace_path = NULL;
+    replay_mode_t mode = MODE_RECORDED;
+    double speed = 1.0;
+    double pps = 0;
+    unsigned long loops = 1;
+    unsigned drain_ms = DEFAULT_DRAIN_MS;
+    struct in_addr dst4;
+    struct in6_addr dst6;
+    int have_dst4 = 0, have_dst6 = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:f:m:x:r:n:d:D:w:h")) != -1) {
+        switch (opt) {
+        case 'c': cfg_path = optarg; break;
+        case 'f': trace_path = optarg; break;
+        case 'm':
+            if (strcmp(optarg, "recorded") == 0) mode = MODE_RECORDED;
+            else if (strcmp(optarg, "rate") == 0) mode = MODE_RATE;
+            else if (strcmp(optarg, "flood") == 0) mode = MODE_FLOOD;
+            else { usage(argv[0]); return 2; }
+            break;
+        case 'x': speed = atof(optarg); break;
+        case 'r': pps = atof(optarg); break;
+        case 'n': loops = strtoul(optarg, NULL, 10); break;
+        case 'd':
+            if (inet_pton(AF_INET, optarg, &dst4) != 1) { usage(argv[0]); return 2; }
+            have_dst4 = 1;
+            break;
+        case 'D':
+            if (inet_pton(AF_INET6, optarg, &dst6) != 1) { usage(argv[0]); return 2; }
+            have_dst6 = 1;
+            break;
+        case 'w': drain_ms = (unsigned)strtoul(optarg, NULL, 10); break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+
+    if (!cfg_path || !trace_path || loops == 0 || speed <= 0 ||
+        (mode == MODE_RATE && pps <= 0)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    /* Load and index the trace */
+    size_t map_size;
+    unsigned char *map = map_trace(trace_path, &map_size);
+    if (!map) return 1;
+
+    replay_trace_t trace = {0};
+    uint32_t magic = rd32(map, 0);
+    int rc = (magic == 0x0A0D0D0A) ? load_pcapng(&trace, map, map_size)
+                                   : (magic == 0xa1b2c3d4 || magic == 0xd4c3b2a1 ||
+                                      magic == 0xa1b23c4d || magic == 0x4d3cb2a1)
+                                   ? load_pcap(&trace, map, map_size) : -1;
+    if (rc != 0 || trace.count == 0) {
+        fprintf(stderr, "ad_tun_replay: no IP packets in %s\n", trace_path);
+        return 1;
+    }
+
+    uint64_t trace_bytes = 0;
+    for (size_t i = 0; i < trace.count; i++) {
+        /* Out-of-order capture times (merged files, clock steps) would wrap
+         * the unsigned offsets below: hold them at the previous packet's */
+        if (i > 0 && trace.pkts[i].ts_ns < trace.pkts[i - 1].ts_ns) {
+            trace.pkts[i].ts_ns = trace.pkts[i - 1].ts_ns;
+        }
+        readdress(&trace.pkts[i], have_dst4 ? &dst4 : NULL, have_dst6 ? &dst6 : NULL);
+        trace.pkts[i].key = packet_key(trace.pkts[i].data, trace.pkts[i].len);
+        trace_bytes += trace.pkts[i].len;
+    }
+    printf("trace: %zu IP packets, %llu bytes, %zu frames skipped\n",
+           trace.count, (unsigned long long)trace_bytes, trace.skipped);
+
+    /* Bring the device up */
+    ad_tun_config_t cfg;
+    ad_tun_error_t err = ad_tun_load_config(cfg_path, &cfg);
+    if (err == AD_TUN_OK) err = ad_tun_init(&cfg);
+    if (err == AD_TUN_OK) err = ad_tun_start();
+    if (err != AD_TUN_OK) {
+        fprintf(stderr, "ad_tun_replay: cannot start device: %s\n", ad_tun_strerror(err));
+        return 1;
+    }
+
+    g_lat = malloc(MAX_LAT_SAMPLES * sizeof(*g_lat));
+    if (!g_lat) return 1;
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    pthread_t reader;
+    if (pthread_create(&reader, NULL, reader_thread, NULL) != 0) {
+        fprintf(stderr, "ad_tun_replay: cannot start reader thread\n");
+        return 1;
+    }
+
+    /* Replay */
+    uint64_t span = trace.pkts[trace.count - 1].ts_ns - trace.pkts[0].ts_ns;
+    uint64_t gap = (trace.count > 1) ? span / (trace.count - 1) : 0;
+    uint64_t tx_pkts = 0, tx_bytes = 0, tx_errors = 0;
+    uint64_t start = now_ns();
+
+    for (unsigned long loop = 0; loop < loops && !g_interrupted; loop++) {
+        for (size_t i = 0; i < trace.count && !g_interrupted; i++) {
+            replay_pkt_t *p = &trace.pkts[i];
+
+            if (mode == MODE_RECORDED) {
+                uint64_t rel = loop * (span + gap) + (p->ts_ns - trace.pkts[0].ts_ns);
+                wait_until(start + (uint64_t)((double)rel / speed));
+            } else if (mode == MODE_RATE) {
+                wait_until(start + (uint64_t)((double)tx_pkts * 1e9 / pps));
+            }
+
+            inflight_t *e = &g_inflight[p->key & (INFLIGHT_SLOTS - 1)];
+            __atomic_store_n(&e->ts_ns, now_ns(), __ATOMIC_RELAXED);
+            __atomic_store_n(&e->key, p->key, __ATOMIC_RELEASE);
+
+            ssize_t n;
+            while ((n = ad_tun_write((const char *)p->data, p->len)) == -EAGAIN && !g_interrupted) {
+                /* device queue full, retry */
+            }
+            if (n < 0) {
+                tx_errors++;
+                continue;
+            }
+            tx_pkts++;
+            tx_bytes += p->len;
+        }
+    }
+
+    uint64_t tx_end = now_ns();
+
+    /* Let the tail of the trace come back before stopping the reader */
+    uint64_t last_rx = __atomic_load_n(&g_rx_pkts, __ATOMIC_RELAXED);
+    uint64_t idle_since = now_ns();
+    while (!g_interrupted && now_ns() - idle_since < (uint64_t)drain_ms * 1000000ULL) {
+        usleep(1000);
+        uint64_t rx = __atomic_load_n(&g_rx_pkts, __ATOMIC_RELAXED);
+        if (rx != last_rx) {
+            last_rx = rx;
+            idle_since = now_ns();
+        }
+    }
+    __atomic_store_n(&g_reader_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(reader, NULL);
+
+    ad_tun_stop();
+    ad_tun_cleanup();
+    ad_tun_free_config(&cfg);
+
+    /* Report */
+    double secs = (double)(tx_end - start) / 1e9;
+    if (secs <= 0) secs = 1e-9;
+
+    printf("tx: %llu packets, %llu bytes, %llu errors in %.3f s\n",
+           (unsigned long long)tx_pkts, (unsigned long long)tx_bytes,
+           (unsigned long long)tx_errors, secs);
+    printf("tx rate: %.0f pps, %.3f Gbps\n", (double)tx_pkts / secs, (double)tx_bytes * 8 / secs / 1e9);
+    printf("rx: %llu packets, %llu bytes, %llu matched to a write\n",
+           (unsigned long long)g_rx_pkts, (unsigned long long)g_rx_bytes,
+           (unsigned long long)g_rx_matched);
+
+    if (g_lat_count > 0) {
+        qsort(g_lat, g_lat_count, sizeof(*g_lat), lat_cmp);
+        const double pct[] = { 50, 90, 99, 99.9 };
+        printf("latency (us):");
+        for (size_t i = 0; i < sizeof(pct) / sizeof(pct[0]); i++) {
+            size_t idx = (size_t)((double)(g_lat_count - 1) * pct[i] / 100.0);
+            printf(" p%g=%.1f", pct[i], (double)g_lat[idx] / 1000.0);
+        }
+        printf(" max=%.1f\n", (double)g_lat[g_lat_count - 1] / 1000.0);
+    } else {
+        printf("latency: no packets came back (use -d/-D with forwarding enabled)\n");
+    }
+
+    free(g_lat);
+    free(trace.pkts);
+    munmap(map, map_size);
+    return g_interrupted ? 130 : 0;
+}